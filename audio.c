@@ -0,0 +1,482 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifdef HAVE_ALSA
+#include <alsa/asoundlib.h>
+#endif
+
+#include "audio.h"
+
+#define audio_load(x) __atomic_load_n (&(x), __ATOMIC_ACQUIRE)
+#define audio_store(x, v) __atomic_store_n (&(x), (v), __ATOMIC_RELEASE)
+
+//Time the thread waits for the data of a pipe before checking if it has to
+//stop (ms)
+#define AUDIO_POLL_TIMEOUT 100
+
+static int64_t audio_time (){
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  return (int64_t)spec.tv_sec*1000000 + spec.tv_nsec/1000;
+}
+
+static void audio_invalid (const char* spec){
+  fprintf (stderr, "error: invalid audio source: %s\n", spec);
+  exit (1);
+}
+
+//Copies the path or the device, the options start at the first ,rate= or
+//,channels= (an ALSA device can have commas)
+static void audio_parse (audio_t* audio, const char* spec, const char* path){
+  const char* options = path;
+  while ((options = strchr (options, ','))){
+    if (!strncmp (options, ",rate=", 6) ||
+        !strncmp (options, ",channels=", 10)){
+      break;
+    }
+    options++;
+  }
+  if (!options) options = path + strlen (path);
+  if (options == path || options - path >= (int)sizeof (audio->path)){
+    audio_invalid (spec);
+  }
+  memcpy (audio->path, path, options - path);
+  audio->path[options - path] = 0;
+
+  while (*options){
+    options++;
+    if (sscanf (options, "rate=%u", &audio->rate) != 1 &&
+        sscanf (options, "channels=%u", &audio->channels) != 1){
+      audio_invalid (spec);
+    }
+    options += strcspn (options, ",");
+  }
+}
+
+static uint32_t audio_le16 (const uint8_t* p){
+  return p[0] | (p[1] << 8);
+}
+
+static uint32_t audio_le32 (const uint8_t* p){
+  return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+//Reads the header of a WAV file until the data chunk
+static void audio_wav_header (audio_t* audio){
+  uint8_t header[16];
+  uint32_t length;
+  int format = 0;
+
+  if (read (audio->fd, header, 12) != 12 || memcmp (header, "RIFF", 4) ||
+      memcmp (header + 8, "WAVE", 4)){
+    fprintf (stderr, "error: audio: %s is not a WAV file\n", audio->path);
+    exit (1);
+  }
+  while (1){
+    if (read (audio->fd, header, 8) != 8){
+      fprintf (stderr, "error: audio: %s has no data\n", audio->path);
+      exit (1);
+    }
+    length = audio_le32 (header + 4);
+    if (!memcmp (header, "data", 4)) break;
+    if (!memcmp (header, "fmt ", 4) && length >= 16){
+      if (read (audio->fd, header, 16) != 16){
+        fprintf (stderr, "error: audio: %s is truncated\n", audio->path);
+        exit (1);
+      }
+      //PCM, 16 bits
+      if (audio_le16 (header) != 1 || audio_le16 (header + 14) != 16){
+        fprintf (stderr, "error: audio: %s is not 16-bit PCM\n",
+            audio->path);
+        exit (1);
+      }
+      audio->channels = audio_le16 (header + 2);
+      audio->rate = audio_le32 (header + 4);
+      format = 1;
+      length -= 16;
+    }
+    //Chunks are padded to 2 bytes
+    if (lseek (audio->fd, length + (length & 1), SEEK_CUR) == -1){
+      fprintf (stderr, "error: lseek\n");
+      exit (1);
+    }
+  }
+  if (!format){
+    fprintf (stderr, "error: audio: %s has no format\n", audio->path);
+    exit (1);
+  }
+}
+
+void audio_open (audio_t* audio, const char* spec){
+  memset (audio, 0, sizeof (audio_t));
+  audio->spec = spec;
+  audio->fd = -1;
+  audio->rate = AUDIO_RATE;
+  audio->channels = AUDIO_CHANNELS;
+
+  if (!strncmp (spec, "alsa:", 5)){
+    audio->type = AUDIO_ALSA;
+    audio_parse (audio, spec, spec + 5);
+  }else if (!strncmp (spec, "wav:", 4)){
+    audio->type = AUDIO_WAV;
+    if (strlen (spec + 4) >= sizeof (audio->path) || !spec[4]){
+      audio_invalid (spec);
+    }
+    strcpy (audio->path, spec + 4);
+  }else if (!strncmp (spec, "pcm:", 4)){
+    audio->type = AUDIO_PCM;
+    audio_parse (audio, spec, spec + 4);
+  }else{
+    audio_invalid (spec);
+  }
+
+  if (audio->type == AUDIO_ALSA){
+#ifdef HAVE_ALSA
+    snd_pcm_t* pcm;
+    int error;
+    if ((error = snd_pcm_open (&pcm, audio->path, SND_PCM_STREAM_CAPTURE,
+        0)) < 0){
+      fprintf (stderr, "error: snd_pcm_open: %s\n", snd_strerror (error));
+      exit (1);
+    }
+    //The driver buffers 4 periods, it resamples if the rate is not supported
+    if ((error = snd_pcm_set_params (pcm, SND_PCM_FORMAT_S16_LE,
+        SND_PCM_ACCESS_RW_INTERLEAVED, audio->channels, audio->rate, 1,
+        4*AUDIO_PERIOD*1000)) < 0){
+      fprintf (stderr, "error: snd_pcm_set_params: %s\n",
+          snd_strerror (error));
+      exit (1);
+    }
+    audio->pcm = pcm;
+#else
+    fprintf (stderr, "error: audio: built without ALSA\n");
+    exit (1);
+#endif
+  }else{
+    if (!strcmp (audio->path, "-")){
+      audio->fd = STDIN_FILENO;
+    }else if ((audio->fd = open (audio->path, O_RDONLY)) == -1){
+      fprintf (stderr, "error: open\n");
+      exit (1);
+    }
+    struct stat st;
+    if (fstat (audio->fd, &st)){
+      fprintf (stderr, "error: fstat\n");
+      exit (1);
+    }
+    audio->paced = S_ISREG (st.st_mode);
+    if (audio->type == AUDIO_WAV){
+      audio_wav_header (audio);
+    }
+  }
+
+  //The rate is written in 16.16 fixed point in the MP4 sample entry
+  if (audio->rate < 8000 || audio->rate > 48000 || !audio->channels ||
+      audio->channels > AUDIO_CHANNELS_MAX){
+    fprintf (stderr, "error: audio: unsupported format, %u Hz, %u channels\n",
+        audio->rate, audio->channels);
+    exit (1);
+  }
+
+  audio->period_frames = audio->rate*AUDIO_PERIOD/1000;
+  for (audio->ring_frames=1; audio->ring_frames<audio->rate*AUDIO_RING;
+      audio->ring_frames*=2);
+  audio->ring = malloc (audio->ring_frames*audio->channels*sizeof (int16_t));
+  if (!audio->ring){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+}
+
+//Adds a point to the line of the sample clock and publishes the frames
+static void audio_update (audio_t* audio, int64_t frames, int64_t time){
+  audio_clock_t clock = audio->clock;
+
+  if (!audio->clock_valid){
+    clock.position = frames;
+    clock.time = time;
+    clock.rate = audio->rate;
+    audio->rate_position = frames;
+    audio->rate_time = time;
+  }else{
+    int64_t predicted = clock.time +
+        (int64_t)((frames - clock.position)*1.0e6/clock.rate);
+    int64_t error = time - predicted;
+    clock.position = frames;
+    clock.time = predicted + (error < 0 ? error : error/AUDIO_SMOOTHING);
+    if (clock.time - audio->rate_time >= AUDIO_RATE_PERIOD*1000000LL){
+      double rate = (frames - audio->rate_position)*1.0e6/
+          (clock.time - audio->rate_time);
+      //Far from the nominal rate it's a gap in the capture, not a drift
+      if (rate > audio->rate*0.99 && rate < audio->rate*1.01){
+        clock.rate += (rate - clock.rate)/4;
+      }
+      audio->rate_position = frames;
+      audio->rate_time = clock.time;
+    }
+  }
+
+  audio_store (audio->sequence, audio->sequence + 1);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  audio->frames = frames;
+  audio->clock = clock;
+  audio->clock_valid = 1;
+  audio_store (audio->sequence, audio->sequence + 1);
+}
+
+//Reads at most length frames at the position of the ring. Returns the number
+//of frames, 0 if there's nothing to read yet and -1 at the end
+static int audio_read (
+    audio_t* audio,
+    int16_t* data,
+    uint32_t length,
+    int64_t* delay){
+  *delay = 0;
+
+#ifdef HAVE_ALSA
+  if (audio->pcm){
+    snd_pcm_sframes_t n = snd_pcm_readi (audio->pcm, data, length);
+    if (n < 0){
+      //Overrun of the driver, the next samples come after a gap
+      audio->errors++;
+      if (snd_pcm_recover (audio->pcm, n, 1) < 0){
+        fprintf (stderr, "error: audio: snd_pcm_readi: %s\n",
+            snd_strerror (n));
+        return -1;
+      }
+      return 0;
+    }
+    snd_pcm_sframes_t frames;
+    if (!snd_pcm_delay (audio->pcm, &frames)){
+      *delay = frames;
+    }
+    return n;
+  }
+#endif
+
+  uint32_t size = audio->channels*sizeof (int16_t);
+  if (!audio->paced){
+    struct pollfd pfd;
+    pfd.fd = audio->fd;
+    pfd.events = POLLIN;
+    if (poll (&pfd, 1, AUDIO_POLL_TIMEOUT) != 1) return 0;
+  }
+  ssize_t n = read (audio->fd, data, length*size);
+  if (n == -1){
+    if (errno == EINTR || errno == EAGAIN) return 0;
+    fprintf (stderr, "error: audio: read: %s\n", strerror (errno));
+    return -1;
+  }
+  if (!n) return -1;
+  //A partial frame is completed with the next read
+  while (n % size){
+    ssize_t m = read (audio->fd, (uint8_t*)data + n, size - n % size);
+    if (m <= 0) return -1;
+    n += m;
+  }
+  return n/size;
+}
+
+static void* audio_thread (void* arg){
+  audio_t* audio = arg;
+  int64_t frames = 0;
+  int64_t start = audio_time ();
+  int64_t delay;
+  int n;
+
+  while (audio->running){
+    //A regular file is read at the sample rate
+    if (audio->paced){
+      int64_t next = start + frames*1000000/audio->rate;
+      struct timespec spec;
+      spec.tv_sec = next/1000000;
+      spec.tv_nsec = (next%1000000)*1000;
+      clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &spec, 0);
+    }
+
+    //The data goes straight to the ring, up to its end
+    uint32_t index = frames & (audio->ring_frames - 1);
+    uint32_t length = audio->period_frames;
+    if (length > audio->ring_frames - index){
+      length = audio->ring_frames - index;
+    }
+    n = audio_read (audio, audio->ring + index*audio->channels, length,
+        &delay);
+    if (n == -1){
+      printf ("audio: end of %s\n", audio->spec);
+      break;
+    }
+    if (!n) continue;
+    frames += n;
+    audio_update (audio, frames, audio_time () - delay*1000000/audio->rate);
+  }
+
+  return 0;
+}
+
+void audio_start (audio_t* audio){
+  audio->running = 1;
+  if (pthread_create (&audio->thread, 0, audio_thread, audio)){
+    fprintf (stderr, "error: pthread_create\n");
+    exit (1);
+  }
+}
+
+void audio_stop (audio_t* audio){
+  if (!audio->running) return;
+  audio->running = 0;
+  pthread_join (audio->thread, 0);
+}
+
+int audio_dump (audio_t* audio, char* str, size_t size){
+  return snprintf (str, size, "%lld frames, %u Hz (measured %.2f), %u "
+      "channels, %u errors", (long long)audio->frames, audio->rate,
+      audio->clock_valid ? audio->clock.rate : 0.0, audio->channels,
+      audio->errors);
+}
+
+void audio_close (audio_t* audio){
+  audio_stop (audio);
+#ifdef HAVE_ALSA
+  if (audio->pcm) snd_pcm_close (audio->pcm);
+#endif
+  if (audio->fd > STDIN_FILENO) close (audio->fd);
+  free (audio->ring);
+}
+
+void audio_sync_init (audio_sync_t* sync, audio_t* audio){
+  sync->audio = audio;
+  sync->offset = 0;
+  sync->offset_valid = 0;
+}
+
+void audio_sync_frame (audio_sync_t* sync, int64_t timestamp, int64_t arrival){
+  int64_t offset = arrival - timestamp;
+  //Like the sample clock, it follows the earliest buffers and a later one
+  //moves it a bit, so a camera clock slower than CLOCK_MONOTONIC is followed
+  if (!sync->offset_valid || offset < sync->offset){
+    sync->offset = offset;
+    sync->offset_valid = 1;
+  }else{
+    sync->offset += (offset - sync->offset)/AUDIO_SMOOTHING;
+  }
+}
+
+void audio_reader_start (
+    audio_reader_t* reader,
+    audio_sync_t* sync,
+    const char* name,
+    int64_t timestamp){
+  memset (reader, 0, sizeof (audio_reader_t));
+  reader->sync = sync;
+  reader->name = name;
+  reader->origin = timestamp;
+  reader->cursor = -1;
+  reader->report = audio_time () + AUDIO_REPORT_PERIOD*1000000LL;
+}
+
+uint32_t audio_reader_read (
+    audio_reader_t* reader,
+    int64_t timestamp,
+    int16_t* data,
+    uint32_t max){
+  audio_t* audio = reader->sync->audio;
+  uint32_t size = audio->channels*sizeof (int16_t);
+  audio_clock_t clock;
+  int64_t frames;
+  int valid;
+  uint32_t sequence;
+
+  do{
+    while ((sequence = audio_load (audio->sequence)) & 1);
+    frames = audio->frames;
+    clock = audio->clock;
+    valid = audio->clock_valid;
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  }while (audio_load (audio->sequence) != sequence);
+
+  //Frames of the source until the timestamp, the ones not captured yet are
+  //taken the next time
+  int64_t end = timestamp;
+  int64_t target = frames;
+  if (valid && reader->sync->offset_valid){
+    int64_t time = timestamp + reader->sync->offset - AUDIO_DELAY;
+    target = clock.position +
+        (int64_t)((time - clock.time)*clock.rate/1.0e6);
+    if (reader->cursor == -1){
+      int64_t start = reader->origin + reader->sync->offset - AUDIO_DELAY;
+      reader->cursor = clock.position +
+          (int64_t)((start - clock.time)*clock.rate/1.0e6);
+      if (reader->cursor < 0) reader->cursor = 0;
+    }
+    if (target > frames){
+      end -= (target - frames)*1000000/audio->rate;
+      target = frames;
+    }
+  }
+  if (reader->cursor == -1 || reader->cursor > frames){
+    reader->cursor = frames;
+  }
+  //The oldest frames have been overwritten, or are being overwritten
+  if (reader->cursor < frames - audio->ring_frames + audio->period_frames){
+    reader->lost++;
+    reader->cursor = frames - audio->ring_frames + audio->period_frames;
+  }
+  int64_t available = target > reader->cursor ? target - reader->cursor : 0;
+
+  //The player plays the frames at the nominal rate
+  int64_t expected = (end - reader->origin)*audio->rate/1000000 -
+      reader->written;
+  if (expected < 0) expected = 0;
+  int64_t skew = (available - expected)*1000000/audio->rate;
+  int64_t length = available;
+  if (skew > AUDIO_SKEW_MAX || skew < -AUDIO_SKEW_MAX){
+    length = expected;
+  }
+  if (length > max) length = max;
+  reader->skew_last = skew;
+  if (skew > reader->skew_max || -skew > reader->skew_max){
+    reader->skew_max = skew < 0 ? -skew : skew;
+  }
+
+  //Two copies if the frames wrap around the end of the ring, silence for
+  //the missing ones
+  int64_t copied = length < available ? length : available;
+  uint32_t index = reader->cursor & (audio->ring_frames - 1);
+  uint32_t first = audio->ring_frames - index;
+  if (first > copied) first = copied;
+  memcpy (data, audio->ring + index*audio->channels, first*size);
+  memcpy ((uint8_t*)data + first*size, audio->ring,
+      (copied - first)*size);
+  memset ((uint8_t*)data + copied*size, 0, (length - copied)*size);
+  reader->inserted += length - copied;
+  reader->dropped += available - copied;
+  reader->cursor += available;
+  reader->written += length;
+
+  int64_t now = audio_time ();
+  if (now >= reader->report){
+    char str[256];
+    audio_reader_dump (reader, str, sizeof (str));
+    printf ("audio %s: %s\n", reader->name, str);
+    reader->report = now + AUDIO_REPORT_PERIOD*1000000LL;
+  }
+
+  return length;
+}
+
+int audio_reader_dump (audio_reader_t* reader, char* str, size_t size){
+  audio_t* audio = reader->sync->audio;
+  return snprintf (str, size, "%.1f s, skew %.1f ms (max %.1f ms), %lld "
+      "frames inserted, %lld dropped, %u losses",
+      (double)reader->written/audio->rate, reader->skew_last/1000.0,
+      reader->skew_max/1000.0, (long long)reader->inserted,
+      (long long)reader->dropped, reader->lost);
+}
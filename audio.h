@@ -0,0 +1,159 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Audio source (-a), muxed with the video by the MP4 outputs. The samples are
+16-bit PCM, passed through as they are ('sowt' track):
+
+  alsa:DEVICE[,rate=HZ][,channels=N]
+                ALSA capture device, e.g. alsa:hw:1,0 or alsa:default
+  wav:PATH      16-bit PCM WAV file, read at its own rate, for testing without
+                a microphone
+  pcm:PATH[,rate=HZ][,channels=N]
+                raw signed 16-bit little-endian samples, PATH can be - (stdin)
+                or a named pipe, e.g. arecord -t raw ... | ./h264 -a pcm:-
+
+A thread reads the samples into a ring, period by period, and the MP4 outputs
+take them from there when they write a fragment. Nothing waits: the video path
+never blocks on the audio, a reader that falls more than the ring behind loses
+the oldest samples and the thread never waits for the readers.
+
+The sample clock is mapped to CLOCK_MONOTONIC. Every read gives a point, its
+time minus the samples still buffered by the driver, and the line through the
+points follows the earliest ones (the reads wake up late, never early). Its
+slope, the real sample rate, is measured every AUDIO_RATE_PERIOD s. Each camera
+maps its timestamps (nTimeStamp) to the same clock with the lowest difference
+between the arrival of its buffers and their timestamps, like the relative
+latency (see latency.h), followed the same way, so AUDIO_DELAY is the minimum
+time from the capture of a frame to the arrival of its buffer.
+
+Drift correction: the player plays the samples at the nominal rate, so the
+reader compares the number of samples written with the duration of the video.
+When the difference, the A/V skew, is bigger than AUDIO_SKEW_MAX, the missing
+samples are filled with silence or the extra ones are dropped. The skew is
+printed every AUDIO_REPORT_PERIOD s and when the output is closed.
+*/
+
+#define AUDIO_RATE 48000
+#define AUDIO_CHANNELS 1
+#define AUDIO_CHANNELS_MAX 2
+//Samples per read (ms)
+#define AUDIO_PERIOD 20
+//Capacity of the ring (s), more than the longest MP4 fragment with audio
+#define AUDIO_RING 4
+//Interval between measures of the real sample rate (s)
+#define AUDIO_RATE_PERIOD 10
+//A later point of the sample clock moves the line 1/AUDIO_SMOOTHING of the way
+#define AUDIO_SMOOTHING 64
+//Skew corrected by inserting or dropping samples (us)
+#define AUDIO_SKEW_MAX 10000
+//Minimum latency from the capture of a frame to the arrival of its buffer (us)
+#define AUDIO_DELAY 0
+//Interval between the reports of the skew (s)
+#define AUDIO_REPORT_PERIOD 60
+
+typedef enum {
+  AUDIO_ALSA,
+  AUDIO_WAV,
+  AUDIO_PCM
+} audio_type_t;
+
+//Line of the sample clock: the sample at position was captured at time (us,
+//CLOCK_MONOTONIC), rate samples per second
+typedef struct {
+  int64_t position;
+  int64_t time;
+  double rate;
+} audio_clock_t;
+
+typedef struct {
+  const char* spec;
+  audio_type_t type;
+  char path[256];
+  int fd;
+  //snd_pcm_t
+  void* pcm;
+  //Regular files are read at the sample rate
+  int paced;
+  uint32_t rate;
+  uint32_t channels;
+  //Frames (a sample of every channel) read so far, the last AUDIO_RING s are
+  //in the ring. The frames and the clock are published together, with a
+  //sequence number that is odd while they change
+  int16_t* ring;
+  uint32_t ring_frames;
+  uint32_t period_frames;
+  volatile uint32_t sequence;
+  int64_t frames;
+  audio_clock_t clock;
+  int clock_valid;
+  //Last measure of the rate, used only by the thread
+  int64_t rate_position;
+  int64_t rate_time;
+  pthread_t thread;
+  volatile int running;
+  //Read errors of the driver (overruns)
+  uint32_t errors;
+} audio_t;
+
+//Timestamps of a camera mapped to CLOCK_MONOTONIC, updated by the encoder loop
+typedef struct {
+  audio_t* audio;
+  int64_t offset;
+  int offset_valid;
+} audio_sync_t;
+
+//Samples of an output, used from the encoder loop
+typedef struct {
+  audio_sync_t* sync;
+  const char* name;
+  //Timestamp of the video at the first sample (us)
+  int64_t origin;
+  //Next frame of the source, -1 until it's known
+  int64_t cursor;
+  //Frames given to the output
+  int64_t written;
+  //Statistics, the skew is positive when the audio is ahead (us)
+  int64_t skew_last;
+  int64_t skew_max;
+  int64_t inserted;
+  int64_t dropped;
+  uint32_t lost;
+  int64_t report;
+} audio_reader_t;
+
+//Parses the specification and opens the source, exits on error
+void audio_open (audio_t* audio, const char* spec);
+//Starts the thread
+void audio_start (audio_t* audio);
+//Stops the thread, the ring can still be read
+void audio_stop (audio_t* audio);
+//Prints the statistics in a string
+int audio_dump (audio_t* audio, char* str, size_t size);
+void audio_close (audio_t* audio);
+
+void audio_sync_init (audio_sync_t* sync, audio_t* audio);
+//Called with the first buffer of every frame
+void audio_sync_frame (audio_sync_t* sync, int64_t timestamp, int64_t arrival);
+
+//The first sample is the one captured with the frame of the timestamp
+void audio_reader_start (
+    audio_reader_t* reader,
+    audio_sync_t* sync,
+    const char* name,
+    int64_t timestamp);
+//Copies the frames until the timestamp, max at most, with the drift
+//corrected. Returns the number of frames
+uint32_t audio_reader_read (
+    audio_reader_t* reader,
+    int64_t timestamp,
+    int16_t* data,
+    uint32_t max);
+//Prints the skew in a string
+int audio_reader_dump (audio_reader_t* reader, char* str, size_t size);
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef BITS_H
+#define BITS_H
+
+#include <endian.h>
+#include <stdint.h>
+#include <string.h>
+
+/*
+Bit reader for the RBSP of the NAL units. It reads a 64-bit big-endian window
+at a time, so a fixed-length field or an Exp-Golomb code (up to 28 leading
+zeros) is decoded without loops. The emulation prevention bytes (00 00 03) must
+be removed before with bits_unescape().
+
+Reading past the end returns zeros and sets the position beyond the end, which
+is checked with bits_overrun().
+*/
+
+typedef struct {
+  const uint8_t* data;
+  uint32_t length;
+  //Bits
+  uint32_t position;
+} bits_t;
+
+static inline void bits_init (bits_t* bits, const uint8_t* data,
+    uint32_t length){
+  bits->data = data;
+  bits->length = length;
+  bits->position = 0;
+}
+
+//Copies up to size bytes of the NAL unit without the emulation prevention
+//bytes. Returns the length of the RBSP
+static inline uint32_t bits_unescape (uint8_t* rbsp, uint32_t size,
+    const uint8_t* data, uint32_t length){
+  uint32_t zeros = 0;
+  uint32_t n = 0;
+  uint32_t i;
+  for (i=0; i<length && n<size; i++){
+    if (zeros >= 2 && data[i] == 3){
+      zeros = 0;
+      continue;
+    }
+    zeros = data[i] ? 0 : zeros + 1;
+    rbsp[n++] = data[i];
+  }
+  return n;
+}
+
+static inline uint64_t bits_peek (bits_t* bits){
+  uint32_t byte = bits->position >> 3;
+  uint64_t value = 0;
+  int i;
+  if (byte + 8 <= bits->length){
+    memcpy (&value, bits->data + byte, 8);
+    value = be64toh (value);
+  }else{
+    for (i=0; i<8; i++){
+      value = (value << 8) |
+          (byte + i < bits->length ? bits->data[byte + i] : 0);
+    }
+  }
+  return value << (bits->position & 7);
+}
+
+//n <= 32
+static inline uint32_t bits_read (bits_t* bits, int n){
+  if (!n) return 0;
+  uint32_t value = bits_peek (bits) >> (64 - n);
+  bits->position += n;
+  return value;
+}
+
+static inline void bits_skip (bits_t* bits, uint32_t n){
+  bits->position += n;
+}
+
+//Unsigned Exp-Golomb code, ue(v)
+static inline uint32_t bits_ue (bits_t* bits){
+  uint64_t value = bits_peek (bits);
+  int zeros = value ? __builtin_clzll (value) : 64;
+  if (zeros > 28){
+    bits->position = bits->length*8 + 1;
+    return 0;
+  }
+  bits->position += 2*zeros + 1;
+  return (uint32_t)(value >> (63 - 2*zeros)) - 1;
+}
+
+//Signed Exp-Golomb code, se(v)
+static inline int32_t bits_se (bits_t* bits){
+  uint32_t value = bits_ue (bits);
+  return value & 1 ? (int32_t)((value + 1) >> 1) : -(int32_t)(value >> 1);
+}
+
+static inline int bits_overrun (bits_t* bits){
+  return bits->position > bits->length*8;
+}
+
+#endif
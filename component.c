@@ -0,0 +1,370 @@
+#include "component.h"
+
+static OMX_ERRORTYPE component_fail (
+    component_t* component,
+    const char* call,
+    OMX_ERRORTYPE error){
+  component->call = call;
+  return error;
+}
+
+//Function that is called when a component receives an event from a secondary
+//thread
+static OMX_ERRORTYPE component_event_handler (
+    OMX_IN OMX_HANDLETYPE comp,
+    OMX_IN OMX_PTR app_data,
+    OMX_IN OMX_EVENTTYPE event,
+    OMX_IN OMX_U32 data1,
+    OMX_IN OMX_U32 data2,
+    OMX_IN OMX_PTR event_data){
+  component_t* component = (component_t*)app_data;
+  VCOS_UNSIGNED set = 0;
+
+  switch (event){
+    case OMX_EventCmdComplete:
+      switch (data1){
+        case OMX_CommandStateSet:
+          set = EVENT_STATE_SET;
+          break;
+        case OMX_CommandPortDisable:
+          set = EVENT_PORT_DISABLE;
+          break;
+        case OMX_CommandPortEnable:
+          set = EVENT_PORT_ENABLE;
+          break;
+        case OMX_CommandFlush:
+          set = EVENT_FLUSH;
+          break;
+        case OMX_CommandMarkBuffer:
+          set = EVENT_MARK_BUFFER;
+          break;
+        default:
+          break;
+      }
+      break;
+    case OMX_EventError:
+      component->event_error = data1;
+      set = EVENT_ERROR;
+      break;
+    case OMX_EventMark:
+      set = EVENT_MARK;
+      break;
+    case OMX_EventPortSettingsChanged:
+      set = EVENT_PORT_SETTINGS_CHANGED;
+      break;
+    case OMX_EventParamOrConfigChanged:
+      set = EVENT_PARAM_OR_CONFIG_CHANGED;
+      break;
+    case OMX_EventBufferFlag:
+      set = EVENT_BUFFER_FLAG;
+      break;
+    case OMX_EventResourcesAcquired:
+      set = EVENT_RESOURCES_ACQUIRED;
+      break;
+    case OMX_EventDynamicResourcesAvailable:
+      set = EVENT_DYNAMIC_RESOURCES_AVAILABLE;
+      break;
+    default:
+      //This should never execute, just ignore
+      break;
+  }
+  if (component->callbacks && component->callbacks->event){
+    component->callbacks->event (component, event, data1, data2);
+  }
+  if (set) vcos_event_flags_set (&component->flags, set, VCOS_OR);
+
+  return OMX_ErrorNone;
+}
+
+//Function that is called when a component fills a buffer with data
+static OMX_ERRORTYPE component_fill_buffer_done (
+    OMX_IN OMX_HANDLETYPE comp,
+    OMX_IN OMX_PTR app_data,
+    OMX_IN OMX_BUFFERHEADERTYPE* buffer){
+  component_t* component = (component_t*)app_data;
+
+  if (component->callbacks && component->callbacks->fill_buffer_done){
+    component->callbacks->fill_buffer_done (component, buffer);
+  }
+  return OMX_ErrorNone;
+}
+
+//Function that is called when a component has consumed an input buffer
+static OMX_ERRORTYPE component_empty_buffer_done (
+    OMX_IN OMX_HANDLETYPE comp,
+    OMX_IN OMX_PTR app_data,
+    OMX_IN OMX_BUFFERHEADERTYPE* buffer){
+  component_t* component = (component_t*)app_data;
+
+  if (component->callbacks && component->callbacks->empty_buffer_done){
+    component->callbacks->empty_buffer_done (component, buffer);
+  }
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE component_init (
+    component_t* component,
+    OMX_STRING name,
+    const component_callbacks_t* callbacks,
+    void* data){
+  OMX_ERRORTYPE error;
+
+  component->handle = 0;
+  component->call = 0;
+
+  //Create the event flags. Without them the component has no name, there's
+  //nothing to deinitialize
+  if (vcos_event_flags_create (&component->flags, "component")){
+    return component_fail (component, "vcos_event_flags_create",
+        OMX_ErrorInsufficientResources);
+  }
+  component->name = name;
+  component->callbacks = callbacks;
+  component->data = data;
+  component->event_error = OMX_ErrorNone;
+
+  //Each component has an event_handler, fill_buffer_done and
+  //empty_buffer_done functions
+  OMX_CALLBACKTYPE callbacks_st;
+  callbacks_st.EventHandler = component_event_handler;
+  callbacks_st.FillBufferDone = component_fill_buffer_done;
+  callbacks_st.EmptyBufferDone = component_empty_buffer_done;
+
+  //Get the handle
+  if ((error = OMX_GetHandle (&component->handle, name, component,
+      &callbacks_st))){
+    component->handle = 0;
+    return component_fail (component, "OMX_GetHandle", error);
+  }
+
+  //Disable all the ports
+  OMX_INDEXTYPE types[] = {
+    OMX_IndexParamAudioInit,
+    OMX_IndexParamVideoInit,
+    OMX_IndexParamImageInit,
+    OMX_IndexParamOtherInit
+  };
+  OMX_PORT_PARAM_TYPE ports_st;
+  OMX_INIT_STRUCTURE (ports_st);
+
+  int i;
+  for (i=0; i<4; i++){
+    if ((error = OMX_GetParameter (component->handle, types[i], &ports_st))){
+      return component_fail (component, "OMX_GetParameter", error);
+    }
+
+    OMX_U32 port;
+    for (port=ports_st.nStartPortNumber;
+        port<ports_st.nStartPortNumber + ports_st.nPorts; port++){
+      if ((error = component_command (component, OMX_CommandPortDisable,
+          port)) ||
+          (error = component_wait (component, EVENT_PORT_DISABLE, 0))){
+        return error;
+      }
+    }
+  }
+
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE component_deinit (component_t* component){
+  OMX_ERRORTYPE error = OMX_ErrorNone;
+
+  vcos_event_flags_delete (&component->flags);
+  if (component->handle && (error = OMX_FreeHandle (component->handle))){
+    component_fail (component, "OMX_FreeHandle", error);
+  }
+  component->handle = 0;
+  return error;
+}
+
+OMX_ERRORTYPE component_wait (
+    component_t* component,
+    VCOS_UNSIGNED events,
+    VCOS_UNSIGNED* retrieved_events){
+  VCOS_UNSIGNED set;
+
+  if (vcos_event_flags_get (&component->flags, events | EVENT_ERROR,
+      VCOS_OR_CONSUME, VCOS_SUSPEND, &set)){
+    return component_fail (component, "vcos_event_flags_get",
+        OMX_ErrorUndefined);
+  }
+  if (set == EVENT_ERROR){
+    return component_fail (component, component->name,
+        component->event_error);
+  }
+  if (retrieved_events){
+    *retrieved_events = set;
+  }
+  return OMX_ErrorNone;
+}
+
+void component_clear (component_t* component){
+  VCOS_UNSIGNED set;
+  vcos_event_flags_get (&component->flags, (VCOS_UNSIGNED)-1, VCOS_OR_CONSUME,
+      VCOS_NO_SUSPEND, &set);
+}
+
+OMX_ERRORTYPE component_command (
+    component_t* component,
+    OMX_COMMANDTYPE command,
+    OMX_U32 param){
+  OMX_ERRORTYPE error;
+
+  if ((error = OMX_SendCommand (component->handle, command, param, 0))){
+    return component_fail (component, "OMX_SendCommand", error);
+  }
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE component_load_camera_drivers (
+    component_t* camera,
+    OMX_U32 device){
+  /*
+  This is a specific behaviour of the Broadcom's Raspberry Pi OpenMAX IL
+  implementation module because the OMX_SetConfig() and OMX_SetParameter() are
+  blocking functions but the drivers are loaded asynchronously, that is, an
+  event is fired to signal the completion. Basically, what you're saying is:
+
+  "When the parameter with index OMX_IndexParamCameraDeviceNumber is set, load
+  the camera drivers and emit an OMX_EventParamOrConfigChanged event"
+
+  The red LED of the camera will be turned on after this call.
+  */
+
+  OMX_ERRORTYPE error;
+
+  OMX_CONFIG_REQUESTCALLBACKTYPE cbs_st;
+  OMX_INIT_STRUCTURE (cbs_st);
+  cbs_st.nPortIndex = OMX_ALL;
+  cbs_st.nIndex = OMX_IndexParamCameraDeviceNumber;
+  cbs_st.bEnable = OMX_TRUE;
+  if ((error = OMX_SetConfig (camera->handle, OMX_IndexConfigRequestCallback,
+      &cbs_st))){
+    return component_fail (camera, "OMX_SetConfig", error);
+  }
+
+  OMX_PARAM_U32TYPE dev_st;
+  OMX_INIT_STRUCTURE (dev_st);
+  dev_st.nPortIndex = OMX_ALL;
+  //ID for the camera device
+  dev_st.nU32 = device;
+  if ((error = OMX_SetParameter (camera->handle,
+      OMX_IndexParamCameraDeviceNumber, &dev_st))){
+    return component_fail (camera, "OMX_SetParameter", error);
+  }
+
+  return component_wait (camera, EVENT_PARAM_OR_CONFIG_CHANGED, 0);
+}
+
+OMX_ERRORTYPE component_set_capture (
+    component_t* camera,
+    OMX_U32 port,
+    OMX_BOOL enabled){
+  OMX_ERRORTYPE error;
+
+  //Enable camera capture port. This basically says that the port 71 will be
+  //used to get data from the camera. If you're capturing a still, the port 72
+  //must be used, it captures a single still and stops by itself
+  OMX_CONFIG_PORTBOOLEANTYPE capture_st;
+  OMX_INIT_STRUCTURE (capture_st);
+  capture_st.nPortIndex = port;
+  capture_st.bEnabled = enabled;
+  if ((error = OMX_SetConfig (camera->handle, OMX_IndexConfigPortCapturing,
+      &capture_st))){
+    return component_fail (camera, "OMX_SetConfig", error);
+  }
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE component_enable_output_port (
+    component_t* component,
+    OMX_U32 port,
+    OMX_BUFFERHEADERTYPE** buffers,
+    int buffers_length){
+  OMX_ERRORTYPE error;
+  int i;
+
+  for (i=0; i<buffers_length; i++) buffers[i] = 0;
+
+  //The port is not enabled until the buffers are allocated
+  if ((error = component_command (component, OMX_CommandPortEnable, port))){
+    return error;
+  }
+
+  OMX_PARAM_PORTDEFINITIONTYPE port_st;
+  OMX_INIT_STRUCTURE (port_st);
+  port_st.nPortIndex = port;
+  if ((error = OMX_GetParameter (component->handle,
+      OMX_IndexParamPortDefinition, &port_st))){
+    return component_fail (component, "OMX_GetParameter", error);
+  }
+  for (i=0; i<buffers_length; i++){
+    if ((error = OMX_AllocateBuffer (component->handle, &buffers[i], port, 0,
+        port_st.nBufferSize))){
+      buffers[i] = 0;
+      return component_fail (component, "OMX_AllocateBuffer", error);
+    }
+  }
+
+  return component_wait (component, EVENT_PORT_ENABLE, 0);
+}
+
+OMX_ERRORTYPE component_disable_output_port (
+    component_t* component,
+    OMX_U32 port,
+    OMX_BUFFERHEADERTYPE** buffers,
+    int buffers_length){
+  OMX_ERRORTYPE error;
+  OMX_ERRORTYPE first = OMX_ErrorNone;
+  const char* call = 0;
+  int i;
+
+  //The port is not disabled until the buffers are released
+  if ((error = component_command (component, OMX_CommandPortDisable, port))){
+    return error;
+  }
+
+  for (i=0; i<buffers_length; i++){
+    if (!buffers[i]) continue;
+    if ((error = OMX_FreeBuffer (component->handle, port, buffers[i])) &&
+        !first){
+      first = error;
+      call = "OMX_FreeBuffer";
+    }
+    buffers[i] = 0;
+  }
+
+  if ((error = component_wait (component, EVENT_PORT_DISABLE, 0))){
+    return error;
+  }
+  if (first) return component_fail (component, call, first);
+  return OMX_ErrorNone;
+}
+
+OMX_ERRORTYPE component_enable_input_port (
+    component_t* component,
+    OMX_U32 port,
+    OMX_BUFFERHEADERTYPE** output_buffers,
+    OMX_BUFFERHEADERTYPE** input_buffers,
+    int buffers_length){
+  OMX_ERRORTYPE error;
+  int i;
+
+  for (i=0; i<buffers_length; i++) input_buffers[i] = 0;
+
+  //The port is not enabled until the buffers are given
+  if ((error = component_command (component, OMX_CommandPortEnable, port))){
+    return error;
+  }
+
+  for (i=0; i<buffers_length; i++){
+    if ((error = OMX_UseBuffer (component->handle, &input_buffers[i], port, 0,
+        output_buffers[i]->nAllocLen, output_buffers[i]->pBuffer))){
+      input_buffers[i] = 0;
+      return component_fail (component, "OMX_UseBuffer", error);
+    }
+  }
+
+  return component_wait (component, EVENT_PORT_ENABLE, 0);
+}
@@ -0,0 +1,140 @@
+#ifndef COMPONENT_H
+#define COMPONENT_H
+
+#include <string.h>
+
+#include <interface/vcos/vcos.h>
+#include <IL/OMX_Broadcom.h>
+
+/*
+OpenMAX IL components of the camera pipelines, shared by h264 and the recorder
+library (recorder.h): the handle and the event flags of a component, the event
+handler, the commands and the ports with their buffers. Nothing is printed and
+nothing exits: every call returns OMX_ErrorNone or the error, and
+component->call names the call that failed. h264.c prints it and exits, the
+recorder returns it to the application.
+
+The owner of a component gets the events and the buffers through callbacks that
+run in a thread of OpenMAX IL. The event handler wakes up the thread waiting in
+component_wait() after the event callback. An OMX_EventError wakes up every
+wait with the error of the event.
+*/
+
+#define OMX_INIT_STRUCTURE(x) \
+  memset (&(x), 0, sizeof (x)); \
+  (x).nSize = sizeof (x); \
+  (x).nVersion.nVersion = OMX_VERSION; \
+  (x).nVersion.s.nVersionMajor = OMX_VERSION_MAJOR; \
+  (x).nVersion.s.nVersionMinor = OMX_VERSION_MINOR; \
+  (x).nVersion.s.nRevision = OMX_VERSION_REVISION; \
+  (x).nVersion.s.nStep = OMX_VERSION_STEP
+
+//Events used with vcos_event_flags_get() and vcos_event_flags_set()
+typedef enum {
+  EVENT_ERROR = 0x1,
+  EVENT_PORT_ENABLE = 0x2,
+  EVENT_PORT_DISABLE = 0x4,
+  EVENT_STATE_SET = 0x8,
+  EVENT_FLUSH = 0x10,
+  EVENT_MARK_BUFFER = 0x20,
+  EVENT_MARK = 0x40,
+  EVENT_PORT_SETTINGS_CHANGED = 0x80,
+  EVENT_PARAM_OR_CONFIG_CHANGED = 0x100,
+  EVENT_BUFFER_FLAG = 0x200,
+  EVENT_RESOURCES_ACQUIRED = 0x400,
+  EVENT_DYNAMIC_RESOURCES_AVAILABLE = 0x800,
+  EVENT_FILL_BUFFER_DONE = 0x1000,
+  EVENT_EMPTY_BUFFER_DONE = 0x2000,
+} component_event;
+
+typedef struct component_s component_t;
+
+//Callbacks of the owner of a component, any of them can be null
+typedef struct {
+  void (*event) (
+      component_t* component,
+      OMX_EVENTTYPE event,
+      OMX_U32 data1,
+      OMX_U32 data2);
+  void (*fill_buffer_done) (
+      component_t* component,
+      OMX_BUFFERHEADERTYPE* buffer);
+  void (*empty_buffer_done) (
+      component_t* component,
+      OMX_BUFFERHEADERTYPE* buffer);
+} component_callbacks_t;
+
+//Data of each component
+struct component_s {
+  //The handle is obtained with OMX_GetHandle() and is used on every function
+  //that needs to manipulate a component. It is released with OMX_FreeHandle()
+  OMX_HANDLETYPE handle;
+  //Bitwise OR of flags. Used for blocking the current thread and waiting an
+  //event. Used with vcos_event_flags_get() and vcos_event_flags_set()
+  VCOS_EVENT_FLAGS_T flags;
+  //The fullname of the component
+  OMX_STRING name;
+  const component_callbacks_t* callbacks;
+  //Owner of the component, for the callbacks
+  void* data;
+  //Error of the last OMX_EventError
+  volatile OMX_ERRORTYPE event_error;
+  //Call that failed last, or the name of the component after an
+  //OMX_EventError
+  const char* call;
+};
+
+//Creates the event flags, gets the handle and disables all the ports
+OMX_ERRORTYPE component_init (
+    component_t* component,
+    OMX_STRING name,
+    const component_callbacks_t* callbacks,
+    void* data);
+OMX_ERRORTYPE component_deinit (component_t* component);
+//Waits for any of the events, or an error. The events received are returned
+//in retrieved_events, which can be null
+OMX_ERRORTYPE component_wait (
+    component_t* component,
+    VCOS_UNSIGNED events,
+    VCOS_UNSIGNED* retrieved_events);
+//Forgets the events received and not waited for, e.g. after a failure
+void component_clear (component_t* component);
+//Sends a command without waiting for its completion
+OMX_ERRORTYPE component_command (
+    component_t* component,
+    OMX_COMMANDTYPE command,
+    OMX_U32 param);
+//Loads the drivers of a camera device, they're ready when it returns
+OMX_ERRORTYPE component_load_camera_drivers (
+    component_t* camera,
+    OMX_U32 device);
+//Starts or stops the capture of a port of the camera
+OMX_ERRORTYPE component_set_capture (
+    component_t* camera,
+    OMX_U32 port,
+    OMX_BOOL enabled);
+//Enables an output port and allocates its buffers. On error the buffers that
+//were not allocated are null
+OMX_ERRORTYPE component_enable_output_port (
+    component_t* component,
+    OMX_U32 port,
+    OMX_BUFFERHEADERTYPE** buffers,
+    int buffers_length);
+//Disables a port and frees its buffers, the ones that are not null. The
+//buffers are set to null, and all of them are freed even if one fails
+OMX_ERRORTYPE component_disable_output_port (
+    component_t* component,
+    OMX_U32 port,
+    OMX_BUFFERHEADERTYPE** buffers,
+    int buffers_length);
+//Enables an input port with the memory of the output buffers of another
+//component, so the data is not copied between them. The buffers are released
+//like the output buffers, with component_disable_output_port()
+OMX_ERRORTYPE component_enable_input_port (
+    component_t* component,
+    OMX_U32 port,
+    OMX_BUFFERHEADERTYPE** output_buffers,
+    OMX_BUFFERHEADERTYPE** input_buffers,
+    int buffers_length);
+
+#endif
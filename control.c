@@ -0,0 +1,150 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+//Characters of an unknown command echoed in the reply
+#define CONTROL_ECHO_MAX 64
+
+static void control_execute (control_t* control, char* line, char* reply,
+    size_t size){
+  char* args = line + strcspn (line, " \t");
+  if (*args) *args++ = 0;
+  int i;
+
+  if (!strcmp (line, "help")){
+    int n = snprintf (reply, size, "ok");
+    for (i=0; i<control->commands_length && n < (int)size; i++){
+      n += snprintf (reply + n, size - n, " %s", control->commands[i].name);
+    }
+    return;
+  }
+
+  for (i=0; i<control->commands_length; i++){
+    if (!strcmp (line, control->commands[i].name)){
+      char message[CONTROL_LINE_SIZE];
+      message[0] = 0;
+      int error = control->commands[i].handler (control->commands[i].arg, args,
+          message, sizeof (message));
+      snprintf (reply, size, "%s%s%s", error ? "error" : "ok",
+          *message ? " " : "", message);
+      return;
+    }
+  }
+
+  //The line can be as long as the reply, only its beginning is echoed
+  snprintf (reply, size, "error unknown command: %.*s", CONTROL_ECHO_MAX,
+      line);
+}
+
+static void control_serve (control_t* control){
+  char line[CONTROL_LINE_SIZE];
+  char reply[CONTROL_LINE_SIZE];
+  size_t length = 0;
+  ssize_t n;
+  char* end;
+
+  while ((n = read (control->fd, line + length, sizeof (line) - 1 - length)) >
+      0){
+    length += n;
+    line[length] = 0;
+
+    while ((end = strchr (line, '\n'))){
+      *end = 0;
+      if (end > line && end[-1] == '\r') end[-1] = 0;
+      if (*line){
+        control_execute (control, line, reply, sizeof (reply) - 1);
+        strcat (reply, "\n");
+        if (write (control->fd, reply, strlen (reply)) == -1) return;
+      }
+      length -= end + 1 - line;
+      memmove (line, end + 1, length + 1);
+    }
+
+    //Line too long
+    if (length == sizeof (line) - 1) return;
+  }
+}
+
+static void* control_loop (void* arg){
+  control_t* control = (control_t*)arg;
+
+  while (!control->stop){
+    if ((control->fd = accept (control->listen_fd, 0, 0)) == -1){
+      if (errno == EINTR || errno == ECONNABORTED) continue;
+      break;
+    }
+    control_serve (control);
+    close (control->fd);
+    control->fd = -1;
+  }
+
+  return 0;
+}
+
+void control_init (control_t* control){
+  control->path = 0;
+  control->listen_fd = -1;
+  control->fd = -1;
+  control->stop = 0;
+  control->commands_length = 0;
+}
+
+void control_open (control_t* control, const char* path){
+  struct sockaddr_un addr;
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen (path) >= sizeof (addr.sun_path)){
+    fprintf (stderr, "error: invalid unix socket path: %s\n", path);
+    exit (1);
+  }
+  strcpy (addr.sun_path, path);
+
+  control->path = path;
+
+  unlink (path);
+  if ((control->listen_fd = socket (AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+      bind (control->listen_fd, (struct sockaddr*)&addr, sizeof (addr)) ||
+      listen (control->listen_fd, 4)){
+    fprintf (stderr, "error: control socket\n");
+    exit (1);
+  }
+
+  if (pthread_create (&control->thread, 0, control_loop, control)){
+    fprintf (stderr, "error: pthread_create\n");
+    exit (1);
+  }
+}
+
+void control_register (
+    control_t* control,
+    const char* name,
+    control_handler_t handler,
+    void* arg){
+  if (control->commands_length == CONTROL_COMMANDS_MAX){
+    fprintf (stderr, "error: too many control commands\n");
+    exit (1);
+  }
+  control->commands[control->commands_length].name = name;
+  control->commands[control->commands_length].handler = handler;
+  control->commands[control->commands_length].arg = arg;
+  control->commands_length++;
+}
+
+void control_close (control_t* control){
+  //Wake up the thread blocked in accept() or read()
+  control->stop = 1;
+  shutdown (control->listen_fd, SHUT_RDWR);
+  if (control->fd != -1) shutdown (control->fd, SHUT_RDWR);
+  if (pthread_join (control->thread, 0)){
+    fprintf (stderr, "error: pthread_join\n");
+    exit (1);
+  }
+  close (control->listen_fd);
+  unlink (control->path);
+}
@@ -0,0 +1,54 @@
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+Control channel. It's a Unix stream socket that accepts one command per line
+and answers every command with one line. The commands are executed in the
+control thread, so their handlers must be thread-safe.
+
+  $ echo idr | socat - UNIX-CONNECT:/tmp/h264.sock
+  ok
+*/
+
+#define CONTROL_COMMANDS_MAX 32
+#define CONTROL_LINE_SIZE 1024
+
+//Executes a command. args contains the rest of the line after the command
+//name. Returns 0 on success, the reply is sent prefixed with "ok" or "error"
+typedef int (*control_handler_t) (
+    void* arg,
+    char* args,
+    char* reply,
+    size_t size);
+
+typedef struct {
+  const char* name;
+  control_handler_t handler;
+  void* arg;
+} control_command_t;
+
+typedef struct {
+  const char* path;
+  int listen_fd;
+  //Connection being served
+  int fd;
+  int stop;
+  pthread_t thread;
+  control_command_t commands[CONTROL_COMMANDS_MAX];
+  int commands_length;
+} control_t;
+
+//The commands are registered between control_init() and control_open()
+void control_init (control_t* control);
+void control_open (control_t* control, const char* path);
+void control_register (
+    control_t* control,
+    const char* name,
+    control_handler_t handler,
+    void* arg);
+void control_close (control_t* control);
+
+#endif
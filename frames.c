@@ -0,0 +1,166 @@
+#include <math.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "frames.h"
+
+//The baseline of the latency follows an increase by 1/LATENCY_FOLLOW per frame
+#define LATENCY_FOLLOW 1024
+
+static int64_t frames_time (){
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  return (int64_t)spec.tv_sec*1000000 + spec.tv_nsec/1000;
+}
+
+void frames_init (frames_t* frames, int64_t interval){
+  frames->interval = interval;
+  frames->filled = -1;
+  frames->queued = -1;
+  frames->hold_max = 0;
+  frames->wait_max = 0;
+  frames->timestamp = 0;
+  frames->open = 0;
+  frames->previous = -1;
+  frames->latency_base = 0;
+  frames->latency_valid = 0;
+  frames->frames = 0;
+  frames->keyframes = 0;
+  frames->incomplete = 0;
+  frames->backward = 0;
+  frames->dropped_sensor = 0;
+  frames->dropped_encoder = 0;
+  frames->dropped_host = 0;
+  frames->bursts = 0;
+  frames->burst_max = 0;
+  frames->burst_last = 0;
+  frames->burst_last_timestamp = 0;
+  frames->hold_peak = 0;
+  frames->wait_peak = 0;
+  frames->arrival = -1;
+  frames->arrivals = 0;
+  frames->arrival_sum = 0;
+  frames->arrival_sum2 = 0;
+  frames->arrival_max = 0;
+}
+
+void frames_queued (frames_t* frames){
+  int64_t now = frames_time ();
+
+  if (frames->filled >= 0 && now - frames->filled > frames->hold_max){
+    frames->hold_max = now - frames->filled;
+    if (frames->hold_max > frames->hold_peak){
+      frames->hold_peak = frames->hold_max;
+    }
+  }
+  frames->queued = now;
+}
+
+static void frames_drop (frames_t* frames, uint32_t dropped, int64_t latency){
+  const char* cause;
+
+  if (frames->hold_max > frames->interval){
+    frames->dropped_host += dropped;
+    cause = "host";
+  }else if (latency - frames->latency_base > frames->interval){
+    frames->dropped_encoder += dropped;
+    cause = "encoder";
+  }else{
+    frames->dropped_sensor += dropped;
+    cause = "sensor";
+  }
+
+  frames->bursts++;
+  frames->burst_last = dropped;
+  frames->burst_last_timestamp = frames->timestamp;
+  if (dropped > frames->burst_max) frames->burst_max = dropped;
+
+  printf ("frames: %u frames dropped (%s) before timestamp %lld us, buffer "
+      "held %lld us, encoder wait %lld us\n", dropped, cause,
+      (long long)frames->timestamp, (long long)frames->hold_max,
+      (long long)frames->wait_max);
+}
+
+static void frames_end (frames_t* frames, int64_t now){
+  int64_t latency = now - frames->timestamp;
+  int64_t delta = frames->timestamp - frames->previous;
+
+  frames->frames++;
+  if (frames->arrival >= 0){
+    int64_t interval = now - frames->arrival;
+    frames->arrivals++;
+    frames->arrival_sum += interval;
+    frames->arrival_sum2 += (double)interval*interval;
+    if (interval > frames->arrival_max) frames->arrival_max = interval;
+  }
+  frames->arrival = now;
+
+  if (frames->previous >= 0){
+    if (delta <= 0){
+      frames->backward++;
+    }else if (delta*2 > frames->interval*3){
+      frames_drop (frames, (delta + frames->interval/2)/frames->interval - 1,
+          latency);
+    }
+  }
+
+  if (!frames->latency_valid || latency < frames->latency_base){
+    frames->latency_base = latency;
+    frames->latency_valid = 1;
+  }else{
+    frames->latency_base += (latency - frames->latency_base)/LATENCY_FOLLOW;
+  }
+
+  frames->previous = frames->timestamp;
+  frames->hold_max = 0;
+  frames->wait_max = 0;
+  frames->open = 0;
+}
+
+void frames_buffer (frames_t* frames, stream_buffer_t* buffer){
+  int64_t now = frames_time ();
+
+  if (frames->queued >= 0 && now - frames->queued > frames->wait_max){
+    frames->wait_max = now - frames->queued;
+    if (frames->wait_max > frames->wait_peak){
+      frames->wait_peak = frames->wait_max;
+    }
+  }
+  frames->filled = now;
+
+  if (!buffer->length || (buffer->flags & STREAM_FLAG_CODECCONFIG)) return;
+
+  if (frames->open && buffer->timestamp != frames->timestamp){
+    //The previous frame never got its ENDOFFRAME
+    frames->incomplete++;
+    frames_end (frames, now);
+  }
+  frames->open = 1;
+  frames->timestamp = buffer->timestamp;
+
+  if (buffer->flags & STREAM_FLAG_ENDOFFRAME){
+    if (buffer->flags & STREAM_FLAG_SYNCFRAME) frames->keyframes++;
+    frames_end (frames, now);
+  }
+}
+
+int frames_dump (frames_t* frames, char* str, size_t size){
+  double mean = 0;
+  double deviation = 0;
+  if (frames->arrivals){
+    mean = frames->arrival_sum/frames->arrivals;
+    deviation = frames->arrival_sum2/frames->arrivals - mean*mean;
+    deviation = deviation > 0 ? sqrt (deviation) : 0;
+  }
+
+  return snprintf (str, size, "frames %u, keyframes %u, incomplete %u, "
+      "backward %u, dropped sensor %u encoder %u host %u, bursts %u (last %u "
+      "at %lld us, max %u), peak hold %lld us, peak wait %lld us, arrival "
+      "interval avg %.2f ms stddev %.3f ms max %.2f ms",
+      frames->frames, frames->keyframes, frames->incomplete, frames->backward,
+      frames->dropped_sensor, frames->dropped_encoder, frames->dropped_host,
+      frames->bursts, frames->burst_last,
+      (long long)frames->burst_last_timestamp, frames->burst_max,
+      (long long)frames->hold_peak, (long long)frames->wait_peak, mean/1000,
+      deviation/1000, frames->arrival_max/1000.0);
+}
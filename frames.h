@@ -0,0 +1,86 @@
+#ifndef FRAMES_H
+#define FRAMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stream.h"
+
+/*
+Frame accounting. The timestamps (nTimeStamp) of the encoded frames are
+compared with the configured frame rate: a gap of more than 1.5 frame intervals
+between two frames is a burst of dropped frames. The encoder loop reports when
+the output buffer is given back to the encoder (frames_queued()) and when it's
+filled (frames_buffer()), so the cause of every burst can be guessed:
+
+- host: the output buffer was held by the outputs longer than a frame interval
+  since the previous frame, the encoder had nowhere to write (backpressure)
+- encoder: the buffer was given back in time but the frame arrived late, its
+  latency (arrival time - timestamp) was more than a frame interval above the
+  usual, the encoder was behind and skipped input frames
+- sensor: the buffer was given back in time and the frame wasn't late, the
+  frames were never captured (e.g. an exposure longer than the frame interval)
+
+The latency is relative: the timestamps come from the VideoCore clock, so the
+baseline is the minimum latency, slowly following the drift between clocks.
+
+Frames split in several buffers are joined with the ENDOFFRAME flag, and a
+buffer with a different timestamp before the ENDOFFRAME of the previous one is
+an incomplete frame. The intervals between the arrivals of the frames are also
+measured, their standard deviation is the jitter of the encoder loop (see -r,
+rt.h). The counters are plain integers written by the encoder thread,
+frames_dump() can be called from the control thread.
+*/
+
+typedef struct {
+  //Frame interval (us)
+  int64_t interval;
+  //Time when the buffer was filled and given back to the encoder (us), -1 if
+  //unknown
+  int64_t filled;
+  int64_t queued;
+  //Since the previous frame: longest time the buffer was held by the host and
+  //longest wait for the encoder (us)
+  int64_t hold_max;
+  int64_t wait_max;
+  //Current frame
+  int64_t timestamp;
+  int open;
+  //Previous frame, -1 if none
+  int64_t previous;
+  //Baseline of the latency (us)
+  int64_t latency_base;
+  int latency_valid;
+  //Statistics
+  uint32_t frames;
+  uint32_t keyframes;
+  uint32_t incomplete;
+  //Timestamps that don't advance
+  uint32_t backward;
+  uint32_t dropped_sensor;
+  uint32_t dropped_encoder;
+  uint32_t dropped_host;
+  uint32_t bursts;
+  uint32_t burst_max;
+  uint32_t burst_last;
+  int64_t burst_last_timestamp;
+  int64_t hold_peak;
+  int64_t wait_peak;
+  //Arrival of the previous frame (us), -1 if none, and the intervals
+  int64_t arrival;
+  uint32_t arrivals;
+  double arrival_sum;
+  double arrival_sum2;
+  int64_t arrival_max;
+} frames_t;
+
+//interval is the time between two frames (us)
+void frames_init (frames_t* frames, int64_t interval);
+//Called before the output buffer is given back to the encoder
+void frames_queued (frames_t* frames);
+//Called for every filled output buffer
+void frames_buffer (frames_t* frames, stream_buffer_t* buffer);
+//Prints the statistics in a string
+int frames_dump (frames_t* frames, char* str, size_t size);
+
+#endif
@@ -30,26 +30,47 @@ AWB (auto white balance) algorithms.
 
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <time.h>
+#include <getopt.h>
+#include <signal.h>
 
 #include <bcm_host.h>
 #include <interface/vcos/vcos.h>
 #include <IL/OMX_Broadcom.h>
 
+#include "audio.h"
+#include "component.h"
+#include "control.h"
 #include "dump.h"
-
-#define OMX_INIT_STRUCTURE(x) \
-  memset (&(x), 0, sizeof (x)); \
-  (x).nSize = sizeof (x); \
-  (x).nVersion.nVersion = OMX_VERSION; \
-  (x).nVersion.s.nVersionMajor = OMX_VERSION_MAJOR; \
-  (x).nVersion.s.nVersionMinor = OMX_VERSION_MINOR; \
-  (x).nVersion.s.nRevision = OMX_VERSION_REVISION; \
-  (x).nVersion.s.nStep = OMX_VERSION_STEP
+#include "frames.h"
+#include "idr.h"
+#include "latency.h"
+#include "overlay.h"
+#include "paramsets.h"
+#include "preview.h"
+#include "rt.h"
+#include "sink.h"
+#include "snapshot.h"
+#include "substream.h"
+#include "sweep.h"
+#include "timelapse.h"
+#include "tuning.h"
+#include "validate.h"
+#include "writer.h"
 
 #define FILENAME "video.h264"
+//Results of the sweep (-S)
+#define SWEEP_RESULTS "sweep.csv"
+//Maximum number of outputs (-o) of a camera
+#define OUTPUTS_MAX 8
+//Maximum number of cameras (-d)
+#define PIPELINES_MAX 4
+//Threads that write the files of all the cameras (-w), 0 writes them in the
+//encoder loop
+#define WRITER_THREADS 2
 
 #define VIDEO_FRAMERATE 30
 #define VIDEO_BITRATE 17000000
@@ -63,6 +84,27 @@ AWB (auto white balance) algorithms.
 #define VIDEO_PROFILE OMX_VIDEO_AVCProfileHigh
 #define VIDEO_INLINE_HEADERS OMX_FALSE
 
+//Low latency mode (-l): more and smaller encoder output buffers, and slices, so
+//the first rows of a frame are sent while the rest is still being encoded
+#define LOWLATENCY_BUFFERS 8
+#define LOWLATENCY_BUFFER_SIZE (16*1024)
+#define LOWLATENCY_MB_ROWS_PER_SLICE 17 //4 slices at 1080p (68 rows)
+//Maximum number of encoder output buffers
+#define BUFFERS_MAX LOWLATENCY_BUFFERS
+
+//JPEG stills (-j), full resolution of the v1 sensor
+#define STILL_WIDTH 2592
+#define STILL_HEIGHT 1944
+#define STILL_QUALITY 85 //1 .. 100
+//Image encoder output buffers, a JPEG spans several of them
+#define STILL_BUFFERS 3
+
+//Filled buffers of all the pipelines: video, stills, preview frames and
+//camera frames with the text (-b)
+#define QUEUE_SIZE \
+  ((BUFFERS_MAX + STILL_BUFFERS + PREVIEW_BUFFERS + OVERLAY_BUFFERS)* \
+  PIPELINES_MAX)
+
 //Some settings doesn't work well
 #define CAM_WIDTH 1920
 #define CAM_HEIGHT 1080
@@ -171,486 +213,791 @@ VIDEO_PROFILE
   OMX_VIDEO_AVCProfileMain
 */
 
-//Data of each component
+//Encoder output buffers of all the pipelines that have been filled, pushed by
+//fill_buffer_done() with the time they arrived and popped by the encoder loop
+//in the same order, which is the order in which the pipelines are served
 typedef struct {
-  //The handle is obtained with OMX_GetHandle() and is used on every function
-  //that needs to manipulate a component. It is released with OMX_FreeHandle()
-  OMX_HANDLETYPE handle;
-  //Bitwise OR of flags. Used for blocking the current thread and waiting an
-  //event. Used with vcos_event_flags_get() and vcos_event_flags_set()
+  OMX_BUFFERHEADERTYPE* buffers[QUEUE_SIZE];
+  int64_t arrivals[QUEUE_SIZE];
+  int head;
+  int length;
+  VCOS_MUTEX_T mutex;
+  //EVENT_FILL_BUFFER_DONE, and EVENT_ERROR if any component fails
   VCOS_EVENT_FLAGS_T flags;
-  //The fullname of the component
-  OMX_STRING name;
-} component_t;
-
-//Events used with vcos_event_flags_get() and vcos_event_flags_set()
-typedef enum {
-  EVENT_ERROR = 0x1,
-  EVENT_PORT_ENABLE = 0x2,
-  EVENT_PORT_DISABLE = 0x4,
-  EVENT_STATE_SET = 0x8,
-  EVENT_FLUSH = 0x10,
-  EVENT_MARK_BUFFER = 0x20,
-  EVENT_MARK = 0x40,
-  EVENT_PORT_SETTINGS_CHANGED = 0x80,
-  EVENT_PARAM_OR_CONFIG_CHANGED = 0x100,
-  EVENT_BUFFER_FLAG = 0x200,
-  EVENT_RESOURCES_ACQUIRED = 0x400,
-  EVENT_DYNAMIC_RESOURCES_AVAILABLE = 0x800,
-  EVENT_FILL_BUFFER_DONE = 0x1000,
-  EVENT_EMPTY_BUFFER_DONE = 0x2000,
-} component_event;
+} buffer_queue_t;
+
+//Latency of every output, from the capture of a frame to the return of the
+//write of its first and last buffers
+typedef struct {
+  sink_t** sinks;
+  int sinks_length;
+  latency_t first[OUTPUTS_MAX];
+  latency_t last[OUTPUTS_MAX];
+} latency_report_t;
+
+//Encoder settings, the VIDEO_* values unless they come from a sweep (-s)
+typedef struct {
+  OMX_U32 bitrate;
+  OMX_BOOL qp;
+  OMX_U32 qp_i;
+  OMX_U32 qp_p;
+  OMX_VIDEO_AVCPROFILETYPE profile;
+  OMX_U32 idr_period;
+} h264_settings_t;
+
+//Components of the pipeline of a camera, encoder output buffers and the state
+//of its stream. The pAppPrivate of the buffers points to the pipeline
+typedef struct pipeline_s {
+  //Camera device number (-d), frame rate (Q16) and if the capture is started
+  //with the pipeline
+  OMX_U32 device;
+  OMX_U32 framerate;
+  int capture;
+  //Size of the stream and encoder settings
+  OMX_U32 width;
+  OMX_U32 height;
+  h264_settings_t settings;
+  component_t camera;
+  component_t encoder;
+  component_t null_sink;
+  OMX_BUFFERHEADERTYPE* buffers[BUFFERS_MAX];
+  int buffers_length;
+  //JPEG stills (-j), the image encoder is only used if there's a pattern
+  const char* still;
+  component_t image_encoder;
+  OMX_BUFFERHEADERTYPE* still_buffers[STILL_BUFFERS];
+  int still_buffers_length;
+  snapshot_t snapshot;
+  //Small preview frames (-p), the resize component takes the place of the
+  //null_sink if there's a specification
+  const char* preview_spec;
+  component_t resize;
+  OMX_BUFFERHEADERTYPE* preview_buffers[PREVIEW_BUFFERS];
+  int preview_buffers_length;
+  preview_t preview;
+  //Substream (-u). The camera feeds a video_splitter and its second output
+  //goes, through the resize component of the substream if the size differs,
+  //to the encoder of the substream. The substream is a pipeline without
+  //camera, its parent owns the camera and the splitter
+  const char* substream_spec;
+  component_t splitter;
+  struct pipeline_s* substream;
+  struct pipeline_s* parent;
+  //Text burned into the frames (-b). The video port of the camera is not
+  //tunneled, its buffers are shared with the input port of the encoder, or of
+  //the splitter: frame_buffers[i] and input_buffers[i] have the same data.
+  //The input buffers go back to the camera while it's running
+  const char* overlay_format;
+  overlay_t overlay;
+  OMX_BUFFERHEADERTYPE* frame_buffers[OVERLAY_BUFFERS];
+  OMX_BUFFERHEADERTYPE* input_buffers[OVERLAY_BUFFERS];
+  volatile int overlay_running;
+  const char* outputs[OUTPUTS_MAX];
+  sink_t* sinks[OUTPUTS_MAX];
+  int sinks_length;
+  idr_t idr;
+  paramsets_t paramsets;
+  frames_t frames;
+  validator_t validator;
+  latency_report_t latency_report;
+  timelapse_t timelapse;
+  //Settings changed by the control channel (set), only for the cameras
+  tuning_t tuning;
+  //Timestamps of the camera mapped to the clock of the audio source (-a)
+  audio_sync_t audio_sync;
+  int frame_start;
+  //Buffers served by the encoder loop since the start of the recording, time
+  //spent in the outputs and waiting in the queue (us)
+  int64_t start;
+  uint32_t served;
+  uint64_t bytes;
+  int64_t busy;
+  int64_t wait_sum;
+  int64_t wait_max;
+} pipeline_t;
+
+//Pipelines of all the cameras, driven by the encoder loop. It's the only
+//writer: the buffers are handed to the outputs in the order they are filled
+typedef struct {
+  pipeline_t pipelines[PIPELINES_MAX];
+  int length;
+} controller_t;
+
+//Encoder of the sweep (see sweep.h): a pipeline without outputs and the buffer
+//held by the sweep
+typedef struct {
+  pipeline_t pipeline;
+  int low_latency;
+  OMX_BUFFERHEADERTYPE* buffer;
+} sweep_pipeline_t;
 
 //Prototypes
-OMX_ERRORTYPE event_handler (
-    OMX_IN OMX_HANDLETYPE comp,
-    OMX_IN OMX_PTR app_data,
-    OMX_IN OMX_EVENTTYPE event,
-    OMX_IN OMX_U32 data1,
-    OMX_IN OMX_U32 data2,
-    OMX_IN OMX_PTR event_data);
-OMX_ERRORTYPE fill_buffer_done (
-    OMX_IN OMX_HANDLETYPE comp,
-    OMX_IN OMX_PTR app_data,
-    OMX_IN OMX_BUFFERHEADERTYPE* buffer);
-void wake (component_t* component, VCOS_UNSIGNED event);
+void event_handler (
+    component_t* component,
+    OMX_EVENTTYPE event,
+    OMX_U32 data1,
+    OMX_U32 data2);
+void fill_buffer_done (component_t* component, OMX_BUFFERHEADERTYPE* buffer);
+void empty_buffer_done (component_t* component, OMX_BUFFERHEADERTYPE* buffer);
+void check_error (component_t* component, OMX_ERRORTYPE error);
 void wait (
     component_t* component,
     VCOS_UNSIGNED events,
     VCOS_UNSIGNED* retrieved_events);
 void init_component (component_t* component);
 void deinit_component (component_t* component);
-void load_camera_drivers (component_t* component);
+void load_camera_drivers (component_t* component, OMX_U32 device);
 void change_state (component_t* component, OMX_STATETYPE state);
 void enable_port (component_t* component, OMX_U32 port);
 void disable_port (component_t* component, OMX_U32 port);
+int64_t get_time ();
+void buffer_queue_init (buffer_queue_t* queue);
+void buffer_queue_deinit (buffer_queue_t* queue);
+void buffer_queue_push (buffer_queue_t* queue, OMX_BUFFERHEADERTYPE* buffer);
+OMX_BUFFERHEADERTYPE* buffer_queue_pop (
+    buffer_queue_t* queue,
+    int64_t* arrival);
+int buffer_queue_wait (buffer_queue_t* queue, VCOS_UNSIGNED timeout);
 void enable_encoder_output_port (
     component_t* encoder,
-    OMX_BUFFERHEADERTYPE** encoder_output_buffer);
+    OMX_U32 port,
+    OMX_BUFFERHEADERTYPE** encoder_output_buffers,
+    int buffers_length);
 void disable_encoder_output_port (
     component_t* encoder,
-    OMX_BUFFERHEADERTYPE* encoder_output_buffer);
-void set_camera_settings (component_t* camera);
-void set_h264_settings (component_t* encoder);
+    OMX_U32 port,
+    OMX_BUFFERHEADERTYPE** encoder_output_buffers,
+    int buffers_length);
+void enable_input_port (
+    component_t* component,
+    OMX_U32 port,
+    OMX_BUFFERHEADERTYPE** output_buffers,
+    OMX_BUFFERHEADERTYPE** input_buffers,
+    int buffers_length);
+int32_t get_index (const int32_t* table, int length, int32_t value);
+void get_tuning_defaults (int32_t* values, h264_settings_t* settings);
+OMX_ERRORTYPE set_camera_config (
+    component_t* camera,
+    const int32_t* values,
+    tuning_config_t config);
+OMX_ERRORTYPE set_encoder_config (
+    component_t* encoder,
+    const int32_t* values,
+    tuning_config_t config);
+void apply_tuning (pipeline_t* pipeline);
+void set_camera_settings (component_t* camera, const int32_t* values);
+void set_h264_settings (component_t* encoder, h264_settings_t* settings);
+void set_low_latency_settings (component_t* encoder);
+void request_idr (component_t* encoder);
+void set_capture (component_t* camera, OMX_U32 port, OMX_BOOL enabled);
+void set_still_settings (component_t* camera, component_t* image_encoder);
+void set_resize_settings (
+    component_t* resize,
+    OMX_U32 width,
+    OMX_U32 height,
+    int buffers_length);
+void setup_tunnel (
+    component_t* output,
+    OMX_U32 output_port,
+    component_t* input,
+    OMX_U32 input_port);
+void set_overlay_ports (
+    pipeline_t* pipeline,
+    component_t* input,
+    OMX_U32 input_port);
+void overlay_input (pipeline_t* pipeline, OMX_BUFFERHEADERTYPE* buffer);
+void set_encoder_port (pipeline_t* pipeline, int low_latency);
+void pipeline_open (pipeline_t* pipeline, int low_latency, int stc);
+void pipeline_close (pipeline_t* pipeline);
+int64_t get_timestamp (OMX_TICKS ticks);
+uint8_t get_profile_idc (OMX_VIDEO_AVCPROFILETYPE profile);
+OMX_VIDEO_AVCPROFILETYPE get_profile (uint8_t profile_idc);
+void h264_settings_init (h264_settings_t* settings);
+void h264_settings_sweep (
+    h264_settings_t* settings,
+    const sweep_config_t* config);
+int latency_report_dump (latency_report_t* report, char* str, size_t size);
+pipeline_t* controller_add (controller_t* controller, OMX_U32 device);
+pipeline_t* controller_substream (controller_t* controller, pipeline_t* parent);
+int controller_dump (
+    controller_t* controller,
+    int (*dump) (pipeline_t* pipeline, char* str, size_t size),
+    char* str,
+    size_t size);
+double controller_fairness (controller_t* controller);
+int pipeline_dump_idr (pipeline_t* pipeline, char* str, size_t size);
+int pipeline_dump_frames (pipeline_t* pipeline, char* str, size_t size);
+int pipeline_dump_latency (pipeline_t* pipeline, char* str, size_t size);
+int pipeline_dump_service (pipeline_t* pipeline, char* str, size_t size);
+int pipeline_dump_snapshot (pipeline_t* pipeline, char* str, size_t size);
+int pipeline_dump_preview (pipeline_t* pipeline, char* str, size_t size);
+int pipeline_dump_overlay (pipeline_t* pipeline, char* str, size_t size);
+int pipeline_dump_tuning (pipeline_t* pipeline, char* str, size_t size);
+int pipeline_dump_settings (pipeline_t* pipeline, char* str, size_t size);
+int control_idr (void* arg, char* args, char* reply, size_t size);
+int control_frames (void* arg, char* args, char* reply, size_t size);
+int control_latency (void* arg, char* args, char* reply, size_t size);
+int control_cameras (void* arg, char* args, char* reply, size_t size);
+int control_writer (void* arg, char* args, char* reply, size_t size);
+int control_snapshot (void* arg, char* args, char* reply, size_t size);
+int control_set (void* arg, char* args, char* reply, size_t size);
+int control_get (void* arg, char* args, char* reply, size_t size);
+void stop_recording (int signal);
+void usage ();
+void sweep_pipeline_open (sweep_encoder_t* encoder,
+    const sweep_config_t* config);
+void sweep_pipeline_read (sweep_encoder_t* encoder,
+    stream_buffer_t* buffer);
+void sweep_pipeline_release (sweep_encoder_t* encoder);
+void sweep_pipeline_close (sweep_encoder_t* encoder);
+void run_sweep (
+    const char* matrix,
+    const char* results,
+    long duration,
+    int low_latency);
+
+//Set by SIGINT and SIGTERM
+volatile sig_atomic_t interrupted = 0;
+//Filled encoder output buffers
+buffer_queue_t ready;
+//Cameras
+controller_t controller;
+//Writer threads of the files
+writer_t writer;
 
 //Function that is called when a component receives an event from a secondary
-//thread
-OMX_ERRORTYPE event_handler (
-    OMX_IN OMX_HANDLETYPE comp,
-    OMX_IN OMX_PTR app_data,
-    OMX_IN OMX_EVENTTYPE event,
-    OMX_IN OMX_U32 data1,
-    OMX_IN OMX_U32 data2,
-    OMX_IN OMX_PTR event_data){
-  component_t* component = (component_t*)app_data;
-  
+//thread, before the thread waiting for it wakes up
+void event_handler (
+    component_t* component,
+    OMX_EVENTTYPE event,
+    OMX_U32 data1,
+    OMX_U32 data2){
   switch (event){
     case OMX_EventCmdComplete:
       switch (data1){
         case OMX_CommandStateSet:
           printf ("event: %s, OMX_CommandStateSet, state: %s\n",
               component->name, dump_OMX_STATETYPE (data2));
-          wake (component, EVENT_STATE_SET);
           break;
         case OMX_CommandPortDisable:
           printf ("event: %s, OMX_CommandPortDisable, port: %d\n",
               component->name, data2);
-          wake (component, EVENT_PORT_DISABLE);
           break;
         case OMX_CommandPortEnable:
           printf ("event: %s, OMX_CommandPortEnable, port: %d\n",
               component->name, data2);
-          wake (component, EVENT_PORT_ENABLE);
           break;
         case OMX_CommandFlush:
           printf ("event: %s, OMX_CommandFlush, port: %d\n",
               component->name, data2);
-          wake (component, EVENT_FLUSH);
           break;
         case OMX_CommandMarkBuffer:
           printf ("event: %s, OMX_CommandMarkBuffer, port: %d\n",
               component->name, data2);
-          wake (component, EVENT_MARK_BUFFER);
           break;
       }
       break;
     case OMX_EventError:
       printf ("event: %s, %s\n", component->name, dump_OMX_ERRORTYPE (data1));
-      wake (component, EVENT_ERROR);
+      //The encoder loop waits for the buffers of all the encoders
+      vcos_event_flags_set (&ready.flags, EVENT_ERROR, VCOS_OR);
       break;
     case OMX_EventMark:
       printf ("event: %s, OMX_EventMark\n", component->name);
-      wake (component, EVENT_MARK);
       break;
     case OMX_EventPortSettingsChanged:
       printf ("event: %s, OMX_EventPortSettingsChanged, port: %d\n",
           component->name, data1);
-      wake (component, EVENT_PORT_SETTINGS_CHANGED);
       break;
     case OMX_EventParamOrConfigChanged:
       printf ("event: %s, OMX_EventParamOrConfigChanged, data1: %d, data2: "
           "%X\n", component->name, data1, data2);
-      wake (component, EVENT_PARAM_OR_CONFIG_CHANGED);
       break;
     case OMX_EventBufferFlag:
       printf ("event: %s, OMX_EventBufferFlag, port: %d\n",
           component->name, data1);
-      wake (component, EVENT_BUFFER_FLAG);
       break;
     case OMX_EventResourcesAcquired:
       printf ("event: %s, OMX_EventResourcesAcquired\n", component->name);
-      wake (component, EVENT_RESOURCES_ACQUIRED);
       break;
     case OMX_EventDynamicResourcesAvailable:
       printf ("event: %s, OMX_EventDynamicResourcesAvailable\n",
           component->name);
-      wake (component, EVENT_DYNAMIC_RESOURCES_AVAILABLE);
       break;
     default:
       //This should never execute, just ignore
       printf ("event: unknown (%X)\n", event);
       break;
   }
-
-  return OMX_ErrorNone;
 }
 
 //Function that is called when a component fills a buffer with data
-OMX_ERRORTYPE fill_buffer_done (
-    OMX_IN OMX_HANDLETYPE comp,
-    OMX_IN OMX_PTR app_data,
-    OMX_IN OMX_BUFFERHEADERTYPE* buffer){
-  component_t* component = (component_t*)app_data;
-  
+void fill_buffer_done (component_t* component, OMX_BUFFERHEADERTYPE* buffer){
   printf ("event: %s, fill_buffer_done\n", component->name);
-  wake (component, EVENT_FILL_BUFFER_DONE);
+  buffer_queue_push (&ready, buffer);
+}
+
+//Function that is called when a component has consumed an input buffer. Only
+//the frames with the text (-b) are given to a component, they go back to the
+//camera
+void empty_buffer_done (component_t* component, OMX_BUFFERHEADERTYPE* buffer){
+  pipeline_t* pipeline = (pipeline_t*)buffer->pAppPrivate;
+  OMX_ERRORTYPE error;
+  int i;
   
-  return OMX_ErrorNone;
+  printf ("event: %s, empty_buffer_done\n", component->name);
+  if (!pipeline->overlay_running) return;
+  for (i=0; pipeline->input_buffers[i] != buffer; i++);
+  if ((error = OMX_FillThisBuffer (pipeline->camera.handle,
+      pipeline->frame_buffers[i])) && pipeline->overlay_running){
+    fprintf (stderr, "error: OMX_FillThisBuffer: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
 }
 
-void wake (component_t* component, VCOS_UNSIGNED event){
-  vcos_event_flags_set (&component->flags, event, VCOS_OR);
+//Every component of the pipelines, see component.h
+const component_callbacks_t callbacks = {
+  event_handler,
+  fill_buffer_done,
+  empty_buffer_done
+};
+
+//Prints the call of component.c that failed and exits
+void check_error (component_t* component, OMX_ERRORTYPE error){
+  if (!error) return;
+  fprintf (stderr, "error: %s: %s\n", component->call,
+      dump_OMX_ERRORTYPE (error));
+  exit (1);
 }
 
 void wait (
     component_t* component,
     VCOS_UNSIGNED events,
     VCOS_UNSIGNED* retrieved_events){
-  VCOS_UNSIGNED set;
-  if (vcos_event_flags_get (&component->flags, events | EVENT_ERROR,
-      VCOS_OR_CONSUME, VCOS_SUSPEND, &set)){
-    fprintf (stderr, "error: vcos_event_flags_get\n");
-    exit (1);
-  }
-  if (set == EVENT_ERROR){
-    exit (1);
-  }
-  if (retrieved_events){
-    *retrieved_events = set;
-  }
+  check_error (component, component_wait (component, events,
+      retrieved_events));
 }
 
 void init_component (component_t* component){
   printf ("initializing component %s\n", component->name);
-  
-  OMX_ERRORTYPE error;
-  
-  //Create the event flags
-  if (vcos_event_flags_create (&component->flags, "component")){
-    fprintf (stderr, "error: vcos_event_flags_create\n");
-    exit (1);
-  }
-  
-  //Each component has an event_handler and fill_buffer_done functions
-  OMX_CALLBACKTYPE callbacks_st;
-  callbacks_st.EventHandler = event_handler;
-  callbacks_st.FillBufferDone = fill_buffer_done;
-  
-  //Get the handle
-  if ((error = OMX_GetHandle (&component->handle, component->name, component,
-      &callbacks_st))){
-    fprintf (stderr, "error: OMX_GetHandle: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
-  
-  //Disable all the ports
-  OMX_INDEXTYPE types[] = {
-    OMX_IndexParamAudioInit,
-    OMX_IndexParamVideoInit,
-    OMX_IndexParamImageInit,
-    OMX_IndexParamOtherInit
-  };
-  OMX_PORT_PARAM_TYPE ports_st;
-  OMX_INIT_STRUCTURE (ports_st);
-
-  int i;
-  for (i=0; i<4; i++){
-    if ((error = OMX_GetParameter (component->handle, types[i], &ports_st))){
-      fprintf (stderr, "error: OMX_GetParameter: %s\n",
-          dump_OMX_ERRORTYPE (error));
-      exit (1);
-    }
-    
-    OMX_U32 port;
-    for (port=ports_st.nStartPortNumber;
-        port<ports_st.nStartPortNumber + ports_st.nPorts; port++){
-      //Disable the port
-      disable_port (component, port);
-      //Wait to the event
-      wait (component, EVENT_PORT_DISABLE, 0);
-    }
-  }
+  check_error (component, component_init (component, component->name,
+      &callbacks, 0));
 }
 
 void deinit_component (component_t* component){
   printf ("deinitializing component %s\n", component->name);
-  
-  OMX_ERRORTYPE error;
-  
-  vcos_event_flags_delete (&component->flags);
-
-  if ((error = OMX_FreeHandle (component->handle))){
-    fprintf (stderr, "error: OMX_FreeHandle: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
+  check_error (component, component_deinit (component));
 }
 
-void load_camera_drivers (component_t* component){
-  /*
-  This is a specific behaviour of the Broadcom's Raspberry Pi OpenMAX IL
-  implementation module because the OMX_SetConfig() and OMX_SetParameter() are
-  blocking functions but the drivers are loaded asynchronously, that is, an
-  event is fired to signal the completion. Basically, what you're saying is:
-  
-  "When the parameter with index OMX_IndexParamCameraDeviceNumber is set, load
-  the camera drivers and emit an OMX_EventParamOrConfigChanged event"
-  
-  The red LED of the camera will be turned on after this call.
-  */
-  
-  printf ("loading camera drivers\n");
-  
-  OMX_ERRORTYPE error;
-
-  OMX_CONFIG_REQUESTCALLBACKTYPE cbs_st;
-  OMX_INIT_STRUCTURE (cbs_st);
-  cbs_st.nPortIndex = OMX_ALL;
-  cbs_st.nIndex = OMX_IndexParamCameraDeviceNumber;
-  cbs_st.bEnable = OMX_TRUE;
-  if ((error = OMX_SetConfig (component->handle, OMX_IndexConfigRequestCallback,
-      &cbs_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
-  
-  OMX_PARAM_U32TYPE dev_st;
-  OMX_INIT_STRUCTURE (dev_st);
-  dev_st.nPortIndex = OMX_ALL;
-  //ID for the camera device
-  dev_st.nU32 = 0;
-  if ((error = OMX_SetParameter (component->handle,
-      OMX_IndexParamCameraDeviceNumber, &dev_st))){
-    fprintf (stderr, "error: OMX_SetParameter: %s\n",
-        dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
-  
-  wait (component, EVENT_PARAM_OR_CONFIG_CHANGED, 0);
+void load_camera_drivers (component_t* component, OMX_U32 device){
+  printf ("loading camera %u drivers\n", device);
+  check_error (component, component_load_camera_drivers (component, device));
 }
 
 void change_state (component_t* component, OMX_STATETYPE state){
   printf ("changing %s state to %s\n", component->name,
       dump_OMX_STATETYPE (state));
-  
-  OMX_ERRORTYPE error;
-  
-  if ((error = OMX_SendCommand (component->handle, OMX_CommandStateSet, state,
-      0))){
-    fprintf (stderr, "error: OMX_SendCommand: %s\n",
-        dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
+  check_error (component, component_command (component, OMX_CommandStateSet,
+      state));
 }
 
 void enable_port (component_t* component, OMX_U32 port){
   printf ("enabling port %d (%s)\n", port, component->name);
-  
-  OMX_ERRORTYPE error;
-  
-  if ((error = OMX_SendCommand (component->handle, OMX_CommandPortEnable,
-      port, 0))){
-    fprintf (stderr, "error: OMX_SendCommand: %s\n",
-        dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
+  check_error (component, component_command (component,
+      OMX_CommandPortEnable, port));
 }
 
 void disable_port (component_t* component, OMX_U32 port){
   printf ("disabling port %d (%s)\n", port, component->name);
-  
-  OMX_ERRORTYPE error;
-  
-  if ((error = OMX_SendCommand (component->handle, OMX_CommandPortDisable,
-      port, 0))){
-    fprintf (stderr, "error: OMX_SendCommand: %s\n",
-        dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
+  check_error (component, component_command (component,
+      OMX_CommandPortDisable, port));
 }
 
-void enable_encoder_output_port (
-    component_t* encoder,
-    OMX_BUFFERHEADERTYPE** encoder_output_buffer){
-  //The port is not enabled until the buffer is allocated
-  OMX_ERRORTYPE error;
-  
-  enable_port (encoder, 201);
-  
-  OMX_PARAM_PORTDEFINITIONTYPE port_st;
-  OMX_INIT_STRUCTURE (port_st);
-  port_st.nPortIndex = 201;
-  if ((error = OMX_GetParameter (encoder->handle, OMX_IndexParamPortDefinition,
-      &port_st))){
-    fprintf (stderr, "error: OMX_GetParameter: %s\n",
-        dump_OMX_ERRORTYPE (error));
+//Monotonic time (us)
+int64_t get_time (){
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  return (int64_t)spec.tv_sec*1000000 + spec.tv_nsec/1000;
+}
+
+void buffer_queue_init (buffer_queue_t* queue){
+  queue->head = 0;
+  queue->length = 0;
+  if (vcos_mutex_create (&queue->mutex, "buffer_queue")){
+    fprintf (stderr, "error: vcos_mutex_create\n");
     exit (1);
   }
-  printf ("allocating %s output buffer\n", encoder->name);
-  if ((error = OMX_AllocateBuffer (encoder->handle, encoder_output_buffer, 201,
-      0, port_st.nBufferSize))){
-    fprintf (stderr, "error: OMX_AllocateBuffer: %s\n",
-        dump_OMX_ERRORTYPE (error));
+  if (vcos_event_flags_create (&queue->flags, "buffer_queue")){
+    fprintf (stderr, "error: vcos_event_flags_create\n");
     exit (1);
   }
-  
-  wait (encoder, EVENT_PORT_ENABLE, 0);
 }
 
-void disable_encoder_output_port (
-    component_t* encoder,
-    OMX_BUFFERHEADERTYPE* encoder_output_buffer){
-  //The port is not disabled until the buffer is released
-  OMX_ERRORTYPE error;
-  
-  disable_port (encoder, 201);
-  
-  //Free encoder output buffer
-  printf ("releasing %s output buffer\n", encoder->name);
-  if ((error = OMX_FreeBuffer (encoder->handle, 201, encoder_output_buffer))){
-    fprintf (stderr, "error: OMX_FreeBuffer: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
-  
-  wait (encoder, EVENT_PORT_DISABLE, 0);
+void buffer_queue_deinit (buffer_queue_t* queue){
+  vcos_event_flags_delete (&queue->flags);
+  vcos_mutex_delete (&queue->mutex);
 }
 
-void set_camera_settings (component_t* camera){
-  printf ("configuring '%s' settings\n", camera->name);
+void buffer_queue_push (buffer_queue_t* queue, OMX_BUFFERHEADERTYPE* buffer){
+  int64_t now = get_time ();
+  vcos_mutex_lock (&queue->mutex);
+  //There are never more filled buffers than allocated ones
+  int i = (queue->head + queue->length++) % QUEUE_SIZE;
+  queue->buffers[i] = buffer;
+  queue->arrivals[i] = now;
+  vcos_mutex_unlock (&queue->mutex);
+  vcos_event_flags_set (&queue->flags, EVENT_FILL_BUFFER_DONE, VCOS_OR);
+}
 
-  OMX_ERRORTYPE error;
-  
-  //Sharpness
-  OMX_CONFIG_SHARPNESSTYPE sharpness_st;
-  OMX_INIT_STRUCTURE (sharpness_st);
-  sharpness_st.nPortIndex = OMX_ALL;
-  sharpness_st.nSharpness = CAM_SHARPNESS;
-  if ((error = OMX_SetConfig (camera->handle, OMX_IndexConfigCommonSharpness,
-      &sharpness_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
-  
-  //Contrast
-  OMX_CONFIG_CONTRASTTYPE contrast_st;
-  OMX_INIT_STRUCTURE (contrast_st);
-  contrast_st.nPortIndex = OMX_ALL;
-  contrast_st.nContrast = CAM_CONTRAST;
-  if ((error = OMX_SetConfig (camera->handle, OMX_IndexConfigCommonContrast,
-      &contrast_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
+OMX_BUFFERHEADERTYPE* buffer_queue_pop (
+    buffer_queue_t* queue,
+    int64_t* arrival){
+  OMX_BUFFERHEADERTYPE* buffer = 0;
+  vcos_mutex_lock (&queue->mutex);
+  if (queue->length){
+    buffer = queue->buffers[queue->head];
+    *arrival = queue->arrivals[queue->head];
+    queue->head = (queue->head + 1) % QUEUE_SIZE;
+    queue->length--;
   }
-  
-  //Saturation
-  OMX_CONFIG_SATURATIONTYPE saturation_st;
-  OMX_INIT_STRUCTURE (saturation_st);
-  saturation_st.nPortIndex = OMX_ALL;
-  saturation_st.nSaturation = CAM_SATURATION;
-  if ((error = OMX_SetConfig (camera->handle, OMX_IndexConfigCommonSaturation,
-      &saturation_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
+  vcos_mutex_unlock (&queue->mutex);
+  return buffer;
+}
+
+//Waits until a buffer is pushed, like wait() but for any encoder. Returns 0 if
+//the timeout (ms or VCOS_SUSPEND) expires
+int buffer_queue_wait (buffer_queue_t* queue, VCOS_UNSIGNED timeout){
+  VCOS_UNSIGNED set;
+  VCOS_STATUS_T status = vcos_event_flags_get (&queue->flags,
+      EVENT_FILL_BUFFER_DONE | EVENT_ERROR, VCOS_OR_CONSUME, timeout, &set);
+  if (status == VCOS_EAGAIN){
+    return 0;
   }
-  
-  //Brightness
-  OMX_CONFIG_BRIGHTNESSTYPE brightness_st;
-  OMX_INIT_STRUCTURE (brightness_st);
-  brightness_st.nPortIndex = OMX_ALL;
-  brightness_st.nBrightness = CAM_BRIGHTNESS;
-  if ((error = OMX_SetConfig (camera->handle, OMX_IndexConfigCommonBrightness,
-      &brightness_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
+  if (status){
+    fprintf (stderr, "error: vcos_event_flags_get\n");
     exit (1);
   }
-  
-  //Exposure value
-  OMX_CONFIG_EXPOSUREVALUETYPE exposure_value_st;
-  OMX_INIT_STRUCTURE (exposure_value_st);
-  exposure_value_st.nPortIndex = OMX_ALL;
-  exposure_value_st.eMetering = CAM_METERING;
-  exposure_value_st.xEVCompensation =
-      (OMX_S32)((CAM_EXPOSURE_COMPENSATION<<16)/6.0);
-  exposure_value_st.nShutterSpeedMsec = (OMX_U32)((CAM_SHUTTER_SPEED)*1e6);
-  exposure_value_st.bAutoShutterSpeed = CAM_SHUTTER_SPEED_AUTO;
-  exposure_value_st.nSensitivity = CAM_ISO;
-  exposure_value_st.bAutoSensitivity = CAM_ISO_AUTO;
-  if ((error = OMX_SetConfig (camera->handle,
-      OMX_IndexConfigCommonExposureValue, &exposure_value_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
+  if (set == EVENT_ERROR){
     exit (1);
   }
-  
-  //Exposure control
-  OMX_CONFIG_EXPOSURECONTROLTYPE exposure_control_st;
-  OMX_INIT_STRUCTURE (exposure_control_st);
-  exposure_control_st.nPortIndex = OMX_ALL;
-  exposure_control_st.eExposureControl = CAM_EXPOSURE;
-  if ((error = OMX_SetConfig (camera->handle, OMX_IndexConfigCommonExposure,
-      &exposure_control_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
+  return 1;
+}
+
+void enable_encoder_output_port (
+    component_t* encoder,
+    OMX_U32 port,
+    OMX_BUFFERHEADERTYPE** encoder_output_buffers,
+    int buffers_length){
+  printf ("allocating %s output buffers\n", encoder->name);
+  check_error (encoder, component_enable_output_port (encoder, port,
+      encoder_output_buffers, buffers_length));
+  printf ("allocated %s output buffers: %d x %d bytes\n", encoder->name,
+      buffers_length, encoder_output_buffers[0]->nAllocLen);
+}
+
+void disable_encoder_output_port (
+    component_t* encoder,
+    OMX_U32 port,
+    OMX_BUFFERHEADERTYPE** encoder_output_buffers,
+    int buffers_length){
+  printf ("releasing %s output buffers\n", encoder->name);
+  check_error (encoder, component_disable_output_port (encoder, port,
+      encoder_output_buffers, buffers_length));
+}
+
+//Enables an input port with the memory of the output buffers of another
+//component, so the data is not copied between them. The buffers are released
+//like the output buffers, with disable_encoder_output_port()
+void enable_input_port (
+    component_t* component,
+    OMX_U32 port,
+    OMX_BUFFERHEADERTYPE** output_buffers,
+    OMX_BUFFERHEADERTYPE** input_buffers,
+    int buffers_length){
+  printf ("sharing %d buffers with %s\n", buffers_length, component->name);
+  check_error (component, component_enable_input_port (component, port,
+      output_buffers, input_buffers, buffers_length));
+}
+
+//OMX values of the settings with names (see tuning.h), in the order of their
+//names in tuning.c
+const int32_t tuning_metering[] = {
+  OMX_MeteringModeAverage, OMX_MeteringModeSpot, OMX_MeteringModeMatrix,
+  OMX_MeteringModeBacklit
+};
+
+const int32_t tuning_exposure[] = {
+  OMX_ExposureControlOff, OMX_ExposureControlAuto, OMX_ExposureControlNight,
+  OMX_ExposureControlBackLight, OMX_ExposureControlSpotLight,
+  OMX_ExposureControlSports, OMX_ExposureControlSnow,
+  OMX_ExposureControlBeach, OMX_ExposureControlLargeAperture,
+  OMX_ExposureControlSmallAperture, OMX_ExposureControlVeryLong,
+  OMX_ExposureControlFixedFps, OMX_ExposureControlNightWithPreview,
+  OMX_ExposureControlAntishake, OMX_ExposureControlFireworks
+};
+
+const int32_t tuning_white_balance[] = {
+  OMX_WhiteBalControlOff, OMX_WhiteBalControlAuto, OMX_WhiteBalControlSunLight,
+  OMX_WhiteBalControlCloudy, OMX_WhiteBalControlShade,
+  OMX_WhiteBalControlTungsten, OMX_WhiteBalControlFluorescent,
+  OMX_WhiteBalControlIncandescent, OMX_WhiteBalControlFlash,
+  OMX_WhiteBalControlHorizon
+};
+
+const int32_t tuning_mirror[] = {
+  OMX_MirrorNone, OMX_MirrorHorizontal, OMX_MirrorVertical, OMX_MirrorBoth
+};
+
+const int32_t tuning_drc[] = {
+  OMX_DynRangeExpOff, OMX_DynRangeExpLow, OMX_DynRangeExpMedium,
+  OMX_DynRangeExpHigh
+};
+
+//Index of an OMX value in one of the tables above
+#define get_tuning_index(table, value) \
+  get_index (table, sizeof (table)/sizeof (table[0]), value)
+
+int32_t get_index (const int32_t* table, int length, int32_t value){
+  int i;
+  for (i=0; i<length && table[i] != value; i++);
+  return i;
+}
+
+//Fills the live settings (see tuning.h) with the CAM_* macros and the encoder
+//settings
+void get_tuning_defaults (int32_t* values, h264_settings_t* settings){
+  values[TUNING_VALUE_SHARPNESS] = CAM_SHARPNESS;
+  values[TUNING_VALUE_CONTRAST] = CAM_CONTRAST;
+  values[TUNING_VALUE_BRIGHTNESS] = CAM_BRIGHTNESS;
+  values[TUNING_VALUE_SATURATION] = CAM_SATURATION;
+  values[TUNING_VALUE_METERING] = get_tuning_index (tuning_metering,
+      CAM_METERING);
+  values[TUNING_VALUE_EV] = CAM_EXPOSURE_COMPENSATION;
+  values[TUNING_VALUE_SHUTTER] = CAM_SHUTTER_SPEED_AUTO ? 0 :
+      (int32_t)((CAM_SHUTTER_SPEED)*1e6);
+  values[TUNING_VALUE_ISO] = CAM_ISO_AUTO ? 0 : CAM_ISO;
+  values[TUNING_VALUE_EXPOSURE] = get_tuning_index (tuning_exposure,
+      CAM_EXPOSURE);
+  values[TUNING_VALUE_STABILISATION] = CAM_FRAME_STABILIZATION;
+  values[TUNING_VALUE_AWB] = get_tuning_index (tuning_white_balance,
+      CAM_WHITE_BALANCE);
+  values[TUNING_VALUE_AWB_RED] = CAM_WHITE_BALANCE_RED_GAIN;
+  values[TUNING_VALUE_AWB_BLUE] = CAM_WHITE_BALANCE_BLUE_GAIN;
+  values[TUNING_VALUE_MIRROR] = get_tuning_index (tuning_mirror, CAM_MIRROR);
+  values[TUNING_VALUE_DENOISE] = CAM_NOISE_REDUCTION;
+  values[TUNING_VALUE_ROI_LEFT] = CAM_ROI_LEFT;
+  values[TUNING_VALUE_ROI_TOP] = CAM_ROI_TOP;
+  values[TUNING_VALUE_ROI_WIDTH] = CAM_ROI_WIDTH;
+  values[TUNING_VALUE_ROI_HEIGHT] = CAM_ROI_HEIGHT;
+  values[TUNING_VALUE_DRC] = get_tuning_index (tuning_drc, CAM_DRC);
+  values[TUNING_VALUE_BITRATE] = settings->bitrate;
+  values[TUNING_VALUE_IDR_PERIOD] = settings->idr_period;
+}
+
+//Applies a config of the camera, they can be changed while capturing
+OMX_ERRORTYPE set_camera_config (
+    component_t* camera,
+    const int32_t* values,
+    tuning_config_t config){
+  switch (config){
+    case TUNING_SHARPNESS: {
+      OMX_CONFIG_SHARPNESSTYPE sharpness_st;
+      OMX_INIT_STRUCTURE (sharpness_st);
+      sharpness_st.nPortIndex = OMX_ALL;
+      sharpness_st.nSharpness = values[TUNING_VALUE_SHARPNESS];
+      return OMX_SetConfig (camera->handle, OMX_IndexConfigCommonSharpness,
+          &sharpness_st);
+    }
+    case TUNING_CONTRAST: {
+      OMX_CONFIG_CONTRASTTYPE contrast_st;
+      OMX_INIT_STRUCTURE (contrast_st);
+      contrast_st.nPortIndex = OMX_ALL;
+      contrast_st.nContrast = values[TUNING_VALUE_CONTRAST];
+      return OMX_SetConfig (camera->handle, OMX_IndexConfigCommonContrast,
+          &contrast_st);
+    }
+    case TUNING_SATURATION: {
+      OMX_CONFIG_SATURATIONTYPE saturation_st;
+      OMX_INIT_STRUCTURE (saturation_st);
+      saturation_st.nPortIndex = OMX_ALL;
+      saturation_st.nSaturation = values[TUNING_VALUE_SATURATION];
+      return OMX_SetConfig (camera->handle, OMX_IndexConfigCommonSaturation,
+          &saturation_st);
+    }
+    case TUNING_BRIGHTNESS: {
+      OMX_CONFIG_BRIGHTNESSTYPE brightness_st;
+      OMX_INIT_STRUCTURE (brightness_st);
+      brightness_st.nPortIndex = OMX_ALL;
+      brightness_st.nBrightness = values[TUNING_VALUE_BRIGHTNESS];
+      return OMX_SetConfig (camera->handle, OMX_IndexConfigCommonBrightness,
+          &brightness_st);
+    }
+    case TUNING_EXPOSURE_VALUE: {
+      OMX_CONFIG_EXPOSUREVALUETYPE exposure_value_st;
+      OMX_INIT_STRUCTURE (exposure_value_st);
+      exposure_value_st.nPortIndex = OMX_ALL;
+      exposure_value_st.eMetering =
+          tuning_metering[values[TUNING_VALUE_METERING]];
+      exposure_value_st.xEVCompensation =
+          (OMX_S32)((values[TUNING_VALUE_EV]<<16)/6.0);
+      exposure_value_st.nShutterSpeedMsec = values[TUNING_VALUE_SHUTTER];
+      exposure_value_st.bAutoShutterSpeed = !values[TUNING_VALUE_SHUTTER];
+      exposure_value_st.nSensitivity = values[TUNING_VALUE_ISO] ?
+          values[TUNING_VALUE_ISO] : CAM_ISO;
+      exposure_value_st.bAutoSensitivity = !values[TUNING_VALUE_ISO];
+      return OMX_SetConfig (camera->handle,
+          OMX_IndexConfigCommonExposureValue, &exposure_value_st);
+    }
+    case TUNING_EXPOSURE: {
+      OMX_CONFIG_EXPOSURECONTROLTYPE exposure_control_st;
+      OMX_INIT_STRUCTURE (exposure_control_st);
+      exposure_control_st.nPortIndex = OMX_ALL;
+      exposure_control_st.eExposureControl =
+          tuning_exposure[values[TUNING_VALUE_EXPOSURE]];
+      return OMX_SetConfig (camera->handle, OMX_IndexConfigCommonExposure,
+          &exposure_control_st);
+    }
+    case TUNING_STABILISATION: {
+      OMX_CONFIG_FRAMESTABTYPE frame_stabilisation_st;
+      OMX_INIT_STRUCTURE (frame_stabilisation_st);
+      frame_stabilisation_st.nPortIndex = OMX_ALL;
+      frame_stabilisation_st.bStab = values[TUNING_VALUE_STABILISATION];
+      return OMX_SetConfig (camera->handle,
+          OMX_IndexConfigCommonFrameStabilisation, &frame_stabilisation_st);
+    }
+    case TUNING_WHITE_BALANCE: {
+      OMX_CONFIG_WHITEBALCONTROLTYPE white_balance_st;
+      OMX_INIT_STRUCTURE (white_balance_st);
+      white_balance_st.nPortIndex = OMX_ALL;
+      white_balance_st.eWhiteBalControl =
+          tuning_white_balance[values[TUNING_VALUE_AWB]];
+      return OMX_SetConfig (camera->handle, OMX_IndexConfigCommonWhiteBalance,
+          &white_balance_st);
+    }
+    case TUNING_AWB_GAINS: {
+      OMX_CONFIG_CUSTOMAWBGAINSTYPE white_balance_gains_st;
+      OMX_INIT_STRUCTURE (white_balance_gains_st);
+      white_balance_gains_st.xGainR =
+          (values[TUNING_VALUE_AWB_RED] << 16)/1000;
+      white_balance_gains_st.xGainB =
+          (values[TUNING_VALUE_AWB_BLUE] << 16)/1000;
+      return OMX_SetConfig (camera->handle, OMX_IndexConfigCustomAwbGains,
+          &white_balance_gains_st);
+    }
+    case TUNING_MIRROR: {
+      OMX_CONFIG_MIRRORTYPE mirror_st;
+      OMX_INIT_STRUCTURE (mirror_st);
+      mirror_st.nPortIndex = 71;
+      mirror_st.eMirror = tuning_mirror[values[TUNING_VALUE_MIRROR]];
+      return OMX_SetConfig (camera->handle, OMX_IndexConfigCommonMirror,
+          &mirror_st);
+    }
+    case TUNING_DENOISE: {
+      OMX_CONFIG_BOOLEANTYPE denoise_st;
+      OMX_INIT_STRUCTURE (denoise_st);
+      denoise_st.bEnabled = values[TUNING_VALUE_DENOISE];
+      return OMX_SetConfig (camera->handle,
+          OMX_IndexConfigStillColourDenoiseEnable, &denoise_st);
+    }
+    case TUNING_ROI: {
+      OMX_CONFIG_INPUTCROPTYPE roi_st;
+      OMX_INIT_STRUCTURE (roi_st);
+      roi_st.nPortIndex = OMX_ALL;
+      roi_st.xLeft = (values[TUNING_VALUE_ROI_LEFT] << 16)/100;
+      roi_st.xTop = (values[TUNING_VALUE_ROI_TOP] << 16)/100;
+      roi_st.xWidth = (values[TUNING_VALUE_ROI_WIDTH] << 16)/100;
+      roi_st.xHeight = (values[TUNING_VALUE_ROI_HEIGHT] << 16)/100;
+      return OMX_SetConfig (camera->handle,
+          OMX_IndexConfigInputCropPercentages, &roi_st);
+    }
+    case TUNING_DRC: {
+      OMX_CONFIG_DYNAMICRANGEEXPANSIONTYPE drc_st;
+      OMX_INIT_STRUCTURE (drc_st);
+      drc_st.eMode = tuning_drc[values[TUNING_VALUE_DRC]];
+      return OMX_SetConfig (camera->handle,
+          OMX_IndexConfigDynamicRangeExpansion, &drc_st);
+    }
+    default:
+      return OMX_ErrorBadParameter;
   }
+}
+
+//Applies a config of the encoder. The bitrate is used at once, the IDR period
+//after the next IDR frame
+OMX_ERRORTYPE set_encoder_config (
+    component_t* encoder,
+    const int32_t* values,
+    tuning_config_t config){
+  OMX_ERRORTYPE error;
   
-  //Frame stabilisation
-  OMX_CONFIG_FRAMESTABTYPE frame_stabilisation_st;
-  OMX_INIT_STRUCTURE (frame_stabilisation_st);
-  frame_stabilisation_st.nPortIndex = OMX_ALL;
-  frame_stabilisation_st.bStab = CAM_FRAME_STABILIZATION;
-  if ((error = OMX_SetConfig (camera->handle,
-      OMX_IndexConfigCommonFrameStabilisation, &frame_stabilisation_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
+  switch (config){
+    case TUNING_BITRATE: {
+      OMX_VIDEO_CONFIG_BITRATETYPE bitrate_st;
+      OMX_INIT_STRUCTURE (bitrate_st);
+      bitrate_st.nPortIndex = 201;
+      bitrate_st.nEncodeBitrate = values[TUNING_VALUE_BITRATE];
+      return OMX_SetConfig (encoder->handle, OMX_IndexConfigVideoBitrate,
+          &bitrate_st);
+    }
+    case TUNING_IDR_PERIOD: {
+      OMX_VIDEO_CONFIG_AVCINTRAPERIOD idr_st;
+      OMX_INIT_STRUCTURE (idr_st);
+      idr_st.nPortIndex = 201;
+      if ((error = OMX_GetConfig (encoder->handle,
+          OMX_IndexConfigVideoAVCIntraPeriod, &idr_st))){
+        return error;
+      }
+      idr_st.nIDRPeriod = values[TUNING_VALUE_IDR_PERIOD];
+      return OMX_SetConfig (encoder->handle,
+          OMX_IndexConfigVideoAVCIntraPeriod, &idr_st);
+    }
+    default:
+      return OMX_ErrorBadParameter;
   }
+}
+
+//Applies the configs requested by the control channel (see tuning.h). Called
+//by the encoder loop, a config that fails keeps its previous values
+void apply_tuning (pipeline_t* pipeline){
+  int32_t values[TUNING_VALUES];
+  uint32_t configs = tuning_begin (&pipeline->tuning, values);
+  OMX_ERRORTYPE error;
+  int64_t start;
+  int i;
   
-  //White balance
-  OMX_CONFIG_WHITEBALCONTROLTYPE white_balance_st;
-  OMX_INIT_STRUCTURE (white_balance_st);
-  white_balance_st.nPortIndex = OMX_ALL;
-  white_balance_st.eWhiteBalControl = CAM_WHITE_BALANCE;
-  if ((error = OMX_SetConfig (camera->handle, OMX_IndexConfigCommonWhiteBalance,
-      &white_balance_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
+  for (i=0; i<TUNING_CONFIGS; i++){
+    if (!(configs & (1 << i))) continue;
+    start = tuning_time ();
+    if (i == TUNING_BITRATE || i == TUNING_IDR_PERIOD){
+      error = set_encoder_config (&pipeline->encoder, values, i);
+    }else{
+      error = set_camera_config (&pipeline->camera, values, i);
+    }
+    if (error){
+      fprintf (stderr, "warning: camera %u: OMX_SetConfig: %s\n",
+          pipeline->device, dump_OMX_ERRORTYPE (error));
+    }
+    tuning_applied (&pipeline->tuning, i, values,
+        error ? dump_OMX_ERRORTYPE (error) : 0, start);
   }
+  tuning_end (&pipeline->tuning);
+}
+
+void set_camera_settings (component_t* camera, const int32_t* values){
+  printf ("configuring '%s' settings\n", camera->name);
+
+  OMX_ERRORTYPE error;
+  int i;
   
-  //White balance gains (if white balance is set to off)
-  if (!CAM_WHITE_BALANCE){
-    OMX_CONFIG_CUSTOMAWBGAINSTYPE white_balance_gains_st;
-    OMX_INIT_STRUCTURE (white_balance_gains_st);
-    white_balance_gains_st.xGainR = (CAM_WHITE_BALANCE_RED_GAIN << 16)/1000;
-    white_balance_gains_st.xGainB = (CAM_WHITE_BALANCE_BLUE_GAIN << 16)/1000;
-    if ((error = OMX_SetConfig (camera->handle, OMX_IndexConfigCustomAwbGains,
-        &white_balance_gains_st))){
+  //The configs that can be changed while recording (see tuning.h). The gains
+  //are only used if the white balance is off
+  for (i=0; i<TUNING_BITRATE; i++){
+    if (i == TUNING_AWB_GAINS &&
+        values[TUNING_VALUE_AWB] != TUNING_AWB_OFF){
+      continue;
+    }
+    if ((error = set_camera_config (camera, values, i))){
       fprintf (stderr, "error: OMX_SetConfig: %s\n",
           dump_OMX_ERRORTYPE (error));
       exit (1);
@@ -668,17 +1015,6 @@ void set_camera_settings (component_t* camera){
     exit (1);
   }
   
-  //Mirror
-  OMX_CONFIG_MIRRORTYPE mirror_st;
-  OMX_INIT_STRUCTURE (mirror_st);
-  mirror_st.nPortIndex = 71;
-  mirror_st.eMirror = CAM_MIRROR;
-  if ((error = OMX_SetConfig (camera->handle, OMX_IndexConfigCommonMirror,
-      &mirror_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
-  
   //Rotation
   OMX_CONFIG_ROTATIONTYPE rotation_st;
   OMX_INIT_STRUCTURE (rotation_st);
@@ -702,53 +1038,19 @@ void set_camera_settings (component_t* camera){
     fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
     exit (1);
   }
-  
-  //Denoise
-  OMX_CONFIG_BOOLEANTYPE denoise_st;
-  OMX_INIT_STRUCTURE (denoise_st);
-  denoise_st.bEnabled = CAM_NOISE_REDUCTION;
-  if ((error = OMX_SetConfig (camera->handle,
-      OMX_IndexConfigStillColourDenoiseEnable, &denoise_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
-  
-  //ROI
-  OMX_CONFIG_INPUTCROPTYPE roi_st;
-  OMX_INIT_STRUCTURE (roi_st);
-  roi_st.nPortIndex = OMX_ALL;
-  roi_st.xLeft = (CAM_ROI_LEFT << 16)/100;
-  roi_st.xTop = (CAM_ROI_TOP << 16)/100;
-  roi_st.xWidth = (CAM_ROI_WIDTH << 16)/100;
-  roi_st.xHeight = (CAM_ROI_HEIGHT << 16)/100;
-  if ((error = OMX_SetConfig (camera->handle,
-      OMX_IndexConfigInputCropPercentages, &roi_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
-  
-  //DRC
-  OMX_CONFIG_DYNAMICRANGEEXPANSIONTYPE drc_st;
-  OMX_INIT_STRUCTURE (drc_st);
-  drc_st.eMode = CAM_DRC;
-  if ((error = OMX_SetConfig (camera->handle,
-      OMX_IndexConfigDynamicRangeExpansion, &drc_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
-  }
 }
 
-void set_h264_settings (component_t* encoder){
+void set_h264_settings (component_t* encoder, h264_settings_t* settings){
   printf ("configuring '%s' settings\n", encoder->name);
   
   OMX_ERRORTYPE error;
   
-  if (!VIDEO_QP){
+  if (!settings->qp){
     //Bitrate
     OMX_VIDEO_PARAM_BITRATETYPE bitrate_st;
     OMX_INIT_STRUCTURE (bitrate_st);
     bitrate_st.eControlRate = OMX_Video_ControlRateVariable;
-    bitrate_st.nTargetBitrate = VIDEO_BITRATE;
+    bitrate_st.nTargetBitrate = settings->bitrate;
     bitrate_st.nPortIndex = 201;
     if ((error = OMX_SetParameter (encoder->handle, OMX_IndexParamVideoBitrate,
         &bitrate_st))){
@@ -762,8 +1064,8 @@ void set_h264_settings (component_t* encoder){
     OMX_INIT_STRUCTURE (quantization_st);
     quantization_st.nPortIndex = 201;
     //nQpB returns an error, it cannot be modified
-    quantization_st.nQpI = VIDEO_QP_I;
-    quantization_st.nQpP = VIDEO_QP_P;
+    quantization_st.nQpI = settings->qp_i;
+    quantization_st.nQpP = settings->qp_p;
     if ((error = OMX_SetParameter (encoder->handle,
         OMX_IndexParamVideoQuantization, &quantization_st))){
       fprintf (stderr, "error: OMX_SetParameter: %s\n",
@@ -794,7 +1096,7 @@ void set_h264_settings (component_t* encoder){
     fprintf (stderr, "error: OMX_GetConfig: %s\n", dump_OMX_ERRORTYPE (error));
     exit (1);
   }
-  idr_st.nIDRPeriod = VIDEO_IDR_PERIOD;
+  idr_st.nIDRPeriod = settings->idr_period;
   if ((error = OMX_SetConfig (encoder->handle,
       OMX_IndexConfigVideoAVCIntraPeriod, &idr_st))){
     fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
@@ -846,7 +1148,7 @@ void set_h264_settings (component_t* encoder){
         dump_OMX_ERRORTYPE (error));
     exit (1);
   }
-  avc_st.eProfile = VIDEO_PROFILE;
+  avc_st.eProfile = settings->profile;
   if ((error = OMX_SetParameter (encoder->handle,
       OMX_IndexParamVideoAvc, &avc_st))){
     fprintf (stderr, "error: OMX_SetParameter: %s\n",
@@ -872,46 +1174,357 @@ void set_h264_settings (component_t* encoder){
   //https://github.com/gagle/raspberrypi-omxcam/blob/master/src/video.c
 }
 
-int main (){
-  OMX_ERRORTYPE error;
-  OMX_BUFFERHEADERTYPE* encoder_output_buffer;
-  component_t camera;
-  component_t encoder;
-  component_t null_sink;
-  camera.name = "OMX.broadcom.camera";
-  encoder.name = "OMX.broadcom.video_encode";
-  null_sink.name = "OMX.broadcom.null_sink";
-  
-  //Open the file
-  int fd = open (FILENAME, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
-  if (fd == -1){
-    fprintf (stderr, "error: open\n");
-    exit (1);
-  }
+void set_low_latency_settings (component_t* encoder){
+  printf ("configuring %s low latency settings\n", encoder->name);
   
-  //Initialize Broadcom's VideoCore APIs
-  bcm_host_init ();
+  OMX_ERRORTYPE error;
   
-  //Initialize OpenMAX IL
-  if ((error = OMX_Init ())){
-    fprintf (stderr, "error: OMX_Init: %s\n", dump_OMX_ERRORTYPE (error));
+  //Slices, every one is sent as soon as it's encoded
+  OMX_PARAM_U32TYPE slice_st;
+  OMX_INIT_STRUCTURE (slice_st);
+  slice_st.nPortIndex = 201;
+  slice_st.nU32 = LOWLATENCY_MB_ROWS_PER_SLICE;
+  if ((error = OMX_SetConfig (encoder->handle,
+      OMX_IndexConfigBrcmVideoEncoderMBRowsPerSlice, &slice_st))){
+    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
     exit (1);
   }
+}
+
+void request_idr (component_t* encoder){
+  printf ("requesting %s IDR frame\n", encoder->name);
+  
+  OMX_ERRORTYPE error;
+  
+  OMX_CONFIG_PORTBOOLEANTYPE idr_st;
+  OMX_INIT_STRUCTURE (idr_st);
+  idr_st.nPortIndex = 201;
+  idr_st.bEnabled = OMX_TRUE;
+  if ((error = OMX_SetConfig (encoder->handle,
+      OMX_IndexConfigBrcmVideoRequestIFrame, &idr_st))){
+    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+}
+
+void set_capture (component_t* camera, OMX_U32 port, OMX_BOOL enabled){
+  printf ("%s %s capture port %d\n", enabled ? "enabling" : "disabling",
+      camera->name, port);
+  check_error (camera, component_set_capture (camera, port, enabled));
+}
+
+//Configures the still port of the camera and the JPEG settings of the image
+//encoder
+void set_still_settings (component_t* camera, component_t* image_encoder){
+  printf ("configuring %s still settings\n", camera->name);
+  
+  OMX_ERRORTYPE error;
+  
+  //Still port definition, full resolution
+  OMX_PARAM_PORTDEFINITIONTYPE port_st;
+  OMX_INIT_STRUCTURE (port_st);
+  port_st.nPortIndex = 72;
+  if ((error = OMX_GetParameter (camera->handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    fprintf (stderr, "error: OMX_GetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+  port_st.format.image.nFrameWidth = STILL_WIDTH;
+  port_st.format.image.nFrameHeight = STILL_HEIGHT;
+  port_st.format.image.nStride = STILL_WIDTH;
+  port_st.format.image.eCompressionFormat = OMX_IMAGE_CodingUnused;
+  port_st.format.image.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+  if ((error = OMX_SetParameter (camera->handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    fprintf (stderr, "error: OMX_SetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+  
+  //The video port is resumed as soon as the still has been captured, instead
+  //of waiting for the end of the capture
+  OMX_PARAM_CAMERACAPTUREMODETYPE mode_st;
+  OMX_INIT_STRUCTURE (mode_st);
+  mode_st.nPortIndex = OMX_ALL;
+  mode_st.eMode = OMX_CameraCaptureModeResumeViewfinderImmediately;
+  if ((error = OMX_SetParameter (camera->handle,
+      OMX_IndexParamCameraCaptureMode, &mode_st))){
+    fprintf (stderr, "error: OMX_SetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+  
+  printf ("configuring '%s' settings\n", image_encoder->name);
+  
+  //Quality
+  OMX_IMAGE_PARAM_QFACTORTYPE quality_st;
+  OMX_INIT_STRUCTURE (quality_st);
+  quality_st.nPortIndex = 341;
+  quality_st.nQFactor = STILL_QUALITY;
+  if ((error = OMX_SetParameter (image_encoder->handle, OMX_IndexParamQFactor,
+      &quality_st))){
+    fprintf (stderr, "error: OMX_SetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+  
+  //No thumbnail, it would be encoded too
+  OMX_PARAM_BRCMTHUMBNAILTYPE thumbnail_st;
+  OMX_INIT_STRUCTURE (thumbnail_st);
+  thumbnail_st.bEnable = OMX_FALSE;
+  if ((error = OMX_SetParameter (image_encoder->handle,
+      OMX_IndexParamBrcmThumbnail, &thumbnail_st))){
+    fprintf (stderr, "error: OMX_SetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+}
+
+//Configures the size of the frames on the resize output port, and the number
+//of buffers unless it's 0 (tunneled). The input port takes the format of the
+//camera port from the tunnel
+void set_resize_settings (
+    component_t* resize,
+    OMX_U32 width,
+    OMX_U32 height,
+    int buffers_length){
+  printf ("configuring %s port definition\n", resize->name);
+  
+  OMX_ERRORTYPE error;
+  
+  OMX_PARAM_PORTDEFINITIONTYPE port_st;
+  OMX_INIT_STRUCTURE (port_st);
+  port_st.nPortIndex = 61;
+  if ((error = OMX_GetParameter (resize->handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    fprintf (stderr, "error: OMX_GetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+  //No padding, a frame is width*height*3/2 bytes
+  port_st.format.image.nFrameWidth = width;
+  port_st.format.image.nFrameHeight = height;
+  port_st.format.image.nStride = width;
+  port_st.format.image.nSliceHeight = height;
+  port_st.format.image.eCompressionFormat = OMX_IMAGE_CodingUnused;
+  port_st.format.image.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+  if (buffers_length){
+    port_st.nBufferCountActual = buffers_length;
+  }
+  if ((error = OMX_SetParameter (resize->handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    fprintf (stderr, "error: OMX_SetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+}
+
+void setup_tunnel (
+    component_t* output,
+    OMX_U32 output_port,
+    component_t* input,
+    OMX_U32 input_port){
+  OMX_ERRORTYPE error;
+  
+  if ((error = OMX_SetupTunnel (output->handle, output_port, input->handle,
+      input_port))){
+    fprintf (stderr, "error: OMX_SetupTunnel: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+}
+
+//Configures the video port of the camera and the input port that takes its
+//place in the tunnel (-b), with the same format and buffers. The text is
+//rasterized for the stride and the slice height of the camera
+void set_overlay_ports (
+    pipeline_t* pipeline,
+    component_t* input,
+    OMX_U32 input_port){
+  OMX_ERRORTYPE error;
+  component_t* camera = &pipeline->camera;
+  
+  printf ("configuring %s port definition\n", input->name);
+  OMX_PARAM_PORTDEFINITIONTYPE port_st;
+  OMX_INIT_STRUCTURE (port_st);
+  port_st.nPortIndex = 71;
+  if ((error = OMX_GetParameter (camera->handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    fprintf (stderr, "error: OMX_GetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+  port_st.nBufferCountActual = OVERLAY_BUFFERS;
+  if ((error = OMX_SetParameter (camera->handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    fprintf (stderr, "error: OMX_SetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+  overlay_init (&pipeline->overlay, pipeline->overlay_format,
+      port_st.format.video.nFrameWidth, port_st.format.video.nFrameHeight,
+      port_st.format.video.nStride, port_st.format.video.nSliceHeight);
+  
+  OMX_VIDEO_PORTDEFINITIONTYPE video = port_st.format.video;
+  OMX_INIT_STRUCTURE (port_st);
+  port_st.nPortIndex = input_port;
+  if ((error = OMX_GetParameter (input->handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    fprintf (stderr, "error: OMX_GetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+  port_st.format.video.nFrameWidth = video.nFrameWidth;
+  port_st.format.video.nFrameHeight = video.nFrameHeight;
+  port_st.format.video.nStride = video.nStride;
+  port_st.format.video.nSliceHeight = video.nSliceHeight;
+  port_st.format.video.xFramerate = video.xFramerate;
+  port_st.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+  port_st.format.video.eColorFormat = video.eColorFormat;
+  port_st.nBufferCountActual = OVERLAY_BUFFERS;
+  if ((error = OMX_SetParameter (input->handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    fprintf (stderr, "error: OMX_SetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+}
+
+//Blends the text into a frame of the camera (-b) and gives it to the encoder,
+//or the splitter, with the buffer that shares its memory. It comes back to the
+//camera from empty_buffer_done()
+void overlay_input (pipeline_t* pipeline, OMX_BUFFERHEADERTYPE* buffer){
+  OMX_ERRORTYPE error;
+  overlay_t* overlay = &pipeline->overlay;
+  component_t* input = pipeline->substream ? &pipeline->splitter :
+      &pipeline->encoder;
+  int i;
+  
+  for (i=0; pipeline->frame_buffers[i] != buffer; i++);
+  OMX_BUFFERHEADERTYPE* input_buffer = pipeline->input_buffers[i];
+  
+  //An empty buffer goes back to the camera
+  if (!buffer->nFilledLen){
+    if ((error = OMX_FillThisBuffer (pipeline->camera.handle, buffer))){
+      fprintf (stderr, "error: OMX_FillThisBuffer: %s\n",
+          dump_OMX_ERRORTYPE (error));
+      exit (1);
+    }
+    return;
+  }
+  overlay_buffer (overlay, buffer->pBuffer + buffer->nOffset,
+      buffer->nFilledLen, get_timestamp (buffer->nTimeStamp));
+  
+  input_buffer->nOffset = buffer->nOffset;
+  input_buffer->nFilledLen = buffer->nFilledLen;
+  input_buffer->nFlags = buffer->nFlags;
+  input_buffer->nTimeStamp = buffer->nTimeStamp;
+  if ((error = OMX_EmptyThisBuffer (input->handle, input_buffer))){
+    fprintf (stderr, "error: OMX_EmptyThisBuffer: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+}
+
+//Configures the output port of the encoder of a stream, with its size and
+//settings
+void set_encoder_port (pipeline_t* pipeline, int low_latency){
+  OMX_ERRORTYPE error;
+  component_t* encoder = &pipeline->encoder;
+  h264_settings_t* settings = &pipeline->settings;
+  
+  printf ("configuring %s port definition\n", encoder->name);
+  OMX_PARAM_PORTDEFINITIONTYPE port_st;
+  OMX_INIT_STRUCTURE (port_st);
+  port_st.nPortIndex = 201;
+  if ((error = OMX_GetParameter (encoder->handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    fprintf (stderr, "error: OMX_GetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+  port_st.format.video.nFrameWidth = pipeline->width;
+  port_st.format.video.nFrameHeight = pipeline->height;
+  port_st.format.video.nStride = pipeline->width;
+  port_st.format.video.xFramerate = VIDEO_FRAMERATE << 16;
+  //Despite being configured later, these two fields need to be set
+  port_st.format.video.nBitrate = settings->qp ? 0 : settings->bitrate;
+  port_st.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
+  //A single buffer unless the latency matters
+  pipeline->buffers_length = low_latency ? LOWLATENCY_BUFFERS : 1;
+  if (pipeline->buffers_length < (int)port_st.nBufferCountMin){
+    pipeline->buffers_length = port_st.nBufferCountMin < BUFFERS_MAX ?
+        port_st.nBufferCountMin : BUFFERS_MAX;
+  }
+  port_st.nBufferCountActual = pipeline->buffers_length;
+  if (low_latency){
+    port_st.nBufferSize = LOWLATENCY_BUFFER_SIZE;
+  }
+  if ((error = OMX_SetParameter (encoder->handle, OMX_IndexParamPortDefinition,
+      &port_st))){
+    fprintf (stderr, "error: OMX_SetParameter: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+  
+  //Configure H264
+  set_h264_settings (encoder, settings);
+  if (low_latency){
+    set_low_latency_settings (encoder);
+  }
+}
+
+//Sets up the camera -> encoder pipeline and starts the capture unless
+//pipeline->capture is 0. The encoder of the substream, if any, is set up with
+//it. stc enables the raw STC timestamps of the camera (see latency.h)
+void pipeline_open (pipeline_t* pipeline, int low_latency, int stc){
+  OMX_ERRORTYPE error;
+  pipeline_t* sub = pipeline->substream;
+  int scaled = sub && (sub->width != pipeline->width ||
+      sub->height != pipeline->height);
+  component_t* camera = &pipeline->camera;
+  component_t* encoder = &pipeline->encoder;
+  component_t* null_sink = &pipeline->null_sink;
+  component_t* image_encoder = &pipeline->image_encoder;
+  component_t* resize = &pipeline->resize;
+  camera->name = "OMX.broadcom.camera";
+  encoder->name = "OMX.broadcom.video_encode";
+  null_sink->name = "OMX.broadcom.null_sink";
+  image_encoder->name = "OMX.broadcom.image_encode";
+  resize->name = "OMX.broadcom.resize";
   
   //Initialize components
-  init_component (&camera);
-  init_component (&encoder);
-  init_component (&null_sink);
+  init_component (camera);
+  init_component (encoder);
+  if (sub){
+    pipeline->splitter.name = "OMX.broadcom.video_splitter";
+    sub->encoder.name = "OMX.broadcom.video_encode";
+    sub->resize.name = "OMX.broadcom.resize";
+    init_component (&pipeline->splitter);
+    if (scaled){
+      init_component (&sub->resize);
+    }
+    init_component (&sub->encoder);
+  }
+  if (pipeline->preview_spec){
+    init_component (resize);
+  }else{
+    init_component (null_sink);
+  }
+  if (pipeline->still){
+    init_component (image_encoder);
+  }
   
   //Initialize camera drivers
-  load_camera_drivers (&camera);
+  load_camera_drivers (camera, pipeline->device);
   
   //Configure camera port definition
-  printf ("configuring %s port definition\n", camera.name);
+  printf ("configuring %s port definition\n", camera->name);
   OMX_PARAM_PORTDEFINITIONTYPE port_st;
   OMX_INIT_STRUCTURE (port_st);
   port_st.nPortIndex = 71;
-  if ((error = OMX_GetParameter (camera.handle, OMX_IndexParamPortDefinition,
+  if ((error = OMX_GetParameter (camera->handle, OMX_IndexParamPortDefinition,
       &port_st))){
     fprintf (stderr, "error: OMX_GetParameter: %s\n",
         dump_OMX_ERRORTYPE (error));
@@ -921,10 +1534,10 @@ int main (){
   port_st.format.video.nFrameWidth = CAM_WIDTH;
   port_st.format.video.nFrameHeight = CAM_HEIGHT;
   port_st.format.video.nStride = CAM_WIDTH;
-  port_st.format.video.xFramerate = VIDEO_FRAMERATE << 16;
+  port_st.format.video.xFramerate = pipeline->framerate;
   port_st.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
   port_st.format.video.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
-  if ((error = OMX_SetParameter (camera.handle, OMX_IndexParamPortDefinition,
+  if ((error = OMX_SetParameter (camera->handle, OMX_IndexParamPortDefinition,
       &port_st))){
     fprintf (stderr, "error: OMX_SetParameter: %s\n",
         dump_OMX_ERRORTYPE (error));
@@ -933,19 +1546,19 @@ int main (){
   
   //Preview port
   port_st.nPortIndex = 70;
-  if ((error = OMX_SetParameter (camera.handle, OMX_IndexParamPortDefinition,
+  if ((error = OMX_SetParameter (camera->handle, OMX_IndexParamPortDefinition,
       &port_st))){
     fprintf (stderr, "error: OMX_SetParameter: %s\n",
         dump_OMX_ERRORTYPE (error));
     exit (1);
   }
   
-  printf ("configuring %s framerate\n", camera.name);
+  printf ("configuring %s framerate\n", camera->name);
   OMX_CONFIG_FRAMERATETYPE framerate_st;
   OMX_INIT_STRUCTURE (framerate_st);
   framerate_st.nPortIndex = 71;
   framerate_st.xEncodeFramerate = port_st.format.video.xFramerate;
-  if ((error = OMX_SetConfig (camera.handle, OMX_IndexConfigVideoFramerate,
+  if ((error = OMX_SetConfig (camera->handle, OMX_IndexConfigVideoFramerate,
       &framerate_st))){
     fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
     exit (1);
@@ -953,168 +1566,953 @@ int main (){
   
   //Preview port
   framerate_st.nPortIndex = 70;
-  if ((error = OMX_SetConfig (camera.handle, OMX_IndexConfigVideoFramerate,
+  if ((error = OMX_SetConfig (camera->handle, OMX_IndexConfigVideoFramerate,
       &framerate_st))){
     fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
     exit (1);
   }
   
   //Configure camera settings
-  set_camera_settings (&camera);
-  
-  //Configure encoder port definition
-  printf ("configuring %s port definition\n", encoder.name);
-  OMX_INIT_STRUCTURE (port_st);
-  port_st.nPortIndex = 201;
-  if ((error = OMX_GetParameter (encoder.handle, OMX_IndexParamPortDefinition,
-      &port_st))){
-    fprintf (stderr, "error: OMX_GetParameter: %s\n",
-        dump_OMX_ERRORTYPE (error));
-    exit (1);
+  set_camera_settings (camera, pipeline->tuning.current);
+  
+  //The timestamps are taken from the system timer as is, so they can be
+  //compared with the time when the frames are sent
+  if (stc){
+    OMX_PARAM_TIMESTAMPMODETYPE timestamp_st;
+    OMX_INIT_STRUCTURE (timestamp_st);
+    timestamp_st.eTimestampMode = OMX_TimestampModeRawStc;
+    if ((error = OMX_SetParameter (camera->handle,
+        OMX_IndexParamCommonUseStcTimestamps, &timestamp_st))){
+      fprintf (stderr, "error: OMX_SetParameter: %s\n",
+          dump_OMX_ERRORTYPE (error));
+      exit (1);
+    }
   }
-  port_st.format.video.nFrameWidth = CAM_WIDTH;
-  port_st.format.video.nFrameHeight = CAM_HEIGHT;
-  port_st.format.video.nStride = CAM_WIDTH;
-  port_st.format.video.xFramerate = VIDEO_FRAMERATE << 16;
-  //Despite being configured later, these two fields need to be set
-  port_st.format.video.nBitrate = VIDEO_QP ? 0 : VIDEO_BITRATE;
-  port_st.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
-  if ((error = OMX_SetParameter (encoder.handle, OMX_IndexParamPortDefinition,
-      &port_st))){
-    fprintf (stderr, "error: OMX_SetParameter: %s\n",
-        dump_OMX_ERRORTYPE (error));
-    exit (1);
+  
+  //Configure the encoders
+  set_encoder_port (pipeline, low_latency);
+  if (sub){
+    set_encoder_port (sub, low_latency);
   }
   
-  //Configure H264
-  set_h264_settings (&encoder);
+  //Configure the stills, JPEG on the image encoder output port
+  if (pipeline->still){
+    set_still_settings (camera, image_encoder);
+    printf ("configuring %s port definition\n", image_encoder->name);
+    OMX_INIT_STRUCTURE (port_st);
+    port_st.nPortIndex = 341;
+    if ((error = OMX_GetParameter (image_encoder->handle,
+        OMX_IndexParamPortDefinition, &port_st))){
+      fprintf (stderr, "error: OMX_GetParameter: %s\n",
+          dump_OMX_ERRORTYPE (error));
+      exit (1);
+    }
+    port_st.format.image.eCompressionFormat = OMX_IMAGE_CodingJPEG;
+    port_st.format.image.eColorFormat = OMX_COLOR_FormatUnused;
+    pipeline->still_buffers_length = STILL_BUFFERS;
+    port_st.nBufferCountActual = STILL_BUFFERS;
+    if ((error = OMX_SetParameter (image_encoder->handle,
+        OMX_IndexParamPortDefinition, &port_st))){
+      fprintf (stderr, "error: OMX_SetParameter: %s\n",
+          dump_OMX_ERRORTYPE (error));
+      exit (1);
+    }
+  }
   
   //Setup tunnels: camera (video) -> video_encode, camera (preview) -> null_sink
+  //or resize. With a substream: camera (video) -> video_splitter ->
+  //video_encode and [resize ->] video_encode of the substream. With the text
+  //(-b), the camera (video) -> video_encode or video_splitter link goes
+  //through the encoder loop
   printf ("configuring tunnels\n");
-  if ((error = OMX_SetupTunnel (camera.handle, 71, encoder.handle, 200))){
+  if (sub){
+    if (pipeline->overlay_format){
+      set_overlay_ports (pipeline, &pipeline->splitter, 250);
+    }else{
+      setup_tunnel (camera, 71, &pipeline->splitter, 250);
+    }
+    setup_tunnel (&pipeline->splitter, 251, encoder, 200);
+    if (scaled){
+      setup_tunnel (&pipeline->splitter, 252, &sub->resize, 60);
+      setup_tunnel (&sub->resize, 61, &sub->encoder, 200);
+      set_resize_settings (&sub->resize, sub->width, sub->height, 0);
+    }else{
+      setup_tunnel (&pipeline->splitter, 252, &sub->encoder, 200);
+    }
+  }else if (pipeline->overlay_format){
+    set_overlay_ports (pipeline, encoder, 200);
+  }else{
+    setup_tunnel (camera, 71, encoder, 200);
+  }
+  if (pipeline->preview_spec){
+    error = OMX_SetupTunnel (camera->handle, 70, resize->handle, 60);
+  }else{
+    error = OMX_SetupTunnel (camera->handle, 70, null_sink->handle, 240);
+  }
+  if (error){
     fprintf (stderr, "error: OMX_SetupTunnel: %s\n",
         dump_OMX_ERRORTYPE (error));
     exit (1);
   }
-  if ((error = OMX_SetupTunnel (camera.handle, 70, null_sink.handle, 240))){
+  //camera (still) -> image_encode
+  if (pipeline->still && (error = OMX_SetupTunnel (camera->handle, 72,
+      image_encoder->handle, 340))){
     fprintf (stderr, "error: OMX_SetupTunnel: %s\n",
         dump_OMX_ERRORTYPE (error));
     exit (1);
   }
+  if (pipeline->preview_spec){
+    pipeline->preview_buffers_length = PREVIEW_BUFFERS;
+    set_resize_settings (resize, pipeline->preview.width,
+        pipeline->preview.height, pipeline->preview_buffers_length);
+  }
   
   //Change state to IDLE
-  change_state (&camera, OMX_StateIdle);
-  wait (&camera, EVENT_STATE_SET, 0);
-  change_state (&encoder, OMX_StateIdle);
-  wait (&encoder, EVENT_STATE_SET, 0);
-  change_state (&null_sink, OMX_StateIdle);
-  wait (&null_sink, EVENT_STATE_SET, 0);
+  change_state (camera, OMX_StateIdle);
+  wait (camera, EVENT_STATE_SET, 0);
+  change_state (encoder, OMX_StateIdle);
+  wait (encoder, EVENT_STATE_SET, 0);
+  if (pipeline->preview_spec){
+    change_state (resize, OMX_StateIdle);
+    wait (resize, EVENT_STATE_SET, 0);
+  }else{
+    change_state (null_sink, OMX_StateIdle);
+    wait (null_sink, EVENT_STATE_SET, 0);
+  }
+  if (pipeline->still){
+    change_state (image_encoder, OMX_StateIdle);
+    wait (image_encoder, EVENT_STATE_SET, 0);
+  }
+  if (sub){
+    change_state (&pipeline->splitter, OMX_StateIdle);
+    wait (&pipeline->splitter, EVENT_STATE_SET, 0);
+    if (scaled){
+      change_state (&sub->resize, OMX_StateIdle);
+      wait (&sub->resize, EVENT_STATE_SET, 0);
+    }
+    change_state (&sub->encoder, OMX_StateIdle);
+    wait (&sub->encoder, EVENT_STATE_SET, 0);
+  }
   
   //Enable the ports
-  enable_port (&camera, 71);
-  wait (&camera, EVENT_PORT_ENABLE, 0);
-  enable_port (&camera, 70);
-  wait (&camera, EVENT_PORT_ENABLE, 0);
-  enable_port (&null_sink, 240);
-  wait (&null_sink, EVENT_PORT_ENABLE, 0);
-  enable_port (&encoder, 200);
-  wait (&encoder, EVENT_PORT_ENABLE, 0);
-  enable_encoder_output_port (&encoder, &encoder_output_buffer);
-  
-  //Change state to EXECUTING
-  change_state (&camera, OMX_StateExecuting);
-  wait (&camera, EVENT_STATE_SET, 0);
-  change_state (&encoder, OMX_StateExecuting);
-  wait (&encoder, EVENT_STATE_SET, 0);
-  wait (&encoder, EVENT_PORT_SETTINGS_CHANGED, 0);
-  change_state (&null_sink, OMX_StateExecuting);
-  wait (&null_sink, EVENT_STATE_SET, 0);
-  
-  //Enable camera capture port. This basically says that the port 71 will be
-  //used to get data from the camera. If you're capturing a still, the port 72
-  //must be used
-  printf ("enabling %s capture port\n", camera.name);
-  OMX_CONFIG_PORTBOOLEANTYPE capture_st;
-  OMX_INIT_STRUCTURE (capture_st);
-  capture_st.nPortIndex = 71;
-  capture_st.bEnabled = OMX_TRUE;
-  if ((error = OMX_SetConfig (camera.handle, OMX_IndexConfigPortCapturing,
-      &capture_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
+  int i;
+  if (pipeline->overlay_format){
+    enable_encoder_output_port (camera, 71, pipeline->frame_buffers,
+        OVERLAY_BUFFERS);
+    for (i=0; i<OVERLAY_BUFFERS; i++){
+      pipeline->frame_buffers[i]->pAppPrivate = pipeline;
+    }
+    if (sub){
+      enable_input_port (&pipeline->splitter, 250, pipeline->frame_buffers,
+          pipeline->input_buffers, OVERLAY_BUFFERS);
+    }
+  }else{
+    enable_port (camera, 71);
+    wait (camera, EVENT_PORT_ENABLE, 0);
+    if (sub){
+      enable_port (&pipeline->splitter, 250);
+      wait (&pipeline->splitter, EVENT_PORT_ENABLE, 0);
+    }
   }
-  
-  //Record ~3000 ms
-  struct timespec spec;
-  clock_gettime (CLOCK_MONOTONIC, &spec);
-  long now = spec.tv_sec*1000 + spec.tv_nsec/1.0e6;
-  long end = now + 3000;
-  
-  while (1){
-    //Get the buffer data
-    if ((error = OMX_FillThisBuffer (encoder.handle, encoder_output_buffer))){
-      fprintf (stderr, "error: OMX_FillThisBuffer: %s\n",
-          dump_OMX_ERRORTYPE (error));
-      exit (1);
+  if (sub){
+    enable_port (&pipeline->splitter, 251);
+    wait (&pipeline->splitter, EVENT_PORT_ENABLE, 0);
+    enable_port (&pipeline->splitter, 252);
+    wait (&pipeline->splitter, EVENT_PORT_ENABLE, 0);
+  }
+  enable_port (camera, 70);
+  wait (camera, EVENT_PORT_ENABLE, 0);
+  if (pipeline->preview_spec){
+    enable_port (resize, 60);
+    wait (resize, EVENT_PORT_ENABLE, 0);
+    enable_encoder_output_port (resize, 61, pipeline->preview_buffers,
+        pipeline->preview_buffers_length);
+  }else{
+    enable_port (null_sink, 240);
+    wait (null_sink, EVENT_PORT_ENABLE, 0);
+  }
+  if (pipeline->overlay_format && !sub){
+    enable_input_port (encoder, 200, pipeline->frame_buffers,
+        pipeline->input_buffers, OVERLAY_BUFFERS);
+  }else{
+    enable_port (encoder, 200);
+    wait (encoder, EVENT_PORT_ENABLE, 0);
+  }
+  for (i=0; pipeline->overlay_format && i<OVERLAY_BUFFERS; i++){
+    pipeline->input_buffers[i]->pAppPrivate = pipeline;
+  }
+  enable_encoder_output_port (encoder, 201, pipeline->buffers,
+      pipeline->buffers_length);
+  for (i=0; i<pipeline->buffers_length; i++){
+    pipeline->buffers[i]->pAppPrivate = pipeline;
+  }
+  for (i=0; pipeline->preview_spec && i<pipeline->preview_buffers_length; i++){
+    pipeline->preview_buffers[i]->pAppPrivate = pipeline;
+  }
+  if (sub){
+    if (scaled){
+      enable_port (&sub->resize, 60);
+      wait (&sub->resize, EVENT_PORT_ENABLE, 0);
+      enable_port (&sub->resize, 61);
+      wait (&sub->resize, EVENT_PORT_ENABLE, 0);
     }
-    
-    //Wait until it's filled
-    wait (&encoder, EVENT_FILL_BUFFER_DONE, 0);
-    
-    //Append the buffer into the file
-    if (pwrite (fd, encoder_output_buffer->pBuffer,
-        encoder_output_buffer->nFilledLen,
-        encoder_output_buffer->nOffset) == -1){
-      fprintf (stderr, "error: pwrite\n");
-      exit (1);
+    enable_port (&sub->encoder, 200);
+    wait (&sub->encoder, EVENT_PORT_ENABLE, 0);
+    enable_encoder_output_port (&sub->encoder, 201, sub->buffers,
+        sub->buffers_length);
+    for (i=0; i<sub->buffers_length; i++){
+      sub->buffers[i]->pAppPrivate = sub;
+    }
+  }
+  if (pipeline->still){
+    enable_port (camera, 72);
+    wait (camera, EVENT_PORT_ENABLE, 0);
+    enable_port (image_encoder, 340);
+    wait (image_encoder, EVENT_PORT_ENABLE, 0);
+    enable_encoder_output_port (image_encoder, 341, pipeline->still_buffers,
+        pipeline->still_buffers_length);
+    for (i=0; i<pipeline->still_buffers_length; i++){
+      pipeline->still_buffers[i]->pAppPrivate = pipeline;
     }
-    
-    clock_gettime (CLOCK_MONOTONIC, &spec);
-    if (spec.tv_sec*1000 + spec.tv_nsec/1.0e6 >= end) break;
   }
   
-  printf ("------------------------------------------------\n");
+  //Change state to EXECUTING
+  change_state (camera, OMX_StateExecuting);
+  wait (camera, EVENT_STATE_SET, 0);
+  change_state (encoder, OMX_StateExecuting);
+  wait (encoder, EVENT_STATE_SET, 0);
+  wait (encoder, EVENT_PORT_SETTINGS_CHANGED, 0);
+  if (sub){
+    change_state (&pipeline->splitter, OMX_StateExecuting);
+    wait (&pipeline->splitter, EVENT_STATE_SET, 0);
+    if (scaled){
+      change_state (&sub->resize, OMX_StateExecuting);
+      wait (&sub->resize, EVENT_STATE_SET, 0);
+    }
+    change_state (&sub->encoder, OMX_StateExecuting);
+    wait (&sub->encoder, EVENT_STATE_SET, 0);
+    wait (&sub->encoder, EVENT_PORT_SETTINGS_CHANGED, 0);
+  }
+  if (pipeline->preview_spec){
+    change_state (resize, OMX_StateExecuting);
+    wait (resize, EVENT_STATE_SET, 0);
+  }else{
+    change_state (null_sink, OMX_StateExecuting);
+    wait (null_sink, EVENT_STATE_SET, 0);
+  }
+  if (pipeline->still){
+    change_state (image_encoder, OMX_StateExecuting);
+    wait (image_encoder, EVENT_STATE_SET, 0);
+  }
   
-  //Disable camera capture port
-  printf ("disabling %s capture port\n", camera.name);
-  capture_st.bEnabled = OMX_FALSE;
-  if ((error = OMX_SetConfig (camera.handle, OMX_IndexConfigPortCapturing,
-      &capture_st))){
-    fprintf (stderr, "error: OMX_SetConfig: %s\n", dump_OMX_ERRORTYPE (error));
-    exit (1);
+  if (pipeline->capture){
+    set_capture (camera, 71, OMX_TRUE);
   }
+}
+
+//Stops the capture and releases the pipeline, and the substream
+void pipeline_close (pipeline_t* pipeline){
+  pipeline_t* sub = pipeline->substream;
+  int scaled = sub && (sub->width != pipeline->width ||
+      sub->height != pipeline->height);
+  component_t* camera = &pipeline->camera;
+  component_t* encoder = &pipeline->encoder;
+  component_t* null_sink = &pipeline->null_sink;
+  component_t* image_encoder = &pipeline->image_encoder;
+  component_t* resize = &pipeline->resize;
+  
+  //The frames with the text stay with the components from now on
+  pipeline->overlay_running = 0;
+  set_capture (camera, 71, OMX_FALSE);
   
   //Change state to IDLE
-  change_state (&camera, OMX_StateIdle);
-  wait (&camera, EVENT_STATE_SET, 0);
-  change_state (&encoder, OMX_StateIdle);
-  wait (&encoder, EVENT_STATE_SET, 0);
-  change_state (&null_sink, OMX_StateIdle);
-  wait (&null_sink, EVENT_STATE_SET, 0);
+  change_state (camera, OMX_StateIdle);
+  wait (camera, EVENT_STATE_SET, 0);
+  change_state (encoder, OMX_StateIdle);
+  wait (encoder, EVENT_STATE_SET, 0);
+  if (pipeline->preview_spec){
+    change_state (resize, OMX_StateIdle);
+    wait (resize, EVENT_STATE_SET, 0);
+  }else{
+    change_state (null_sink, OMX_StateIdle);
+    wait (null_sink, EVENT_STATE_SET, 0);
+  }
+  if (pipeline->still){
+    change_state (image_encoder, OMX_StateIdle);
+    wait (image_encoder, EVENT_STATE_SET, 0);
+  }
+  if (sub){
+    change_state (&pipeline->splitter, OMX_StateIdle);
+    wait (&pipeline->splitter, EVENT_STATE_SET, 0);
+    if (scaled){
+      change_state (&sub->resize, OMX_StateIdle);
+      wait (&sub->resize, EVENT_STATE_SET, 0);
+    }
+    change_state (&sub->encoder, OMX_StateIdle);
+    wait (&sub->encoder, EVENT_STATE_SET, 0);
+  }
   
   //Disable the tunnel ports
-  disable_port (&camera, 71);
-  wait (&camera, EVENT_PORT_DISABLE, 0);
-  disable_port (&camera, 70);
-  wait (&camera, EVENT_PORT_DISABLE, 0);
-  disable_port (&null_sink, 240);
-  wait (&null_sink, EVENT_PORT_DISABLE, 0);
-  disable_port (&encoder, 200);
-  wait (&encoder, EVENT_PORT_DISABLE, 0);
-  disable_encoder_output_port (&encoder, encoder_output_buffer);
+  if (pipeline->overlay_format){
+    disable_encoder_output_port (camera, 71, pipeline->frame_buffers,
+        OVERLAY_BUFFERS);
+    disable_encoder_output_port (sub ? &pipeline->splitter : encoder,
+        sub ? 250 : 200, pipeline->input_buffers, OVERLAY_BUFFERS);
+  }else{
+    disable_port (camera, 71);
+    wait (camera, EVENT_PORT_DISABLE, 0);
+    if (sub){
+      disable_port (&pipeline->splitter, 250);
+      wait (&pipeline->splitter, EVENT_PORT_DISABLE, 0);
+    }
+  }
+  if (sub){
+    disable_port (&pipeline->splitter, 251);
+    wait (&pipeline->splitter, EVENT_PORT_DISABLE, 0);
+    disable_port (&pipeline->splitter, 252);
+    wait (&pipeline->splitter, EVENT_PORT_DISABLE, 0);
+    if (scaled){
+      disable_port (&sub->resize, 60);
+      wait (&sub->resize, EVENT_PORT_DISABLE, 0);
+      disable_port (&sub->resize, 61);
+      wait (&sub->resize, EVENT_PORT_DISABLE, 0);
+    }
+    disable_port (&sub->encoder, 200);
+    wait (&sub->encoder, EVENT_PORT_DISABLE, 0);
+    disable_encoder_output_port (&sub->encoder, 201, sub->buffers,
+        sub->buffers_length);
+  }
+  disable_port (camera, 70);
+  wait (camera, EVENT_PORT_DISABLE, 0);
+  if (pipeline->preview_spec){
+    disable_port (resize, 60);
+    wait (resize, EVENT_PORT_DISABLE, 0);
+    disable_encoder_output_port (resize, 61, pipeline->preview_buffers,
+        pipeline->preview_buffers_length);
+  }else{
+    disable_port (null_sink, 240);
+    wait (null_sink, EVENT_PORT_DISABLE, 0);
+  }
+  if (!pipeline->overlay_format || sub){
+    disable_port (encoder, 200);
+    wait (encoder, EVENT_PORT_DISABLE, 0);
+  }
+  disable_encoder_output_port (encoder, 201, pipeline->buffers,
+      pipeline->buffers_length);
+  if (pipeline->still){
+    disable_port (camera, 72);
+    wait (camera, EVENT_PORT_DISABLE, 0);
+    disable_port (image_encoder, 340);
+    wait (image_encoder, EVENT_PORT_DISABLE, 0);
+    disable_encoder_output_port (image_encoder, 341, pipeline->still_buffers,
+        pipeline->still_buffers_length);
+  }
   
   //Change state to LOADED
-  change_state (&camera, OMX_StateLoaded);
-  wait (&camera, EVENT_STATE_SET, 0);
-  change_state (&encoder, OMX_StateLoaded);
-  wait (&encoder, EVENT_STATE_SET, 0);
-  change_state (&null_sink, OMX_StateLoaded);
-  wait (&null_sink, EVENT_STATE_SET, 0);
+  change_state (camera, OMX_StateLoaded);
+  wait (camera, EVENT_STATE_SET, 0);
+  change_state (encoder, OMX_StateLoaded);
+  wait (encoder, EVENT_STATE_SET, 0);
+  if (pipeline->preview_spec){
+    change_state (resize, OMX_StateLoaded);
+    wait (resize, EVENT_STATE_SET, 0);
+  }else{
+    change_state (null_sink, OMX_StateLoaded);
+    wait (null_sink, EVENT_STATE_SET, 0);
+  }
+  if (pipeline->still){
+    change_state (image_encoder, OMX_StateLoaded);
+    wait (image_encoder, EVENT_STATE_SET, 0);
+  }
+  if (sub){
+    change_state (&pipeline->splitter, OMX_StateLoaded);
+    wait (&pipeline->splitter, EVENT_STATE_SET, 0);
+    if (scaled){
+      change_state (&sub->resize, OMX_StateLoaded);
+      wait (&sub->resize, EVENT_STATE_SET, 0);
+    }
+    change_state (&sub->encoder, OMX_StateLoaded);
+    wait (&sub->encoder, EVENT_STATE_SET, 0);
+  }
   
   //Deinitialize components
-  deinit_component (&camera);
-  deinit_component (&encoder);
-  deinit_component (&null_sink);
+  deinit_component (camera);
+  deinit_component (encoder);
+  if (pipeline->preview_spec){
+    deinit_component (resize);
+  }else{
+    deinit_component (null_sink);
+  }
+  if (pipeline->still){
+    deinit_component (image_encoder);
+  }
+  if (sub){
+    deinit_component (&pipeline->splitter);
+    if (scaled){
+      deinit_component (&sub->resize);
+    }
+    deinit_component (&sub->encoder);
+  }
+}
+
+int64_t get_timestamp (OMX_TICKS ticks){
+  //OMX_SKIP64BIT is defined, so the timestamp is split in two 32-bit halves
+  return ((int64_t)ticks.nHighPart << 32) | ticks.nLowPart;
+}
+
+//profile_idc signaled in the SPS
+uint8_t get_profile_idc (OMX_VIDEO_AVCPROFILETYPE profile){
+  switch (profile){
+    case OMX_VIDEO_AVCProfileBaseline: return 66;
+    case OMX_VIDEO_AVCProfileMain: return 77;
+    case OMX_VIDEO_AVCProfileHigh: return 100;
+    default: return 0;
+  }
+}
+
+//Profile of a profile_idc, high if it's unknown
+OMX_VIDEO_AVCPROFILETYPE get_profile (uint8_t profile_idc){
+  switch (profile_idc){
+    case 66: return OMX_VIDEO_AVCProfileBaseline;
+    case 77: return OMX_VIDEO_AVCProfileMain;
+    default: return OMX_VIDEO_AVCProfileHigh;
+  }
+}
+
+void h264_settings_init (h264_settings_t* settings){
+  settings->bitrate = VIDEO_BITRATE;
+  settings->qp = VIDEO_QP;
+  settings->qp_i = VIDEO_QP_I;
+  settings->qp_p = VIDEO_QP_P;
+  settings->profile = VIDEO_PROFILE;
+  settings->idr_period = VIDEO_IDR_PERIOD;
+}
+
+//Settings of a configuration of the sweep, the QPs are used if any is set
+void h264_settings_sweep (
+    h264_settings_t* settings,
+    const sweep_config_t* config){
+  settings->bitrate = config->bitrate;
+  settings->qp = config->qp_i || config->qp_p ? OMX_TRUE : OMX_FALSE;
+  settings->qp_i = config->qp_i;
+  settings->qp_p = config->qp_p;
+  settings->profile = get_profile (config->profile);
+  settings->idr_period = config->idr_period;
+}
+
+int latency_report_dump (latency_report_t* report, char* str, size_t size){
+  char first[256];
+  char last[256];
+  int n = 0;
+  int i;
+  
+  for (i=0; i<report->sinks_length && n < (int)size; i++){
+    latency_dump (&report->first[i], first, sizeof (first));
+    latency_dump (&report->last[i], last, sizeof (last));
+    n += snprintf (str + n, size - n, "%s%s: first buffer %s; last buffer %s",
+        i ? "; " : "", report->sinks[i]->name, first, last);
+  }
+  return n;
+}
+
+//Adds the pipeline of a camera (-d)
+pipeline_t* controller_add (controller_t* controller, OMX_U32 device){
+  int i;
+  
+  if (controller->length == PIPELINES_MAX) usage ();
+  for (i=0; i<controller->length; i++){
+    if (controller->pipelines[i].device == device){
+      fprintf (stderr, "error: camera %u is used twice\n", device);
+      exit (1);
+    }
+  }
+  
+  pipeline_t* pipeline = &controller->pipelines[controller->length++];
+  pipeline->device = device;
+  pipeline->width = CAM_WIDTH;
+  pipeline->height = CAM_HEIGHT;
+  h264_settings_init (&pipeline->settings);
+  pipeline->sinks_length = 0;
+  pipeline->still = 0;
+  pipeline->preview_spec = 0;
+  pipeline->substream_spec = 0;
+  pipeline->substream = 0;
+  pipeline->parent = 0;
+  return pipeline;
+}
+
+//Adds the substream of a camera (-u, see substream.h)
+pipeline_t* controller_substream (controller_t* controller, pipeline_t* parent){
+  substream_t substream;
+  
+  if (controller->length == PIPELINES_MAX) usage ();
+  substream_init (&substream, parent->substream_spec, parent->width,
+      parent->height);
+  pipeline_t* sub = &controller->pipelines[controller->length++];
+  memset (sub, 0, sizeof (pipeline_t));
+  sub->device = parent->device;
+  sub->width = substream.width;
+  sub->height = substream.height;
+  h264_settings_init (&sub->settings);
+  sub->settings.bitrate = substream.bitrate;
+  sub->settings.qp = OMX_FALSE;
+  sub->settings.profile = get_profile (substream.profile);
+  sub->parent = parent;
+  parent->substream = sub;
+  //The output is used until the end, like the outputs of -o
+  sub->outputs[0] = substream.output;
+  sub->sinks_length = 1;
+  return sub;
+}
+
+//Prints the statistics of every pipeline, prefixed by the camera (and
+//substream) if there are several
+int controller_dump (
+    controller_t* controller,
+    int (*dump) (pipeline_t* pipeline, char* str, size_t size),
+    char* str,
+    size_t size){
+  int n = 0;
+  int i;
+  
+  if (controller->length == 1){
+    return dump (&controller->pipelines[0], str, size);
+  }
+  for (i=0; i<controller->length && n < (int)size; i++){
+    n += snprintf (str + n, size - n, "%scamera %u%s: ", i ? "; " : "",
+        controller->pipelines[i].device,
+        controller->pipelines[i].parent ? " substream" : "");
+    if (n < (int)size){
+      n += dump (&controller->pipelines[i], str + n, size - n);
+    }
+  }
+  return n;
+}
+
+//Jain's index of the average time the buffers of every pipeline wait to be
+//served, from 1/n (one pipeline takes all the waiting) to 1 (even)
+double controller_fairness (controller_t* controller){
+  double sum = 0;
+  double sum2 = 0;
+  int i;
+  
+  for (i=0; i<controller->length; i++){
+    pipeline_t* pipeline = &controller->pipelines[i];
+    double wait = pipeline->served ?
+        (double)pipeline->wait_sum/pipeline->served : 0;
+    sum += wait;
+    sum2 += wait*wait;
+  }
+  return sum2 > 0 ? sum*sum/(controller->length*sum2) : 1;
+}
+
+int pipeline_dump_idr (pipeline_t* pipeline, char* str, size_t size){
+  return idr_dump (&pipeline->idr, str, size);
+}
+
+int pipeline_dump_frames (pipeline_t* pipeline, char* str, size_t size){
+  return frames_dump (&pipeline->frames, str, size);
+}
+
+int pipeline_dump_latency (pipeline_t* pipeline, char* str, size_t size){
+  return latency_report_dump (&pipeline->latency_report, str, size);
+}
+
+int pipeline_dump_service (pipeline_t* pipeline, char* str, size_t size){
+  double seconds = (get_time () - pipeline->start)/1.0e6;
+  return snprintf (str, size, "buffers %u, %.2f MB/s, outputs busy %.1f%%, "
+      "queue wait avg %.2f ms max %.2f ms", pipeline->served,
+      seconds > 0 ? pipeline->bytes/seconds/1.0e6 : 0,
+      seconds > 0 ? pipeline->busy/seconds/1.0e4 : 0,
+      pipeline->served ? pipeline->wait_sum/1000.0/pipeline->served : 0,
+      pipeline->wait_max/1000.0);
+}
+
+int pipeline_dump_snapshot (pipeline_t* pipeline, char* str, size_t size){
+  if (!pipeline->still){
+    return snprintf (str, size, "no stills");
+  }
+  return snapshot_dump (&pipeline->snapshot, str, size);
+}
+
+int pipeline_dump_preview (pipeline_t* pipeline, char* str, size_t size){
+  if (!pipeline->preview_spec){
+    return snprintf (str, size, "no preview");
+  }
+  return preview_dump (&pipeline->preview, str, size);
+}
+
+int pipeline_dump_overlay (pipeline_t* pipeline, char* str, size_t size){
+  if (!pipeline->overlay_format){
+    return snprintf (str, size, "no text");
+  }
+  return overlay_dump (&pipeline->overlay, str, size);
+}
+
+int pipeline_dump_tuning (pipeline_t* pipeline, char* str, size_t size){
+  if (pipeline->parent){
+    return snprintf (str, size, "no live settings");
+  }
+  return tuning_dump (&pipeline->tuning, str, size);
+}
+
+int pipeline_dump_settings (pipeline_t* pipeline, char* str, size_t size){
+  if (pipeline->parent){
+    return snprintf (str, size, "no live settings");
+  }
+  return tuning_get (&pipeline->tuning, str, size);
+}
+
+//Control command: idr [stats]
+int control_idr (void* arg, char* args, char* reply, size_t size){
+  controller_t* controller = (controller_t*)arg;
+  int i;
+  
+  if (!strcmp (args, "stats")){
+    controller_dump (controller, pipeline_dump_idr, reply, size);
+    return 0;
+  }
+  if (*args){
+    snprintf (reply, size, "usage: idr [stats]");
+    return 1;
+  }
+  
+  for (i=0; i<controller->length; i++){
+    idr_request (&controller->pipelines[i].idr);
+  }
+  return 0;
+}
+
+//Control command: frames
+int control_frames (void* arg, char* args, char* reply, size_t size){
+  if (*args){
+    snprintf (reply, size, "usage: frames");
+    return 1;
+  }
+  
+  controller_dump ((controller_t*)arg, pipeline_dump_frames, reply, size);
+  return 0;
+}
+
+//Control command: latency
+int control_latency (void* arg, char* args, char* reply, size_t size){
+  if (*args){
+    snprintf (reply, size, "usage: latency");
+    return 1;
+  }
+  
+  controller_dump ((controller_t*)arg, pipeline_dump_latency, reply, size);
+  return 0;
+}
+
+//Control command: cameras
+int control_cameras (void* arg, char* args, char* reply, size_t size){
+  controller_t* controller = (controller_t*)arg;
+  
+  if (*args){
+    snprintf (reply, size, "usage: cameras");
+    return 1;
+  }
+  
+  int n = controller_dump (controller, pipeline_dump_service, reply, size);
+  if (n < (int)size){
+    snprintf (reply + n, size - n, "; fairness %.3f",
+        controller_fairness (controller));
+  }
+  return 0;
+}
+
+//Control command: writer
+int control_writer (void* arg, char* args, char* reply, size_t size){
+  if (*args){
+    snprintf (reply, size, "usage: writer");
+    return 1;
+  }
+  
+  writer_dump ((writer_t*)arg, reply, size);
+  return 0;
+}
+
+//Control command: snapshot [stats]
+int control_snapshot (void* arg, char* args, char* reply, size_t size){
+  controller_t* controller = (controller_t*)arg;
+  int i;
+  
+  if (!strcmp (args, "stats")){
+    controller_dump (controller, pipeline_dump_snapshot, reply, size);
+    return 0;
+  }
+  if (*args){
+    snprintf (reply, size, "usage: snapshot [stats]");
+    return 1;
+  }
+  
+  for (i=0; i<controller->length; i++){
+    if (controller->pipelines[i].still){
+      snapshot_request (&controller->pipelines[i].snapshot);
+    }
+  }
+  return 0;
+}
+
+//Control command: set [camera=N] KEY=VALUE... | set stats
+int control_set (void* arg, char* args, char* reply, size_t size){
+  controller_t* controller = (controller_t*)arg;
+  static int32_t values[PIPELINES_MAX][TUNING_VALUES];
+  uint32_t configs[PIPELINES_MAX];
+  uint32_t tickets[PIPELINES_MAX];
+  char line[CONTROL_LINE_SIZE];
+  pipeline_t* pipeline;
+  unsigned int device = 0;
+  int all = 1;
+  int selected = 0;
+  int failed = 0;
+  int n = 0;
+  int i;
+  
+  if (!strcmp (args, "stats")){
+    controller_dump (controller, pipeline_dump_tuning, reply, size);
+    return 0;
+  }
+  if (sscanf (args, "camera=%u", &device) == 1){
+    all = 0;
+    args += strcspn (args, " \t");
+  }
+  
+  //Every camera is checked before anything is requested. The substreams
+  //follow their cameras
+  for (i=0; i<controller->length; i++){
+    pipeline = &controller->pipelines[i];
+    if (pipeline->parent || (!all && pipeline->device != device)) continue;
+    snprintf (line, sizeof (line), "%s", args);
+    if (tuning_parse (&pipeline->tuning, line, values[i], &configs[i], reply,
+        size)){
+      return 1;
+    }
+    if ((configs[i] & (1 << TUNING_BITRATE)) && pipeline->settings.qp){
+      snprintf (reply, size, "the bitrate is ignored with a fixed "
+          "quantization");
+      return 1;
+    }
+    selected |= 1 << i;
+  }
+  if (!selected){
+    snprintf (reply, size, "unknown camera: %u", device);
+    return 1;
+  }
+  
+  //Only the configs that change are applied, by the encoder loop
+  for (i=0; i<controller->length; i++){
+    if (!(selected & (1 << i))) continue;
+    configs[i] = tuning_request (&controller->pipelines[i].tuning, values[i],
+        &tickets[i]);
+  }
+  for (i=0; i<controller->length && n < (int)size; i++){
+    if (!(selected & (1 << i))) continue;
+    pipeline = &controller->pipelines[i];
+    if (configs[i]){
+      tuning_wait (&pipeline->tuning, tickets[i], TUNING_WAIT);
+      failed |= tuning_failed (&pipeline->tuning, configs[i]);
+    }
+    if (controller->length > 1){
+      n += snprintf (reply + n, size - n, "%scamera %u: ", n ? "; " : "",
+          pipeline->device);
+      if (n >= (int)size) break;
+    }
+    n += tuning_reply (&pipeline->tuning, configs[i], reply + n, size - n);
+  }
+  return failed;
+}
+
+//Control command: get
+int control_get (void* arg, char* args, char* reply, size_t size){
+  if (*args){
+    snprintf (reply, size, "usage: get");
+    return 1;
+  }
+  
+  controller_dump ((controller_t*)arg, pipeline_dump_settings, reply, size);
+  return 0;
+}
+
+void stop_recording (int signal){
+  interrupted = 1;
+}
+
+void usage (){
+  fprintf (stderr, "usage: h264 [-c control_socket] [-t ms] [-T ms] [-l] [-r settings]\n"
+      "            [-v] [-w threads] [-a audio] [[-d camera] [-b text]\n"
+      "            [-j still] [-p preview] [-u substream] -o output...]...\n"
+      "       h264 -s matrix [-S results] [-t ms] [-l] [-r settings]\n\n"
+      "  -c PATH       control socket, one command per line (see control.h):\n"
+      "                idr, frames, cameras, writer, snapshot, latency,\n"
+      "                set KEY=VALUE..., get, help\n"
+      "  -t ms         recording time, 0 until SIGINT/SIGTERM (default: 3000)\n"
+      "  -T ms         timelapse, one frame every ms played at %d fps\n"
+      "  -d N          camera device number of the next outputs, one pipeline\n"
+      "                per camera (default: 0)\n"
+      "  -b FORMAT     text burned into the frames, strftime() format, e.g.\n"
+      "                \"CAM1 %%Y-%%m-%%d %%H:%%M:%%S\"\n"
+      "  -j PATTERN    JPEG stills of the camera on the snapshot command,\n"
+      "                e.g. still-%%05u.jpg\n"
+      "  -p OUTPUT[,size=WxH][,fps=N]\n"
+      "                raw I420 preview frames scaled by the GPU\n"
+      "                (default: %dx%d)\n"
+      "  -u OUTPUT[,size=WxH][,bitrate=BPS][,profile=baseline|main|high]\n"
+      "                second stream of the camera, scaled and encoded with\n"
+      "                its own settings (default: %dx%d, %d bps, baseline)\n"
+      "  -a SOURCE     audio of the MP4 outputs, alsa:DEVICE, wav:PATH or\n"
+      "                pcm:PATH[,rate=HZ][,channels=N] (see audio.h)\n"
+      "  -l            low latency: slices, small buffers sent as they arrive\n"
+      "  -r ROLE=POLICY:PRIORITY[@CPU],...\n"
+      "                real-time threads, e.g. capture=fifo:50@3 (see rt.h)\n"
+      "  -v            validate the stream and report the errors\n"
+      "  -w N          threads that write the files, 0 in the encoder loop\n"
+      "                (default: %d, see writer.h)\n"
+      "  -s PARAM=VALUE[:VALUE]...[,PARAM=...]\n"
+      "                encoder parameter sweep, -t ms per configuration, e.g.\n"
+      "                bitrate=8000000:17000000,profile=baseline:high\n"
+      "  -S PATH       sweep results, JSON (.json) or CSV\n"
+      "                (default: " SWEEP_RESULTS ")\n"
+      "\n"
+      "output:\n"
+      "  -             stdout\n"
+      "  fifo:PATH     named pipe\n"
+      "  tcp:HOST:PORT TCP connection\n"
+      "  unix:PATH     Unix socket connection\n"
+      "  rtp:HOST:PORT RTP over UDP\n"
+      "  server:[HOST:]PORT\n"
+      "                TCP server\n"
+      "  mp4:PATH      fragmented MP4 file (or PATH.mp4)\n"
+      "  ts:PATH       MPEG-TS file (or PATH.ts)\n"
+      "  udp:HOST:PORT MPEG-TS over UDP\n"
+      "  segment:PATTERN[,duration=S][,size=MB][,playlist=PATH][,window=N]\n"
+      "                segmented recording, e.g. segment:video-%%05u.ts\n"
+      "  shm:NAME[,size=MB][,frames=N]\n"
+      "                ring in POSIX shared memory, e.g. shm:/h264, read with\n"
+      "                shmring.h\n"
+      "  PATH          file (default: " FILENAME ")\n", VIDEO_FRAMERATE,
+      PREVIEW_WIDTH, PREVIEW_HEIGHT, SUBSTREAM_WIDTH, SUBSTREAM_HEIGHT,
+      SUBSTREAM_BITRATE, WRITER_THREADS);
+  exit (1);
+}
+
+//Sets up a pipeline with the settings of a configuration of the sweep through
+//set_h264_settings() and gives all the buffers to the encoder
+void sweep_pipeline_open (sweep_encoder_t* encoder,
+    const sweep_config_t* config){
+  sweep_pipeline_t* sweep = (sweep_pipeline_t*)encoder->data;
+  pipeline_t* pipeline = &sweep->pipeline;
+  int32_t values[TUNING_VALUES];
+  OMX_ERRORTYPE error;
+  int i;
+  
+  h264_settings_sweep (&pipeline->settings, config);
+  buffer_queue_init (&ready);
+  pipeline->device = 0;
+  pipeline->framerate = VIDEO_FRAMERATE << 16;
+  pipeline->capture = 1;
+  pipeline->width = CAM_WIDTH;
+  pipeline->height = CAM_HEIGHT;
+  pipeline->still = 0;
+  pipeline->preview_spec = 0;
+  pipeline->substream = 0;
+  get_tuning_defaults (values, &pipeline->settings);
+  tuning_init (&pipeline->tuning, values);
+  pipeline_open (pipeline, sweep->low_latency,
+      latency_clock_absolute (encoder->clock));
+  
+  for (i=0; i<pipeline->buffers_length; i++){
+    if ((error = OMX_FillThisBuffer (pipeline->encoder.handle,
+        pipeline->buffers[i]))){
+      fprintf (stderr, "error: OMX_FillThisBuffer: %s\n",
+          dump_OMX_ERRORTYPE (error));
+      exit (1);
+    }
+  }
+}
+
+void sweep_pipeline_read (sweep_encoder_t* encoder,
+    stream_buffer_t* buffer){
+  sweep_pipeline_t* sweep = (sweep_pipeline_t*)encoder->data;
+  OMX_BUFFERHEADERTYPE* header;
+  int64_t arrival;
+  
+  while (!(header = buffer_queue_pop (&ready, &arrival))){
+    buffer_queue_wait (&ready, VCOS_SUSPEND);
+  }
+  sweep->buffer = header;
+  buffer->data = header->pBuffer + header->nOffset;
+  buffer->length = header->nFilledLen;
+  buffer->timestamp = get_timestamp (header->nTimeStamp);
+  buffer->flags = header->nFlags;
+}
+
+void sweep_pipeline_release (sweep_encoder_t* encoder){
+  sweep_pipeline_t* sweep = (sweep_pipeline_t*)encoder->data;
+  OMX_ERRORTYPE error;
+  
+  if ((error = OMX_FillThisBuffer (sweep->pipeline.encoder.handle,
+      sweep->buffer))){
+    fprintf (stderr, "error: OMX_FillThisBuffer: %s\n",
+        dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+}
+
+void sweep_pipeline_close (sweep_encoder_t* encoder){
+  sweep_pipeline_t* sweep = (sweep_pipeline_t*)encoder->data;
+  
+  pipeline_close (&sweep->pipeline);
+  tuning_close (&sweep->pipeline.tuning);
+  buffer_queue_deinit (&ready);
+}
+
+//Encoder parameter sweep (-s): every configuration is recorded for the given
+//time with a new pipeline and without outputs (see sweep.h)
+void run_sweep (
+    const char* matrix,
+    const char* results,
+    long duration,
+    int low_latency){
+  OMX_ERRORTYPE error;
+  sweep_config_t defaults = {
+    VIDEO_BITRATE,
+    VIDEO_QP ? VIDEO_QP_I : 0,
+    VIDEO_QP ? VIDEO_QP_P : 0,
+    get_profile_idc (VIDEO_PROFILE),
+    VIDEO_IDR_PERIOD
+  };
+  sweep_t sweep;
+  static sweep_pipeline_t pipeline;
+  sweep_encoder_t encoder;
+  latency_clock_t latency_clock;
+  
+  sweep_init (&sweep, &defaults, matrix);
+  sweep_open (&sweep, results);
+  
+  //Initialize Broadcom's VideoCore APIs
+  bcm_host_init ();
+  latency_clock_open (&latency_clock, bcm_host_get_peripheral_address ());
+  
+  //Initialize OpenMAX IL
+  if ((error = OMX_Init ())){
+    fprintf (stderr, "error: OMX_Init: %s\n", dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+  
+  signal (SIGINT, stop_recording);
+  signal (SIGTERM, stop_recording);
+  
+  pipeline.low_latency = low_latency;
+  encoder.open = sweep_pipeline_open;
+  encoder.read = sweep_pipeline_read;
+  encoder.release = sweep_pipeline_release;
+  encoder.close = sweep_pipeline_close;
+  encoder.clock = &latency_clock;
+  encoder.interval = 1000000/VIDEO_FRAMERATE;
+  encoder.data = &pipeline;
+  sweep_run (&sweep, &encoder, duration, &interrupted);
   
   //Deinitialize OpenMAX IL
   if ((error = OMX_Deinit ())){
@@ -1125,13 +2523,620 @@ int main (){
   //Deinitialize Broadcom's VideoCore APIs
   bcm_host_deinit ();
   
-  //Close the file
-  if (close (fd)){
-    fprintf (stderr, "error: close\n");
+  latency_clock_close (&latency_clock);
+  sweep_close (&sweep);
+}
+
+int main (int argc, char** argv){
+  OMX_ERRORTYPE error;
+  OMX_BUFFERHEADERTYPE* encoder_output_buffer;
+  int32_t values[TUNING_VALUES];
+  
+  const char* control_path = 0;
+  const char* sweep_matrix = 0;
+  const char* sweep_results = SWEEP_RESULTS;
+  const char* audio_spec = 0;
+  audio_t audio;
+  long duration = 3000;
+  long timelapse = 0;
+  int validate = 0;
+  int low_latency = 0;
+  long writer_threads = WRITER_THREADS;
+  pipeline_t* pipeline = 0;
+  long device;
+  char* end_opt;
+  int opt;
+  while ((opt = getopt (argc, argv, "a:b:c:d:j:lo:p:r:s:S:t:T:u:vw:")) != -1){
+    switch (opt){
+      case 'a':
+        audio_spec = optarg;
+        break;
+      case 'c':
+        control_path = optarg;
+        break;
+      case 'd':
+        device = strtol (optarg, &end_opt, 10);
+        if (*end_opt || device < 0) usage ();
+        pipeline = controller_add (&controller, device);
+        break;
+      case 't':
+        duration = strtol (optarg, &end_opt, 10);
+        if (*end_opt || duration < 0) usage ();
+        break;
+      case 'T':
+        timelapse = strtol (optarg, &end_opt, 10);
+        if (*end_opt || timelapse < 1000/VIDEO_FRAMERATE) usage ();
+        break;
+      case 'l':
+        low_latency = 1;
+        break;
+      case 'r':
+        rt_configure (optarg);
+        break;
+      case 'v':
+        validate = 1;
+        break;
+      case 'w':
+        writer_threads = strtol (optarg, &end_opt, 10);
+        if (*end_opt || writer_threads < 0 ||
+            writer_threads > WRITER_THREADS_MAX){
+          usage ();
+        }
+        break;
+      case 's':
+        sweep_matrix = optarg;
+        break;
+      case 'S':
+        sweep_results = optarg;
+        break;
+      case 'j':
+        if (!pipeline) pipeline = controller_add (&controller, 0);
+        pipeline->still = optarg;
+        break;
+      case 'b':
+        if (!pipeline) pipeline = controller_add (&controller, 0);
+        pipeline->overlay_format = optarg;
+        break;
+      case 'p':
+        if (!pipeline) pipeline = controller_add (&controller, 0);
+        pipeline->preview_spec = optarg;
+        break;
+      case 'u':
+        if (!pipeline) pipeline = controller_add (&controller, 0);
+        pipeline->substream_spec = optarg;
+        break;
+      case 'o':
+        //The outputs before the first -d are for the camera 0
+        if (!pipeline) pipeline = controller_add (&controller, 0);
+        if (pipeline->sinks_length == OUTPUTS_MAX) usage ();
+        pipeline->outputs[pipeline->sinks_length++] = optarg;
+        break;
+      default:
+        usage ();
+    }
+  }
+  if (sweep_matrix){
+    //The stream is not written, every configuration needs a recording time
+    if (controller.length || validate || control_path || timelapse ||
+        audio_spec || !duration){
+      usage ();
+    }
+    rt_thread (RT_CAPTURE);
+    run_sweep (sweep_matrix, sweep_results, duration, low_latency);
+    printf ("ok\n");
+    return 0;
+  }
+  if (!controller.length){
+    controller_add (&controller, 0);
+  }
+  if (controller.length == 1 && !controller.pipelines[0].sinks_length){
+    controller.pipelines[0].outputs[0] = FILENAME;
+    controller.pipelines[0].sinks_length = 1;
+  }
+  //The substreams follow the cameras. They need every frame of the camera
+  int i;
+  int j;
+  int cameras = controller.length;
+  for (i=0; i<cameras; i++){
+    if (!controller.pipelines[i].substream_spec) continue;
+    if (timelapse && timelapse_toggled (timelapse)){
+      fprintf (stderr, "error: a substream needs a timelapse interval of %d "
+          "ms or less\n", TIMELAPSE_INTERVAL_MAX);
+      exit (1);
+    }
+    controller_substream (&controller, &controller.pipelines[i]);
+  }
+  //The timelapse frames are played faster than they were captured
+  if (audio_spec){
+    if (timelapse){
+      fprintf (stderr, "error: the audio cannot be recorded with a "
+          "timelapse\n");
+      exit (1);
+    }
+    audio_open (&audio, audio_spec);
+  }
+  
+  //The files of all the cameras share the writer threads
+  if (writer_threads){
+    writer_init (&writer, writer_threads, 0);
+    sink_set_writer (&writer);
+  }
+  
+  //Open the outputs. This must be done before printing anything because the
+  //stdout output redirects the log messages to stderr
+  for (i=0; i<controller.length; i++){
+    pipeline = &controller.pipelines[i];
+    if (!pipeline->sinks_length){
+      fprintf (stderr, "error: camera %u has no outputs\n", pipeline->device);
+      exit (1);
+    }
+    pipeline->framerate = VIDEO_FRAMERATE << 16;
+    pipeline->capture = 1;
+    idr_init (&pipeline->idr);
+    paramsets_init (&pipeline->paramsets);
+    frames_init (&pipeline->frames, 1000000/VIDEO_FRAMERATE);
+    if (timelapse){
+      pipeline->framerate = timelapse_framerate (timelapse);
+      pipeline->capture = !timelapse_toggled (timelapse);
+      frames_init (&pipeline->frames, (int64_t)timelapse*1000);
+      timelapse_init (&pipeline->timelapse, VIDEO_FRAMERATE);
+    }
+    if (pipeline->still){
+      snapshot_init (&pipeline->snapshot, pipeline->still,
+          pipeline->frames.interval, sink_writer ());
+    }
+    if (pipeline->preview_spec){
+      preview_init (&pipeline->preview, pipeline->preview_spec,
+          pipeline->framerate >> 16);
+      preview_open (&pipeline->preview);
+    }
+    for (j=0; j<pipeline->sinks_length; j++){
+      pipeline->sinks[j] = sink_open (pipeline->outputs[j]);
+      pipeline->sinks[j]->idr = &pipeline->idr;
+      pipeline->sinks[j]->paramsets = &pipeline->paramsets;
+      pipeline->sinks[j]->low_latency = low_latency;
+      if (audio_spec){
+        pipeline->sinks[j]->audio = &pipeline->audio_sync;
+      }
+    }
+    if (audio_spec){
+      audio_sync_init (&pipeline->audio_sync, &audio);
+    }
+    if (validate){
+      validator_init (&pipeline->validator,
+          get_profile_idc (pipeline->settings.profile), VIDEO_FRAMERATE,
+          pipeline->settings.idr_period);
+    }
+    pipeline->latency_report.sinks = pipeline->sinks;
+    pipeline->latency_report.sinks_length = pipeline->sinks_length;
+    for (j=0; j<pipeline->sinks_length; j++){
+      latency_init (&pipeline->latency_report.first[j]);
+      latency_init (&pipeline->latency_report.last[j]);
+    }
+    get_tuning_defaults (values, &pipeline->settings);
+    tuning_init (&pipeline->tuning, values);
+    pipeline->frame_start = 1;
+    pipeline->served = 0;
+    pipeline->bytes = 0;
+    pipeline->busy = 0;
+    pipeline->wait_sum = 0;
+    pipeline->wait_max = 0;
+  }
+  
+  //Open the control channel
+  control_t control;
+  control_init (&control);
+  control_register (&control, "idr", control_idr, &controller);
+  control_register (&control, "frames", control_frames, &controller);
+  control_register (&control, "cameras", control_cameras, &controller);
+  if (writer_threads){
+    control_register (&control, "writer", control_writer, &writer);
+  }
+  control_register (&control, "set", control_set, &controller);
+  control_register (&control, "get", control_get, &controller);
+  int stills = 0;
+  for (i=0; i<controller.length; i++){
+    if (controller.pipelines[i].still) stills = 1;
+  }
+  if (stills){
+    control_register (&control, "snapshot", control_snapshot, &controller);
+  }
+  latency_clock_t latency_clock;
+  if (low_latency){
+    control_register (&control, "latency", control_latency, &controller);
+  }
+  if (control_path){
+    control_open (&control, control_path);
+  }
+  
+  //The audio is captured from now on, the samples before the first frame of
+  //every output are skipped. Like the other helper threads, the thread is
+  //created before the encoder loop takes the capture role (-r), so it keeps
+  //the default scheduling and runs on any CPU
+  if (audio_spec){
+    audio_start (&audio);
+  }
+  
+  //The threads of the VideoCore client, where fill_buffer_done() runs, are
+  //created from now on and inherit the scheduling of the encoder loop
+  rt_thread (RT_CAPTURE);
+  
+  //Initialize Broadcom's VideoCore APIs
+  bcm_host_init ();
+  buffer_queue_init (&ready);
+  if (low_latency){
+    latency_clock_open (&latency_clock, bcm_host_get_peripheral_address ());
+  }
+  
+  //Initialize OpenMAX IL
+  if ((error = OMX_Init ())){
+    fprintf (stderr, "error: OMX_Init: %s\n", dump_OMX_ERRORTYPE (error));
+    exit (1);
+  }
+  
+  //Set up the pipelines and start the capture, the substreams are set up with
+  //their cameras
+  for (i=0; i<controller.length; i++){
+    if (controller.pipelines[i].parent) continue;
+    pipeline_open (&controller.pipelines[i], low_latency,
+        low_latency && latency_clock_absolute (&latency_clock));
+  }
+  
+  //Record until the time is over or the process is asked to stop
+  signal (SIGINT, stop_recording);
+  signal (SIGTERM, stop_recording);
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  long now = spec.tv_sec*1000 + spec.tv_nsec/1.0e6;
+  long end = now + duration;
+  stream_buffer_t stream_buffer;
+  VCOS_UNSIGNED events;
+  VCOS_UNSIGNED timeout;
+  int64_t arrival;
+  int64_t served;
+  int64_t captured;
+  int media;
+  int toggled = timelapse && timelapse_toggled (timelapse);
+  int64_t next_capture = get_time ();
+  timelapse_meter_t meter;
+  timelapse_meter_start (&meter);
+  
+  //Give all the buffers to the encoders, they come back in the same order
+  for (i=0; i<controller.length; i++){
+    pipeline = &controller.pipelines[i];
+    pipeline->start = get_time ();
+    frames_queued (&pipeline->frames);
+    for (j=0; j<pipeline->buffers_length; j++){
+      if ((error = OMX_FillThisBuffer (pipeline->encoder.handle,
+          pipeline->buffers[j]))){
+        fprintf (stderr, "error: OMX_FillThisBuffer: %s\n",
+            dump_OMX_ERRORTYPE (error));
+        exit (1);
+      }
+    }
+    pipeline->overlay_running = pipeline->overlay_format != 0;
+    for (j=0; pipeline->overlay_format && j<OVERLAY_BUFFERS; j++){
+      if ((error = OMX_FillThisBuffer (pipeline->camera.handle,
+          pipeline->frame_buffers[j]))){
+        fprintf (stderr, "error: OMX_FillThisBuffer: %s\n",
+            dump_OMX_ERRORTYPE (error));
+        exit (1);
+      }
+    }
+    for (j=0; pipeline->still && j<pipeline->still_buffers_length; j++){
+      if ((error = OMX_FillThisBuffer (pipeline->image_encoder.handle,
+          pipeline->still_buffers[j]))){
+        fprintf (stderr, "error: OMX_FillThisBuffer: %s\n",
+            dump_OMX_ERRORTYPE (error));
+        exit (1);
+      }
+    }
+    for (j=0; pipeline->preview_spec && j<pipeline->preview_buffers_length;
+        j++){
+      if ((error = OMX_FillThisBuffer (pipeline->resize.handle,
+          pipeline->preview_buffers[j]))){
+        fprintf (stderr, "error: OMX_FillThisBuffer: %s\n",
+            dump_OMX_ERRORTYPE (error));
+        exit (1);
+      }
+    }
+  }
+  
+  while (1){
+    //Wait until a buffer of any camera is filled. With a long timelapse
+    //interval the capture is started at every interval, and stopped once
+    //every camera has sent a frame
+    while (!(encoder_output_buffer = buffer_queue_pop (&ready, &arrival))){
+      timeout = VCOS_SUSPEND;
+      if (toggled){
+        served = get_time ();
+        if (interrupted || (duration && served/1000 >= end)) break;
+        if (served >= next_capture){
+          for (i=0; i<controller.length; i++){
+            if (controller.pipelines[i].timelapse.capturing) continue;
+            set_capture (&controller.pipelines[i].camera, 71, OMX_TRUE);
+            controller.pipelines[i].timelapse.capturing = 1;
+          }
+          while (next_capture <= served) next_capture += timelapse*1000;
+        }
+        timeout = (next_capture - served)/1000 + 1;
+        if (timeout > TIMELAPSE_SLEEP_MAX) timeout = TIMELAPSE_SLEEP_MAX;
+      }
+      buffer_queue_wait (&ready, timeout);
+      meter.wakeups++;
+    }
+    if (!encoder_output_buffer) break;
+    pipeline = (pipeline_t*)encoder_output_buffer->pAppPrivate;
+    
+    //A frame of the camera that needs the text (-b)
+    if (encoder_output_buffer->nOutputPortIndex == 71){
+      overlay_input (pipeline, encoder_output_buffer);
+      continue;
+    }
+    
+    //A part of the JPEG of a still, it's only copied, the writer threads
+    //write it
+    if (encoder_output_buffer->nOutputPortIndex == 341){
+      stream_buffer.data = encoder_output_buffer->pBuffer +
+          encoder_output_buffer->nOffset;
+      stream_buffer.length = encoder_output_buffer->nFilledLen;
+      stream_buffer.flags = encoder_output_buffer->nFlags;
+      snapshot_data (&pipeline->snapshot, &stream_buffer);
+      if ((error = OMX_FillThisBuffer (pipeline->image_encoder.handle,
+          encoder_output_buffer))){
+        fprintf (stderr, "error: OMX_FillThisBuffer: %s\n",
+            dump_OMX_ERRORTYPE (error));
+        exit (1);
+      }
+      continue;
+    }
+    
+    //A preview frame, the output copies it only if the reader is slow, and the
+    //buffer goes back to the pool of the resize component right away
+    if (encoder_output_buffer->nOutputPortIndex == 61){
+      stream_buffer.data = encoder_output_buffer->pBuffer +
+          encoder_output_buffer->nOffset;
+      stream_buffer.length = encoder_output_buffer->nFilledLen;
+      stream_buffer.timestamp =
+          get_timestamp (encoder_output_buffer->nTimeStamp);
+      stream_buffer.flags = encoder_output_buffer->nFlags;
+      preview_frame (&pipeline->preview, &stream_buffer);
+      if ((error = OMX_FillThisBuffer (pipeline->resize.handle,
+          encoder_output_buffer))){
+        fprintf (stderr, "error: OMX_FillThisBuffer: %s\n",
+            dump_OMX_ERRORTYPE (error));
+        exit (1);
+      }
+      continue;
+    }
+    served = get_time ();
+    
+    //A change of the output port settings means that new SPS/PPS are coming,
+    //the cached ones cannot be used anymore
+    if (!vcos_event_flags_get (&pipeline->encoder.flags,
+        EVENT_PORT_SETTINGS_CHANGED, VCOS_OR_CONSUME, VCOS_NO_SUSPEND,
+        &events)){
+      paramsets_invalidate (&pipeline->paramsets);
+    }
+    
+    //Hand the buffer to the outputs
+    stream_buffer.data = encoder_output_buffer->pBuffer +
+        encoder_output_buffer->nOffset;
+    stream_buffer.length = encoder_output_buffer->nFilledLen;
+    stream_buffer.timestamp = get_timestamp (encoder_output_buffer->nTimeStamp);
+    stream_buffer.flags = encoder_output_buffer->nFlags;
+    frames_buffer (&pipeline->frames, &stream_buffer);
+    captured = stream_buffer.timestamp;
+    if (timelapse && timelapse_timestamp (&pipeline->timelapse, &stream_buffer)
+        && toggled && pipeline->timelapse.capturing){
+      set_capture (&pipeline->camera, 71, OMX_FALSE);
+      pipeline->timelapse.capturing = 0;
+    }
+    //The cache is updated first, so the sinks see the new SPS/PPS
+    if (stream_buffer.flags & STREAM_FLAG_CODECCONFIG){
+      paramsets_update (&pipeline->paramsets, &stream_buffer);
+    }
+    media = stream_buffer.length &&
+        !(stream_buffer.flags & STREAM_FLAG_CODECCONFIG);
+    if (audio_spec && media && pipeline->frame_start){
+      audio_sync_frame (&pipeline->audio_sync, stream_buffer.timestamp,
+          arrival);
+    }
+    for (i=0; i<pipeline->sinks_length; i++){
+      sink_write (pipeline->sinks[i], &stream_buffer);
+      if (low_latency && media){
+        int64_t since = latency_clock_since (&latency_clock, captured);
+        if (pipeline->frame_start){
+          latency_add (&pipeline->latency_report.first[i], since);
+        }
+        if (stream_buffer.flags & STREAM_FLAG_ENDOFFRAME){
+          latency_add (&pipeline->latency_report.last[i], since);
+        }
+      }
+    }
+    if (validate){
+      validator_write (&pipeline->validator, &stream_buffer);
+    }
+    
+    if ((stream_buffer.flags & STREAM_FLAG_ENDOFFRAME) &&
+        !(stream_buffer.flags & STREAM_FLAG_CODECCONFIG)){
+      idr_frame (&pipeline->idr, stream_buffer.flags & STREAM_FLAG_SYNCFRAME);
+      if (pipeline->still){
+        snapshot_frame (&pipeline->snapshot, captured);
+      }
+    }
+    if (media){
+      pipeline->frame_start =
+          (stream_buffer.flags & STREAM_FLAG_ENDOFFRAME) != 0;
+    }
+    
+    pipeline->served++;
+    pipeline->bytes += stream_buffer.length;
+    pipeline->busy += get_time () - served;
+    pipeline->wait_sum += served - arrival;
+    if (served - arrival > pipeline->wait_max){
+      pipeline->wait_max = served - arrival;
+    }
+    
+    clock_gettime (CLOCK_MONOTONIC, &spec);
+    now = spec.tv_sec*1000 + spec.tv_nsec/1.0e6;
+    
+    //Ask for an IDR frame before giving the buffer back to the encoder
+    if (idr_pending (&pipeline->idr, now)){
+      request_idr (&pipeline->encoder);
+    }
+    //Apply the settings changed by the control channel
+    if (tuning_pending (&pipeline->tuning)){
+      apply_tuning (pipeline);
+    }
+    //Start a requested still, the video port keeps capturing
+    if (pipeline->still && snapshot_start (&pipeline->snapshot)){
+      set_capture (&pipeline->camera, 72, OMX_TRUE);
+    }
+    frames_queued (&pipeline->frames);
+    if ((error = OMX_FillThisBuffer (pipeline->encoder.handle,
+        encoder_output_buffer))){
+      fprintf (stderr, "error: OMX_FillThisBuffer: %s\n",
+          dump_OMX_ERRORTYPE (error));
+      exit (1);
+    }
+    
+    if (interrupted || (duration && now >= end)) break;
+  }
+  
+  printf ("------------------------------------------------\n");
+  
+  //The outputs take the last samples from the ring when they're closed
+  if (audio_spec){
+    audio_stop (&audio);
+  }
+  
+  //Close the control channel
+  if (control_path){
+    control_close (&control);
+  }
+  
+  for (i=controller.length - 1; i>=0; i--){
+    if (controller.pipelines[i].parent) continue;
+    pipeline_close (&controller.pipelines[i]);
+  }
+  
+  //Write the pending stills, the statistics are printed
+  for (i=0; i<controller.length; i++){
+    if (controller.pipelines[i].still){
+      snapshot_close (&controller.pipelines[i].snapshot);
+    }
+  }
+  
+  //Deinitialize OpenMAX IL
+  if ((error = OMX_Deinit ())){
+    fprintf (stderr, "error: OMX_Deinit: %s\n", dump_OMX_ERRORTYPE (error));
     exit (1);
   }
   
+  buffer_queue_deinit (&ready);
+  
+  //Deinitialize Broadcom's VideoCore APIs
+  bcm_host_deinit ();
+  
+  //The statistics of the writer threads before the files are closed, every
+  //file prints its own when it's closed
+  if (writer_threads){
+    char report[WRITER_STREAMS_MAX*256];
+    writer_dump (&writer, report, sizeof (report));
+    printf ("writer: %s\n", report);
+  }
+  
+  //Close the outputs
+  int previews = 0;
+  int overlays = 0;
+  for (i=0; i<controller.length; i++){
+    pipeline = &controller.pipelines[i];
+    for (j=0; j<pipeline->sinks_length; j++){
+      sink_close (pipeline->sinks[j]);
+    }
+    if (pipeline->preview_spec){
+      previews = 1;
+    }
+    if (pipeline->overlay_format){
+      overlays = 1;
+    }
+  }
+  
+  char stats[PIPELINES_MAX*512];
+  if (audio_spec){
+    audio_dump (&audio, stats, sizeof (stats));
+    printf ("audio: %s\n", stats);
+    audio_close (&audio);
+  }
+  controller_dump (&controller, pipeline_dump_idr, stats, sizeof (stats));
+  printf ("idr: %s\n", stats);
+  controller_dump (&controller, pipeline_dump_frames, stats, sizeof (stats));
+  printf ("frames: %s\n", stats);
+  if (previews){
+    controller_dump (&controller, pipeline_dump_preview, stats,
+        sizeof (stats));
+    printf ("preview: %s\n", stats);
+    for (i=0; i<controller.length; i++){
+      if (controller.pipelines[i].preview_spec){
+        preview_close (&controller.pipelines[i].preview);
+      }
+    }
+  }
+  if (overlays){
+    controller_dump (&controller, pipeline_dump_overlay, stats,
+        sizeof (stats));
+    printf ("overlay: %s\n", stats);
+    for (i=0; i<controller.length; i++){
+      if (controller.pipelines[i].overlay_format){
+        overlay_close (&controller.pipelines[i].overlay);
+      }
+    }
+  }
+  if (control_path){
+    controller_dump (&controller, pipeline_dump_tuning, stats,
+        sizeof (stats));
+    printf ("live settings: %s\n", stats);
+  }
+  for (i=0; i<controller.length; i++){
+    tuning_close (&controller.pipelines[i].tuning);
+  }
+  if (controller.length > 1){
+    controller_dump (&controller, pipeline_dump_service, stats,
+        sizeof (stats));
+    printf ("cameras: %s; fairness %.3f\n", stats,
+        controller_fairness (&controller));
+  }
+  if (writer_threads){
+    writer_close (&writer);
+  }
+  if (timelapse){
+    uint32_t frames = 0;
+    for (i=0; i<controller.length; i++){
+      frames += controller.pipelines[i].frames.frames;
+    }
+    timelapse_meter_dump (&meter, frames, stats, sizeof (stats));
+    printf ("timelapse: %s\n", stats);
+  }
+  if (validate){
+    for (i=0; i<controller.length; i++){
+      if (controller.length > 1){
+        printf ("camera %u%s:\n", controller.pipelines[i].device,
+            controller.pipelines[i].parent ? " substream" : "");
+      }
+      validator_close (&controller.pipelines[i].validator);
+    }
+  }
+  if (low_latency){
+    char report[PIPELINES_MAX*OUTPUTS_MAX*512];
+    controller_dump (&controller, pipeline_dump_latency, report,
+        sizeof (report));
+    printf ("latency (%s): %s\n", latency_clock_absolute (&latency_clock) ?
+        "capture to send" : "relative to the lowest", report);
+    latency_clock_close (&latency_clock);
+  }
+  
   printf ("ok\n");
   
   return 0;
-}
\ No newline at end of file
+}
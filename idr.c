@@ -0,0 +1,61 @@
+#include <stdio.h>
+
+#include "idr.h"
+
+void idr_init (idr_t* idr){
+  idr->requests = 0;
+  idr->handled = 0;
+  idr->sent = -IDR_INTERVAL_MIN;
+  idr->frames = -1;
+  idr->sent_requests = 0;
+  idr->idr_frames = 0;
+  idr->latency_last = 0;
+  idr->latency_max = 0;
+  idr->latency_sum = 0;
+  idr->latency_count = 0;
+}
+
+void idr_request (idr_t* idr){
+  __sync_fetch_and_add (&idr->requests, 1);
+}
+
+int idr_pending (idr_t* idr, long now){
+  if (idr->requests == idr->handled) return 0;
+  //Wait for the IDR frame of the request in flight
+  if (idr->frames >= 0) return 0;
+  if (now - idr->sent < IDR_INTERVAL_MIN) return 0;
+
+  idr->sent = now;
+  idr->frames = 0;
+  idr->sent_requests++;
+  return 1;
+}
+
+void idr_frame (idr_t* idr, int sync){
+  if (idr->frames >= 0) idr->frames++;
+
+  if (!sync){
+    if (idr->frames > IDR_TIMEOUT_FRAMES) idr->frames = -1;
+    return;
+  }
+
+  idr->idr_frames++;
+  if (idr->frames >= 0){
+    idr->latency_last = idr->frames;
+    if (idr->latency_last > idr->latency_max){
+      idr->latency_max = idr->latency_last;
+    }
+    idr->latency_sum += idr->latency_last;
+    idr->latency_count++;
+    idr->frames = -1;
+  }
+  idr->handled = idr->requests;
+}
+
+int idr_dump (idr_t* idr, char* str, size_t size){
+  return snprintf (str, size, "requests %u, sent %u, idr frames %u, latency "
+      "(frames) last %u avg %.1f max %u", idr->requests, idr->sent_requests,
+      idr->idr_frames, idr->latency_last,
+      idr->latency_count ? (double)idr->latency_sum/idr->latency_count : 0.0,
+      idr->latency_max);
+}
@@ -0,0 +1,53 @@
+#ifndef IDR_H
+#define IDR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+On-demand IDR frames. Anybody (a new client, the control channel) can call
+idr_request() from any thread. The encoder loop asks idr_pending() before
+giving the buffer back to the encoder and, if it returns 1, it requests an IDR
+frame to the encoder (OMX_IndexConfigBrcmVideoRequestIFrame).
+
+The requests are coalesced: all the requests done before an IDR frame is
+produced are satisfied by it, even if it was a periodic IDR frame. They're
+also rate limited, at most one request is sent to the encoder every
+IDR_INTERVAL_MIN ms. The latency is measured in frames, from the request sent to
+the encoder to the IDR frame, both included.
+*/
+
+//Minimum time between two requests sent to the encoder (ms)
+#define IDR_INTERVAL_MIN 1000
+//A request that hasn't produced an IDR frame after this number of frames is
+//considered lost and can be sent again
+#define IDR_TIMEOUT_FRAMES 60
+
+typedef struct {
+  //Incremented by idr_request()
+  volatile uint32_t requests;
+  //Requests satisfied by an IDR frame
+  uint32_t handled;
+  //Time of the last request sent to the encoder (ms)
+  long sent;
+  //Frames since the last request sent to the encoder, -1 if none is in flight
+  int frames;
+  //Statistics
+  uint32_t sent_requests;
+  uint32_t idr_frames;
+  uint32_t latency_last;
+  uint32_t latency_max;
+  uint32_t latency_sum;
+  uint32_t latency_count;
+} idr_t;
+
+void idr_init (idr_t* idr);
+void idr_request (idr_t* idr);
+//Returns 1 if a request must be sent to the encoder now
+int idr_pending (idr_t* idr, long now);
+//Called for every encoded frame
+void idr_frame (idr_t* idr, int sync);
+//Prints the statistics in a string
+int idr_dump (idr_t* idr, char* str, size_t size);
+
+#endif
@@ -0,0 +1,106 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "latency.h"
+
+//System timer of the BCM283x, offset from the peripherals and registers
+#define STC_OFFSET 0x3000
+#define STC_SIZE 4096
+#define STC_CLO 1
+#define STC_CHI 2
+
+void latency_clock_open (latency_clock_t* clock, uint32_t peripherals){
+  clock->stc = 0;
+  clock->offset = 0;
+  clock->offset_valid = 0;
+
+  int fd = open ("/dev/mem", O_RDONLY | O_SYNC);
+  if (fd == -1){
+    fprintf (stderr, "warning: latency: /dev/mem not available, the latency "
+        "is relative\n");
+    return;
+  }
+  void* map = mmap (0, STC_SIZE, PROT_READ, MAP_SHARED, fd,
+      peripherals + STC_OFFSET);
+  close (fd);
+  if (map == MAP_FAILED){
+    fprintf (stderr, "warning: latency: mmap of the system timer failed, the "
+        "latency is relative\n");
+    return;
+  }
+  clock->stc = (volatile uint32_t*)map;
+}
+
+int latency_clock_absolute (latency_clock_t* clock){
+  return clock->stc != 0;
+}
+
+int64_t latency_clock_since (latency_clock_t* clock, int64_t timestamp){
+  if (clock->stc){
+    uint32_t high;
+    uint32_t low;
+    //The high word changes if the low one wraps between the two reads
+    do{
+      high = clock->stc[STC_CHI];
+      low = clock->stc[STC_CLO];
+    }while (high != clock->stc[STC_CHI]);
+    return (int64_t)(((uint64_t)high << 32) | low) - timestamp;
+  }
+
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  int64_t since = (int64_t)spec.tv_sec*1000000 + spec.tv_nsec/1000 - timestamp;
+  if (!clock->offset_valid || since < clock->offset){
+    clock->offset = since;
+    clock->offset_valid = 1;
+  }
+  return since - clock->offset;
+}
+
+void latency_clock_reset (latency_clock_t* clock){
+  clock->offset_valid = 0;
+}
+
+void latency_clock_close (latency_clock_t* clock){
+  if (clock->stc) munmap ((void*)clock->stc, STC_SIZE);
+  clock->stc = 0;
+}
+
+void latency_init (latency_t* latency){
+  memset (latency, 0, sizeof (latency_t));
+}
+
+void latency_add (latency_t* latency, int64_t us){
+  if (us < 0) us = 0;
+  int64_t bin = us/LATENCY_RESOLUTION;
+  latency->bins[bin < LATENCY_BINS ? bin : LATENCY_BINS - 1]++;
+  latency->count++;
+  latency->sum += us;
+  if (us > latency->max) latency->max = us;
+}
+
+double latency_percentile (latency_t* latency, double fraction){
+  uint32_t target = latency->count*fraction;
+  uint32_t n = 0;
+  int i;
+
+  for (i=0; i<LATENCY_BINS - 1; i++){
+    n += latency->bins[i];
+    if (n > target) return (i + 1)*LATENCY_RESOLUTION/1000.0;
+  }
+  return latency->max/1000.0;
+}
+
+int latency_dump (latency_t* latency, char* str, size_t size){
+  if (!latency->count) return snprintf (str, size, "no samples");
+  return snprintf (str, size, "%u samples, avg %.1f ms, p50 %.1f ms, p90 %.1f "
+      "ms, p99 %.1f ms, p99.9 %.1f ms, max %.1f ms", latency->count,
+      (double)latency->sum/latency->count/1000.0,
+      latency_percentile (latency, 0.5), latency_percentile (latency, 0.9),
+      latency_percentile (latency, 0.99), latency_percentile (latency, 0.999),
+      latency->max/1000.0);
+}
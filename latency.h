@@ -0,0 +1,57 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Latency from the capture of a frame to its delivery to an output, with
+percentiles. The timestamps of the frames (nTimeStamp) are taken by the
+VideoCore from its system timer (STC) when the camera uses raw STC timestamps.
+The same 1 MHz timer is mapped from /dev/mem, so the latency is absolute. If it
+cannot be mapped (not root), the clock is CLOCK_MONOTONIC and the latency is
+relative to the lowest one seen, which still shows the jitter and the tail.
+
+The samples are kept in a histogram, LATENCY_RESOLUTION us per bin up to
+LATENCY_MAX us, the rest go to the last bin.
+*/
+
+#define LATENCY_RESOLUTION 100
+#define LATENCY_MAX 500000
+#define LATENCY_BINS (LATENCY_MAX/LATENCY_RESOLUTION + 1)
+
+typedef struct {
+  //System timer registers, null if not mapped
+  volatile uint32_t* stc;
+  //Lowest difference between the clock and the timestamps when the STC is not
+  //available
+  int64_t offset;
+  int offset_valid;
+} latency_clock_t;
+
+typedef struct {
+  uint32_t bins[LATENCY_BINS];
+  uint32_t count;
+  int64_t sum;
+  int64_t max;
+} latency_t;
+
+//peripherals is the physical address of the peripherals
+//(bcm_host_get_peripheral_address())
+void latency_clock_open (latency_clock_t* clock, uint32_t peripherals);
+//Returns 1 if the latency is absolute
+int latency_clock_absolute (latency_clock_t* clock);
+//Time elapsed since the timestamp of a frame (us)
+int64_t latency_clock_since (latency_clock_t* clock, int64_t timestamp);
+//Forgets the lowest latency, the timestamps of a new stream start again
+void latency_clock_reset (latency_clock_t* clock);
+void latency_clock_close (latency_clock_t* clock);
+
+void latency_init (latency_t* latency);
+void latency_add (latency_t* latency, int64_t us);
+//Upper bound of the bin of the given fraction of the samples (ms)
+double latency_percentile (latency_t* latency, double fraction);
+//Prints the count, average, percentiles and maximum in a string
+int latency_dump (latency_t* latency, char* str, size_t size);
+
+#endif
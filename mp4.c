@@ -0,0 +1,853 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "mp4.h"
+#include "nal.h"
+
+//Track timescale (90 kHz, like the RTP clock)
+#define MP4_TIMESCALE 90000
+//Maximum size of the samples of a fragment. A GOP that doesn't fit is split in
+//several fragments
+#define MP4_FRAGMENT_SIZE (8*1024*1024)
+//Maximum samples of a fragment
+#define MP4_SAMPLES_MAX 1024
+//Maximum size of a frame that spans several buffers
+#define MP4_FRAME_SIZE (2*1024*1024)
+//Maximum NAL units in a frame
+#define MP4_NALS_MAX 256
+//Room for the ftyp and moov boxes, or the moof box
+#define MP4_BOXES_SIZE (4096 + 12*MP4_SAMPLES_MAX)
+//Sample duration used when the timestamps don't increase (30 fps)
+#define MP4_DEFAULT_DURATION (MP4_TIMESCALE/30)
+//Maximum duration of a fragment with audio, shorter than the audio ring
+#define MP4_AUDIO_FRAGMENT MP4_TIMESCALE
+
+//Sample flags (ISO/IEC 14496-12, section 8.8.3.1)
+#define MP4_SAMPLE_SYNC 0x02000000
+#define MP4_SAMPLE_NON_SYNC 0x01010000
+
+typedef struct {
+  uint32_t size;
+  int sync;
+  //Decoding time (timescale units)
+  int64_t time;
+} mp4_sample_t;
+
+typedef struct {
+  sink_t sink;
+  int fd;
+  //The ftyp and moov boxes have been written
+  int started;
+  //Generation of the SPS/PPS written in the avcC or in the last IDR frame
+  uint32_t generation;
+  //Sequence number of the next moof
+  uint32_t sequence;
+  //Timestamp of the first sample (us)
+  int64_t timestamp_origin;
+  uint32_t last_duration;
+  uint8_t* boxes;
+  //Samples of the current fragment in AVCC format (length prefixed)
+  uint8_t* data;
+  uint32_t data_length;
+  //Bytes of the frames of the fragment as they came from the encoder
+  uint64_t data_bytes;
+  mp4_sample_t samples[MP4_SAMPLES_MAX];
+  int samples_length;
+  //Frame assembled from several buffers
+  uint8_t* frame;
+  uint32_t frame_length;
+  int64_t frame_timestamp;
+  int frame_sync;
+  int frame_dropped;
+  //Waiting for the next IDR frame, also before the first one
+  int resync;
+  nal_t nals[MP4_NALS_MAX];
+  //Samples of the audio track, read when a fragment is written
+  audio_reader_t audio;
+  int16_t* audio_data;
+  uint32_t audio_max;
+} mp4_sink_t;
+
+static uint8_t* put8 (uint8_t* p, uint8_t value){
+  *p++ = value;
+  return p;
+}
+
+static uint8_t* put16 (uint8_t* p, uint16_t value){
+  *p++ = value >> 8;
+  *p++ = value;
+  return p;
+}
+
+static uint8_t* put32 (uint8_t* p, uint32_t value){
+  *p++ = value >> 24;
+  *p++ = value >> 16;
+  *p++ = value >> 8;
+  *p++ = value;
+  return p;
+}
+
+static uint8_t* put64 (uint8_t* p, uint64_t value){
+  p = put32 (p, value >> 32);
+  return put32 (p, value);
+}
+
+static uint8_t* put_zeros (uint8_t* p, uint32_t length){
+  memset (p, 0, length);
+  return p + length;
+}
+
+//Writes the header of a box, its size is written by box_end()
+static uint8_t* box_begin (uint8_t* p, const char* type){
+  p = put32 (p, 0);
+  memcpy (p, type, 4);
+  return p + 4;
+}
+
+static uint8_t* full_box_begin (
+    uint8_t* p,
+    const char* type,
+    uint8_t version,
+    uint32_t flags){
+  p = box_begin (p, type);
+  return put32 (p, (version << 24) | flags);
+}
+
+static void box_end (uint8_t* box, uint8_t* p){
+  put32 (box, p - box);
+}
+
+//Unity transformation matrix of the mvhd and tkhd boxes
+static uint8_t* put_matrix (uint8_t* p){
+  static const uint32_t matrix[] = {
+    0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000
+  };
+  int i;
+  for (i=0; i<9; i++){
+    p = put32 (p, matrix[i]);
+  }
+  return p;
+}
+
+static uint8_t* put_avcc (uint8_t* p, paramsets_t* paramsets){
+  sps_t* sps = &paramsets->sps;
+  uint8_t* box = p;
+
+  p = box_begin (p, "avcC");
+  p = put8 (p, 1);
+  p = put8 (p, sps->profile_idc);
+  p = put8 (p, sps->constraints);
+  p = put8 (p, sps->level_idc);
+  //4-byte NAL unit lengths
+  p = put8 (p, 0xFC | 3);
+  p = put8 (p, 0xE0 | 1);
+  p = put16 (p, paramsets->sps_length);
+  memcpy (p, paramsets->sps_nal, paramsets->sps_length);
+  p += paramsets->sps_length;
+  p = put8 (p, 1);
+  p = put16 (p, paramsets->pps_length);
+  memcpy (p, paramsets->pps_nal, paramsets->pps_length);
+  p += paramsets->pps_length;
+  if (sps->profile_idc == 100 || sps->profile_idc == 110 ||
+      sps->profile_idc == 122 || sps->profile_idc == 144){
+    p = put8 (p, 0xFC | sps->chroma_format_idc);
+    p = put8 (p, 0xF8 | (sps->bit_depth_luma - 8));
+    p = put8 (p, 0xF8 | (sps->bit_depth_chroma - 8));
+    //No SPS extensions
+    p = put8 (p, 0);
+  }
+  box_end (box, p);
+
+  return p;
+}
+
+//The data is in the same file
+static uint8_t* put_dinf (uint8_t* p){
+  uint8_t* dinf = p;
+  uint8_t* box;
+  uint8_t* url;
+
+  p = box_begin (p, "dinf");
+  box = p;
+  p = full_box_begin (p, "dref", 0, 0);
+  p = put32 (p, 1);
+  url = p;
+  p = full_box_begin (p, "url ", 0, 1);
+  box_end (url, p);
+  box_end (box, p);
+  box_end (dinf, p);
+
+  return p;
+}
+
+//Empty sample tables, the samples are in the fragments
+static uint8_t* put_sample_tables (uint8_t* p){
+  uint8_t* box;
+
+  box = p;
+  p = full_box_begin (p, "stts", 0, 0);
+  p = put32 (p, 0);
+  box_end (box, p);
+  box = p;
+  p = full_box_begin (p, "stsc", 0, 0);
+  p = put32 (p, 0);
+  box_end (box, p);
+  box = p;
+  p = full_box_begin (p, "stsz", 0, 0);
+  p = put32 (p, 0);
+  p = put32 (p, 0);
+  box_end (box, p);
+  box = p;
+  p = full_box_begin (p, "stco", 0, 0);
+  p = put32 (p, 0);
+  box_end (box, p);
+
+  return p;
+}
+
+static uint8_t* put_trex (
+    uint8_t* p,
+    uint32_t track,
+    uint32_t duration,
+    uint32_t size){
+  uint8_t* box = p;
+
+  p = full_box_begin (p, "trex", 0, 0);
+  //Track ID, sample description index, default duration, size and flags
+  p = put32 (p, track);
+  p = put32 (p, 1);
+  p = put32 (p, duration);
+  p = put32 (p, size);
+  p = put32 (p, 0);
+  box_end (box, p);
+
+  return p;
+}
+
+//Track of 16-bit little-endian PCM samples, one sample per frame
+static uint8_t* put_audio_trak (uint8_t* p, audio_t* audio){
+  uint8_t* trak;
+  uint8_t* mdia;
+  uint8_t* minf;
+  uint8_t* stbl;
+  uint8_t* box;
+
+  trak = p;
+  p = box_begin (p, "trak");
+
+  box = p;
+  p = full_box_begin (p, "tkhd", 0, 3);
+  p = put_zeros (p, 8);
+  p = put32 (p, 2);
+  p = put_zeros (p, 4);
+  p = put32 (p, 0);
+  //Reserved, layer, alternate group
+  p = put_zeros (p, 12);
+  //Volume 1.0
+  p = put16 (p, 0x0100);
+  p = put16 (p, 0);
+  p = put_matrix (p);
+  //No width and height
+  p = put_zeros (p, 8);
+  box_end (box, p);
+
+  mdia = p;
+  p = box_begin (p, "mdia");
+
+  box = p;
+  p = full_box_begin (p, "mdhd", 0, 0);
+  p = put_zeros (p, 8);
+  p = put32 (p, audio->rate);
+  p = put32 (p, 0);
+  p = put16 (p, 0x55C4);
+  p = put16 (p, 0);
+  box_end (box, p);
+
+  box = p;
+  p = full_box_begin (p, "hdlr", 0, 0);
+  p = put32 (p, 0);
+  memcpy (p, "soun", 4);
+  p = put_zeros (p + 4, 12);
+  memcpy (p, "SoundHandler", 13);
+  p += 13;
+  box_end (box, p);
+
+  minf = p;
+  p = box_begin (p, "minf");
+
+  box = p;
+  p = full_box_begin (p, "smhd", 0, 0);
+  //Balance and reserved
+  p = put_zeros (p, 4);
+  box_end (box, p);
+
+  p = put_dinf (p);
+
+  stbl = p;
+  p = box_begin (p, "stbl");
+
+  box = p;
+  p = full_box_begin (p, "stsd", 0, 0);
+  p = put32 (p, 1);
+  uint8_t* sowt = p;
+  p = box_begin (p, "sowt");
+  p = put_zeros (p, 6);
+  //Data reference index
+  p = put16 (p, 1);
+  p = put_zeros (p, 8);
+  p = put16 (p, audio->channels);
+  //Bits per sample
+  p = put16 (p, 16);
+  p = put_zeros (p, 4);
+  //16.16 fixed point
+  p = put32 (p, audio->rate << 16);
+  box_end (sowt, p);
+  box_end (box, p);
+
+  p = put_sample_tables (p);
+
+  box_end (stbl, p);
+  box_end (minf, p);
+  box_end (mdia, p);
+  box_end (trak, p);
+
+  return p;
+}
+
+//Builds the ftyp and moov boxes. The moov box has no samples, they're in the
+//fragments. Returns the size
+static uint32_t mp4_header (mp4_sink_t* sink, paramsets_t* paramsets){
+  uint8_t* p = sink->boxes;
+  uint8_t* ftyp;
+  uint8_t* moov;
+  uint8_t* trak;
+  uint8_t* mdia;
+  uint8_t* minf;
+  uint8_t* stbl;
+  uint8_t* box;
+  uint32_t width = paramsets->sps.width;
+  uint32_t height = paramsets->sps.height;
+
+  ftyp = p;
+  p = box_begin (p, "ftyp");
+  memcpy (p, "isom", 4);
+  p = put32 (p + 4, 0x200);
+  memcpy (p, "isomiso2avc1iso6mp41", 20);
+  p += 20;
+  box_end (ftyp, p);
+
+  moov = p;
+  p = box_begin (p, "moov");
+
+  box = p;
+  p = full_box_begin (p, "mvhd", 0, 0);
+  //Creation and modification time
+  p = put_zeros (p, 8);
+  p = put32 (p, 1000);
+  //Duration, unknown
+  p = put32 (p, 0);
+  //Rate 1.0, volume 1.0
+  p = put32 (p, 0x00010000);
+  p = put16 (p, 0x0100);
+  p = put_zeros (p, 10);
+  p = put_matrix (p);
+  p = put_zeros (p, 24);
+  //Next track ID
+  p = put32 (p, sink->sink.audio ? 3 : 2);
+  box_end (box, p);
+
+  trak = p;
+  p = box_begin (p, "trak");
+
+  box = p;
+  //Track enabled and in movie
+  p = full_box_begin (p, "tkhd", 0, 3);
+  p = put_zeros (p, 8);
+  //Track ID
+  p = put32 (p, 1);
+  p = put_zeros (p, 4);
+  //Duration
+  p = put32 (p, 0);
+  //Reserved, layer, alternate group, volume, reserved
+  p = put_zeros (p, 16);
+  p = put_matrix (p);
+  p = put32 (p, width << 16);
+  p = put32 (p, height << 16);
+  box_end (box, p);
+
+  mdia = p;
+  p = box_begin (p, "mdia");
+
+  box = p;
+  p = full_box_begin (p, "mdhd", 0, 0);
+  p = put_zeros (p, 8);
+  p = put32 (p, MP4_TIMESCALE);
+  p = put32 (p, 0);
+  //Language: und
+  p = put16 (p, 0x55C4);
+  p = put16 (p, 0);
+  box_end (box, p);
+
+  box = p;
+  p = full_box_begin (p, "hdlr", 0, 0);
+  p = put32 (p, 0);
+  memcpy (p, "vide", 4);
+  p = put_zeros (p + 4, 12);
+  memcpy (p, "VideoHandler", 13);
+  p += 13;
+  box_end (box, p);
+
+  minf = p;
+  p = box_begin (p, "minf");
+
+  box = p;
+  p = full_box_begin (p, "vmhd", 0, 1);
+  //Graphics mode and opcolor
+  p = put_zeros (p, 8);
+  box_end (box, p);
+
+  p = put_dinf (p);
+
+  stbl = p;
+  p = box_begin (p, "stbl");
+
+  box = p;
+  p = full_box_begin (p, "stsd", 0, 0);
+  p = put32 (p, 1);
+  uint8_t* avc1 = p;
+  p = box_begin (p, "avc1");
+  p = put_zeros (p, 6);
+  //Data reference index
+  p = put16 (p, 1);
+  p = put_zeros (p, 16);
+  p = put16 (p, width);
+  p = put16 (p, height);
+  //72 dpi
+  p = put32 (p, 0x00480000);
+  p = put32 (p, 0x00480000);
+  p = put32 (p, 0);
+  //Frame count
+  p = put16 (p, 1);
+  //Compressor name
+  p = put_zeros (p, 32);
+  //Depth
+  p = put16 (p, 0x18);
+  p = put16 (p, 0xFFFF);
+  p = put_avcc (p, paramsets);
+  box_end (avc1, p);
+  box_end (box, p);
+
+  p = put_sample_tables (p);
+
+  box_end (stbl, p);
+  box_end (minf, p);
+  box_end (mdia, p);
+  box_end (trak, p);
+
+  if (sink->sink.audio){
+    p = put_audio_trak (p, sink->sink.audio->audio);
+  }
+
+  //The samples are in the fragments
+  uint8_t* mvex = p;
+  p = box_begin (p, "mvex");
+  p = put_trex (p, 1, 0, 0);
+  if (sink->sink.audio){
+    //A sample is a frame of every channel
+    p = put_trex (p, 2, 1, sink->sink.audio->audio->channels*2);
+  }
+  box_end (mvex, p);
+
+  box_end (moov, p);
+
+  return p - sink->boxes;
+}
+
+//Writes everything or exits, the file is a regular file. With the writer
+//threads it returns 0 if the data doesn't fit in the stream
+static int mp4_writev (mp4_sink_t* sink, struct iovec* iov, int iovcnt){
+  ssize_t n;
+
+  if (sink->sink.stream){
+    return writer_writev (sink->sink.stream, iov, iovcnt);
+  }
+  while (iovcnt){
+    if ((n = writev (sink->fd, iov, iovcnt)) == -1){
+      if (errno == EINTR) continue;
+      fprintf (stderr, "error: writev\n");
+      exit (1);
+    }
+    while (iovcnt && (size_t)n >= iov->iov_len){
+      n -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt){
+      iov->iov_base = (uint8_t*)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+  return 1;
+}
+
+//Writes the current fragment. The duration of the last sample is the distance
+//to the next one, next_time, or the previous duration if it's not known (-1).
+//Returns 0 if the writer threads are behind and its frames have been dropped
+static int mp4_flush (mp4_sink_t* sink, int64_t next_time){
+  if (!sink->samples_length) return 1;
+
+  uint8_t* p = sink->boxes;
+  uint8_t* moof;
+  uint8_t* traf;
+  uint8_t* box;
+  uint8_t* data_offset;
+  uint8_t mdat[8];
+  int64_t duration;
+  int64_t end = 0;
+  uint32_t audio_length = 0;
+  int i;
+
+  moof = p;
+  p = box_begin (p, "moof");
+
+  box = p;
+  p = full_box_begin (p, "mfhd", 0, 0);
+  p = put32 (p, sink->sequence++);
+  box_end (box, p);
+
+  traf = p;
+  p = box_begin (p, "traf");
+
+  box = p;
+  //default-base-is-moof: the data offsets are relative to the moof box
+  p = full_box_begin (p, "tfhd", 0, 0x020000);
+  p = put32 (p, 1);
+  box_end (box, p);
+
+  box = p;
+  p = full_box_begin (p, "tfdt", 1, 0);
+  p = put64 (p, sink->samples[0].time);
+  box_end (box, p);
+
+  box = p;
+  //Data offset, sample duration, sample size and sample flags present
+  p = full_box_begin (p, "trun", 0, 0x000701);
+  p = put32 (p, sink->samples_length);
+  data_offset = p;
+  p += 4;
+  for (i=0; i<sink->samples_length; i++){
+    mp4_sample_t* sample = &sink->samples[i];
+    if (i + 1 < sink->samples_length){
+      duration = sink->samples[i + 1].time - sample->time;
+    }else if (next_time != -1){
+      duration = next_time - sample->time;
+    }else{
+      duration = sink->last_duration;
+    }
+    if (duration <= 0 || duration > UINT32_MAX){
+      duration = sink->last_duration;
+    }
+    sink->last_duration = duration;
+    p = put32 (p, duration);
+    p = put32 (p, sample->size);
+    p = put32 (p, sample->sync ? MP4_SAMPLE_SYNC : MP4_SAMPLE_NON_SYNC);
+    end = sample->time + duration;
+  }
+  box_end (box, p);
+
+  box_end (traf, p);
+
+  //The audio samples captured until the end of the last video sample, after
+  //the video in the mdat box
+  uint8_t* audio_offset = 0;
+  if (sink->audio_data){
+    audio_t* audio = sink->sink.audio->audio;
+    int64_t time = sink->audio.written;
+    audio_length = audio_reader_read (&sink->audio,
+        sink->audio.origin + end*1000000/MP4_TIMESCALE, sink->audio_data,
+        sink->audio_max);
+    if (audio_length){
+      traf = p;
+      p = box_begin (p, "traf");
+
+      box = p;
+      //Default sample duration and size present
+      p = full_box_begin (p, "tfhd", 0, 0x020018);
+      p = put32 (p, 2);
+      p = put32 (p, 1);
+      p = put32 (p, audio->channels*2);
+      box_end (box, p);
+
+      box = p;
+      p = full_box_begin (p, "tfdt", 1, 0);
+      p = put64 (p, time);
+      box_end (box, p);
+
+      box = p;
+      p = full_box_begin (p, "trun", 0, 0x000001);
+      p = put32 (p, audio_length);
+      audio_offset = p;
+      p += 4;
+      box_end (box, p);
+
+      box_end (traf, p);
+      audio_length *= audio->channels*2;
+    }
+  }
+
+  box_end (moof, p);
+
+  put32 (data_offset, p - moof + sizeof (mdat));
+  if (audio_offset){
+    put32 (audio_offset, p - moof + sizeof (mdat) + sink->data_length);
+  }
+  put32 (mdat, sizeof (mdat) + sink->data_length + audio_length);
+  memcpy (mdat + 4, "mdat", 4);
+
+  //The whole fragment is written with a single call
+  struct iovec iov[4];
+  iov[0].iov_base = sink->boxes;
+  iov[0].iov_len = p - sink->boxes;
+  iov[1].iov_base = mdat;
+  iov[1].iov_len = sizeof (mdat);
+  iov[2].iov_base = sink->data;
+  iov[2].iov_len = sink->data_length;
+  iov[3].iov_base = sink->audio_data;
+  iov[3].iov_len = audio_length;
+  int written = mp4_writev (sink, iov, audio_length ? 4 : 3);
+  if (!written){
+    sink->sink.frames -= sink->samples_length;
+    sink->sink.dropped_frames += sink->samples_length;
+    sink->sink.bytes -= sink->data_bytes;
+  }
+
+  sink->samples_length = 0;
+  sink->data_length = 0;
+  sink->data_bytes = 0;
+  return written;
+}
+
+static uint8_t* put_nal (uint8_t* p, uint8_t* nal, uint32_t length){
+  p = put32 (p, length);
+  memcpy (p, nal, length);
+  return p + length;
+}
+
+//Converts an Annex-B frame to a sample. Returns 0 if it doesn't fit
+static int mp4_add_sample (
+    mp4_sink_t* sink,
+    uint8_t* data,
+    uint32_t length,
+    int64_t timestamp,
+    int sync){
+  paramsets_t* paramsets = sink->sink.paramsets;
+  int n = nal_split (data, length, sink->nals, MP4_NALS_MAX);
+  //The SPS/PPS are repeated in the IDR frames after they change
+  int inband = sync && paramsets->generation != sink->generation;
+  uint32_t size = 0;
+  int i;
+
+  for (i=0; i<n; i++){
+    size += 4 + sink->nals[i].length;
+  }
+  if (inband){
+    size += 8 + paramsets->sps_length + paramsets->pps_length;
+  }
+  if (size > MP4_FRAGMENT_SIZE) return 0;
+
+  int64_t time = (timestamp - sink->timestamp_origin)*MP4_TIMESCALE/1000000;
+
+  //A fragment per GOP, or smaller if the GOP doesn't fit or it's too long
+  //for the audio
+  if (sync || sink->samples_length == MP4_SAMPLES_MAX ||
+      sink->data_length + size > MP4_FRAGMENT_SIZE ||
+      (sink->sink.audio && sink->samples_length &&
+      time - sink->samples[0].time >= MP4_AUDIO_FRAGMENT)){
+    //An IDR frame starts a new fragment that doesn't need the lost one
+    if (!mp4_flush (sink, time) && !sync) return 0;
+  }
+
+  uint8_t* p = sink->data + sink->data_length;
+  if (inband){
+    p = put_nal (p, paramsets->sps_nal, paramsets->sps_length);
+    p = put_nal (p, paramsets->pps_nal, paramsets->pps_length);
+    sink->generation = paramsets->generation;
+  }
+  for (i=0; i<n; i++){
+    p = put_nal (p, sink->nals[i].data, sink->nals[i].length);
+  }
+
+  mp4_sample_t* sample = &sink->samples[sink->samples_length++];
+  sample->size = size;
+  sample->sync = sync;
+  sample->time = time;
+  sink->data_length += size;
+
+  return 1;
+}
+
+//The audio starts with the first frame of the first file
+static void mp4_audio_start (mp4_sink_t* sink){
+  audio_t* audio = sink->sink.audio->audio;
+
+  //Enough for the longest fragment and the corrections
+  sink->audio_max = 2*(uint64_t)audio->rate*MP4_AUDIO_FRAGMENT/MP4_TIMESCALE;
+  sink->audio_data = malloc (sink->audio_max*audio->channels*sizeof (int16_t));
+  if (!sink->audio_data){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+  audio_reader_start (&sink->audio, sink->sink.audio, sink->sink.name,
+      sink->frame_timestamp);
+}
+
+static void mp4_sink_write (sink_t* base, stream_buffer_t* buffer){
+  mp4_sink_t* sink = (mp4_sink_t*)base;
+  uint8_t* data;
+  uint32_t length;
+
+  //The SPS/PPS go to the avcC box, they're taken from the cache
+  if (buffer->flags & STREAM_FLAG_CODECCONFIG) return;
+
+  if (!sink->frame_length){
+    sink->frame_timestamp = buffer->timestamp;
+  }
+  sink->frame_sync |= buffer->flags & STREAM_FLAG_SYNCFRAME;
+
+  if ((buffer->flags & STREAM_FLAG_ENDOFFRAME) && !sink->frame_length){
+    //The whole frame is in this buffer, it's converted without copying it
+    //twice
+    data = buffer->data;
+    length = buffer->length;
+  }else{
+    if (sink->frame_length + buffer->length > MP4_FRAME_SIZE){
+      sink->frame_dropped = 1;
+    }else{
+      memcpy (sink->frame + sink->frame_length, buffer->data, buffer->length);
+      sink->frame_length += buffer->length;
+    }
+    if (!(buffer->flags & STREAM_FLAG_ENDOFFRAME)) return;
+    data = sink->frame;
+    length = sink->frame_length;
+  }
+
+  if (sink->resync && sink->frame_sync && base->paramsets &&
+      base->paramsets->complete){
+    sink->resync = 0;
+    if (!sink->started){
+      //The file can be played from the first IDR frame
+      struct iovec iov;
+      iov.iov_base = sink->boxes;
+      iov.iov_len = mp4_header (sink, base->paramsets);
+      if (mp4_writev (sink, &iov, 1)){
+        sink->generation = base->paramsets->generation;
+        if (sink->sequence == 1){
+          sink->timestamp_origin = sink->frame_timestamp;
+          if (base->audio){
+            mp4_audio_start (sink);
+          }
+        }
+        sink->started = 1;
+      }else{
+        //The writer threads are behind, the file starts at a later IDR frame
+        sink->resync = 1;
+        if (base->idr) idr_request (base->idr);
+      }
+    }
+  }
+
+  if (sink->frame_dropped || sink->resync ||
+      !mp4_add_sample (sink, data, length, sink->frame_timestamp,
+      sink->frame_sync)){
+    if (!sink->resync && base->idr) idr_request (base->idr);
+    sink->resync = 1;
+    base->dropped_frames++;
+  }else{
+    base->frames++;
+    base->bytes += length;
+    sink->data_bytes += length;
+  }
+
+  sink->frame_length = 0;
+  sink->frame_sync = 0;
+  sink->frame_dropped = 0;
+}
+
+static int mp4_sink_rotate (sink_t* base, int fd){
+  mp4_sink_t* sink = (mp4_sink_t*)base;
+  int previous = sink->fd;
+
+  //The new file gets its own ftyp and moov at the next IDR frame. The
+  //decoding times continue from the previous file
+  mp4_flush (sink, -1);
+  if (base->stream) previous = writer_rotate (base->stream, fd);
+  sink->fd = fd;
+  sink->started = 0;
+  sink->resync = 1;
+
+  return previous;
+}
+
+static void mp4_sink_close (sink_t* base){
+  mp4_sink_t* sink = (mp4_sink_t*)base;
+
+  mp4_flush (sink, -1);
+
+  if (sink->audio_data){
+    char str[256];
+    audio_reader_dump (&sink->audio, str, sizeof (str));
+    printf ("audio %s: %s\n", base->name, str);
+  }
+
+  if (base->stream) sink->fd = writer_stream_close (base->stream);
+  if (close (sink->fd)){
+    fprintf (stderr, "error: close\n");
+    exit (1);
+  }
+
+  free (sink->boxes);
+  free (sink->data);
+  free (sink->frame);
+  free (sink->audio_data);
+  free (sink);
+}
+
+sink_t* mp4_sink_open (const char* spec){
+  mp4_sink_t* sink = calloc (1, sizeof (mp4_sink_t));
+  if (!sink){
+    fprintf (stderr, "error: calloc\n");
+    exit (1);
+  }
+  sink->sink.name = spec;
+  sink->sink.write = mp4_sink_write;
+  sink->sink.close = mp4_sink_close;
+  sink->sink.rotate = mp4_sink_rotate;
+  sink->resync = 1;
+  sink->sequence = 1;
+  sink->last_duration = MP4_DEFAULT_DURATION;
+
+  const char* path = strncmp (spec, "mp4:", 4) ? spec : spec + 4;
+  sink->fd = open (path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+  if (sink->fd == -1){
+    fprintf (stderr, "error: open\n");
+    exit (1);
+  }
+  sink_stream (&sink->sink, sink->fd);
+
+  sink->boxes = malloc (MP4_BOXES_SIZE);
+  sink->data = malloc (MP4_FRAGMENT_SIZE);
+  sink->frame = malloc (MP4_FRAME_SIZE);
+  if (!sink->boxes || !sink->data || !sink->frame){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+
+  return &sink->sink;
+}
@@ -0,0 +1,27 @@
+#ifndef MP4_H
+#define MP4_H
+
+#include "sink.h"
+
+/*
+Fragmented MP4 (ISO BMFF) writer. The file starts with the ftyp and moov boxes,
+written at the first IDR frame with the avcC built from the cached SPS/PPS, and
+then there's one moof/mdat pair per GOP. The sample durations come from the
+encoder timestamps and the IDR frames are flagged as sync samples, so the file
+plays without remuxing it.
+
+The file is only appended to, never seeked, and every fragment is written at
+once when it's complete, so a file cut off by a power loss is playable up to its
+last complete fragment. The fragment is built in buffers allocated when the
+sink is opened, nothing is allocated per frame.
+
+With an audio source (-a, see audio.h) there's a second track of 16-bit PCM
+samples. The fragments are 1 s long at most and every one has the samples
+captured until the end of its last frame, after the video in the mdat box.
+
+Output specification: mp4:PATH, or a PATH that ends with .mp4
+*/
+
+sink_t* mp4_sink_open (const char* spec);
+
+#endif
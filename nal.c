@@ -0,0 +1,170 @@
+#include <stddef.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define NAL_NEON
+#endif
+
+#include "nal.h"
+
+//Byte-at-a-time search, used for the last bytes of a buffer and when there's
+//no SIMD support
+static uint8_t* find_start_code_scalar (uint8_t* p, uint8_t* end){
+  for (; p + 2 < end; p++){
+    if (p[2] > 1){
+      p += 2;
+    }else if (!p[0] && !p[1] && p[2] == 1){
+      return p;
+    }
+  }
+  return end;
+}
+
+//Returns the position of the next 00 00 01 sequence or end. The bytes p[i],
+//p[i + 1] and p[i + 2] of 16 consecutive positions are compared at once
+static uint8_t* find_start_code (uint8_t* p, uint8_t* end){
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128 ();
+  const __m128i one = _mm_set1_epi8 (1);
+  __m128i a;
+  __m128i b;
+  __m128i c;
+  int mask;
+
+  for (; p + 18 <= end; p += 16){
+    a = _mm_cmpeq_epi8 (_mm_loadu_si128 ((__m128i*)p), zero);
+    b = _mm_cmpeq_epi8 (_mm_loadu_si128 ((__m128i*)(p + 1)), zero);
+    c = _mm_cmpeq_epi8 (_mm_loadu_si128 ((__m128i*)(p + 2)), one);
+    mask = _mm_movemask_epi8 (_mm_and_si128 (_mm_and_si128 (a, b), c));
+    if (mask) return p + __builtin_ctz (mask);
+  }
+#elif defined(NAL_NEON)
+  const uint8x16_t zero = vdupq_n_u8 (0);
+  const uint8x16_t one = vdupq_n_u8 (1);
+  uint8x16_t m;
+  uint64_t mask;
+
+  for (; p + 18 <= end; p += 16){
+    m = vandq_u8 (vandq_u8 (vceqq_u8 (vld1q_u8 (p), zero),
+        vceqq_u8 (vld1q_u8 (p + 1), zero)), vceqq_u8 (vld1q_u8 (p + 2), one));
+    //There's no movemask, the 16 bytes are narrowed to 4 bits each
+    mask = vget_lane_u64 (vreinterpret_u64_u8 (
+        vshrn_n_u16 (vreinterpretq_u16_u8 (m), 4)), 0);
+    if (mask) return p + (__builtin_ctzll (mask) >> 2);
+  }
+#endif
+  return find_start_code_scalar (p, end);
+}
+
+int nal_split (uint8_t* data, uint32_t length, nal_t* nals, int max){
+  uint8_t* end = data + length;
+  uint8_t* p = find_start_code (data, end);
+  uint8_t* next;
+  int n = 0;
+
+  while (p < end && n < max){
+    p += 3;
+    next = find_start_code (p, end);
+    nals[n].data = p;
+    //The first zero of a 4-byte start code belongs to it, not to the previous
+    //NAL unit
+    nals[n].length = (next < end && !next[-1] ? next - 1 : next) - p;
+    nals[n].offset = p - data;
+    nals[n].type = nals[n].length ? p[0] & 0x1F : 0;
+    if (nals[n].length) n++;
+    p = next;
+  }
+
+  return n;
+}
+
+void nal_scanner_init (nal_scanner_t* scanner){
+  scanner->position = 0;
+  scanner->zeros = 0;
+  scanner->open = 0;
+  scanner->type_pending = 0;
+}
+
+//A start code ends at data[index] (the 01 byte). The zeros before it may be in
+//the previous buffers
+static void nal_scanner_start (
+    nal_scanner_t* scanner,
+    uint8_t* data,
+    uint32_t length,
+    uint32_t index,
+    nal_entry_t* nals,
+    int* n,
+    int max){
+  uint64_t position = scanner->position + index;
+
+  if (scanner->open){
+    int four = index >= 3 ? !data[index - 3] : scanner->zeros >= 3 - index;
+    uint64_t end = position - 2 - four;
+    if (end > scanner->nal.offset){
+      scanner->nal.length = end - scanner->nal.offset;
+      if (*n < max) nals[(*n)++] = scanner->nal;
+    }
+  }
+
+  scanner->open = 1;
+  scanner->nal.offset = position + 1;
+  scanner->type_pending = index + 1 == length;
+  if (!scanner->type_pending){
+    scanner->nal.type = data[index + 1] & 0x1F;
+  }
+}
+
+int nal_scan (
+    nal_scanner_t* scanner,
+    uint8_t* data,
+    uint32_t length,
+    nal_entry_t* nals,
+    int max){
+  uint8_t* end = data + length;
+  uint8_t* p;
+  uint32_t i;
+  int n = 0;
+
+  if (!length) return 0;
+
+  if (scanner->type_pending){
+    scanner->nal.type = data[0] & 0x1F;
+    scanner->type_pending = 0;
+  }
+
+  //Start codes split between the previous buffer and this one
+  for (i=0; i<2 && i<length; i++){
+    if (data[i] == 1 && scanner->zeros + i >= 2){
+      nal_scanner_start (scanner, data, length, i, nals, &n, max);
+    }
+    if (data[i]) break;
+  }
+
+  for (p=find_start_code (data, end); p<end; p=find_start_code (p + 3, end)){
+    nal_scanner_start (scanner, data, length, p - data + 2, nals, &n, max);
+  }
+
+  //Zeros at the end, they may be the beginning of the next start code
+  for (i=0; i<3 && i<length && !end[-1 - (int)i]; i++);
+  scanner->zeros = i == length ? scanner->zeros + i : i;
+  if (scanner->zeros > 3) scanner->zeros = 3;
+  scanner->position += length;
+
+  return n;
+}
+
+int nal_scanner_flush (nal_scanner_t* scanner, nal_entry_t* nal){
+  int open = scanner->open && !scanner->type_pending &&
+      scanner->position > scanner->nal.offset;
+
+  if (open){
+    scanner->nal.length = scanner->position - scanner->nal.offset;
+    *nal = scanner->nal;
+  }
+  scanner->open = 0;
+  scanner->type_pending = 0;
+
+  return open;
+}
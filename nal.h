@@ -0,0 +1,71 @@
+#ifndef NAL_H
+#define NAL_H
+
+#include <stdint.h>
+
+//NAL unit types (H.264, table 7-1)
+#define NAL_SLICE 1
+#define NAL_IDR 5
+#define NAL_SEI 6
+#define NAL_SPS 7
+#define NAL_PPS 8
+#define NAL_AUD 9
+
+//A NAL unit inside an Annex-B buffer. The data points to the NAL header, the
+//start code is not included
+typedef struct {
+  uint8_t* data;
+  uint32_t length;
+  //Offset of the NAL header from the beginning of the buffer
+  uint32_t offset;
+  uint8_t type;
+} nal_t;
+
+//A NAL unit found by the streaming scanner. It may span several buffers, so
+//it's described by its position in the stream
+typedef struct {
+  //Offset of the NAL header from the beginning of the stream
+  uint64_t offset;
+  uint64_t length;
+  uint8_t type;
+} nal_entry_t;
+
+/*
+Streaming scanner: the buffers are fed in order and the start codes can be
+split between two buffers. A NAL unit is reported when the next start code is
+found, or by nal_scanner_flush() when the caller knows that it has ended (end of
+frame or end of stream). Nothing is copied.
+
+The start codes are searched 16 bytes at a time with SSE2 or NEON (compile with
+-mfpu=neon on a Raspberry Pi 2 or newer), with a byte-at-a-time fallback.
+*/
+typedef struct {
+  //Stream offset of the next buffer
+  uint64_t position;
+  //Zero bytes at the end of the stream, up to 3
+  uint32_t zeros;
+  //A NAL unit has started and hasn't been reported yet
+  int open;
+  //Its type is the first byte of the next buffer
+  int type_pending;
+  nal_entry_t nal;
+} nal_scanner_t;
+
+//Splits an Annex-B buffer into NAL units. Returns the number of NAL units
+//stored in nals, at most max
+int nal_split (uint8_t* data, uint32_t length, nal_t* nals, int max);
+
+void nal_scanner_init (nal_scanner_t* scanner);
+//Scans the next buffer of the stream. Returns the number of NAL units ended in
+//this buffer that have been stored in nals, at most max (the rest are lost)
+int nal_scan (
+    nal_scanner_t* scanner,
+    uint8_t* data,
+    uint32_t length,
+    nal_entry_t* nals,
+    int max);
+//Ends the current NAL unit at the end of the data scanned so far. Returns 1 if
+//there was one
+int nal_scanner_flush (nal_scanner_t* scanner, nal_entry_t* nal);
+
+#endif
@@ -0,0 +1,427 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (__ARM_NEON) || defined (__ARM_NEON__)
+#define OVERLAY_NEON
+#include <arm_neon.h>
+#elif defined (__SSE2__)
+#define OVERLAY_SSE2
+#include <emmintrin.h>
+#endif
+
+#include "overlay.h"
+
+//Printable ASCII characters
+#define OVERLAY_FIRST ' '
+#define OVERLAY_GLYPHS 95
+//Font cell, the glyphs are 5x7 plus the spacing
+#define OVERLAY_CELL_WIDTH 6
+#define OVERLAY_CELL_HEIGHT 8
+
+//5x7 font, a byte per column, the least significant bit is the top row
+static const uint8_t font[OVERLAY_GLYPHS][5] = {
+  { 0x00, 0x00, 0x00, 0x00, 0x00 }, //space
+  { 0x00, 0x00, 0x5F, 0x00, 0x00 }, //!
+  { 0x00, 0x07, 0x00, 0x07, 0x00 }, //"
+  { 0x14, 0x7F, 0x14, 0x7F, 0x14 }, //#
+  { 0x24, 0x2A, 0x7F, 0x2A, 0x12 }, //$
+  { 0x23, 0x13, 0x08, 0x64, 0x62 }, //%
+  { 0x36, 0x49, 0x55, 0x22, 0x50 }, //&
+  { 0x00, 0x05, 0x03, 0x00, 0x00 }, //'
+  { 0x00, 0x1C, 0x22, 0x41, 0x00 }, //(
+  { 0x00, 0x41, 0x22, 0x1C, 0x00 }, //)
+  { 0x14, 0x08, 0x3E, 0x08, 0x14 }, //*
+  { 0x08, 0x08, 0x3E, 0x08, 0x08 }, //+
+  { 0x00, 0x50, 0x30, 0x00, 0x00 }, //,
+  { 0x08, 0x08, 0x08, 0x08, 0x08 }, //-
+  { 0x00, 0x60, 0x60, 0x00, 0x00 }, //.
+  { 0x20, 0x10, 0x08, 0x04, 0x02 }, ///
+  { 0x3E, 0x51, 0x49, 0x45, 0x3E }, //0
+  { 0x00, 0x42, 0x7F, 0x40, 0x00 }, //1
+  { 0x42, 0x61, 0x51, 0x49, 0x46 }, //2
+  { 0x21, 0x41, 0x45, 0x4B, 0x31 }, //3
+  { 0x18, 0x14, 0x12, 0x7F, 0x10 }, //4
+  { 0x27, 0x45, 0x45, 0x45, 0x39 }, //5
+  { 0x3C, 0x4A, 0x49, 0x49, 0x30 }, //6
+  { 0x01, 0x71, 0x09, 0x05, 0x03 }, //7
+  { 0x36, 0x49, 0x49, 0x49, 0x36 }, //8
+  { 0x06, 0x49, 0x49, 0x29, 0x1E }, //9
+  { 0x00, 0x36, 0x36, 0x00, 0x00 }, //:
+  { 0x00, 0x56, 0x36, 0x00, 0x00 }, //;
+  { 0x08, 0x14, 0x22, 0x41, 0x00 }, //<
+  { 0x14, 0x14, 0x14, 0x14, 0x14 }, //=
+  { 0x00, 0x41, 0x22, 0x14, 0x08 }, //>
+  { 0x02, 0x01, 0x51, 0x09, 0x06 }, //?
+  { 0x32, 0x49, 0x79, 0x41, 0x3E }, //@
+  { 0x7E, 0x11, 0x11, 0x11, 0x7E }, //A
+  { 0x7F, 0x49, 0x49, 0x49, 0x36 }, //B
+  { 0x3E, 0x41, 0x41, 0x41, 0x22 }, //C
+  { 0x7F, 0x41, 0x41, 0x22, 0x1C }, //D
+  { 0x7F, 0x49, 0x49, 0x49, 0x41 }, //E
+  { 0x7F, 0x09, 0x09, 0x09, 0x01 }, //F
+  { 0x3E, 0x41, 0x49, 0x49, 0x7A }, //G
+  { 0x7F, 0x08, 0x08, 0x08, 0x7F }, //H
+  { 0x00, 0x41, 0x7F, 0x41, 0x00 }, //I
+  { 0x20, 0x40, 0x41, 0x3F, 0x01 }, //J
+  { 0x7F, 0x08, 0x14, 0x22, 0x41 }, //K
+  { 0x7F, 0x40, 0x40, 0x40, 0x40 }, //L
+  { 0x7F, 0x02, 0x0C, 0x02, 0x7F }, //M
+  { 0x7F, 0x04, 0x08, 0x10, 0x7F }, //N
+  { 0x3E, 0x41, 0x41, 0x41, 0x3E }, //O
+  { 0x7F, 0x09, 0x09, 0x09, 0x06 }, //P
+  { 0x3E, 0x41, 0x51, 0x21, 0x5E }, //Q
+  { 0x7F, 0x09, 0x19, 0x29, 0x46 }, //R
+  { 0x46, 0x49, 0x49, 0x49, 0x31 }, //S
+  { 0x01, 0x01, 0x7F, 0x01, 0x01 }, //T
+  { 0x3F, 0x40, 0x40, 0x40, 0x3F }, //U
+  { 0x1F, 0x20, 0x40, 0x20, 0x1F }, //V
+  { 0x3F, 0x40, 0x38, 0x40, 0x3F }, //W
+  { 0x63, 0x14, 0x08, 0x14, 0x63 }, //X
+  { 0x07, 0x08, 0x70, 0x08, 0x07 }, //Y
+  { 0x61, 0x51, 0x49, 0x45, 0x43 }, //Z
+  { 0x00, 0x7F, 0x41, 0x41, 0x00 }, //[
+  { 0x02, 0x04, 0x08, 0x10, 0x20 }, //backslash
+  { 0x00, 0x41, 0x41, 0x7F, 0x00 }, //]
+  { 0x04, 0x02, 0x01, 0x02, 0x04 }, //^
+  { 0x40, 0x40, 0x40, 0x40, 0x40 }, //_
+  { 0x00, 0x01, 0x02, 0x04, 0x00 }, //`
+  { 0x20, 0x54, 0x54, 0x54, 0x78 }, //a
+  { 0x7F, 0x48, 0x44, 0x44, 0x38 }, //b
+  { 0x38, 0x44, 0x44, 0x44, 0x20 }, //c
+  { 0x38, 0x44, 0x44, 0x48, 0x7F }, //d
+  { 0x38, 0x54, 0x54, 0x54, 0x18 }, //e
+  { 0x08, 0x7E, 0x09, 0x01, 0x02 }, //f
+  { 0x0C, 0x52, 0x52, 0x52, 0x3E }, //g
+  { 0x7F, 0x08, 0x04, 0x04, 0x78 }, //h
+  { 0x00, 0x44, 0x7D, 0x40, 0x00 }, //i
+  { 0x20, 0x40, 0x44, 0x3D, 0x00 }, //j
+  { 0x7F, 0x10, 0x28, 0x44, 0x00 }, //k
+  { 0x00, 0x41, 0x7F, 0x40, 0x00 }, //l
+  { 0x7C, 0x04, 0x18, 0x04, 0x78 }, //m
+  { 0x7C, 0x08, 0x04, 0x04, 0x78 }, //n
+  { 0x38, 0x44, 0x44, 0x44, 0x38 }, //o
+  { 0x7C, 0x14, 0x14, 0x14, 0x08 }, //p
+  { 0x08, 0x14, 0x14, 0x18, 0x7C }, //q
+  { 0x7C, 0x08, 0x04, 0x04, 0x08 }, //r
+  { 0x48, 0x54, 0x54, 0x54, 0x20 }, //s
+  { 0x04, 0x3F, 0x44, 0x40, 0x20 }, //t
+  { 0x3C, 0x40, 0x40, 0x20, 0x7C }, //u
+  { 0x1C, 0x20, 0x40, 0x20, 0x1C }, //v
+  { 0x3C, 0x40, 0x30, 0x40, 0x3C }, //w
+  { 0x44, 0x28, 0x10, 0x28, 0x44 }, //x
+  { 0x0C, 0x50, 0x50, 0x50, 0x3C }, //y
+  { 0x44, 0x64, 0x54, 0x4C, 0x44 }, //z
+  { 0x00, 0x08, 0x36, 0x41, 0x00 }, //{
+  { 0x00, 0x00, 0x7F, 0x00, 0x00 }, //|
+  { 0x00, 0x41, 0x36, 0x08, 0x00 }, //}
+  { 0x08, 0x04, 0x08, 0x10, 0x08 }  //~
+};
+
+static int64_t overlay_time (){
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  return (int64_t)spec.tv_sec*1000000 + spec.tv_nsec/1000;
+}
+
+//x/255 rounded, for x <= 255*255: (x + 128 + ((x + 128) >> 8)) >> 8. The
+//three versions give the same pixels
+static void overlay_blend (
+    uint8_t* pixels,
+    const uint8_t* value,
+    const uint8_t* alpha,
+    uint32_t length){
+  uint32_t i = 0;
+
+#if defined (OVERLAY_NEON)
+  for (; i + 16 <= length; i += 16){
+    uint8x16_t p = vld1q_u8 (pixels + i);
+    uint8x16_t a = vld1q_u8 (alpha + i);
+    uint16x8_t low = vmull_u8 (vget_low_u8 (p), vget_low_u8 (a));
+    uint16x8_t high = vmull_u8 (vget_high_u8 (p), vget_high_u8 (a));
+    uint8x16_t blended = vcombine_u8 (
+        vraddhn_u16 (low, vrshrq_n_u16 (low, 8)),
+        vraddhn_u16 (high, vrshrq_n_u16 (high, 8)));
+    vst1q_u8 (pixels + i, vqaddq_u8 (blended, vld1q_u8 (value + i)));
+  }
+#elif defined (OVERLAY_SSE2)
+  __m128i zero = _mm_setzero_si128 ();
+  __m128i half = _mm_set1_epi16 (128);
+  for (; i + 16 <= length; i += 16){
+    __m128i p = _mm_loadu_si128 ((const __m128i*)(pixels + i));
+    __m128i a = _mm_loadu_si128 ((const __m128i*)(alpha + i));
+    __m128i low = _mm_add_epi16 (_mm_mullo_epi16 (
+        _mm_unpacklo_epi8 (p, zero), _mm_unpacklo_epi8 (a, zero)), half);
+    __m128i high = _mm_add_epi16 (_mm_mullo_epi16 (
+        _mm_unpackhi_epi8 (p, zero), _mm_unpackhi_epi8 (a, zero)), half);
+    low = _mm_srli_epi16 (_mm_add_epi16 (low, _mm_srli_epi16 (low, 8)), 8);
+    high = _mm_srli_epi16 (_mm_add_epi16 (high, _mm_srli_epi16 (high, 8)), 8);
+    __m128i blended = _mm_packus_epi16 (low, high);
+    _mm_storeu_si128 ((__m128i*)(pixels + i), _mm_adds_epu8 (blended,
+        _mm_loadu_si128 ((const __m128i*)(value + i))));
+  }
+#endif
+
+  for (; i<length; i++){
+    uint32_t x = pixels[i]*alpha[i] + 128;
+    x = value[i] + ((x + (x >> 8)) >> 8);
+    pixels[i] = x > 255 ? 255 : x;
+  }
+}
+
+static void overlay_planes_alloc (
+    overlay_planes_t* planes,
+    uint32_t width,
+    uint32_t height){
+  planes->stride = width;
+  planes->value = malloc (width*height);
+  planes->alpha = malloc (width*height);
+  if (!planes->value || !planes->alpha){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+}
+
+static void overlay_planes_free (overlay_planes_t* planes){
+  free (planes->value);
+  free (planes->alpha);
+}
+
+//Premultiplied value and inverse alpha
+static void overlay_pixel (
+    overlay_planes_t* planes,
+    uint32_t x,
+    uint32_t y,
+    uint32_t value,
+    uint32_t alpha){
+  planes->value[y*planes->stride + x] = (value*alpha + 127)/255;
+  planes->alpha[y*planes->stride + x] = 255 - alpha;
+}
+
+//Pixel of a glyph at the scale of the atlas, 0 outside of the font
+static int overlay_font_pixel (
+    int glyph,
+    int x,
+    int y,
+    uint32_t scale,
+    uint32_t margin){
+  if (x < (int)margin || y < (int)margin) return 0;
+  x = (x - margin)/scale;
+  y = (y - margin)/scale;
+  return x < 5 && y < 7 && (font[glyph][x] >> y) & 1;
+}
+
+//Rasterizes every glyph: the text, an outline of half a font pixel around it
+//and the background
+static void overlay_rasterize (overlay_t* overlay, uint32_t scale){
+  uint32_t width = overlay->glyph_width;
+  uint32_t height = overlay->glyph_height;
+  uint32_t margin = scale/2;
+  int dx;
+  int dy;
+  uint32_t glyph;
+  uint32_t x;
+  uint32_t y;
+
+  overlay_planes_alloc (&overlay->atlas, OVERLAY_GLYPHS*width, height);
+  overlay_planes_alloc (&overlay->atlas_chroma, OVERLAY_GLYPHS*width/2,
+      height/2);
+
+  for (glyph=0; glyph<OVERLAY_GLYPHS; glyph++){
+    for (y=0; y<height; y++){
+      for (x=0; x<width; x++){
+        int text = overlay_font_pixel (glyph, x, y, scale, margin);
+        int outline = 0;
+        for (dy=-(int)margin; !text && dy<=(int)margin; dy++){
+          for (dx=-(int)margin; dx<=(int)margin; dx++){
+            outline |= overlay_font_pixel (glyph, x + dx, y + dy, scale,
+                margin);
+          }
+        }
+        overlay_pixel (&overlay->atlas, glyph*width + x, y,
+            text ? OVERLAY_WHITE : OVERLAY_BLACK,
+            text || outline ? 255 : OVERLAY_BACKGROUND);
+      }
+    }
+  }
+
+  //The chroma goes to gray with the average alpha of 2x2 pixels
+  overlay_planes_t* luma = &overlay->atlas;
+  for (y=0; y<height/2; y++){
+    for (x=0; x<OVERLAY_GLYPHS*width/2; x++){
+      uint32_t i = 2*y*luma->stride + 2*x;
+      uint32_t alpha = 4*255 - luma->alpha[i] - luma->alpha[i + 1] -
+          luma->alpha[i + luma->stride] - luma->alpha[i + luma->stride + 1];
+      overlay_pixel (&overlay->atlas_chroma, x, y, 128, (alpha + 2)/4);
+    }
+  }
+}
+
+//Copies a glyph of the atlas to a position of the line
+static void overlay_glyph (
+    overlay_planes_t* line,
+    overlay_planes_t* atlas,
+    uint32_t position,
+    uint32_t glyph,
+    uint32_t width,
+    uint32_t height){
+  uint32_t y;
+  for (y=0; y<height; y++){
+    memcpy (line->value + y*line->stride + position*width,
+        atlas->value + y*atlas->stride + glyph*width, width);
+    memcpy (line->alpha + y*line->stride + position*width,
+        atlas->alpha + y*atlas->stride + glyph*width, width);
+  }
+}
+
+//Formats the text, only the characters that change are copied
+static void overlay_update (overlay_t* overlay, time_t now){
+  char text[256];
+  struct tm tm;
+  uint32_t length;
+  uint32_t max = overlay->line.stride/overlay->glyph_width;
+  uint32_t i;
+
+  localtime_r (&now, &tm);
+  length = strftime (text, sizeof (text), overlay->format, &tm);
+  if (length > max) length = max;
+
+  for (i=0; i<length; i++){
+    //Anything else is a space
+    if (text[i] < OVERLAY_FIRST || text[i] >= OVERLAY_FIRST + OVERLAY_GLYPHS){
+      text[i] = ' ';
+    }
+    if (i < overlay->length && text[i] == overlay->text[i]) continue;
+    overlay_glyph (&overlay->line, &overlay->atlas, i,
+        text[i] - OVERLAY_FIRST, overlay->glyph_width, overlay->glyph_height);
+    overlay_glyph (&overlay->line_chroma, &overlay->atlas_chroma, i,
+        text[i] - OVERLAY_FIRST, overlay->glyph_width/2,
+        overlay->glyph_height/2);
+  }
+  memcpy (overlay->text, text, length);
+  overlay->text[length] = 0;
+  overlay->length = length;
+  overlay->second = now;
+  overlay->updates++;
+}
+
+void overlay_init (
+    overlay_t* overlay,
+    const char* format,
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride,
+    uint32_t slice_height){
+  memset (overlay, 0, sizeof (overlay_t));
+  overlay->format = format;
+  overlay->width = width;
+  overlay->height = height;
+  overlay->stride = stride ? stride : width;
+  overlay->slice_height = slice_height ? slice_height : height;
+  overlay->second = -1;
+
+  uint32_t scale = OVERLAY_SCALE*height/1080;
+  if (!scale) scale = 1;
+  overlay->glyph_width = OVERLAY_CELL_WIDTH*scale;
+  overlay->glyph_height = OVERLAY_CELL_HEIGHT*scale;
+  overlay->x = (OVERLAY_X*height/1080) & ~1;
+  overlay->y = (OVERLAY_Y*height/1080) & ~1;
+  overlay_rasterize (overlay, scale);
+
+  //The characters that don't fit in the frame are not shown, and there's no
+  //text if not even one fits
+  uint32_t max = 0;
+  if (overlay->x < width && overlay->y + overlay->glyph_height <= height){
+    max = (width - overlay->x)/overlay->glyph_width;
+  }
+  if (max > OVERLAY_TEXT_MAX) max = OVERLAY_TEXT_MAX;
+  overlay_planes_alloc (&overlay->line, (max ? max : 1)*overlay->glyph_width,
+      overlay->glyph_height);
+  overlay_planes_alloc (&overlay->line_chroma,
+      (max ? max : 1)*overlay->glyph_width/2, overlay->glyph_height/2);
+  if (!max){
+    fprintf (stderr, "warning: the frames are too small for the text\n");
+    overlay->line.stride = 0;
+  }
+}
+
+void overlay_frame (overlay_t* overlay, uint8_t* frame, time_t now){
+  int64_t start = overlay_time ();
+  uint32_t stride = overlay->stride;
+  uint32_t y;
+
+  if (!overlay->line.stride) return;
+  if (now != overlay->second){
+    overlay_update (overlay, now);
+  }
+
+  //Only the rectangle of the text
+  uint32_t width = overlay->length*overlay->glyph_width;
+  uint8_t* luma = frame + overlay->y*stride + overlay->x;
+  for (y=0; y<overlay->glyph_height; y++){
+    overlay_blend (luma + y*stride,
+        overlay->line.value + y*overlay->line.stride,
+        overlay->line.alpha + y*overlay->line.stride, width);
+  }
+  uint8_t* u = frame + stride*overlay->slice_height +
+      overlay->y/2*(stride/2) + overlay->x/2;
+  uint8_t* v = u + (stride/2)*(overlay->slice_height/2);
+  for (y=0; y<overlay->glyph_height/2; y++){
+    uint8_t* value = overlay->line_chroma.value +
+        y*overlay->line_chroma.stride;
+    uint8_t* alpha = overlay->line_chroma.alpha +
+        y*overlay->line_chroma.stride;
+    overlay_blend (u + y*(stride/2), value, alpha, width/2);
+    overlay_blend (v + y*(stride/2), value, alpha, width/2);
+  }
+
+  int64_t time = overlay_time () - start;
+  overlay->frames++;
+  overlay->time_sum += time;
+  if (time > overlay->time_max) overlay->time_max = time;
+}
+
+void overlay_buffer (
+    overlay_t* overlay,
+    uint8_t* data,
+    uint32_t length,
+    int64_t timestamp){
+  struct timespec spec;
+
+  if (length < overlay->stride*overlay->slice_height*3/2){
+    overlay->short_frames++;
+    return;
+  }
+  if (!overlay->epoch_set){
+    clock_gettime (CLOCK_REALTIME, &spec);
+    overlay->epoch = (int64_t)spec.tv_sec*1000000 + spec.tv_nsec/1000 -
+        timestamp;
+    overlay->epoch_set = 1;
+  }
+  overlay_frame (overlay, data, (overlay->epoch + timestamp)/1000000);
+}
+
+int overlay_dump (overlay_t* overlay, char* str, size_t size){
+  return snprintf (str, size, "%u frames, %u text updates, %ux%u pixels, "
+      "avg %.1f us max %lld us per frame (%s), %u short frames without the "
+      "text", overlay->frames,
+      overlay->updates, overlay->length*overlay->glyph_width,
+      overlay->glyph_height,
+      overlay->frames ? (double)overlay->time_sum/overlay->frames : 0,
+      (long long)overlay->time_max,
+#if defined (OVERLAY_NEON)
+      "NEON"
+#elif defined (OVERLAY_SSE2)
+      "SSE2"
+#else
+      "scalar"
+#endif
+      , overlay->short_frames);
+}
+
+void overlay_close (overlay_t* overlay){
+  overlay_planes_free (&overlay->atlas);
+  overlay_planes_free (&overlay->atlas_chroma);
+  overlay_planes_free (&overlay->line);
+  overlay_planes_free (&overlay->line_chroma);
+}
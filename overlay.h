@@ -0,0 +1,108 @@
+#ifndef OVERLAY_H
+#define OVERLAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+Text burned into the frames before they're encoded (-b), e.g. the camera name
+and the date and time for evidence footage. The text is a strftime() format,
+e.g. -b "CAM1 %Y-%m-%d %H:%M:%S", formatted with the local time of every frame.
+
+The video port of the camera (71) is not tunneled: its frames come to the
+encoder loop in a pool of OVERLAY_BUFFERS buffers, the text is blended in place
+and the same buffers are given to the encoder (or the video_splitter of the
+substream), so there's no copy on the ARM. The stills and the preview frames
+don't have the text.
+
+Every glyph of a 5x7 font is rasterized once, with an outline and a dark
+background, into an atlas of premultiplied luma and inverse alpha planes, and
+the chroma planes at half the size. When the text changes (once per second),
+only the glyphs that differ are copied from the atlas into the line, and every
+frame blends only the rectangle of the line, with NEON or SSE2 if available:
+
+  pixel = value + pixel*(255 - alpha)/255
+
+The cost of every frame is measured, it's printed at the end.
+*/
+
+//Buffers of the camera video port, shared with the encoder input port
+#define OVERLAY_BUFFERS 3
+//Size of a pixel of the font at 1080p, it's scaled with the height
+#define OVERLAY_SCALE 4
+//Position of the text, top left corner (pixels at 1080p)
+#define OVERLAY_X 32
+#define OVERLAY_Y 32
+//Maximum characters of the text
+#define OVERLAY_TEXT_MAX 64
+//Luma of the text and the outline (video range), opacity of the background
+#define OVERLAY_WHITE 235
+#define OVERLAY_BLACK 16
+#define OVERLAY_BACKGROUND 96
+
+//Premultiplied value and inverse alpha of a rectangle of pixels
+typedef struct {
+  uint8_t* value;
+  uint8_t* alpha;
+  uint32_t stride;
+} overlay_planes_t;
+
+typedef struct {
+  const char* format;
+  //YUV420 planar frames, the chroma planes follow the luma plane
+  uint32_t width;
+  uint32_t height;
+  uint32_t stride;
+  uint32_t slice_height;
+  //Size of a glyph, luma pixels
+  uint32_t glyph_width;
+  uint32_t glyph_height;
+  //All the glyphs side by side, luma and chroma
+  overlay_planes_t atlas;
+  overlay_planes_t atlas_chroma;
+  //Current text and its pixels
+  char text[OVERLAY_TEXT_MAX + 1];
+  uint32_t length;
+  time_t second;
+  //Wall clock minus the clock of the camera (us), set at the first buffer
+  int64_t epoch;
+  int epoch_set;
+  overlay_planes_t line;
+  overlay_planes_t line_chroma;
+  //Rectangle of the line in the frame, even coordinates
+  uint32_t x;
+  uint32_t y;
+  //Statistics
+  uint32_t frames;
+  uint32_t updates;
+  //Buffers shorter than a frame, given to the encoder without the text
+  uint32_t short_frames;
+  int64_t time_sum;
+  int64_t time_max;
+} overlay_t;
+
+//Rasterizes the atlas for frames of the given size
+void overlay_init (
+    overlay_t* overlay,
+    const char* format,
+    uint32_t width,
+    uint32_t height,
+    uint32_t stride,
+    uint32_t slice_height);
+//Blends the text of the time now into a frame, in place
+void overlay_frame (overlay_t* overlay, uint8_t* frame, time_t now);
+//Blends the text into a buffer of the camera of length bytes, captured at
+//timestamp (us, clock of the camera). The clock of the camera is mapped to the
+//wall clock once, at the first buffer, so the second of the text is the one of
+//the capture. A buffer shorter than a frame is left as it is and counted
+void overlay_buffer (
+    overlay_t* overlay,
+    uint8_t* data,
+    uint32_t length,
+    int64_t timestamp);
+//Prints the statistics in a string
+int overlay_dump (overlay_t* overlay, char* str, size_t size);
+void overlay_close (overlay_t* overlay);
+
+#endif
@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "bits.h"
+#include "nal.h"
+#include "paramsets.h"
+
+//Maximum bytes of a SPS/PPS that are parsed
+#define PARAMSETS_RBSP_SIZE 256
+
+static const uint8_t start_code[] = { 0, 0, 0, 1 };
+
+static void scaling_list_skip (bits_t* bits, int size){
+  int32_t last = 8;
+  int32_t next = 8;
+  int i;
+  for (i=0; i<size && next; i++){
+    next = (last + bits_se (bits) + 256) % 256;
+    if (next) last = next;
+  }
+}
+
+int sps_parse (sps_t* sps, const uint8_t* nal, uint32_t length){
+  uint8_t rbsp[PARAMSETS_RBSP_SIZE];
+  bits_t bits;
+  uint32_t i;
+  uint32_t n;
+
+  if (length < 4) return -1;
+  bits_init (&bits, rbsp, bits_unescape (rbsp, sizeof (rbsp), nal + 1,
+      length - 1));
+
+  memset (sps, 0, sizeof (sps_t));
+  sps->profile_idc = bits_read (&bits, 8);
+  sps->constraints = bits_read (&bits, 8);
+  sps->level_idc = bits_read (&bits, 8);
+  sps->id = bits_ue (&bits);
+  sps->chroma_format_idc = 1;
+  sps->bit_depth_luma = 8;
+  sps->bit_depth_chroma = 8;
+
+  switch (sps->profile_idc){
+    case 100: case 110: case 122: case 244: case 44: case 83: case 86:
+    case 118: case 128: case 138: case 139: case 134: case 135:
+      sps->chroma_format_idc = bits_ue (&bits);
+      if (sps->chroma_format_idc == 3){
+        //separate_colour_plane_flag
+        bits_skip (&bits, 1);
+      }
+      sps->bit_depth_luma = 8 + bits_ue (&bits);
+      sps->bit_depth_chroma = 8 + bits_ue (&bits);
+      //qpprime_y_zero_transform_bypass_flag
+      bits_skip (&bits, 1);
+      if (bits_read (&bits, 1)){
+        n = sps->chroma_format_idc != 3 ? 8 : 12;
+        for (i=0; i<n; i++){
+          if (bits_read (&bits, 1)) scaling_list_skip (&bits, i < 6 ? 16 : 64);
+        }
+      }
+      break;
+  }
+
+  sps->log2_max_frame_num = bits_ue (&bits) + 4;
+  sps->poc_type = bits_ue (&bits);
+  if (sps->poc_type == 0){
+    sps->log2_max_poc_lsb = bits_ue (&bits) + 4;
+  }else if (sps->poc_type == 1){
+    sps->delta_pic_order_always_zero = bits_read (&bits, 1);
+    //offset_for_non_ref_pic, offset_for_top_to_bottom_field
+    bits_se (&bits);
+    bits_se (&bits);
+    n = bits_ue (&bits);
+    for (i=0; i<n && !bits_overrun (&bits); i++){
+      bits_se (&bits);
+    }
+  }
+
+  //max_num_ref_frames, gaps_in_frame_num_value_allowed_flag
+  bits_ue (&bits);
+  bits_skip (&bits, 1);
+  uint32_t width_mbs = bits_ue (&bits) + 1;
+  uint32_t height_map_units = bits_ue (&bits) + 1;
+  sps->frame_mbs_only = bits_read (&bits, 1);
+  if (!sps->frame_mbs_only){
+    //mb_adaptive_frame_field_flag
+    bits_skip (&bits, 1);
+  }
+  //direct_8x8_inference_flag
+  bits_skip (&bits, 1);
+
+  sps->width = width_mbs*16;
+  sps->height = (2 - sps->frame_mbs_only)*height_map_units*16;
+  if (bits_read (&bits, 1)){
+    //Cropping, in chroma samples for 4:2:0 and 4:2:2
+    uint32_t crop_x = sps->chroma_format_idc == 1 ||
+        sps->chroma_format_idc == 2 ? 2 : 1;
+    uint32_t crop_y = (sps->chroma_format_idc == 1 ? 2 : 1)*
+        (2 - sps->frame_mbs_only);
+    uint32_t left = bits_ue (&bits);
+    uint32_t right = bits_ue (&bits);
+    uint32_t top = bits_ue (&bits);
+    uint32_t bottom = bits_ue (&bits);
+    sps->width -= (left + right)*crop_x;
+    sps->height -= (top + bottom)*crop_y;
+  }
+
+  return bits_overrun (&bits) ? -1 : 0;
+}
+
+int pps_parse (pps_t* pps, const uint8_t* nal, uint32_t length){
+  uint8_t rbsp[PARAMSETS_RBSP_SIZE];
+  bits_t bits;
+
+  if (length < 2) return -1;
+  bits_init (&bits, rbsp, bits_unescape (rbsp, sizeof (rbsp), nal + 1,
+      length - 1));
+
+  pps->id = bits_ue (&bits);
+  pps->sps_id = bits_ue (&bits);
+  pps->entropy_coding_mode = bits_read (&bits, 1);
+  pps->bottom_field_pic_order = bits_read (&bits, 1);
+
+  return bits_overrun (&bits) ? -1 : 0;
+}
+
+void paramsets_init (paramsets_t* paramsets){
+  memset (paramsets, 0, sizeof (paramsets_t));
+}
+
+void paramsets_invalidate (paramsets_t* paramsets){
+  paramsets->stale = 1;
+}
+
+//Rebuilds the Annex-B copy with the given NAL units
+static int paramsets_store (
+    paramsets_t* paramsets,
+    const uint8_t* sps,
+    uint32_t sps_length,
+    const uint8_t* pps,
+    uint32_t pps_length){
+  uint8_t data[PARAMSETS_SIZE];
+  uint32_t length = 0;
+
+  if (sps_length + pps_length + 2*sizeof (start_code) > PARAMSETS_SIZE){
+    fprintf (stderr, "error: parameter sets too big\n");
+    return 0;
+  }
+
+  if (sps_length){
+    memcpy (data, start_code, sizeof (start_code));
+    memcpy (data + sizeof (start_code), sps, sps_length);
+    length += sizeof (start_code) + sps_length;
+  }
+  if (pps_length){
+    memcpy (data + length, start_code, sizeof (start_code));
+    memcpy (data + length + sizeof (start_code), pps, pps_length);
+    length += sizeof (start_code) + pps_length;
+  }
+
+  if (length == paramsets->length && !memcmp (data, paramsets->data, length)){
+    return 0;
+  }
+
+  memcpy (paramsets->data, data, length);
+  paramsets->length = length;
+  paramsets->sps_nal = sps_length ? paramsets->data + sizeof (start_code) : 0;
+  paramsets->sps_length = sps_length;
+  paramsets->pps_nal = pps_length
+      ? paramsets->data + length - pps_length
+      : 0;
+  paramsets->pps_length = pps_length;
+  paramsets->complete = sps_length && pps_length;
+  if (paramsets->complete) paramsets->generation++;
+
+  return paramsets->complete;
+}
+
+int paramsets_update (paramsets_t* paramsets, stream_buffer_t* buffer){
+  nal_t nals[4];
+  int n = nal_split (buffer->data, buffer->length, nals, 4);
+  int changed = 0;
+  int i;
+
+  for (i=0; i<n; i++){
+    //The copies are taken before paramsets_store() overwrites the data
+    uint8_t sps[PARAMSETS_SIZE];
+    uint8_t pps[PARAMSETS_SIZE];
+    uint32_t sps_length = paramsets->sps_length;
+    uint32_t pps_length = paramsets->pps_length;
+    if (sps_length) memcpy (sps, paramsets->sps_nal, sps_length);
+    if (pps_length) memcpy (pps, paramsets->pps_nal, pps_length);
+
+    if (nals[i].type == NAL_SPS){
+      sps_t sps_st;
+      if (sps_parse (&sps_st, nals[i].data, nals[i].length) ||
+          nals[i].length > PARAMSETS_SIZE){
+        fprintf (stderr, "error: invalid SPS\n");
+        continue;
+      }
+      //A different SPS starts a new set, the old PPS may not be valid anymore
+      if (paramsets->stale || (paramsets->complete &&
+          (nals[i].length != sps_length ||
+          memcmp (nals[i].data, sps, sps_length)))){
+        pps_length = 0;
+        paramsets->stale = 0;
+      }
+      memcpy (sps, nals[i].data, nals[i].length);
+      sps_length = nals[i].length;
+      paramsets->sps = sps_st;
+    }else if (nals[i].type == NAL_PPS){
+      pps_t pps_st;
+      if (pps_parse (&pps_st, nals[i].data, nals[i].length) ||
+          nals[i].length > PARAMSETS_SIZE){
+        fprintf (stderr, "error: invalid PPS\n");
+        continue;
+      }
+      if (paramsets->stale){
+        sps_length = 0;
+        paramsets->stale = 0;
+      }
+      memcpy (pps, nals[i].data, nals[i].length);
+      pps_length = nals[i].length;
+      paramsets->pps = pps_st;
+    }else{
+      continue;
+    }
+
+    changed |= paramsets_store (paramsets, sps, sps_length, pps, pps_length);
+  }
+
+  if (changed){
+    printf ("parameter sets: profile %u, level %u, %ux%u\n",
+        paramsets->sps.profile_idc, paramsets->sps.level_idc,
+        paramsets->sps.width, paramsets->sps.height);
+  }
+
+  return changed;
+}
@@ -0,0 +1,76 @@
+#ifndef PARAMSETS_H
+#define PARAMSETS_H
+
+#include <stdint.h>
+
+#include "stream.h"
+
+/*
+Cache of the active SPS and PPS. VIDEO_INLINE_HEADERS is disabled, so the
+encoder only produces them once, in the OMX_BUFFERFLAG_CODECCONFIG buffers sent
+before the first frame. The outputs copy the cached parameter sets at the start
+of every file, segment or client, so they can be decoded on their own without
+paying for the inline headers in every IDR frame.
+
+The cache is filled from the codec config buffers and it's refreshed after an
+OMX_EventPortSettingsChanged event: the next codec config buffers replace it.
+*/
+
+//Maximum size of the SPS and PPS, start codes included
+#define PARAMSETS_SIZE 512
+
+typedef struct {
+  uint8_t profile_idc;
+  //constraint_set0_flag .. constraint_set5_flag and reserved_zero_2bits
+  uint8_t constraints;
+  uint8_t level_idc;
+  uint32_t id;
+  uint32_t chroma_format_idc;
+  uint32_t bit_depth_luma;
+  uint32_t bit_depth_chroma;
+  uint32_t log2_max_frame_num;
+  uint32_t poc_type;
+  uint32_t log2_max_poc_lsb;
+  int delta_pic_order_always_zero;
+  int frame_mbs_only;
+  uint32_t width;
+  uint32_t height;
+} sps_t;
+
+typedef struct {
+  uint32_t id;
+  uint32_t sps_id;
+  int entropy_coding_mode;
+  int bottom_field_pic_order;
+} pps_t;
+
+typedef struct {
+  //SPS and PPS in Annex-B format
+  uint8_t data[PARAMSETS_SIZE];
+  uint32_t length;
+  //NAL units inside data, without the start codes
+  uint8_t* sps_nal;
+  uint32_t sps_length;
+  uint8_t* pps_nal;
+  uint32_t pps_length;
+  sps_t sps;
+  pps_t pps;
+  //Both parameter sets are present
+  int complete;
+  //The next parameter sets replace the current ones
+  int stale;
+  //Incremented every time the parameter sets change
+  uint32_t generation;
+} paramsets_t;
+
+void paramsets_init (paramsets_t* paramsets);
+//Called with every codec config buffer. Returns 1 if the cache has changed
+int paramsets_update (paramsets_t* paramsets, stream_buffer_t* buffer);
+//Called when the encoder output port settings change
+void paramsets_invalidate (paramsets_t* paramsets);
+
+//Parse a NAL unit (header included). Return 0 on success
+int sps_parse (sps_t* sps, const uint8_t* nal, uint32_t length);
+int pps_parse (pps_t* pps, const uint8_t* nal, uint32_t length);
+
+#endif
@@ -0,0 +1,218 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "preview.h"
+
+static void preview_invalid (const char* spec){
+  fprintf (stderr, "error: invalid preview: %s\n", spec);
+  exit (1);
+}
+
+void preview_init (preview_t* preview, const char* spec, uint32_t framerate){
+  memset (preview, 0, sizeof (preview_t));
+  preview->width = PREVIEW_WIDTH;
+  preview->height = PREVIEW_HEIGHT;
+  preview->fps = framerate;
+  preview->next = -1;
+
+  //OUTPUT[,option=value]...
+  char* options = strchr (spec, ',');
+  size_t length = options ? (size_t)(options - spec) : strlen (spec);
+  if (!length || !(preview->output = strndup (spec, length))){
+    preview_invalid (spec);
+  }
+
+  //Only the outputs that write the bytes as they are, the others expect H.264
+  const char* output = preview->output;
+  length = strlen (output);
+  if (!strncmp (output, "rtp:", 4) || !strncmp (output, "server:", 7) ||
+      !strncmp (output, "mp4:", 4) || !strncmp (output, "ts:", 3) ||
+      !strncmp (output, "udp:", 4) || !strncmp (output, "segment:", 8) ||
+      !strncmp (output, "shm:", 4) ||
+      (length > 4 && !strcmp (output + length - 4, ".mp4")) ||
+      (length > 3 && !strcmp (output + length - 3, ".ts"))){
+    fprintf (stderr, "error: invalid preview output: %s\n", output);
+    exit (1);
+  }
+
+  while (options){
+    options++;
+    if (sscanf (options, "size=%ux%u", &preview->width, &preview->height) != 2
+        && sscanf (options, "fps=%u", &preview->fps) != 1){
+      preview_invalid (spec);
+    }
+    options = strchr (options, ',');
+  }
+  if (!preview->width || preview->width % 32 || !preview->height ||
+      preview->height % 16 || !preview->fps || preview->fps > framerate){
+    preview_invalid (spec);
+  }
+  preview->interval = 1000000/preview->fps;
+  preview->tolerance = 1000000/framerate/2;
+}
+
+void preview_open (preview_t* preview){
+  preview->sink = sink_open (preview->output);
+}
+
+void preview_frame (preview_t* preview, stream_buffer_t* buffer){
+  if (!buffer->length) return;
+  if (buffer->length != preview->width*preview->height*3/2){
+    //A partial frame, the size of the port doesn't match
+    preview->invalid++;
+    return;
+  }
+
+  //Every frame is written unless it comes before the next one is due. The
+  //tolerance keeps the jitter of the camera from skipping the frames that are
+  //on time
+  if (preview->next >= 0 &&
+      buffer->timestamp < preview->next - preview->tolerance){
+    preview->skipped++;
+    return;
+  }
+  if (preview->next < 0 || buffer->timestamp - preview->next >
+      preview->interval){
+    preview->next = buffer->timestamp;
+  }
+  preview->next += preview->interval;
+
+  //Every frame can be decoded on its own, the sink drops whole frames
+  stream_buffer_t frame = *buffer;
+  frame.flags = STREAM_FLAG_ENDOFFRAME | STREAM_FLAG_SYNCFRAME;
+  sink_write (preview->sink, &frame);
+  preview->frames++;
+}
+
+int preview_dump (preview_t* preview, char* str, size_t size){
+  return snprintf (str, size, "%ux%u at %u fps, frames %u, skipped %u, "
+      "invalid %u, dropped by the output %u", preview->width, preview->height,
+      preview->fps, preview->frames, preview->skipped, preview->invalid,
+      preview->sink ? preview->sink->dropped_frames : 0);
+}
+
+void preview_close (preview_t* preview){
+  if (preview->sink){
+    sink_close (preview->sink);
+    preview->sink = 0;
+  }
+  free (preview->output);
+  preview->output = 0;
+}
+
+static void preview_scale_plane (const uint8_t* src, uint32_t src_width,
+    uint32_t src_height, uint8_t* dst, uint32_t width, uint32_t height){
+  uint32_t x, y, i, j;
+
+  for (y=0; y<height; y++){
+    uint32_t top = (uint64_t)y*src_height/height;
+    uint32_t bottom = (uint64_t)(y + 1)*src_height/height;
+    if (bottom == top) bottom++;
+    for (x=0; x<width; x++){
+      uint32_t left = (uint64_t)x*src_width/width;
+      uint32_t right = (uint64_t)(x + 1)*src_width/width;
+      uint32_t sum = 0;
+      if (right == left) right++;
+      for (j=top; j<bottom; j++){
+        for (i=left; i<right; i++) sum += src[j*src_width + i];
+      }
+      uint32_t n = (bottom - top)*(right - left);
+      dst[y*width + x] = (sum + n/2)/n;
+    }
+  }
+}
+
+void preview_scale (const uint8_t* src, uint32_t src_width,
+    uint32_t src_height, uint8_t* dst, uint32_t width, uint32_t height){
+  const uint8_t* src_u = src + src_width*src_height;
+  const uint8_t* src_v = src_u + src_width*src_height/4;
+  uint8_t* u = dst + width*height;
+  uint8_t* v = u + width*height/4;
+
+  preview_scale_plane (src, src_width, src_height, dst, width, height);
+  preview_scale_plane (src_u, src_width/2, src_height/2, u, width/2,
+      height/2);
+  preview_scale_plane (src_v, src_width/2, src_height/2, v, width/2,
+      height/2);
+}
+
+void preview_standin_init (preview_standin_t* standin, uint32_t camera_width,
+    uint32_t camera_height, uint32_t width, uint32_t height,
+    uint32_t framerate){
+  int i;
+
+  memset (standin, 0, sizeof (preview_standin_t));
+  standin->camera_width = camera_width;
+  standin->camera_height = camera_height;
+  standin->width = width;
+  standin->height = height;
+  standin->framerate = framerate;
+  if (!(standin->camera = malloc (camera_width*camera_height*3/2))){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+  for (i=0; i<PREVIEW_BUFFERS; i++){
+    if (!(standin->buffers[i].data = malloc (width*height*3/2))){
+      fprintf (stderr, "error: malloc\n");
+      exit (1);
+    }
+  }
+}
+
+//A gradient that moves with every frame
+static void preview_standin_draw (preview_standin_t* standin){
+  uint32_t width = standin->camera_width;
+  uint32_t height = standin->camera_height;
+  uint32_t frame = standin->frame;
+  uint8_t* y = standin->camera;
+  uint8_t* u = y + width*height;
+  uint8_t* v = u + width*height/4;
+  uint32_t i, j;
+
+  for (j=0; j<height; j++){
+    for (i=0; i<width; i++) y[j*width + i] = i + 2*j + 3*frame;
+  }
+  for (j=0; j<height/2; j++){
+    for (i=0; i<width/2; i++){
+      u[j*width/2 + i] = 2*i + frame;
+      v[j*width/2 + i] = 2*j + frame;
+    }
+  }
+}
+
+stream_buffer_t* preview_standin_fill (preview_standin_t* standin){
+  int64_t timestamp = (int64_t)standin->frame*1000000/standin->framerate;
+  int i;
+
+  for (i=0; i<PREVIEW_BUFFERS && standin->held[i]; i++);
+  if (i == PREVIEW_BUFFERS){
+    standin->frame++;
+    return 0;
+  }
+
+  stream_buffer_t* buffer = &standin->buffers[i];
+  preview_standin_draw (standin);
+  preview_scale (standin->camera, standin->camera_width,
+      standin->camera_height, buffer->data, standin->width, standin->height);
+  buffer->length = standin->width*standin->height*3/2;
+  buffer->timestamp = timestamp;
+  buffer->flags = STREAM_FLAG_ENDOFFRAME;
+  standin->held[i] = 1;
+  standin->frame++;
+  return buffer;
+}
+
+void preview_standin_release (preview_standin_t* standin,
+    stream_buffer_t* buffer){
+  standin->held[buffer - standin->buffers] = 0;
+}
+
+void preview_standin_close (preview_standin_t* standin){
+  int i;
+
+  free (standin->camera);
+  for (i=0; i<PREVIEW_BUFFERS; i++) free (standin->buffers[i].data);
+}
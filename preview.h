@@ -0,0 +1,98 @@
+#ifndef PREVIEW_H
+#define PREVIEW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "sink.h"
+#include "stream.h"
+
+/*
+Small raw frames for analytics (-p). The preview port of the camera (70) is
+tunneled to OMX.broadcom.resize instead of the null_sink, so the GPU scales the
+frames down and the ARM only sees small I420 (YUV420 planar) frames. The
+preview still runs the AGC and AWB algorithms.
+
+The frames come back in a small pool of resize output buffers that the encoder
+loop gives back as soon as the frame has been handed to the output, so the
+resize component never waits for the application. The frame rate is lowered by
+skipping frames before they're written, by their timestamps.
+
+The output is a plain sink (file, stdout, named pipe, TCP or Unix socket, see
+sink.h) that receives one frame after another, width*height*3/2 bytes each.
+Like the video, a slow reader loses whole frames. The width must be a multiple
+of 32 and the height a multiple of 16, so the frames have no padding.
+
+Output specification:
+
+  -p OUTPUT[,size=WIDTHxHEIGHT][,fps=N]
+
+The stand-in below takes the place of the camera and the resize component on
+any machine: it draws camera frames and scales them down on the CPU (a box
+filter, every pixel is the average of the area it covers) into its own pool of
+PREVIEW_BUFFERS buffers, so preview_frame() and the outputs can be checked
+without a camera.
+*/
+
+#define PREVIEW_WIDTH 320
+#define PREVIEW_HEIGHT 240
+//Resize output buffers
+#define PREVIEW_BUFFERS 3
+
+typedef struct {
+  char* output;
+  uint32_t width;
+  uint32_t height;
+  uint32_t fps;
+  //Distance between two frames (us) and timestamp of the next one, -1 if none
+  int64_t interval;
+  int64_t next;
+  //Half the frame interval of the camera (us)
+  int64_t tolerance;
+  sink_t* sink;
+  //Statistics
+  uint32_t frames;
+  uint32_t skipped;
+  uint32_t invalid;
+} preview_t;
+
+//Parses the -p option, framerate is the frame rate of the camera
+void preview_init (preview_t* preview, const char* spec, uint32_t framerate);
+//Opens the output. Called with the other outputs, before printing anything
+void preview_open (preview_t* preview);
+//Called for every filled resize output buffer
+void preview_frame (preview_t* preview, stream_buffer_t* buffer);
+//Prints the statistics in a string
+int preview_dump (preview_t* preview, char* str, size_t size);
+void preview_close (preview_t* preview);
+
+typedef struct {
+  //Size of the camera frames and of the scaled frames
+  uint32_t camera_width;
+  uint32_t camera_height;
+  uint32_t width;
+  uint32_t height;
+  uint32_t framerate;
+  uint8_t* camera;
+  stream_buffer_t buffers[PREVIEW_BUFFERS];
+  //The buffers that the application holds
+  int held[PREVIEW_BUFFERS];
+  uint32_t frame;
+} preview_standin_t;
+
+//Scales an I420 frame down, the sizes must be even
+void preview_scale (const uint8_t* src, uint32_t src_width,
+    uint32_t src_height, uint8_t* dst, uint32_t width, uint32_t height);
+void preview_standin_init (preview_standin_t* standin, uint32_t camera_width,
+    uint32_t camera_height, uint32_t width, uint32_t height,
+    uint32_t framerate);
+//Captures and scales the next frame into a free buffer. The frames come at the
+//frame rate of the camera (timestamps), a frame is lost if every buffer is
+//held by the application: returns null and the frame is skipped
+stream_buffer_t* preview_standin_fill (preview_standin_t* standin);
+//Gives a buffer back to the pool
+void preview_standin_release (preview_standin_t* standin,
+    stream_buffer_t* buffer);
+void preview_standin_close (preview_standin_t* standin);
+
+#endif
@@ -0,0 +1,468 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "recorder.h"
+
+#define RECORDER_WIDTH 1920
+#define RECORDER_HEIGHT 1080
+#define RECORDER_FRAMERATE 30
+#define RECORDER_BITRATE 17000000
+#define RECORDER_PROFILE 100
+#define RECORDER_BUFFERS 3
+
+typedef enum {
+  //Components loaded
+  RECORDER_STATE_OPEN,
+  //Idle, with the ports enabled and the buffers allocated
+  RECORDER_STATE_CONFIGURED,
+  RECORDER_STATE_RECORDING
+} recorder_state_t;
+
+struct recorder_s {
+  recorder_state_t state;
+  recorder_pipeline_t pipeline;
+  recorder_config_t config;
+  recorder_callback_t callback;
+  void* arg;
+  recorder_frame_t frames[RECORDER_BUFFERS_MAX];
+  int buffers_length;
+  //Filled buffers waiting for the thread of the callback, and frames given to
+  //the callback that haven't been released yet. Protected by the mutex
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  recorder_frame_t* queue[RECORDER_BUFFERS_MAX];
+  int queue_head;
+  int queue_length;
+  int outstanding;
+  int stopping;
+  //Error of a component while recording, protected by the mutex
+  int failed;
+  char failure[128];
+  pthread_t thread;
+  char error[128];
+};
+
+int recorder_set_error (
+    recorder_t* recorder,
+    int result,
+    const char* format,
+    ...){
+  va_list args;
+
+  va_start (args, format);
+  vsnprintf (recorder->error, sizeof (recorder->error), format, args);
+  va_end (args);
+  return result;
+}
+
+void recorder_filled (recorder_t* recorder, recorder_frame_t* frame){
+  pthread_mutex_lock (&recorder->mutex);
+  //There are never more filled buffers than allocated ones
+  recorder->queue[(recorder->queue_head + recorder->queue_length++) %
+      RECORDER_BUFFERS_MAX] = frame;
+  pthread_cond_broadcast (&recorder->cond);
+  pthread_mutex_unlock (&recorder->mutex);
+}
+
+void recorder_failed (recorder_t* recorder, const char* format, ...){
+  va_list args;
+
+  pthread_mutex_lock (&recorder->mutex);
+  //The errors of the other calls are returned by the calls themselves
+  if (recorder->state == RECORDER_STATE_RECORDING && !recorder->stopping &&
+      !recorder->failed){
+    recorder->failed = 1;
+    va_start (args, format);
+    vsnprintf (recorder->failure, sizeof (recorder->failure), format, args);
+    va_end (args);
+  }
+  pthread_mutex_unlock (&recorder->mutex);
+}
+
+//Returns the error of a component while recording, if any
+static int recorder_check_failure (recorder_t* recorder){
+  int result = RECORDER_OK;
+
+  pthread_mutex_lock (&recorder->mutex);
+  if (recorder->failed){
+    result = recorder_set_error (recorder, RECORDER_ERROR_OMX, "%s",
+        recorder->failure);
+  }
+  pthread_mutex_unlock (&recorder->mutex);
+  return result;
+}
+
+//Undoes recorder_configure(), as far as it went. The errors are ignored, the
+//first one is kept in recorder->error
+static void recorder_unconfigure (recorder_t* recorder){
+  char error[sizeof (recorder->error)];
+
+  memcpy (error, recorder->error, sizeof (error));
+  recorder->pipeline.unconfigure (&recorder->pipeline);
+  if (error[0]) memcpy (recorder->error, error, sizeof (error));
+  recorder->state = RECORDER_STATE_OPEN;
+}
+
+//Thread of the callback
+static void* recorder_deliver (void* arg){
+  recorder_t* recorder = arg;
+  recorder_frame_t* frame;
+
+  pthread_mutex_lock (&recorder->mutex);
+  while (1){
+    while (!recorder->queue_length && !recorder->stopping){
+      pthread_cond_wait (&recorder->cond, &recorder->mutex);
+    }
+    if (recorder->stopping) break;
+    frame = recorder->queue[recorder->queue_head];
+    recorder->queue_head = (recorder->queue_head + 1) % RECORDER_BUFFERS_MAX;
+    recorder->queue_length--;
+    recorder->outstanding++;
+    pthread_mutex_unlock (&recorder->mutex);
+
+    if (frame->buffer.length){
+      recorder->callback (recorder, frame, recorder->arg);
+    }else{
+      recorder_release (recorder, frame);
+    }
+
+    pthread_mutex_lock (&recorder->mutex);
+  }
+  pthread_mutex_unlock (&recorder->mutex);
+
+  return 0;
+}
+
+void recorder_config_init (recorder_config_t* config){
+  memset (config, 0, sizeof (recorder_config_t));
+  config->width = RECORDER_WIDTH;
+  config->height = RECORDER_HEIGHT;
+  config->framerate = RECORDER_FRAMERATE;
+  config->bitrate = RECORDER_BITRATE;
+  config->profile = RECORDER_PROFILE;
+  config->buffers = RECORDER_BUFFERS;
+}
+
+int recorder_open_pipeline (
+    recorder_t** recorder_ptr,
+    const recorder_pipeline_t* pipeline,
+    uint32_t device){
+  recorder_t* recorder = calloc (1, sizeof (recorder_t));
+  *recorder_ptr = recorder;
+  if (!recorder) return RECORDER_ERROR_MEMORY;
+  recorder->state = RECORDER_STATE_OPEN;
+  pthread_mutex_init (&recorder->mutex, 0);
+  pthread_cond_init (&recorder->cond, 0);
+  recorder->pipeline = *pipeline;
+  recorder->pipeline.recorder = recorder;
+
+  return recorder->pipeline.open (&recorder->pipeline, device);
+}
+
+int recorder_configure (
+    recorder_t* recorder,
+    const recorder_config_t* config,
+    recorder_callback_t callback,
+    void* arg){
+  int result;
+
+  if (recorder->state == RECORDER_STATE_RECORDING){
+    return recorder_set_error (recorder, RECORDER_ERROR_STATE,
+        "configure while recording");
+  }
+  if (!callback || !config->width || !config->height ||
+      config->width > 1920 || config->height > 1080 ||
+      !config->framerate || config->framerate > 90 || !config->bitrate ||
+      config->bitrate > 25000000 || (config->profile != 66 &&
+      config->profile != 77 && config->profile != 100)){
+    return recorder_set_error (recorder, RECORDER_ERROR_INVALID,
+        "invalid configuration");
+  }
+  if (recorder->state == RECORDER_STATE_CONFIGURED){
+    recorder_unconfigure (recorder);
+  }
+  recorder->error[0] = 0;
+  recorder->config = *config;
+  recorder->callback = callback;
+  recorder->arg = arg;
+
+  recorder->buffers_length = 0;
+  if ((result = recorder->pipeline.configure (&recorder->pipeline, config,
+      recorder->frames, &recorder->buffers_length))){
+    recorder_unconfigure (recorder);
+    return result;
+  }
+  recorder->state = RECORDER_STATE_CONFIGURED;
+  return RECORDER_OK;
+}
+
+int recorder_start (recorder_t* recorder){
+  recorder_pipeline_t* pipeline = &recorder->pipeline;
+  int result;
+  int i;
+
+  if (recorder->state != RECORDER_STATE_CONFIGURED){
+    return recorder_set_error (recorder, RECORDER_ERROR_STATE,
+        recorder->state == RECORDER_STATE_OPEN ? "start before configure" :
+        "already recording");
+  }
+
+  //The buffers returned by the last stop are owned by the encoder again
+  recorder->queue_head = 0;
+  recorder->queue_length = 0;
+  recorder->outstanding = 0;
+  recorder->stopping = 0;
+  recorder->failed = 0;
+  if ((result = pipeline->execute (pipeline))){
+    pipeline->idle (pipeline);
+    return result;
+  }
+  if (pthread_create (&recorder->thread, 0, recorder_deliver, recorder)){
+    pipeline->idle (pipeline);
+    return recorder_set_error (recorder, RECORDER_ERROR_MEMORY,
+        "pthread_create");
+  }
+  pthread_mutex_lock (&recorder->mutex);
+  recorder->state = RECORDER_STATE_RECORDING;
+  pthread_mutex_unlock (&recorder->mutex);
+
+  for (i=0; i<recorder->buffers_length; i++){
+    if ((result = pipeline->fill (pipeline, recorder->frames[i].header))){
+      break;
+    }
+  }
+  if (result || (result = pipeline->capture (pipeline, 1))){
+    //The error of the call is returned, not the one of the stop
+    char error[sizeof (recorder->error)];
+    memcpy (error, recorder->error, sizeof (error));
+    recorder_stop (recorder);
+    memcpy (recorder->error, error, sizeof (error));
+    return result;
+  }
+
+  return RECORDER_OK;
+}
+
+int recorder_release (recorder_t* recorder, recorder_frame_t* frame){
+  pthread_mutex_lock (&recorder->mutex);
+  recorder->outstanding--;
+  if (recorder->stopping){
+    //recorder_stop() is waiting for the last frames
+    pthread_cond_broadcast (&recorder->cond);
+    pthread_mutex_unlock (&recorder->mutex);
+    return RECORDER_OK;
+  }
+  pthread_mutex_unlock (&recorder->mutex);
+
+  //The frames have stopped, the buffer stays with the recorder
+  int result = recorder_check_failure (recorder);
+  if (result) return result;
+  return recorder->pipeline.fill (&recorder->pipeline, frame->header);
+}
+
+int recorder_stop (recorder_t* recorder){
+  recorder_pipeline_t* pipeline = &recorder->pipeline;
+  int result;
+
+  if (recorder->state != RECORDER_STATE_RECORDING){
+    return recorder_set_error (recorder, RECORDER_ERROR_STATE,
+        "not recording");
+  }
+  if (pthread_equal (pthread_self (), recorder->thread)){
+    return recorder_set_error (recorder, RECORDER_ERROR_STATE,
+        "stop from the callback");
+  }
+
+  //Even if the capture cannot be stopped, the recorder is stopped
+  int capture = pipeline->capture (pipeline, 0);
+
+  pthread_mutex_lock (&recorder->mutex);
+  recorder->stopping = 1;
+  pthread_cond_broadcast (&recorder->cond);
+  pthread_mutex_unlock (&recorder->mutex);
+  pthread_join (recorder->thread, 0);
+
+  pthread_mutex_lock (&recorder->mutex);
+  while (recorder->outstanding){
+    pthread_cond_wait (&recorder->cond, &recorder->mutex);
+  }
+  recorder->state = RECORDER_STATE_CONFIGURED;
+  pthread_mutex_unlock (&recorder->mutex);
+
+  //The encoder returns the buffers it has, they're ignored. The error of a
+  //component while recording comes first
+  result = pipeline->idle (pipeline);
+  if (recorder->failed){
+    return recorder_set_error (recorder, RECORDER_ERROR_OMX, "%s",
+        recorder->failure);
+  }
+  return result ? result : capture;
+}
+
+void recorder_close (recorder_t* recorder){
+  if (!recorder) return;
+
+  if (recorder->state == RECORDER_STATE_RECORDING){
+    recorder_stop (recorder);
+  }
+  if (recorder->state == RECORDER_STATE_CONFIGURED){
+    recorder_unconfigure (recorder);
+  }
+  recorder->pipeline.close (&recorder->pipeline);
+
+  pthread_cond_destroy (&recorder->cond);
+  pthread_mutex_destroy (&recorder->mutex);
+  free (recorder);
+}
+
+const char* recorder_error (recorder_t* recorder){
+  if (!recorder) return "calloc";
+  return recorder->error;
+}
+
+//The stand-in logs the call, and fails it if it's the one to fail
+static int recorder_standin_call (recorder_pipeline_t* pipeline,
+    const char* call){
+  recorder_standin_t* standin = pipeline->data;
+  size_t length = strlen (standin->calls);
+
+  snprintf (standin->calls + length, sizeof (standin->calls) - length,
+      "%s%s", length ? " " : "", call);
+  if (standin->fail && !strcmp (standin->fail, call)){
+    return recorder_set_error (pipeline->recorder, RECORDER_ERROR_OMX,
+        "%s: OMX_ErrorHardware", call);
+  }
+  return RECORDER_OK;
+}
+
+static int recorder_standin_open (
+    recorder_pipeline_t* pipeline,
+    uint32_t device){
+  recorder_standin_t* standin = pipeline->data;
+  standin->recorder = pipeline->recorder;
+  return recorder_standin_call (pipeline, "open");
+}
+
+static int recorder_standin_configure (
+    recorder_pipeline_t* pipeline,
+    const recorder_config_t* config,
+    recorder_frame_t* frames,
+    int* length){
+  recorder_standin_t* standin = pipeline->data;
+  int result;
+  int i;
+
+  if ((result = recorder_standin_call (pipeline, "configure"))) return result;
+  standin->state = 1;
+  standin->frames = frames;
+  standin->length = config->buffers;
+  for (i=0; i<standin->length; i++) frames[i].header = standin->data[i];
+  *length = standin->length;
+  return RECORDER_OK;
+}
+
+static void recorder_standin_unconfigure (recorder_pipeline_t* pipeline){
+  recorder_standin_t* standin = pipeline->data;
+  recorder_standin_call (pipeline, "unconfigure");
+  standin->state = 0;
+  standin->frames = 0;
+  standin->length = 0;
+}
+
+static int recorder_standin_execute (recorder_pipeline_t* pipeline){
+  recorder_standin_t* standin = pipeline->data;
+  int result;
+
+  if ((result = recorder_standin_call (pipeline, "execute"))) return result;
+  standin->state = 2;
+  return RECORDER_OK;
+}
+
+//The encoder gives back the buffers it owns, they're ignored
+static int recorder_standin_idle (recorder_pipeline_t* pipeline){
+  recorder_standin_t* standin = pipeline->data;
+  int result;
+
+  if ((result = recorder_standin_call (pipeline, "idle"))) return result;
+  pthread_mutex_lock (&standin->mutex);
+  standin->state = 1;
+  standin->owned_length = 0;
+  pthread_mutex_unlock (&standin->mutex);
+  return RECORDER_OK;
+}
+
+static int recorder_standin_fill_buffer (
+    recorder_pipeline_t* pipeline,
+    void* header){
+  recorder_standin_t* standin = pipeline->data;
+
+  pthread_mutex_lock (&standin->mutex);
+  standin->owned[standin->owned_length++] = header;
+  pthread_mutex_unlock (&standin->mutex);
+  return RECORDER_OK;
+}
+
+static int recorder_standin_capture (
+    recorder_pipeline_t* pipeline,
+    int enabled){
+  recorder_standin_t* standin = pipeline->data;
+  int result;
+
+  if ((result = recorder_standin_call (pipeline, enabled ? "capture" :
+      "nocapture"))){
+    return result;
+  }
+  standin->capturing = enabled;
+  return RECORDER_OK;
+}
+
+static void recorder_standin_close (recorder_pipeline_t* pipeline){
+  recorder_standin_t* standin = pipeline->data;
+  recorder_standin_call (pipeline, "close");
+  pthread_mutex_destroy (&standin->mutex);
+}
+
+void recorder_standin_init (
+    recorder_pipeline_t* pipeline,
+    recorder_standin_t* standin){
+  memset (standin, 0, sizeof (recorder_standin_t));
+  pthread_mutex_init (&standin->mutex, 0);
+  pipeline->open = recorder_standin_open;
+  pipeline->configure = recorder_standin_configure;
+  pipeline->unconfigure = recorder_standin_unconfigure;
+  pipeline->execute = recorder_standin_execute;
+  pipeline->idle = recorder_standin_idle;
+  pipeline->fill = recorder_standin_fill_buffer;
+  pipeline->capture = recorder_standin_capture;
+  pipeline->close = recorder_standin_close;
+  pipeline->recorder = 0;
+  pipeline->data = standin;
+}
+
+int recorder_standin_fill (recorder_standin_t* standin, uint32_t length){
+  recorder_frame_t* frame;
+  uint8_t* data;
+
+  pthread_mutex_lock (&standin->mutex);
+  if (standin->state != 2 || !standin->owned_length){
+    pthread_mutex_unlock (&standin->mutex);
+    return 0;
+  }
+  data = standin->owned[0];
+  memmove (standin->owned, standin->owned + 1,
+      --standin->owned_length*sizeof (void*));
+  pthread_mutex_unlock (&standin->mutex);
+
+  frame = &standin->frames[(data - standin->data[0])/sizeof (standin->data[0])];
+  memset (data, standin->timestamp & 0xFF, sizeof (standin->data[0]));
+  frame->buffer.data = data;
+  frame->buffer.length = length < sizeof (standin->data[0]) ? length :
+      sizeof (standin->data[0]);
+  frame->buffer.timestamp = standin->timestamp;
+  frame->buffer.flags = STREAM_FLAG_ENDOFFRAME;
+  standin->timestamp += 33333;
+  recorder_filled (standin->recorder, frame);
+  return 1;
+}
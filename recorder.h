@@ -0,0 +1,198 @@
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "stream.h"
+
+/*
+Recorder library (librecorder.a), for the programs that want the H.264 stream
+of a camera in their own process instead of running h264 and reading its
+output. It's a camera -> encoder pipeline like the one of h264, without the
+outputs: the encoded buffers are given to a callback as they are, without any
+copy, and they're given back to the encoder with recorder_release(). Nothing
+is printed and nothing exits, every call returns RECORDER_OK or an error, and
+recorder_error() describes the last one:
+
+  recorder_t* recorder;
+  recorder_config_t config;
+  recorder_config_init (&config);
+  config.bitrate = 4000000;
+  if (recorder_open (&recorder, 0) ||
+      recorder_configure (recorder, &config, on_frame, arg) ||
+      recorder_start (recorder)) ...recorder_error (recorder)
+  ...
+  recorder_stop (recorder);
+  recorder_close (recorder);
+
+The callback runs in a thread of the recorder, one buffer at a time. It can
+release the frame before returning or keep it and release it later from any
+thread, but the encoder stops when it has no buffers left, so config.buffers
+must be bigger than the number of frames that are kept at the same time. A
+frame is a buffer of the encoder: a frame can span several buffers, the last
+one has STREAM_FLAG_ENDOFFRAME, and the SPS/PPS come in their own buffers with
+STREAM_FLAG_CODECCONFIG.
+
+recorder_stop() waits until all the frames have been released, so it must not
+be called from the callback or while the frames are kept by the thread that
+calls it. A recorder can be started and stopped several times, and configured
+again while it's stopped. Several recorders can be open at the same time, one
+per camera.
+
+An error of the firmware while recording (OMX_EventError of a component) stops
+the frames. It's kept by the recorder and returned, RECORDER_ERROR_OMX, by the
+next recorder_release() and by recorder_stop(), and recorder_error() names the
+component and the error. After the stop the recorder can be started or
+configured again.
+
+The recorder drives a recorder_pipeline_t: the camera -> video_encode ->
+buffers pipeline of OpenMAX IL (recorder_omx.c, recorder_open()), or the
+stand-in at the end of this file, a pipeline without camera driven by the
+host tests (test/recorder_test.c).
+*/
+
+//Maximum number of encoder output buffers
+#define RECORDER_BUFFERS_MAX 16
+
+typedef enum {
+  RECORDER_OK,
+  //The call is not valid in the current state, e.g. start before configure
+  RECORDER_ERROR_STATE,
+  //Invalid configuration
+  RECORDER_ERROR_INVALID,
+  RECORDER_ERROR_MEMORY,
+  //The firmware or OpenMAX IL failed
+  RECORDER_ERROR_OMX
+} recorder_result_t;
+
+typedef struct {
+  uint32_t width;
+  uint32_t height;
+  //Frames per second
+  uint32_t framerate;
+  //Bits per second
+  uint32_t bitrate;
+  //Frames between IDR frames, 0 means only the first one
+  uint32_t idr_period;
+  //profile_idc: 66 (baseline), 77 (main) or 100 (high)
+  uint32_t profile;
+  //Repeat the SPS/PPS before every IDR frame
+  int inline_headers;
+  //Encoder output buffers
+  uint32_t buffers;
+} recorder_config_t;
+
+typedef struct {
+  //Points to the encoder output buffer, valid until it's released
+  stream_buffer_t buffer;
+  //Used by recorder_release()
+  void* header;
+} recorder_frame_t;
+
+typedef struct recorder_s recorder_t;
+
+typedef void (*recorder_callback_t) (
+    recorder_t* recorder,
+    recorder_frame_t* frame,
+    void* arg);
+
+//1080p, 30 fps, 17 Mbps, high profile, 3 buffers
+void recorder_config_init (recorder_config_t* config);
+//Loads the components and the drivers of the camera device. recorder is set
+//even on error, so recorder_error() can be used, and it must be closed
+int recorder_open (recorder_t** recorder, uint32_t device);
+//Configures the camera and the encoder, and allocates the buffers. The
+//callback is called with every encoded buffer while recording
+int recorder_configure (
+    recorder_t* recorder,
+    const recorder_config_t* config,
+    recorder_callback_t callback,
+    void* arg);
+int recorder_start (recorder_t* recorder);
+//Gives a frame back to the encoder
+int recorder_release (recorder_t* recorder, recorder_frame_t* frame);
+//Stops the capture, waits until all the frames have been released
+int recorder_stop (recorder_t* recorder);
+//Stops the recorder if needed and releases everything
+void recorder_close (recorder_t* recorder);
+//Describes the last error
+const char* recorder_error (recorder_t* recorder);
+
+//Pipeline of a recorder. The calls return RECORDER_OK or an error described
+//with recorder_set_error(). The encoder output buffers are frames[i].header,
+//the pipeline gives a filled one to recorder_filled() and an asynchronous
+//error to recorder_failed(), from any thread
+typedef struct recorder_pipeline_s {
+  //Loads the components and the drivers of the camera
+  int (*open) (struct recorder_pipeline_s* pipeline, uint32_t device);
+  //Configures the components, allocates the buffers (*length, at most
+  //RECORDER_BUFFERS_MAX) and sets their headers in frames, in state idle
+  int (*configure) (
+      struct recorder_pipeline_s* pipeline,
+      const recorder_config_t* config,
+      recorder_frame_t* frames,
+      int* length);
+  //Undoes configure(), as far as it went
+  void (*unconfigure) (struct recorder_pipeline_s* pipeline);
+  //Executing and idle states
+  int (*execute) (struct recorder_pipeline_s* pipeline);
+  int (*idle) (struct recorder_pipeline_s* pipeline);
+  //Gives a buffer to the encoder
+  int (*fill) (struct recorder_pipeline_s* pipeline, void* header);
+  //Starts or stops the capture of the camera
+  int (*capture) (struct recorder_pipeline_s* pipeline, int enabled);
+  //Releases everything, even after a failed open()
+  void (*close) (struct recorder_pipeline_s* pipeline);
+  recorder_t* recorder;
+  void* data;
+} recorder_pipeline_t;
+
+//Opens a recorder with a pipeline (copied), recorder_open() opens the one of
+//OpenMAX IL
+int recorder_open_pipeline (
+    recorder_t** recorder,
+    const recorder_pipeline_t* pipeline,
+    uint32_t device);
+//Pipeline: sets the error and returns result
+int recorder_set_error (
+    recorder_t* recorder,
+    int result,
+    const char* format,
+    ...) __attribute__ ((format (printf, 3, 4)));
+//Pipeline: an encoder output buffer has been filled
+void recorder_filled (recorder_t* recorder, recorder_frame_t* frame);
+//Pipeline: a component failed while recording, the first error is kept
+void recorder_failed (recorder_t* recorder, const char* format, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+//Stand-in pipeline: an encoder without camera that fills the buffers it owns
+//when the test asks for it. The calls are logged, and the one named fail
+//(e.g. "configure") fails
+typedef struct {
+  recorder_t* recorder;
+  pthread_mutex_t mutex;
+  //0 loaded, 1 idle, 2 executing
+  int state;
+  int capturing;
+  uint8_t data[RECORDER_BUFFERS_MAX][64];
+  recorder_frame_t* frames;
+  int length;
+  //Buffers owned by the encoder, in the order they were given
+  void* owned[RECORDER_BUFFERS_MAX];
+  int owned_length;
+  int64_t timestamp;
+  //The calls but fill, e.g. "configure execute capture"
+  char calls[256];
+  const char* fail;
+} recorder_standin_t;
+
+//Sets up the pipeline of the stand-in, to open with recorder_open_pipeline()
+void recorder_standin_init (
+    recorder_pipeline_t* pipeline,
+    recorder_standin_t* standin);
+//Fills the oldest buffer owned by the encoder with a frame of length bytes
+//and gives it to the recorder. Returns 0 if the encoder has no buffer
+int recorder_standin_fill (recorder_standin_t* standin, uint32_t length);
+
+#endif
@@ -0,0 +1,445 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <bcm_host.h>
+#include <interface/vcos/vcos.h>
+#include <IL/OMX_Broadcom.h>
+
+#include "component.h"
+#include "dump.h"
+#include "recorder.h"
+
+//Pipeline of the recorder (see recorder.h): camera (video) -> video_encode,
+//camera (preview) -> null_sink, the preview port runs the AGC and AWB
+//algorithms
+typedef struct {
+  recorder_t* recorder;
+  component_t camera;
+  component_t encoder;
+  component_t null_sink;
+  //Progress of configure(), so a failure can be undone
+  int idle;
+  int enabled;
+  OMX_BUFFERHEADERTYPE* buffers[RECORDER_BUFFERS_MAX];
+  int buffers_length;
+  //OMX_Init() has been called for this recorder
+  int initialized;
+} recorder_omx_t;
+
+//OMX_Init() and bcm_host_init() are called by the first recorder
+static pthread_mutex_t recorder_omx_lock = PTHREAD_MUTEX_INITIALIZER;
+static int recorder_omx_users = 0;
+
+static int recorder_omx_fail (
+    recorder_omx_t* omx,
+    const char* call,
+    OMX_ERRORTYPE error){
+  return recorder_set_error (omx->recorder, RECORDER_ERROR_OMX, "%s: %s",
+      call, dump_OMX_ERRORTYPE (error));
+}
+
+//Returns the error of a call of component.c
+static int recorder_omx_check (
+    recorder_omx_t* omx,
+    component_t* component,
+    OMX_ERRORTYPE error){
+  if (!error) return RECORDER_OK;
+  recorder_omx_fail (omx, component->call, error);
+  return error == OMX_ErrorInsufficientResources ? RECORDER_ERROR_MEMORY :
+      RECORDER_ERROR_OMX;
+}
+
+//Called by OpenMAX IL, the error of a component is kept by the recorder
+static void recorder_omx_event (
+    component_t* component,
+    OMX_EVENTTYPE event,
+    OMX_U32 data1,
+    OMX_U32 data2){
+  recorder_omx_t* omx = (recorder_omx_t*)component->data;
+
+  if (event == OMX_EventError){
+    recorder_failed (omx->recorder, "%s: %s", component->name,
+        dump_OMX_ERRORTYPE (data1));
+  }
+}
+
+//Called by OpenMAX IL, the frame goes to the thread of the callback
+static void recorder_omx_fill_buffer_done (
+    component_t* component,
+    OMX_BUFFERHEADERTYPE* buffer){
+  recorder_omx_t* omx = (recorder_omx_t*)component->data;
+  recorder_frame_t* frame = buffer->pAppPrivate;
+
+  frame->buffer.data = buffer->pBuffer + buffer->nOffset;
+  frame->buffer.length = buffer->nFilledLen;
+  //OMX_SKIP64BIT is defined, the timestamp is split in two halves
+  frame->buffer.timestamp = ((int64_t)buffer->nTimeStamp.nHighPart << 32) |
+      buffer->nTimeStamp.nLowPart;
+  frame->buffer.flags = buffer->nFlags;
+  recorder_filled (omx->recorder, frame);
+}
+
+static const component_callbacks_t recorder_omx_callbacks = {
+  recorder_omx_event,
+  recorder_omx_fill_buffer_done,
+  0
+};
+
+//Sends a command and waits for its completion
+static int recorder_omx_command (
+    recorder_omx_t* omx,
+    component_t* component,
+    OMX_COMMANDTYPE command,
+    OMX_U32 param,
+    VCOS_UNSIGNED event){
+  OMX_ERRORTYPE error;
+
+  if ((error = component_command (component, command, param)) ||
+      (error = component_wait (component, event, 0))){
+    return recorder_omx_check (omx, component, error);
+  }
+  return RECORDER_OK;
+}
+
+static int recorder_omx_enable_port (
+    recorder_omx_t* omx,
+    component_t* component,
+    OMX_U32 port){
+  return recorder_omx_command (omx, component, OMX_CommandPortEnable, port,
+      EVENT_PORT_ENABLE);
+}
+
+static int recorder_omx_disable_port (
+    recorder_omx_t* omx,
+    component_t* component,
+    OMX_U32 port){
+  return recorder_omx_command (omx, component, OMX_CommandPortDisable, port,
+      EVENT_PORT_DISABLE);
+}
+
+static int recorder_omx_init_component (
+    recorder_omx_t* omx,
+    component_t* component,
+    OMX_STRING name){
+  return recorder_omx_check (omx, component, component_init (component, name,
+      &recorder_omx_callbacks, omx));
+}
+
+static void recorder_omx_deinit_component (component_t* component){
+  if (!component->name) return;
+  component_deinit (component);
+  component->name = 0;
+}
+
+static int recorder_omx_set_camera (
+    recorder_omx_t* omx,
+    const recorder_config_t* config){
+  OMX_ERRORTYPE error;
+  OMX_HANDLETYPE camera = omx->camera.handle;
+
+  //Video and preview ports
+  OMX_PARAM_PORTDEFINITIONTYPE port_st;
+  OMX_INIT_STRUCTURE (port_st);
+  port_st.nPortIndex = 71;
+  if ((error = OMX_GetParameter (camera, OMX_IndexParamPortDefinition,
+      &port_st))){
+    return recorder_omx_fail (omx, "OMX_GetParameter", error);
+  }
+  port_st.format.video.nFrameWidth = config->width;
+  port_st.format.video.nFrameHeight = config->height;
+  port_st.format.video.nStride = config->width;
+  port_st.format.video.xFramerate = config->framerate << 16;
+  port_st.format.video.eCompressionFormat = OMX_VIDEO_CodingUnused;
+  port_st.format.video.eColorFormat = OMX_COLOR_FormatYUV420PackedPlanar;
+  if ((error = OMX_SetParameter (camera, OMX_IndexParamPortDefinition,
+      &port_st))){
+    return recorder_omx_fail (omx, "OMX_SetParameter", error);
+  }
+  port_st.nPortIndex = 70;
+  if ((error = OMX_SetParameter (camera, OMX_IndexParamPortDefinition,
+      &port_st))){
+    return recorder_omx_fail (omx, "OMX_SetParameter", error);
+  }
+
+  OMX_CONFIG_FRAMERATETYPE framerate_st;
+  OMX_INIT_STRUCTURE (framerate_st);
+  framerate_st.nPortIndex = 71;
+  framerate_st.xEncodeFramerate = config->framerate << 16;
+  if ((error = OMX_SetConfig (camera, OMX_IndexConfigVideoFramerate,
+      &framerate_st))){
+    return recorder_omx_fail (omx, "OMX_SetConfig", error);
+  }
+  framerate_st.nPortIndex = 70;
+  if ((error = OMX_SetConfig (camera, OMX_IndexConfigVideoFramerate,
+      &framerate_st))){
+    return recorder_omx_fail (omx, "OMX_SetConfig", error);
+  }
+
+  return RECORDER_OK;
+}
+
+static int recorder_omx_set_encoder (
+    recorder_omx_t* omx,
+    const recorder_config_t* config){
+  OMX_ERRORTYPE error;
+  OMX_HANDLETYPE encoder = omx->encoder.handle;
+
+  OMX_PARAM_PORTDEFINITIONTYPE port_st;
+  OMX_INIT_STRUCTURE (port_st);
+  port_st.nPortIndex = 201;
+  if ((error = OMX_GetParameter (encoder, OMX_IndexParamPortDefinition,
+      &port_st))){
+    return recorder_omx_fail (omx, "OMX_GetParameter", error);
+  }
+  port_st.format.video.nFrameWidth = config->width;
+  port_st.format.video.nFrameHeight = config->height;
+  port_st.format.video.nStride = config->width;
+  port_st.format.video.xFramerate = config->framerate << 16;
+  port_st.format.video.nBitrate = config->bitrate;
+  port_st.format.video.eCompressionFormat = OMX_VIDEO_CodingAVC;
+  omx->buffers_length = 0;
+  port_st.nBufferCountActual = config->buffers < port_st.nBufferCountMin ?
+      port_st.nBufferCountMin : config->buffers;
+  if (port_st.nBufferCountActual > RECORDER_BUFFERS_MAX){
+    return recorder_set_error (omx->recorder, RECORDER_ERROR_INVALID,
+        "the encoder needs %u buffers", port_st.nBufferCountActual);
+  }
+  if ((error = OMX_SetParameter (encoder, OMX_IndexParamPortDefinition,
+      &port_st))){
+    return recorder_omx_fail (omx, "OMX_SetParameter", error);
+  }
+
+  OMX_VIDEO_PARAM_BITRATETYPE bitrate_st;
+  OMX_INIT_STRUCTURE (bitrate_st);
+  bitrate_st.eControlRate = OMX_Video_ControlRateVariable;
+  bitrate_st.nTargetBitrate = config->bitrate;
+  bitrate_st.nPortIndex = 201;
+  if ((error = OMX_SetParameter (encoder, OMX_IndexParamVideoBitrate,
+      &bitrate_st))){
+    return recorder_omx_fail (omx, "OMX_SetParameter", error);
+  }
+
+  OMX_VIDEO_PARAM_PORTFORMATTYPE format_st;
+  OMX_INIT_STRUCTURE (format_st);
+  format_st.nPortIndex = 201;
+  format_st.eCompressionFormat = OMX_VIDEO_CodingAVC;
+  if ((error = OMX_SetParameter (encoder, OMX_IndexParamVideoPortFormat,
+      &format_st))){
+    return recorder_omx_fail (omx, "OMX_SetParameter", error);
+  }
+
+  OMX_VIDEO_CONFIG_AVCINTRAPERIOD idr_st;
+  OMX_INIT_STRUCTURE (idr_st);
+  idr_st.nPortIndex = 201;
+  if ((error = OMX_GetConfig (encoder, OMX_IndexConfigVideoAVCIntraPeriod,
+      &idr_st))){
+    return recorder_omx_fail (omx, "OMX_GetConfig", error);
+  }
+  idr_st.nIDRPeriod = config->idr_period;
+  if ((error = OMX_SetConfig (encoder, OMX_IndexConfigVideoAVCIntraPeriod,
+      &idr_st))){
+    return recorder_omx_fail (omx, "OMX_SetConfig", error);
+  }
+
+  OMX_VIDEO_PARAM_AVCTYPE avc_st;
+  OMX_INIT_STRUCTURE (avc_st);
+  avc_st.nPortIndex = 201;
+  if ((error = OMX_GetParameter (encoder, OMX_IndexParamVideoAvc, &avc_st))){
+    return recorder_omx_fail (omx, "OMX_GetParameter", error);
+  }
+  avc_st.eProfile = config->profile == 66 ? OMX_VIDEO_AVCProfileBaseline :
+      config->profile == 77 ? OMX_VIDEO_AVCProfileMain :
+      OMX_VIDEO_AVCProfileHigh;
+  if ((error = OMX_SetParameter (encoder, OMX_IndexParamVideoAvc, &avc_st))){
+    return recorder_omx_fail (omx, "OMX_SetParameter", error);
+  }
+
+  OMX_CONFIG_PORTBOOLEANTYPE headers_st;
+  OMX_INIT_STRUCTURE (headers_st);
+  headers_st.nPortIndex = 201;
+  headers_st.bEnabled = config->inline_headers ? OMX_TRUE : OMX_FALSE;
+  if ((error = OMX_SetParameter (encoder,
+      OMX_IndexParamBrcmVideoAVCInlineHeaderEnable, &headers_st))){
+    return recorder_omx_fail (omx, "OMX_SetParameter", error);
+  }
+
+  omx->buffers_length = port_st.nBufferCountActual;
+  return RECORDER_OK;
+}
+
+//Changes the state of the three components, in the order of the pipeline
+static int recorder_omx_set_state (recorder_omx_t* omx, OMX_STATETYPE state){
+  int result;
+
+  if ((result = recorder_omx_command (omx, &omx->camera, OMX_CommandStateSet,
+      state, EVENT_STATE_SET)) ||
+      (result = recorder_omx_command (omx, &omx->encoder, OMX_CommandStateSet,
+      state, EVENT_STATE_SET)) ||
+      (result = recorder_omx_command (omx, &omx->null_sink,
+      OMX_CommandStateSet, state, EVENT_STATE_SET))){
+    return result;
+  }
+  return RECORDER_OK;
+}
+
+static int recorder_omx_open (recorder_pipeline_t* pipeline, uint32_t device){
+  OMX_ERRORTYPE error;
+  int result;
+
+  recorder_omx_t* omx = calloc (1, sizeof (recorder_omx_t));
+  pipeline->data = omx;
+  if (!omx){
+    return recorder_set_error (pipeline->recorder, RECORDER_ERROR_MEMORY,
+        "calloc");
+  }
+  omx->recorder = pipeline->recorder;
+
+  pthread_mutex_lock (&recorder_omx_lock);
+  if (!recorder_omx_users){
+    bcm_host_init ();
+    if ((error = OMX_Init ())){
+      bcm_host_deinit ();
+      pthread_mutex_unlock (&recorder_omx_lock);
+      return recorder_omx_fail (omx, "OMX_Init", error);
+    }
+  }
+  recorder_omx_users++;
+  omx->initialized = 1;
+  pthread_mutex_unlock (&recorder_omx_lock);
+
+  if ((result = recorder_omx_init_component (omx, &omx->camera,
+      "OMX.broadcom.camera")) ||
+      (result = recorder_omx_init_component (omx, &omx->encoder,
+      "OMX.broadcom.video_encode")) ||
+      (result = recorder_omx_init_component (omx, &omx->null_sink,
+      "OMX.broadcom.null_sink"))){
+    return result;
+  }
+  return recorder_omx_check (omx, &omx->camera,
+      component_load_camera_drivers (&omx->camera, device));
+}
+
+static void recorder_omx_unconfigure (recorder_pipeline_t* pipeline){
+  recorder_omx_t* omx = pipeline->data;
+
+  if (omx->enabled){
+    recorder_omx_disable_port (omx, &omx->camera, 71);
+    recorder_omx_disable_port (omx, &omx->camera, 70);
+    recorder_omx_disable_port (omx, &omx->null_sink, 240);
+    recorder_omx_disable_port (omx, &omx->encoder, 200);
+    recorder_omx_check (omx, &omx->encoder, component_disable_output_port (
+        &omx->encoder, 201, omx->buffers, omx->buffers_length));
+  }
+  omx->enabled = 0;
+  if (omx->idle){
+    recorder_omx_set_state (omx, OMX_StateLoaded);
+    omx->idle = 0;
+  }
+}
+
+static int recorder_omx_configure (
+    recorder_pipeline_t* pipeline,
+    const recorder_config_t* config,
+    recorder_frame_t* frames,
+    int* length){
+  recorder_omx_t* omx = pipeline->data;
+  OMX_ERRORTYPE error;
+  int result;
+  int i;
+
+  component_clear (&omx->camera);
+  component_clear (&omx->encoder);
+  component_clear (&omx->null_sink);
+
+  if ((result = recorder_omx_set_camera (omx, config)) ||
+      (result = recorder_omx_set_encoder (omx, config))){
+    return result;
+  }
+  if ((error = OMX_SetupTunnel (omx->camera.handle, 71, omx->encoder.handle,
+      200)) ||
+      (error = OMX_SetupTunnel (omx->camera.handle, 70,
+      omx->null_sink.handle, 240))){
+    return recorder_omx_fail (omx, "OMX_SetupTunnel", error);
+  }
+
+  omx->idle = 1;
+  if ((result = recorder_omx_set_state (omx, OMX_StateIdle))) return result;
+
+  omx->enabled = 1;
+  if ((result = recorder_omx_enable_port (omx, &omx->camera, 71)) ||
+      (result = recorder_omx_enable_port (omx, &omx->camera, 70)) ||
+      (result = recorder_omx_enable_port (omx, &omx->null_sink, 240)) ||
+      (result = recorder_omx_enable_port (omx, &omx->encoder, 200)) ||
+      (result = recorder_omx_check (omx, &omx->encoder,
+      component_enable_output_port (&omx->encoder, 201, omx->buffers,
+      omx->buffers_length)))){
+    return result;
+  }
+
+  for (i=0; i<omx->buffers_length; i++){
+    frames[i].header = omx->buffers[i];
+    omx->buffers[i]->pAppPrivate = &frames[i];
+  }
+  *length = omx->buffers_length;
+  return RECORDER_OK;
+}
+
+static int recorder_omx_execute (recorder_pipeline_t* pipeline){
+  return recorder_omx_set_state (pipeline->data, OMX_StateExecuting);
+}
+
+static int recorder_omx_idle (recorder_pipeline_t* pipeline){
+  return recorder_omx_set_state (pipeline->data, OMX_StateIdle);
+}
+
+static int recorder_omx_fill (recorder_pipeline_t* pipeline, void* header){
+  recorder_omx_t* omx = pipeline->data;
+  OMX_ERRORTYPE error;
+
+  if ((error = OMX_FillThisBuffer (omx->encoder.handle, header))){
+    return recorder_omx_fail (omx, "OMX_FillThisBuffer", error);
+  }
+  return RECORDER_OK;
+}
+
+static int recorder_omx_capture (recorder_pipeline_t* pipeline, int enabled){
+  recorder_omx_t* omx = pipeline->data;
+  return recorder_omx_check (omx, &omx->camera, component_set_capture (
+      &omx->camera, 71, enabled ? OMX_TRUE : OMX_FALSE));
+}
+
+static void recorder_omx_close (recorder_pipeline_t* pipeline){
+  recorder_omx_t* omx = pipeline->data;
+
+  if (!omx) return;
+  recorder_omx_deinit_component (&omx->camera);
+  recorder_omx_deinit_component (&omx->encoder);
+  recorder_omx_deinit_component (&omx->null_sink);
+
+  pthread_mutex_lock (&recorder_omx_lock);
+  if (omx->initialized && !--recorder_omx_users){
+    OMX_Deinit ();
+    bcm_host_deinit ();
+  }
+  pthread_mutex_unlock (&recorder_omx_lock);
+  free (omx);
+  pipeline->data = 0;
+}
+
+int recorder_open (recorder_t** recorder, uint32_t device){
+  recorder_pipeline_t pipeline = {
+    recorder_omx_open,
+    recorder_omx_configure,
+    recorder_omx_unconfigure,
+    recorder_omx_execute,
+    recorder_omx_idle,
+    recorder_omx_fill,
+    recorder_omx_capture,
+    recorder_omx_close,
+    0,
+    0
+  };
+  return recorder_open_pipeline (recorder, &pipeline, device);
+}
@@ -0,0 +1,137 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "rt.h"
+
+#define PAGE_SIZE 4096
+
+typedef struct {
+  int policy;
+  int priority;
+  //-1 to keep the affinity
+  int cpu;
+} rt_settings_t;
+
+static const char* roles[RT_ROLES] = { "capture", "network", "writer" };
+
+static int enabled = 0;
+static rt_settings_t settings[RT_ROLES] = {
+  { SCHED_OTHER, 0, -1 },
+  { SCHED_OTHER, 0, -1 },
+  { SCHED_OTHER, 0, -1 }
+};
+
+static void rt_invalid (const char* spec){
+  fprintf (stderr, "error: invalid real-time settings: %s\n", spec);
+  exit (1);
+}
+
+//ROLE=[POLICY[:PRIORITY]][@CPU]
+static void rt_parse (const char* spec, const char* item, size_t length){
+  char buffer[64];
+  char* value;
+  char* cpu;
+  char* end;
+  int i;
+
+  if (length >= sizeof (buffer)) rt_invalid (spec);
+  memcpy (buffer, item, length);
+  buffer[length] = 0;
+  if (!(value = strchr (buffer, '='))) rt_invalid (spec);
+  *value++ = 0;
+
+  for (i=0; i<RT_ROLES && strcmp (buffer, roles[i]); i++);
+  if (i == RT_ROLES) rt_invalid (spec);
+  rt_settings_t* role = &settings[i];
+
+  if ((cpu = strchr (value, '@'))){
+    *cpu++ = 0;
+    role->cpu = strtol (cpu, &end, 10);
+    if (end == cpu || *end || role->cpu < 0 || role->cpu >= CPU_SETSIZE){
+      rt_invalid (spec);
+    }
+  }
+
+  if (!*value || !strcmp (value, "other")) return;
+  if (!strncmp (value, "fifo:", 5)){
+    role->policy = SCHED_FIFO;
+  }else if (!strncmp (value, "rr:", 3)){
+    role->policy = SCHED_RR;
+  }else{
+    rt_invalid (spec);
+  }
+  role->priority = strtol (strchr (value, ':') + 1, &end, 10);
+  if (*end || role->priority < sched_get_priority_min (role->policy) ||
+      role->priority > sched_get_priority_max (role->policy)){
+    rt_invalid (spec);
+  }
+}
+
+//Touches the stack below the caller, so it's mapped before it's needed
+static void __attribute__ ((noinline)) rt_prefault_stack (){
+  unsigned char stack[RT_STACK_PREFAULT];
+  volatile unsigned char* p = stack;
+  int i;
+  for (i=0; i<RT_STACK_PREFAULT; i+=PAGE_SIZE){
+    p[i] = 0;
+  }
+}
+
+void rt_configure (const char* spec){
+  const char* item = spec;
+  const char* end;
+
+  while (1){
+    end = strchr (item, ',');
+    rt_parse (spec, item, end ? (size_t)(end - item) : strlen (item));
+    if (!end) break;
+    item = end + 1;
+  }
+  enabled = 1;
+
+  //The freed memory stays in the process, it's not faulted in again
+  mallopt (M_TRIM_THRESHOLD, -1);
+  mallopt (M_MMAP_MAX, 0);
+  //The current pages and the future ones (buffers, thread stacks) are loaded
+  //and locked in memory
+  if (mlockall (MCL_CURRENT | MCL_FUTURE)){
+    fprintf (stderr, "warning: rt: mlockall: %s, the memory is not locked\n",
+        strerror (errno));
+  }
+}
+
+void rt_thread (rt_role_t role){
+  rt_settings_t* s = &settings[role];
+  int error;
+
+  if (!enabled) return;
+  rt_prefault_stack ();
+
+  if (s->policy != SCHED_OTHER){
+    struct sched_param param;
+    param.sched_priority = s->priority;
+    if ((error = pthread_setschedparam (pthread_self (), s->policy, &param))){
+      fprintf (stderr, "warning: rt: %s thread: pthread_setschedparam: %s, "
+          "the default scheduling is used\n", roles[role], strerror (error));
+    }
+  }
+
+  if (s->cpu >= 0){
+    cpu_set_t cpus;
+    CPU_ZERO (&cpus);
+    CPU_SET (s->cpu, &cpus);
+    if ((error = pthread_setaffinity_np (pthread_self (), sizeof (cpus),
+        &cpus))){
+      fprintf (stderr, "warning: rt: %s thread: pthread_setaffinity_np: %s, "
+          "the thread is not pinned\n", roles[role], strerror (error));
+    }
+  }
+}
@@ -0,0 +1,37 @@
+#ifndef RT_H
+#define RT_H
+
+/*
+Real-time settings of the threads. -r gives a scheduling policy, a priority and
+a CPU to the threads of every role:
+
+  -r capture=fifo:50@3,network=rr:20@2,writer=rr:10@2
+
+capture is the encoder loop, network the thread of the server: output and
+writer the threads that write the files (see writer.h). The policy is fifo, rr
+or other (no priority), and the CPU is optional.
+
+With -r the memory is also locked with mlockall(), malloc() never gives memory
+back to the system and every thread touches the first RT_STACK_PREFAULT bytes of
+its stack, so there are no page faults once the recording has started. Without
+the privileges (CAP_SYS_NICE and CAP_IPC_LOCK, or the RLIMIT_RTPRIO and
+RLIMIT_MEMLOCK limits) a warning is printed and the threads keep the default
+settings.
+*/
+
+//Bytes of the stack of every thread touched at startup
+#define RT_STACK_PREFAULT (128*1024)
+
+typedef enum {
+  RT_CAPTURE,
+  RT_NETWORK,
+  RT_WRITER,
+  RT_ROLES
+} rt_role_t;
+
+//Parses the -r option and locks the memory
+void rt_configure (const char* spec);
+//Applies the settings of the role to the calling thread
+void rt_thread (rt_role_t role);
+
+#endif
@@ -0,0 +1,398 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "nal.h"
+#include "rtp.h"
+
+#define RTP_PAYLOAD_TYPE 96
+#define RTP_HEADER_SIZE 12
+//Default maximum size of a packet, RTP header included. It leaves room for the
+//IP and UDP headers in a 1500-byte Ethernet frame
+#define RTP_MTU 1400
+//Maximum NAL units aggregated in a STAP-A packet
+#define RTP_STAP_MAX 8
+//Maximum packets per sendmmsg() call (UIO_MAXIOV)
+#define RTP_BATCH 1024
+//Maximum size of a frame that spans several buffers
+#define RTP_FRAME_SIZE (2*1024*1024)
+//Maximum NAL units in a frame
+#define RTP_NALS_MAX 256
+//Socket send buffer, it must hold the burst of an IDR frame
+#define RTP_SNDBUF (1024*1024)
+
+#define FU_A 28
+#define STAP_A 24
+
+typedef struct {
+  //RTP header followed by the FU or STAP-A headers
+  uint8_t header[RTP_HEADER_SIZE + 1 + 2*RTP_STAP_MAX];
+  struct iovec iov[2 + 2*RTP_STAP_MAX];
+} rtp_packet_t;
+
+typedef struct {
+  sink_t sink;
+  int fd;
+  uint32_t mtu;
+  uint16_t sequence;
+  uint32_t ssrc;
+  uint32_t timestamp_offset;
+  //RTP timestamp of the frame being sent
+  uint32_t timestamp;
+  //Frame assembled from several buffers and the SPS/PPS waiting to be sent
+  //with the next frame
+  uint8_t* frame;
+  uint32_t frame_length;
+  int frame_sync;
+  int frame_dropped;
+  //Part of the frame has been sent (low latency)
+  int frame_started;
+  //Waiting for the next IDR frame after a drop
+  int resync;
+  nal_t nals[RTP_NALS_MAX];
+  //Packets of the current batch
+  rtp_packet_t* packets;
+  struct mmsghdr* messages;
+  int packets_length;
+} rtp_sink_t;
+
+//Sends the current batch. Returns 0 if some packets have been dropped
+static int rtp_flush (rtp_sink_t* sink){
+  int sent = 0;
+  int n;
+
+  while (sent < sink->packets_length){
+    n = sendmmsg (sink->fd, sink->messages + sent, sink->packets_length - sent,
+        MSG_DONTWAIT);
+    if (n == -1){
+      if (errno == EINTR) continue;
+      //ICMP port unreachable of a previous packet, the receiver is not there
+      //yet. It's reported once, so just retry
+      if (errno == ECONNREFUSED) continue;
+      sink->packets_length = 0;
+      return 0;
+    }
+    sent += n;
+  }
+
+  sink->packets_length = 0;
+  return 1;
+}
+
+static rtp_packet_t* rtp_packet_begin (rtp_sink_t* sink){
+  if (sink->packets_length == RTP_BATCH && !rtp_flush (sink)) return 0;
+
+  rtp_packet_t* packet = &sink->packets[sink->packets_length];
+  uint8_t* h = packet->header;
+  h[0] = 0x80;
+  h[1] = RTP_PAYLOAD_TYPE;
+  h[2] = sink->sequence >> 8;
+  h[3] = sink->sequence;
+  h[4] = sink->timestamp >> 24;
+  h[5] = sink->timestamp >> 16;
+  h[6] = sink->timestamp >> 8;
+  h[7] = sink->timestamp;
+  h[8] = sink->ssrc >> 24;
+  h[9] = sink->ssrc >> 16;
+  h[10] = sink->ssrc >> 8;
+  h[11] = sink->ssrc;
+  sink->sequence++;
+
+  packet->iov[0].iov_base = h;
+  packet->iov[0].iov_len = RTP_HEADER_SIZE;
+  sink->messages[sink->packets_length].msg_hdr.msg_iovlen = 1;
+  sink->packets_length++;
+
+  return packet;
+}
+
+static void rtp_packet_add (
+    rtp_sink_t* sink,
+    rtp_packet_t* packet,
+    void* data,
+    size_t length){
+  struct msghdr* msg = &sink->messages[packet - sink->packets].msg_hdr;
+  packet->iov[msg->msg_iovlen].iov_base = data;
+  packet->iov[msg->msg_iovlen].iov_len = length;
+  msg->msg_iovlen++;
+}
+
+//Packetizes and sends Annex-B NAL units, preceded by the NAL units in prefix.
+//The marker is set at the end of the access unit. Returns 0 if some packets
+//have been dropped
+static int rtp_send (
+    rtp_sink_t* sink,
+    uint8_t* prefix,
+    uint32_t prefix_length,
+    uint8_t* data,
+    uint32_t length,
+    int marker){
+  rtp_packet_t* packet;
+  uint32_t payload = sink->mtu - RTP_HEADER_SIZE;
+  int n = nal_split (prefix, prefix_length, sink->nals, RTP_NALS_MAX);
+  n += nal_split (data, length, sink->nals + n, RTP_NALS_MAX - n);
+  int i = 0;
+  int j;
+
+  while (i < n){
+    nal_t* nal = &sink->nals[i];
+
+    if (nal->length <= payload){
+      //Aggregate the following NAL units while they fit in the packet
+      uint32_t size = 1;
+      for (j=i; j<n && j-i<RTP_STAP_MAX &&
+          size + 2 + sink->nals[j].length <= payload; j++){
+        size += 2 + sink->nals[j].length;
+      }
+
+      if (!(packet = rtp_packet_begin (sink))) return 0;
+
+      if (j - i < 2){
+        //Single NAL unit packet
+        rtp_packet_add (sink, packet, nal->data, nal->length);
+        i++;
+        continue;
+      }
+
+      //STAP-A: the NRI is the highest of the aggregated NAL units
+      uint8_t* h = packet->header + RTP_HEADER_SIZE;
+      h[0] = STAP_A;
+      rtp_packet_add (sink, packet, h++, 1);
+      for (; i<j; i++){
+        nal = &sink->nals[i];
+        if ((nal->data[0] & 0x60) > (packet->header[RTP_HEADER_SIZE] & 0x60)){
+          packet->header[RTP_HEADER_SIZE] = STAP_A | (nal->data[0] & 0x60);
+        }
+        h[0] = nal->length >> 8;
+        h[1] = nal->length;
+        rtp_packet_add (sink, packet, h, 2);
+        rtp_packet_add (sink, packet, nal->data, nal->length);
+        h += 2;
+      }
+      continue;
+    }
+
+    //FU-A: the NAL header is not sent, it's rebuilt from the FU indicator and
+    //the FU header
+    uint8_t* p = nal->data + 1;
+    uint32_t left = nal->length - 1;
+    uint32_t chunk;
+    int start = 1;
+    while (left){
+      chunk = left < payload - 2 ? left : payload - 2;
+      if (!(packet = rtp_packet_begin (sink))) return 0;
+      uint8_t* h = packet->header + RTP_HEADER_SIZE;
+      h[0] = (nal->data[0] & 0xE0) | FU_A;
+      h[1] = (nal->data[0] & 0x1F) | (start ? 0x80 : 0) |
+          (chunk == left ? 0x40 : 0);
+      rtp_packet_add (sink, packet, h, 2);
+      rtp_packet_add (sink, packet, p, chunk);
+      p += chunk;
+      left -= chunk;
+      start = 0;
+    }
+    i++;
+  }
+
+  if (!sink->packets_length) return 1;
+
+  //The marker bit signals the last packet of the access unit
+  if (marker) sink->packets[sink->packets_length - 1].header[1] |= 0x80;
+
+  return rtp_flush (sink);
+}
+
+//Sends a part of the current frame, the whole frame if end is set
+static void rtp_sink_send (
+    rtp_sink_t* sink,
+    stream_buffer_t* buffer,
+    uint8_t* data,
+    uint32_t length,
+    int end){
+  sink_t* base = &sink->sink;
+  uint8_t* prefix = 0;
+  uint32_t prefix_length = 0;
+
+  //90 kHz clock
+  sink->timestamp = sink->timestamp_offset +
+      (uint32_t)(buffer->timestamp*9/100);
+
+  if (!sink->frame_started && sink->resync && sink->frame_sync){
+    sink->resync = 0;
+    //The receiver may have missed the SPS/PPS
+    if (base->paramsets && base->paramsets->complete){
+      prefix = base->paramsets->data;
+      prefix_length = base->paramsets->length;
+    }
+  }
+  sink->frame_started = 1;
+
+  if (sink->frame_dropped || sink->resync ||
+      !rtp_send (sink, prefix, prefix_length, data, length, end)){
+    if (!sink->resync && base->idr) idr_request (base->idr);
+    sink->resync = 1;
+    sink->frame_dropped = 1;
+  }else{
+    base->bytes += length;
+  }
+
+  if (end){
+    if (sink->frame_dropped){
+      base->dropped_frames++;
+    }else{
+      base->frames++;
+    }
+    sink->frame_started = 0;
+    sink->frame_sync = 0;
+    sink->frame_dropped = 0;
+  }
+}
+
+//Sends the NAL units of the frame that are complete, the last one may continue
+//in the next buffer. The start codes before the last buffer, which begins at
+//offset, have already been searched
+static void rtp_sink_send_complete (
+    rtp_sink_t* sink,
+    stream_buffer_t* buffer,
+    uint32_t offset){
+  uint8_t* frame = sink->frame;
+  uint32_t start = sink->frame_length;
+  uint32_t min = offset + 1 > 3 ? offset + 1 : 3;
+
+  //Last start code
+  while (start >= min && (frame[start - 1] != 1 || frame[start - 2] ||
+      frame[start - 3])){
+    start--;
+  }
+  if (start < min || start == 3) return;
+  start -= 3;
+  //The first zero of a 4-byte start code
+  uint32_t length = frame[start - 1] ? start : start - 1;
+  if (!length) return;
+
+  rtp_sink_send (sink, buffer, frame, length, 0);
+  sink->frame_length -= start;
+  memmove (frame, frame + start, sink->frame_length);
+}
+
+static void rtp_sink_write (sink_t* base, stream_buffer_t* buffer){
+  rtp_sink_t* sink = (rtp_sink_t*)base;
+  int config = buffer->flags & STREAM_FLAG_CODECCONFIG;
+  int end = (buffer->flags & STREAM_FLAG_ENDOFFRAME) && !config;
+
+  sink->frame_sync |= buffer->flags & STREAM_FLAG_SYNCFRAME;
+
+  if (end && !sink->frame_length){
+    //The whole frame is in this buffer, it's packetized without copying it
+    rtp_sink_send (sink, buffer, buffer->data, buffer->length, 1);
+    return;
+  }
+
+  uint32_t offset = sink->frame_length;
+  if (sink->frame_length + buffer->length > RTP_FRAME_SIZE){
+    sink->frame_dropped = 1;
+  }else{
+    memcpy (sink->frame + sink->frame_length, buffer->data, buffer->length);
+    sink->frame_length += buffer->length;
+  }
+
+  if (end){
+    rtp_sink_send (sink, buffer, sink->frame, sink->frame_length, 1);
+    sink->frame_length = 0;
+  }else if (base->low_latency && !config && !sink->frame_dropped){
+    //The SPS/PPS wait for the first slice, they're aggregated with it
+    rtp_sink_send_complete (sink, buffer, offset);
+  }
+}
+
+static void rtp_sink_close (sink_t* base){
+  rtp_sink_t* sink = (rtp_sink_t*)base;
+
+  if (close (sink->fd)){
+    fprintf (stderr, "error: close\n");
+    exit (1);
+  }
+
+  free (sink->frame);
+  free (sink->packets);
+  free (sink->messages);
+  free (sink);
+}
+
+sink_t* rtp_sink_open (const char* spec){
+  rtp_sink_t* sink = calloc (1, sizeof (rtp_sink_t));
+  if (!sink){
+    fprintf (stderr, "error: calloc\n");
+    exit (1);
+  }
+  sink->sink.name = spec;
+  sink->sink.write = rtp_sink_write;
+  sink->sink.close = rtp_sink_close;
+  sink->mtu = RTP_MTU;
+
+  //rtp:HOST:PORT[,option=value]...
+  char address[512];
+  const char* options = strchr (spec, ',');
+  size_t length = options ? (size_t)(options - spec) : strlen (spec);
+  if (length - 4 >= sizeof (address)){
+    fprintf (stderr, "error: invalid address: %s\n", spec);
+    exit (1);
+  }
+  memcpy (address, spec + 4, length - 4);
+  address[length - 4] = 0;
+
+  unsigned int pace = 0;
+  while (options){
+    options++;
+    if (sscanf (options, "mtu=%u", &sink->mtu) != 1 &&
+        sscanf (options, "pace=%u", &pace) != 1){
+      fprintf (stderr, "error: invalid rtp option: %s\n", options);
+      exit (1);
+    }
+    options = strchr (options, ',');
+  }
+  if (sink->mtu < RTP_HEADER_SIZE + 64){
+    fprintf (stderr, "error: invalid rtp mtu: %u\n", sink->mtu);
+    exit (1);
+  }
+
+  sink->fd = sink_connect (address, SOCK_DGRAM);
+
+  int size = RTP_SNDBUF;
+  setsockopt (sink->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof (size));
+  if (pace && setsockopt (sink->fd, SOL_SOCKET, SO_MAX_PACING_RATE, &pace,
+      sizeof (pace))){
+    fprintf (stderr, "warning: sink %s: pacing not available\n", spec);
+  }
+
+  //Random initial values (RFC 3550, section 5.1)
+  struct timespec spec_time;
+  clock_gettime (CLOCK_REALTIME, &spec_time);
+  srand (spec_time.tv_nsec ^ getpid ());
+  sink->sequence = rand ();
+  sink->ssrc = rand ();
+  sink->timestamp_offset = rand ();
+
+  sink->frame = malloc (RTP_FRAME_SIZE);
+  sink->packets = malloc (RTP_BATCH*sizeof (rtp_packet_t));
+  sink->messages = calloc (RTP_BATCH, sizeof (struct mmsghdr));
+  if (!sink->frame || !sink->packets || !sink->messages){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+
+  //The socket is connected, so only the iovecs change between packets
+  int i;
+  for (i=0; i<RTP_BATCH; i++){
+    sink->messages[i].msg_hdr.msg_iov = sink->packets[i].iov;
+  }
+
+  return &sink->sink;
+}
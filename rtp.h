@@ -0,0 +1,21 @@
+#ifndef RTP_H
+#define RTP_H
+
+#include "sink.h"
+
+/*
+RTP sender (RFC 3550) with the H.264 payload format (RFC 6184, non-interleaved
+mode). Each frame is split into NAL units which are sent as single NAL unit
+packets, STAP-A packets (small NAL units like SPS and PPS aggregated in one
+packet) or FU-A packets (NAL units bigger than the MTU). All the packets of a
+frame are sent with a single sendmmsg() call.
+
+Output specification: rtp:HOST:PORT[,mtu=BYTES][,pace=BYTES_PER_SECOND]
+
+The pacing is done by the kernel (SO_MAX_PACING_RATE, it needs the fq queueing
+discipline), so the encoder loop never sleeps.
+*/
+
+sink_t* rtp_sink_open (const char* spec);
+
+#endif
@@ -0,0 +1,164 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtpdepay.h"
+
+#define RTP_HEADER_SIZE 12
+#define FU_A 28
+#define STAP_A 24
+
+void rtp_depay_init (rtp_depay_t* depay, uint32_t size){
+  memset (depay, 0, sizeof (rtp_depay_t));
+  depay->frame = malloc (size);
+  if (!depay->frame){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+  depay->size = size;
+}
+
+void rtp_depay_free (rtp_depay_t* depay){
+  free (depay->frame);
+}
+
+//Appends a start code, if header is set, and the data
+static void rtp_depay_append (
+    rtp_depay_t* depay,
+    int header,
+    const uint8_t* data,
+    uint32_t length){
+  if (depay->broken) return;
+  if (depay->frame_length + 4*header + length > depay->size){
+    depay->broken = 1;
+    return;
+  }
+  if (header){
+    memcpy (depay->frame + depay->frame_length, "\0\0\0\1", 4);
+    depay->frame_length += 4;
+  }
+  memcpy (depay->frame + depay->frame_length, data, length);
+  depay->frame_length += length;
+}
+
+//Ends the current frame
+static void rtp_depay_end (rtp_depay_t* depay){
+  //A fragmented NAL unit that didn't end
+  if (depay->fragment) depay->broken = 1;
+  if (depay->broken){
+    depay->broken_frames++;
+  }else{
+    depay->frames++;
+  }
+}
+
+//Starts a new frame, the previous one is forgotten
+static void rtp_depay_reset (rtp_depay_t* depay, uint32_t timestamp){
+  depay->frame_length = 0;
+  depay->broken = 0;
+  depay->fragment = 0;
+  depay->open = 1;
+  depay->timestamp = timestamp;
+}
+
+int rtp_depay_flush (rtp_depay_t* depay){
+  if (!depay->open) return 0;
+  rtp_depay_end (depay);
+  depay->open = 0;
+  depay->broken = 1;
+  return 1;
+}
+
+int rtp_depay_packet (rtp_depay_t* depay, const uint8_t* packet,
+    uint32_t length){
+  if (length < RTP_HEADER_SIZE + 1 || (packet[0] & 0xC0) != 0x80) return -1;
+  //CSRCs, header extension and padding, never sent by rtp.c
+  uint32_t header = RTP_HEADER_SIZE + 4*(packet[0] & 0x0F);
+  if ((packet[0] & 0x10) && length >= header + 4){
+    header += 4 + 4*((packet[header + 2] << 8) | packet[header + 3]);
+  }
+  if ((packet[0] & 0x20) && length > header) length -= packet[length - 1];
+  if (length <= header) return -1;
+
+  uint16_t sequence = (packet[2] << 8) | packet[3];
+  uint32_t timestamp = ((uint32_t)packet[4] << 24) | (packet[5] << 16) |
+      (packet[6] << 8) | packet[7];
+  uint32_t ssrc = ((uint32_t)packet[8] << 24) | (packet[9] << 16) |
+      (packet[10] << 8) | packet[11];
+  int gap = 0;
+
+  //A new sender starts a new sequence
+  if (depay->started && ssrc != depay->ssrc) depay->started = 0;
+  if (depay->started){
+    gap = (int16_t)(sequence - depay->sequence);
+    if (gap < 0){
+      depay->reordered++;
+      return 0;
+    }
+    depay->lost += gap;
+  }
+  depay->started = 1;
+  depay->ssrc = ssrc;
+  depay->sequence = sequence + 1;
+  depay->packets++;
+  depay->bytes += length;
+
+  if (!depay->open || timestamp != depay->timestamp){
+    //The last packet of the previous frame has been lost, it's the lost one if
+    //there's only one
+    if (depay->open){
+      depay->broken = 1;
+      rtp_depay_end (depay);
+      if (gap == 1) gap = 0;
+    }
+    rtp_depay_reset (depay, timestamp);
+  }
+  //The lost packets belong to this frame or to the end of the previous one
+  if (gap) depay->broken = 1;
+
+  const uint8_t* payload = packet + header;
+  uint32_t size = length - header;
+  uint8_t type = payload[0] & 0x1F;
+
+  if (type == STAP_A){
+    depay->stap_a++;
+    if (depay->fragment) depay->broken = 1;
+    depay->fragment = 0;
+    payload++;
+    size--;
+    while (size >= 2){
+      uint32_t nal_length = (payload[0] << 8) | payload[1];
+      if (nal_length + 2 > size) return -1;
+      rtp_depay_append (depay, 1, payload + 2, nal_length);
+      payload += 2 + nal_length;
+      size -= 2 + nal_length;
+    }
+  }else if (type == FU_A){
+    depay->fu_a++;
+    if (size < 2) return -1;
+    if (payload[1] & 0x80){
+      if (depay->fragment) depay->broken = 1;
+      uint8_t nal_header = (payload[0] & 0xE0) | (payload[1] & 0x1F);
+      rtp_depay_append (depay, 1, &nal_header, 1);
+      depay->fragment = 1;
+    }else if (!depay->fragment){
+      //The first fragment has been lost
+      depay->broken = 1;
+    }
+    rtp_depay_append (depay, 0, payload + 2, size - 2);
+    if (payload[1] & 0x40) depay->fragment = 0;
+  }else if (type >= 1 && type <= 23){
+    depay->single++;
+    if (depay->fragment) depay->broken = 1;
+    depay->fragment = 0;
+    rtp_depay_append (depay, 1, payload, size);
+  }else{
+    return -1;
+  }
+
+  //The marker bit ends the frame
+  if (!(packet[1] & 0x80)) return 0;
+  rtp_depay_end (depay);
+  depay->open = 0;
+  return 1;
+}
@@ -0,0 +1,66 @@
+#ifndef RTPDEPAY_H
+#define RTPDEPAY_H
+
+#include <stdint.h>
+
+/*
+Receiver side of rtp.h, used by the rtprecv tool and the tests. The RTP packets
+are checked for sequence continuity and the H.264 payload (single NAL unit,
+STAP-A and FU-A packets) is reassembled into Annex-B frames, every NAL unit
+with a 4-byte start code, which is what the encoder produces. A frame ends with
+the marker bit.
+
+A lost packet damages the frame of the next packet received, unless it's the
+only one lost and the previous frame didn't end: it cannot be known whether the
+lost packets were the end of a frame or the beginning of the next one. A damaged
+frame is still returned but marked as broken. A frame whose last packet has been
+lost is discarded when a packet of a new timestamp arrives, and counted as
+broken. Late and duplicated packets are counted and
+discarded.
+*/
+
+typedef struct {
+  //Frame being assembled
+  uint8_t* frame;
+  uint32_t frame_length;
+  uint32_t size;
+  //RTP timestamp of the frame
+  uint32_t timestamp;
+  //A packet of the frame has been lost or the frame doesn't fit
+  int broken;
+  //Packets of the frame have been received and its marker has not
+  int open;
+  //Inside a fragmented NAL unit
+  int fragment;
+  //Sequence number expected in the next packet
+  uint16_t sequence;
+  uint32_t ssrc;
+  //The first packet has been received
+  int started;
+  //Statistics
+  uint64_t packets;
+  uint64_t bytes;
+  uint32_t lost;
+  //Late or duplicated packets
+  uint32_t reordered;
+  uint32_t frames;
+  uint32_t broken_frames;
+  //Packets of each type
+  uint32_t single;
+  uint32_t stap_a;
+  uint32_t fu_a;
+} rtp_depay_t;
+
+//size is the maximum size of a frame
+void rtp_depay_init (rtp_depay_t* depay, uint32_t size);
+void rtp_depay_free (rtp_depay_t* depay);
+//Consumes an RTP packet. Returns 1 if it completes a frame: frame and
+//frame_length (Annex-B), timestamp and broken describe it until the next call.
+//Returns -1 if the packet is not valid
+int rtp_depay_packet (rtp_depay_t* depay, const uint8_t* packet,
+    uint32_t length);
+//Ends the stream, an incomplete frame is counted as broken. Returns 1 if there
+//was one
+int rtp_depay_flush (rtp_depay_t* depay);
+
+#endif
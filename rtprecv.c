@@ -0,0 +1,162 @@
+#include <errno.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "latency.h"
+#include "rtpdepay.h"
+
+/*
+RTP receiver for testing the rtp: output, e.g. over loopback:
+
+  ./rtprecv 5004 received.h264 &
+  ./h264 -o rtp:127.0.0.1:5004
+
+It checks the sequence continuity, reassembles the frames (written to FILE if
+given, only the complete ones) and prints every second the packets, the lost
+and late ones, the frames and the latency from the capture to the arrival of
+the last packet of the frame. The RTP timestamps have a random offset, so the
+latency is relative to the lowest one seen, like latency.h without the STC: it
+shows the jitter and the tail added by the network and the receiver.
+*/
+
+//Maximum size of a frame
+#define RTPRECV_FRAME_SIZE (4*1024*1024)
+//Receive buffer, it must hold the burst of an IDR frame
+#define RTPRECV_RCVBUF (4*1024*1024)
+//Statistics interval (ms)
+#define RTPRECV_INTERVAL 1000
+
+static volatile sig_atomic_t stop = 0;
+
+static void signal_handler (int signal){
+  stop = 1;
+}
+
+static int64_t now (){
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  return (int64_t)spec.tv_sec*1000000 + spec.tv_nsec/1000;
+}
+
+static int bind_udp (const char* address){
+  char host[256] = "";
+  const char* port = strrchr (address, ':');
+  if (port){
+    if (port - address >= (int)sizeof (host)){
+      fprintf (stderr, "error: invalid address: %s\n", address);
+      exit (1);
+    }
+    memcpy (host, address, port - address);
+    host[port - address] = 0;
+    port++;
+  }else{
+    port = address;
+  }
+
+  struct addrinfo hints;
+  struct addrinfo* result;
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_DGRAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo (*host ? host : 0, port, &hints, &result)){
+    fprintf (stderr, "error: getaddrinfo\n");
+    exit (1);
+  }
+  int fd = socket (result->ai_family, result->ai_socktype,
+      result->ai_protocol);
+  if (fd == -1 || bind (fd, result->ai_addr, result->ai_addrlen)){
+    fprintf (stderr, "error: bind\n");
+    exit (1);
+  }
+  freeaddrinfo (result);
+
+  int size = RTPRECV_RCVBUF;
+  setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+  return fd;
+}
+
+static void dump (rtp_depay_t* depay, latency_t* latency){
+  char str[256];
+  latency_dump (latency, str, sizeof (str));
+  printf ("%llu packets, %u lost, %u late, %u frames, %u broken frames, "
+      "latency %s\n", (unsigned long long)depay->packets, depay->lost,
+      depay->reordered, depay->frames, depay->broken_frames, str);
+}
+
+int main (int argc, char** argv){
+  if (argc < 2 || argc > 3){
+    fprintf (stderr, "usage: rtprecv [HOST:]PORT [FILE]\n");
+    return 1;
+  }
+
+  int fd = bind_udp (argv[1]);
+  FILE* file = 0;
+  if (argc == 3 && !(file = fopen (argv[2], "wb"))){
+    fprintf (stderr, "error: fopen\n");
+    exit (1);
+  }
+
+  signal (SIGINT, signal_handler);
+  signal (SIGTERM, signal_handler);
+
+  rtp_depay_t depay;
+  rtp_depay_init (&depay, RTPRECV_FRAME_SIZE);
+  //The histogram is too big for the stack
+  static latency_t latency;
+  latency_init (&latency);
+  int64_t offset = 0;
+  int offset_valid = 0;
+  uint32_t last_timestamp = 0;
+  int64_t timestamp = 0;
+  int64_t next = now () + RTPRECV_INTERVAL*1000;
+  uint8_t packet[65536];
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+
+  while (!stop){
+    if (poll (&pfd, 1, RTPRECV_INTERVAL) == -1 && errno != EINTR){
+      fprintf (stderr, "error: poll\n");
+      exit (1);
+    }
+    ssize_t n;
+    while ((n = recv (fd, packet, sizeof (packet), MSG_DONTWAIT)) > 0){
+      if (rtp_depay_packet (&depay, packet, n) != 1) continue;
+
+      //The 90 kHz timestamps are unwrapped and compared with the arrival time
+      timestamp += (int32_t)(depay.timestamp - last_timestamp);
+      if (!offset_valid) timestamp = 0;
+      last_timestamp = depay.timestamp;
+      int64_t difference = now () - timestamp*100/9;
+      if (!offset_valid || difference < offset){
+        offset = difference;
+        offset_valid = 1;
+      }
+      latency_add (&latency, difference - offset);
+
+      if (file && !depay.broken &&
+          fwrite (depay.frame, 1, depay.frame_length, file) !=
+          depay.frame_length){
+        fprintf (stderr, "error: fwrite\n");
+        exit (1);
+      }
+    }
+    if (now () >= next){
+      dump (&depay, &latency);
+      next += RTPRECV_INTERVAL*1000;
+    }
+  }
+
+  rtp_depay_flush (&depay);
+  dump (&depay, &latency);
+  if (file) fclose (file);
+  rtp_depay_free (&depay);
+  close (fd);
+  return 0;
+}
@@ -0,0 +1,467 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "segment.h"
+#include "storage.h"
+
+//Default target duration of a segment (s)
+#define SEGMENT_DURATION 10
+#define SEGMENT_PATH_SIZE 512
+//Complete segments waiting for the writer threads
+#define SEGMENT_QUEUE_SIZE 16
+//Maximum entries of the playlist, the oldest ones are removed
+#define SEGMENT_PLAYLIST_MAX 1024
+
+typedef struct segment_sink_s segment_sink_t;
+
+typedef struct {
+  segment_sink_t* sink;
+  int fd;
+  uint32_t index;
+  //Seconds
+  double duration;
+} segment_job_t;
+
+//Playlist entry of a segment
+typedef struct {
+  double duration;
+  //Size of the file and, with MP4 segments, of its ftyp and moov boxes, the
+  //initialization section
+  uint64_t size;
+  uint32_t header;
+} segment_entry_t;
+
+struct segment_sink_s {
+  sink_t sink;
+  //Output that writes the segments, it's moved from file to file
+  sink_t* output;
+  char output_spec[SEGMENT_PATH_SIZE + 8];
+  char* pattern;
+  //Targets, 0 if not used (us, bytes)
+  int64_t duration;
+  uint64_t size;
+  char* playlist;
+  uint32_t window;
+  //The segments are fragmented MP4 files
+  int mp4;
+  //Catalog of the recordings and quota
+  storage_t storage;
+  //Number of the first segment of this run
+  uint32_t first_index;
+  //Current segment
+  uint32_t index;
+  int64_t start;
+  uint64_t length;
+  //Timestamp of the last frame and distance to the previous one, used for the
+  //duration of the last segment
+  int64_t timestamp;
+  int64_t interval;
+  int started;
+  int frame_start;
+  int requested;
+  //Segments that were longer than the target because the next file wasn't
+  //open yet
+  uint32_t late;
+  //Writer threads of the jobs, the shared ones or a private one
+  writer_t* writer;
+  writer_t own;
+  //Stream of the jobs that don't follow the data of the output: the next file
+  //is opened there, and the segments are finished there if the output is
+  //written synchronously
+  writer_stream_t* jobs;
+  //The fields below are protected by the mutex
+  pthread_mutex_t mutex;
+  //Complete segments that are not finished yet
+  int pending;
+  //Next file, already open, -1 if it's not ready yet
+  int next_fd;
+  uint32_t next_index;
+  //Playlist entries, only used by the jobs
+  segment_entry_t entries[SEGMENT_PLAYLIST_MAX];
+  uint32_t segments;
+};
+
+static void segment_path (
+    segment_sink_t* sink,
+    uint32_t index,
+    int part,
+    char* path,
+    size_t size){
+  int n = snprintf (path, size, sink->pattern, index);
+  if (n < 0 || (size_t)n + 5 >= size){
+    fprintf (stderr, "error: segment path too long: %s\n", sink->pattern);
+    exit (1);
+  }
+  if (part) strcat (path, ".part");
+}
+
+static void segment_playlist (segment_sink_t* sink, int end){
+  char path[SEGMENT_PATH_SIZE];
+  char segment[SEGMENT_PATH_SIZE];
+  uint32_t window = sink->window && sink->window < SEGMENT_PLAYLIST_MAX
+      ? sink->window : SEGMENT_PLAYLIST_MAX;
+  uint32_t first = sink->segments > sink->first_index + window ?
+      sink->segments - window : sink->first_index;
+  double target = 0;
+  uint32_t i;
+
+  for (i=first; i<sink->segments; i++){
+    if (sink->entries[i % SEGMENT_PLAYLIST_MAX].duration > target){
+      target = sink->entries[i % SEGMENT_PLAYLIST_MAX].duration;
+    }
+  }
+
+  //The playlist is replaced atomically, a reader never sees a partial one
+  snprintf (path, sizeof (path), "%s.tmp", sink->playlist);
+  FILE* file = fopen (path, "w");
+  if (!file){
+    fprintf (stderr, "error: fopen\n");
+    exit (1);
+  }
+  //The MP4 segments need version 7 for the initialization sections
+  fprintf (file, "#EXTM3U\n#EXT-X-VERSION:%u\n#EXT-X-TARGETDURATION:%u\n"
+      "#EXT-X-MEDIA-SEQUENCE:%u\n", sink->mp4 ? 7 : 3,
+      (uint32_t)(target + 0.999), first);
+  if (!sink->window){
+    fprintf (file, "#EXT-X-PLAYLIST-TYPE:EVENT\n");
+  }
+  for (i=first; i<sink->segments; i++){
+    segment_entry_t* entry = &sink->entries[i % SEGMENT_PLAYLIST_MAX];
+    segment_path (sink, i, 0, segment, sizeof (segment));
+    const char* name = strrchr (segment, '/');
+    name = name ? name + 1 : segment;
+    //Every MP4 segment starts with its own ftyp and moov boxes: they're its
+    //initialization section and the media segment is the rest of the file
+    if (entry->header){
+      fprintf (file, "#EXT-X-MAP:URI=\"%s\",BYTERANGE=\"%u@0\"\n"
+          "#EXT-X-BYTERANGE:%llu@%u\n", name, entry->header,
+          (unsigned long long)(entry->size - entry->header), entry->header);
+    }
+    fprintf (file, "#EXTINF:%.3f,\n%s\n", entry->duration, name);
+  }
+  if (end){
+    fprintf (file, "#EXT-X-ENDLIST\n");
+  }
+  if (fclose (file)){
+    fprintf (stderr, "error: fclose\n");
+    exit (1);
+  }
+  if (rename (path, sink->playlist)){
+    fprintf (stderr, "error: rename\n");
+    exit (1);
+  }
+}
+
+//Size of the ftyp and moov boxes at the beginning of an MP4 segment, 0 if
+//they're not there (the segment has no IDR frame)
+static uint32_t segment_mp4_header (const char* path){
+  uint8_t box[8];
+  uint32_t length = 0;
+  int i;
+
+  int fd = open (path, O_RDONLY);
+  if (fd == -1){
+    fprintf (stderr, "error: open\n");
+    exit (1);
+  }
+  for (i=0; i<2; i++){
+    if (pread (fd, box, sizeof (box), length) != sizeof (box) ||
+        memcmp (box + 4, i ? "moov" : "ftyp", 4)){
+      length = 0;
+      break;
+    }
+    length += ((uint32_t)box[0] << 24) | (box[1] << 16) | (box[2] << 8) |
+        box[3];
+  }
+  close (fd);
+  return length;
+}
+
+//Flushes a complete segment to disk and makes it visible with its final name
+static void segment_finish (segment_sink_t* sink, segment_job_t* job, int end){
+  char part[SEGMENT_PATH_SIZE];
+  char path[SEGMENT_PATH_SIZE];
+  segment_entry_t* entry = &sink->entries[job->index % SEGMENT_PLAYLIST_MAX];
+  struct stat st;
+
+  if (fsync (job->fd) || fstat (job->fd, &st) || close (job->fd)){
+    fprintf (stderr, "error: fsync\n");
+    exit (1);
+  }
+  segment_path (sink, job->index, 1, part, sizeof (part));
+  segment_path (sink, job->index, 0, path, sizeof (path));
+  entry->duration = job->duration;
+  entry->size = st.st_size;
+  entry->header = sink->mp4 && sink->playlist ? segment_mp4_header (part) : 0;
+  if (rename (part, path)){
+    fprintf (stderr, "error: rename\n");
+    exit (1);
+  }
+
+  sink->segments = job->index + 1;
+  if (sink->playlist) segment_playlist (sink, end);
+  storage_add (&sink->storage, job->index, (uint64_t)st.st_blocks*512);
+}
+
+static int segment_open (segment_sink_t* sink, uint32_t index){
+  char path[SEGMENT_PATH_SIZE];
+  segment_path (sink, index, 1, path, sizeof (path));
+  int fd = open (path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+  if (fd == -1){
+    fprintf (stderr, "error: open\n");
+    exit (1);
+  }
+  return fd;
+}
+
+//Job that opens the next file ahead of time
+static void segment_open_job (void* arg){
+  segment_sink_t* sink = (segment_sink_t*)arg;
+
+  pthread_mutex_lock (&sink->mutex);
+  uint32_t index = sink->next_index;
+  pthread_mutex_unlock (&sink->mutex);
+  int fd = segment_open (sink, index);
+  pthread_mutex_lock (&sink->mutex);
+  sink->next_fd = fd;
+  pthread_mutex_unlock (&sink->mutex);
+}
+
+//Job queued after the last byte of a segment
+static void segment_finish_job (void* arg){
+  segment_job_t* job = (segment_job_t*)arg;
+  segment_sink_t* sink = job->sink;
+
+  segment_finish (sink, job, 0);
+  pthread_mutex_lock (&sink->mutex);
+  sink->pending--;
+  pthread_mutex_unlock (&sink->mutex);
+  free (job);
+}
+
+//Moves the output to the next file. Called before the first buffer of an IDR
+//frame
+static void segment_rotate (segment_sink_t* sink, int64_t timestamp){
+  pthread_mutex_lock (&sink->mutex);
+  int fd = sink->next_fd;
+  if (fd == -1 || sink->pending == SEGMENT_QUEUE_SIZE){
+    //The disk is slow, the segment will end at a later IDR frame
+    pthread_mutex_unlock (&sink->mutex);
+    sink->late++;
+    sink->requested = 0;
+    return;
+  }
+  sink->next_fd = -1;
+  sink->next_index = sink->index + 2;
+  sink->pending++;
+  pthread_mutex_unlock (&sink->mutex);
+
+  segment_job_t* job = malloc (sizeof (segment_job_t));
+  if (!job){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+  job->sink = sink;
+  job->fd = sink->output->rotate (sink->output, fd);
+  job->index = sink->index;
+  job->duration = (timestamp - sink->start)/1.0e6;
+
+  //The segment is finished once its data has been written
+  writer_job (sink->output->stream ? sink->output->stream : sink->jobs,
+      segment_finish_job, job);
+  writer_job (sink->jobs, segment_open_job, sink);
+
+  sink->index++;
+  sink->start = timestamp;
+  sink->length = 0;
+  sink->requested = 0;
+}
+
+static void segment_sink_write (sink_t* base, stream_buffer_t* buffer){
+  segment_sink_t* sink = (segment_sink_t*)base;
+  int config = buffer->flags & STREAM_FLAG_CODECCONFIG;
+
+  if (!config && sink->frame_start){
+    if (!sink->started){
+      sink->start = buffer->timestamp;
+      sink->timestamp = buffer->timestamp;
+      sink->started = 1;
+    }
+    sink->interval = buffer->timestamp - sink->timestamp;
+    sink->timestamp = buffer->timestamp;
+    if ((sink->duration && buffer->timestamp - sink->start >= sink->duration) ||
+        (sink->size && sink->length >= sink->size)){
+      if (buffer->flags & STREAM_FLAG_SYNCFRAME){
+        segment_rotate (sink, buffer->timestamp);
+      }else if (!sink->requested && base->idr){
+        idr_request (base->idr);
+        sink->requested = 1;
+      }
+    }
+  }
+
+  sink->output->idr = base->idr;
+  sink->output->paramsets = base->paramsets;
+  sink->output->audio = base->audio;
+  sink->output->write (sink->output, buffer);
+  sink->length += buffer->length;
+  if (!config){
+    sink->frame_start = (buffer->flags & STREAM_FLAG_ENDOFFRAME) != 0;
+  }
+
+  base->bytes = sink->output->bytes;
+  base->frames = sink->output->frames;
+  base->dropped_frames = sink->output->dropped_frames;
+}
+
+static void segment_sink_close (sink_t* base){
+  segment_sink_t* sink = (segment_sink_t*)base;
+
+  //The output flushes its data and the jobs that follow it
+  sink->output->close (sink->output);
+  writer_flush (sink->jobs);
+
+  //The file opened ahead of time is not needed
+  char path[SEGMENT_PATH_SIZE];
+  if (sink->next_fd != -1){
+    close (sink->next_fd);
+    segment_path (sink, sink->next_index, 1, path, sizeof (path));
+    unlink (path);
+  }
+
+  //The last segment is finished here
+  segment_path (sink, sink->index, 1, path, sizeof (path));
+  segment_job_t job;
+  if ((job.fd = open (path, O_RDONLY)) == -1){
+    fprintf (stderr, "error: open\n");
+    exit (1);
+  }
+  job.index = sink->index;
+  job.duration = (sink->timestamp + sink->interval - sink->start)/1.0e6;
+  segment_finish (sink, &job, 1);
+
+  printf ("segment %s: %u segments, %u late\n", base->name,
+      sink->index - sink->first_index + 1, sink->late);
+  storage_close (&sink->storage);
+
+  writer_stream_close (sink->jobs);
+  if (sink->writer == &sink->own) writer_close (&sink->own);
+  pthread_mutex_destroy (&sink->mutex);
+  free (sink->pattern);
+  free (sink->playlist);
+  free (sink);
+}
+
+sink_t* segment_sink_open (const char* spec){
+  segment_sink_t* sink = calloc (1, sizeof (segment_sink_t));
+  if (!sink){
+    fprintf (stderr, "error: calloc\n");
+    exit (1);
+  }
+  sink->sink.name = spec;
+  sink->sink.write = segment_sink_write;
+  sink->sink.close = segment_sink_close;
+  sink->frame_start = 1;
+  sink->next_fd = -1;
+
+  //segment:PATTERN[,option=value]...
+  char* options = strchr (spec, ',');
+  size_t length = options ? (size_t)(options - spec) : strlen (spec);
+  char* pattern = strndup (spec + 8, length - 8);
+  if (!pattern){
+    fprintf (stderr, "error: strndup\n");
+    exit (1);
+  }
+  sink->pattern = pattern;
+
+  //A single unsigned conversion, the pattern is used as a format string
+  char* conversion = strchr (pattern, '%');
+  if (!conversion || strchr (conversion + 1, '%') ||
+      conversion[1 + strspn (conversion + 1, "0123456789")] != 'u'){
+    fprintf (stderr, "error: invalid segment pattern: %s\n", pattern);
+    exit (1);
+  }
+
+  unsigned int duration = 0;
+  unsigned int size = 0;
+  char* quota = 0;
+  char* value;
+  while (options){
+    options++;
+    value = strchr (options, '=');
+    length = strcspn (options, ",");
+    if (sscanf (options, "duration=%u", &duration) != 1 &&
+        sscanf (options, "size=%u", &size) != 1 &&
+        sscanf (options, "window=%u", &sink->window) != 1){
+      if (value && value - options == 8 &&
+          !strncmp (options, "playlist", 8)){
+        sink->playlist = strndup (value + 1, length - 9);
+      }else if (value && value - options == 5 &&
+          !strncmp (options, "quota", 5)){
+        quota = strndup (value + 1, length - 6);
+      }else{
+        fprintf (stderr, "error: invalid segment option: %s\n", options);
+        exit (1);
+      }
+    }
+    options = strchr (options, ',');
+  }
+  if (!duration && !size) duration = SEGMENT_DURATION;
+  sink->duration = (int64_t)duration*1000000;
+  sink->size = (uint64_t)size*1024*1024;
+
+  //The numbering continues after the recordings of the previous runs
+  storage_open (&sink->storage, pattern, quota);
+  free (quota);
+  sink->index = sink->storage.next_index;
+  sink->first_index = sink->index;
+  sink->next_index = sink->index + 1;
+
+  //The output that writes the first segment, the same output is moved to the
+  //next files
+  char path[SEGMENT_PATH_SIZE];
+  segment_path (sink, sink->index, 1, path, sizeof (path));
+  length = strlen (pattern);
+  const char* prefix = "";
+  if (length > 4 && !strcmp (pattern + length - 4, ".mp4")){
+    prefix = "mp4:";
+    sink->mp4 = 1;
+  }else if (length > 3 && !strcmp (pattern + length - 3, ".ts")){
+    prefix = "ts:";
+  }else if (sink->playlist){
+    //HLS has no Annex-B segments
+    fprintf (stderr, "error: the playlist needs .ts or .mp4 segments: %s\n",
+        pattern);
+    exit (1);
+  }
+  snprintf (sink->output_spec, sizeof (sink->output_spec), "%s%s", prefix,
+      path);
+  sink->output = sink_open (sink->output_spec);
+  if (!sink->output->rotate){
+    fprintf (stderr, "error: invalid segment output: %s\n", pattern);
+    exit (1);
+  }
+
+  if (pthread_mutex_init (&sink->mutex, 0)){
+    fprintf (stderr, "error: pthread_mutex_init\n");
+    exit (1);
+  }
+  //Without the shared writer threads the output is written synchronously and
+  //a private thread runs the jobs
+  if (!(sink->writer = sink_writer ())){
+    writer_init (&sink->own, 1, 0);
+    sink->writer = &sink->own;
+  }
+  sink->jobs = writer_stream_open (sink->writer, spec, -1, 0);
+  writer_job (sink->jobs, segment_open_job, sink);
+
+  return &sink->sink;
+}
@@ -0,0 +1,39 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include "sink.h"
+
+/*
+Segmented recording. The stream is written to a sequence of files and a new
+file is started at the first IDR frame after the segment reaches the target
+duration or size, so every segment starts with the SPS/PPS and an IDR frame and
+it can be decoded on its own. When the target is reached an IDR frame is
+requested, the IDR period of the encoder can be disabled.
+
+The format of the segments is chosen by the extension of the pattern, like the
+other outputs: .mp4 (fragmented MP4), .ts (MPEG-TS) or anything else (H.264
+Annex-B). The pattern must have a single %u (%05u, etc.) conversion, replaced by
+the segment number.
+
+The hot path only switches the file descriptor. The writer threads (see
+writer.h, a private one if they're not used) open the next file ahead of time
+and, once the last byte of a segment has been written, they flush it to disk
+with fsync(), rename it from PATH.part to PATH and update the playlist. The
+playlist is a HLS media playlist (m3u8) that lists the last "window" segments
+of the run (all of them if 0). It needs .ts or .mp4 segments: the .mp4 ones are
+listed with byte ranges (version 7), the ftyp and moov boxes at the beginning
+of every file are its initialization section (EXT-X-MAP).
+
+The numbering continues after the existing recordings, and the oldest ones are
+deleted when they exceed the quota, in MB or a percentage of the file system
+(see storage.h).
+
+Output specification:
+
+  segment:PATTERN[,duration=S][,size=MB][,playlist=PATH][,window=N]
+      [,quota=MB|N%]
+*/
+
+sink_t* segment_sink_open (const char* spec);
+
+#endif
@@ -0,0 +1,542 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "rt.h"
+#include "server.h"
+
+//Size of the shared ring (bytes and buffers)
+#define SERVER_RING_SIZE (8*1024*1024)
+#define SERVER_ENTRIES 4096
+#define SERVER_CLIENTS_MAX 64
+//A client that is this far behind jumps to the most recent IDR frame
+#define SERVER_LAG_MAX (2*1024*1024)
+//Maximum bytes written to a client in a single call
+#define SERVER_WRITE_MAX (256*1024)
+//The ring is not locked while the data is written to a client, so a client
+//whose data is closer than this to being overwritten by the encoder skips
+#define SERVER_GUARD (1024*1024)
+
+typedef struct {
+  //Absolute position in the ring
+  uint64_t position;
+  uint32_t length;
+  uint32_t flags;
+  //First buffer of a frame
+  int frame_start;
+} server_entry_t;
+
+typedef struct {
+  int fd;
+  //Buffer being sent and absolute position of the next byte to send
+  uint64_t cursor;
+  uint64_t position;
+  //Copy of the SPS/PPS being sent, its generation and bytes of it already sent
+  uint8_t config[PARAMSETS_SIZE];
+  uint32_t config_length;
+  uint32_t config_generation;
+  uint32_t config_offset;
+  //The SPS/PPS must be sent before the next buffer
+  int config_pending;
+  //Waiting for the next IDR frame
+  int resync;
+  //Waiting for EPOLLOUT
+  int blocked;
+  //Statistics
+  uint64_t bytes;
+  uint32_t skips;
+  uint64_t lag_max;
+} server_client_t;
+
+typedef struct {
+  sink_t sink;
+  int listen_fd;
+  int event_fd;
+  int epoll_fd;
+  pthread_t thread;
+  int stop;
+  //The ring is protected by the mutex, the clients are only used by the event
+  //loop
+  pthread_mutex_t mutex;
+  uint8_t* ring;
+  server_entry_t entries[SERVER_ENTRIES];
+  //Oldest buffer, next buffer and most recent IDR frame
+  uint64_t tail;
+  uint64_t head;
+  uint64_t idr;
+  int idr_valid;
+  uint64_t position;
+  int frame_start;
+  //Copy of the cached SPS/PPS, sent first to every client
+  uint8_t config[PARAMSETS_SIZE];
+  uint32_t config_length;
+  uint32_t config_generation;
+  server_client_t clients[SERVER_CLIENTS_MAX];
+  //CPU time used by the event loop
+  struct timespec cpu;
+  struct timespec started;
+} server_t;
+
+static void server_epoll (server_t* server, int op, int fd, uint32_t events){
+  struct epoll_event ev;
+  ev.events = events;
+  ev.data.fd = fd;
+  if (epoll_ctl (server->epoll_fd, op, fd, &ev)){
+    fprintf (stderr, "error: epoll_ctl\n");
+    exit (1);
+  }
+}
+
+static void server_client_close (server_t* server, server_client_t* client){
+  printf ("server %s: client %d: %llu bytes, %u skips, max lag %llu KiB\n",
+      server->sink.name, client->fd, (unsigned long long)client->bytes,
+      client->skips, (unsigned long long)client->lag_max/1024);
+  close (client->fd);
+  client->fd = -1;
+}
+
+//Moves the cursor of a client to the most recent IDR frame, or makes it wait
+//for the next one. Called with the mutex locked
+static void server_client_skip (server_t* server, server_client_t* client){
+  if (server->idr_valid && server->idr >= server->tail){
+    client->cursor = server->idr;
+    client->position = server->entries[server->idr % SERVER_ENTRIES].position;
+    client->resync = 0;
+  }else{
+    client->cursor = server->head;
+    client->position = server->position;
+    client->resync = 1;
+    if (server->sink.idr) idr_request (server->sink.idr);
+  }
+  //The SPS/PPS may have changed in the skipped data. A copy that is being
+  //sent is finished first, it cannot be cut
+  client->config_pending = 1;
+}
+
+//Returns 1 if the data from position has been overwritten, or it's about to
+//be. Called with the mutex locked
+static int server_overwritten (server_t* server, uint64_t position,
+    uint64_t guard){
+  return server->position - position + guard > SERVER_RING_SIZE;
+}
+
+//Prepares the next write to a client, the SPS/PPS (config is set) or the data
+//from its position. Called with the mutex locked. Returns the number of
+//iovecs, 0 if the client is up to date
+static int server_client_window (
+    server_t* server,
+    server_client_t* client,
+    struct iovec* iov,
+    int* config){
+  server_entry_t* entry;
+
+  //Slow client: its data has been overwritten or it's too far behind
+  if (client->cursor < server->tail ||
+      server_overwritten (server, client->position, SERVER_GUARD)){
+    server_client_skip (server, client);
+    client->skips++;
+  }else if (client->cursor < server->head){
+    uint64_t lag = server->position - client->position;
+    if (lag > client->lag_max) client->lag_max = lag;
+    if (lag > SERVER_LAG_MAX && server->idr_valid &&
+        server->idr > client->cursor){
+      server_client_skip (server, client);
+      client->skips++;
+    }
+  }
+
+  //The SPS/PPS are copied, the encoder can replace them during the write. The
+  //copy is sent whole, or replaced by the current one if it hasn't started
+  if ((client->config_pending &&
+      client->config_offset == client->config_length) ||
+      (!client->config_offset && client->config_length &&
+      client->config_generation != server->config_generation)){
+    client->config_pending = 0;
+    client->config_offset = 0;
+    memcpy (client->config, server->config, server->config_length);
+    client->config_length = server->config_length;
+    client->config_generation = server->config_generation;
+  }
+  if (client->config_offset < client->config_length){
+    iov[0].iov_base = client->config + client->config_offset;
+    iov[0].iov_len = client->config_length - client->config_offset;
+    *config = 1;
+    return 1;
+  }
+  *config = 0;
+
+  //Buffers already sent, or skipped while waiting for an IDR frame
+  while (client->cursor < server->head){
+    entry = &server->entries[client->cursor % SERVER_ENTRIES];
+    if (client->resync &&
+        (!entry->frame_start || !(entry->flags & STREAM_FLAG_SYNCFRAME))){
+      client->position = entry->position + entry->length;
+    }else{
+      client->resync = 0;
+    }
+    if (client->position < entry->position + entry->length) break;
+    client->cursor++;
+  }
+  if (client->cursor == server->head) return 0;
+
+  //The buffers are contiguous in the ring, several of them are sent at once.
+  //The data may wrap around the end of the ring
+  uint64_t length = server->position - client->position;
+  if (length > SERVER_WRITE_MAX) length = SERVER_WRITE_MAX;
+  uint32_t start = client->position % SERVER_RING_SIZE;
+  iov[0].iov_base = server->ring + start;
+  iov[0].iov_len = length;
+  if (start + length <= SERVER_RING_SIZE) return 1;
+  iov[0].iov_len = SERVER_RING_SIZE - start;
+  iov[1].iov_base = server->ring;
+  iov[1].iov_len = length - iov[0].iov_len;
+  return 2;
+}
+
+//Writes as much as possible to a client. The ring is locked only to find the
+//data to send and to check afterwards that it wasn't overwritten, so the
+//encoder never waits for a write to a client
+static void server_client_send (server_t* server, server_client_t* client){
+  struct iovec iov[2];
+  int config;
+  int count;
+  ssize_t n;
+
+  while (1){
+    pthread_mutex_lock (&server->mutex);
+    count = server_client_window (server, client, iov, &config);
+    pthread_mutex_unlock (&server->mutex);
+    if (!count) break;
+
+    n = writev (client->fd, iov, count);
+    if (n == -1){
+      if (errno == EINTR) continue;
+      if (errno == EAGAIN) break;
+      server_client_close (server, client);
+      return;
+    }
+    client->bytes += n;
+
+    if (config){
+      client->config_offset += n;
+      continue;
+    }
+
+    //The guard makes it very unlikely, but if the encoder went round the ring
+    //during the write, the client got damaged data, like a skip
+    pthread_mutex_lock (&server->mutex);
+    if (server_overwritten (server, client->position, 0)){
+      server_client_skip (server, client);
+      client->skips++;
+    }else{
+      client->position += n;
+    }
+    pthread_mutex_unlock (&server->mutex);
+  }
+
+  //Wait for EPOLLOUT only while there's something to send
+  int blocked = count != 0;
+  if (blocked != client->blocked){
+    client->blocked = blocked;
+    server_epoll (server, EPOLL_CTL_MOD, client->fd,
+        EPOLLIN | (blocked ? EPOLLOUT : 0));
+  }
+}
+
+static void server_accept (server_t* server){
+  int fd;
+  int i;
+
+  while ((fd = accept4 (server->listen_fd, 0, 0, SOCK_NONBLOCK)) != -1){
+    for (i=0; i<SERVER_CLIENTS_MAX && server->clients[i].fd != -1; i++);
+    if (i == SERVER_CLIENTS_MAX){
+      fprintf (stderr, "error: server %s: too many clients\n",
+          server->sink.name);
+      close (fd);
+      continue;
+    }
+
+    int on = 1;
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on));
+
+    server_client_t* client = &server->clients[i];
+    memset (client, 0, sizeof (server_client_t));
+    client->fd = fd;
+    server_epoll (server, EPOLL_CTL_ADD, fd, EPOLLIN);
+
+    pthread_mutex_lock (&server->mutex);
+    server_client_skip (server, client);
+    pthread_mutex_unlock (&server->mutex);
+    server_client_send (server, client);
+
+    //The IDR frame in the ring can be old, ask for a new one so the client
+    //doesn't have to catch up
+    if (server->sink.idr) idr_request (server->sink.idr);
+  }
+}
+
+static server_client_t* server_client (server_t* server, int fd){
+  int i;
+  for (i=0; i<SERVER_CLIENTS_MAX; i++){
+    if (server->clients[i].fd == fd) return &server->clients[i];
+  }
+  return 0;
+}
+
+static void* server_loop (void* arg){
+  server_t* server = (server_t*)arg;
+  struct epoll_event events[SERVER_CLIENTS_MAX + 2];
+  server_client_t* client;
+  uint64_t value;
+  char discard[256];
+  int n;
+  int i;
+
+  rt_thread (RT_NETWORK);
+
+  while (!server->stop){
+    if ((n = epoll_wait (server->epoll_fd, events, SERVER_CLIENTS_MAX + 2,
+        -1)) == -1){
+      if (errno == EINTR) continue;
+      fprintf (stderr, "error: epoll_wait\n");
+      exit (1);
+    }
+
+    for (i=0; i<n; i++){
+      int fd = events[i].data.fd;
+
+      if (fd == server->listen_fd){
+        server_accept (server);
+      }else if (fd == server->event_fd){
+        //New data in the ring, wake up the clients that were up to date
+        if (read (server->event_fd, &value, sizeof (value)) == -1) continue;
+        int j;
+        for (j=0; j<SERVER_CLIENTS_MAX; j++){
+          client = &server->clients[j];
+          if (client->fd != -1 && !client->blocked){
+            server_client_send (server, client);
+          }
+        }
+      }else if ((client = server_client (server, fd))){
+        if (events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)){
+          //The clients don't send anything, a read means a disconnection
+          ssize_t r = read (fd, discard, sizeof (discard));
+          if (!r || (r == -1 && errno != EAGAIN && errno != EINTR)){
+            server_client_close (server, client);
+          }
+        }
+        if (client->fd != -1 && (events[i].events & EPOLLOUT)){
+          server_client_send (server, client);
+        }
+      }
+    }
+  }
+
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &server->cpu);
+  return 0;
+}
+
+//Appends a buffer to the ring. Called with the mutex locked
+static void server_append (server_t* server, stream_buffer_t* buffer){
+  //Drop the oldest buffers until there's room
+  while (server->tail < server->head &&
+      (server->head - server->tail == SERVER_ENTRIES ||
+      server->position + buffer->length -
+      server->entries[server->tail % SERVER_ENTRIES].position >
+      SERVER_RING_SIZE)){
+    server->tail++;
+  }
+
+  server_entry_t* entry = &server->entries[server->head % SERVER_ENTRIES];
+  entry->position = server->position;
+  entry->length = buffer->length;
+  entry->flags = buffer->flags;
+  entry->frame_start = server->frame_start;
+
+  uint32_t start = server->position % SERVER_RING_SIZE;
+  uint32_t length = buffer->length;
+  if (start + length > SERVER_RING_SIZE){
+    length = SERVER_RING_SIZE - start;
+    memcpy (server->ring, buffer->data + length, buffer->length - length);
+  }
+  memcpy (server->ring + start, buffer->data, length);
+
+  if (entry->frame_start && (buffer->flags & STREAM_FLAG_SYNCFRAME)){
+    server->idr = server->head;
+    server->idr_valid = 1;
+  }
+  server->position += buffer->length;
+  server->head++;
+}
+
+static void server_sink_write (sink_t* base, stream_buffer_t* buffer){
+  server_t* server = (server_t*)base;
+  uint64_t value = 1;
+
+  pthread_mutex_lock (&server->mutex);
+
+  //The SPS/PPS buffers go to the ring like any other buffer, so the connected
+  //clients get them in order, and a copy is kept for the new clients
+  paramsets_t* paramsets = base->paramsets;
+  if (paramsets && paramsets->complete &&
+      paramsets->generation != server->config_generation){
+    memcpy (server->config, paramsets->data, paramsets->length);
+    server->config_length = paramsets->length;
+    server->config_generation = paramsets->generation;
+  }
+
+  if (buffer->length > SERVER_RING_SIZE/2){
+    //It doesn't fit, the clients will wait for the next IDR frame
+    base->dropped_frames++;
+    server->idr_valid = 0;
+    server->tail = server->head;
+  }else{
+    server_append (server, buffer);
+    base->bytes += buffer->length;
+  }
+  if (!(buffer->flags & STREAM_FLAG_CODECCONFIG)){
+    server->frame_start = (buffer->flags & STREAM_FLAG_ENDOFFRAME) != 0;
+    if (server->frame_start) base->frames++;
+  }
+
+  pthread_mutex_unlock (&server->mutex);
+
+  if (write (server->event_fd, &value, sizeof (value)) == -1){
+    fprintf (stderr, "error: write\n");
+    exit (1);
+  }
+}
+
+static void server_sink_close (sink_t* base){
+  server_t* server = (server_t*)base;
+  uint64_t value = 1;
+  struct timespec now;
+  int i;
+
+  server->stop = 1;
+  if (write (server->event_fd, &value, sizeof (value)) == -1 ||
+      pthread_join (server->thread, 0)){
+    fprintf (stderr, "error: pthread_join\n");
+    exit (1);
+  }
+
+  for (i=0; i<SERVER_CLIENTS_MAX; i++){
+    if (server->clients[i].fd != -1){
+      server_client_close (server, &server->clients[i]);
+    }
+  }
+
+  clock_gettime (CLOCK_MONOTONIC, &now);
+  double cpu = server->cpu.tv_sec + server->cpu.tv_nsec/1.0e9;
+  double wall = (now.tv_sec - server->started.tv_sec) +
+      (now.tv_nsec - server->started.tv_nsec)/1.0e9;
+  printf ("server %s: event loop cpu %.3f s (%.2f%%)\n", base->name, cpu,
+      wall > 0 ? cpu*100/wall : 0);
+
+  close (server->listen_fd);
+  close (server->event_fd);
+  close (server->epoll_fd);
+  pthread_mutex_destroy (&server->mutex);
+  free (server->ring);
+  free (server);
+}
+
+static int server_listen (const char* address){
+  char host[256];
+  const char* port = strrchr (address, ':');
+  if (port){
+    if (port - address >= (int)sizeof (host)){
+      fprintf (stderr, "error: invalid address: %s\n", address);
+      exit (1);
+    }
+    memcpy (host, address, port - address);
+    host[port - address] = 0;
+    port++;
+  }else{
+    port = address;
+  }
+
+  struct addrinfo hints;
+  struct addrinfo* result;
+  struct addrinfo* ai;
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  hints.ai_flags = AI_PASSIVE;
+  if (getaddrinfo (port == address ? 0 : host, port, &hints, &result)){
+    fprintf (stderr, "error: getaddrinfo\n");
+    exit (1);
+  }
+
+  int fd = -1;
+  int on = 1;
+  for (ai=result; ai; ai=ai->ai_next){
+    if ((fd = socket (ai->ai_family, ai->ai_socktype | SOCK_NONBLOCK,
+        ai->ai_protocol)) == -1){
+      continue;
+    }
+    setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+    if (!bind (fd, ai->ai_addr, ai->ai_addrlen) && !listen (fd, 16)) break;
+    close (fd);
+    fd = -1;
+  }
+  freeaddrinfo (result);
+  if (fd == -1){
+    fprintf (stderr, "error: listen\n");
+    exit (1);
+  }
+
+  return fd;
+}
+
+sink_t* server_sink_open (const char* spec){
+  server_t* server = calloc (1, sizeof (server_t));
+  if (!server || !(server->ring = malloc (SERVER_RING_SIZE))){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+  server->sink.name = spec;
+  server->sink.write = server_sink_write;
+  server->sink.close = server_sink_close;
+  server->frame_start = 1;
+  int i;
+  for (i=0; i<SERVER_CLIENTS_MAX; i++){
+    server->clients[i].fd = -1;
+  }
+
+  //server:[HOST:]PORT
+  server->listen_fd = server_listen (spec + 7);
+  if ((server->event_fd = eventfd (0, EFD_NONBLOCK)) == -1 ||
+      (server->epoll_fd = epoll_create1 (0)) == -1){
+    fprintf (stderr, "error: epoll_create1\n");
+    exit (1);
+  }
+  server_epoll (server, EPOLL_CTL_ADD, server->listen_fd, EPOLLIN);
+  server_epoll (server, EPOLL_CTL_ADD, server->event_fd, EPOLLIN);
+
+  //A client that goes away must not kill the process
+  signal (SIGPIPE, SIG_IGN);
+
+  clock_gettime (CLOCK_MONOTONIC, &server->started);
+  if (pthread_mutex_init (&server->mutex, 0) ||
+      pthread_create (&server->thread, 0, server_loop, server)){
+    fprintf (stderr, "error: pthread_create\n");
+    exit (1);
+  }
+
+  return &server->sink;
+}
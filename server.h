@@ -0,0 +1,24 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "sink.h"
+
+/*
+TCP server that sends the encoded stream to several clients. The buffers are
+copied once into a ring shared by all the clients and every client has its own
+read cursor, so a slow client never delays the others: when the ring overwrites
+the data that it didn't read yet, or it falls too far behind, it jumps to the
+most recent IDR frame. A new client receives the SPS/PPS and starts at the most
+recent IDR frame that is still in the ring.
+
+All the sockets are handled by a single thread with an epoll event loop. The
+ring is locked only to find the data to send to a client, never during the
+write, so the encoder doesn't wait for the clients. test/server_bench.c measures
+it with many local clients.
+
+Output specification: server:[HOST:]PORT
+*/
+
+sink_t* server_sink_open (const char* spec);
+
+#endif
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "shm.h"
+#include "shmring.h"
+
+typedef struct {
+  sink_t sink;
+  //Name of the shared memory, with the leading slash
+  char* name;
+  shmring_writer_t writer;
+  uint32_t config_generation;
+  //Waiting for the next IDR frame after a drop
+  int resync;
+  //An IDR frame has been requested because the last one is leaving the ring
+  int aging;
+  //Statistics
+  uint32_t published;
+} shm_t;
+
+static void shm_sink_write (sink_t* base, stream_buffer_t* buffer){
+  shm_t* shm = (shm_t*)base;
+
+  //The readers that resync get a copy of the SPS/PPS
+  paramsets_t* paramsets = base->paramsets;
+  if (paramsets && paramsets->complete &&
+      paramsets->generation != shm->config_generation){
+    shmring_writer_config (&shm->writer, paramsets->data, paramsets->length);
+    shm->config_generation = paramsets->generation;
+  }
+
+  if (shm->resync){
+    if (!(buffer->flags & STREAM_FLAG_SYNCFRAME) &&
+        !(buffer->flags & STREAM_FLAG_CODECCONFIG)){
+      if (buffer->flags & STREAM_FLAG_ENDOFFRAME) base->dropped_frames++;
+      return;
+    }
+    shm->resync = 0;
+  }
+
+  shmring_writer_append (&shm->writer, buffer->data, buffer->length,
+      buffer->timestamp, buffer->flags);
+  if (!(buffer->flags & (STREAM_FLAG_ENDOFFRAME | STREAM_FLAG_CODECCONFIG))){
+    return;
+  }
+  if (shmring_writer_publish (&shm->writer)){
+    shm->published++;
+    base->bytes += shm->writer.length;
+    if (buffer->flags & STREAM_FLAG_CODECCONFIG) return;
+    base->frames++;
+    //The readers can't ask for an IDR frame, so there's always one in the
+    //ring for those that resync
+    if (shm->writer.flags & STREAM_FLAG_SYNCFRAME){
+      shm->aging = 0;
+    }else if (!shm->aging && shmring_writer_idr_aging (&shm->writer)){
+      shm->aging = 1;
+      if (base->idr) idr_request (base->idr);
+    }
+  }else{
+    //Too big for the ring, the next frames can't be decoded without it
+    fprintf (stderr, "warning: shm %s: frame too big for the ring\n",
+        shm->name);
+    base->dropped_frames++;
+    shm->resync = 1;
+    if (base->idr) idr_request (base->idr);
+  }
+}
+
+static void shm_sink_close (sink_t* base){
+  shm_t* shm = (shm_t*)base;
+
+  printf ("shm %s: %u frames published, ring of %u KiB and %u frames\n",
+      shm->name, shm->published, shm->writer.header->size/1024,
+      shm->writer.header->slots);
+  shmring_writer_close (&shm->writer, shm->name);
+  free (shm->name);
+  free (shm);
+}
+
+sink_t* shm_sink_open (const char* spec){
+  shm_t* shm = calloc (1, sizeof (shm_t));
+  if (!shm){
+    fprintf (stderr, "error: calloc\n");
+    exit (1);
+  }
+  shm->sink.name = spec;
+  shm->sink.write = shm_sink_write;
+  shm->sink.close = shm_sink_close;
+
+  //shm:NAME[,size=MB][,frames=N]
+  uint32_t size = SHM_SIZE;
+  uint32_t frames = SHM_FRAMES;
+  const char* name = spec + 4;
+  if (*name == '/') name++;
+  size_t length = strcspn (name, ",");
+  const char* options = name + length;
+  const char* slash = strchr (name, '/');
+  if (!length || (slash && slash < options) ||
+      !(shm->name = malloc (length + 2))){
+    fprintf (stderr, "error: invalid shm output: %s\n", spec);
+    exit (1);
+  }
+  shm->name[0] = '/';
+  memcpy (shm->name + 1, name, length);
+  shm->name[length + 1] = 0;
+  while (*options){
+    options++;
+    if (sscanf (options, "size=%u", &size) != 1 &&
+        sscanf (options, "frames=%u", &frames) != 1){
+      fprintf (stderr, "error: invalid shm output: %s\n", spec);
+      exit (1);
+    }
+    options += strcspn (options, ",");
+  }
+  if (!size || size > 512 || frames < 2 || frames > 65536){
+    fprintf (stderr, "error: invalid shm output: %s\n", spec);
+    exit (1);
+  }
+
+  if (shmring_writer_open (&shm->writer, shm->name, size*1024*1024,
+      frames)){
+    fprintf (stderr, "error: shm_open: %s\n", shm->name);
+    exit (1);
+  }
+
+  return &shm->sink;
+}
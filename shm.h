@@ -0,0 +1,31 @@
+#ifndef SHM_H
+#define SHM_H
+
+#include "sink.h"
+
+/*
+Shared memory output for local processes (analytics, uploaders, live views).
+The frames are copied once into a ring in POSIX shared memory and any number of
+processes read them from there, with the client library of shmring.h. The
+readers are never waited for: a reader that is too slow is overrun and jumps to
+the most recent IDR frame by itself. The readers can't ask for an IDR frame, so
+one is requested when the last one reaches the older half of the ring.
+
+The buffers of a frame are published together at the end of the frame, with the
+timestamp and the flags of the encoder. A frame that doesn't fit in half the
+ring is dropped, and so are the next ones until an IDR frame, which is
+requested.
+
+Output specification: shm:NAME[,size=MB][,frames=N]
+
+NAME is the name of the shared memory (/dev/shm/NAME), it's removed when the
+output is closed. size is the size of the ring (8 MB by default) and frames is
+the number of frames it can hold (256 by default).
+*/
+
+#define SHM_SIZE 8
+#define SHM_FRAMES 256
+
+sink_t* shm_sink_open (const char* spec);
+
+#endif
@@ -0,0 +1,381 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "shmring.h"
+
+#define shmring_load(x) __atomic_load_n (&(x), __ATOMIC_ACQUIRE)
+#define shmring_store(x, v) __atomic_store_n (&(x), (v), __ATOMIC_RELEASE)
+
+//Maps the data ring twice, one copy after the other
+static uint8_t* shmring_map (int fd, uint32_t offset, uint32_t size, int prot){
+  uint8_t* base = mmap (0, 2*(size_t)size, PROT_NONE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (base == MAP_FAILED) return 0;
+  if (mmap (base, size, prot, MAP_SHARED | MAP_FIXED, fd, offset) ==
+      MAP_FAILED || mmap (base + size, size, prot, MAP_SHARED | MAP_FIXED,
+      fd, offset) == MAP_FAILED){
+    munmap (base, 2*(size_t)size);
+    return 0;
+  }
+  return base;
+}
+
+static uint32_t shmring_offset (uint32_t slots){
+  uint32_t page = sysconf (_SC_PAGESIZE);
+  uint32_t size = sizeof (shmring_header_t) + slots*sizeof (shmring_slot_t);
+  return (size + page - 1)/page*page;
+}
+
+//Marks the file of a previous writer closed, in case it crashed, so its
+//readers see the end of the stream
+static void shmring_orphan (const char* name){
+  shmring_header_t header;
+  shmring_header_t* mapped;
+  struct stat st;
+  int fd;
+
+  if ((fd = shm_open (name, O_RDWR, 0)) == -1) return;
+  if (!fstat (fd, &st) && st.st_size >= (off_t)sizeof (header) &&
+      pread (fd, &header, sizeof (header), 0) == sizeof (header) &&
+      header.magic == SHMRING_MAGIC && header.version == SHMRING_VERSION &&
+      (mapped = mmap (0, sizeof (header), PROT_READ | PROT_WRITE, MAP_SHARED,
+      fd, 0)) != MAP_FAILED){
+    shmring_store (mapped->closed, 1);
+    __atomic_add_fetch (&mapped->futex, 1, __ATOMIC_SEQ_CST);
+    syscall (SYS_futex, &mapped->futex, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+    munmap (mapped, sizeof (header));
+  }
+  close (fd);
+}
+
+int shmring_writer_open (
+    shmring_writer_t* writer,
+    const char* name,
+    uint32_t size,
+    uint32_t slots){
+  uint32_t page = sysconf (_SC_PAGESIZE);
+  uint32_t power = page;
+
+  memset (writer, 0, sizeof (shmring_writer_t));
+  if (slots < 2 || slots > 1U << 16 || !size || size > 1U << 30) return -1;
+  //Powers of two, so the positions and generations can wrap around
+  while (power < size) power *= 2;
+  size = power;
+  for (power=2; power<slots; power*=2);
+  slots = power;
+  uint32_t offset = shmring_offset (slots);
+
+  //A new file: truncating the old one would make its readers fault on the
+  //pages they have mapped
+  shmring_orphan (name);
+  shm_unlink (name);
+  if ((writer->fd = shm_open (name, O_RDWR | O_CREAT | O_EXCL, 0644)) == -1){
+    return -1;
+  }
+  if (ftruncate (writer->fd, (off_t)offset + size) ||
+      (writer->header = mmap (0, offset, PROT_READ | PROT_WRITE, MAP_SHARED,
+      writer->fd, 0)) == MAP_FAILED ||
+      !(writer->data = shmring_map (writer->fd, offset, size,
+      PROT_READ | PROT_WRITE))){
+    close (writer->fd);
+    shm_unlink (name);
+    return -1;
+  }
+
+  shmring_header_t* header = writer->header;
+  header->version = SHMRING_VERSION;
+  header->size = size;
+  header->offset = offset;
+  header->slots = slots;
+  //The slots are free
+  uint32_t i;
+  for (i=0; i<slots; i++) header->slot[i].generation = i - 1;
+  //The readers check the magic number last
+  shmring_store (header->magic, SHMRING_MAGIC);
+  writer->frame_start = 1;
+  return 0;
+}
+
+int shmring_writer_append (
+    shmring_writer_t* writer,
+    const uint8_t* data,
+    uint32_t length,
+    int64_t timestamp,
+    uint32_t flags){
+  shmring_header_t* header = writer->header;
+
+  if (writer->frame_start){
+    writer->frame_start = 0;
+    writer->length = 0;
+    writer->flags = 0;
+    writer->timestamp = timestamp;
+    writer->discard = 0;
+  }
+  writer->flags |= flags;
+  if (writer->discard) return -1;
+  if (writer->length + length > header->size/2){
+    writer->discard = 1;
+    return -1;
+  }
+
+  //Reserve the space before writing, so a reader that was using it notices
+  uint32_t start = writer->position + writer->length;
+  shmring_store (header->reserved, start + length);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  memcpy (writer->data + (start & (header->size - 1)), data, length);
+  writer->length += length;
+  return 0;
+}
+
+int shmring_writer_publish (shmring_writer_t* writer){
+  shmring_header_t* header = writer->header;
+  uint32_t generation = header->head;
+  shmring_slot_t* slot = &header->slot[generation % header->slots];
+
+  if (writer->frame_start) return 0;
+  writer->frame_start = 1;
+  if (writer->discard){
+    writer->position = header->reserved;
+    return 0;
+  }
+
+  //The generation is wrong while the slot is written. Nobody looks for
+  //generation - 1 in this slot
+  shmring_store (slot->generation, generation - 1);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  slot->position = writer->position;
+  slot->length = writer->length;
+  slot->flags = writer->flags;
+  slot->timestamp = writer->timestamp;
+  shmring_store (slot->generation, generation);
+
+  if ((writer->flags & STREAM_FLAG_SYNCFRAME) &&
+      !(writer->flags & STREAM_FLAG_CODECCONFIG)){
+    shmring_store (header->idr, generation);
+    shmring_store (header->idr_valid, 1);
+  }
+  writer->position += writer->length;
+  shmring_store (header->head, generation + 1);
+
+  __atomic_add_fetch (&header->futex, 1, __ATOMIC_SEQ_CST);
+  syscall (SYS_futex, &header->futex, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+  return 1;
+}
+
+int shmring_writer_idr_aging (shmring_writer_t* writer){
+  shmring_header_t* header = writer->header;
+
+  if (!header->idr_valid) return 1;
+  shmring_slot_t* slot = &header->slot[header->idr % header->slots];
+  return header->head - header->idr > header->slots/2 ||
+      writer->position - slot->position > header->size/2;
+}
+
+void shmring_writer_config (
+    shmring_writer_t* writer,
+    const uint8_t* data,
+    uint32_t length){
+  shmring_header_t* header = writer->header;
+
+  if (length > SHMRING_CONFIG_SIZE) return;
+  shmring_store (header->config_sequence, header->config_sequence + 1);
+  __atomic_thread_fence (__ATOMIC_SEQ_CST);
+  memcpy (header->config, data, length);
+  header->config_length = length;
+  shmring_store (header->config_sequence, header->config_sequence + 1);
+}
+
+void shmring_writer_close (shmring_writer_t* writer, const char* name){
+  shmring_header_t* header = writer->header;
+
+  shmring_store (header->closed, 1);
+  __atomic_add_fetch (&header->futex, 1, __ATOMIC_SEQ_CST);
+  syscall (SYS_futex, &header->futex, FUTEX_WAKE, INT_MAX, 0, 0, 0);
+
+  munmap (writer->data, 2*(size_t)header->size);
+  munmap (header, header->offset);
+  close (writer->fd);
+  shm_unlink (name);
+}
+
+//Returns 1 if the data at position hasn't been overwritten
+static int shmring_intact (shmring_reader_t* reader, uint32_t position){
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  return shmring_load (reader->header->reserved) - position <= reader->size;
+}
+
+//Jumps to the most recent IDR frame, or waits for the next one if its slot or
+//its data have been overwritten
+static void shmring_resync (shmring_reader_t* reader){
+  shmring_header_t* header = reader->header;
+
+  reader->config_pending = 1;
+  reader->resync = 1;
+  reader->cursor = shmring_load (header->head);
+  if (!shmring_load (header->idr_valid)) return;
+
+  uint32_t idr = shmring_load (header->idr);
+  shmring_slot_t* slot = &header->slot[idr % reader->slots];
+  if ((int32_t)(reader->cursor - idr) > (int32_t)reader->slots ||
+      shmring_load (slot->generation) != idr) return;
+  uint32_t position = slot->position;
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  if (shmring_load (slot->generation) == idr &&
+      shmring_intact (reader, position)){
+    reader->cursor = idr;
+  }
+}
+
+int shmring_reader_open (shmring_reader_t* reader, const char* name){
+  shmring_header_t header;
+  struct stat st;
+
+  memset (reader, 0, sizeof (shmring_reader_t));
+  if ((reader->fd = shm_open (name, O_RDONLY, 0)) == -1) return -1;
+  if (fstat (reader->fd, &st) || st.st_size < (off_t)sizeof (header) ||
+      pread (reader->fd, &header, sizeof (header), 0) != sizeof (header) ||
+      header.magic != SHMRING_MAGIC || header.version != SHMRING_VERSION ||
+      st.st_size < (off_t)header.offset + header.size ||
+      (reader->header = mmap (0, header.offset, PROT_READ, MAP_SHARED,
+      reader->fd, 0)) == MAP_FAILED){
+    close (reader->fd);
+    return -1;
+  }
+  if (!(reader->data = shmring_map (reader->fd, header.offset, header.size,
+      PROT_READ))){
+    munmap (reader->header, header.offset);
+    close (reader->fd);
+    return -1;
+  }
+  reader->size = header.size;
+  reader->slots = header.slots;
+  shmring_resync (reader);
+  return 0;
+}
+
+//Copies the SPS/PPS, returns their length
+static uint32_t shmring_config (shmring_reader_t* reader){
+  shmring_header_t* header = reader->header;
+  uint32_t sequence;
+  uint32_t length;
+
+  do{
+    while ((sequence = shmring_load (header->config_sequence)) & 1);
+    length = header->config_length;
+    if (length > SHMRING_CONFIG_SIZE) length = 0;
+    memcpy (reader->config, header->config, length);
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  }while (shmring_load (header->config_sequence) != sequence);
+
+  return length;
+}
+
+//Waits until the futex changes, returns 0 on timeout
+static int shmring_wait (shmring_reader_t* reader, uint32_t value,
+    int timeout){
+  struct timespec spec;
+
+  spec.tv_sec = timeout/1000;
+  spec.tv_nsec = (timeout%1000)*1000000L;
+  if (syscall (SYS_futex, &reader->header->futex, FUTEX_WAIT, value,
+      timeout < 0 ? 0 : &spec, 0, 0) == -1 && errno == ETIMEDOUT){
+    return 0;
+  }
+  return 1;
+}
+
+int shmring_read (
+    shmring_reader_t* reader,
+    shmring_frame_t* frame,
+    int timeout){
+  shmring_header_t* header = reader->header;
+  shmring_slot_t* slot;
+
+  while (1){
+    uint32_t futex = shmring_load (header->futex);
+    uint32_t head = shmring_load (header->head);
+
+    if (reader->cursor == head){
+      if (shmring_load (header->closed)) return -1;
+      if (!timeout || !shmring_wait (reader, futex, timeout)) return 0;
+      continue;
+    }
+
+    //The slot is read twice: if the generation changes in between, or the
+    //data has been overwritten, the frame is lost
+    slot = &header->slot[reader->cursor % reader->slots];
+    if ((int32_t)(head - reader->cursor) > (int32_t)reader->slots ||
+        shmring_load (slot->generation) != reader->cursor){
+      reader->overruns++;
+      shmring_resync (reader);
+      continue;
+    }
+    frame->position = slot->position;
+    frame->length = slot->length;
+    frame->flags = slot->flags;
+    frame->timestamp = slot->timestamp;
+    frame->generation = reader->cursor;
+    frame->data = reader->data + (frame->position & (reader->size - 1));
+    __atomic_thread_fence (__ATOMIC_ACQUIRE);
+    if (shmring_load (slot->generation) != reader->cursor ||
+        !shmring_intact (reader, frame->position)){
+      reader->overruns++;
+      shmring_resync (reader);
+      continue;
+    }
+
+    int sync = (frame->flags & STREAM_FLAG_SYNCFRAME) &&
+        !(frame->flags & STREAM_FLAG_CODECCONFIG);
+    if (reader->resync){
+      if (!sync){
+        reader->cursor++;
+        reader->skipped++;
+        continue;
+      }
+      reader->resync = 0;
+    }
+    //The SPS/PPS go before the IDR frame
+    if (sync && reader->config_pending){
+      reader->config_pending = 0;
+      uint32_t length = shmring_config (reader);
+      if (length){
+        frame->data = reader->config;
+        frame->length = length;
+        frame->flags = STREAM_FLAG_CODECCONFIG | STREAM_FLAG_ENDOFFRAME;
+        return 1;
+      }
+    }
+    reader->cursor++;
+    reader->frames++;
+    return 1;
+  }
+}
+
+int shmring_valid (shmring_reader_t* reader, const shmring_frame_t* frame){
+  if (frame->data == reader->config ||
+      shmring_intact (reader, frame->position)){
+    return 1;
+  }
+  //Unless the reader has already moved on
+  if (reader->cursor == frame->generation + 1){
+    reader->overruns++;
+    shmring_resync (reader);
+  }
+  return 0;
+}
+
+void shmring_reader_close (shmring_reader_t* reader){
+  munmap (reader->data, 2*(size_t)reader->size);
+  munmap (reader->header, reader->header->offset);
+  close (reader->fd);
+}
@@ -0,0 +1,163 @@
+#ifndef SHMRING_H
+#define SHMRING_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stream.h"
+
+/*
+Ring of encoded frames in POSIX shared memory, for local processes that want
+the stream without a copy per reader (see shm.h for the output). This file and
+shmring.c are the whole client library, they don't depend on the rest of the
+program:
+
+  shmring_reader_t reader;
+  shmring_frame_t frame;
+  if (shmring_reader_open (&reader, "/h264")) ...
+  while (shmring_read (&reader, &frame, -1) > 0){
+    use (frame.data, frame.length, frame.timestamp, frame.flags);
+    if (!shmring_valid (&reader, &frame)) ...the data was overwritten
+  }
+  shmring_reader_close (&reader);
+
+There's a single writer and any number of readers. The readers never write to
+the shared memory, every one has its own cursor and they don't need any lock:
+every frame has a slot with its generation (the number of the frame) and a
+reader checks the generation before and after reading the slot, and the data
+with the position reserved by the writer. A reader that has been overrun (its
+frame was overwritten) jumps to the most recent IDR frame if it's still in the
+ring, or waits for the next one, and gets the SPS/PPS first. The readers wait
+for new frames on a futex that the writer increments after every frame.
+
+The data ring is mapped twice, one copy after the other, so every frame is
+contiguous in memory even if it wraps around the end of the ring. The counters
+are 32 bits, so they're lock-free on every Raspberry Pi, and wrap around.
+*/
+
+#define SHMRING_MAGIC 0x34363268
+#define SHMRING_VERSION 1
+#define SHMRING_CONFIG_SIZE 512
+
+typedef struct {
+  //Number of the frame, it changes while the slot is written
+  volatile uint32_t generation;
+  //Position of the data in the ring
+  uint32_t position;
+  uint32_t length;
+  uint32_t flags;
+  int64_t timestamp;
+} shmring_slot_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t version;
+  //Size of the data ring, a power of two, and its offset in the file
+  uint32_t size;
+  uint32_t offset;
+  uint32_t slots;
+  //Set when the writer is gone
+  volatile uint32_t closed;
+  //Frames published
+  volatile uint32_t head;
+  //Generation of the most recent IDR frame
+  volatile uint32_t idr;
+  volatile uint32_t idr_valid;
+  //End of the data written so far, the data before end - size is overwritten
+  volatile uint32_t reserved;
+  //Incremented after every frame, the readers wait on it
+  volatile uint32_t futex;
+  //SPS/PPS, the sequence is odd while they're written
+  volatile uint32_t config_sequence;
+  uint32_t config_length;
+  uint8_t config[SHMRING_CONFIG_SIZE];
+  shmring_slot_t slot[];
+} shmring_header_t;
+
+typedef struct {
+  int fd;
+  shmring_header_t* header;
+  uint8_t* data;
+  //Frame being written, dropped if it doesn't fit
+  uint32_t position;
+  uint32_t length;
+  uint32_t flags;
+  int64_t timestamp;
+  int frame_start;
+  int discard;
+} shmring_writer_t;
+
+typedef struct {
+  int fd;
+  shmring_header_t* header;
+  uint8_t* data;
+  uint32_t size;
+  uint32_t slots;
+  //Next frame
+  uint32_t cursor;
+  //Waiting for an IDR frame, and the SPS/PPS must be returned first
+  int resync;
+  int config_pending;
+  uint8_t config[SHMRING_CONFIG_SIZE];
+  //Statistics
+  uint32_t frames;
+  uint32_t overruns;
+  uint32_t skipped;
+} shmring_reader_t;
+
+typedef struct {
+  //Points to the shared memory, valid until the writer overwrites it
+  const uint8_t* data;
+  uint32_t length;
+  int64_t timestamp;
+  //STREAM_FLAG_*
+  uint32_t flags;
+  uint32_t generation;
+  uint32_t position;
+} shmring_frame_t;
+
+//Creates the shared memory (NAME as in shm_open()). size and slots are rounded
+//up to powers of two. An existing one is closed and replaced by a new file,
+//its readers keep their mapping and shmring_read() returns -1. Returns 0 on
+//success
+int shmring_writer_open (
+    shmring_writer_t* writer,
+    const char* name,
+    uint32_t size,
+    uint32_t slots);
+//Appends a buffer to the current frame. Returns -1 if the frame doesn't fit
+int shmring_writer_append (
+    shmring_writer_t* writer,
+    const uint8_t* data,
+    uint32_t length,
+    int64_t timestamp,
+    uint32_t flags);
+//Publishes the current frame and wakes up the readers. Returns 0 if the frame
+//has been dropped
+int shmring_writer_publish (shmring_writer_t* writer);
+//Returns 1 if there's no IDR frame in the newer half of the ring (frames or
+//data), the readers that resync soon may have to wait for the next one
+int shmring_writer_idr_aging (shmring_writer_t* writer);
+//Copies the SPS/PPS given to the readers that resync
+void shmring_writer_config (
+    shmring_writer_t* writer,
+    const uint8_t* data,
+    uint32_t length);
+//Tells the readers that the stream has ended and removes the name
+void shmring_writer_close (shmring_writer_t* writer, const char* name);
+
+//Attaches to the ring, the first frame is the most recent IDR frame. Returns
+//0 on success
+int shmring_reader_open (shmring_reader_t* reader, const char* name);
+//Gets the next frame, waiting timeout ms at most (-1 forever). Returns 1 if
+//there's a frame, 0 on timeout and -1 when the writer is gone
+int shmring_read (
+    shmring_reader_t* reader,
+    shmring_frame_t* frame,
+    int timeout);
+//Returns 1 if the data of the frame hasn't been overwritten yet. Call it after
+//using the data, if it returns 0 the reader resyncs at the next read
+int shmring_valid (shmring_reader_t* reader, const shmring_frame_t* frame);
+void shmring_reader_close (shmring_reader_t* reader);
+
+#endif
@@ -0,0 +1,433 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "sink.h"
+#include "mp4.h"
+#include "rtp.h"
+#include "segment.h"
+#include "server.h"
+#include "shm.h"
+#include "ts.h"
+
+//Bytes that a non-blocking sink keeps while the reader is slow. Frames are
+//dropped when it's full
+#define SINK_BACKLOG_SIZE (2*1024*1024)
+//Capacity requested for the pipes (stdout and named pipes)
+#define SINK_PIPE_SIZE (1024*1024)
+//Maximum time to wait for a slow reader when the sink is closed (ms)
+#define SINK_CLOSE_TIMEOUT 1000
+//Buffer of a file in the writer threads, it holds an MP4 fragment (8 MB) while
+//the previous one is written
+#define SINK_STREAM_SIZE (16*1024*1024)
+
+static writer_t* sink_shared_writer;
+
+typedef struct {
+  sink_t sink;
+  int fd;
+  //Regular files never return EAGAIN, so they're written synchronously, or by
+  //the writer threads
+  int blocking;
+  //The reader has gone away, everything is dropped from now on
+  int broken;
+  //Data that the reader didn't accept yet
+  uint8_t* backlog;
+  uint32_t backlog_offset;
+  uint32_t backlog_length;
+  //The next buffer is the first one of a frame
+  int frame_start;
+  //Part of the current frame has been dropped
+  int frame_dropped;
+  //Waiting for the next IDR frame after a drop
+  int resync;
+} fd_sink_t;
+
+static void fd_sink_break (fd_sink_t* sink){
+  fprintf (stderr, "error: sink %s: %s\n", sink->sink.name, strerror (errno));
+  sink->broken = 1;
+  sink->backlog_length = 0;
+}
+
+//Returns 1 if the backlog is empty
+static int fd_sink_flush (fd_sink_t* sink){
+  ssize_t n;
+
+  while (sink->backlog_length){
+    n = write (sink->fd, sink->backlog + sink->backlog_offset,
+        sink->backlog_length);
+    if (n == -1){
+      if (errno == EINTR) continue;
+      if (errno != EAGAIN) fd_sink_break (sink);
+      return 0;
+    }
+    sink->backlog_offset += n;
+    sink->backlog_length -= n;
+  }
+
+  sink->backlog_offset = 0;
+  return !sink->broken;
+}
+
+//Returns 1 if the data has been accepted, either by the kernel or by the
+//backlog
+static int fd_sink_send (fd_sink_t* sink, uint8_t* data, uint32_t length){
+  ssize_t n;
+
+  if (sink->blocking){
+    if (sink->sink.stream){
+      return writer_write (sink->sink.stream, data, length);
+    }
+    while (length){
+      if ((n = write (sink->fd, data, length)) == -1){
+        if (errno == EINTR) continue;
+        fprintf (stderr, "error: write\n");
+        exit (1);
+      }
+      data += n;
+      length -= n;
+    }
+    return 1;
+  }
+
+  if (sink->broken) return 0;
+
+  //If nothing is queued, hand the data directly to the kernel
+  if (fd_sink_flush (sink)){
+    while (length){
+      if ((n = write (sink->fd, data, length)) == -1){
+        if (errno == EINTR) continue;
+        if (errno != EAGAIN){
+          fd_sink_break (sink);
+          return 0;
+        }
+        break;
+      }
+      data += n;
+      length -= n;
+    }
+    if (!length) return 1;
+  }else if (sink->broken){
+    return 0;
+  }
+
+  //Keep the rest in the backlog
+  if (sink->backlog_offset + sink->backlog_length + length >
+      SINK_BACKLOG_SIZE){
+    memmove (sink->backlog, sink->backlog + sink->backlog_offset,
+        sink->backlog_length);
+    sink->backlog_offset = 0;
+    if (sink->backlog_length + length > SINK_BACKLOG_SIZE) return 0;
+  }
+  memcpy (sink->backlog + sink->backlog_offset + sink->backlog_length, data,
+      length);
+  sink->backlog_length += length;
+
+  return 1;
+}
+
+static void fd_sink_write (sink_t* base, stream_buffer_t* buffer){
+  fd_sink_t* sink = (fd_sink_t*)base;
+  //The SPS/PPS buffers are not part of any frame and they're never dropped
+  //voluntarily because a decoder cannot do anything without them
+  int config = buffer->flags & STREAM_FLAG_CODECCONFIG;
+
+  if (!config && sink->frame_start){
+    sink->frame_dropped = 0;
+    if (sink->resync && (buffer->flags & STREAM_FLAG_SYNCFRAME)){
+      sink->resync = 0;
+      //The reader may have missed the SPS/PPS
+      if (base->paramsets && base->paramsets->complete &&
+          !fd_sink_send (sink, base->paramsets->data,
+          base->paramsets->length)){
+        sink->resync = 1;
+      }
+    }
+  }
+
+  if (config || !sink->resync){
+    if (fd_sink_send (sink, buffer->data, buffer->length)){
+      base->bytes += buffer->length;
+    }else if (!config){
+      sink->resync = 1;
+      sink->frame_dropped = 1;
+      if (base->idr) idr_request (base->idr);
+    }
+  }else{
+    sink->frame_dropped = 1;
+  }
+
+  if (config) return;
+
+  if (buffer->flags & STREAM_FLAG_ENDOFFRAME){
+    sink->frame_start = 1;
+    if (sink->frame_dropped){
+      base->dropped_frames++;
+    }else{
+      base->frames++;
+    }
+  }else{
+    sink->frame_start = 0;
+  }
+}
+
+static int fd_sink_rotate (sink_t* base, int fd){
+  fd_sink_t* sink = (fd_sink_t*)base;
+  int previous = sink->fd;
+
+  //Only regular files are rotated, they have no backlog. The new file starts
+  //with the SPS/PPS, the next frame is an IDR frame
+  if (base->stream) previous = writer_rotate (base->stream, fd);
+  sink->fd = fd;
+  if (base->paramsets && base->paramsets->complete &&
+      !fd_sink_send (sink, base->paramsets->data, base->paramsets->length)){
+    //The writer is behind, they're sent before the next IDR frame
+    sink->resync = 1;
+  }
+
+  return previous;
+}
+
+static void fd_sink_close (sink_t* base){
+  fd_sink_t* sink = (fd_sink_t*)base;
+  struct pollfd pfd;
+
+  //Give a slow reader a last chance to get the pending data
+  pfd.fd = sink->fd;
+  pfd.events = POLLOUT;
+  while (sink->backlog_length && !sink->broken &&
+      poll (&pfd, 1, SINK_CLOSE_TIMEOUT) == 1){
+    fd_sink_flush (sink);
+  }
+
+  if (base->stream) sink->fd = writer_stream_close (base->stream);
+  if (close (sink->fd)){
+    fprintf (stderr, "error: close\n");
+    exit (1);
+  }
+
+  free (sink->backlog);
+  free (sink);
+}
+
+static int stdout_open (){
+  //The encoded stream takes over the stdout file descriptor and the log
+  //messages printed with printf() are sent to stderr
+  int fd = dup (STDOUT_FILENO);
+  if (fd == -1 || dup2 (STDERR_FILENO, STDOUT_FILENO) == -1){
+    fprintf (stderr, "error: dup\n");
+    exit (1);
+  }
+  setvbuf (stdout, 0, _IOLBF, 0);
+  return fd;
+}
+
+static int fifo_open (const char* path){
+  if (mkfifo (path, 0666) && errno != EEXIST){
+    fprintf (stderr, "error: mkfifo\n");
+    exit (1);
+  }
+
+  //Opened for reading too, otherwise open() fails until there's a reader. The
+  //data is dropped while nobody is reading
+  int fd = open (path, O_RDWR);
+  if (fd == -1){
+    fprintf (stderr, "error: open\n");
+    exit (1);
+  }
+  return fd;
+}
+
+int sink_connect (const char* address, int type){
+  char host[256];
+  const char* port = strrchr (address, ':');
+  if (!port || port - address >= (int)sizeof (host)){
+    fprintf (stderr, "error: invalid address: %s\n", address);
+    exit (1);
+  }
+  memcpy (host, address, port - address);
+  host[port - address] = 0;
+  port++;
+
+  struct addrinfo hints;
+  struct addrinfo* result;
+  struct addrinfo* ai;
+  memset (&hints, 0, sizeof (hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = type;
+  if (getaddrinfo (host, port, &hints, &result)){
+    fprintf (stderr, "error: getaddrinfo\n");
+    exit (1);
+  }
+
+  int fd = -1;
+  for (ai=result; ai; ai=ai->ai_next){
+    if ((fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol)) == -1){
+      continue;
+    }
+    if (!connect (fd, ai->ai_addr, ai->ai_addrlen)) break;
+    close (fd);
+    fd = -1;
+  }
+  freeaddrinfo (result);
+  if (fd == -1){
+    fprintf (stderr, "error: connect\n");
+    exit (1);
+  }
+
+  //Each buffer is sent as soon as it's written
+  if (type == SOCK_STREAM){
+    int on = 1;
+    setsockopt (fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof (on));
+  }
+
+  return fd;
+}
+
+static int unix_connect (const char* path){
+  struct sockaddr_un addr;
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen (path) >= sizeof (addr.sun_path)){
+    fprintf (stderr, "error: invalid unix socket path: %s\n", path);
+    exit (1);
+  }
+  strcpy (addr.sun_path, path);
+
+  int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  if (fd == -1){
+    fprintf (stderr, "error: socket\n");
+    exit (1);
+  }
+  if (connect (fd, (struct sockaddr*)&addr, sizeof (addr))){
+    fprintf (stderr, "error: connect\n");
+    exit (1);
+  }
+  return fd;
+}
+
+sink_t* sink_open (const char* spec){
+  if (!strncmp (spec, "rtp:", 4)){
+    return rtp_sink_open (spec);
+  }
+  if (!strncmp (spec, "server:", 7)){
+    return server_sink_open (spec);
+  }
+  if (!strncmp (spec, "shm:", 4)){
+    return shm_sink_open (spec);
+  }
+  size_t length = strlen (spec);
+  if (!strncmp (spec, "mp4:", 4) ||
+      (length > 4 && !strcmp (spec + length - 4, ".mp4"))){
+    return mp4_sink_open (spec);
+  }
+  if (!strncmp (spec, "ts:", 3) || !strncmp (spec, "udp:", 4) ||
+      (length > 3 && !strcmp (spec + length - 3, ".ts"))){
+    return ts_sink_open (spec);
+  }
+  if (!strncmp (spec, "segment:", 8)){
+    return segment_sink_open (spec);
+  }
+  
+  fd_sink_t* sink = calloc (1, sizeof (fd_sink_t));
+  if (!sink){
+    fprintf (stderr, "error: calloc\n");
+    exit (1);
+  }
+  sink->sink.name = spec;
+  sink->sink.write = fd_sink_write;
+  sink->sink.close = fd_sink_close;
+  sink->frame_start = 1;
+
+  if (!strcmp (spec, "-")){
+    sink->fd = stdout_open ();
+  }else if (!strncmp (spec, "fifo:", 5)){
+    sink->fd = fifo_open (spec + 5);
+  }else if (!strncmp (spec, "tcp:", 4)){
+    sink->fd = sink_connect (spec + 4, SOCK_STREAM);
+  }else if (!strncmp (spec, "unix:", 5)){
+    sink->fd = unix_connect (spec + 5);
+  }else{
+    sink->fd = open (spec, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+    if (sink->fd == -1){
+      fprintf (stderr, "error: open\n");
+      exit (1);
+    }
+  }
+
+  struct stat st;
+  if (fstat (sink->fd, &st)){
+    fprintf (stderr, "error: fstat\n");
+    exit (1);
+  }
+
+  sink->blocking = S_ISREG (st.st_mode) || S_ISBLK (st.st_mode);
+  if (S_ISREG (st.st_mode)){
+    sink->sink.rotate = fd_sink_rotate;
+    sink_stream (&sink->sink, sink->fd);
+  }
+  if (!sink->blocking){
+    //A reader that goes away must not kill the process
+    signal (SIGPIPE, SIG_IGN);
+
+    if (fcntl (sink->fd, F_SETFL, fcntl (sink->fd, F_GETFL) | O_NONBLOCK)){
+      fprintf (stderr, "error: fcntl\n");
+      exit (1);
+    }
+    //A bigger pipe absorbs the bursts of the IDR frames. It's not an error if
+    //it cannot be resized
+    if (S_ISFIFO (st.st_mode)){
+      fcntl (sink->fd, F_SETPIPE_SZ, SINK_PIPE_SIZE);
+    }
+    if (!(sink->backlog = malloc (SINK_BACKLOG_SIZE))){
+      fprintf (stderr, "error: malloc\n");
+      exit (1);
+    }
+  }
+
+  return &sink->sink;
+}
+
+void sink_set_writer (writer_t* writer){
+  sink_shared_writer = writer;
+}
+
+writer_t* sink_writer (){
+  return sink_shared_writer;
+}
+
+void sink_stream (sink_t* sink, int fd){
+  struct stat st;
+  if (!sink_shared_writer) return;
+  if (fstat (fd, &st)){
+    fprintf (stderr, "error: fstat\n");
+    exit (1);
+  }
+  if (S_ISREG (st.st_mode)){
+    sink->stream = writer_stream_open (sink_shared_writer, sink->name, fd,
+        SINK_STREAM_SIZE);
+  }
+}
+
+void sink_write (sink_t* sink, stream_buffer_t* buffer){
+  sink->write (sink, buffer);
+}
+
+void sink_close (sink_t* sink){
+  printf ("sink %s: %u frames, %llu bytes, %u dropped frames\n", sink->name,
+      sink->frames, (unsigned long long)sink->bytes, sink->dropped_frames);
+  sink->close (sink);
+}
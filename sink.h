@@ -0,0 +1,85 @@
+#ifndef SINK_H
+#define SINK_H
+
+#include <stdint.h>
+
+#include "audio.h"
+#include "idr.h"
+#include "paramsets.h"
+#include "stream.h"
+#include "writer.h"
+
+/*
+A sink is the destination of the encoded stream. The encoder output loop hands
+every buffer to every sink, so a sink must never block: if it cannot keep up, it
+drops whole frames and resumes the stream at the next IDR frame, which is the
+first frame that a decoder can decode without the previous ones.
+
+Output specification accepted by sink_open():
+
+  -             stdout (the log messages are redirected to stderr)
+  fifo:PATH     named pipe, it's created if it doesn't exist
+  tcp:HOST:PORT TCP connection
+  unix:PATH     Unix stream socket connection
+  rtp:HOST:PORT RTP over UDP (see rtp.h)
+  server:[HOST:]PORT
+                TCP server for several clients (see server.h)
+  shm:NAME      shared memory ring for local processes (see shm.h)
+  mp4:PATH      fragmented MP4 file, also any PATH that ends with .mp4 (see
+                mp4.h)
+  ts:PATH       MPEG transport stream file, also any PATH that ends with .ts
+  udp:HOST:PORT MPEG transport stream over UDP (see ts.h)
+  segment:PATTERN
+                sequence of files, a new one every few seconds (see segment.h)
+  PATH          regular file
+
+The regular files (also the mp4:, ts: and segment: files) are written by the
+writer threads given to sink_set_writer() before they're opened (see writer.h).
+A file that is behind drops frames like a slow reader. Without them the files
+are written in the encoder loop.
+*/
+
+typedef struct sink_s sink_t;
+
+struct sink_s {
+  //Output specification
+  const char* name;
+  //Consumes a buffer. It must return immediately
+  void (*write) (sink_t* sink, stream_buffer_t* buffer);
+  //Flushes the pending data and releases the sink
+  void (*close) (sink_t* sink);
+  //Continues the output in a new file, fd, that starts with its own header.
+  //Called between two frames. Returns the previous file descriptor, that is
+  //closed by the caller. Null if the sink doesn't write to a file
+  int (*rotate) (sink_t* sink, int fd);
+  //Used to ask for an IDR frame when the sink needs to resync, it can be null
+  idr_t* idr;
+  //SPS/PPS sent before the first IDR frame after a resync, it can be null
+  paramsets_t* paramsets;
+  //Audio muxed with the video, it can be null, only the MP4 outputs use it
+  audio_sync_t* audio;
+  //Send every buffer as soon as it arrives, without waiting for the end of the
+  //frame (the complete NAL units with RTP, the full datagrams with UDP)
+  int low_latency;
+  //Stream of the writer threads of a regular file, null if it's written
+  //synchronously
+  writer_stream_t* stream;
+  //Statistics
+  uint64_t bytes;
+  uint32_t frames;
+  uint32_t dropped_frames;
+};
+
+sink_t* sink_open (const char* spec);
+void sink_write (sink_t* sink, stream_buffer_t* buffer);
+void sink_close (sink_t* sink);
+//Writer threads of the regular files opened from now on, null to write them
+//synchronously
+void sink_set_writer (writer_t* writer);
+writer_t* sink_writer ();
+//Gives the sink a stream of the writer threads if fd is a regular file
+void sink_stream (sink_t* sink, int fd);
+//Connects a socket of the given type (SOCK_STREAM, SOCK_DGRAM) to HOST:PORT
+int sink_connect (const char* address, int type);
+
+#endif
@@ -0,0 +1,254 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "snapshot.h"
+
+#define SNAPSHOT_PATH_SIZE 512
+
+static int64_t snapshot_time (){
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  return (int64_t)spec.tv_sec*1000000 + spec.tv_nsec/1000;
+}
+
+static void snapshot_path (
+    snapshot_t* snapshot,
+    uint32_t index,
+    int part,
+    char* path,
+    size_t size){
+  int n = snprintf (path, size, snapshot->pattern, index);
+  if (n < 0 || (size_t)n + 5 >= size){
+    fprintf (stderr, "error: snapshot path too long: %s\n", snapshot->pattern);
+    exit (1);
+  }
+  if (part) strcat (path, ".part");
+}
+
+//Job of the writer threads
+static void snapshot_write (void* arg){
+  snapshot_job_t* job = (snapshot_job_t*)arg;
+  snapshot_t* snapshot = job->snapshot;
+  char part[SNAPSHOT_PATH_SIZE];
+  char path[SNAPSHOT_PATH_SIZE];
+  int64_t start = snapshot_time ();
+
+  snapshot_path (snapshot, job->index, 1, part, sizeof (part));
+  snapshot_path (snapshot, job->index, 0, path, sizeof (path));
+  FILE* file = fopen (part, "w");
+  if (!file){
+    fprintf (stderr, "error: fopen\n");
+    exit (1);
+  }
+  if (fwrite (job->data, 1, job->length, file) != job->length ||
+      fclose (file)){
+    fprintf (stderr, "error: fwrite\n");
+    exit (1);
+  }
+  if (rename (part, path)){
+    fprintf (stderr, "error: rename\n");
+    exit (1);
+  }
+  free (job->data);
+
+  int64_t now = snapshot_time ();
+  printf ("snapshot: %s written, %zu bytes in %.1f ms, %.1f ms after the "
+      "request\n", path, job->length, (now - start)/1000.0,
+      (now - job->requested)/1000.0);
+
+  pthread_mutex_lock (&snapshot->mutex);
+  snapshot->queued--;
+  snapshot->written++;
+  if (now - start > snapshot->write_max) snapshot->write_max = now - start;
+  if (now - job->requested > snapshot->total_max){
+    snapshot->total_max = now - job->requested;
+  }
+  pthread_mutex_unlock (&snapshot->mutex);
+  free (job);
+}
+
+void snapshot_init (snapshot_t* snapshot, const char* pattern,
+    int64_t interval, writer_t* writer){
+  memset (snapshot, 0, sizeof (snapshot_t));
+  snapshot->pattern = pattern;
+  snapshot->interval = interval;
+  snapshot->previous = -1;
+
+  //A single unsigned conversion, the pattern is used as a format string
+  const char* conversion = strchr (pattern, '%');
+  if (!conversion || strchr (conversion + 1, '%') ||
+      conversion[1 + strspn (conversion + 1, "0123456789")] != 'u'){
+    fprintf (stderr, "error: invalid snapshot pattern: %s\n", pattern);
+    exit (1);
+  }
+
+  if (pthread_mutex_init (&snapshot->mutex, 0)){
+    fprintf (stderr, "error: pthread_mutex_init\n");
+    exit (1);
+  }
+  if (!writer){
+    writer_init (&snapshot->own, 1, 0);
+    writer = &snapshot->own;
+  }
+  snapshot->writer = writer;
+  snapshot->stream = writer_stream_open (writer, pattern, -1, 0);
+}
+
+void snapshot_request (snapshot_t* snapshot){
+  pthread_mutex_lock (&snapshot->mutex);
+  if (!snapshot->pending){
+    snapshot->pending = 1;
+    snapshot->pending_since = snapshot_time ();
+  }
+  snapshot->requests++;
+  pthread_mutex_unlock (&snapshot->mutex);
+}
+
+int snapshot_start (snapshot_t* snapshot){
+  //One still at a time, the next request waits for the end of the gap
+  if (snapshot->active || snapshot->watching) return 0;
+
+  pthread_mutex_lock (&snapshot->mutex);
+  int pending = snapshot->pending;
+  snapshot->pending = 0;
+  snapshot->requested = snapshot->pending_since;
+  pthread_mutex_unlock (&snapshot->mutex);
+  if (!pending) return 0;
+
+  if (!(snapshot->data = malloc (SNAPSHOT_DATA_SIZE))){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+  snapshot->size = SNAPSHOT_DATA_SIZE;
+  snapshot->length = 0;
+  snapshot->active = 1;
+  snapshot->watching = 1;
+  snapshot->gap = 0;
+  return 1;
+}
+
+//Hands the JPEG to the writer threads
+static void snapshot_end (snapshot_t* snapshot){
+  int64_t latency = snapshot_time () - snapshot->requested;
+  uint32_t index = snapshot->index;
+  int queued = 0;
+
+  pthread_mutex_lock (&snapshot->mutex);
+  if (snapshot->queued < SNAPSHOT_QUEUE_SIZE){
+    snapshot->queued++;
+    queued = 1;
+  }
+  pthread_mutex_unlock (&snapshot->mutex);
+
+  if (!queued){
+    //The disk is slow
+    fprintf (stderr, "warning: snapshot %u dropped, the queue is full\n",
+        index);
+    free (snapshot->data);
+    snapshot->data = 0;
+    snapshot->active = 0;
+    snapshot->dropped++;
+    return;
+  }
+
+  snapshot_job_t* job = malloc (sizeof (snapshot_job_t));
+  if (!job){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+  job->snapshot = snapshot;
+  job->data = snapshot->data;
+  job->length = snapshot->length;
+  job->index = index;
+  job->requested = snapshot->requested;
+  snapshot->data = 0;
+  snapshot->active = 0;
+  writer_job (snapshot->stream, snapshot_write, job);
+
+  snapshot->index++;
+  snapshot->stills++;
+  snapshot->latency_last = latency;
+  snapshot->latency_sum += latency;
+  if (latency > snapshot->latency_max) snapshot->latency_max = latency;
+}
+
+void snapshot_data (snapshot_t* snapshot, stream_buffer_t* buffer){
+  //Buffers outside of a capture are ignored
+  if (!snapshot->active) return;
+
+  if (snapshot->length + buffer->length > snapshot->size){
+    while (snapshot->length + buffer->length > snapshot->size){
+      snapshot->size *= 2;
+    }
+    if (!(snapshot->data = realloc (snapshot->data, snapshot->size))){
+      fprintf (stderr, "error: realloc\n");
+      exit (1);
+    }
+  }
+  memcpy (snapshot->data + snapshot->length, buffer->data, buffer->length);
+  snapshot->length += buffer->length;
+
+  if (buffer->flags & (STREAM_FLAG_EOS | STREAM_FLAG_ENDOFFRAME)){
+    snapshot_end (snapshot);
+  }
+}
+
+void snapshot_frame (snapshot_t* snapshot, int64_t timestamp){
+  int64_t previous = snapshot->previous;
+  snapshot->previous = timestamp;
+  if (!snapshot->watching || previous < 0) return;
+
+  if (timestamp - previous > snapshot->gap){
+    snapshot->gap = timestamp - previous;
+  }
+  if (snapshot->active) return;
+
+  //First video frame after the JPEG
+  uint32_t lost = 0;
+  if (snapshot->gap*2 > snapshot->interval*3){
+    lost = (snapshot->gap + snapshot->interval/2)/snapshot->interval - 1;
+  }
+  snapshot->watching = 0;
+  snapshot->gap_last = snapshot->gap;
+  if (snapshot->gap > snapshot->gap_max) snapshot->gap_max = snapshot->gap;
+  snapshot->lost += lost;
+
+  printf ("snapshot: still %u captured in %.1f ms, video gap %.1f ms (%u "
+      "frames lost)\n", snapshot->index - 1, snapshot->latency_last/1000.0,
+      snapshot->gap/1000.0, lost);
+}
+
+int snapshot_dump (snapshot_t* snapshot, char* str, size_t size){
+  pthread_mutex_lock (&snapshot->mutex);
+  uint32_t requests = snapshot->requests;
+  uint32_t written = snapshot->written;
+  int64_t write_max = snapshot->write_max;
+  int64_t total_max = snapshot->total_max;
+  pthread_mutex_unlock (&snapshot->mutex);
+
+  return snprintf (str, size, "requests %u, stills %u, written %u, dropped %u, "
+      "latency (ms) last %.1f avg %.1f max %.1f, write max %.1f ms, written "
+      "max %.1f ms after the request, video gap (ms) last %.1f max %.1f, "
+      "frames lost %u", requests, snapshot->stills, written, snapshot->dropped,
+      snapshot->latency_last/1000.0,
+      snapshot->stills ? snapshot->latency_sum/1000.0/snapshot->stills : 0.0,
+      snapshot->latency_max/1000.0, write_max/1000.0, total_max/1000.0,
+      snapshot->gap_last/1000.0, snapshot->gap_max/1000.0, snapshot->lost);
+}
+
+void snapshot_close (snapshot_t* snapshot){
+  writer_stream_close (snapshot->stream);
+  if (snapshot->writer == &snapshot->own) writer_close (&snapshot->own);
+
+  //A still that never completed
+  free (snapshot->data);
+  snapshot->data = 0;
+  snapshot->active = 0;
+
+  char stats[512];
+  snapshot_dump (snapshot, stats, sizeof (stats));
+  printf ("snapshot %s: %s\n", snapshot->pattern, stats);
+  pthread_mutex_destroy (&snapshot->mutex);
+}
@@ -0,0 +1,111 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "stream.h"
+#include "writer.h"
+
+/*
+JPEG stills while the video is recorded (-j PATTERN). The still port of the
+camera (72) is tunneled to an image encoder and a full resolution still is
+captured when it's requested with the snapshot control command. The video port
+keeps capturing: the camera resumes the video as soon as the still has been
+taken (OMX_CameraCaptureModeResumeViewfinderImmediately).
+
+Anybody can call snapshot_request() from any thread, the requests are coalesced
+until the capture starts. The encoder loop asks snapshot_start() and, if it
+returns 1, it starts the capture on port 72. The JPEG comes back in several
+image encoder buffers, collected by snapshot_data() and handed to the writer
+threads (see writer.h) as a job, so the encoder loop never waits for the disk.
+The file is written as PATH.part and renamed to PATH once it's complete. The
+pattern must have a single %u (%05u, etc.) conversion, replaced by the still
+number.
+
+The sensor is switched to the still mode for the capture, the video frames of
+that time are lost. For every still the following is measured:
+
+- latency: from the request to the end of the JPEG in the encoder loop, and
+  until it's written
+- gap: the longest interval between two video frames (timestamps), from the
+  capture to the first video frame after the JPEG, and the frames it lost
+*/
+
+//Stills waiting for the writer threads, the next ones are dropped
+#define SNAPSHOT_QUEUE_SIZE 4
+//Initial size of the buffer of a JPEG, it grows as needed
+#define SNAPSHOT_DATA_SIZE (2*1024*1024)
+
+typedef struct snapshot_s snapshot_t;
+
+typedef struct {
+  snapshot_t* snapshot;
+  uint8_t* data;
+  size_t length;
+  uint32_t index;
+  //Time of the request (us)
+  int64_t requested;
+} snapshot_job_t;
+
+struct snapshot_s {
+  const char* pattern;
+  //Video frame interval (us)
+  int64_t interval;
+  //Number of the next still
+  uint32_t index;
+  //Still being captured, its JPEG and the time of its request (us)
+  int active;
+  int64_t requested;
+  uint8_t* data;
+  size_t length;
+  size_t size;
+  //The gap of the video is measured until the first frame after the JPEG
+  int watching;
+  int64_t previous;
+  int64_t gap;
+  //Statistics of the encoder loop
+  uint32_t stills;
+  uint32_t dropped;
+  int64_t latency_last;
+  int64_t latency_sum;
+  int64_t latency_max;
+  int64_t gap_last;
+  int64_t gap_max;
+  uint32_t lost;
+  //Writer threads, the shared ones or a private one, and the stream of the
+  //jobs
+  writer_t* writer;
+  writer_t own;
+  writer_stream_t* stream;
+  //The fields below are protected by the mutex
+  pthread_mutex_t mutex;
+  //Pending request, time of the first one (us)
+  int pending;
+  int64_t pending_since;
+  uint32_t requests;
+  //Stills given to the writer threads and not written yet
+  int queued;
+  uint32_t written;
+  int64_t write_max;
+  int64_t total_max;
+};
+
+//interval is the time between two video frames (us). The stills are written by
+//writer, or by a private thread if it's null
+void snapshot_init (snapshot_t* snapshot, const char* pattern,
+    int64_t interval, writer_t* writer);
+void snapshot_request (snapshot_t* snapshot);
+//Returns 1 if a still must be captured now
+int snapshot_start (snapshot_t* snapshot);
+//Called for every filled image encoder buffer
+void snapshot_data (snapshot_t* snapshot, stream_buffer_t* buffer);
+//Called for every video frame with its original timestamp
+void snapshot_frame (snapshot_t* snapshot, int64_t timestamp);
+//Prints the statistics in a string
+int snapshot_dump (snapshot_t* snapshot, char* str, size_t size);
+//Writes the pending stills, releases the stream and prints the statistics
+void snapshot_close (snapshot_t* snapshot);
+
+#endif
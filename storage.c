@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/syscall.h>
+
+#include "storage.h"
+
+//Initial capacity of the catalog
+#define STORAGE_FILES 1024
+
+//I/O priority (linux/ioprio.h)
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+#define IOPRIO_WHO_PROCESS 1
+
+static double storage_time (){
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  return spec.tv_sec + spec.tv_nsec/1.0e9;
+}
+
+static int storage_file_compare (const void* a, const void* b){
+  uint32_t x = ((const storage_file_t*)a)->index;
+  uint32_t y = ((const storage_file_t*)b)->index;
+  return x < y ? -1 : x > y;
+}
+
+//Called with the mutex locked, or before the thread is started
+static void storage_push (storage_t* storage, uint32_t index, uint64_t size){
+  if (storage->files_length == storage->files_capacity){
+    //The ring is unrolled into a bigger array
+    uint32_t capacity = storage->files_capacity*2;
+    storage_file_t* files = malloc (capacity*sizeof (storage_file_t));
+    if (!files){
+      fprintf (stderr, "error: malloc\n");
+      exit (1);
+    }
+    uint32_t i;
+    for (i=0; i<storage->files_length; i++){
+      files[i] = storage->files[(storage->files_head + i) %
+          storage->files_capacity];
+    }
+    free (storage->files);
+    storage->files = files;
+    storage->files_head = 0;
+    storage->files_capacity = capacity;
+  }
+
+  storage_file_t* file = &storage->files[(storage->files_head +
+      storage->files_length) % storage->files_capacity];
+  file->index = index;
+  file->size = size;
+  storage->files_length++;
+  storage->used += size;
+}
+
+//Returns 1 if the name is a recording (or a .part recording) and stores its
+//number
+static int storage_parse (
+    storage_t* storage,
+    const char* name,
+    uint32_t* index,
+    int* part){
+  const char* conversion = strchr (storage->name, '%');
+  size_t prefix = conversion - storage->name;
+  const char* suffix = strchr (conversion, 'u') + 1;
+  size_t suffix_length = strlen (suffix);
+  char* end;
+
+  if (strncmp (name, storage->name, prefix)) return 0;
+  name += prefix;
+  if (*name < '0' || *name > '9') return 0;
+  *index = strtoul (name, &end, 10);
+  if (strncmp (end, suffix, suffix_length)) return 0;
+  end += suffix_length;
+  *part = !strcmp (end, ".part");
+  return !*end || *part;
+}
+
+//Builds the catalog with a single pass over the directory
+static void storage_scan (storage_t* storage){
+  double start = storage_time ();
+  char name[STORAGE_PATH_SIZE];
+  struct dirent* entry;
+  struct stat st;
+  uint32_t index;
+  int part;
+
+  DIR* dir = fdopendir (dup (storage->directory_fd));
+  if (!dir){
+    fprintf (stderr, "error: fdopendir\n");
+    exit (1);
+  }
+  while ((entry = readdir (dir))){
+    if (entry->d_type != DT_REG && entry->d_type != DT_UNKNOWN) continue;
+    if (!storage_parse (storage, entry->d_name, &index, &part)) continue;
+    if (fstatat (storage->directory_fd, entry->d_name, &st,
+        AT_SYMLINK_NOFOLLOW) || !S_ISREG (st.st_mode)){
+      continue;
+    }
+    if (part && !st.st_size){
+      //File opened ahead of time that was never used
+      unlinkat (storage->directory_fd, entry->d_name, 0);
+      continue;
+    }
+    if (part){
+      //Interrupted recording
+      snprintf (name, sizeof (name), storage->name, index);
+      if (renameat (storage->directory_fd, entry->d_name,
+          storage->directory_fd, name)){
+        continue;
+      }
+    }
+    storage_push (storage, index, (uint64_t)st.st_blocks*512);
+  }
+  closedir (dir);
+
+  qsort (storage->files, storage->files_length, sizeof (storage_file_t),
+      storage_file_compare);
+  if (storage->files_length){
+    storage->next_index = storage->files[storage->files_length - 1].index + 1;
+  }
+
+  storage->catalog_time = storage_time () - start;
+}
+
+static int storage_full (storage_t* storage){
+  //The newest recording is never deleted
+  return storage->quota && storage->files_length > 1 &&
+      storage->used + storage->reserve > storage->quota;
+}
+
+static void* storage_loop (void* arg){
+  storage_t* storage = (storage_t*)arg;
+  char name[STORAGE_PATH_SIZE];
+  storage_file_t file;
+  double start;
+
+  //The deletions only get the disk when nobody else wants it
+  if (syscall (SYS_ioprio_set, IOPRIO_WHO_PROCESS, (int)syscall (SYS_gettid),
+      IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT)){
+    fprintf (stderr, "warning: storage: ioprio_set: %s\n", strerror (errno));
+  }
+
+  pthread_mutex_lock (&storage->mutex);
+  while (!storage->stop){
+    if (!storage_full (storage)){
+      pthread_cond_wait (&storage->cond, &storage->mutex);
+      continue;
+    }
+
+    file = storage->files[storage->files_head];
+    storage->files_head = (storage->files_head + 1) % storage->files_capacity;
+    storage->files_length--;
+    storage->used -= file.size;
+    pthread_mutex_unlock (&storage->mutex);
+
+    start = storage_time ();
+    snprintf (name, sizeof (name), storage->name, file.index);
+    if (unlinkat (storage->directory_fd, name, 0) && errno != ENOENT){
+      fprintf (stderr, "error: storage: unlink %s: %s\n", name,
+          strerror (errno));
+    }
+
+    pthread_mutex_lock (&storage->mutex);
+    storage->evict_time += storage_time () - start;
+    storage->evicted++;
+    storage->evicted_bytes += file.size;
+  }
+  pthread_mutex_unlock (&storage->mutex);
+
+  return 0;
+}
+
+static uint64_t storage_quota (storage_t* storage, const char* quota){
+  char* end;
+  double value = strtod (quota, &end);
+
+  if (value <= 0 || (*end && strcmp (end, "%"))){
+    fprintf (stderr, "error: invalid quota: %s\n", quota);
+    exit (1);
+  }
+  if (!*end){
+    return value*1024*1024;
+  }
+
+  struct statvfs st;
+  if (fstatvfs (storage->directory_fd, &st)){
+    fprintf (stderr, "error: fstatvfs\n");
+    exit (1);
+  }
+  return (double)st.f_blocks*st.f_frsize*value/100;
+}
+
+void storage_open (storage_t* storage, const char* pattern, const char* quota){
+  memset (storage, 0, sizeof (storage_t));
+
+  const char* slash = strrchr (pattern, '/');
+  if (slash){
+    size_t length = slash == pattern ? 1 : (size_t)(slash - pattern);
+    if (length >= sizeof (storage->directory)){
+      fprintf (stderr, "error: invalid path: %s\n", pattern);
+      exit (1);
+    }
+    memcpy (storage->directory, pattern, length);
+  }else{
+    strcpy (storage->directory, ".");
+  }
+  storage->name = slash ? slash + 1 : pattern;
+  if (!strchr (storage->name, '%')){
+    fprintf (stderr, "error: invalid path: %s\n", pattern);
+    exit (1);
+  }
+
+  storage->directory_fd = open (storage->directory, O_RDONLY | O_DIRECTORY);
+  if (storage->directory_fd == -1){
+    fprintf (stderr, "error: open %s\n", storage->directory);
+    exit (1);
+  }
+
+  storage->files_capacity = STORAGE_FILES;
+  storage->files = malloc (STORAGE_FILES*sizeof (storage_file_t));
+  if (!storage->files){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+
+  storage_scan (storage);
+
+  if (!quota) return;
+  storage->quota = storage_quota (storage, quota);
+
+  if (pthread_mutex_init (&storage->mutex, 0) ||
+      pthread_cond_init (&storage->cond, 0)){
+    fprintf (stderr, "error: pthread_mutex_init\n");
+    exit (1);
+  }
+  if (pthread_create (&storage->thread, 0, storage_loop, storage)){
+    fprintf (stderr, "error: pthread_create\n");
+    exit (1);
+  }
+}
+
+void storage_add (storage_t* storage, uint32_t index, uint64_t size){
+  if (!storage->quota){
+    storage_push (storage, index, size);
+    return;
+  }
+
+  pthread_mutex_lock (&storage->mutex);
+  storage_push (storage, index, size);
+  if (size > storage->reserve) storage->reserve = size;
+  if (storage_full (storage)) pthread_cond_signal (&storage->cond);
+  pthread_mutex_unlock (&storage->mutex);
+}
+
+void storage_close (storage_t* storage){
+  if (storage->quota){
+    pthread_mutex_lock (&storage->mutex);
+    storage->stop = 1;
+    pthread_cond_signal (&storage->cond);
+    pthread_mutex_unlock (&storage->mutex);
+    if (pthread_join (storage->thread, 0)){
+      fprintf (stderr, "error: pthread_join\n");
+      exit (1);
+    }
+    pthread_mutex_destroy (&storage->mutex);
+    pthread_cond_destroy (&storage->cond);
+  }
+
+  printf ("storage %s: catalog built in %.1f ms, %u recordings, %llu MB "
+      "(quota %llu MB), evicted %u recordings (%llu MB) in %.1f ms\n",
+      storage->directory, storage->catalog_time*1000, storage->files_length,
+      (unsigned long long)storage->used/(1024*1024),
+      (unsigned long long)storage->quota/(1024*1024), storage->evicted,
+      (unsigned long long)storage->evicted_bytes/(1024*1024),
+      storage->evict_time*1000);
+
+  close (storage->directory_fd);
+  free (storage->files);
+}
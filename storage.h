@@ -0,0 +1,66 @@
+#ifndef STORAGE_H
+#define STORAGE_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+/*
+Storage manager of the segmented recordings. It keeps a catalog of the
+recordings in memory, ordered from the oldest to the newest, so nothing has to
+scan the directory while recording. The catalog is built once when it's opened,
+with a single pass over the directory, and then every finished segment is added
+to it. The numbering of the segments continues after the newest recording, and
+the .part files left by a previous run that didn't finish are renamed, they're
+playable up to their last frame or fragment.
+
+If there's a quota, the oldest recordings are deleted by a background thread
+with the idle I/O priority, so the deletions only use the disk when the writer
+doesn't. It deletes recordings until there's room for another segment as big as
+the biggest recent one. The quota is a size in MB or a percentage of the file
+system (e.g. 80%).
+*/
+
+#define STORAGE_PATH_SIZE 512
+
+typedef struct {
+  uint32_t index;
+  //Bytes used on disk
+  uint64_t size;
+} storage_file_t;
+
+typedef struct {
+  //Directory and file name pattern of the recordings
+  char directory[STORAGE_PATH_SIZE];
+  const char* name;
+  int directory_fd;
+  //0 if there's no quota
+  uint64_t quota;
+  uint64_t used;
+  //Biggest recent recording, the room that is kept for the next one
+  uint64_t reserve;
+  //Catalog, a ring of recordings that grows when it's full
+  storage_file_t* files;
+  uint32_t files_head;
+  uint32_t files_length;
+  uint32_t files_capacity;
+  //Number of the next recording
+  uint32_t next_index;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int stop;
+  //Statistics
+  double catalog_time;
+  uint32_t evicted;
+  uint64_t evicted_bytes;
+  double evict_time;
+} storage_t;
+
+//The pattern is the path of the recordings with a single %u conversion. The
+//quota can be null
+void storage_open (storage_t* storage, const char* pattern, const char* quota);
+//Adds a finished recording to the catalog
+void storage_add (storage_t* storage, uint32_t index, uint64_t size);
+void storage_close (storage_t* storage);
+
+#endif
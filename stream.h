@@ -0,0 +1,24 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stdint.h>
+
+//Flags of a stream buffer. They have the same values as the OMX_BUFFERFLAG_*
+//flags, so the nFlags field of an OMX_BUFFERHEADERTYPE can be copied as is
+#define STREAM_FLAG_EOS 0x1
+#define STREAM_FLAG_ENDOFFRAME 0x10
+#define STREAM_FLAG_SYNCFRAME 0x20
+#define STREAM_FLAG_CODECCONFIG 0x80
+
+//Encoded data produced by the encoder output port. It doesn't own the data, it
+//points to the buffer allocated with OMX_AllocateBuffer(), so it's only valid
+//until the buffer is given back to the encoder with OMX_FillThisBuffer()
+typedef struct {
+  uint8_t* data;
+  uint32_t length;
+  //Presentation timestamp in microseconds (nTimeStamp)
+  int64_t timestamp;
+  uint32_t flags;
+} stream_buffer_t;
+
+#endif
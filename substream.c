@@ -0,0 +1,87 @@
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "substream.h"
+
+static void substream_invalid (const char* spec){
+  fprintf (stderr, "error: invalid substream: %s\n", spec);
+  exit (1);
+}
+
+//Returns 1 if the option (up to the next comma) is an option of the
+//substream: bitrate=, profile= or size=WxH
+static int substream_is_option (const char* option){
+  size_t length = strcspn (option, ",");
+  const char* x = memchr (option, 'x', length);
+  return !strncmp (option, "bitrate=", 8) ||
+      !strncmp (option, "profile=", 8) ||
+      (!strncmp (option, "size=", 5) && x);
+}
+
+//Parses an option of the substream, it must be the whole option
+static void substream_option (
+    substream_t* substream,
+    const char* spec,
+    const char* option){
+  int length = strcspn (option, ",");
+  int n = -1;
+
+  if (sscanf (option, "size=%ux%u%n", &substream->width, &substream->height,
+      &n) == 2 || sscanf (option, "bitrate=%u%n", &substream->bitrate,
+      &n) == 1){
+    if (n != length) substream_invalid (spec);
+  }else if (length == 16 && !strncmp (option, "profile=baseline", 16)){
+    substream->profile = 66;
+  }else if (length == 12 && !strncmp (option, "profile=main", 12)){
+    substream->profile = 77;
+  }else if (length == 12 && !strncmp (option, "profile=high", 12)){
+    substream->profile = 100;
+  }else{
+    substream_invalid (spec);
+  }
+}
+
+void substream_init (
+    substream_t* substream,
+    const char* spec,
+    uint32_t width,
+    uint32_t height){
+  memset (substream, 0, sizeof (substream_t));
+  substream->width = SUBSTREAM_WIDTH;
+  substream->height = SUBSTREAM_HEIGHT;
+  substream->bitrate = SUBSTREAM_BITRATE;
+  substream->profile = SUBSTREAM_PROFILE;
+
+  //The options of the substream are the trailing ones, the output keeps the
+  //others
+  const char* options = spec + strlen (spec);
+  const char* comma;
+  while ((comma = memrchr (spec, ',', options - spec)) &&
+      substream_is_option (comma + 1)){
+    options = comma;
+  }
+  if (options == spec ||
+      !(substream->output = strndup (spec, options - spec))){
+    substream_invalid (spec);
+  }
+
+  while (*options){
+    options++;
+    substream_option (substream, spec, options);
+    options += strcspn (options, ",");
+  }
+  if (!substream->width || substream->width % 32 || substream->width > width ||
+      !substream->height || substream->height % 16 ||
+      substream->height > height || !substream->bitrate ||
+      substream->bitrate > SUBSTREAM_BITRATE_MAX){
+    substream_invalid (spec);
+  }
+}
+
+void substream_close (substream_t* substream){
+  free (substream->output);
+  substream->output = 0;
+}
@@ -0,0 +1,50 @@
+#ifndef SUBSTREAM_H
+#define SUBSTREAM_H
+
+#include <stdint.h>
+
+/*
+Second stream of a camera (-u), scaled and encoded with its own settings (see
+the pipelines in h264.c). This is only the specification, the components are
+set up by h264.c:
+
+  -u OUTPUT[,size=WIDTHxHEIGHT][,bitrate=BPS][,profile=baseline|main|high]
+
+The output is any output of -o and can have its own options, like
+segment:sub-%05u.ts,duration=2 or shm:sub,size=8. Only the trailing options
+that are options of the substream are split off: size must be WIDTHxHEIGHT
+(the size of segment: and shm: is a number of MB), the bitrate a number and the
+profile one of the three names.
+
+The resize output has no padding, the encoder takes it as is: the width must be
+a multiple of 32 and the height a multiple of 16, and the size can't be larger
+than the camera. The bitrate is capped like the one of the set command (see
+tuning.h).
+*/
+
+#define SUBSTREAM_WIDTH 640
+#define SUBSTREAM_HEIGHT 480
+#define SUBSTREAM_BITRATE 1000000
+#define SUBSTREAM_BITRATE_MAX 25000000
+//profile_idc, baseline
+#define SUBSTREAM_PROFILE 66
+
+typedef struct {
+  char* output;
+  uint32_t width;
+  uint32_t height;
+  uint32_t bitrate;
+  //profile_idc, 66, 77 or 100
+  uint8_t profile;
+} substream_t;
+
+//Parses the -u option, width and height are the size of the camera. Exits on
+//error
+void substream_init (
+    substream_t* substream,
+    const char* spec,
+    uint32_t width,
+    uint32_t height);
+void substream_close (substream_t* substream);
+
+#endif
@@ -0,0 +1,421 @@
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sweep.h"
+
+#define SWEEP_COLUMNS 23
+#define SWEEP_VALUE_SIZE 32
+
+static const char* parameters[SWEEP_PARAMETERS] = {
+  "bitrate", "qp_i", "qp_p", "profile", "idr"
+};
+
+static const char* columns[SWEEP_COLUMNS] = {
+  "bitrate", "qp_i", "qp_p", "profile", "idr_period", "startup_ms", "seconds",
+  "frames", "keyframes", "bytes", "bytes_per_frame", "fps", "measured_bitrate",
+  "latency_avg_ms", "latency_p50_ms", "latency_p90_ms", "latency_p99_ms",
+  "latency_max_ms", "latency_absolute", "dropped_sensor", "dropped_encoder",
+  "dropped_host", "incomplete"
+};
+
+//Monotonic time (us)
+static int64_t sweep_time (){
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  return (int64_t)spec.tv_sec*1000000 + spec.tv_nsec/1000;
+}
+
+static void sweep_invalid (const char* spec){
+  fprintf (stderr, "error: invalid sweep: %s\n", spec);
+  exit (1);
+}
+
+static const char* sweep_profile_name (uint8_t profile){
+  switch (profile){
+    case 66: return "baseline";
+    case 77: return "main";
+    case 100: return "high";
+    default: return "unknown";
+  }
+}
+
+static uint32_t sweep_value (const char* spec, sweep_parameter_t parameter,
+    const char* value){
+  char* end;
+
+  if (parameter == SWEEP_PROFILE){
+    if (!strcmp (value, "baseline")) return 66;
+    if (!strcmp (value, "main")) return 77;
+    if (!strcmp (value, "high")) return 100;
+    sweep_invalid (spec);
+  }
+
+  long n = strtol (value, &end, 10);
+  if (!*value || *end || n < 0) sweep_invalid (spec);
+  if ((parameter == SWEEP_QP_I || parameter == SWEEP_QP_P) && n > 51){
+    sweep_invalid (spec);
+  }
+  return n;
+}
+
+//NAME=VALUE[:VALUE]...
+static void sweep_parse (sweep_t* sweep, const char* spec, const char* item,
+    size_t length){
+  char buffer[512];
+  char* value;
+  char* next;
+  int i;
+
+  if (length >= sizeof (buffer)) sweep_invalid (spec);
+  memcpy (buffer, item, length);
+  buffer[length] = 0;
+  if (!(value = strchr (buffer, '='))) sweep_invalid (spec);
+  *value++ = 0;
+
+  for (i=0; i<SWEEP_PARAMETERS && strcmp (buffer, parameters[i]); i++);
+  if (i == SWEEP_PARAMETERS) sweep_invalid (spec);
+
+  sweep->lengths[i] = 0;
+  while (1){
+    if (sweep->lengths[i] == SWEEP_VALUES_MAX) sweep_invalid (spec);
+    if ((next = strchr (value, ':'))) *next++ = 0;
+    sweep->values[i][sweep->lengths[i]++] = sweep_value (spec, i, value);
+    if (!next) break;
+    value = next;
+  }
+}
+
+void sweep_init (sweep_t* sweep, const sweep_config_t* defaults,
+    const char* spec){
+  const char* item = spec;
+  const char* end;
+  int i;
+
+  sweep->values[SWEEP_BITRATE][0] = defaults->bitrate;
+  sweep->values[SWEEP_QP_I][0] = defaults->qp_i;
+  sweep->values[SWEEP_QP_P][0] = defaults->qp_p;
+  sweep->values[SWEEP_PROFILE][0] = defaults->profile;
+  sweep->values[SWEEP_IDR][0] = defaults->idr_period;
+  for (i=0; i<SWEEP_PARAMETERS; i++){
+    sweep->lengths[i] = 1;
+    sweep->indexes[i] = 0;
+  }
+  sweep->done = 0;
+  sweep->file = 0;
+  sweep->json = 0;
+  sweep->rows = 0;
+
+  while (1){
+    end = strchr (item, ',');
+    sweep_parse (sweep, spec, item, end ? (size_t)(end - item) : strlen (item));
+    if (!end) break;
+    item = end + 1;
+  }
+}
+
+int sweep_length (sweep_t* sweep){
+  int length = 1;
+  int i;
+  for (i=0; i<SWEEP_PARAMETERS; i++){
+    length *= sweep->lengths[i];
+  }
+  return length;
+}
+
+int sweep_next (sweep_t* sweep, sweep_config_t* config){
+  int i;
+
+  if (sweep->done) return 0;
+  config->bitrate = sweep->values[SWEEP_BITRATE][sweep->indexes[SWEEP_BITRATE]];
+  config->qp_i = sweep->values[SWEEP_QP_I][sweep->indexes[SWEEP_QP_I]];
+  config->qp_p = sweep->values[SWEEP_QP_P][sweep->indexes[SWEEP_QP_P]];
+  config->profile = sweep->values[SWEEP_PROFILE][sweep->indexes[SWEEP_PROFILE]];
+  config->idr_period = sweep->values[SWEEP_IDR][sweep->indexes[SWEEP_IDR]];
+
+  //Odometer, the last parameter changes first
+  for (i=SWEEP_PARAMETERS - 1; i>=0; i--){
+    if (++sweep->indexes[i] < sweep->lengths[i]) return 1;
+    sweep->indexes[i] = 0;
+  }
+  sweep->done = 1;
+  return 1;
+}
+
+void sweep_open (sweep_t* sweep, const char* path){
+  size_t length = strlen (path);
+  int i;
+
+  if (!(sweep->file = fopen (path, "w"))){
+    fprintf (stderr, "error: cannot open the sweep results %s\n", path);
+    exit (1);
+  }
+  sweep->json = length >= 5 && !strcmp (path + length - 5, ".json");
+
+  if (sweep->json){
+    fprintf (sweep->file, "[");
+  }else{
+    for (i=0; i<SWEEP_COLUMNS; i++){
+      fprintf (sweep->file, "%s%s", i ? "," : "", columns[i]);
+    }
+    fprintf (sweep->file, "\n");
+  }
+  fflush (sweep->file);
+}
+
+void sweep_result (sweep_t* sweep, const sweep_config_t* config,
+    sweep_result_t* result){
+  char values[SWEEP_COLUMNS][SWEEP_VALUE_SIZE];
+  frames_t* frames = &result->frames;
+  latency_t* latency = &result->latency;
+  double seconds = result->seconds;
+  int i = 0;
+
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%u", config->bitrate);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%u", config->qp_i);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%u", config->qp_p);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%s",
+      sweep_profile_name (config->profile));
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%u", config->idr_period);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%.1f", result->startup);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%.3f", seconds);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%u", frames->frames);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%u", frames->keyframes);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%llu",
+      (unsigned long long)result->bytes);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%.0f",
+      frames->frames ? (double)result->bytes/frames->frames : 0);
+  //The first frame starts the time, there are frames - 1 intervals
+  double fps = seconds > 0 && frames->frames > 1 ?
+      (frames->frames - 1)/seconds : 0;
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%.2f", fps);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%.0f",
+      frames->frames ? (double)result->bytes*8/frames->frames*fps : 0);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%.1f",
+      latency->count ? (double)latency->sum/latency->count/1000.0 : 0);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%.1f",
+      latency->count ? latency_percentile (latency, 0.5) : 0);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%.1f",
+      latency->count ? latency_percentile (latency, 0.9) : 0);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%.1f",
+      latency->count ? latency_percentile (latency, 0.99) : 0);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%.1f", latency->max/1000.0);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%d", result->absolute);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%u", frames->dropped_sensor);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%u", frames->dropped_encoder);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%u", frames->dropped_host);
+  snprintf (values[i++], SWEEP_VALUE_SIZE, "%u", frames->incomplete);
+
+  printf ("sweep:");
+  for (i=0; i<SWEEP_COLUMNS; i++){
+    printf ("%s %s %s", i ? "," : "", columns[i], values[i]);
+  }
+  printf ("\n");
+
+  if (!sweep->file) return;
+  if (sweep->json){
+    fprintf (sweep->file, "%s\n  {", sweep->rows ? "," : "");
+    for (i=0; i<SWEEP_COLUMNS; i++){
+      //The profile is the only string
+      fprintf (sweep->file, i == 3 ? "%s\"%s\": \"%s\"" : "%s\"%s\": %s",
+          i ? ", " : "", columns[i], values[i]);
+    }
+    fprintf (sweep->file, "}");
+  }else{
+    for (i=0; i<SWEEP_COLUMNS; i++){
+      fprintf (sweep->file, "%s%s", i ? "," : "", values[i]);
+    }
+    fprintf (sweep->file, "\n");
+  }
+  //The results of the finished configurations are kept if the sweep is
+  //interrupted
+  fflush (sweep->file);
+  sweep->rows++;
+}
+
+void sweep_close (sweep_t* sweep){
+  if (!sweep->file) return;
+  if (sweep->json){
+    fprintf (sweep->file, "\n]\n");
+  }
+  fclose (sweep->file);
+  sweep->file = 0;
+}
+
+void sweep_run (sweep_t* sweep, sweep_encoder_t* encoder, long duration,
+    volatile sig_atomic_t* interrupted){
+  //The histogram of the latency is too big for the stack
+  static sweep_result_t result;
+  sweep_config_t config;
+  stream_buffer_t buffer;
+  int64_t start;
+  int64_t first;
+  int64_t now = 0;
+  int n = 0;
+
+  while (!*interrupted && sweep_next (sweep, &config)){
+    printf ("sweep: configuration %d/%d\n", ++n, sweep_length (sweep));
+    frames_init (&result.frames, encoder->interval);
+    latency_init (&result.latency);
+    latency_clock_reset (encoder->clock);
+    result.absolute = latency_clock_absolute (encoder->clock);
+    result.startup = 0;
+    result.bytes = 0;
+    first = -1;
+
+    //The startup includes the camera drivers and the allocation of the buffers
+    start = sweep_time ();
+    encoder->open (encoder, &config);
+    frames_queued (&result.frames);
+
+    while (1){
+      encoder->read (encoder, &buffer);
+      frames_buffer (&result.frames, &buffer);
+
+      now = sweep_time ();
+      if (buffer.length && !(buffer.flags & STREAM_FLAG_CODECCONFIG)){
+        if (first < 0){
+          first = now;
+          result.startup = (first - start)/1000.0;
+        }
+        result.bytes += buffer.length;
+        if (buffer.flags & STREAM_FLAG_ENDOFFRAME){
+          latency_add (&result.latency, latency_clock_since (encoder->clock,
+              buffer.timestamp));
+        }
+      }
+
+      frames_queued (&result.frames);
+      encoder->release (encoder);
+      if (*interrupted || (first >= 0 && now - first >= duration*1000)) break;
+    }
+    result.seconds = first >= 0 ? (now - first)/1.0e6 : 0;
+
+    encoder->close (encoder);
+    sweep_result (sweep, &config, &result);
+  }
+}
+
+//Bytes of a frame with the settings of the configuration
+static uint32_t sweep_standin_size (sweep_standin_t* standin, int idr,
+    int64_t interval){
+  sweep_config_t* config = &standin->config;
+  double size;
+
+  if (config->qp_i || config->qp_p){
+    //1/20 byte per pixel for an IDR frame at QP 26, a P frame is 5 times
+    //smaller, and the size is halved every 6 QP
+    uint32_t qp = idr ? config->qp_i : config->qp_p;
+    if (!qp) qp = 26;
+    size = (double)standin->width*standin->height/(idr ? 20 : 100)*
+        pow (2, (26.0 - qp)/6);
+  }else{
+    //An IDR frame is 5 P frames
+    double average = config->bitrate/8.0*interval/1.0e6;
+    uint32_t period = config->idr_period;
+    size = period ? average*period/(period + 4) : average;
+    if (idr) size *= 5;
+  }
+  //CAVLC only in baseline, 8x8 transforms in high
+  if (config->profile == 66) size *= 1.1;
+  if (config->profile == 100) size *= 0.95;
+  return size < 64 ? 64 : size;
+}
+
+static void sweep_standin_open (sweep_encoder_t* encoder,
+    const sweep_config_t* config){
+  sweep_standin_t* standin = (sweep_standin_t*)encoder->data;
+
+  standin->config = *config;
+  if (!(standin->data = malloc (SWEEP_STANDIN_BUFFER_SIZE))){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+  //Slice data never contains a start code
+  memset (standin->data, 0xAA, SWEEP_STANDIN_BUFFER_SIZE);
+  standin->frame = 0;
+  standin->capture = sweep_time () + standin->startup - encoder->interval;
+  standin->idr = 0;
+  standin->length = 0;
+  standin->offset = 0;
+  standin->config_sent = 0;
+}
+
+static void sweep_standin_read (sweep_encoder_t* encoder,
+    stream_buffer_t* buffer){
+  sweep_standin_t* standin = (sweep_standin_t*)encoder->data;
+  int64_t interval = encoder->interval;
+  uint8_t* data = standin->data;
+  int64_t now = sweep_time ();
+
+  if (!standin->config_sent){
+    uint8_t config[] = {
+      0, 0, 0, 1, 0x67, standin->config.profile, 0, 40, 0xAC,
+      0, 0, 0, 1, 0x68, 0xCE, 0x38, 0x80
+    };
+    memcpy (data, config, sizeof (config));
+    buffer->data = data;
+    buffer->length = sizeof (config);
+    buffer->timestamp = 0;
+    buffer->flags = STREAM_FLAG_CODECCONFIG;
+    standin->config_sent = 1;
+    return;
+  }
+
+  if (standin->offset == standin->length){
+    //The frames captured while the encoder had no buffer are lost
+    standin->capture += interval;
+    while (standin->capture + interval <= now) standin->capture += interval;
+    standin->idr = !standin->frame || (standin->config.idr_period &&
+        !(standin->frame%standin->config.idr_period));
+    standin->length = sweep_standin_size (standin, standin->idr, interval);
+    standin->offset = 0;
+    standin->frame++;
+    memcpy (data, "\0\0\0\1", 4);
+    data[4] = standin->idr ? 0x65 : 0x41;
+  }else{
+    memset (data, 0xAA, 5);
+  }
+
+  uint32_t length = standin->length - standin->offset;
+  if (length > SWEEP_STANDIN_BUFFER_SIZE) length = SWEEP_STANDIN_BUFFER_SIZE;
+  standin->offset += length;
+  int64_t ready = standin->capture +
+      (int64_t)standin->offset*1000000/SWEEP_STANDIN_RATE;
+  if (ready > now) usleep (ready - now);
+
+  buffer->data = data;
+  buffer->length = length;
+  buffer->timestamp = standin->capture;
+  buffer->flags = standin->idr ? STREAM_FLAG_SYNCFRAME : 0;
+  if (standin->offset == standin->length){
+    buffer->flags |= STREAM_FLAG_ENDOFFRAME;
+  }
+}
+
+static void sweep_standin_release (sweep_encoder_t* encoder){
+  //Nothing to give back, the lost frames are counted at the next read
+}
+
+static void sweep_standin_close (sweep_encoder_t* encoder){
+  sweep_standin_t* standin = (sweep_standin_t*)encoder->data;
+  free (standin->data);
+  standin->data = 0;
+}
+
+void sweep_standin_init (sweep_encoder_t* encoder, sweep_standin_t* standin,
+    uint32_t width, uint32_t height, int64_t interval){
+  memset (standin, 0, sizeof (sweep_standin_t));
+  standin->width = width;
+  standin->height = height;
+  standin->startup = 100000;
+  encoder->open = sweep_standin_open;
+  encoder->read = sweep_standin_read;
+  encoder->release = sweep_standin_release;
+  encoder->close = sweep_standin_close;
+  encoder->clock = &standin->clock;
+  encoder->interval = interval;
+  encoder->data = standin;
+}
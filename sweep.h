@@ -0,0 +1,151 @@
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "frames.h"
+#include "latency.h"
+#include "stream.h"
+
+/*
+Encoder parameter sweep. -s gives a list of values for some of the encoder
+settings, and every combination is recorded for -t ms with a new pipeline:
+
+  -s bitrate=4000000:8000000:17000000,profile=baseline:high,idr=0:30
+
+The parameters are bitrate (bits/s), qp_i and qp_p (1 .. 51, the bitrate is
+ignored if any of them is not 0), profile (baseline, main or high) and idr (IDR
+period in frames, 0 disabled). The ones not given keep the default settings.
+The last parameter changes first.
+
+Every configuration gives a row of results:
+
+- startup: time from the setup of the pipeline (camera drivers included) to the
+  first frame
+- frames, keyframes, bytes, bytes per frame, frame rate and bitrate, measured
+  from the first frame
+- latency of every frame, from the capture to the end of the frame in the
+  encoder loop (see latency.h)
+- dropped frames by cause and incomplete frames (see frames.h)
+
+The results are written to -S as they are measured, JSON if the path ends with
+.json and CSV otherwise.
+
+The measurements don't depend on the encoder: sweep_run() drives a
+sweep_encoder_t, the pipeline of h264.c (set_h264_settings()) on the Pi or the
+stand-in below on any machine. The stand-in gives frames at the frame interval
+with the sizes a configuration would roughly give (the bitrate split between
+the IDR frames and the P frames, or a size halved every 6 QP), in buffers of
+SWEEP_STANDIN_BUFFER_SIZE bytes that are ready as the frame is "encoded" at
+SWEEP_STANDIN_RATE bytes/s. Frames are skipped when the buffers are given back
+late, like the real encoder does, so the driver, the results and the dropped
+frames can be checked without a camera.
+*/
+
+//Maximum number of values of a parameter
+#define SWEEP_VALUES_MAX 16
+
+typedef enum {
+  SWEEP_BITRATE,
+  SWEEP_QP_I,
+  SWEEP_QP_P,
+  SWEEP_PROFILE,
+  SWEEP_IDR,
+  SWEEP_PARAMETERS
+} sweep_parameter_t;
+
+//Encoder settings of a configuration
+typedef struct {
+  uint32_t bitrate;
+  uint32_t qp_i;
+  uint32_t qp_p;
+  //profile_idc, 66, 77 or 100
+  uint8_t profile;
+  uint32_t idr_period;
+} sweep_config_t;
+
+typedef struct {
+  //Time from the setup of the pipeline to the first frame (ms)
+  double startup;
+  //Time from the first frame to the last one (s)
+  double seconds;
+  uint64_t bytes;
+  frames_t frames;
+  latency_t latency;
+  //1 if the latency is absolute
+  int absolute;
+} sweep_result_t;
+
+typedef struct {
+  uint32_t values[SWEEP_PARAMETERS][SWEEP_VALUES_MAX];
+  int lengths[SWEEP_PARAMETERS];
+  //Indexes of the values of the next configuration
+  int indexes[SWEEP_PARAMETERS];
+  int done;
+  //Results
+  FILE* file;
+  int json;
+  int rows;
+} sweep_t;
+
+//Encoder of the sweep
+typedef struct sweep_encoder_s {
+  //Sets up the encoder with the settings of a configuration and starts it
+  void (*open) (struct sweep_encoder_s* encoder, const sweep_config_t* config);
+  //Waits for the next filled buffer
+  void (*read) (struct sweep_encoder_s* encoder, stream_buffer_t* buffer);
+  //Gives the last buffer back to the encoder
+  void (*release) (struct sweep_encoder_s* encoder);
+  void (*close) (struct sweep_encoder_s* encoder);
+  //Clock of the timestamps
+  latency_clock_t* clock;
+  //Frame interval (us)
+  int64_t interval;
+  void* data;
+} sweep_encoder_t;
+
+#define SWEEP_STANDIN_BUFFER_SIZE 65536
+#define SWEEP_STANDIN_RATE 50000000
+
+typedef struct {
+  uint32_t width;
+  uint32_t height;
+  //Time from open() to the capture of the first frame (us)
+  int64_t startup;
+  sweep_config_t config;
+  latency_clock_t clock;
+  uint8_t* data;
+  //Current frame: number, capture time, IDR, bytes and bytes already read
+  uint32_t frame;
+  int64_t capture;
+  int idr;
+  uint32_t length;
+  uint32_t offset;
+  int config_sent;
+} sweep_standin_t;
+
+//Parses the -s option, the parameters that are not given take the default
+//value
+void sweep_init (sweep_t* sweep, const sweep_config_t* defaults,
+    const char* spec);
+//Number of configurations
+int sweep_length (sweep_t* sweep);
+//Gets the next configuration, returns 0 when there are no more
+int sweep_next (sweep_t* sweep, sweep_config_t* config);
+//Opens the results file
+void sweep_open (sweep_t* sweep, const char* path);
+//Writes the results of a configuration and prints them
+void sweep_result (sweep_t* sweep, const sweep_config_t* config,
+    sweep_result_t* result);
+void sweep_close (sweep_t* sweep);
+//Records every configuration for duration ms and writes the results. Stops
+//after the current configuration when interrupted is set
+void sweep_run (sweep_t* sweep, sweep_encoder_t* encoder, long duration,
+    volatile sig_atomic_t* interrupted);
+//Stand-in encoder of a stream of the given size, the clock is relative
+void sweep_standin_init (sweep_encoder_t* encoder, sweep_standin_t* standin,
+    uint32_t width, uint32_t height, int64_t interval);
+
+#endif
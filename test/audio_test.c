@@ -0,0 +1,254 @@
+#include "test.h"
+
+#include <sys/wait.h>
+
+#include "audio.h"
+
+#define RATE 8000
+
+//Sample of a frame of the test sources
+static int16_t sample (int64_t frame, uint32_t channel){
+  return channel ? -(int16_t)frame : (int16_t)frame;
+}
+
+//Source without a thread (/dev/null is never read)
+static void source (audio_t* audio){
+  char spec[64];
+  snprintf (spec, sizeof (spec), "pcm:/dev/null,rate=%u", RATE);
+  audio_open (audio, spec);
+}
+
+//Captures frames up to end: the samples go to the ring and the last one was
+//captured at time, rate samples per second
+static void capture (audio_t* audio, int64_t end, int64_t time, double rate){
+  int64_t frame;
+
+  for (frame=audio->frames; frame<end; frame++){
+    audio->ring[frame & (audio->ring_frames - 1)] = sample (frame, 0);
+  }
+  audio->frames = end;
+  audio->clock.position = end;
+  audio->clock.time = time;
+  audio->clock.rate = rate;
+  audio->clock_valid = 1;
+}
+
+static void check_samples (const int16_t* data, uint32_t length,
+    int64_t first){
+  uint32_t i;
+  for (i=0; i<length; i++) CHECK (data[i] == sample (first + i, 0));
+}
+
+static void test_reader (){
+  static int16_t data[48000];
+  audio_t audio;
+  audio_sync_t sync;
+  audio_reader_t reader;
+  char stats[256];
+
+  source (&audio);
+  CHECK (audio.ring_frames == 32768 && audio.period_frames == 160);
+
+  //The frame with the timestamp 0 arrives 1 s later, with the sample 0
+  audio_sync_init (&sync, &audio);
+  audio_sync_frame (&sync, 0, 1000000);
+  capture (&audio, RATE, 2000000, RATE);
+  audio_reader_start (&reader, &sync, "test", 0);
+
+  CHECK (audio_reader_read (&reader, 500000, data, 48000) == 4000);
+  check_samples (data, 4000, 0);
+  CHECK (audio_reader_read (&reader, 1000000, data, 48000) == 4000);
+  check_samples (data, 4000, 4000);
+  //The samples of the next 0.5 s haven't been captured yet
+  CHECK (!audio_reader_read (&reader, 1500000, data, 48000));
+  CHECK (!reader.skew_last && !reader.inserted && !reader.dropped);
+
+  //The sample clock is 2% fast: 20 ms of extra samples are dropped
+  capture (&audio, 16160, 3000000, 8160);
+  CHECK (audio_reader_read (&reader, 2000000, data, 48000) == 8000);
+  check_samples (data, 8000, 8000);
+  CHECK (reader.skew_last == 20000 && reader.dropped == 160);
+
+  //Then 4% slow: 40 ms of silence are inserted after the samples
+  capture (&audio, 23840, 4000000, 7680);
+  CHECK (audio_reader_read (&reader, 3000000, data, 48000) == 8000);
+  check_samples (data, 7680, 16160);
+  CHECK (!data[7680] && !data[7999]);
+  CHECK (reader.skew_last == -40000 && reader.inserted == 320);
+  CHECK (reader.skew_max == 40000);
+
+  //The reader falls more than the ring behind: it loses the oldest samples
+  //and reads the others across the end of the ring
+  capture (&audio, 63840, 9000000, RATE);
+  CHECK (audio_reader_read (&reader, 8000000, data, 48000) == 40000);
+  CHECK (reader.lost == 1);
+  check_samples (data, 32608, 31232);
+  CHECK (!data[32608]);
+  CHECK (reader.written == 64000);
+
+  CHECK (audio_reader_dump (&reader, stats, sizeof (stats)) > 0);
+  CHECK (strstr (stats, "8.0 s, skew "));
+  CHECK (strstr (stats, " 1 losses"));
+  audio_close (&audio);
+}
+
+//The offset of a camera follows its earliest buffers
+static void test_sync (){
+  audio_t audio;
+  audio_sync_t sync;
+
+  source (&audio);
+  audio_sync_init (&sync, &audio);
+  audio_sync_frame (&sync, 0, 1000);
+  CHECK (sync.offset_valid && sync.offset == 1000);
+  audio_sync_frame (&sync, 33333, 33333 + 900);
+  CHECK (sync.offset == 900);
+  audio_sync_frame (&sync, 66666, 66666 + 900 + 64*100);
+  CHECK (sync.offset == 1000);
+  audio_close (&audio);
+}
+
+static void put16 (uint8_t* p, uint32_t value){
+  p[0] = value;
+  p[1] = value >> 8;
+}
+
+static void put32 (uint8_t* p, uint32_t value){
+  put16 (p, value);
+  put16 (p + 2, value >> 16);
+}
+
+//A stereo WAV file is read at its rate by the thread
+static void test_wav (){
+  static uint8_t wav[44 + 12 + 4000*4];
+  audio_t audio;
+  char dir[64];
+  char path[128];
+  char spec[160];
+  char stats[256];
+  uint8_t* p = wav;
+  int i;
+
+  memcpy (p, "RIFFxxxxWAVE", 12);
+  p += 12;
+  //An odd chunk before the format, padded to 2 bytes
+  memcpy (p, "LIST", 4);
+  put32 (p + 4, 3);
+  p += 12;
+  memcpy (p, "fmt ", 4);
+  put32 (p + 4, 16);
+  put16 (p + 8, 1);
+  put16 (p + 10, 2);
+  put32 (p + 12, RATE);
+  put32 (p + 16, RATE*4);
+  put16 (p + 20, 4);
+  put16 (p + 22, 16);
+  p += 24;
+  memcpy (p, "data", 4);
+  put32 (p + 4, 4000*4);
+  p += 8;
+  for (i=0; i<4000; i++){
+    put16 (p, sample (i, 0));
+    put16 (p + 2, sample (i, 1));
+    p += 4;
+  }
+  put32 (wav + 4, p - wav - 8);
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path, sizeof (path), "%s/audio.wav", dir);
+  FILE* file = fopen (path, "wb");
+  CHECK (file && fwrite (wav, 1, p - wav, file) == (size_t)(p - wav));
+  fclose (file);
+
+  snprintf (spec, sizeof (spec), "wav:%s", path);
+  audio_open (&audio, spec);
+  CHECK (audio.rate == RATE && audio.channels == 2 && audio.paced);
+
+  //0.5 s of samples, the last period is read after 0.48 s
+  int64_t start = test_time ();
+  audio_start (&audio);
+  while (audio.frames < 4000 && test_time () - start < 3000000){
+    usleep (10000);
+  }
+  CHECK (test_time () - start >= 450000);
+  audio_stop (&audio);
+  CHECK (audio.frames == 4000);
+  for (i=0; i<4000; i++){
+    CHECK (audio.ring[2*i] == sample (i, 0));
+    CHECK (audio.ring[2*i + 1] == sample (i, 1));
+  }
+  CHECK (audio.clock_valid && audio.clock.position == 4000);
+  CHECK (audio.clock.rate == RATE);
+
+  CHECK (audio_dump (&audio, stats, sizeof (stats)) > 0);
+  CHECK (strstr (stats, "4000 frames, 8000 Hz (measured 8000.00), 2 channels"));
+  audio_close (&audio);
+  test_remove (dir);
+}
+
+static int open_source (const char* spec){
+  int status;
+  //Or the child would print the buffered output again when it exits
+  fflush (stdout);
+  pid_t pid = fork ();
+  CHECK (pid != -1);
+  if (!pid){
+    audio_t audio;
+    fclose (stderr);
+    audio_open (&audio, spec);
+    audio_close (&audio);
+    _exit (0);
+  }
+  CHECK (waitpid (pid, &status, 0) == pid);
+  CHECK (WIFEXITED (status));
+  return WEXITSTATUS (status);
+}
+
+static void test_spec (){
+  const char* invalid[] = {
+    "mic:default",
+    "alsa:",
+    "alsa:,rate=48000",
+    "wav:",
+    "wav:/dev/null",
+    "pcm:",
+    "pcm:/dev/null,rate=x",
+    "pcm:/dev/null,bits=16",
+    "pcm:/dev/null,rate=4000",
+    "pcm:/dev/null,rate=96000",
+    "pcm:/dev/null,channels=0",
+    "pcm:/dev/null,channels=3",
+    "pcm:/nonexistent/audio.raw"
+  };
+  audio_t audio;
+  char dir[64];
+  char path[128];
+  char spec[160];
+  size_t i;
+
+  for (i=0; i<sizeof (invalid)/sizeof (invalid[0]); i++){
+    CHECK (open_source (invalid[i]) == 1);
+  }
+
+  //The options start at the first ,rate= or ,channels=
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path, sizeof (path), "%s/a,b.raw", dir);
+  FILE* file = fopen (path, "wb");
+  CHECK (file);
+  fclose (file);
+  snprintf (spec, sizeof (spec), "pcm:%s,channels=2,rate=44100", path);
+  audio_open (&audio, spec);
+  CHECK (!strcmp (audio.path, path));
+  CHECK (audio.rate == 44100 && audio.channels == 2 && audio.paced);
+  CHECK (audio.period_frames == 882 && audio.ring_frames == 262144);
+  audio_close (&audio);
+  test_remove (dir);
+}
+
+int main (){
+  test_reader ();
+  test_sync ();
+  test_wav ();
+  test_spec ();
+  return 0;
+}
@@ -0,0 +1,120 @@
+#include "test.h"
+
+#include "frames.h"
+
+//Frame interval (us), long enough for the scheduling noise of a test machine
+#define INTERVAL 20000
+//Latency of the frames that arrive on time (us)
+#define LATENCY 5000
+
+//Timestamp of the last frame, on the grid of the frame interval
+static int64_t timestamp;
+
+//The encoder fills a buffer: the frame comes skip frames after the previous
+//one and arrives late us later than usual, and the buffer is given back after
+//hold us
+static void frame (
+    frames_t* frames,
+    uint32_t skip,
+    int64_t late,
+    int64_t hold,
+    int sync){
+  stream_buffer_t buffer;
+  uint8_t data[1] = { 0 };
+
+  timestamp += (skip + 1)*INTERVAL;
+  int64_t wait = timestamp + LATENCY + late - test_time ();
+  if (wait > 0) usleep (wait);
+  buffer.data = data;
+  buffer.length = 1;
+  buffer.timestamp = timestamp;
+  buffer.flags = STREAM_FLAG_ENDOFFRAME | (sync ? STREAM_FLAG_SYNCFRAME : 0);
+  frames_buffer (frames, &buffer);
+  usleep (hold);
+  frames_queued (frames);
+}
+
+static void steady (frames_t* frames, int n){
+  int i;
+  for (i=0; i<n; i++) frame (frames, 0, 0, 0, 0);
+}
+
+static void test_causes (){
+  frames_t frames;
+  char dump[1024];
+
+  frames_init (&frames, INTERVAL);
+  timestamp = test_time () - INTERVAL;
+  frame (&frames, 0, 0, 0, 1);
+  steady (&frames, 5);
+  CHECK (frames.frames == 6 && frames.keyframes == 1);
+  CHECK (!frames.bursts);
+
+  //Two frames never captured: the next one is on time
+  frame (&frames, 2, 0, 0, 0);
+  CHECK (frames.dropped_sensor == 2 && frames.bursts == 1);
+  steady (&frames, 5);
+
+  //The encoder was behind: the next frame is two intervals late
+  frame (&frames, 2, 2*INTERVAL, 0, 0);
+  CHECK (frames.dropped_encoder == 2 && frames.bursts == 2);
+  steady (&frames, 5);
+
+  //The host held the buffer for two intervals, the encoder had to skip one
+  frame (&frames, 0, 0, 2*INTERVAL, 0);
+  frame (&frames, 1, 0, 0, 0);
+  CHECK (frames.dropped_host == 1 && frames.bursts == 3);
+  CHECK (frames.hold_peak >= 2*INTERVAL);
+  CHECK (frames.burst_max == 2 && frames.burst_last == 1);
+  CHECK (frames.burst_last_timestamp == timestamp);
+
+  CHECK (frames.dropped_sensor == 2 && frames.dropped_encoder == 2);
+  frames_dump (&frames, dump, sizeof (dump));
+  const char* expected = "frames 20, keyframes 1, incomplete 0, backward 0, "
+      "dropped sensor 2 encoder 2 host 1, bursts 3 (last 1";
+  CHECK (!strncmp (dump, expected, strlen (expected)));
+}
+
+//Frames split in several buffers, a frame without its end and a timestamp
+//that doesn't advance
+static void test_buffers (){
+  frames_t frames;
+  stream_buffer_t buffer;
+  uint8_t data[1] = { 0 };
+
+  frames_init (&frames, INTERVAL);
+  buffer.data = data;
+  buffer.length = 1;
+  buffer.timestamp = 0;
+  buffer.flags = STREAM_FLAG_CODECCONFIG;
+  frames_buffer (&frames, &buffer);
+  CHECK (!frames.frames);
+
+  buffer.flags = 0;
+  frames_buffer (&frames, &buffer);
+  frames_buffer (&frames, &buffer);
+  buffer.flags = STREAM_FLAG_ENDOFFRAME;
+  frames_buffer (&frames, &buffer);
+  CHECK (frames.frames == 1 && !frames.incomplete);
+
+  buffer.timestamp = INTERVAL;
+  buffer.flags = 0;
+  frames_buffer (&frames, &buffer);
+  buffer.timestamp = 2*INTERVAL;
+  frames_buffer (&frames, &buffer);
+  CHECK (frames.frames == 2 && frames.incomplete == 1);
+  buffer.flags = STREAM_FLAG_ENDOFFRAME;
+  frames_buffer (&frames, &buffer);
+  CHECK (frames.frames == 3);
+
+  buffer.timestamp = INTERVAL;
+  frames_buffer (&frames, &buffer);
+  CHECK (frames.frames == 4 && frames.backward == 1);
+  CHECK (!frames.bursts);
+}
+
+int main (){
+  test_causes ();
+  test_buffers ();
+  return 0;
+}
@@ -0,0 +1,149 @@
+#include "test.h"
+
+#include <sys/un.h>
+
+#include "control.h"
+#include "idr.h"
+
+//Requests are coalesced, sent at most every IDR_INTERVAL_MIN ms, and
+//satisfied by the next IDR frame, periodic or not
+static void test_requests (){
+  idr_t idr;
+  long now = 100000;
+  int i;
+
+  idr_init (&idr);
+  CHECK (!idr_pending (&idr, now));
+  idr_request (&idr);
+  idr_request (&idr);
+  idr_request (&idr);
+  CHECK (idr_pending (&idr, now));
+  //In flight
+  CHECK (!idr_pending (&idr, now + 2000));
+  for (i=0; i<3; i++) idr_frame (&idr, 0);
+  idr_frame (&idr, 1);
+  CHECK (idr.latency_last == 4 && idr.latency_count == 1);
+  CHECK (!idr_pending (&idr, now + 2000));
+  CHECK (idr.sent_requests == 1);
+
+  //Rate limited
+  idr_request (&idr);
+  CHECK (!idr_pending (&idr, now + IDR_INTERVAL_MIN - 1));
+  CHECK (idr_pending (&idr, now + IDR_INTERVAL_MIN));
+  now += IDR_INTERVAL_MIN;
+
+  //A request that doesn't produce an IDR frame is sent again
+  for (i=0; i<=IDR_TIMEOUT_FRAMES; i++) idr_frame (&idr, 0);
+  CHECK (!idr_pending (&idr, now + 10));
+  idr_frame (&idr, 0);
+  CHECK (idr_pending (&idr, now + IDR_INTERVAL_MIN));
+  idr_frame (&idr, 1);
+  CHECK (idr.sent_requests == 3 && idr.latency_last == 1);
+
+  //A periodic IDR frame satisfies the pending requests
+  idr_request (&idr);
+  idr_frame (&idr, 1);
+  CHECK (!idr_pending (&idr, now + 10*IDR_INTERVAL_MIN));
+  CHECK (idr.idr_frames == 3 && idr.latency_count == 2);
+
+  char str[256];
+  idr_dump (&idr, str, sizeof (str));
+  CHECK (!strcmp (str, "requests 5, sent 3, idr frames 3, latency (frames) "
+      "last 1 avg 2.5 max 4"));
+}
+
+static int control_test_idr (void* arg, char* args, char* reply, size_t size){
+  if (*args){
+    snprintf (reply, size, "usage: idr");
+    return 1;
+  }
+  idr_request ((idr_t*)arg);
+  return 0;
+}
+
+static int control_test_echo (void* arg, char* args, char* reply,
+    size_t size){
+  snprintf (reply, size, "%s", args);
+  return 0;
+}
+
+//Sends a string and reads until the expected number of lines arrive
+static void command (int fd, const char* str, char* reply, size_t size,
+    int lines){
+  size_t length = 0;
+  ssize_t n;
+
+  CHECK (write (fd, str, strlen (str)) == (ssize_t)strlen (str));
+  while (lines && (n = read (fd, reply + length, size - 1 - length)) > 0){
+    reply[length + n] = 0;
+    while (n--) lines -= reply[length++] == '\n';
+  }
+  reply[length] = 0;
+}
+
+static void test_control (){
+  char dir[64];
+  char path[128];
+  char reply[4096];
+  char line[1200];
+  struct sockaddr_un addr;
+  control_t control;
+  idr_t idr;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path, sizeof (path), "%s/control.sock", dir);
+  idr_init (&idr);
+  control_init (&control);
+  control_register (&control, "idr", control_test_idr, &idr);
+  control_register (&control, "echo", control_test_echo, 0);
+  control_open (&control, path);
+
+  int fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  memset (&addr, 0, sizeof (addr));
+  addr.sun_family = AF_UNIX;
+  strcpy (addr.sun_path, path);
+  CHECK (!connect (fd, (struct sockaddr*)&addr, sizeof (addr)));
+
+  command (fd, "idr\n", reply, sizeof (reply), 1);
+  CHECK (!strcmp (reply, "ok\n"));
+  CHECK (idr.requests == 1);
+  command (fd, "idr now\n", reply, sizeof (reply), 1);
+  CHECK (!strcmp (reply, "error usage: idr\n"));
+  command (fd, "help\n", reply, sizeof (reply), 1);
+  CHECK (!strcmp (reply, "ok idr echo\n"));
+
+  //Several commands in one write, CRLF and empty lines
+  command (fd, "echo a b\r\n\nidr\necho\n", reply, sizeof (reply), 3);
+  CHECK (!strcmp (reply, "ok a b\nok\nok\n"));
+  CHECK (idr.requests == 2);
+
+  //Only the beginning of an unknown command is echoed
+  memset (line, 'x', 1000);
+  strcpy (line + 1000, "\n");
+  command (fd, line, reply, sizeof (reply), 1);
+  CHECK (!strncmp (reply, "error unknown command: xxx", 26));
+  CHECK (strlen (reply) == strlen ("error unknown command: \n") + 64);
+
+  //A line longer than CONTROL_LINE_SIZE closes the connection
+  memset (line, 'x', sizeof (line) - 1);
+  line[sizeof (line) - 1] = 0;
+  command (fd, line, reply, sizeof (reply), 1);
+  CHECK (!*reply);
+  close (fd);
+
+  //The next connection is served
+  fd = socket (AF_UNIX, SOCK_STREAM, 0);
+  CHECK (!connect (fd, (struct sockaddr*)&addr, sizeof (addr)));
+  command (fd, "echo again\n", reply, sizeof (reply), 1);
+  CHECK (!strcmp (reply, "ok again\n"));
+  close (fd);
+
+  control_close (&control);
+  test_remove (dir);
+}
+
+int main (){
+  test_requests ();
+  test_control ();
+  return 0;
+}
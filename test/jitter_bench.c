@@ -0,0 +1,148 @@
+#include "test.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <sys/wait.h>
+
+#include "frames.h"
+#include "rt.h"
+
+/*
+Jitter of the encoder loop with and without -r. A producer thread stands for
+the VideoCore: it sends a frame every INTERVAL us on an absolute clock, always
+at the highest priority. The capture thread waits for the frames like the
+encoder loop waits for EVENT_FILL_BUFFER_DONE, gives them to frames_t and fills
+a new FRAME_SIZE buffer for every frame, as the outputs do. LOAD processes per
+CPU, the rest of a busy system, keep all the CPUs busy and churn the memory
+meanwhile.
+
+For every run it prints the statistics of the arrival intervals measured by
+frames_t (the jitter printed by the control command) and the percentiles of the
+wake-up delay of the capture thread after the frame was sent. Without the
+privileges -r only prints warnings and both runs are alike.
+*/
+
+#define FRAMES 600
+//Frame interval (us), 60 fps
+#define INTERVAL 16667
+#define FRAME_SIZE (1024*1024)
+#define LOAD 2
+#define LOAD_SIZE (8*1024*1024)
+
+static int pipes[2];
+static int64_t delays[FRAMES];
+
+static void* producer_loop (void* arg){
+  struct sched_param param;
+  struct timespec next;
+  int64_t sent;
+  int i;
+
+  param.sched_priority = sched_get_priority_max (SCHED_FIFO);
+  if (pthread_setschedparam (pthread_self (), SCHED_FIFO, &param)){
+    fprintf (stderr, "warning: the producer has the default scheduling\n");
+  }
+  clock_gettime (CLOCK_MONOTONIC, &next);
+  for (i=0; i<FRAMES; i++){
+    next.tv_nsec += INTERVAL*1000;
+    if (next.tv_nsec >= 1000000000){
+      next.tv_nsec -= 1000000000;
+      next.tv_sec++;
+    }
+    clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &next, 0);
+    sent = test_time ();
+    CHECK (write (pipes[1], &sent, sizeof (sent)) == sizeof (sent));
+  }
+  return 0;
+}
+
+static void load_loop (){
+  uint8_t* data;
+  int i = 0;
+
+  while (1){
+    data = malloc (LOAD_SIZE);
+    CHECK (data);
+    memset (data, i++, LOAD_SIZE);
+    free (data);
+  }
+}
+
+static void run (const char* spec){
+  pthread_t producer;
+  pid_t load[64];
+  stream_buffer_t buffer;
+  frames_t frames;
+  int64_t sent;
+  int loads = LOAD*sysconf (_SC_NPROCESSORS_ONLN);
+  int i;
+
+  if (loads > 64) loads = 64;
+  for (i=0; i<loads; i++){
+    load[i] = fork ();
+    CHECK (load[i] != -1);
+    if (!load[i]) load_loop ();
+  }
+  if (spec) rt_configure (spec);
+  rt_thread (RT_CAPTURE);
+
+  CHECK (!pipe (pipes));
+  CHECK (!pthread_create (&producer, 0, producer_loop, 0));
+
+  frames_init (&frames, INTERVAL);
+  for (i=0; i<FRAMES; i++){
+    CHECK (read (pipes[0], &sent, sizeof (sent)) == sizeof (sent));
+    int64_t now = test_time ();
+    delays[i] = now - sent;
+    buffer.data = malloc (FRAME_SIZE);
+    CHECK (buffer.data);
+    memset (buffer.data, i, FRAME_SIZE);
+    buffer.length = FRAME_SIZE;
+    buffer.timestamp = sent;
+    buffer.flags = STREAM_FLAG_ENDOFFRAME;
+    frames_buffer (&frames, &buffer);
+    free (buffer.data);
+    frames_queued (&frames);
+  }
+
+  CHECK (!pthread_join (producer, 0));
+  for (i=0; i<loads; i++){
+    kill (load[i], SIGKILL);
+    CHECK (waitpid (load[i], 0, 0) == load[i]);
+  }
+
+  double mean = frames.arrival_sum/frames.arrivals;
+  double deviation = frames.arrival_sum2/frames.arrivals - mean*mean;
+  test_percentile_t percentile = test_percentile (delays, FRAMES);
+  printf ("%s: interval avg %.3f ms stddev %.3f ms max %.3f ms, wake-up p50 "
+      "%lld us p99 %lld us max %lld us\n", spec ? spec : "default",
+      mean/1000, deviation > 0 ? sqrt (deviation)/1000 : 0,
+      frames.arrival_max/1000.0, (long long)percentile.p50,
+      (long long)percentile.p99, (long long)percentile.max);
+}
+
+//Every run is a process of its own, -r can't be undone
+static void run_process (const char* spec){
+  int status;
+  fflush (stdout);
+  pid_t pid = fork ();
+  CHECK (pid != -1);
+  if (!pid){
+    run (spec);
+    fflush (stdout);
+    _exit (0);
+  }
+  CHECK (waitpid (pid, &status, 0) == pid);
+  CHECK (WIFEXITED (status) && !WEXITSTATUS (status));
+}
+
+int main (){
+  printf ("%d frames at %d us, %d load processes per CPU\n", FRAMES, INTERVAL,
+      LOAD);
+  run_process (0);
+  run_process ("capture=fifo:50");
+  run_process ("capture=fifo:50@0");
+  return 0;
+}
@@ -0,0 +1,187 @@
+#include "test.h"
+
+#include "sink.h"
+
+#define GOP 30
+
+//Checks a fragment: sequence number, decode time, samples (AVCC NAL units of
+//the expected sizes) and the data offset to the mdat box
+static void check_fragment (
+    uint8_t* data,
+    size_t length,
+    int index,
+    uint32_t samples,
+    int64_t time,
+    const uint32_t* sizes){
+  uint32_t size;
+  uint32_t i;
+
+  uint8_t* moof = test_box (data, length, "moof", index, &size);
+  CHECK (moof);
+  uint32_t moof_size = size;
+  uint8_t* box = test_box (moof, moof_size, "mfhd", 0, &size);
+  CHECK (box && test_be32 (box + 4) == (uint32_t)index + 1);
+  box = test_box (moof, moof_size, "traf/tfhd", 0, &size);
+  CHECK (box && test_be32 (box) == 0x020000 && test_be32 (box + 4) == 1);
+  box = test_box (moof, moof_size, "traf/tfdt", 0, &size);
+  CHECK (box && box[0] == 1);
+  CHECK (test_be32 (box + 4) == (uint32_t)(time >> 32));
+  CHECK (test_be32 (box + 8) == (uint32_t)time);
+
+  uint8_t* trun = test_box (moof, moof_size, "traf/trun", 0, &size);
+  CHECK (trun && test_be32 (trun) == 0x000701);
+  CHECK (test_be32 (trun + 4) == samples && size == 12 + 12*samples);
+
+  //The data offset is relative to the moof box and points after the header
+  //of the next mdat box
+  uint8_t* mdat = test_box (data, length, "mdat", index, &size);
+  CHECK (mdat);
+  CHECK (moof - 8 + test_be32 (trun + 8) == mdat);
+  uint8_t* sample = mdat;
+  for (i=0; i<samples; i++){
+    uint8_t* entry = trun + 12 + 12*i;
+    uint32_t duration = test_be32 (entry);
+    CHECK (duration == 2999 || duration == 3000);
+    CHECK (test_be32 (entry + 8) == (i ? 0x01010000 : 0x02000000));
+
+    //Length prefixed NAL units
+    uint32_t sample_size = test_be32 (entry + 4);
+    uint32_t offset = 0;
+    uint32_t nals = 0;
+    while (offset < sample_size){
+      uint32_t nal = test_be32 (sample + offset);
+      CHECK (nal && nal == sizes[i*3 + nals] - 4);
+      offset += 4 + nal;
+      nals++;
+    }
+    CHECK (offset == sample_size);
+    CHECK (nals == (sizes[i*3 + 1] ? 3 : 1));
+    CHECK ((sample[4] & 0x1F) == (i ? 1 : nals == 3 ? 7 : 5));
+    sample += sample_size;
+  }
+  CHECK (sample == mdat + size);
+}
+
+static void test_fragments (){
+  char dir[64];
+  char path[128];
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  paramsets_t paramsets;
+  idr_t idr;
+  uint32_t sizes[3][3*GOP];
+  uint32_t size;
+  int i;
+  int j;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path, sizeof (path), "%s/video.mp4", dir);
+  test_stream_init (&stream, 100, 1920, 1080, 100000);
+  paramsets_init (&paramsets);
+  idr_init (&idr);
+  memset (sizes, 0, sizeof (sizes));
+
+  sink_t* sink = sink_open (path);
+  sink->paramsets = &paramsets;
+  sink->idr = &idr;
+  test_stream_config (&stream, &buffer);
+  paramsets_update (&paramsets, &buffer);
+  sink_write (sink, &buffer);
+
+  //The file starts at the first IDR frame, which the encoder sends anyway
+  test_stream_frame (&stream, &buffer, 0, 3000);
+  sink_write (sink, &buffer);
+  CHECK (sink->dropped_frames == 1 && !idr.requests);
+
+  for (j=0; j<3; j++){
+    //New SPS/PPS before the last GOP, they're repeated in its IDR frame
+    uint8_t config[128];
+    uint32_t sps_length = 0;
+    uint32_t pps_length = 0;
+    if (j == 2){
+      sps_length = test_sps (config, 100, 1280, 720);
+      pps_length = test_pps (config + sps_length, 0);
+      stream_buffer_t config_buffer = { config, sps_length + pps_length, 0,
+          STREAM_FLAG_CODECCONFIG };
+      CHECK (paramsets_update (&paramsets, &config_buffer));
+      sink_write (sink, &config_buffer);
+    }
+
+    for (i=0; i<GOP; i++){
+      test_stream_frame (&stream, &buffer, !i, i ? 2000 + i*100 : 20000);
+      if (i == 5){
+        //A frame in two buffers
+        stream_buffer_t part = buffer;
+        part.length = 1000;
+        part.flags &= ~STREAM_FLAG_ENDOFFRAME;
+        sink_write (sink, &part);
+        part.data += 1000;
+        part.length = buffer.length - 1000;
+        part.flags = buffer.flags;
+        sink_write (sink, &part);
+      }else{
+        sink_write (sink, &buffer);
+      }
+      if (!i && sps_length){
+        sizes[j][0] = sps_length;
+        sizes[j][1] = pps_length;
+        sizes[j][2] = buffer.length;
+      }else{
+        sizes[j][i*3] = buffer.length;
+      }
+    }
+  }
+  CHECK (sink->frames == 3*GOP);
+  sink_close (sink);
+
+  size_t length;
+  uint8_t* data = test_read_file (path, &length);
+
+  //ftyp and moov, with the first SPS/PPS in the avcC box
+  uint8_t* box = test_box (data, length, "ftyp", 0, &size);
+  CHECK (box == data + 8 && !memcmp (box, "isom", 4));
+  box = test_box (data, length, "moov/mvhd", 0, &size);
+  CHECK (box && test_be32 (box + 12) == 1000);
+  box = test_box (data, length, "moov/trak/tkhd", 0, &size);
+  CHECK (box && test_be32 (box + 12) == 1);
+  CHECK (test_be32 (box + 76) == 1920 << 16);
+  CHECK (test_be32 (box + 80) == 1080 << 16);
+  box = test_box (data, length, "moov/trak/mdia/mdhd", 0, &size);
+  CHECK (box && test_be32 (box + 12) == 90000);
+  box = test_box (data, length, "moov/trak/mdia/hdlr", 0, &size);
+  CHECK (box && !memcmp (box + 8, "vide", 4));
+  uint8_t* stsd = test_box (data, length, "moov/trak/mdia/minf/stbl/stsd", 0,
+      &size);
+  CHECK (stsd && test_be32 (stsd + 4) == 1);
+  uint8_t* avc1 = stsd + 8;
+  CHECK (!memcmp (avc1 + 4, "avc1", 4));
+  CHECK (test_be16 (avc1 + 32) == 1920 && test_be16 (avc1 + 34) == 1080);
+  uint8_t* avcc = avc1 + 8 + 78;
+  CHECK (!memcmp (avcc + 4, "avcC", 4));
+  CHECK (avcc[8] == 1 && avcc[9] == 100 && avcc[11] == 40);
+  CHECK (avcc[12] == 0xFF && avcc[13] == 0xE1);
+  uint32_t sps_length = test_be16 (avcc + 14);
+  CHECK (!memcmp (avcc + 16, stream.config + 4, sps_length));
+  CHECK (avcc[16 + sps_length] == 1);
+  uint32_t pps_length = test_be16 (avcc + 17 + sps_length);
+  CHECK (!memcmp (avcc + 19 + sps_length, stream.config + 8 + sps_length,
+      pps_length));
+  box = test_box (data, length, "moov/mvex/trex", 0, &size);
+  CHECK (box && test_be32 (box + 4) == 1);
+
+  //A fragment per GOP
+  for (j=0; j<3; j++){
+    check_fragment (data, length, j, GOP, j*GOP*stream.interval*9/100,
+        sizes[j]);
+  }
+  CHECK (!test_box (data, length, "moof", 3, &size));
+
+  free (data);
+  test_stream_free (&stream);
+  test_remove (dir);
+}
+
+int main (){
+  test_fragments ();
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include "test.h"
+
+#include "nal.h"
+
+/*
+Speed of the start code search (GB/s): nal_split() on a big buffer of frames,
+nal_scan() on the same stream in pieces like the encoder buffers, and the
+byte-at-a-time search for comparison. The frames are random bytes, as
+compressed slices look, with a start code every FRAME_SIZE bytes.
+*/
+
+#define SIZE (64*1024*1024)
+#define FRAME_SIZE 40000
+#define PIECE_SIZE 16384
+#define ROUNDS 10
+
+//The search of nal.c without SIMD
+static int scalar_count (uint8_t* p, uint8_t* end){
+  int n = 0;
+  for (; p + 2 < end; p++){
+    if (p[2] > 1){
+      p += 2;
+    }else if (!p[0] && !p[1] && p[2] == 1){
+      n++;
+    }
+  }
+  return n;
+}
+
+int main (){
+  static nal_t nals[SIZE/FRAME_SIZE + 1024];
+  static nal_entry_t entries[64];
+  nal_scanner_t scanner;
+  uint32_t state = 1;
+  uint32_t i;
+  int n = 0;
+  int r;
+
+  uint8_t* data = malloc (SIZE);
+  CHECK (data);
+  for (i=0; i<SIZE; i++){
+    state = state*1103515245 + 12345;
+    data[i] = state >> 16;
+  }
+  for (i=0; i + 5 < SIZE; i+=FRAME_SIZE){
+    memcpy (data + i, "\0\0\0\1\x41", 5);
+  }
+
+  int64_t start = test_time ();
+  for (r=0; r<ROUNDS; r++){
+    n = nal_split (data, SIZE, nals, sizeof (nals)/sizeof (nal_t));
+  }
+  int64_t time = test_time () - start;
+  printf ("nal_split: %d NAL units, %.2f GB/s\n", n,
+      (double)SIZE*ROUNDS/time/1000);
+
+  start = test_time ();
+  for (r=0; r<ROUNDS; r++){
+    nal_scanner_init (&scanner);
+    n = 0;
+    for (i=0; i<SIZE; i+=PIECE_SIZE){
+      n += nal_scan (&scanner, data + i, SIZE - i < PIECE_SIZE ? SIZE - i :
+          PIECE_SIZE, entries, 64);
+    }
+    n += nal_scanner_flush (&scanner, entries);
+  }
+  time = test_time () - start;
+  printf ("nal_scan (%u-byte pieces): %d NAL units, %.2f GB/s\n", PIECE_SIZE,
+      n, (double)SIZE*ROUNDS/time/1000);
+
+  start = test_time ();
+  for (r=0; r<ROUNDS; r++) n = scalar_count (data, data + SIZE);
+  time = test_time () - start;
+  printf ("byte-at-a-time: %d start codes, %.2f GB/s\n", n,
+      (double)SIZE*ROUNDS/time/1000);
+
+  free (data);
+  return 0;
+}
@@ -0,0 +1,149 @@
+#include "test.h"
+
+#include "nal.h"
+
+#define BUFFERS 5000
+#define BUFFER_SIZE 4096
+#define NALS_MAX BUFFER_SIZE
+
+//Reference: byte-at-a-time search of every 00 00 01, the NAL unit ends at the
+//next one, or before its first zero if it's a 4-byte start code
+static int reference_split (uint8_t* data, uint32_t length, nal_t* nals){
+  uint32_t start = 0;
+  uint32_t i;
+  int open = 0;
+  int n = 0;
+
+  for (i=0; i<=length; i++){
+    int code = i + 2 < length && !data[i] && !data[i + 1] && data[i + 2] == 1;
+    if (!code && i < length) continue;
+    if (open){
+      uint32_t end = i < length && i > start && !data[i - 1] ? i - 1 : i;
+      if (end > start){
+        nals[n].data = data + start;
+        nals[n].length = end - start;
+        nals[n].offset = start;
+        nals[n].type = data[start] & 0x1F;
+        n++;
+      }
+    }
+    open = 1;
+    start = i + 3;
+    i += 2;
+  }
+  return n;
+}
+
+static uint32_t random_next (uint32_t* state){
+  *state = *state*1103515245 + 12345;
+  return *state >> 8;
+}
+
+//Random bytes with many zeros and ones, so there are start codes of 3 and 4
+//bytes, runs of zeros and near misses everywhere, also across the 16-byte
+//blocks of the vectorized search
+static uint32_t random_buffer (uint32_t* state, uint8_t* data){
+  uint32_t length = random_next (state)%BUFFER_SIZE;
+  uint32_t i;
+
+  for (i=0; i<length; i++){
+    uint32_t r = random_next (state)%100;
+    data[i] = r < 45 ? 0 : r < 60 ? 1 : random_next (state);
+  }
+  return length;
+}
+
+static void check_nals (nal_t* a, int n, nal_t* b, int m){
+  int i;
+  CHECK (n == m);
+  for (i=0; i<n; i++){
+    CHECK (a[i].data == b[i].data);
+    CHECK (a[i].length == b[i].length);
+    CHECK (a[i].offset == b[i].offset);
+    CHECK (a[i].type == b[i].type);
+  }
+}
+
+static void test_nal_split (){
+  static uint8_t data[BUFFER_SIZE];
+  static nal_t nals[NALS_MAX];
+  static nal_t expected[NALS_MAX];
+  uint32_t state = 1;
+  int i;
+
+  for (i=0; i<BUFFERS; i++){
+    uint32_t length = random_buffer (&state, data);
+    int n = reference_split (data, length, expected);
+    check_nals (nals, nal_split (data, length, nals, NALS_MAX), expected, n);
+    //Only the first max NAL units
+    if (n > 2){
+      check_nals (nals, nal_split (data, length, nals, 2), expected, 2);
+    }
+  }
+
+  //Corner cases
+  uint8_t a[] = { 0, 0, 1 };
+  CHECK (!nal_split (a, sizeof (a), nals, NALS_MAX));
+  uint8_t b[] = { 0, 0, 0, 1, 0x65, 0, 0, 1, 0x41, 0xAA, 0, 0, 0 };
+  CHECK (nal_split (b, sizeof (b), nals, NALS_MAX) == 2);
+  CHECK (nals[0].offset == 4 && nals[0].length == 1 && nals[0].type == 5);
+  CHECK (nals[1].offset == 8 && nals[1].length == 5 && nals[1].type == 1);
+  uint8_t c[] = { 0x41, 0, 0, 1, 0x41 };
+  CHECK (nal_split (c, sizeof (c), nals, NALS_MAX) == 1);
+  CHECK (nals[0].offset == 4);
+}
+
+//The same stream fed in random pieces, start codes split in every possible
+//way, gives the NAL units of the whole buffer
+static void test_nal_scan (){
+  static uint8_t data[BUFFER_SIZE];
+  static nal_t expected[NALS_MAX];
+  static nal_entry_t nals[NALS_MAX];
+  nal_scanner_t scanner;
+  uint32_t state = 2;
+  int i;
+
+  for (i=0; i<BUFFERS; i++){
+    uint32_t length = random_buffer (&state, data);
+    int m = reference_split (data, length, expected);
+    //Pieces of up to 8 bytes, or 64, and some empty ones
+    uint32_t max = i%3 ? 1 + random_next (&state)%8 : 64;
+    uint32_t offset = 0;
+    int n = 0;
+
+    nal_scanner_init (&scanner);
+    while (offset < length){
+      uint32_t piece = random_next (&state)%(max + 1);
+      if (piece > length - offset) piece = length - offset;
+      n += nal_scan (&scanner, data + offset, piece, nals + n, NALS_MAX - n);
+      offset += piece;
+    }
+    n += nal_scanner_flush (&scanner, nals + n);
+
+    CHECK (n == m);
+    for (n=0; n<m; n++){
+      CHECK (nals[n].offset == expected[n].offset);
+      CHECK (nals[n].length == expected[n].length);
+      CHECK (nals[n].type == expected[n].type);
+    }
+  }
+
+  //A start code at the very end: the type is in the next buffer
+  uint8_t a[] = { 0, 0, 0, 1 };
+  uint8_t b[] = { 0x67, 0x42, 0, 0 };
+  uint8_t c[] = { 0, 1, 0x68, 0xCE };
+  nal_scanner_init (&scanner);
+  CHECK (!nal_scan (&scanner, a, sizeof (a), nals, NALS_MAX));
+  CHECK (!nal_scan (&scanner, b, sizeof (b), nals, NALS_MAX));
+  CHECK (nal_scan (&scanner, c, sizeof (c), nals, NALS_MAX) == 1);
+  CHECK (nals[0].offset == 4 && nals[0].length == 2 && nals[0].type == 7);
+  CHECK (nal_scanner_flush (&scanner, nals));
+  CHECK (nals[0].offset == 10 && nals[0].length == 2 && nals[0].type == 8);
+  CHECK (!nal_scanner_flush (&scanner, nals));
+}
+
+int main (){
+  test_nal_split ();
+  test_nal_scan ();
+  return 0;
+}
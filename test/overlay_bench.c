@@ -0,0 +1,111 @@
+#include "test.h"
+
+#include "overlay.h"
+
+/*
+Cost of the text (-b) on 1080p frames, blended in place in a pool of
+OVERLAY_BUFFERS buffers like the ones of the video port of the camera. FRAMES
+frames of camera time at 30 fps, so the text changes every 30 frames, with the
+text of the README and with a line of OVERLAY_TEXT_MAX characters. It prints
+the percentiles of the cost per frame and the share of the frame budget.
+
+  test/overlay_bench [INPUT.yuv WIDTHxHEIGHT [OUTPUT.yuv]]
+
+With an input file of I420 frames (e.g. ffmpeg ... -pix_fmt yuv420p -f rawvideo)
+the frames are read from it instead, and written with the text to the output,
+to watch the result (ffplay -f rawvideo -pixel_format yuv420p -video_size WxH).
+*/
+
+#define WIDTH 1920
+#define HEIGHT 1080
+#define FRAMES 3000
+#define FRAMERATE 30
+//Frames of an input file
+#define FRAMES_MAX 100000
+
+static int64_t costs[FRAMES_MAX];
+
+//Monotonic time (ns), the cost of a frame is a few microseconds
+static int64_t time_ns (){
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  return (int64_t)spec.tv_sec*1000000000 + spec.tv_nsec;
+}
+
+static void run (
+    const char* name,
+    const char* format,
+    uint32_t width,
+    uint32_t height,
+    FILE* input,
+    FILE* output){
+  uint8_t* buffers[OVERLAY_BUFFERS];
+  size_t size = width*height*3/2;
+  overlay_t overlay;
+  char stats[256];
+  uint32_t frames;
+  size_t i;
+
+  //A gradient, the frames of the camera are never uniform
+  for (i=0; i<OVERLAY_BUFFERS; i++){
+    size_t j;
+    buffers[i] = malloc (size);
+    CHECK (buffers[i]);
+    for (j=0; j<size; j++) buffers[i][j] = j % width + j/width;
+  }
+  overlay_init (&overlay, format, width, height, 0, 0);
+
+  time_t now = time (0);
+  for (frames=0; frames<(input ? FRAMES_MAX : FRAMES); frames++){
+    uint8_t* frame = buffers[frames % OVERLAY_BUFFERS];
+    if (input && fread (frame, 1, size, input) != size) break;
+    int64_t start = time_ns ();
+    overlay_frame (&overlay, frame, now + frames/FRAMERATE);
+    costs[frames] = time_ns () - start;
+    if (output) CHECK (fwrite (frame, 1, size, output) == size);
+  }
+
+  CHECK (frames);
+  int64_t sum = 0;
+  for (i=0; i<frames; i++) sum += costs[i];
+  test_percentile_t percentile = test_percentile (costs, frames);
+  printf ("%s, %ux%u, %u frames: avg %.1f us, p50 %.1f us, p99 %.1f us, "
+      "max %.1f us, %.3f%% of the frame budget at %d fps\n", name, width,
+      height, frames, sum/1000.0/frames, percentile.p50/1000.0,
+      percentile.p99/1000.0, percentile.max/1000.0,
+      100.0*sum/frames/(1.0e9/FRAMERATE), FRAMERATE);
+  overlay_dump (&overlay, stats, sizeof (stats));
+  printf ("  %s\n", stats);
+
+  overlay_close (&overlay);
+  for (i=0; i<OVERLAY_BUFFERS; i++) free (buffers[i]);
+}
+
+int main (int argc, char** argv){
+  char line[OVERLAY_TEXT_MAX + 1];
+  uint32_t width;
+  uint32_t height;
+
+  if (argc > 1){
+    if (argc < 3 || argc > 4 ||
+        sscanf (argv[2], "%ux%u", &width, &height) != 2 || !width ||
+        !height || width % 2 || height % 2){
+      fprintf (stderr, "usage: %s [INPUT.yuv WIDTHxHEIGHT [OUTPUT.yuv]]\n",
+          argv[0]);
+      return 1;
+    }
+    FILE* input = strcmp (argv[1], "-") ? fopen (argv[1], "rb") : stdin;
+    FILE* output = argc > 3 ? fopen (argv[3], "wb") : 0;
+    CHECK (input && (argc == 3 || output));
+    run (argv[1], "CAM1 %Y-%m-%d %H:%M:%S", width, height, input, output);
+    if (input != stdin) fclose (input);
+    if (output) fclose (output);
+    return 0;
+  }
+
+  memset (line, 'W', OVERLAY_TEXT_MAX);
+  line[OVERLAY_TEXT_MAX] = 0;
+  run ("date and time", "CAM1 %Y-%m-%d %H:%M:%S", WIDTH, HEIGHT, 0, 0);
+  run ("full line", line, WIDTH, HEIGHT, 0, 0);
+  return 0;
+}
@@ -0,0 +1,201 @@
+#include "test.h"
+
+#include "overlay.h"
+
+//640x360 frames in buffers padded like the ones of the camera: the text is
+//6x8 pixels per character at (10, 10)
+#define WIDTH 640
+#define HEIGHT 360
+#define STRIDE 672
+#define SLICE_HEIGHT 368
+#define FRAME_SIZE (STRIDE*SLICE_HEIGHT*3/2)
+
+static uint8_t before[FRAME_SIZE];
+static uint8_t frame[FRAME_SIZE];
+
+//Pseudo-random pixels, the same every time
+static void fill (uint8_t* data, size_t size){
+  uint32_t state = 12345;
+  size_t i;
+  for (i=0; i<size; i++){
+    state = state*1103515245 + 12345;
+    data[i] = state >> 24;
+  }
+}
+
+//pixel = value + pixel*alpha/255, alpha being the inverse one
+static uint8_t blend (uint8_t pixel, uint8_t value, uint8_t alpha){
+  uint32_t x = (pixel*alpha + 127)/255 + value;
+  return x > 255 ? 255 : x;
+}
+
+//Checks a plane of the frame: the rectangle of the text is blended with the
+//line, everything else is untouched, including the padding
+static void check_plane (
+    const uint8_t* original,
+    const uint8_t* blended,
+    uint32_t stride,
+    uint32_t rows,
+    const overlay_planes_t* line,
+    uint32_t x,
+    uint32_t y,
+    uint32_t width,
+    uint32_t height){
+  uint32_t i;
+  uint32_t j;
+
+  for (j=0; j<rows; j++){
+    for (i=0; i<stride; i++){
+      uint8_t expected = original[j*stride + i];
+      if (i >= x && i < x + width && j >= y && j < y + height){
+        uint32_t k = (j - y)*line->stride + i - x;
+        expected = blend (expected, line->value[k], line->alpha[k]);
+      }
+      CHECK (blended[j*stride + i] == expected);
+    }
+  }
+}
+
+static void check_frame (overlay_t* overlay){
+  uint32_t width = overlay->length*overlay->glyph_width;
+  uint32_t chroma = STRIDE*SLICE_HEIGHT;
+
+  check_plane (before, frame, STRIDE, SLICE_HEIGHT, &overlay->line,
+      overlay->x, overlay->y, width, overlay->glyph_height);
+  check_plane (before + chroma, frame + chroma, STRIDE/2, SLICE_HEIGHT/2,
+      &overlay->line_chroma, overlay->x/2, overlay->y/2, width/2,
+      overlay->glyph_height/2);
+  check_plane (before + chroma*5/4, frame + chroma*5/4, STRIDE/2,
+      SLICE_HEIGHT/2, &overlay->line_chroma, overlay->x/2, overlay->y/2,
+      width/2, overlay->glyph_height/2);
+}
+
+//The rows longer than 16 pixels go through NEON or SSE2, they give the same
+//pixels as the formula
+static void test_blend (){
+  overlay_t overlay;
+  char stats[256];
+
+  overlay_init (&overlay, "CAM1 %S", WIDTH, HEIGHT, STRIDE, SLICE_HEIGHT);
+  CHECK (overlay.glyph_width == 6 && overlay.glyph_height == 8);
+  CHECK (overlay.x == 10 && overlay.y == 10);
+  fill (before, FRAME_SIZE);
+  memcpy (frame, before, FRAME_SIZE);
+
+  overlay_frame (&overlay, frame, 1000);
+  CHECK (!strcmp (overlay.text, "CAM1 40"));
+  check_frame (&overlay);
+
+  //The same second keeps the text, the next one changes the last character
+  memcpy (before, frame, FRAME_SIZE);
+  overlay_frame (&overlay, frame, 1000);
+  check_frame (&overlay);
+  CHECK (overlay.updates == 1);
+  memcpy (before, frame, FRAME_SIZE);
+  overlay_frame (&overlay, frame, 1001);
+  CHECK (!strcmp (overlay.text, "CAM1 41"));
+  check_frame (&overlay);
+  CHECK (overlay.updates == 2 && overlay.frames == 3);
+
+  CHECK (overlay_dump (&overlay, stats, sizeof (stats)) > 0);
+  CHECK (strstr (stats, "3 frames, 2 text updates, 42x8 pixels, "));
+  overlay_close (&overlay);
+}
+
+//The pixels of a glyph on a gray frame
+static void test_glyph (){
+  overlay_t overlay;
+  uint32_t chroma = STRIDE*SLICE_HEIGHT;
+  uint8_t* luma = frame + 10*STRIDE + 10;
+
+  overlay_init (&overlay, "A\t", WIDTH, HEIGHT, STRIDE, SLICE_HEIGHT);
+  memset (frame, 100, chroma);
+  memset (frame + chroma, 200, chroma/2);
+  overlay_frame (&overlay, frame, 0);
+
+  //Anything that is not printable is a space
+  CHECK (!strcmp (overlay.text, "A "));
+  //The first column of the A is lit in the rows 1 to 6, the background is
+  //OVERLAY_BACKGROUND opaque: 16*96/255 + 100*159/255
+  CHECK (luma[0] == 68 && luma[7*STRIDE] == 68);
+  CHECK (luma[STRIDE] == 235 && luma[6*STRIDE] == 235);
+  CHECK (luma[5] == 68 && luma[6 + 3*STRIDE] == 68);
+  CHECK (luma[-1] == 100 && luma[12] == 100 && luma[8*STRIDE] == 100);
+  //The chroma of the background goes a bit to gray, 128*96/255 + 200*159/255
+  CHECK (frame[chroma + 5*(STRIDE/2) + 5 + 4] == 173);
+  CHECK (frame[chroma + 5*(STRIDE/2) + 5 + 6] == 200);
+  overlay_close (&overlay);
+}
+
+//The characters that don't fit are dropped, and a frame that has room for
+//none has no text
+static void test_clip (){
+  overlay_t overlay;
+
+  fill (before, FRAME_SIZE);
+  overlay_init (&overlay, "ABCDEFGH", 10 + 3*6 + 5, HEIGHT, STRIDE,
+      SLICE_HEIGHT);
+  memcpy (frame, before, FRAME_SIZE);
+  overlay_frame (&overlay, frame, 0);
+  CHECK (!strcmp (overlay.text, "ABC"));
+  check_frame (&overlay);
+  overlay_close (&overlay);
+
+  //Room for 5 pixels only
+  overlay_init (&overlay, "ABCDEFGH", 15, HEIGHT, STRIDE, SLICE_HEIGHT);
+  CHECK (!overlay.line.stride);
+  memcpy (frame, before, FRAME_SIZE);
+  overlay_frame (&overlay, frame, 0);
+  CHECK (!memcmp (frame, before, FRAME_SIZE));
+  CHECK (!overlay.frames && !overlay.updates);
+  overlay_close (&overlay);
+
+  //The position is off the frame
+  overlay_init (&overlay, "ABCDEFGH", 8, HEIGHT, STRIDE, SLICE_HEIGHT);
+  CHECK (!overlay.line.stride);
+  overlay_frame (&overlay, frame, 0);
+  CHECK (!memcmp (frame, before, FRAME_SIZE));
+  overlay_close (&overlay);
+}
+
+//The second of the text follows the timestamps of the camera, mapped to the
+//wall clock at the first buffer, and the short buffers are counted
+static void test_buffer (){
+  overlay_t overlay;
+  char stats[256];
+
+  overlay_init (&overlay, "%s", WIDTH, HEIGHT, STRIDE, SLICE_HEIGHT);
+  fill (before, FRAME_SIZE);
+  memcpy (frame, before, FRAME_SIZE);
+  overlay_buffer (&overlay, frame, FRAME_SIZE - 1, 5000000);
+  CHECK (!memcmp (frame, before, FRAME_SIZE));
+  CHECK (!overlay.epoch_set && overlay.short_frames == 1);
+
+  time_t now = time (0);
+  overlay_buffer (&overlay, frame, FRAME_SIZE, 5000000);
+  CHECK (overlay.epoch_set);
+  time_t first = overlay.second;
+  CHECK (first >= now && first <= time (0));
+  check_frame (&overlay);
+
+  //The epoch on a second: the text changes when the timestamp reaches the
+  //next one
+  overlay.epoch -= overlay.epoch % 1000000;
+  overlay_buffer (&overlay, frame, FRAME_SIZE, 5999999);
+  CHECK (overlay.second == overlay.epoch/1000000 + 5);
+  overlay_buffer (&overlay, frame, FRAME_SIZE, 15000000);
+  CHECK (overlay.second == overlay.epoch/1000000 + 15);
+  CHECK (overlay.frames == 3);
+
+  CHECK (overlay_dump (&overlay, stats, sizeof (stats)) > 0);
+  CHECK (strstr (stats, ", 1 short frames without the text"));
+  overlay_close (&overlay);
+}
+
+int main (){
+  test_blend ();
+  test_glyph ();
+  test_clip ();
+  test_buffer ();
+  return 0;
+}
@@ -0,0 +1,138 @@
+#include "test.h"
+
+#include "bits.h"
+#include "paramsets.h"
+
+static void test_bits (){
+  uint32_t values[] = { 0, 1, 2, 3, 7, 254, 255, 65535, 1000000,
+      (1 << 28) - 2 };
+  int32_t signed_values[] = { 0, 1, -1, 2, -2, 1000, -1000, 123456 };
+  test_bits_t writer = { .position = 0 };
+  bits_t bits;
+  uint32_t i;
+
+  for (i=0; i<sizeof (values)/sizeof (values[0]); i++){
+    test_bits_ue (&writer, values[i]);
+    test_bits_put (&writer, i, 5);
+  }
+  for (i=0; i<sizeof (signed_values)/sizeof (signed_values[0]); i++){
+    test_bits_se (&writer, signed_values[i]);
+  }
+  bits_init (&bits, writer.data, (writer.position + 7)/8);
+  for (i=0; i<sizeof (values)/sizeof (values[0]); i++){
+    CHECK (bits_ue (&bits) == values[i]);
+    CHECK (bits_read (&bits, 5) == i);
+  }
+  for (i=0; i<sizeof (signed_values)/sizeof (signed_values[0]); i++){
+    CHECK (bits_se (&bits) == signed_values[i]);
+  }
+  CHECK (bits.position == writer.position);
+  CHECK (!bits_overrun (&bits));
+  bits_read (&bits, 16);
+  CHECK (bits_overrun (&bits));
+
+  //More than 28 leading zeros is not a valid code
+  uint8_t zeros[8] = { 0, 0, 0, 0, 0x80 };
+  bits_init (&bits, zeros, sizeof (zeros));
+  bits_ue (&bits);
+  CHECK (bits_overrun (&bits));
+
+  //The emulation prevention bytes are removed
+  uint8_t escaped[] = { 0x11, 0, 0, 3, 1, 0, 0, 3, 0, 0, 3 };
+  uint8_t rbsp[16];
+  uint8_t expected[] = { 0x11, 0, 0, 1, 0, 0, 0, 0 };
+  CHECK (bits_unescape (rbsp, sizeof (rbsp), escaped, sizeof (escaped)) ==
+      sizeof (expected));
+  CHECK (!memcmp (rbsp, expected, sizeof (expected)));
+}
+
+static void test_parse (){
+  uint8_t data[64];
+  sps_t sps;
+  pps_t pps;
+  struct {
+    uint8_t profile;
+    uint32_t width;
+    uint32_t height;
+  } sizes[] = {
+    { 66, 640, 480 }, { 77, 1280, 720 }, { 100, 1920, 1080 },
+    { 100, 1640, 922 }, { 100, 3280, 2464 }
+  };
+  uint32_t i;
+
+  for (i=0; i<sizeof (sizes)/sizeof (sizes[0]); i++){
+    uint32_t length = test_sps (data, sizes[i].profile, sizes[i].width,
+        sizes[i].height);
+    CHECK (!sps_parse (&sps, data + 4, length - 4));
+    CHECK (sps.profile_idc == sizes[i].profile && sps.level_idc == 40);
+    CHECK (sps.width == sizes[i].width && sps.height == sizes[i].height);
+    CHECK (sps.chroma_format_idc == 1 && sps.bit_depth_luma == 8);
+    CHECK (sps.log2_max_frame_num == 8 && !sps.poc_type);
+    CHECK (sps.log2_max_poc_lsb == 8 && sps.frame_mbs_only);
+    //Truncated
+    CHECK (sps_parse (&sps, data + 4, 6));
+  }
+
+  uint32_t length = test_pps (data, 3);
+  CHECK (!pps_parse (&pps, data + 4, length - 4));
+  CHECK (pps.id == 3 && !pps.sps_id && !pps.entropy_coding_mode);
+  CHECK (pps_parse (&pps, data + 4, 1));
+}
+
+static void update (paramsets_t* paramsets, uint8_t* data, uint32_t length,
+    int changed){
+  stream_buffer_t buffer = { data, length, 0, STREAM_FLAG_CODECCONFIG };
+  CHECK (paramsets_update (paramsets, &buffer) == changed);
+}
+
+static void test_cache (){
+  paramsets_t paramsets;
+  uint8_t config[128];
+  uint8_t pps[32];
+
+  paramsets_init (&paramsets);
+  uint32_t sps_length = test_sps (config, 100, 1920, 1080);
+  uint32_t length = sps_length + test_pps (config + sps_length, 0);
+  uint32_t pps_length = test_pps (pps, 1);
+
+  //The SPS alone is not enough
+  update (&paramsets, config, sps_length, 0);
+  CHECK (!paramsets.complete && !paramsets.generation);
+  update (&paramsets, config + sps_length, length - sps_length, 1);
+  CHECK (paramsets.complete && paramsets.generation == 1);
+  CHECK (paramsets.length == length);
+  CHECK (!memcmp (paramsets.data, config, length));
+  CHECK (paramsets.sps.width == 1920 && paramsets.sps.height == 1080);
+
+  //The same ones again don't change anything
+  update (&paramsets, config, length, 0);
+  CHECK (paramsets.generation == 1);
+
+  //A new PPS replaces the old one
+  update (&paramsets, pps, pps_length, 1);
+  CHECK (paramsets.generation == 2 && paramsets.pps.id == 1);
+  CHECK (paramsets.length == sps_length + pps_length);
+  CHECK (!memcmp (paramsets.pps_nal, pps + 4, pps_length - 4));
+
+  //A new SPS starts a new set, the old PPS is dropped until the next one
+  uint32_t length2 = test_sps (config, 66, 640, 480);
+  update (&paramsets, config, length2, 0);
+  CHECK (!paramsets.complete && paramsets.generation == 2);
+  update (&paramsets, pps, pps_length, 1);
+  CHECK (paramsets.complete && paramsets.generation == 3);
+  CHECK (paramsets.sps.width == 640 && paramsets.sps.profile_idc == 66);
+
+  //After a port settings change, even the same SPS starts a new set
+  paramsets_invalidate (&paramsets);
+  update (&paramsets, config, length2, 0);
+  CHECK (!paramsets.complete);
+  update (&paramsets, pps, pps_length, 1);
+  CHECK (paramsets.generation == 4);
+}
+
+int main (){
+  test_bits ();
+  test_parse ();
+  test_cache ();
+  return 0;
+}
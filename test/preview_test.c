@@ -0,0 +1,156 @@
+#include "test.h"
+
+#include <sys/wait.h>
+
+#include "preview.h"
+
+#define FRAMERATE 30
+#define FRAME_SIZE (PREVIEW_WIDTH*PREVIEW_HEIGHT*3/2)
+
+static void test_scale (){
+  uint8_t src[64*18*3/2];
+  uint8_t dst[16*4*3/2];
+  uint32_t i, j;
+
+  //A vertical ramp, 18 rows into 4: boxes of 4, 5, 4 and 5 rows, rounded
+  for (j=0; j<18; j++){
+    for (i=0; i<64; i++) src[j*64 + i] = j;
+  }
+  memset (src + 64*18, 100, 64*18/2);
+  preview_scale (src, 64, 18, dst, 16, 4);
+  for (i=0; i<16; i++){
+    CHECK (dst[i] == 2);
+    CHECK (dst[16 + i] == 6);
+    CHECK (dst[32 + i] == 11);
+    CHECK (dst[48 + i] == 15);
+  }
+  for (i=16*4; i<sizeof (dst); i++) CHECK (dst[i] == 100);
+}
+
+static void test_standin (){
+  preview_standin_t standin;
+  stream_buffer_t* buffers[PREVIEW_BUFFERS];
+  uint32_t x, y;
+  int i;
+
+  preview_standin_init (&standin, 640, 480, PREVIEW_WIDTH, PREVIEW_HEIGHT,
+      FRAMERATE);
+
+  //Every pixel is the average of a 2x2 box of the gradient i + 2j + 3*frame
+  buffers[0] = preview_standin_fill (&standin);
+  CHECK (buffers[0]);
+  CHECK (buffers[0]->length == FRAME_SIZE);
+  CHECK (buffers[0]->timestamp == 0);
+  for (y=0; y<30; y++){
+    for (x=0; x<30; x++){
+      CHECK (buffers[0]->data[y*PREVIEW_WIDTH + x] == 2*x + 4*y + 2);
+    }
+  }
+
+  //The application holds every buffer, the next frame is lost
+  for (i=1; i<PREVIEW_BUFFERS; i++){
+    CHECK ((buffers[i] = preview_standin_fill (&standin)));
+    CHECK (buffers[i] != buffers[i - 1]);
+  }
+  CHECK (!preview_standin_fill (&standin));
+  preview_standin_release (&standin, buffers[1]);
+  stream_buffer_t* buffer = preview_standin_fill (&standin);
+  CHECK (buffer == buffers[1]);
+  CHECK (buffer->timestamp == (PREVIEW_BUFFERS + 1)*1000000/FRAMERATE);
+  CHECK (buffer->data[0] == 3*(PREVIEW_BUFFERS + 1) + 2);
+
+  preview_standin_close (&standin);
+}
+
+//The stand-in feeds the preview output at 30 fps, lowered to 10 fps
+static void test_output (){
+  preview_t preview;
+  preview_standin_t standin;
+  char dir[64];
+  char spec[160];
+  char path[128];
+  char stats[256];
+  size_t length;
+  int i;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path, sizeof (path), "%s/preview.yuv", dir);
+  snprintf (spec, sizeof (spec), "%s,fps=10", path);
+  preview_init (&preview, spec, FRAMERATE);
+  preview_open (&preview);
+  preview_standin_init (&standin, 1280, 720, preview.width, preview.height,
+      FRAMERATE);
+
+  for (i=0; i<30; i++){
+    stream_buffer_t* buffer = preview_standin_fill (&standin);
+    CHECK (buffer);
+    preview_frame (&preview, buffer);
+    preview_standin_release (&standin, buffer);
+  }
+  //A frame of another size
+  stream_buffer_t partial = { standin.camera, 1000, 30*1000000/FRAMERATE,
+      STREAM_FLAG_ENDOFFRAME };
+  preview_frame (&preview, &partial);
+
+  CHECK (preview.frames == 10 && preview.skipped == 20 &&
+      preview.invalid == 1);
+  CHECK (preview_dump (&preview, stats, sizeof (stats)) > 0);
+  CHECK (!strcmp (stats, "320x240 at 10 fps, frames 10, skipped 20, "
+      "invalid 1, dropped by the output 0"));
+  preview_close (&preview);
+  preview_standin_close (&standin);
+
+  //Frames 0, 3, 6... of the camera, whole. The first pixel is the average of a
+  //4x3 box
+  uint8_t* data = test_read_file (path, &length);
+  CHECK (length == 10*FRAME_SIZE);
+  for (i=0; i<10; i++) CHECK (data[i*FRAME_SIZE] == 3*3*i + 4);
+  free (data);
+  test_remove (dir);
+}
+
+static int init (const char* spec){
+  int status;
+  //Or the child would print the buffered output again when it exits
+  fflush (stdout);
+  pid_t pid = fork ();
+  CHECK (pid != -1);
+  if (!pid){
+    preview_t preview;
+    fclose (stderr);
+    preview_init (&preview, spec, FRAMERATE);
+    _exit (0);
+  }
+  CHECK (waitpid (pid, &status, 0) == pid);
+  CHECK (WIFEXITED (status));
+  return WEXITSTATUS (status);
+}
+
+static void test_invalid (){
+  const char* specs[] = {
+    "",
+    ",fps=10",
+    "preview.mp4",
+    "preview.ts",
+    "rtp:127.0.0.1:5004",
+    "preview.yuv,size=100x240",
+    "preview.yuv,size=320x250",
+    "preview.yuv,fps=60",
+    "preview.yuv,fps=0",
+    "preview.yuv,rate=10"
+  };
+  size_t i;
+
+  for (i=0; i<sizeof (specs)/sizeof (specs[0]); i++){
+    CHECK (init (specs[i]) == 1);
+  }
+  CHECK (init ("preview.yuv,size=640x480,fps=15") == 0);
+}
+
+int main (){
+  test_scale ();
+  test_standin ();
+  test_output ();
+  test_invalid ();
+  return 0;
+}
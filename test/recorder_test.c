@@ -0,0 +1,334 @@
+#include "test.h"
+
+#include <pthread.h>
+
+#include "recorder.h"
+
+//Frames received by the callback
+typedef struct {
+  recorder_t* recorder;
+  pthread_mutex_t mutex;
+  //Keep the frames instead of releasing them
+  int keep;
+  recorder_frame_t* kept[RECORDER_BUFFERS_MAX];
+  int kept_length;
+  int frames;
+  int64_t timestamp;
+  uint32_t length;
+  //Result of the last release, or of the stop if stop is set
+  int result;
+  int stop;
+} context_t;
+
+static void on_frame (
+    recorder_t* recorder,
+    recorder_frame_t* frame,
+    void* arg){
+  context_t* context = arg;
+
+  CHECK (recorder == context->recorder);
+  CHECK (frame->buffer.flags == STREAM_FLAG_ENDOFFRAME);
+  CHECK (frame->buffer.data[0] == (frame->buffer.timestamp & 0xFF));
+  pthread_mutex_lock (&context->mutex);
+  context->timestamp = frame->buffer.timestamp;
+  context->length = frame->buffer.length;
+  if (context->stop){
+    context->result = recorder_stop (recorder);
+  }
+  if (context->keep){
+    context->kept[context->kept_length++] = frame;
+  }else{
+    context->result = recorder_release (recorder, frame);
+  }
+  context->frames++;
+  pthread_mutex_unlock (&context->mutex);
+}
+
+static void context_init (context_t* context){
+  memset (context, 0, sizeof (context_t));
+  pthread_mutex_init (&context->mutex, 0);
+}
+
+//Waits up to 1 s for the callback to receive frames
+static void wait_frames (context_t* context, int frames){
+  int64_t start = test_time ();
+  int received;
+
+  do{
+    pthread_mutex_lock (&context->mutex);
+    received = context->frames;
+    pthread_mutex_unlock (&context->mutex);
+    if (received >= frames) return;
+    usleep (1000);
+  }while (test_time () - start < 1000000);
+  CHECK (received >= frames);
+}
+
+static recorder_t* open_standin (recorder_standin_t* standin){
+  recorder_pipeline_t pipeline;
+  recorder_t* recorder;
+
+  recorder_standin_init (&pipeline, standin);
+  CHECK (!recorder_open_pipeline (&recorder, &pipeline, 0));
+  CHECK (!strcmp (standin->calls, "open"));
+  standin->calls[0] = 0;
+  return recorder;
+}
+
+static void test_state (){
+  recorder_standin_t standin;
+  recorder_config_t config;
+  context_t context;
+
+  context_init (&context);
+  recorder_t* recorder = open_standin (&standin);
+  recorder_config_init (&config);
+  CHECK (config.buffers == 3 && config.bitrate == 17000000);
+
+  CHECK (recorder_start (recorder) == RECORDER_ERROR_STATE);
+  CHECK (!strcmp (recorder_error (recorder), "start before configure"));
+  CHECK (recorder_stop (recorder) == RECORDER_ERROR_STATE);
+  CHECK (!strcmp (recorder_error (recorder), "not recording"));
+  config.bitrate = 25000001;
+  CHECK (recorder_configure (recorder, &config, on_frame, &context) ==
+      RECORDER_ERROR_INVALID);
+  config.bitrate = 4000000;
+  CHECK (recorder_configure (recorder, &config, 0, &context) ==
+      RECORDER_ERROR_INVALID);
+  CHECK (!standin.calls[0]);
+
+  //A failed configure is undone, the error of the configure is kept
+  standin.fail = "configure";
+  CHECK (recorder_configure (recorder, &config, on_frame, &context) ==
+      RECORDER_ERROR_OMX);
+  CHECK (!strcmp (recorder_error (recorder), "configure: OMX_ErrorHardware"));
+  CHECK (!strcmp (standin.calls, "configure unconfigure"));
+  CHECK (recorder_start (recorder) == RECORDER_ERROR_STATE);
+
+  //And the recorder can be configured again
+  standin.fail = 0;
+  standin.calls[0] = 0;
+  CHECK (!recorder_configure (recorder, &config, on_frame, &context));
+  CHECK (!strcmp (standin.calls, "configure"));
+  CHECK (standin.state == 1 && standin.length == 3);
+  CHECK (!recorder_configure (recorder, &config, on_frame, &context));
+  CHECK (!strcmp (standin.calls, "configure unconfigure configure"));
+
+  //Every buffer is given to the encoder before the capture starts
+  standin.calls[0] = 0;
+  CHECK (!recorder_start (recorder));
+  CHECK (!strcmp (standin.calls, "execute capture"));
+  CHECK (standin.state == 2 && standin.capturing);
+  CHECK (standin.owned_length == 3);
+  CHECK (recorder_start (recorder) == RECORDER_ERROR_STATE);
+  CHECK (!strcmp (recorder_error (recorder), "already recording"));
+  CHECK (recorder_configure (recorder, &config, on_frame, &context) ==
+      RECORDER_ERROR_STATE);
+
+  standin.calls[0] = 0;
+  CHECK (!recorder_stop (recorder));
+  CHECK (!strcmp (standin.calls, "nocapture idle"));
+  CHECK (standin.state == 1 && !standin.capturing);
+
+  //Started again, stopped by the close
+  CHECK (!recorder_start (recorder));
+  CHECK (standin.owned_length == 3);
+  standin.calls[0] = 0;
+  recorder_close (recorder);
+  CHECK (!strcmp (standin.calls, "nocapture idle unconfigure close"));
+}
+
+//A start that fails is undone, the recorder stays configured
+static void test_start_failure (){
+  recorder_standin_t standin;
+  recorder_config_t config;
+  context_t context;
+
+  context_init (&context);
+  recorder_t* recorder = open_standin (&standin);
+  recorder_config_init (&config);
+  CHECK (!recorder_configure (recorder, &config, on_frame, &context));
+
+  standin.calls[0] = 0;
+  standin.fail = "execute";
+  CHECK (recorder_start (recorder) == RECORDER_ERROR_OMX);
+  CHECK (!strcmp (recorder_error (recorder), "execute: OMX_ErrorHardware"));
+  CHECK (!strcmp (standin.calls, "execute idle"));
+
+  standin.calls[0] = 0;
+  standin.fail = "capture";
+  CHECK (recorder_start (recorder) == RECORDER_ERROR_OMX);
+  CHECK (!strcmp (recorder_error (recorder), "capture: OMX_ErrorHardware"));
+  CHECK (!strcmp (standin.calls, "execute capture nocapture idle"));
+
+  standin.fail = 0;
+  CHECK (!recorder_start (recorder));
+  CHECK (!recorder_stop (recorder));
+  recorder_close (recorder);
+}
+
+static void test_frames (){
+  recorder_standin_t standin;
+  recorder_config_t config;
+  context_t context;
+  int i;
+
+  context_init (&context);
+  recorder_t* recorder = context.recorder = open_standin (&standin);
+  recorder_config_init (&config);
+  CHECK (!recorder_configure (recorder, &config, on_frame, &context));
+  //No buffers before the start
+  CHECK (!recorder_standin_fill (&standin, 10));
+  CHECK (!recorder_start (recorder));
+
+  //The frames are released by the callback, the encoder never runs out
+  for (i=0; i<10; i++){
+    CHECK (recorder_standin_fill (&standin, 10 + i));
+    wait_frames (&context, i + 1);
+    CHECK (context.timestamp == i*33333 && context.length == 10 + i);
+    CHECK (!context.result);
+  }
+
+  //An empty buffer goes back to the encoder without the callback
+  CHECK (recorder_standin_fill (&standin, 0));
+  CHECK (recorder_standin_fill (&standin, 5));
+  wait_frames (&context, 11);
+  CHECK (context.length == 5);
+  usleep (10000);
+  CHECK (context.frames == 11);
+
+  CHECK (!recorder_stop (recorder));
+  recorder_close (recorder);
+}
+
+static void* release_later (void* arg){
+  context_t* context = arg;
+  int i;
+
+  usleep (50000);
+  pthread_mutex_lock (&context->mutex);
+  for (i=0; i<context->kept_length; i++){
+    CHECK (!recorder_release (context->recorder, context->kept[i]));
+  }
+  context->kept_length = 0;
+  pthread_mutex_unlock (&context->mutex);
+  return 0;
+}
+
+//The frames kept by the application, the stop waits for them
+static void test_kept (){
+  recorder_standin_t standin;
+  recorder_config_t config;
+  context_t context;
+  pthread_t thread;
+
+  context_init (&context);
+  context.keep = 1;
+  recorder_t* recorder = context.recorder = open_standin (&standin);
+  recorder_config_init (&config);
+  CHECK (!recorder_configure (recorder, &config, on_frame, &context));
+  CHECK (!recorder_start (recorder));
+
+  CHECK (recorder_standin_fill (&standin, 10));
+  CHECK (recorder_standin_fill (&standin, 10));
+  CHECK (recorder_standin_fill (&standin, 10));
+  //The encoder has no buffer left
+  CHECK (!recorder_standin_fill (&standin, 10));
+  wait_frames (&context, 3);
+
+  //Released from another thread, the encoder fills the oldest one first
+  pthread_mutex_lock (&context.mutex);
+  CHECK (!recorder_release (recorder, context.kept[1]));
+  context.kept[1] = context.kept[--context.kept_length];
+  pthread_mutex_unlock (&context.mutex);
+  CHECK (recorder_standin_fill (&standin, 10));
+  wait_frames (&context, 4);
+  CHECK (context.timestamp == 3*33333);
+
+  CHECK (!pthread_create (&thread, 0, release_later, &context));
+  int64_t start = test_time ();
+  CHECK (!recorder_stop (recorder));
+  CHECK (test_time () - start >= 40000);
+  CHECK (!pthread_join (thread, 0));
+  CHECK (!context.kept_length);
+
+  //The buffers released after the stop stay with the recorder
+  CHECK (!standin.owned_length);
+  CHECK (!recorder_start (recorder));
+  CHECK (standin.owned_length == 3);
+  CHECK (!recorder_stop (recorder));
+  recorder_close (recorder);
+}
+
+static void test_stop_from_callback (){
+  recorder_standin_t standin;
+  recorder_config_t config;
+  context_t context;
+
+  context_init (&context);
+  context.stop = 1;
+  recorder_t* recorder = context.recorder = open_standin (&standin);
+  recorder_config_init (&config);
+  CHECK (!recorder_configure (recorder, &config, on_frame, &context));
+  CHECK (!recorder_start (recorder));
+  CHECK (recorder_standin_fill (&standin, 10));
+  wait_frames (&context, 1);
+  CHECK (!strcmp (recorder_error (recorder), "stop from the callback"));
+  //The frame was released after the failed stop
+  CHECK (!context.result);
+  CHECK (!recorder_stop (recorder));
+  recorder_close (recorder);
+}
+
+//An error of a component while recording is returned by the next release and
+//by the stop, then the recorder starts again
+static void test_failure (){
+  recorder_standin_t standin;
+  recorder_config_t config;
+  context_t context;
+
+  context_init (&context);
+  recorder_t* recorder = context.recorder = open_standin (&standin);
+  recorder_config_init (&config);
+
+  //Ignored when not recording
+  recorder_failed (recorder, "camera: OMX_ErrorHardware");
+  CHECK (!recorder_configure (recorder, &config, on_frame, &context));
+  CHECK (!recorder_start (recorder));
+
+  CHECK (recorder_standin_fill (&standin, 10));
+  wait_frames (&context, 1);
+  CHECK (!context.result);
+  recorder_failed (recorder, "video_encode: OMX_ErrorHardware");
+  //Only the first error is kept
+  recorder_failed (recorder, "camera: OMX_ErrorInsufficientResources");
+  CHECK (recorder_standin_fill (&standin, 10));
+  wait_frames (&context, 2);
+  CHECK (context.result == RECORDER_ERROR_OMX);
+  CHECK (!strcmp (recorder_error (recorder),
+      "video_encode: OMX_ErrorHardware"));
+  CHECK (standin.owned_length == 2);
+
+  standin.calls[0] = 0;
+  CHECK (recorder_stop (recorder) == RECORDER_ERROR_OMX);
+  CHECK (!strcmp (recorder_error (recorder),
+      "video_encode: OMX_ErrorHardware"));
+  CHECK (!strcmp (standin.calls, "nocapture idle"));
+
+  CHECK (!recorder_start (recorder));
+  CHECK (recorder_standin_fill (&standin, 10));
+  wait_frames (&context, 3);
+  CHECK (!context.result);
+  CHECK (!recorder_stop (recorder));
+  recorder_close (recorder);
+}
+
+int main (){
+  test_state ();
+  test_start_failure ();
+  test_frames ();
+  test_kept ();
+  test_stop_from_callback ();
+  test_failure ();
+  return 0;
+}
@@ -0,0 +1,127 @@
+#include "test.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <sys/wait.h>
+
+#include "rt.h"
+
+//Every test runs in a child: the settings are global and the memory stays
+//locked
+static int run (void (*function)(const char*), const char* spec){
+  int status;
+  pid_t pid = fork ();
+  CHECK (pid != -1);
+  if (!pid){
+    function (spec);
+    _exit (0);
+  }
+  CHECK (waitpid (pid, &status, 0) == pid);
+  CHECK (WIFEXITED (status));
+  return WEXITSTATUS (status);
+}
+
+static void configure (const char* spec){
+  fclose (stderr);
+  rt_configure (spec);
+}
+
+static void test_invalid (){
+  const char* specs[] = {
+    "",
+    "capture",
+    "camera=fifo:50",
+    "capture=fifo",
+    "capture=fifo:",
+    "capture=fifo:100",
+    "capture=fifo:0",
+    "capture=rr:50x",
+    "capture=idle:50",
+    "capture=fifo:50@",
+    "capture=fifo:50@-1",
+    "capture=fifo:50@99999",
+    "capture=fifo:50,",
+    "network=rr:10,writer=other:10",
+    "writer=other@0123456789012345678901234567890123456789012345678901234567"
+  };
+  size_t i;
+
+  for (i=0; i<sizeof (specs)/sizeof (specs[0]); i++){
+    if (run (configure, specs[i]) != 1){
+      fprintf (stderr, "accepted: \"%s\"\n", specs[i]);
+      CHECK (0);
+    }
+  }
+  CHECK (!run (configure, "capture=fifo:50@0,network=rr:1,writer=other@0"));
+  CHECK (!run (configure, "writer=@0"));
+  CHECK (!run (configure, "network="));
+}
+
+typedef struct {
+  rt_role_t role;
+  int policy;
+  int priority;
+  int pinned;
+} thread_t;
+
+static void* thread_loop (void* arg){
+  thread_t* thread = (thread_t*)arg;
+  struct sched_param param;
+  cpu_set_t cpus;
+
+  rt_thread (thread->role);
+  CHECK (!pthread_getschedparam (pthread_self (), &thread->policy, &param));
+  thread->priority = param.sched_priority;
+  CHECK (!pthread_getaffinity_np (pthread_self (), sizeof (cpus), &cpus));
+  thread->pinned = CPU_COUNT (&cpus) == 1 && CPU_ISSET (0, &cpus);
+  return 0;
+}
+
+static void thread_run (thread_t* thread, rt_role_t role){
+  pthread_t id;
+  thread->role = role;
+  CHECK (!pthread_create (&id, 0, thread_loop, thread));
+  CHECK (!pthread_join (id, 0));
+}
+
+//Without the privileges the thread keeps the default scheduling, with them it
+//gets the policy and the priority. The CPU is always available
+static void check_policy (thread_t* thread, int policy, int priority){
+  struct sched_param param;
+  param.sched_priority = priority;
+  if (pthread_setschedparam (pthread_self (), policy, &param)){
+    CHECK (thread->policy == SCHED_OTHER && !thread->priority);
+  }else{
+    CHECK (thread->policy == policy && thread->priority == priority);
+    param.sched_priority = 0;
+    CHECK (!pthread_setschedparam (pthread_self (), SCHED_OTHER, &param));
+  }
+}
+
+static void threads (const char* spec){
+  thread_t thread;
+
+  //Nothing changes before rt_configure()
+  thread_run (&thread, RT_CAPTURE);
+  CHECK (thread.policy == SCHED_OTHER && !thread.priority);
+
+  rt_configure (spec);
+  thread_run (&thread, RT_CAPTURE);
+  check_policy (&thread, SCHED_FIFO, 50);
+  CHECK (thread.pinned);
+  thread_run (&thread, RT_NETWORK);
+  check_policy (&thread, SCHED_RR, 10);
+  thread_run (&thread, RT_WRITER);
+  CHECK (thread.policy == SCHED_OTHER && !thread.priority);
+  CHECK (thread.pinned);
+}
+
+static void test_threads (){
+  CHECK (!run (threads, "capture=fifo:50@0,network=rr:10,writer=other@0"));
+}
+
+int main (){
+  test_invalid ();
+  test_threads ();
+  return 0;
+}
@@ -0,0 +1,223 @@
+#include "test.h"
+
+#include "rtpdepay.h"
+#include "sink.h"
+
+#define MTU 1200
+
+//Receiving end of the loopback: a UDP socket on 127.0.0.1
+static int receiver_open (char* spec, size_t size, const char* options){
+  struct sockaddr_in addr;
+  socklen_t length = sizeof (addr);
+  int fd = socket (AF_INET, SOCK_DGRAM, 0);
+  CHECK (fd != -1);
+  int buffer = 4*1024*1024;
+  setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &buffer, sizeof (buffer));
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  CHECK (!bind (fd, (struct sockaddr*)&addr, sizeof (addr)));
+  CHECK (!getsockname (fd, (struct sockaddr*)&addr, &length));
+  snprintf (spec, size, "rtp:127.0.0.1:%u%s", ntohs (addr.sin_port), options);
+  return fd;
+}
+
+//Feeds the packets received so far. Returns the number of complete frames, the
+//last one is in depay
+static int receive (int fd, rtp_depay_t* depay, uint32_t* packets){
+  uint8_t packet[65536];
+  ssize_t n;
+  int frames = 0;
+
+  while ((n = recv (fd, packet, sizeof (packet), MSG_DONTWAIT)) > 0){
+    CHECK (n <= MTU);
+    CHECK ((packet[1] & 0x7F) == 96);
+    int result = rtp_depay_packet (depay, packet, n);
+    CHECK (result >= 0);
+    frames += result;
+    if (packets) (*packets)++;
+  }
+  CHECK (n == -1 && errno == EAGAIN);
+  return frames;
+}
+
+//Frames of every size, from a single NAL unit packet to a hundred FU-A packets,
+//come back unchanged with continuous sequence numbers and 90 kHz timestamps
+static void test_loopback (){
+  char spec[64];
+  test_stream_t stream;
+  stream_buffer_t config;
+  stream_buffer_t buffer;
+  rtp_depay_t depay;
+  uint32_t sizes[] = { 40, 500, MTU - 12, MTU - 11, 5000, 100000, 300 };
+  uint32_t timestamp = 0;
+  uint32_t i;
+
+  int fd = receiver_open (spec, sizeof (spec), ",mtu=1200");
+  test_stream_init (&stream, 100, 1920, 1080, 100000);
+  rtp_depay_init (&depay, 1024*1024);
+  sink_t* sink = sink_open (spec);
+
+  //The SPS/PPS wait for the first frame and they're aggregated in a STAP-A
+  //packet
+  test_stream_config (&stream, &config);
+  sink_write (sink, &config);
+  CHECK (!receive (fd, &depay, 0));
+
+  for (i=0; i<sizeof (sizes)/sizeof (sizes[0]); i++){
+    test_stream_frame (&stream, &buffer, !i, sizes[i]);
+    sink_write (sink, &buffer);
+    CHECK (receive (fd, &depay, 0) == 1);
+    CHECK (!depay.broken);
+    if (!i){
+      CHECK (depay.frame_length == config.length + buffer.length);
+      CHECK (!memcmp (depay.frame, config.data, config.length));
+      CHECK (!memcmp (depay.frame + config.length, buffer.data,
+          buffer.length));
+      CHECK (depay.stap_a == 1);
+    }else{
+      CHECK (depay.frame_length == buffer.length);
+      CHECK (!memcmp (depay.frame, buffer.data, buffer.length));
+      //33333 us
+      CHECK (depay.timestamp - timestamp == 2999 ||
+          depay.timestamp - timestamp == 3000);
+    }
+    timestamp = depay.timestamp;
+  }
+  CHECK (depay.frames == i);
+  CHECK (!depay.lost && !depay.reordered && !depay.broken_frames);
+  CHECK (depay.single && depay.fu_a >= 100000/(MTU - 14));
+  CHECK (sink->frames == i && !sink->dropped_frames);
+
+  sink_close (sink);
+  rtp_depay_free (&depay);
+  test_stream_free (&stream);
+  close (fd);
+}
+
+//A lost packet in the middle of a fragmented NAL unit breaks that frame only,
+//late packets are discarded
+static void test_loss (){
+  char spec[64];
+  uint8_t packets[64][MTU];
+  ssize_t lengths[64];
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  rtp_depay_t depay;
+  int n = 0;
+  int i;
+
+  int fd = receiver_open (spec, sizeof (spec), ",mtu=1200");
+  test_stream_init (&stream, 66, 640, 480, 10000);
+  rtp_depay_init (&depay, 1024*1024);
+  sink_t* sink = sink_open (spec);
+
+  for (i=0; i<3; i++){
+    test_stream_frame (&stream, &buffer, !i, 5000);
+    sink_write (sink, &buffer);
+    while (n < 64 && (lengths[n] = recv (fd, packets[n], MTU,
+        MSG_DONTWAIT)) > 0){
+      n++;
+    }
+  }
+  //5 packets per frame
+  CHECK (n == 15);
+
+  for (i=0; i<n; i++){
+    //The third packet of the second frame is lost
+    if (i == 7) continue;
+    int result = rtp_depay_packet (&depay, packets[i], lengths[i]);
+    CHECK (result == (i%5 == 4));
+    if (result) CHECK (depay.broken == (i/5 == 1));
+  }
+  CHECK (depay.lost == 1);
+  CHECK (depay.frames == 2 && depay.broken_frames == 1);
+  CHECK (!rtp_depay_packet (&depay, packets[3], lengths[3]));
+  CHECK (depay.reordered == 1);
+
+  //The marker of the last frame is lost, it's discarded when the next frame
+  //starts
+  rtp_depay_free (&depay);
+  rtp_depay_init (&depay, 1024*1024);
+  for (i=0; i<n; i++){
+    if (i == 9) continue;
+    CHECK (rtp_depay_packet (&depay, packets[i], lengths[i]) ==
+        (i%5 == 4 && i != 9));
+  }
+  CHECK (depay.frames == 2 && depay.broken_frames == 1);
+  CHECK (!rtp_depay_flush (&depay));
+
+  sink_close (sink);
+  rtp_depay_free (&depay);
+  test_stream_free (&stream);
+  close (fd);
+}
+
+//With low latency every NAL unit is sent as soon as the next start code
+//arrives, the marker still ends the frame
+static void test_low_latency (){
+  char spec[64];
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  stream_buffer_t piece;
+  paramsets_t paramsets;
+  rtp_depay_t depay;
+  uint8_t frame[4*3000];
+  uint32_t length = 0;
+  uint32_t packets = 0;
+  uint32_t early = 0;
+  int i;
+
+  int fd = receiver_open (spec, sizeof (spec), ",mtu=1200");
+  test_stream_init (&stream, 100, 1920, 1080, 3000);
+  paramsets_init (&paramsets);
+  rtp_depay_init (&depay, 1024*1024);
+  sink_t* sink = sink_open (spec);
+  sink->paramsets = &paramsets;
+  sink->low_latency = 1;
+
+  test_stream_config (&stream, &buffer);
+  CHECK (paramsets_update (&paramsets, &buffer));
+  sink_write (sink, &buffer);
+  CHECK (!receive (fd, &depay, &packets) && !packets);
+
+  //An IDR frame of 4 slices in buffers of 1000 bytes
+  for (i=0; i<4; i++){
+    length += test_slice (frame + length, 1, 0, 0, 3000);
+  }
+  test_stream_frame (&stream, &buffer, 1, 100);
+  for (i=0; i<12; i++){
+    piece = buffer;
+    piece.data = frame + i*1000;
+    piece.length = 1000;
+    piece.flags = i == 11 ? buffer.flags : STREAM_FLAG_SYNCFRAME;
+    sink_write (sink, &piece);
+    int frames = receive (fd, &depay, &packets);
+    CHECK (frames == (i == 11));
+    //The first slice is complete when the second one starts
+    //The SPS/PPS go as soon as the first slice starts, the first slice when
+    //the second one starts
+    if (i < 3) CHECK (packets == 1);
+    if (i == 3) CHECK (packets == 4);
+    if (i < 11) early = packets;
+  }
+  //The SPS/PPS and 3 slices of 3 packets before the end of the frame
+  CHECK (early == 10);
+  CHECK (!depay.broken && depay.stap_a == 1);
+  CHECK (depay.frame_length == paramsets.length + length);
+  CHECK (!memcmp (depay.frame, paramsets.data, paramsets.length));
+  CHECK (!memcmp (depay.frame + paramsets.length, frame, length));
+  CHECK (sink->frames == 1);
+
+  sink_close (sink);
+  rtp_depay_free (&depay);
+  test_stream_free (&stream);
+  close (fd);
+}
+
+int main (){
+  test_loopback ();
+  test_loss ();
+  test_low_latency ();
+  return 0;
+}
@@ -0,0 +1,195 @@
+#include "test.h"
+
+#include <sys/wait.h>
+
+#include "sink.h"
+
+//Every segment is 32 frames long: the target duration is reached at the 31st
+//frame, an IDR frame is requested and the encoder produces it next
+#define SEGMENTS 5
+#define SEGMENT_FRAMES 32
+#define FRAME_SIZE 5000
+
+//Writes the frames of SEGMENTS segments like the encoder, that produces an IDR
+//frame after a request
+static void record (const char* spec){
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  paramsets_t paramsets;
+  idr_t idr;
+  uint32_t requests = 0;
+  int i;
+
+  test_stream_init (&stream, 100, 1280, 720, FRAME_SIZE);
+  paramsets_init (&paramsets);
+  idr_init (&idr);
+
+  sink_t* sink = sink_open (spec);
+  sink->paramsets = &paramsets;
+  sink->idr = &idr;
+  test_stream_config (&stream, &buffer);
+  CHECK (paramsets_update (&paramsets, &buffer));
+  sink_write (sink, &buffer);
+  for (i=0; i<SEGMENTS*SEGMENT_FRAMES; i++){
+    int sync = !i || idr.requests != requests;
+    requests = idr.requests;
+    CHECK (sync == !(i%SEGMENT_FRAMES));
+    test_stream_frame (&stream, &buffer, sync, FRAME_SIZE);
+    sink_write (sink, &buffer);
+    //Time for the background thread to open the next file
+    usleep (2000);
+  }
+  CHECK (sink->frames == SEGMENTS*SEGMENT_FRAMES);
+  sink_close (sink);
+
+  test_stream_free (&stream);
+}
+
+//Every segment starts with the SPS/PPS and an IDR frame, the numbering
+//continues in the next run
+static void test_raw (){
+  char dir[64];
+  char spec[128];
+  char path[128];
+  test_nal_t nals[SEGMENT_FRAMES + 2];
+  int i;
+  int j;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (spec, sizeof (spec), "segment:%s/%%03u.h264,duration=1", dir);
+  record (spec);
+  record (spec);
+
+  for (i=0; i<2*SEGMENTS; i++){
+    size_t length;
+    snprintf (path, sizeof (path), "%s/%03u.h264", dir, i);
+    uint8_t* data = test_read_file (path, &length);
+    CHECK (test_split (data, length, nals, SEGMENT_FRAMES + 2) ==
+        SEGMENT_FRAMES + 2);
+    CHECK (nals[0].type == 7 && nals[1].type == 8 && nals[2].type == 5);
+    for (j=1; j<SEGMENT_FRAMES; j++){
+      CHECK (nals[j + 2].type == 1 && nals[j + 2].frame_num == (uint32_t)j);
+    }
+    free (data);
+  }
+  snprintf (path, sizeof (path), "%s/%03u.h264", dir, i);
+  CHECK (access (path, F_OK));
+  snprintf (path, sizeof (path), "%s/%03u.h264.part", dir, i);
+  CHECK (access (path, F_OK));
+
+  test_remove (dir);
+}
+
+//HLS playlist of the last 3 segments
+static void test_ts (){
+  char dir[64];
+  char spec[192];
+  char path[128];
+  size_t length;
+  int i;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (spec, sizeof (spec), "segment:%s/cam-%%05u.ts,duration=1,"
+      "playlist=%s/cam.m3u8,window=3", dir, dir);
+  record (spec);
+
+  for (i=0; i<SEGMENTS; i++){
+    snprintf (path, sizeof (path), "%s/cam-%05u.ts", dir, i);
+    uint8_t* data = test_read_file (path, &length);
+    //It starts with the PAT
+    CHECK (length && !(length%188));
+    CHECK (data[0] == 0x47 && data[1] == 0x40 && !data[2]);
+    free (data);
+  }
+
+  snprintf (path, sizeof (path), "%s/cam.m3u8", dir);
+  char* playlist = (char*)test_read_file (path, &length);
+  CHECK (!strcmp (playlist,
+      "#EXTM3U\n"
+      "#EXT-X-VERSION:3\n"
+      "#EXT-X-TARGETDURATION:2\n"
+      "#EXT-X-MEDIA-SEQUENCE:2\n"
+      "#EXTINF:1.067,\n"
+      "cam-00002.ts\n"
+      "#EXTINF:1.067,\n"
+      "cam-00003.ts\n"
+      "#EXTINF:1.067,\n"
+      "cam-00004.ts\n"
+      "#EXT-X-ENDLIST\n"));
+
+  free (playlist);
+  test_remove (dir);
+}
+
+//The MP4 segments are listed with their ftyp and moov boxes as the
+//initialization section
+static void test_mp4 (){
+  char dir[64];
+  char spec[192];
+  char path[128];
+  char expected[4096];
+  size_t length;
+  int n;
+  int i;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (spec, sizeof (spec), "segment:%s/%%u.mp4,duration=1,"
+      "playlist=%s/cam.m3u8", dir, dir);
+  record (spec);
+
+  n = snprintf (expected, sizeof (expected), "#EXTM3U\n#EXT-X-VERSION:7\n"
+      "#EXT-X-TARGETDURATION:2\n#EXT-X-MEDIA-SEQUENCE:0\n"
+      "#EXT-X-PLAYLIST-TYPE:EVENT\n");
+  for (i=0; i<SEGMENTS; i++){
+    uint32_t size;
+    snprintf (path, sizeof (path), "%s/%u.mp4", dir, i);
+    uint8_t* data = test_read_file (path, &length);
+    CHECK (test_box (data, length, "ftyp", 0, &size) == data + 8);
+    uint32_t header = size + 8;
+    CHECK (test_box (data, length, "moov", 0, &size) == data + header + 8);
+    header += size + 8;
+    CHECK (test_box (data, length, "moof", 0, &size) == data + header + 8);
+    n += snprintf (expected + n, sizeof (expected) - n,
+        "#EXT-X-MAP:URI=\"%u.mp4\",BYTERANGE=\"%u@0\"\n"
+        "#EXT-X-BYTERANGE:%u@%u\n#EXTINF:1.067,\n%u.mp4\n", i, header,
+        (uint32_t)length - header, header, i);
+    free (data);
+  }
+  snprintf (expected + n, sizeof (expected) - n, "#EXT-X-ENDLIST\n");
+
+  snprintf (path, sizeof (path), "%s/cam.m3u8", dir);
+  char* playlist = (char*)test_read_file (path, &length);
+  CHECK (!strcmp (playlist, expected));
+
+  free (playlist);
+  test_remove (dir);
+}
+
+//HLS has no Annex-B segments, a playlist of them is refused
+static void test_raw_playlist (){
+  char dir[64];
+  char spec[192];
+  int status;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (spec, sizeof (spec), "segment:%s/%%u.h264,playlist=%s/a.m3u8",
+      dir, dir);
+  pid_t pid = fork ();
+  CHECK (pid != -1);
+  if (!pid){
+    fclose (stderr);
+    sink_open (spec);
+    _exit (0);
+  }
+  CHECK (waitpid (pid, &status, 0) == pid);
+  CHECK (WIFEXITED (status) && WEXITSTATUS (status) == 1);
+  test_remove (dir);
+}
+
+int main (){
+  test_raw ();
+  test_ts ();
+  test_mp4 ();
+  test_raw_playlist ();
+  return 0;
+}
@@ -0,0 +1,111 @@
+#include "test.h"
+
+#include <pthread.h>
+
+#include "sink.h"
+
+/*
+Load of the server: many local clients read the stream as fast as they can
+while the frames are written at a fixed rate. For every number of clients it
+prints the time the encoder spends in sink_write() (the server must never make
+it wait for the clients), the lag of the clients behind the encoder, and the
+server prints the CPU time of its event loop and the skips of every client.
+*/
+
+#define FRAMES 600
+#define FRAME_SIZE 40000
+//Frame interval (us), 160 Mbps
+#define INTERVAL 2000
+#define CLIENTS_MAX 63
+
+typedef struct {
+  int fd;
+  pthread_t thread;
+  volatile uint64_t received;
+  uint64_t lag_max;
+} client_t;
+
+static void* client_loop (void* arg){
+  client_t* client = (client_t*)arg;
+  static __thread uint8_t data[256*1024];
+  ssize_t n;
+
+  while ((n = read (client->fd, data, sizeof (data))) > 0){
+    __atomic_add_fetch (&client->received, n, __ATOMIC_RELAXED);
+  }
+  return 0;
+}
+
+static void bench (int clients){
+  static client_t client[CLIENTS_MAX];
+  static int64_t times[FRAMES];
+  char spec[32];
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  uint64_t written = 0;
+  int i;
+  int j;
+
+  uint16_t port = test_port ();
+  snprintf (spec, sizeof (spec), "server:127.0.0.1:%u", port);
+  sink_t* sink = sink_open (spec);
+  test_stream_init (&stream, 100, 1920, 1080, FRAME_SIZE);
+
+  for (j=0; j<clients; j++){
+    client[j].fd = test_connect (port);
+    CHECK (!fcntl (client[j].fd, F_SETFL, 0));
+    client[j].received = 0;
+    client[j].lag_max = 0;
+    CHECK (!pthread_create (&client[j].thread, 0, client_loop, &client[j]));
+  }
+  usleep (100000);
+
+  int64_t start = test_time ();
+  for (i=0; i<FRAMES; i++){
+    test_stream_frame (&stream, &buffer, !(i%30), FRAME_SIZE);
+    int64_t before = test_time ();
+    sink_write (sink, &buffer);
+    times[i] = test_time () - before;
+    written += buffer.length;
+
+    //Lag of every client just before the next frame
+    int64_t next = start + (int64_t)(i + 1)*INTERVAL;
+    int64_t now = test_time ();
+    if (next > now) usleep (next - now);
+    for (j=0; j<clients; j++){
+      uint64_t received = __atomic_load_n (&client[j].received,
+          __ATOMIC_RELAXED);
+      uint64_t lag = written > received ? written - received : 0;
+      if (lag > client[j].lag_max) client[j].lag_max = lag;
+    }
+  }
+
+  test_percentile_t percentile = test_percentile (times, FRAMES);
+  uint64_t lag_sum = 0;
+  uint64_t lag_max = 0;
+  for (j=0; j<clients; j++){
+    lag_sum += client[j].lag_max;
+    if (client[j].lag_max > lag_max) lag_max = client[j].lag_max;
+  }
+  printf ("%d clients: sink_write p50 %lld us, p99 %lld us, max %lld us; "
+      "max client lag avg %llu KiB, max %llu KiB (%.1f ms)\n", clients,
+      (long long)percentile.p50, (long long)percentile.p99,
+      (long long)percentile.max, (unsigned long long)lag_sum/clients/1024,
+      (unsigned long long)lag_max/1024,
+      (double)lag_max/FRAME_SIZE*INTERVAL/1000);
+
+  sink_close (sink);
+  for (j=0; j<clients; j++){
+    pthread_join (client[j].thread, 0);
+    close (client[j].fd);
+  }
+  test_stream_free (&stream);
+}
+
+int main (){
+  int clients[] = { 1, 8, 32, CLIENTS_MAX };
+  int i;
+
+  for (i=0; i<4; i++) bench (clients[i]);
+  return 0;
+}
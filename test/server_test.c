@@ -0,0 +1,234 @@
+#include "test.h"
+
+#include "sink.h"
+
+#define FRAME_SIZE 60000
+
+typedef struct {
+  sink_t* sink;
+  test_stream_t stream;
+  paramsets_t paramsets;
+  idr_t idr;
+  uint16_t port;
+  //Everything written to the sink, the SPS/PPS first
+  uint8_t* expected;
+  size_t expected_length;
+} server_test_t;
+
+static void open_server (server_test_t* test){
+  char spec[32];
+  stream_buffer_t buffer;
+
+  memset (test, 0, sizeof (server_test_t));
+  test->port = test_port ();
+  snprintf (spec, sizeof (spec), "server:127.0.0.1:%u", test->port);
+  test->sink = sink_open (strdup (spec));
+  paramsets_init (&test->paramsets);
+  idr_init (&test->idr);
+  test->sink->paramsets = &test->paramsets;
+  test->sink->idr = &test->idr;
+  test_stream_init (&test->stream, 100, 1920, 1080, FRAME_SIZE);
+  test->expected = malloc (32*1024*1024);
+  CHECK (test->expected);
+
+  test_stream_config (&test->stream, &buffer);
+  CHECK (paramsets_update (&test->paramsets, &buffer));
+  sink_write (test->sink, &buffer);
+}
+
+static void close_server (server_test_t* test){
+  const char* name = test->sink->name;
+  sink_close (test->sink);
+  free ((void*)name);
+  free (test->expected);
+  test_stream_free (&test->stream);
+}
+
+static void write_frame (server_test_t* test, int idr, uint32_t length){
+  stream_buffer_t buffer;
+  test_stream_frame (&test->stream, &buffer, idr, length);
+  sink_write (test->sink, &buffer);
+  memcpy (test->expected + test->expected_length, buffer.data, buffer.length);
+  test->expected_length += buffer.length;
+}
+
+//Connects a client and waits until the server has accepted it: it sends the
+//SPS/PPS at once. On a busy machine that can take longer than the frames the
+//test writes next
+static int connect_client (server_test_t* test, uint8_t** data,
+    size_t* length, size_t* size){
+  int fd = test_connect (test->port);
+  int64_t end = test_time () + 5000000;
+  while (*length < test->paramsets.length && test_time () < end){
+    test_receive (fd, data, length, size, 10);
+  }
+  return fd;
+}
+
+//A new client gets the SPS/PPS and starts at the most recent IDR frame
+static void test_join (){
+  server_test_t test;
+  uint8_t* data = 0;
+  size_t length = 0;
+  size_t size = 0;
+  int i;
+
+  open_server (&test);
+  for (i=0; i<6; i++) write_frame (&test, !i, 1000);
+  test.expected_length = 0;
+  for (i=0; i<4; i++) write_frame (&test, !i, 2000);
+
+  int fd = connect_client (&test, &data, &length, &size);
+  test_receive (fd, &data, &length, &size, 200);
+  CHECK (length == test.paramsets.length + test.expected_length);
+  CHECK (!memcmp (data, test.paramsets.data, test.paramsets.length));
+  CHECK (!memcmp (data + test.paramsets.length, test.expected,
+      test.expected_length));
+  //The client asked for a fresh IDR frame
+  CHECK (test.idr.requests);
+
+  //Then it follows the stream
+  length = 0;
+  test.expected_length = 0;
+  for (i=0; i<3; i++) write_frame (&test, 0, 3000);
+  test_receive (fd, &data, &length, &size, 200);
+  CHECK (length == test.expected_length);
+  CHECK (!memcmp (data, test.expected, length));
+
+  close (fd);
+  free (data);
+  close_server (&test);
+}
+
+//A client that keeps up receives everything, while the ring wraps around
+//several times
+static void test_wrap (){
+  server_test_t test;
+  uint8_t* data = 0;
+  size_t length = 0;
+  size_t size = 0;
+  int i;
+
+  open_server (&test);
+  int fd = connect_client (&test, &data, &length, &size);
+  test_receive (fd, &data, &length, &size, 200);
+  CHECK (length == test.paramsets.length);
+
+  length = 0;
+  for (i=0; i<500; i++){
+    write_frame (&test, !(i%30), FRAME_SIZE - (i%7)*1000);
+    int64_t end = test_time () + 1000000;
+    while (length < test.expected_length && test_time () < end){
+      test_receive (fd, &data, &length, &size, 10);
+    }
+    CHECK (length == test.expected_length);
+  }
+  CHECK (!memcmp (data, test.expected, length));
+  CHECK (test.sink->frames == 500 && !test.sink->dropped_frames);
+
+  close (fd);
+  free (data);
+  close_server (&test);
+}
+
+//A client that doesn't read is left behind, then it jumps to the most recent
+//IDR frame with the SPS/PPS first
+static void test_slow (){
+  server_test_t test;
+  test_nal_t nals[1024];
+  uint8_t* data = 0;
+  size_t length = 0;
+  size_t size = 0;
+  uint32_t i;
+
+  open_server (&test);
+  int fd = connect_client (&test, &data, &length, &size);
+  test_receive (fd, &data, &length, &size, 200);
+
+  for (i=0; i<300; i++) write_frame (&test, !(i%30), FRAME_SIZE);
+  test_receive (fd, &data, &length, &size, 200);
+  CHECK (length < test.paramsets.length + test.expected_length);
+
+  //The beginning of the stream, which was in the socket buffers, and the last
+  //IDR frame and its P frames. On a busy machine the beginning can be
+  //overwritten before the server sends it, then the client skips at once and
+  //gets the SPS/PPS again
+  uint32_t count = test_split (data, length, nals, 1024);
+  CHECK (count >= 36);
+  CHECK (nals[0].type == 7 && nals[1].type == 8);
+  uint32_t first = nals[2].type == 7 ? 4 : 2;
+  CHECK (first == 2 || nals[3].type == 8);
+  CHECK (nals[first].type == 5);
+  //The last skip: the SPS/PPS, an IDR frame and the frames up to the end. The
+  //server can fall behind the encoder more than once, it's not always the last
+  //IDR frame
+  uint32_t last = count - 1;
+  while (nals[last].type != 7) last--;
+  CHECK (nals[last + 1].type == 8 && nals[last + 2].type == 5);
+  size_t tail = 0;
+  for (i=last + 2; i<count; i++) tail += nals[i].length;
+  CHECK (tail >= 30*FRAME_SIZE && !(tail%(30*FRAME_SIZE)));
+  CHECK (!memcmp (data + length - tail,
+      test.expected + test.expected_length - tail, tail));
+
+  close (fd);
+  free (data);
+  close_server (&test);
+}
+
+//New SPS/PPS reach the connected clients once, in the stream, and the new
+//clients get the current ones
+static void test_config (){
+  server_test_t test;
+  stream_buffer_t buffer;
+  uint8_t config[128];
+  uint8_t* data = 0;
+  size_t length = 0;
+  size_t size = 0;
+
+  open_server (&test);
+  int fd = connect_client (&test, &data, &length, &size);
+  test_receive (fd, &data, &length, &size, 200);
+  CHECK (length == test.paramsets.length);
+  write_frame (&test, 1, 1000);
+  write_frame (&test, 0, 1000);
+  test_receive (fd, &data, &length, &size, 200);
+  CHECK (length == test.paramsets.length + 2000);
+
+  //The encoder restarts with another size
+  length = 0;
+  test.expected_length = 0;
+  buffer.length = test_sps (config, 100, 1280, 720);
+  buffer.length += test_pps (config + buffer.length, 1000);
+  buffer.data = config;
+  buffer.flags = STREAM_FLAG_CODECCONFIG;
+  buffer.timestamp = 0;
+  CHECK (paramsets_update (&test.paramsets, &buffer));
+  sink_write (test.sink, &buffer);
+  memcpy (test.expected, config, buffer.length);
+  test.expected_length = buffer.length;
+  write_frame (&test, 1, 2000);
+  write_frame (&test, 0, 2000);
+  test_receive (fd, &data, &length, &size, 200);
+  CHECK (length == test.expected_length);
+  CHECK (!memcmp (data, test.expected, length));
+
+  length = 0;
+  int fd2 = connect_client (&test, &data, &length, &size);
+  test_receive (fd2, &data, &length, &size, 200);
+  CHECK (length == test.expected_length);
+  CHECK (!memcmp (data, test.expected, length));
+
+  close (fd);
+  close (fd2);
+  free (data);
+  close_server (&test);
+}
+
+int main (){
+  test_join ();
+  test_config ();
+  test_wrap ();
+  test_slow ();
+  return 0;
+}
@@ -0,0 +1,150 @@
+#include "test.h"
+
+#include <sys/wait.h>
+
+#include "shmring.h"
+
+/*
+Shared memory ring with several reader processes. The writer publishes FRAMES
+frames of FRAME_SIZE bytes (about 17 Mbps at 30 fps) with an IDR frame every
+IDR_PERIOD frames, into a ring of the default size of the shm: output. Every
+reader copies every frame out of the ring, as a reader that keeps it would, and
+checks that it wasn't overwritten meanwhile.
+
+Paced at 60 fps it prints the percentiles of the delay from the publication of
+a frame to its reception by the readers (the futex wake-up), and unpaced the
+throughput of the writer and what the readers got of it: the frames read, the
+overruns and the frames skipped until an IDR frame.
+*/
+
+#define FRAMES 600
+#define FRAME_SIZE 70000
+#define IDR_PERIOD 30
+#define RING_SIZE (8*1024*1024)
+#define RING_SLOTS 256
+//Frame interval of the paced runs (us), 60 fps
+#define INTERVAL 16667
+#define READERS_MAX 8
+
+typedef struct {
+  uint32_t frames;
+  uint32_t overruns;
+  uint32_t skipped;
+  uint32_t invalid;
+  //Delay from the publication to the read (us)
+  test_percentile_t delay;
+} result_t;
+
+static uint8_t frame_data[FRAME_SIZE];
+static int64_t delays[FRAMES];
+
+static void reader_run (const char* name, int ready, int results){
+  static uint8_t copy[FRAME_SIZE];
+  shmring_reader_t reader;
+  shmring_frame_t frame;
+  result_t result;
+  uint32_t n = 0;
+  char byte = 0;
+
+  memset (&result, 0, sizeof (result));
+  CHECK (!shmring_reader_open (&reader, name));
+  CHECK (write (ready, &byte, 1) == 1);
+  while (shmring_read (&reader, &frame, -1) == 1){
+    if (frame.flags & STREAM_FLAG_CODECCONFIG) continue;
+    int64_t delay = test_time () - frame.timestamp;
+    memcpy (copy, frame.data, frame.length);
+    if (!shmring_valid (&reader, &frame)){
+      result.invalid++;
+      continue;
+    }
+    if (n < FRAMES) delays[n++] = delay;
+  }
+  result.frames = reader.frames;
+  result.overruns = reader.overruns;
+  result.skipped = reader.skipped;
+  if (n) result.delay = test_percentile (delays, n);
+  CHECK (write (results, &result, sizeof (result)) == sizeof (result));
+  shmring_reader_close (&reader);
+}
+
+static void run (int readers, int paced){
+  static const uint8_t config[] = { 0, 0, 0, 1, 0x67, 0x64, 0, 40, 0, 0, 0, 1,
+      0x68, 0xEE };
+  shmring_writer_t writer;
+  pid_t pids[READERS_MAX];
+  result_t result;
+  result_t total;
+  int ready[2];
+  int results[2];
+  char name[64];
+  char byte;
+  int i;
+
+  snprintf (name, sizeof (name), "/h264-bench-%d", (int)getpid ());
+  CHECK (!shmring_writer_open (&writer, name, RING_SIZE, RING_SLOTS));
+  shmring_writer_config (&writer, config, sizeof (config));
+  CHECK (!pipe (ready) && !pipe (results));
+  fflush (stdout);
+  for (i=0; i<readers; i++){
+    CHECK ((pids[i] = fork ()) != -1);
+    if (!pids[i]){
+      reader_run (name, ready[1], results[1]);
+      _exit (0);
+    }
+  }
+  for (i=0; i<readers; i++) CHECK (read (ready[0], &byte, 1) == 1);
+
+  int64_t start = test_time ();
+  int64_t next = start;
+  for (i=0; i<FRAMES; i++){
+    if (paced){
+      next += INTERVAL;
+      while (test_time () < next) usleep (next - test_time ());
+    }
+    CHECK (!shmring_writer_append (&writer, frame_data, FRAME_SIZE,
+        test_time (), STREAM_FLAG_ENDOFFRAME |
+        (i%IDR_PERIOD ? 0 : STREAM_FLAG_SYNCFRAME)));
+    CHECK (shmring_writer_publish (&writer));
+  }
+  int64_t time = test_time () - start;
+  shmring_writer_close (&writer, name);
+
+  memset (&total, 0, sizeof (total));
+  for (i=0; i<readers; i++){
+    CHECK (read (results[0], &result, sizeof (result)) == sizeof (result));
+    total.frames += result.frames;
+    total.overruns += result.overruns;
+    total.skipped += result.skipped;
+    total.invalid += result.invalid;
+    if (result.delay.p50 > total.delay.p50) total.delay.p50 = result.delay.p50;
+    if (result.delay.p99 > total.delay.p99) total.delay.p99 = result.delay.p99;
+    if (result.delay.max > total.delay.max) total.delay.max = result.delay.max;
+  }
+  for (i=0; i<readers; i++) CHECK (waitpid (pids[i], 0, 0) == pids[i]);
+  close (ready[0]);
+  close (ready[1]);
+  close (results[0]);
+  close (results[1]);
+
+  if (paced){
+    printf ("%d readers, 60 fps: frames read %u of %u, overruns %u, delay "
+        "p50 %lld us p99 %lld us max %lld us (worst reader)\n", readers,
+        total.frames, readers*FRAMES, total.overruns,
+        (long long)total.delay.p50, (long long)total.delay.p99,
+        (long long)total.delay.max);
+  }else{
+    printf ("%d readers, unpaced: writer %.1f MB/s, frames read %u of %u, "
+        "overruns %u, skipped %u, overwritten while copied %u\n", readers,
+        (double)FRAMES*FRAME_SIZE/time, total.frames, readers*FRAMES,
+        total.overruns, total.skipped, total.invalid);
+  }
+}
+
+int main (){
+  int readers;
+
+  memset (frame_data, 0xAA, FRAME_SIZE);
+  for (readers=1; readers<=READERS_MAX; readers*=2) run (readers, 0);
+  for (readers=1; readers<=READERS_MAX; readers*=2) run (readers, 1);
+  return 0;
+}
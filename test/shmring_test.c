@@ -0,0 +1,297 @@
+#include "test.h"
+
+#include <sys/wait.h>
+
+#include "shm.h"
+#include "shmring.h"
+
+#define FRAME_MAX (512*1024)
+
+static uint8_t frame_data[FRAME_MAX];
+static const uint8_t config[] = { 0, 0, 0, 1, 0x67, 1, 2, 3, 0, 0, 0, 1, 0x68,
+    4 };
+
+static void ring_name (char* name, size_t size, const char* suffix){
+  snprintf (name, size, "/h264-test-%d-%s", (int)getpid (), suffix);
+}
+
+//Publishes a frame in two buffers, the byte i is i + seed
+static void publish (shmring_writer_t* writer, uint32_t length, int idr,
+    uint8_t seed){
+  uint32_t i;
+
+  for (i=0; i<length; i++) frame_data[i] = i + seed;
+  CHECK (!shmring_writer_append (writer, frame_data, length/2, seed*1000,
+      idr ? STREAM_FLAG_SYNCFRAME : 0));
+  CHECK (!shmring_writer_append (writer, frame_data + length/2,
+      length - length/2, seed*1000, STREAM_FLAG_ENDOFFRAME));
+  CHECK (shmring_writer_publish (writer));
+}
+
+static void check_frame (shmring_reader_t* reader, shmring_frame_t* frame,
+    uint32_t length, uint8_t seed){
+  uint32_t i;
+
+  CHECK (frame->length == length);
+  CHECK (frame->timestamp == seed*1000);
+  for (i=0; i<length; i++) CHECK (frame->data[i] == (uint8_t)(i + seed));
+  CHECK (shmring_valid (reader, frame));
+}
+
+static void check_config (shmring_frame_t* frame){
+  CHECK (frame->flags & STREAM_FLAG_CODECCONFIG);
+  CHECK (frame->length == sizeof (config));
+  CHECK (!memcmp (frame->data, config, sizeof (config)));
+}
+
+//The frames wrap around the end of the ring many times and are contiguous
+static void test_wrap (){
+  shmring_writer_t writer;
+  shmring_reader_t reader;
+  shmring_frame_t frame;
+  char name[64];
+  int i;
+
+  ring_name (name, sizeof (name), "wrap");
+  CHECK (!shmring_writer_open (&writer, name, 65536, 16));
+  shmring_writer_config (&writer, config, sizeof (config));
+  CHECK (!shmring_reader_open (&reader, name));
+  CHECK (!shmring_read (&reader, &frame, 0));
+
+  publish (&writer, 15000, 1, 0);
+  CHECK (shmring_read (&reader, &frame, 0) == 1);
+  check_config (&frame);
+  CHECK (shmring_read (&reader, &frame, 0) == 1);
+  CHECK (frame.flags == (STREAM_FLAG_SYNCFRAME | STREAM_FLAG_ENDOFFRAME));
+  check_frame (&reader, &frame, 15000, 0);
+
+  for (i=1; i<60; i++){
+    publish (&writer, 7001, 0, i);
+    CHECK (shmring_read (&reader, &frame, 0) == 1);
+    CHECK (frame.generation == i);
+    check_frame (&reader, &frame, 7001, i);
+  }
+  CHECK (!shmring_read (&reader, &frame, 0));
+  CHECK (reader.frames == 60 && !reader.overruns && !reader.skipped);
+
+  shmring_writer_close (&writer, name);
+  CHECK (shmring_read (&reader, &frame, 0) == -1);
+  shmring_reader_close (&reader);
+}
+
+//A slow reader is overrun and jumps to the most recent IDR frame, after the
+//SPS/PPS
+static void test_overrun (){
+  shmring_writer_t writer;
+  shmring_reader_t reader;
+  shmring_frame_t frame;
+  char name[64];
+  int i;
+
+  ring_name (name, sizeof (name), "overrun");
+  CHECK (!shmring_writer_open (&writer, name, 65536, 16));
+  shmring_writer_config (&writer, config, sizeof (config));
+  CHECK (!shmring_reader_open (&reader, name));
+
+  publish (&writer, 15000, 1, 0);
+  for (i=1; i<=20; i++) publish (&writer, 7000, 0, i);
+  publish (&writer, 15000, 1, 21);
+  for (i=22; i<25; i++) publish (&writer, 7000, 0, i);
+
+  CHECK (shmring_read (&reader, &frame, 0) == 1);
+  check_config (&frame);
+  CHECK (reader.overruns == 1);
+  CHECK (shmring_read (&reader, &frame, 0) == 1);
+  CHECK (frame.generation == 21);
+  check_frame (&reader, &frame, 15000, 21);
+  for (i=22; i<25; i++){
+    CHECK (shmring_read (&reader, &frame, 0) == 1);
+    check_frame (&reader, &frame, 7000, i);
+  }
+  CHECK (!shmring_read (&reader, &frame, 0));
+
+  shmring_writer_close (&writer, name);
+  shmring_reader_close (&reader);
+}
+
+//The most recent IDR frame still has its slot but its data has been
+//overwritten: the reader waits for the next one instead of jumping to it
+static void test_idr_overwritten (){
+  shmring_writer_t writer;
+  shmring_reader_t late;
+  shmring_reader_t slow;
+  shmring_frame_t frame;
+  char name[64];
+  int i;
+
+  ring_name (name, sizeof (name), "idr");
+  CHECK (!shmring_writer_open (&writer, name, 1024*1024, 256));
+  shmring_writer_config (&writer, config, sizeof (config));
+  CHECK (!shmring_reader_open (&slow, name));
+  CHECK (shmring_writer_idr_aging (&writer));
+
+  publish (&writer, 60000, 1, 0);
+  CHECK (!shmring_writer_idr_aging (&writer));
+  for (i=1; i<40; i++) publish (&writer, 60000, 0, i);
+  CHECK (shmring_writer_idr_aging (&writer));
+
+  //Neither reader spins on the lost IDR frame
+  int64_t start = test_time ();
+  CHECK (!shmring_reader_open (&late, name));
+  CHECK (late.cursor == 40 && late.resync);
+  CHECK (!shmring_read (&late, &frame, 0));
+  CHECK (!shmring_read (&slow, &frame, 0));
+  CHECK (slow.overruns == 1 && slow.cursor == 40);
+  CHECK (test_time () - start < 100000);
+
+  //The P frames are skipped until the next IDR frame
+  publish (&writer, 60000, 0, 40);
+  publish (&writer, 60000, 1, 41);
+  CHECK (!shmring_writer_idr_aging (&writer));
+  CHECK (shmring_read (&late, &frame, 0) == 1);
+  check_config (&frame);
+  CHECK (shmring_read (&late, &frame, 0) == 1);
+  check_frame (&late, &frame, 60000, 41);
+  CHECK (late.skipped == 1);
+  CHECK (shmring_read (&slow, &frame, 0) == 1);
+  check_config (&frame);
+  CHECK (shmring_read (&slow, &frame, 0) == 1);
+  check_frame (&slow, &frame, 60000, 41);
+
+  shmring_writer_close (&writer, name);
+  shmring_reader_close (&late);
+  shmring_reader_close (&slow);
+}
+
+static void sink_frame (sink_t* sink, uint32_t length, uint32_t flags){
+  stream_buffer_t buffer = { frame_data, length, 0,
+      flags | STREAM_FLAG_ENDOFFRAME };
+  sink_write (sink, &buffer);
+}
+
+//The shm output asks for an IDR frame when the last one reaches the older
+//half of the ring
+static void test_sink (){
+  shmring_reader_t reader;
+  shmring_frame_t frame;
+  idr_t idr;
+  char name[64];
+  char spec[96];
+  int i;
+
+  ring_name (name, sizeof (name), "sink");
+  snprintf (spec, sizeof (spec), "shm:%s,size=1,frames=64", name + 1);
+  sink_t* sink = sink_open (spec);
+  idr_init (&idr);
+  sink->idr = &idr;
+  CHECK (!shmring_reader_open (&reader, name));
+
+  sink_frame (sink, sizeof (config), STREAM_FLAG_CODECCONFIG);
+  sink_frame (sink, 60000, STREAM_FLAG_SYNCFRAME);
+  //Half the ring (512 KiB) from the start of the IDR frame
+  for (i=0; i<7; i++) sink_frame (sink, 60000, 0);
+  CHECK (!idr.requests);
+  sink_frame (sink, 60000, 0);
+  CHECK (idr.requests == 1);
+  for (i=0; i<20; i++) sink_frame (sink, 60000, 0);
+  CHECK (idr.requests == 1);
+  sink_frame (sink, 60000, STREAM_FLAG_SYNCFRAME);
+  for (i=0; i<8; i++) sink_frame (sink, 60000, 0);
+  CHECK (idr.requests == 2);
+  CHECK (sink->frames == 38 && !sink->dropped_frames);
+
+  //The reader was overrun and resumes at the last IDR frame
+  sink_close (sink);
+  CHECK (shmring_read (&reader, &frame, 0) == 1);
+  CHECK (reader.overruns == 1);
+  CHECK (frame.generation == 30 && (frame.flags & STREAM_FLAG_SYNCFRAME));
+  for (i=1; shmring_read (&reader, &frame, 0) == 1; i++);
+  CHECK (i == 9);
+  shmring_reader_close (&reader);
+}
+
+static int open_sink (const char* spec){
+  int status;
+  //Or the child would print the buffered output again when it exits
+  fflush (stdout);
+  pid_t pid = fork ();
+  CHECK (pid != -1);
+  if (!pid){
+    fclose (stderr);
+    sink_close (shm_sink_open (spec));
+    _exit (0);
+  }
+  CHECK (waitpid (pid, &status, 0) == pid);
+  CHECK (WIFEXITED (status));
+  return WEXITSTATUS (status);
+}
+
+static void test_spec (){
+  const char* invalid[] = {
+    "shm:",
+    "shm:/",
+    "shm:a/b",
+    "shm:name,size=0",
+    "shm:name,size=1024",
+    "shm:name,frames=1",
+    "shm:name,rate=10"
+  };
+  char spec[80];
+  size_t i;
+
+  for (i=0; i<sizeof (invalid)/sizeof (invalid[0]); i++){
+    CHECK (open_sink (invalid[i]) == 1);
+  }
+  snprintf (spec, sizeof (spec), "shm:h264-test-%d", (int)getpid ());
+  CHECK (open_sink (spec) == 0);
+  snprintf (spec, sizeof (spec), "shm:/h264-test-%d,size=2,frames=16",
+      (int)getpid ());
+  CHECK (open_sink (spec) == 0);
+}
+
+//A new writer replaces the ring of one that crashed: the old readers see the
+//end of the stream and their frames stay mapped, the new ones get the new ring
+static void test_replace (){
+  shmring_writer_t old_writer;
+  shmring_writer_t writer;
+  shmring_reader_t old_reader;
+  shmring_reader_t reader;
+  shmring_frame_t frame;
+  char name[64];
+
+  ring_name (name, sizeof (name), "replace");
+  CHECK (!shmring_writer_open (&old_writer, name, 65536, 16));
+  CHECK (!shmring_reader_open (&old_reader, name));
+  publish (&old_writer, 15000, 1, 1);
+  CHECK (shmring_read (&old_reader, &frame, 0) == 1);
+
+  //A smaller ring, the old one isn't truncated
+  CHECK (!shmring_writer_open (&writer, name, 4096, 4));
+  CHECK (writer.header != old_writer.header);
+  check_frame (&old_reader, &frame, 15000, 1);
+  CHECK (shmring_read (&old_reader, &frame, -1) == -1);
+
+  CHECK (!shmring_reader_open (&reader, name));
+  CHECK (reader.size < old_reader.size);
+  CHECK (!shmring_read (&reader, &frame, 0));
+  publish (&writer, 1000, 1, 2);
+  CHECK (shmring_read (&reader, &frame, 0) == 1);
+  check_frame (&reader, &frame, 1000, 2);
+  CHECK (shmring_read (&old_reader, &frame, 0) == -1);
+
+  shmring_writer_close (&writer, name);
+  shmring_reader_close (&reader);
+  shmring_reader_close (&old_reader);
+  //Already unlinked
+  shmring_writer_close (&old_writer, name);
+}
+
+int main (){
+  test_wrap ();
+  test_overrun ();
+  test_idr_overwritten ();
+  test_replace ();
+  test_sink ();
+  test_spec ();
+  return 0;
+}
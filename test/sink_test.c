@@ -0,0 +1,148 @@
+#include "test.h"
+
+#include "sink.h"
+
+//Frame size of the fifo test, the IDR frames are as big as the P frames
+#define FRAME_SIZE 100000
+
+static void test_file (){
+  char dir[64];
+  char path[128];
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  uint8_t* expected = malloc (20*4096);
+  size_t expected_length = 0;
+  uint32_t i;
+
+  CHECK (expected);
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path, sizeof (path), "%s/video.h264", dir);
+  test_stream_init (&stream, 100, 1920, 1080, 4096);
+
+  sink_t* sink = sink_open (path);
+  CHECK (sink->rotate);
+  test_stream_config (&stream, &buffer);
+  sink_write (sink, &buffer);
+  memcpy (expected, buffer.data, buffer.length);
+  expected_length += buffer.length;
+  for (i=0; i<20; i++){
+    test_stream_frame (&stream, &buffer, !(i%10), 1000 + i*100);
+    sink_write (sink, &buffer);
+    memcpy (expected + expected_length, buffer.data, buffer.length);
+    expected_length += buffer.length;
+  }
+  CHECK (sink->frames == 20);
+  CHECK (!sink->dropped_frames);
+  CHECK (sink->bytes == expected_length);
+  sink_close (sink);
+
+  //Regular files are written synchronously, nothing is lost
+  size_t length;
+  uint8_t* data = test_read_file (path, &length);
+  CHECK (length == expected_length);
+  CHECK (!memcmp (data, expected, length));
+
+  free (data);
+  free (expected);
+  test_stream_free (&stream);
+  test_remove (dir);
+}
+
+static void test_fifo (){
+  char dir[64];
+  char path[128];
+  char spec[140];
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  paramsets_t paramsets;
+  idr_t idr;
+  uint8_t* data = 0;
+  size_t length = 0;
+  size_t size = 0;
+  uint32_t written = 0;
+  uint32_t i;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path, sizeof (path), "%s/fifo", dir);
+  snprintf (spec, sizeof (spec), "fifo:%s", path);
+  test_stream_init (&stream, 100, 1280, 720, FRAME_SIZE);
+  paramsets_init (&paramsets);
+  idr_init (&idr);
+
+  sink_t* sink = sink_open (spec);
+  CHECK (!sink->rotate);
+  sink->paramsets = &paramsets;
+  sink->idr = &idr;
+  int fd = open (path, O_RDONLY | O_NONBLOCK);
+  CHECK (fd != -1);
+
+  test_stream_config (&stream, &buffer);
+  CHECK (paramsets_update (&paramsets, &buffer));
+  sink_write (sink, &buffer);
+
+  //Nobody reads: the pipe and then the backlog get full, and the rest of the
+  //frames are dropped
+  for (i=0; i<60; i++){
+    test_stream_frame (&stream, &buffer, !i, FRAME_SIZE);
+    sink_write (sink, &buffer);
+    written++;
+  }
+  CHECK (sink->dropped_frames);
+  CHECK (sink->frames + sink->dropped_frames == written);
+  CHECK (idr.requests);
+  uint32_t frames = sink->frames;
+
+  //The reader catches up. The P frames are still dropped because they cannot
+  //be decoded without the dropped ones, until the next IDR frame
+  for (i=0; i<5; i++){
+    test_drain (fd, &data, &length, &size);
+    test_stream_frame (&stream, &buffer, 0, FRAME_SIZE);
+    sink_write (sink, &buffer);
+    written++;
+  }
+  CHECK (sink->frames == frames);
+  for (i=0; i<10; i++){
+    test_drain (fd, &data, &length, &size);
+    test_stream_frame (&stream, &buffer, !i, FRAME_SIZE);
+    sink_write (sink, &buffer);
+    written++;
+  }
+  CHECK (sink->frames == frames + 10);
+  CHECK (sink->frames + sink->dropped_frames == written);
+  uint64_t bytes = sink->bytes;
+  sink_close (sink);
+  test_drain (fd, &data, &length, &size);
+  close (fd);
+
+  //Only whole frames are dropped: the output is the SPS/PPS, the first frames
+  //without a gap, then the SPS/PPS again, the IDR frame and the rest
+  test_nal_t* nals = malloc (sizeof (test_nal_t)*(written + 4));
+  CHECK (nals);
+  uint32_t count = test_split (data, length, nals, written + 4);
+  CHECK (count == frames + 10 + 4);
+  CHECK (nals[0].type == 7 && nals[1].type == 8 && nals[2].type == 5);
+  for (i=3; i<frames + 2; i++){
+    CHECK (nals[i].type == 1);
+    CHECK (nals[i].length == FRAME_SIZE);
+    CHECK (nals[i].frame_num == i - 2);
+  }
+  CHECK (nals[i].type == 7 && nals[i + 1].type == 8);
+  CHECK (nals[i + 2].type == 5);
+  CHECK (nals[i + 2].length == FRAME_SIZE);
+  for (i+=3; i<count; i++){
+    CHECK (nals[i].type == 1);
+    CHECK (nals[i].length == FRAME_SIZE);
+  }
+  CHECK (length == bytes + paramsets.length);
+
+  free (nals);
+  free (data);
+  test_stream_free (&stream);
+  test_remove (dir);
+}
+
+int main (){
+  test_file ();
+  test_fifo ();
+  return 0;
+}
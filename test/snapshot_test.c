@@ -0,0 +1,197 @@
+#include "test.h"
+
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "snapshot.h"
+
+//Frame interval (us), 30 fps
+#define INTERVAL 33333
+#define CHUNK (1024*1024)
+
+//Gives a JPEG of length bytes in buffers of at most CHUNK bytes, the byte i is
+//i*7 + seed
+static void jpeg (snapshot_t* snapshot, size_t length, uint8_t seed){
+  static uint8_t chunk[CHUNK];
+  size_t offset = 0;
+  size_t i;
+
+  while (offset < length){
+    size_t n = length - offset < CHUNK ? length - offset : CHUNK;
+    for (i=0; i<n; i++) chunk[i] = (offset + i)*7 + seed;
+    offset += n;
+    stream_buffer_t buffer = { chunk, n, 0,
+        offset == length ? STREAM_FLAG_ENDOFFRAME : 0 };
+    snapshot_data (snapshot, &buffer);
+  }
+}
+
+static void check_jpeg (const char* dir, uint32_t index, size_t length,
+    uint8_t seed){
+  char path[256];
+  struct stat st;
+  size_t i, n;
+
+  snprintf (path, sizeof (path), "%s/still-%03u.jpg.part", dir, index);
+  CHECK (stat (path, &st) == -1 && errno == ENOENT);
+  snprintf (path, sizeof (path), "%s/still-%03u.jpg", dir, index);
+  uint8_t* data = test_read_file (path, &n);
+  CHECK (n == length);
+  for (i=0; i<n; i++) CHECK (data[i] == (uint8_t)(i*7 + seed));
+  free (data);
+}
+
+static void test_capture (){
+  snapshot_t snapshot;
+  char dir[64];
+  char pattern[128];
+  char stats[512];
+  int64_t timestamp = 0;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (pattern, sizeof (pattern), "%s/still-%%03u.jpg", dir);
+  snapshot_init (&snapshot, pattern, INTERVAL, 0);
+
+  //Nothing to capture, and buffers without a capture are ignored
+  CHECK (!snapshot_start (&snapshot));
+  jpeg (&snapshot, 1000, 0);
+  CHECK (!snapshot.length && !snapshot.stills);
+
+  //The requests are coalesced until the capture starts
+  snapshot_request (&snapshot);
+  snapshot_request (&snapshot);
+  snapshot_request (&snapshot);
+  snapshot_frame (&snapshot, timestamp);
+  CHECK (snapshot_start (&snapshot));
+  CHECK (!snapshot_start (&snapshot));
+  CHECK (snapshot.requests == 3);
+
+  //3 MB, the buffer grows past SNAPSHOT_DATA_SIZE
+  jpeg (&snapshot, 3*CHUNK, 1);
+  CHECK (snapshot.size == 2*SNAPSHOT_DATA_SIZE);
+  CHECK (!snapshot.active && snapshot.stills == 1);
+
+  //The next still waits for the end of the gap: 6 frame intervals, 5 frames
+  //lost
+  snapshot_request (&snapshot);
+  CHECK (!snapshot_start (&snapshot));
+  timestamp += 6*INTERVAL;
+  snapshot_frame (&snapshot, timestamp);
+  CHECK (!snapshot.watching);
+  CHECK (snapshot.gap_last == 6*INTERVAL);
+  CHECK (snapshot.lost == 5);
+
+  //A frame arrives during the capture, the gap ends at the first frame after
+  //the JPEG. A gap shorter than 1.5 intervals loses nothing
+  CHECK (snapshot_start (&snapshot));
+  timestamp += INTERVAL;
+  snapshot_frame (&snapshot, timestamp);
+  CHECK (snapshot.watching);
+  jpeg (&snapshot, 5000, 2);
+  timestamp += INTERVAL*4/3;
+  snapshot_frame (&snapshot, timestamp);
+  CHECK (!snapshot.watching);
+  CHECK (snapshot.gap_last == INTERVAL*4/3);
+  CHECK (snapshot.gap_max == 6*INTERVAL);
+  CHECK (snapshot.lost == 5);
+  CHECK (snapshot.stills == 2);
+
+  writer_flush (snapshot.stream);
+  CHECK (snapshot.written == 2 && !snapshot.queued);
+  check_jpeg (dir, 0, 3*CHUNK, 1);
+  check_jpeg (dir, 1, 5000, 2);
+  CHECK (snapshot_dump (&snapshot, stats, sizeof (stats)) > 0);
+  CHECK (strstr (stats, "requests 4, stills 2, written 2, dropped 0, "));
+  CHECK (strstr (stats, ", frames lost 5"));
+
+  snapshot_close (&snapshot);
+  test_remove (dir);
+}
+
+//The disk is slow: SNAPSHOT_QUEUE_SIZE stills wait for the writer thread and
+//the next ones are dropped, the encoder loop never waits
+static void test_queue (){
+  snapshot_t snapshot;
+  writer_t writer;
+  test_blocker_t blocker;
+  char dir[64];
+  char pattern[128];
+  int64_t timestamp = 0;
+  int i;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (pattern, sizeof (pattern), "%s/still-%%03u.jpg", dir);
+  writer_init (&writer, 1, 0);
+  writer_stream_t* other = writer_stream_open (&writer, "other", -1, 0);
+  snapshot_init (&snapshot, pattern, INTERVAL, &writer);
+  test_block (other, &blocker);
+
+  int64_t start = test_time ();
+  for (i=0; i<SNAPSHOT_QUEUE_SIZE + 2; i++){
+    snapshot_request (&snapshot);
+    CHECK (snapshot_start (&snapshot));
+    jpeg (&snapshot, 10000, i);
+    timestamp += INTERVAL;
+    snapshot_frame (&snapshot, timestamp);
+    timestamp += INTERVAL;
+    snapshot_frame (&snapshot, timestamp);
+  }
+  CHECK (test_time () - start < 500000);
+  CHECK (snapshot.stills == SNAPSHOT_QUEUE_SIZE);
+  CHECK (snapshot.dropped == 2);
+  CHECK (snapshot.queued == SNAPSHOT_QUEUE_SIZE && !snapshot.written);
+
+  test_unblock (&blocker);
+  writer_flush (snapshot.stream);
+  CHECK (snapshot.written == SNAPSHOT_QUEUE_SIZE);
+  //The dropped stills don't take a number
+  for (i=0; i<SNAPSHOT_QUEUE_SIZE; i++) check_jpeg (dir, i, 10000, i);
+
+  snapshot_close (&snapshot);
+  writer_stream_close (other);
+  writer_close (&writer);
+  test_remove (dir);
+}
+
+static int init (const char* pattern){
+  int status;
+  //Or the child would print the buffered output again when it exits
+  fflush (stdout);
+  pid_t pid = fork ();
+  CHECK (pid != -1);
+  if (!pid){
+    snapshot_t snapshot;
+    fclose (stderr);
+    snapshot_init (&snapshot, pattern, INTERVAL, 0);
+    _exit (0);
+  }
+  CHECK (waitpid (pid, &status, 0) == pid);
+  CHECK (WIFEXITED (status));
+  return WEXITSTATUS (status);
+}
+
+static void test_pattern (){
+  const char* invalid[] = {
+    "still.jpg",
+    "still-%d.jpg",
+    "still-%s.jpg",
+    "still-%u-%u.jpg",
+    "still-%05lu.jpg",
+    "still-%%.jpg",
+    "still-%"
+  };
+  size_t i;
+
+  for (i=0; i<sizeof (invalid)/sizeof (invalid[0]); i++){
+    CHECK (init (invalid[i]) == 1);
+  }
+  CHECK (init ("/tmp/still-%u.jpg") == 0);
+  CHECK (init ("/tmp/still-%05u.jpg") == 0);
+}
+
+int main (){
+  test_capture ();
+  test_queue ();
+  test_pattern ();
+  return 0;
+}
@@ -0,0 +1,77 @@
+#include "test.h"
+
+#include <sys/stat.h>
+
+#include "storage.h"
+
+/*
+Catalog and eviction with a big directory: FILES recordings of one block each.
+It prints the time to build the catalog (the single pass over the directory at
+startup), the time of storage_add() (the only call of the recording path, it
+must not depend on the number of recordings) and the time the background thread
+takes to delete half of them when the quota is lowered.
+*/
+
+#define FILES 100000
+#define ADDS 1000
+
+int main (){
+  static int64_t times[ADDS];
+  char dir[64];
+  char path[128];
+  char quota[32];
+  storage_t storage;
+  struct stat st;
+  uint32_t i;
+
+  test_tmpdir (dir, sizeof (dir));
+  int64_t start = test_time ();
+  for (i=0; i<FILES; i++){
+    snprintf (path, sizeof (path), "%s/%06u.ts", dir, i);
+    int fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    CHECK (fd != -1 && write (fd, "G", 1) == 1);
+    close (fd);
+  }
+  printf ("%u files created in %.1f s\n", FILES,
+      (test_time () - start)/1.0e6);
+  snprintf (path, sizeof (path), "%s/000000.ts", dir);
+  CHECK (!stat (path, &st));
+  uint64_t size = (uint64_t)st.st_blocks*512;
+  snprintf (path, sizeof (path), "%s/%%06u.ts", dir);
+
+  //Catalog, nothing to delete yet
+  storage_open (&storage, path, 0);
+  CHECK (storage.files_length == FILES && storage.next_index == FILES);
+  printf ("catalog of %u recordings: %.1f ms\n", storage.files_length,
+      storage.catalog_time*1000);
+  storage_close (&storage);
+
+  //The quota is half of the recordings, the new ones evict the oldest
+  snprintf (quota, sizeof (quota), "%.3f", FILES/2*size/1048576.0);
+  storage_open (&storage, path, quota);
+  start = test_time ();
+  for (i=0; i<ADDS; i++){
+    int64_t before = test_time ();
+    storage_add (&storage, FILES + i, size);
+    times[i] = test_time () - before;
+  }
+  for (;;){
+    pthread_mutex_lock (&storage.mutex);
+    int full = storage.used + storage.reserve > storage.quota;
+    pthread_mutex_unlock (&storage.mutex);
+    if (!full) break;
+    usleep (1000);
+  }
+  int64_t time = test_time () - start;
+  test_percentile_t percentile = test_percentile (times, ADDS);
+  printf ("storage_add: p50 %lld us, p99 %lld us, max %lld us\n",
+      (long long)percentile.p50, (long long)percentile.p99,
+      (long long)percentile.max);
+  printf ("evicted %u recordings in %.1f ms (%.1f us each), %u left\n",
+      storage.evicted, time/1000.0, (double)time/storage.evicted,
+      storage.files_length);
+  storage_close (&storage);
+
+  test_remove (dir);
+  return 0;
+}
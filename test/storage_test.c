@@ -0,0 +1,160 @@
+#include "test.h"
+
+#include <sys/stat.h>
+
+#include "storage.h"
+
+#define FILE_SIZE 65536
+
+static void create (const char* dir, const char* name, size_t size){
+  static uint8_t data[FILE_SIZE];
+  char path[128];
+  snprintf (path, sizeof (path), "%s/%s", dir, name);
+  int fd = open (path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  CHECK (fd != -1);
+  CHECK (size <= sizeof (data) && write (fd, data, size) == (ssize_t)size);
+  close (fd);
+}
+
+static int exists (const char* dir, const char* name){
+  char path[128];
+  snprintf (path, sizeof (path), "%s/%s", dir, name);
+  return !access (path, F_OK);
+}
+
+//Recording of the catalog, from the oldest
+static storage_file_t* file (storage_t* storage, uint32_t i){
+  return &storage->files[(storage->files_head + i)%storage->files_capacity];
+}
+
+//Only the recordings enter the catalog, the interrupted ones are renamed and
+//the empty ones opened ahead of time are deleted
+static void test_scan (){
+  char dir[64];
+  char pattern[128];
+  char path[128];
+  storage_t storage;
+
+  test_tmpdir (dir, sizeof (dir));
+  create (dir, "10.ts", 100);
+  create (dir, "3.ts", 100);
+  create (dir, "7.ts.part", 100);
+  create (dir, "12.ts.part", 0);
+  create (dir, "5.tsx", 100);
+  create (dir, "x4.ts", 100);
+  create (dir, "notes.txt", 100);
+  snprintf (path, sizeof (path), "%s/20.ts", dir);
+  CHECK (!mkdir (path, 0777));
+
+  snprintf (pattern, sizeof (pattern), "%s/%%u.ts", dir);
+  storage_open (&storage, pattern, 0);
+  CHECK (storage.files_length == 3);
+  CHECK (file (&storage, 0)->index == 3);
+  CHECK (file (&storage, 1)->index == 7);
+  CHECK (file (&storage, 2)->index == 10);
+  CHECK (file (&storage, 0)->size);
+  CHECK (storage.next_index == 11);
+  CHECK (exists (dir, "7.ts") && !exists (dir, "7.ts.part"));
+  CHECK (!exists (dir, "12.ts.part"));
+  CHECK (exists (dir, "5.tsx") && exists (dir, "x4.ts"));
+  storage_close (&storage);
+
+  //An empty directory starts at 0
+  test_remove (dir);
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (pattern, sizeof (pattern), "%s/cam-%%05u.mp4", dir);
+  storage_open (&storage, pattern, 0);
+  CHECK (!storage.files_length && !storage.next_index);
+  storage_close (&storage);
+  test_remove (dir);
+}
+
+//The catalog grows past its initial capacity, in order, also when the ring
+//has wrapped
+static void test_grow (){
+  char dir[64];
+  char pattern[128];
+  storage_t storage;
+  uint32_t i;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (pattern, sizeof (pattern), "%s/%%u.h264", dir);
+  storage_open (&storage, pattern, 0);
+  for (i=0; i<1000; i++) storage_add (&storage, i, 1);
+  storage.files_head = 900;
+  storage.files_length = 100;
+  for (i=1000; i<4000; i++) storage_add (&storage, i, 1);
+  CHECK (storage.files_length == 3100);
+  CHECK (storage.files_capacity == 4096);
+  for (i=0; i<storage.files_length; i++){
+    CHECK (file (&storage, i)->index == 900 + i);
+  }
+  storage_close (&storage);
+  test_remove (dir);
+}
+
+//The oldest recordings are deleted until there's room for another one as big
+//as the biggest recent one
+static void test_quota (){
+  char dir[64];
+  char pattern[128];
+  char name[32];
+  storage_t storage;
+  struct stat st;
+  uint32_t i;
+
+  test_tmpdir (dir, sizeof (dir));
+  for (i=0; i<12; i++){
+    snprintf (name, sizeof (name), "%u.ts", i);
+    create (dir, name, FILE_SIZE);
+  }
+  snprintf (pattern, sizeof (pattern), "%s/0.ts", dir);
+  CHECK (!stat (pattern, &st));
+  uint64_t size = (uint64_t)st.st_blocks*512;
+  snprintf (pattern, sizeof (pattern), "%s/%%u.ts", dir);
+
+  //768 KiB, under the quota
+  storage_open (&storage, pattern, "1");
+  CHECK (storage.quota == 1024*1024);
+  CHECK (storage.used == 12*size);
+  usleep (50000);
+  CHECK (!storage.evicted);
+
+  for (i=12; i<=20; i++){
+    snprintf (name, sizeof (name), "%u.ts", i);
+    create (dir, name, FILE_SIZE);
+    storage_add (&storage, i, size);
+  }
+  uint32_t kept = (storage.quota - size)/size;
+  int64_t start = test_time ();
+  for (;;){
+    pthread_mutex_lock (&storage.mutex);
+    uint32_t length = storage.files_length;
+    pthread_mutex_unlock (&storage.mutex);
+    if (length == kept) break;
+    CHECK (test_time () - start < 5000000);
+    usleep (1000);
+  }
+  usleep (50000);
+  CHECK (storage.evicted == 21 - kept);
+  CHECK (storage.used == kept*size);
+  CHECK (file (&storage, 0)->index == 21 - kept);
+  for (i=0; i<=20; i++){
+    snprintf (name, sizeof (name), "%u.ts", i);
+    CHECK (exists (dir, name) == (i >= 21 - kept));
+  }
+  storage_close (&storage);
+
+  //A percentage of the file system
+  storage_open (&storage, pattern, "50%");
+  CHECK (storage.quota);
+  storage_close (&storage);
+  test_remove (dir);
+}
+
+int main (){
+  test_scan ();
+  test_grow ();
+  test_quota ();
+  return 0;
+}
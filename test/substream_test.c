@@ -0,0 +1,116 @@
+#include "test.h"
+
+#include <sys/wait.h>
+
+#include "substream.h"
+
+#define WIDTH 1920
+#define HEIGHT 1080
+
+static void test_defaults (){
+  substream_t substream;
+
+  substream_init (&substream, "rtp:192.168.1.10:5004", WIDTH, HEIGHT);
+  CHECK (!strcmp (substream.output, "rtp:192.168.1.10:5004"));
+  CHECK (substream.width == SUBSTREAM_WIDTH);
+  CHECK (substream.height == SUBSTREAM_HEIGHT);
+  CHECK (substream.bitrate == SUBSTREAM_BITRATE);
+  CHECK (substream.profile == 66);
+  substream_close (&substream);
+
+  substream_init (&substream,
+      "sub.h264,profile=high,size=1280x720,bitrate=25000000", WIDTH, HEIGHT);
+  CHECK (!strcmp (substream.output, "sub.h264"));
+  CHECK (substream.width == 1280 && substream.height == 720);
+  CHECK (substream.bitrate == 25000000 && substream.profile == 100);
+  substream_close (&substream);
+
+  //The whole camera
+  substream_init (&substream, "-,size=1920x1072,profile=main", WIDTH, HEIGHT);
+  CHECK (substream.width == 1920 && substream.height == 1072);
+  CHECK (substream.profile == 77);
+  substream_close (&substream);
+}
+
+//The options of the output stay with the output
+static void test_output_options (){
+  substream_t substream;
+
+  substream_init (&substream, "segment:sub-%05u.ts,duration=2", WIDTH,
+      HEIGHT);
+  CHECK (!strcmp (substream.output, "segment:sub-%05u.ts,duration=2"));
+  CHECK (substream.width == SUBSTREAM_WIDTH);
+  substream_close (&substream);
+
+  //The size of shm: and segment: is a number of MB
+  substream_init (&substream, "shm:sub,size=8", WIDTH, HEIGHT);
+  CHECK (!strcmp (substream.output, "shm:sub,size=8"));
+  CHECK (substream.width == SUBSTREAM_WIDTH);
+  substream_close (&substream);
+
+  substream_init (&substream,
+      "segment:sub-%05u.ts,duration=2,size=8,size=320x240,bitrate=500000",
+      WIDTH, HEIGHT);
+  CHECK (!strcmp (substream.output, "segment:sub-%05u.ts,duration=2,size=8"));
+  CHECK (substream.width == 320 && substream.height == 240);
+  CHECK (substream.bitrate == 500000);
+  substream_close (&substream);
+
+  //Only the trailing options are the ones of the substream
+  substream_init (&substream, "shm:sub,size=8,frames=4,profile=main", WIDTH,
+      HEIGHT);
+  CHECK (!strcmp (substream.output, "shm:sub,size=8,frames=4"));
+  CHECK (substream.profile == 77 && substream.bitrate == SUBSTREAM_BITRATE);
+  substream_close (&substream);
+}
+
+static int init (const char* spec){
+  int status;
+  //Or the child would print the buffered output again when it exits
+  fflush (stdout);
+  pid_t pid = fork ();
+  CHECK (pid != -1);
+  if (!pid){
+    substream_t substream;
+    fclose (stderr);
+    substream_init (&substream, spec, WIDTH, HEIGHT);
+    substream_close (&substream);
+    _exit (0);
+  }
+  CHECK (waitpid (pid, &status, 0) == pid);
+  CHECK (WIFEXITED (status));
+  return WEXITSTATUS (status);
+}
+
+static void test_errors (){
+  const char* invalid[] = {
+    "",
+    ",bitrate=1000000",
+    "rtp:192.168.1.10:5004,size=0x480",
+    "rtp:192.168.1.10:5004,size=650x480",
+    "rtp:192.168.1.10:5004,size=640x488",
+    "rtp:192.168.1.10:5004,size=2048x480",
+    "rtp:192.168.1.10:5004,size=640x1088",
+    "rtp:192.168.1.10:5004,size=640x480x",
+    "rtp:192.168.1.10:5004,size=wxh",
+    "rtp:192.168.1.10:5004,bitrate=0",
+    "rtp:192.168.1.10:5004,bitrate=25000001",
+    "rtp:192.168.1.10:5004,bitrate=fast",
+    "rtp:192.168.1.10:5004,bitrate=1000000bps",
+    "rtp:192.168.1.10:5004,profile=extended",
+    "rtp:192.168.1.10:5004,profile=highest"
+  };
+  size_t i;
+
+  CHECK (!init ("rtp:192.168.1.10:5004,size=640x480"));
+  for (i=0; i<sizeof (invalid)/sizeof (invalid[0]); i++){
+    CHECK (init (invalid[i]) == 1);
+  }
+}
+
+int main (){
+  test_defaults ();
+  test_output_options ();
+  test_errors ();
+  return 0;
+}
@@ -0,0 +1,252 @@
+#include "test.h"
+
+#include <sys/wait.h>
+
+#include "sweep.h"
+
+//Frame interval (us), 30 fps
+#define INTERVAL 33333
+//Time per configuration (ms)
+#define DURATION 400
+#define STARTUP 50000
+#define COLUMNS 23
+
+static const sweep_config_t defaults = { 8000000, 0, 0, 100, 30 };
+static volatile sig_atomic_t interrupted;
+
+typedef struct {
+  char* values[COLUMNS];
+} row_t;
+
+//Splits the rows of a CSV file in place, returns the number of rows after the
+//header
+static int parse_csv (char* text, row_t* rows, int max){
+  char* line;
+  char* save;
+  int n = -1;
+
+  for (line = strtok_r (text, "\n", &save); line;
+      line = strtok_r (0, "\n", &save)){
+    char* value = line;
+    int i;
+    CHECK (n < max);
+    for (i=0; i<COLUMNS; i++){
+      CHECK (value);
+      if (n >= 0) rows[n].values[i] = value;
+      if ((value = strchr (value, ','))) *value++ = 0;
+    }
+    CHECK (!value);
+    n++;
+  }
+  return n;
+}
+
+static double column (row_t* row, int i){
+  return atof (row->values[i]);
+}
+
+static void sweep (const char* spec, const char* path,
+    sweep_encoder_t* encoder){
+  sweep_t sweep;
+  sweep_init (&sweep, &defaults, spec);
+  sweep_open (&sweep, path);
+  sweep_run (&sweep, encoder, DURATION, &interrupted);
+  sweep_close (&sweep);
+}
+
+static void test_matrix (){
+  sweep_standin_t standin;
+  sweep_encoder_t encoder;
+  row_t rows[8];
+  char dir[64];
+  char path[128];
+  size_t length;
+  int i;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path, sizeof (path), "%s/sweep.csv", dir);
+  sweep_standin_init (&encoder, &standin, 1920, 1080, INTERVAL);
+  standin.startup = STARTUP;
+  sweep ("bitrate=2000000:8000000,profile=baseline:high,idr=5", path,
+      &encoder);
+
+  char* text = (char*)test_read_file (path, &length);
+  const char* header = "bitrate,qp_i,qp_p,profile,idr_period,startup_ms,";
+  CHECK (!strncmp (text, header, strlen (header)));
+  CHECK (parse_csv (text, rows, 8) == 4);
+  //The last parameter changes first
+  CHECK (!strcmp (rows[0].values[0], "2000000"));
+  CHECK (!strcmp (rows[0].values[3], "baseline"));
+  CHECK (!strcmp (rows[1].values[3], "high"));
+  CHECK (!strcmp (rows[2].values[0], "8000000"));
+  for (i=0; i<4; i++){
+    row_t* row = &rows[i];
+    CHECK (column (row, 4) == 5);
+    CHECK (column (row, 5) >= STARTUP/1000 &&
+        column (row, 5) < STARTUP/1000 + 30);
+    CHECK (column (row, 6) >= DURATION/1000.0);
+    //frames, keyframes: one every 5 frames
+    CHECK (column (row, 7) >= 12 && column (row, 7) <= 15);
+    CHECK (column (row, 8) == (int)(column (row, 7) + 4)/5);
+    CHECK (column (row, 11) > 27 && column (row, 11) < 33);
+    //The latency is relative, the frames of 1/5 s come out together
+    CHECK (column (row, 18) == 0);
+    CHECK (column (row, 14) < 2);
+    //No dropped or incomplete frames
+    CHECK (column (row, 19) == 0 && column (row, 20) == 0);
+    CHECK (column (row, 21) == 0 && column (row, 22) == 0);
+  }
+  //4 times the bitrate, 4 times the bytes. Baseline needs more bytes
+  CHECK (column (&rows[2], 10) > 3.5*column (&rows[0], 10));
+  CHECK (column (&rows[2], 10) < 4.5*column (&rows[0], 10));
+  CHECK (column (&rows[0], 10) > column (&rows[1], 10));
+  free (text);
+  test_remove (dir);
+}
+
+//The QPs override the bitrate and the results are written as JSON
+static void test_json (){
+  sweep_standin_t standin;
+  sweep_encoder_t encoder;
+  char dir[64];
+  char path[128];
+  size_t length;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path, sizeof (path), "%s/sweep.json", dir);
+  sweep_standin_init (&encoder, &standin, 1280, 720, INTERVAL);
+  standin.startup = STARTUP;
+  sweep ("qp_i=20:32,qp_p=26", path, &encoder);
+
+  char* text = (char*)test_read_file (path, &length);
+  CHECK (text[0] == '[' && !strcmp (text + length - 4, "}\n]\n"));
+  char* a = strstr (text, "\n  {\"bitrate\": 8000000, \"qp_i\": 20, "
+      "\"qp_p\": 26, \"profile\": \"high\", \"idr_period\": 30, ");
+  char* b = strstr (text, "},\n  {\"bitrate\": 8000000, \"qp_i\": 32, ");
+  CHECK (a && b && a < b);
+  //The first frame is the only IDR frame, its size is halved every 6 QP
+  unsigned long long bytes_a;
+  unsigned long long bytes_b;
+  unsigned frames_a;
+  unsigned frames_b;
+  CHECK (sscanf (strstr (a, "\"frames\": "), "\"frames\": %u",
+      &frames_a) == 1);
+  CHECK (sscanf (strstr (a, "\"bytes\": "), "\"bytes\": %llu",
+      &bytes_a) == 1);
+  CHECK (sscanf (strstr (b, "\"frames\": "), "\"frames\": %u",
+      &frames_b) == 1);
+  CHECK (sscanf (strstr (b, "\"bytes\": "), "\"bytes\": %llu",
+      &bytes_b) == 1);
+  uint64_t p = (uint64_t)(1280*720/100*0.95);
+  CHECK (bytes_a == (uint64_t)(1280*720/20*2*0.95) + (frames_a - 1)*p);
+  CHECK (bytes_b == (uint64_t)(1280*720/20/2*0.95) + (frames_b - 1)*p);
+  free (text);
+  test_remove (dir);
+}
+
+typedef struct {
+  sweep_encoder_t* standin;
+  int frames;
+} slow_t;
+
+static void slow_open (sweep_encoder_t* encoder, const sweep_config_t* config){
+  slow_t* slow = (slow_t*)encoder->data;
+  slow->frames = 0;
+  slow->standin->open (slow->standin, config);
+}
+
+static void slow_read (sweep_encoder_t* encoder, stream_buffer_t* buffer){
+  slow_t* slow = (slow_t*)encoder->data;
+  slow->standin->read (slow->standin, buffer);
+  if (buffer->flags & STREAM_FLAG_ENDOFFRAME) slow->frames++;
+}
+
+//The end of the 3rd frame is given back 3 frame intervals late, the 8th frame
+//stops the sweep
+static void slow_release (sweep_encoder_t* encoder){
+  slow_t* slow = (slow_t*)encoder->data;
+  if (slow->frames == 3) usleep (3*INTERVAL);
+  if (slow->frames == 8) interrupted = 1;
+  slow->standin->release (slow->standin);
+}
+
+static void slow_close (sweep_encoder_t* encoder){
+  slow_t* slow = (slow_t*)encoder->data;
+  slow->standin->close (slow->standin);
+}
+
+//The frames lost while a buffer is not given back are dropped, and an
+//interrupted sweep keeps the configuration in progress
+static void test_dropped (){
+  sweep_standin_t standin;
+  sweep_encoder_t inner;
+  sweep_encoder_t encoder;
+  slow_t slow;
+  row_t rows[8];
+  char dir[64];
+  char path[128];
+  size_t length;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path, sizeof (path), "%s/sweep.csv", dir);
+  sweep_standin_init (&inner, &standin, 640, 480, INTERVAL);
+  standin.startup = STARTUP;
+  slow.standin = &inner;
+  encoder = inner;
+  encoder.open = slow_open;
+  encoder.read = slow_read;
+  encoder.release = slow_release;
+  encoder.close = slow_close;
+  encoder.data = &slow;
+  interrupted = 0;
+  sweep ("idr=0:30", path, &encoder);
+  interrupted = 0;
+
+  char* text = (char*)test_read_file (path, &length);
+  CHECK (parse_csv (text, rows, 8) == 1);
+  CHECK (column (&rows[0], 4) == 0);
+  //The frames captured during the 3 intervals but the last one are lost
+  CHECK (column (&rows[0], 7) == 8);
+  CHECK (column (&rows[0], 19) + column (&rows[0], 20) +
+      column (&rows[0], 21) == 2);
+  free (text);
+  test_remove (dir);
+}
+
+//Invalid matrices exit with 1
+static void test_invalid (){
+  const char* specs[] = {
+    "bitrate",
+    "speed=1",
+    "qp_i=52",
+    "bitrate=-1",
+    "bitrate=1:",
+    "profile=extended",
+    "idr=1:2:3:4:5:6:7:8:9:10:11:12:13:14:15:16:17"
+  };
+  sweep_t sweep;
+  size_t i;
+  int status;
+
+  for (i=0; i<sizeof (specs)/sizeof (specs[0]); i++){
+    pid_t pid = fork ();
+    CHECK (pid != -1);
+    if (!pid){
+      fclose (stderr);
+      sweep_init (&sweep, &defaults, specs[i]);
+      _exit (0);
+    }
+    CHECK (waitpid (pid, &status, 0) == pid);
+    CHECK (WIFEXITED (status) && WEXITSTATUS (status) == 1);
+  }
+}
+
+int main (){
+  //The results are printed as well
+  CHECK (freopen ("/dev/null", "w", stdout));
+  test_matrix ();
+  test_json ();
+  test_dropped ();
+  test_invalid ();
+  return 0;
+}
@@ -0,0 +1,502 @@
+#ifndef TEST_H
+#define TEST_H
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "stream.h"
+#include "writer.h"
+
+/*
+Host tests (make test) and benchmarks (make bench) of the modules that don't
+need the VideoCore libraries. Every test/NAME_test.c and test/NAME_bench.c is a
+program linked with those modules, it runs its checks and exits with 1 at the
+first failure. They build and run on any Linux machine, e.g. the development
+PC, without a camera.
+
+The streams are built with the helpers below: real SPS, PPS and slice headers
+(Exp-Golomb coded), so the parsers see what the encoder produces, and payloads
+that never contain a start code.
+*/
+
+#define CHECK(condition) do { \
+  if (!(condition)){ \
+    fprintf (stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, \
+        #condition); \
+    exit (1); \
+  } \
+} while (0)
+
+//Monotonic time (us)
+static inline int64_t test_time (){
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  return (int64_t)spec.tv_sec*1000000 + spec.tv_nsec/1000;
+}
+
+static inline int test_compare (const void* a, const void* b){
+  int64_t x = *(const int64_t*)a;
+  int64_t y = *(const int64_t*)b;
+  return x < y ? -1 : x > y;
+}
+
+//Median, 99th percentile and maximum of the samples of a benchmark
+typedef struct {
+  int64_t p50;
+  int64_t p99;
+  int64_t max;
+} test_percentile_t;
+
+//Sorts the samples, at least one
+static inline test_percentile_t test_percentile (
+    int64_t* samples,
+    size_t length){
+  test_percentile_t percentile;
+
+  CHECK (length);
+  qsort (samples, length, sizeof (int64_t), test_compare);
+  percentile.p50 = samples[length/2];
+  percentile.p99 = samples[length*99/100];
+  percentile.max = samples[length - 1];
+  return percentile;
+}
+
+//Creates an empty directory in /tmp
+static inline void test_tmpdir (char* path, size_t size){
+  snprintf (path, size, "/tmp/h264-test-XXXXXX");
+  CHECK (mkdtemp (path));
+}
+
+static inline int test_remove_entry (
+    const char* path,
+    const struct stat* st,
+    int type,
+    struct FTW* ftw){
+  return remove (path);
+}
+
+//Removes a directory and everything inside
+static inline void test_remove (const char* path){
+  nftw (path, test_remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+//Reads a whole file, the length is returned in length. A null byte is added
+//after the data, so a text file is a string. Must be freed
+static inline uint8_t* test_read_file (const char* path, size_t* length){
+  FILE* file = fopen (path, "rb");
+  CHECK (file);
+  CHECK (!fseek (file, 0, SEEK_END));
+  long size = ftell (file);
+  CHECK (size >= 0);
+  rewind (file);
+  uint8_t* data = malloc (size + 1);
+  CHECK (data);
+  CHECK (fread (data, 1, size, file) == (size_t)size);
+  fclose (file);
+  data[size] = 0;
+  *length = size;
+  return data;
+}
+
+//Occupies the thread of a writer until it's unblocked
+typedef struct {
+  int started[2];
+  int gate[2];
+} test_blocker_t;
+
+static inline void test_block_job (void* arg){
+  test_blocker_t* blocker = (test_blocker_t*)arg;
+  uint8_t byte = 0;
+  CHECK (write (blocker->started[1], &byte, 1) == 1);
+  CHECK (read (blocker->gate[0], &byte, 1) == 1);
+  //The thread that opened the gate doesn't wait for the job
+  close (blocker->gate[0]);
+}
+
+//Returns when the thread of the stream runs the blocking job
+static inline void test_block (
+    writer_stream_t* stream,
+    test_blocker_t* blocker){
+  uint8_t byte;
+  CHECK (!pipe (blocker->started) && !pipe (blocker->gate));
+  writer_job (stream, test_block_job, blocker);
+  CHECK (read (blocker->started[0], &byte, 1) == 1);
+}
+
+static inline void test_unblock (test_blocker_t* blocker){
+  uint8_t byte = 0;
+  CHECK (write (blocker->gate[1], &byte, 1) == 1);
+  close (blocker->started[0]);
+  close (blocker->started[1]);
+  close (blocker->gate[1]);
+}
+
+//Bit writer of the RBSP of a NAL unit
+typedef struct {
+  uint8_t data[256];
+  uint32_t position;
+} test_bits_t;
+
+static inline void test_bits_put (test_bits_t* bits, uint32_t value, int n){
+  while (n--){
+    uint32_t byte = bits->position >> 3;
+    if (!(bits->position & 7)) bits->data[byte] = 0;
+    if ((value >> n) & 1) bits->data[byte] |= 0x80 >> (bits->position & 7);
+    bits->position++;
+  }
+}
+
+static inline void test_bits_ue (test_bits_t* bits, uint32_t value){
+  int n = 32 - __builtin_clz (value + 1);
+  test_bits_put (bits, 0, n - 1);
+  test_bits_put (bits, value + 1, n);
+}
+
+static inline void test_bits_se (test_bits_t* bits, int32_t value){
+  test_bits_ue (bits, value > 0 ? 2*value - 1 : -2*value);
+}
+
+//Writes a NAL unit in Annex-B format (4-byte start code) with the RBSP
+//trailing bits and the emulation prevention bytes. Returns its length
+static inline uint32_t test_bits_nal (
+    test_bits_t* bits,
+    uint8_t header,
+    uint8_t* out){
+  uint32_t length = 5;
+  uint32_t zeros = 0;
+  uint32_t i;
+
+  test_bits_put (bits, 1, 1);
+  while (bits->position & 7) test_bits_put (bits, 0, 1);
+  out[0] = out[1] = out[2] = 0;
+  out[3] = 1;
+  out[4] = header;
+  for (i=0; i<bits->position/8; i++){
+    if (zeros >= 2 && bits->data[i] <= 3){
+      out[length++] = 3;
+      zeros = 0;
+    }
+    zeros = bits->data[i] ? 0 : zeros + 1;
+    out[length++] = bits->data[i];
+  }
+  return length;
+}
+
+//SPS of a 4:2:0 stream, frame_num and pic_order_cnt_lsb of 8 bits
+static inline uint32_t test_sps (
+    uint8_t* out,
+    uint8_t profile_idc,
+    uint32_t width,
+    uint32_t height){
+  test_bits_t bits = { .position = 0 };
+  uint32_t width_mbs = (width + 15)/16;
+  uint32_t height_mbs = (height + 15)/16;
+
+  test_bits_put (&bits, profile_idc, 8);
+  test_bits_put (&bits, 0, 8);
+  test_bits_put (&bits, 40, 8);
+  //seq_parameter_set_id
+  test_bits_ue (&bits, 0);
+  if (profile_idc == 100){
+    //chroma_format_idc, bit depths, transform bypass, no scaling matrix
+    test_bits_ue (&bits, 1);
+    test_bits_ue (&bits, 0);
+    test_bits_ue (&bits, 0);
+    test_bits_put (&bits, 0, 1);
+    test_bits_put (&bits, 0, 1);
+  }
+  //log2_max_frame_num_minus4, pic_order_cnt_type, log2_max_poc_lsb_minus4
+  test_bits_ue (&bits, 4);
+  test_bits_ue (&bits, 0);
+  test_bits_ue (&bits, 4);
+  //max_num_ref_frames, gaps_in_frame_num_value_allowed_flag
+  test_bits_ue (&bits, 1);
+  test_bits_put (&bits, 0, 1);
+  test_bits_ue (&bits, width_mbs - 1);
+  test_bits_ue (&bits, height_mbs - 1);
+  //frame_mbs_only_flag, direct_8x8_inference_flag
+  test_bits_put (&bits, 1, 1);
+  test_bits_put (&bits, 1, 1);
+  if (width_mbs*16 != width || height_mbs*16 != height){
+    test_bits_put (&bits, 1, 1);
+    test_bits_ue (&bits, 0);
+    test_bits_ue (&bits, (width_mbs*16 - width)/2);
+    test_bits_ue (&bits, 0);
+    test_bits_ue (&bits, (height_mbs*16 - height)/2);
+  }else{
+    test_bits_put (&bits, 0, 1);
+  }
+  //vui_parameters_present_flag
+  test_bits_put (&bits, 0, 1);
+  return test_bits_nal (&bits, 0x67, out);
+}
+
+static inline uint32_t test_pps (uint8_t* out, uint32_t id){
+  test_bits_t bits = { .position = 0 };
+
+  test_bits_ue (&bits, id);
+  //seq_parameter_set_id, entropy_coding_mode_flag,
+  //bottom_field_pic_order_in_frame_present_flag, num_slice_groups_minus1
+  test_bits_ue (&bits, 0);
+  test_bits_put (&bits, 0, 1);
+  test_bits_put (&bits, 0, 1);
+  test_bits_ue (&bits, 0);
+  //num_ref_idx_l0/l1_default_active_minus1, weighted_pred_flag,
+  //weighted_bipred_idc, pic_init_qp_minus26, pic_init_qs_minus26,
+  //chroma_qp_index_offset
+  test_bits_ue (&bits, 0);
+  test_bits_ue (&bits, 0);
+  test_bits_put (&bits, 0, 1);
+  test_bits_put (&bits, 0, 2);
+  test_bits_se (&bits, 0);
+  test_bits_se (&bits, 0);
+  test_bits_se (&bits, 0);
+  //deblocking_filter_control_present_flag, constrained_intra_pred_flag,
+  //redundant_pic_cnt_present_flag
+  test_bits_put (&bits, 1, 1);
+  test_bits_put (&bits, 0, 1);
+  test_bits_put (&bits, 0, 1);
+  return test_bits_nal (&bits, 0x68, out);
+}
+
+//Slice of a frame with the SPS and PPS above: the header and length bytes of
+//payload in total, 0xAA bytes that never form a start code
+static inline uint32_t test_slice (
+    uint8_t* out,
+    int idr,
+    uint32_t frame_num,
+    uint32_t pps_id,
+    uint32_t length){
+  test_bits_t bits = { .position = 0 };
+
+  //first_mb_in_slice, slice_type (I or P, all the slices of the picture)
+  test_bits_ue (&bits, 0);
+  test_bits_ue (&bits, idr ? 7 : 5);
+  test_bits_ue (&bits, pps_id);
+  test_bits_put (&bits, frame_num & 0xFF, 8);
+  if (idr){
+    //idr_pic_id
+    test_bits_ue (&bits, 0);
+  }
+  //pic_order_cnt_lsb
+  test_bits_put (&bits, (2*frame_num) & 0xFF, 8);
+  uint32_t n = test_bits_nal (&bits, idr ? 0x65 : 0x41, out);
+  //The trailing bits are part of the payload, as if the slice data followed
+  if (length > n){
+    memset (out + n, 0xAA, length - n);
+    n = length;
+  }
+  return n;
+}
+
+//Encoded frames of a test stream
+typedef struct {
+  //Codec config buffer: SPS and PPS
+  uint8_t config[64];
+  uint32_t config_length;
+  uint8_t* data;
+  uint32_t size;
+  uint32_t frame_num;
+  int64_t timestamp;
+  //Frame interval (us)
+  int64_t interval;
+} test_stream_t;
+
+static inline void test_stream_init (
+    test_stream_t* stream,
+    uint8_t profile_idc,
+    uint32_t width,
+    uint32_t height,
+    uint32_t size){
+  stream->config_length = test_sps (stream->config, profile_idc, width,
+      height);
+  stream->config_length += test_pps (stream->config + stream->config_length,
+      0);
+  stream->data = malloc (size);
+  CHECK (stream->data);
+  stream->size = size;
+  stream->frame_num = 0;
+  stream->timestamp = 0;
+  stream->interval = 1000000/30;
+}
+
+static inline void test_stream_free (test_stream_t* stream){
+  free (stream->data);
+}
+
+static inline void test_stream_config (
+    test_stream_t* stream,
+    stream_buffer_t* buffer){
+  buffer->data = stream->config;
+  buffer->length = stream->config_length;
+  buffer->timestamp = 0;
+  buffer->flags = STREAM_FLAG_CODECCONFIG | STREAM_FLAG_ENDOFFRAME;
+}
+
+//Next frame of the stream, in one buffer of length bytes (at most size)
+static inline void test_stream_frame (
+    test_stream_t* stream,
+    stream_buffer_t* buffer,
+    int idr,
+    uint32_t length){
+  CHECK (length <= stream->size);
+  if (idr) stream->frame_num = 0;
+  buffer->data = stream->data;
+  buffer->length = test_slice (stream->data, idr, stream->frame_num++, 0,
+      length);
+  buffer->timestamp = stream->timestamp;
+  buffer->flags = STREAM_FLAG_ENDOFFRAME | (idr ? STREAM_FLAG_SYNCFRAME : 0);
+  stream->timestamp += stream->interval;
+}
+
+//Drains a non-blocking fd into a growing buffer, until there's nothing else to
+//read or the end of the file
+static inline void test_drain (int fd, uint8_t** data, size_t* length,
+    size_t* size){
+  ssize_t n;
+
+  for (;;){
+    if (*size - *length < 65536){
+      *size = *size*2 + 65536;
+      *data = realloc (*data, *size);
+      CHECK (*data);
+    }
+    n = read (fd, *data + *length, *size - *length);
+    if (n == -1 && errno == EINTR) continue;
+    if (n <= 0){
+      CHECK (!n || errno == EAGAIN);
+      return;
+    }
+    *length += n;
+  }
+}
+
+//Free TCP port on the loopback interface
+static inline uint16_t test_port (){
+  struct sockaddr_in addr;
+  socklen_t length = sizeof (addr);
+  int fd = socket (AF_INET, SOCK_STREAM, 0);
+  CHECK (fd != -1);
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  CHECK (!bind (fd, (struct sockaddr*)&addr, sizeof (addr)));
+  CHECK (!getsockname (fd, (struct sockaddr*)&addr, &length));
+  close (fd);
+  return ntohs (addr.sin_port);
+}
+
+//Non-blocking TCP connection to a port of the loopback interface
+static inline int test_connect (uint16_t port){
+  struct sockaddr_in addr;
+  int fd = socket (AF_INET, SOCK_STREAM, 0);
+  CHECK (fd != -1);
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  addr.sin_port = htons (port);
+  CHECK (!connect (fd, (struct sockaddr*)&addr, sizeof (addr)));
+  CHECK (!fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK));
+  return fd;
+}
+
+//Reads until nothing arrives for ms milliseconds
+static inline void test_receive (int fd, uint8_t** data, size_t* length,
+    size_t* size, int ms){
+  struct pollfd pfd = { .fd = fd, .events = POLLIN };
+  while (poll (&pfd, 1, ms) == 1){
+    size_t before = *length;
+    test_drain (fd, data, length, size);
+    if (*length == before) break;
+  }
+}
+
+static inline uint32_t test_be16 (const uint8_t* p){
+  return (p[0] << 8) | p[1];
+}
+
+static inline uint32_t test_be32 (const uint8_t* p){
+  return ((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+}
+
+//Finds a box of an ISO BMFF file by its path, e.g. "moov/trak/tkhd", the
+//index-th one with that type at the last level (the first one at the others).
+//Returns its payload and its size, 0 if it's not found
+static inline uint8_t* test_box (
+    uint8_t* data,
+    size_t length,
+    const char* path,
+    int index,
+    uint32_t* size){
+  const char* next = strchr (path, '/');
+  size_t offset = 0;
+
+  while (offset + 8 <= length){
+    uint32_t box_size = test_be32 (data + offset);
+    CHECK (box_size >= 8 && offset + box_size <= length);
+    if (!memcmp (data + offset + 4, path, 4) && (next || !index--)){
+      if (next){
+        return test_box (data + offset + 8, box_size - 8, next + 1, index,
+            size);
+      }
+      *size = box_size - 8;
+      return data + offset + 8;
+    }
+    offset += box_size;
+  }
+  return 0;
+}
+
+//NAL unit of a test stream, split by test_split()
+typedef struct {
+  uint8_t type;
+  uint32_t length;
+  //frame_num of the P slices (see test_slice)
+  uint32_t frame_num;
+} test_nal_t;
+
+//Splits the output of a sink, an Annex-B stream of 4-byte start codes. Returns
+//the number of NAL units, at most max
+static inline uint32_t test_split (
+    uint8_t* data,
+    size_t length,
+    test_nal_t* nals,
+    uint32_t max){
+  uint32_t count = 0;
+  size_t i = 0;
+  size_t start;
+
+  while (i + 3 < length){
+    CHECK (count < max);
+    CHECK (!data[i] && !data[i + 1] && !data[i + 2] && data[i + 3] == 1);
+    i += 4;
+    start = i;
+    while (i + 2 < length && (data[i] || data[i + 1] || data[i + 2] > 1)) i++;
+    if (i + 2 >= length) i = length;
+    //The 4-byte start code of the next unit begins with a zero byte
+    else if (i > start && !data[i - 1]) i--;
+    nals[count].type = data[start] & 0x1F;
+    nals[count].length = i - start + 4;
+    //first_mb_in_slice (1 bit), slice_type 5 (5 bits), pic_parameter_set_id
+    //(1 bit), frame_num (8 bits)
+    nals[count].frame_num = ((data[start + 1] & 1) << 7) |
+        (data[start + 2] >> 1);
+    count++;
+  }
+  return count;
+}
+
+#endif
@@ -0,0 +1,115 @@
+#include "test.h"
+
+#include "timelapse.h"
+
+#define PLAYBACK 25
+
+static uint8_t payload[16];
+
+//Rewrites the timestamp of a buffer, returns the new one in timestamp
+static int rewrite (timelapse_t* timelapse, uint32_t length, int64_t source,
+    uint32_t flags, int64_t* timestamp){
+  stream_buffer_t buffer = { payload, length, source, flags };
+  int end = timelapse_timestamp (timelapse, &buffer);
+  *timestamp = buffer.timestamp;
+  return end;
+}
+
+static void test_framerate (){
+  CHECK (timelapse_framerate (1000) == 1 << 16);
+  CHECK (timelapse_framerate (500) == 2 << 16);
+  CHECK (timelapse_framerate (100) == 10 << 16);
+  CHECK (timelapse_framerate (3000) == 1 << 16);
+  CHECK (timelapse_framerate (60000) == 1 << 16);
+
+  CHECK (!timelapse_toggled (100));
+  CHECK (!timelapse_toggled (TIMELAPSE_INTERVAL_MAX));
+  CHECK (timelapse_toggled (TIMELAPSE_INTERVAL_MAX + 1));
+}
+
+static void test_timestamp (){
+  timelapse_t timelapse;
+  int64_t timestamp;
+  int i;
+
+  timelapse_init (&timelapse, PLAYBACK);
+
+  //SPS and PPS before the first frame
+  CHECK (!rewrite (&timelapse, 10, 123456, STREAM_FLAG_CODECCONFIG,
+      &timestamp));
+  CHECK (timestamp == 0);
+
+  //A frame in two buffers, the timestamps of the camera are ignored
+  CHECK (!rewrite (&timelapse, 16, 5000000, STREAM_FLAG_SYNCFRAME,
+      &timestamp));
+  CHECK (timestamp == 0);
+  CHECK (rewrite (&timelapse, 16, 5000000, STREAM_FLAG_ENDOFFRAME,
+      &timestamp));
+  CHECK (timestamp == 0);
+  CHECK (timelapse.frames == 0);
+
+  //One frame every 10 s is played at 25 fps
+  for (i=1; i<10; i++){
+    CHECK (!rewrite (&timelapse, 16, 5000000 + i*10000000LL, 0, &timestamp));
+    CHECK (timestamp == i*1000000LL/PLAYBACK);
+    CHECK (rewrite (&timelapse, 16, 5000000 + i*10000000LL,
+        STREAM_FLAG_ENDOFFRAME, &timestamp));
+    CHECK (timestamp == i*1000000LL/PLAYBACK);
+  }
+  CHECK (timelapse.frames == 9);
+
+  //The SPS and PPS of an IDR take the timestamp of the next frame
+  CHECK (!rewrite (&timelapse, 10, 95000000, STREAM_FLAG_CODECCONFIG,
+      &timestamp));
+  CHECK (timestamp == 10*1000000LL/PLAYBACK);
+  CHECK (timelapse.frames == 9);
+  CHECK (rewrite (&timelapse, 16, 105000000,
+      STREAM_FLAG_ENDOFFRAME | STREAM_FLAG_SYNCFRAME, &timestamp));
+  CHECK (timestamp == 10*1000000LL/PLAYBACK);
+
+  //An empty buffer isn't a frame
+  CHECK (!rewrite (&timelapse, 0, 115000000,
+      STREAM_FLAG_ENDOFFRAME | STREAM_FLAG_EOS, &timestamp));
+  CHECK (timelapse.frames == 10);
+  CHECK (rewrite (&timelapse, 16, 115000000, STREAM_FLAG_ENDOFFRAME,
+      &timestamp));
+  CHECK (timestamp == 11*1000000LL/PLAYBACK);
+}
+
+static void test_meter (){
+  timelapse_meter_t meter;
+  char str[256];
+  unsigned frames;
+  double wakeups, switches, cpu;
+  int64_t start;
+  int i;
+
+  timelapse_meter_start (&meter);
+  CHECK (timelapse_meter_dump (&meter, 0, str, sizeof (str)) > 0);
+  CHECK (!strcmp (str, "no frames"));
+
+  //10 wakeups that sleep and 100 ms of CPU for 5 frames
+  for (i=0; i<10; i++){
+    meter.wakeups++;
+    usleep (1000);
+  }
+  start = test_time ();
+  while (test_time () - start < 100000);
+
+  CHECK (timelapse_meter_dump (&meter, 5, str, sizeof (str)) > 0);
+  CHECK (sscanf (str, "frames %u, per frame: encoder loop wakeups %lf, "
+      "context switches %lf, CPU time %lf ms", &frames, &wakeups, &switches,
+      &cpu) == 4);
+  CHECK (frames == 5);
+  CHECK (wakeups == 2);
+  CHECK (switches >= 2);
+  //The busy loop may be preempted on a loaded machine
+  CHECK (cpu >= 5 && cpu < 1000);
+}
+
+int main (){
+  test_framerate ();
+  test_timestamp ();
+  test_meter ();
+  return 0;
+}
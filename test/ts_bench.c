@@ -0,0 +1,82 @@
+#include "test.h"
+
+#include <pthread.h>
+
+#include "sink.h"
+
+/*
+Throughput of the TS packetization: frames of several sizes are written as fast
+as possible to /dev/null, so the time is the packetization and write() of the
+batches, and to a local UDP socket read by another thread, where sendmmsg()
+adds the per-datagram cost. The sink prints its own CPU time when it's closed.
+*/
+
+#define FRAMES 3000
+
+static volatile int receiving;
+
+static void* receive_loop (void* arg){
+  int fd = *(int*)arg;
+  static uint8_t datagram[65536];
+  while (receiving) recv (fd, datagram, sizeof (datagram), 0);
+  return 0;
+}
+
+static void bench (const char* spec, uint32_t frame_size){
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  paramsets_t paramsets;
+  int i;
+
+  test_stream_init (&stream, 100, 1920, 1080, frame_size);
+  paramsets_init (&paramsets);
+  sink_t* sink = sink_open (spec);
+  sink->paramsets = &paramsets;
+  test_stream_config (&stream, &buffer);
+  paramsets_update (&paramsets, &buffer);
+  sink_write (sink, &buffer);
+
+  int64_t start = test_time ();
+  for (i=0; i<FRAMES; i++){
+    test_stream_frame (&stream, &buffer, !(i%30), frame_size);
+    sink_write (sink, &buffer);
+  }
+  int64_t time = test_time () - start;
+  printf ("%s, %u-byte frames: %.1f MB/s, %.1f us per frame, "
+      "%u dropped frames\n", spec, frame_size,
+      (double)sink->bytes/time, (double)time/FRAMES, sink->dropped_frames);
+  sink_close (sink);
+  test_stream_free (&stream);
+}
+
+int main (){
+  uint32_t sizes[] = { 2000, 40000, 200000 };
+  struct sockaddr_in addr;
+  socklen_t length = sizeof (addr);
+  pthread_t thread;
+  char spec[64];
+  int i;
+
+  for (i=0; i<3; i++) bench ("ts:/dev/null", sizes[i]);
+
+  int fd = socket (AF_INET, SOCK_DGRAM, 0);
+  CHECK (fd != -1);
+  int size = 8*1024*1024;
+  setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  CHECK (!bind (fd, (struct sockaddr*)&addr, sizeof (addr)));
+  CHECK (!getsockname (fd, (struct sockaddr*)&addr, &length));
+  CHECK (!fcntl (fd, F_SETFL, O_NONBLOCK));
+  receiving = 1;
+  CHECK (!pthread_create (&thread, 0, receive_loop, &fd));
+
+  snprintf (spec, sizeof (spec), "udp:127.0.0.1:%u", ntohs (addr.sin_port));
+  for (i=0; i<3; i++) bench (spec, sizes[i]);
+
+  receiving = 0;
+  pthread_join (thread, 0);
+  close (fd);
+  return 0;
+}
@@ -0,0 +1,441 @@
+#include "test.h"
+
+#include "sink.h"
+
+#define FRAMES 200
+#define GOP 30
+#define PACKET_SIZE 188
+#define PID_PAT 0x0000
+#define PID_PMT 0x1000
+#define PID_VIDEO 0x0100
+
+//Frame of the demuxed stream
+typedef struct {
+  int64_t pts;
+  int64_t dts;
+  int64_t pcr;
+  int random_access;
+  //The PAT and PMT are right before the frame
+  int psi;
+  size_t offset;
+  size_t length;
+} ts_frame_t;
+
+typedef struct {
+  ts_frame_t frames[FRAMES];
+  int length;
+  //Payload of all the PES packets
+  uint8_t* data;
+  size_t data_length;
+  size_t data_size;
+  int counter[3];
+  int psi;
+} demux_t;
+
+//The frame lengths make the last packet of a frame end at every offset, so
+//all the stuffing cases are covered
+static uint32_t frame_length (int i){
+  return 2000 + i;
+}
+
+static uint32_t crc32_mpeg (const uint8_t* data, uint32_t length){
+  uint32_t crc = 0xFFFFFFFF;
+  int i;
+  while (length--){
+    crc ^= (uint32_t)*data++ << 24;
+    for (i=0; i<8; i++){
+      crc = crc & 0x80000000 ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+    }
+  }
+  return crc;
+}
+
+static int64_t timestamp (const uint8_t* p, uint8_t prefix){
+  CHECK (p[0] >> 4 == prefix);
+  CHECK ((p[0] & 1) && (p[2] & 1) && (p[4] & 1));
+  return ((int64_t)(p[0] & 0x0E) << 29) | (p[1] << 22) | ((p[2] >> 1) << 15) |
+      (p[3] << 7) | (p[4] >> 1);
+}
+
+//Checks a PSI section: pointer field, CRC and stuffing. Returns the section
+static uint8_t* section (uint8_t* packet, uint8_t table_id){
+  CHECK (packet[1] & 0x40);
+  CHECK (!packet[4]);
+  uint8_t* section = packet + 5;
+  uint32_t length = ((section[1] & 0x0F) << 8) | section[2];
+  CHECK (section[0] == table_id);
+  CHECK (5 + 3 + length <= PACKET_SIZE);
+  //The CRC of a section with its CRC is 0
+  CHECK (!crc32_mpeg (section, 3 + length));
+  uint32_t i;
+  for (i=5 + 3 + length; i<PACKET_SIZE; i++) CHECK (packet[i] == 0xFF);
+  return section;
+}
+
+static void demux_init (demux_t* demux){
+  memset (demux, 0, sizeof (demux_t));
+  demux->counter[0] = demux->counter[1] = demux->counter[2] = -1;
+}
+
+static void demux_free (demux_t* demux){
+  free (demux->data);
+}
+
+static void demux_append (demux_t* demux, const uint8_t* data, size_t length){
+  if (demux->data_length + length > demux->data_size){
+    demux->data_size = demux->data_size*2 + length + 65536;
+    demux->data = realloc (demux->data, demux->data_size);
+    CHECK (demux->data);
+  }
+  memcpy (demux->data + demux->data_length, data, length);
+  demux->data_length += length;
+  if (demux->length) demux->frames[demux->length - 1].length += length;
+}
+
+//Demuxes whole packets, a file or the datagrams received so far
+static void demux_packets (demux_t* demux, uint8_t* data, size_t length){
+  uint8_t* packet;
+  ts_frame_t* frame;
+
+  CHECK (!(length%PACKET_SIZE));
+  for (packet=data; packet<data + length; packet+=PACKET_SIZE){
+    CHECK (packet[0] == 0x47);
+    uint16_t pid = ((packet[1] & 0x1F) << 8) | packet[2];
+    int index = pid == PID_PAT ? 0 : pid == PID_PMT ? 1 : 2;
+    CHECK (index < 2 || pid == PID_VIDEO);
+
+    //Every packet has a payload, the counters never skip a value
+    CHECK (packet[3] & 0x10);
+    int counter = packet[3] & 0x0F;
+    if (demux->counter[index] != -1){
+      CHECK (counter == ((demux->counter[index] + 1) & 0x0F));
+    }
+    demux->counter[index] = counter;
+
+    if (pid == PID_PAT){
+      uint8_t* pat = section (packet, 0x00);
+      CHECK (test_be16 (pat + 8) == 1);
+      CHECK ((test_be16 (pat + 10) & 0x1FFF) == PID_PMT);
+      demux->psi = 1;
+      continue;
+    }
+    if (pid == PID_PMT){
+      //The PMT always follows the PAT
+      CHECK (demux->psi == 1);
+      uint8_t* pmt = section (packet, 0x02);
+      CHECK ((test_be16 (pmt + 8) & 0x1FFF) == PID_VIDEO);
+      CHECK (pmt[12] == 0x1B);
+      CHECK ((test_be16 (pmt + 13) & 0x1FFF) == PID_VIDEO);
+      demux->psi = 2;
+      continue;
+    }
+
+    int start = packet[1] & 0x40;
+    uint8_t* payload = packet + 4;
+    int64_t pcr = -1;
+    int random_access = 0;
+    if (packet[3] & 0x20){
+      uint8_t* field = packet + 5;
+      payload = field + packet[4];
+      CHECK (payload < packet + PACKET_SIZE);
+      if (packet[4]){
+        uint8_t flags = *field++;
+        random_access = flags & 0x40;
+        if (flags & 0x10){
+          pcr = ((int64_t)field[0] << 25) | (field[1] << 17) |
+              (field[2] << 9) | (field[3] << 1) | (field[4] >> 7);
+          CHECK (!field[5]);
+          field += 6;
+        }
+        while (field < payload) CHECK (*field++ == 0xFF);
+      }
+    }
+
+    //Only the first packet of a frame has the PCR and the random access flag
+    CHECK (start ? pcr != -1 : pcr == -1 && !random_access);
+    if (start){
+      CHECK (demux->length < FRAMES);
+      frame = &demux->frames[demux->length++];
+      frame->pcr = pcr;
+      frame->random_access = random_access;
+      frame->psi = demux->psi == 2;
+      demux->psi = 0;
+      frame->offset = demux->data_length;
+      frame->length = 0;
+
+      //Unbounded PES packet with the PTS and DTS
+      CHECK (!payload[0] && !payload[1] && payload[2] == 1);
+      CHECK (payload[3] == 0xE0);
+      CHECK (!payload[4] && !payload[5]);
+      CHECK (payload[6] == 0x80 && payload[7] == 0xC0 && payload[8] == 10);
+      frame->pts = timestamp (payload + 9, 3);
+      frame->dts = timestamp (payload + 14, 1);
+      payload += 19;
+    }else{
+      CHECK (demux->length);
+      CHECK (!demux->psi);
+    }
+    demux_append (demux, payload, packet + PACKET_SIZE - payload);
+  }
+}
+
+//Checks the frames first..first + count of the stream written by the tests,
+//the frame i is demuxed frame i - first
+static void check_frames (
+    demux_t* demux,
+    int first,
+    int count,
+    uint8_t* config,
+    uint32_t config_length){
+  static const uint8_t aud[] = { 0, 0, 0, 1, 9, 0xF0 };
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  int64_t psi = -1;
+  int i;
+
+  CHECK (demux->length == count);
+  test_stream_init (&stream, 100, 1920, 1080, frame_length (FRAMES));
+  for (i=0; i<first + count; i++){
+    test_stream_frame (&stream, &buffer, !(i%GOP), frame_length (i));
+    if (i < first) continue;
+    ts_frame_t* frame = &demux->frames[i - first];
+    int idr = !(i%GOP);
+    int64_t time = buffer.timestamp*9/100 + 9000;
+
+    CHECK (frame->pts == time && frame->dts == time);
+    CHECK (frame->pcr == time - 9000);
+    CHECK (!frame->random_access == !idr);
+
+    //The PAT and PMT start the stream, precede every IDR frame and are
+    //repeated at least every 100 ms
+    CHECK (i > first || frame->psi);
+    CHECK (!idr || frame->psi);
+    if (frame->psi) psi = time;
+    CHECK (time - psi < 9000 + 3000);
+
+    //Access unit delimiter, SPS/PPS before the IDR frames, and the frame
+    uint8_t* data = demux->data + frame->offset;
+    uint32_t length = sizeof (aud) + (idr ? config_length : 0) + buffer.length;
+    CHECK (frame->length == length);
+    CHECK (!memcmp (data, aud, sizeof (aud)));
+    data += sizeof (aud);
+    if (idr){
+      CHECK (!memcmp (data, config, config_length));
+      data += config_length;
+    }
+    CHECK (!memcmp (data, buffer.data, buffer.length));
+  }
+  test_stream_free (&stream);
+}
+
+static void test_file (){
+  char dir[64];
+  char path[128];
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  paramsets_t paramsets;
+  demux_t demux;
+  int i;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path, sizeof (path), "%s/video.ts", dir);
+  test_stream_init (&stream, 100, 1920, 1080, frame_length (FRAMES));
+  paramsets_init (&paramsets);
+
+  sink_t* sink = sink_open (path);
+  CHECK (sink->rotate);
+  sink->paramsets = &paramsets;
+  test_stream_config (&stream, &buffer);
+  CHECK (paramsets_update (&paramsets, &buffer));
+  sink_write (sink, &buffer);
+  for (i=0; i<FRAMES; i++){
+    test_stream_frame (&stream, &buffer, !(i%GOP), frame_length (i));
+    sink_write (sink, &buffer);
+  }
+  CHECK (sink->frames == FRAMES);
+  CHECK (!sink->dropped_frames);
+  sink_close (sink);
+
+  size_t length;
+  uint8_t* data = test_read_file (path, &length);
+  demux_init (&demux);
+  demux_packets (&demux, data, length);
+  check_frames (&demux, 0, FRAMES, paramsets.data, paramsets.length);
+
+  demux_free (&demux);
+  free (data);
+  test_stream_free (&stream);
+  test_remove (dir);
+}
+
+//The second file of a rotation is a stream on its own
+static void test_rotate (){
+  char dir[64];
+  char path[2][128];
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  paramsets_t paramsets;
+  demux_t demux;
+  int i;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path[0], sizeof (path[0]), "%s/0.ts", dir);
+  snprintf (path[1], sizeof (path[1]), "%s/1.ts", dir);
+  test_stream_init (&stream, 100, 1920, 1080, frame_length (FRAMES));
+  paramsets_init (&paramsets);
+
+  sink_t* sink = sink_open (path[0]);
+  sink->paramsets = &paramsets;
+  test_stream_config (&stream, &buffer);
+  CHECK (paramsets_update (&paramsets, &buffer));
+  sink_write (sink, &buffer);
+  for (i=0; i<2*GOP; i++){
+    if (i == GOP){
+      int fd = open (path[1], O_WRONLY | O_CREAT | O_TRUNC, 0666);
+      CHECK (fd != -1);
+      CHECK (!close (sink->rotate (sink, fd)));
+    }
+    test_stream_frame (&stream, &buffer, !(i%GOP), frame_length (i));
+    sink_write (sink, &buffer);
+  }
+  sink_close (sink);
+
+  for (i=0; i<2; i++){
+    size_t length;
+    uint8_t* data = test_read_file (path[i], &length);
+    demux_init (&demux);
+    demux_packets (&demux, data, length);
+    check_frames (&demux, i*GOP, GOP, paramsets.data, paramsets.length);
+    demux_free (&demux);
+    free (data);
+  }
+
+  test_stream_free (&stream);
+  test_remove (dir);
+}
+
+//Receives the pending datagrams. Returns the number of full datagrams
+static int receive (int fd, demux_t* demux){
+  static uint8_t datagram[65536];
+  ssize_t n;
+  int full = 0;
+
+  while ((n = recv (fd, datagram, sizeof (datagram), MSG_DONTWAIT)) > 0){
+    CHECK (n <= 7*PACKET_SIZE);
+    if (n == 7*PACKET_SIZE) full++;
+    demux_packets (demux, datagram, n);
+  }
+  CHECK (errno == EAGAIN);
+  return full;
+}
+
+static void test_udp (){
+  char spec[64];
+  struct sockaddr_in addr;
+  socklen_t addr_length = sizeof (addr);
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  paramsets_t paramsets;
+  demux_t demux;
+  int i;
+
+  int fd = socket (AF_INET, SOCK_DGRAM, 0);
+  CHECK (fd != -1);
+  int size = 4*1024*1024;
+  setsockopt (fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof (size));
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  CHECK (!bind (fd, (struct sockaddr*)&addr, sizeof (addr)));
+  CHECK (!getsockname (fd, (struct sockaddr*)&addr, &addr_length));
+  snprintf (spec, sizeof (spec), "udp:127.0.0.1:%u,psi=50",
+      ntohs (addr.sin_port));
+
+  test_stream_init (&stream, 100, 1920, 1080, frame_length (FRAMES));
+  paramsets_init (&paramsets);
+  demux_init (&demux);
+
+  //A socket cannot be rotated
+  sink_t* sink = sink_open (spec);
+  CHECK (!sink->rotate);
+  sink->paramsets = &paramsets;
+  test_stream_config (&stream, &buffer);
+  CHECK (paramsets_update (&paramsets, &buffer));
+  sink_write (sink, &buffer);
+  for (i=0; i<GOP; i++){
+    test_stream_frame (&stream, &buffer, !(i%GOP), frame_length (i));
+    sink_write (sink, &buffer);
+    receive (fd, &demux);
+  }
+  CHECK (sink->frames == GOP);
+  CHECK (!sink->dropped_frames);
+  sink_close (sink);
+  receive (fd, &demux);
+  check_frames (&demux, 0, GOP, paramsets.data, paramsets.length);
+
+  demux_free (&demux);
+  test_stream_free (&stream);
+  close (fd);
+}
+
+//With low latency the full datagrams are sent before the end of the frame
+static void test_low_latency (){
+  char spec[64];
+  struct sockaddr_in addr;
+  socklen_t addr_length = sizeof (addr);
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  stream_buffer_t half;
+  paramsets_t paramsets;
+  demux_t demux;
+  int i;
+
+  int fd = socket (AF_INET, SOCK_DGRAM, 0);
+  CHECK (fd != -1);
+  memset (&addr, 0, sizeof (addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  CHECK (!bind (fd, (struct sockaddr*)&addr, sizeof (addr)));
+  CHECK (!getsockname (fd, (struct sockaddr*)&addr, &addr_length));
+  snprintf (spec, sizeof (spec), "udp:127.0.0.1:%u", ntohs (addr.sin_port));
+
+  test_stream_init (&stream, 100, 1920, 1080, frame_length (FRAMES));
+  paramsets_init (&paramsets);
+  demux_init (&demux);
+
+  sink_t* sink = sink_open (spec);
+  sink->paramsets = &paramsets;
+  sink->low_latency = 1;
+  test_stream_config (&stream, &buffer);
+  CHECK (paramsets_update (&paramsets, &buffer));
+  sink_write (sink, &buffer);
+  for (i=0; i<GOP; i++){
+    test_stream_frame (&stream, &buffer, !(i%GOP), frame_length (i));
+    half = buffer;
+    half.length = buffer.length - 100;
+    half.flags &= ~STREAM_FLAG_ENDOFFRAME;
+    sink_write (sink, &half);
+    //All the frame but the last 100 bytes, at least one full datagram
+    CHECK (receive (fd, &demux) >= 1);
+    half.data += half.length;
+    half.length = buffer.length - half.length;
+    half.flags = buffer.flags;
+    sink_write (sink, &half);
+    receive (fd, &demux);
+  }
+  CHECK (sink->frames == GOP);
+  sink_close (sink);
+  check_frames (&demux, 0, GOP, paramsets.data, paramsets.length);
+
+  demux_free (&demux);
+  test_stream_free (&stream);
+  close (fd);
+}
+
+int main (){
+  test_file ();
+  test_rotate ();
+  test_udp ();
+  test_low_latency ();
+  return 0;
+}
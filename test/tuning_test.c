@@ -0,0 +1,278 @@
+#include "test.h"
+
+#include <pthread.h>
+
+#include "tuning.h"
+
+//Settings of the firmware, the indexes of the names are the ones of tuning.c
+static void defaults (int32_t* values){
+  memset (values, 0, TUNING_VALUES*sizeof (int32_t));
+  values[TUNING_VALUE_BRIGHTNESS] = 50;
+  //exposure=auto, awb=auto, denoise=on
+  values[TUNING_VALUE_EXPOSURE] = 1;
+  values[TUNING_VALUE_AWB] = 1;
+  values[TUNING_VALUE_AWB_RED] = 1000;
+  values[TUNING_VALUE_AWB_BLUE] = 1000;
+  values[TUNING_VALUE_DENOISE] = 1;
+  values[TUNING_VALUE_ROI_WIDTH] = 100;
+  values[TUNING_VALUE_ROI_HEIGHT] = 100;
+  values[TUNING_VALUE_BITRATE] = 17000000;
+}
+
+//Parses a command, returns 0 on success
+static int parse (
+    tuning_t* tuning,
+    const char* command,
+    int32_t* values,
+    uint32_t* configs,
+    char* error){
+  char args[256];
+  snprintf (args, sizeof (args), "%s", command);
+  return tuning_parse (tuning, args, values, configs, error, 128);
+}
+
+//Applies the pending configs like the encoder loop, the config fail fails
+static void apply (tuning_t* tuning, int fail){
+  int32_t values[TUNING_VALUES];
+  uint32_t configs = tuning_begin (tuning, values);
+  int i;
+
+  for (i=0; i<TUNING_CONFIGS; i++){
+    if (!(configs & (1 << i))) continue;
+    tuning_applied (tuning, i, values,
+        i == fail ? "OMX_ErrorBadParameter" : 0, tuning_time ());
+  }
+  tuning_end (tuning);
+}
+
+static void test_parse (){
+  const char* invalid[][2] = {
+    { "", "usage: set KEY=VALUE..." },
+    { "ev", "expected KEY=VALUE: ev" },
+    { "zoom=2", "unknown setting: zoom" },
+    { "size=640x480", "size can't be changed while recording, it needs a "
+        "restart" },
+    { "ev=3 profile=high", "profile can't be changed while recording, it "
+        "needs a restart" },
+    { "framerate=25", "framerate can't be changed while recording, it needs "
+        "a restart" },
+    { "ev=25", "invalid ev" },
+    { "ev=", "invalid ev" },
+    { "ev=3x", "invalid ev" },
+    { "iso=50", "invalid iso" },
+    { "awb=purple", "invalid awb" },
+    { "awb_gains=1500", "invalid awb_gains" },
+    { "awb_gains=1500,1200,1000", "invalid awb_gains" },
+    { "bitrate=25000001", "invalid bitrate" },
+    { "roi=10,10,80", "invalid roi" },
+    { "roi=50,0,60,100", "invalid roi" },
+    { "roi=0,0,0,100", "invalid roi" }
+  };
+  int32_t firmware[TUNING_VALUES];
+  int32_t values[TUNING_VALUES];
+  tuning_t tuning;
+  uint32_t configs;
+  char error[128];
+  size_t i;
+
+  defaults (firmware);
+  tuning_init (&tuning, firmware);
+  for (i=0; i<sizeof (invalid)/sizeof (invalid[0]); i++){
+    CHECK (parse (&tuning, invalid[i][0], values, &configs, error));
+    CHECK (!strcmp (error, invalid[i][1]));
+  }
+
+  CHECK (!parse (&tuning, "ev=-6 shutter=auto iso=400 awb=off "
+      "awb_gains=1500,1200 mirror=both drc=high bitrate=8000000", values,
+      &configs, error));
+  CHECK (configs == ((1 << TUNING_EXPOSURE_VALUE) |
+      (1 << TUNING_WHITE_BALANCE) | (1 << TUNING_AWB_GAINS) |
+      (1 << TUNING_MIRROR) | (1 << TUNING_DRC) | (1 << TUNING_BITRATE)));
+  CHECK (values[TUNING_VALUE_EV] == -6 && !values[TUNING_VALUE_SHUTTER]);
+  CHECK (values[TUNING_VALUE_ISO] == 400);
+  CHECK (values[TUNING_VALUE_AWB] == TUNING_AWB_OFF);
+  CHECK (values[TUNING_VALUE_AWB_RED] == 1500);
+  CHECK (values[TUNING_VALUE_AWB_BLUE] == 1200);
+  CHECK (values[TUNING_VALUE_MIRROR] == 3 && values[TUNING_VALUE_DRC] == 3);
+  CHECK (values[TUNING_VALUE_BITRATE] == 8000000);
+  //The other values are the wanted ones
+  CHECK (values[TUNING_VALUE_BRIGHTNESS] == 50);
+  CHECK (values[TUNING_VALUE_EXPOSURE] == 1);
+  tuning_close (&tuning);
+}
+
+//Only the configs whose values differ from the firmware are sent
+static void test_request (){
+  int32_t firmware[TUNING_VALUES];
+  int32_t values[TUNING_VALUES];
+  tuning_t tuning;
+  uint32_t configs;
+  uint32_t ticket;
+  char error[128];
+  char reply[256];
+
+  defaults (firmware);
+  tuning_init (&tuning, firmware);
+
+  //The same values
+  CHECK (!parse (&tuning, "brightness=50 awb=auto", values, &configs, error));
+  CHECK (!tuning_request (&tuning, values, &ticket));
+  CHECK (!tuning_pending (&tuning) && !tuning.requests);
+  CHECK (tuning_reply (&tuning, 0, reply, sizeof (reply)) > 0);
+  CHECK (!strcmp (reply, "unchanged"));
+
+  //The gains are ignored by the firmware while the white balance is auto
+  CHECK (!parse (&tuning, "ev=6 iso=400 awb_gains=1500,1200", values,
+      &configs, error));
+  CHECK (tuning_request (&tuning, values, &ticket) ==
+      ((1 << TUNING_EXPOSURE_VALUE) | (1 << TUNING_AWB_GAINS)));
+  CHECK (ticket == 1 && tuning_pending (&tuning));
+  apply (&tuning, -1);
+  CHECK (tuning.current[TUNING_VALUE_EV] == 6);
+
+  //Turning the white balance off sends the gains again, even if they don't
+  //change, another white balance doesn't
+  CHECK (!parse (&tuning, "awb=off", values, &configs, error));
+  CHECK (tuning_request (&tuning, values, &ticket) ==
+      ((1 << TUNING_WHITE_BALANCE) | (1 << TUNING_AWB_GAINS)));
+  apply (&tuning, -1);
+  CHECK (!parse (&tuning, "awb=sunlight", values, &configs, error));
+  CHECK (tuning_request (&tuning, values, &ticket) ==
+      (1 << TUNING_WHITE_BALANCE));
+  apply (&tuning, -1);
+  CHECK (ticket == 3 && tuning.done == 3);
+  CHECK (tuning.stats[TUNING_AWB_GAINS].applied == 2);
+  CHECK (tuning.stats[TUNING_WHITE_BALANCE].applied == 2);
+  CHECK (!tuning.stats[TUNING_BITRATE].applied);
+
+  CHECK (tuning_get (&tuning, reply, sizeof (reply)) > 0);
+  CHECK (strstr (reply, "brightness=50 "));
+  CHECK (strstr (reply, " ev=6 shutter=auto iso=400 exposure=auto "));
+  CHECK (strstr (reply, " awb=sunlight awb_gains=1500,1200 mirror=none "));
+  CHECK (strstr (reply, " roi=0,0,100,100 drc=off bitrate=17000000 idr=0"));
+  tuning_close (&tuning);
+}
+
+typedef struct {
+  tuning_t* tuning;
+  //Time the encoder loop waits before applying the configs (us)
+  int64_t delay;
+  int fail;
+} loop_t;
+
+//The encoder loop, it applies the pending configs once
+static void* loop_thread (void* arg){
+  loop_t* loop = arg;
+  while (!tuning_pending (loop->tuning)) usleep (1000);
+  usleep (loop->delay);
+  apply (loop->tuning, loop->fail);
+  return 0;
+}
+
+//The control thread waits for the ticket of its request
+static void test_wait (){
+  int32_t firmware[TUNING_VALUES];
+  int32_t values[TUNING_VALUES];
+  tuning_t tuning;
+  loop_t loop = { &tuning, 20000, -1 };
+  pthread_t thread;
+  uint32_t configs;
+  uint32_t ticket;
+  char error[128];
+  char reply[256];
+
+  defaults (firmware);
+  tuning_init (&tuning, firmware);
+  CHECK (!pthread_create (&thread, 0, loop_thread, &loop));
+  CHECK (!parse (&tuning, "bitrate=8000000", values, &configs, error));
+  configs = tuning_request (&tuning, values, &ticket);
+  CHECK (configs == (1 << TUNING_BITRATE));
+  CHECK (tuning_reply (&tuning, configs, reply, sizeof (reply)) > 0);
+  CHECK (!strcmp (reply, "bitrate pending"));
+  CHECK (tuning_wait (&tuning, ticket, TUNING_WAIT));
+  CHECK (!pthread_join (thread, 0));
+  CHECK (tuning.current[TUNING_VALUE_BITRATE] == 8000000);
+  CHECK (!tuning_failed (&tuning, configs));
+  //The latency goes from the request to the end of OMX_SetConfig()
+  CHECK (tuning.stats[TUNING_BITRATE].latency_last >= 20000);
+  CHECK (tuning_reply (&tuning, configs, reply, sizeof (reply)) > 0);
+  CHECK (!strncmp (reply, "bitrate ", 8) && strstr (reply, " ms"));
+
+  //Nobody applies the next request: the wait times out
+  CHECK (!parse (&tuning, "idr=30", values, &configs, error));
+  configs = tuning_request (&tuning, values, &ticket);
+  int64_t start = test_time ();
+  CHECK (!tuning_wait (&tuning, ticket, 50));
+  CHECK (test_time () - start >= 50000);
+  CHECK (tuning_reply (&tuning, configs, reply, sizeof (reply)) > 0);
+  CHECK (!strcmp (reply, "idr_period pending"));
+
+  //A late encoder loop still applies it, the older ticket is done too
+  apply (&tuning, -1);
+  CHECK (tuning_wait (&tuning, ticket, 0));
+  CHECK (tuning_wait (&tuning, ticket - 1, 0));
+  CHECK (tuning.current[TUNING_VALUE_IDR_PERIOD] == 30);
+  tuning_close (&tuning);
+}
+
+//A config that fails keeps the values of the firmware
+static void test_rollback (){
+  int32_t firmware[TUNING_VALUES];
+  int32_t values[TUNING_VALUES];
+  int32_t taken[TUNING_VALUES];
+  tuning_t tuning;
+  uint32_t configs;
+  uint32_t ticket;
+  char error[128];
+  char reply[256];
+
+  defaults (firmware);
+  tuning_init (&tuning, firmware);
+  CHECK (!parse (&tuning, "mirror=horizontal drc=low", values, &configs,
+      error));
+  configs = tuning_request (&tuning, values, &ticket);
+  apply (&tuning, TUNING_DRC);
+  CHECK (tuning_wait (&tuning, ticket, 0));
+  CHECK (tuning_failed (&tuning, configs));
+  CHECK (!tuning_failed (&tuning, 1 << TUNING_MIRROR));
+  CHECK (tuning.current[TUNING_VALUE_MIRROR] == 1);
+  CHECK (!tuning.current[TUNING_VALUE_DRC] && !tuning.wanted[TUNING_VALUE_DRC]);
+  CHECK (tuning.stats[TUNING_DRC].errors == 1);
+  CHECK (tuning_reply (&tuning, configs, reply, sizeof (reply)) > 0);
+  CHECK (strstr (reply, "drc failed (OMX_ErrorBadParameter)"));
+  CHECK (!strncmp (reply, "mirror ", 7));
+
+  //The next command starts from the values of the firmware, drc=off is
+  //already there
+  CHECK (!parse (&tuning, "drc=off", values, &configs, error));
+  CHECK (!tuning_request (&tuning, values, &ticket));
+
+  //A request that arrives while the failed config is applied is kept
+  CHECK (!parse (&tuning, "drc=medium", values, &configs, error));
+  tuning_request (&tuning, values, &ticket);
+  tuning_begin (&tuning, taken);
+  CHECK (!parse (&tuning, "drc=high", values, &configs, error));
+  tuning_request (&tuning, values, &ticket);
+  tuning_applied (&tuning, TUNING_DRC, taken, "OMX_ErrorBadParameter",
+      tuning_time ());
+  tuning_end (&tuning);
+  CHECK (tuning.wanted[TUNING_VALUE_DRC] == 3 && tuning_pending (&tuning));
+  CHECK (!tuning_wait (&tuning, ticket, 0));
+  apply (&tuning, -1);
+  CHECK (tuning_wait (&tuning, ticket, 0));
+  CHECK (tuning.current[TUNING_VALUE_DRC] == 3);
+  CHECK (!tuning_failed (&tuning, 1 << TUNING_DRC));
+
+  CHECK (tuning_dump (&tuning, reply, sizeof (reply)) > 0);
+  CHECK (strstr (reply, "mirror applied 1 errors 0 "));
+  CHECK (strstr (reply, "drc applied 1 errors 2 "));
+  tuning_close (&tuning);
+}
+
+int main (){
+  test_parse ();
+  test_request ();
+  test_wait ();
+  test_rollback ();
+  return 0;
+}
@@ -0,0 +1,151 @@
+#include "test.h"
+
+#include "validate.h"
+
+#define FRAME_SIZE 3000
+
+static uint32_t random_state = 1;
+
+static uint32_t random_next (){
+  random_state = random_state*1103515245 + 12345;
+  return random_state >> 8;
+}
+
+//Writes a buffer in random pieces, like the encoder does with the big frames.
+//Only the last piece ends the frame
+static void write_pieces (validator_t* validator, stream_buffer_t* buffer){
+  stream_buffer_t piece = *buffer;
+  uint32_t left = buffer->length;
+
+  while (left){
+    piece.length = 1 + random_next ()%(left < 600 ? left : 600);
+    left -= piece.length;
+    piece.flags = left ? buffer->flags & ~STREAM_FLAG_ENDOFFRAME :
+        buffer->flags;
+    validator_write (validator, &piece);
+    piece.data += piece.length;
+  }
+}
+
+static void start (
+    validator_t* validator,
+    test_stream_t* stream,
+    uint8_t profile_idc,
+    uint32_t framerate,
+    uint32_t idr_period){
+  stream_buffer_t buffer;
+  validator_init (validator, profile_idc, framerate, idr_period);
+  test_stream_init (stream, 100, 1920, 1080, FRAME_SIZE);
+  test_stream_config (stream, &buffer);
+  validator_write (validator, &buffer);
+}
+
+static void frame (validator_t* validator, test_stream_t* stream, int idr){
+  stream_buffer_t buffer;
+  test_stream_frame (stream, &buffer, idr, FRAME_SIZE);
+  write_pieces (validator, &buffer);
+}
+
+//A valid stream, split anywhere, has no errors
+static void test_valid (){
+  validator_t validator;
+  test_stream_t stream;
+  int i;
+
+  start (&validator, &stream, 100, 30, 30);
+  for (i=0; i<300; i++) frame (&validator, &stream, !(i%30));
+  CHECK (!validator.errors);
+  CHECK (validator.frames == 300);
+  //SPS, PPS and one slice per frame
+  CHECK (validator.nals_length == 302);
+  validator_close (&validator);
+  test_stream_free (&stream);
+}
+
+static void test_errors (){
+  validator_t validator;
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  int i;
+
+  //Profile and level: 1080p needs level 4.2 at 60 fps
+  start (&validator, &stream, 66, 30, 0);
+  CHECK (validator.errors == 1);
+  test_stream_free (&stream);
+  start (&validator, &stream, 100, 60, 0);
+  CHECK (validator.errors == 1);
+  test_stream_free (&stream);
+
+  //The stream starts with a P frame, reported once
+  start (&validator, &stream, 100, 30, 0);
+  stream.frame_num = 1;
+  for (i=0; i<3; i++) frame (&validator, &stream, 0);
+  CHECK (validator.errors == 1);
+  test_stream_free (&stream);
+
+  //A frame is lost
+  start (&validator, &stream, 100, 30, 0);
+  frame (&validator, &stream, 1);
+  frame (&validator, &stream, 0);
+  test_stream_frame (&stream, &buffer, 0, FRAME_SIZE);
+  frame (&validator, &stream, 0);
+  frame (&validator, &stream, 0);
+  CHECK (validator.errors == 1);
+  test_stream_free (&stream);
+
+  //No IDR frame after the IDR period
+  start (&validator, &stream, 100, 30, 10);
+  for (i=0; i<11; i++) frame (&validator, &stream, !i);
+  CHECK (!validator.errors);
+  frame (&validator, &stream, 0);
+  CHECK (validator.errors == 1);
+  frame (&validator, &stream, 1);
+  CHECK (validator.errors == 1);
+  test_stream_free (&stream);
+
+  //Sync flag of a P frame
+  start (&validator, &stream, 100, 30, 0);
+  frame (&validator, &stream, 1);
+  test_stream_frame (&stream, &buffer, 0, FRAME_SIZE);
+  buffer.flags |= STREAM_FLAG_SYNCFRAME;
+  write_pieces (&validator, &buffer);
+  CHECK (validator.errors == 1);
+  test_stream_free (&stream);
+
+  //Unknown PPS
+  start (&validator, &stream, 100, 30, 0);
+  frame (&validator, &stream, 1);
+  buffer.data = stream.data;
+  buffer.length = test_slice (stream.data, 0, 1, 3, FRAME_SIZE);
+  buffer.flags = STREAM_FLAG_ENDOFFRAME;
+  write_pieces (&validator, &buffer);
+  CHECK (validator.errors == 1);
+  test_stream_free (&stream);
+
+  //Truncated NAL unit, it has no stop bit
+  start (&validator, &stream, 100, 30, 0);
+  frame (&validator, &stream, 1);
+  test_stream_frame (&stream, &buffer, 0, FRAME_SIZE);
+  buffer.data[buffer.length - 1] = 0;
+  write_pieces (&validator, &buffer);
+  CHECK (validator.errors == 1);
+  test_stream_free (&stream);
+
+  //Slice header cut short
+  start (&validator, &stream, 100, 30, 0);
+  frame (&validator, &stream, 1);
+  buffer.data = stream.data;
+  //first_mb_in_slice, slice_type and pps_id, frame_num is missing
+  buffer.length = 6;
+  memcpy (buffer.data, "\0\0\0\1\x41\xE0", 6);
+  buffer.flags = STREAM_FLAG_ENDOFFRAME;
+  validator_write (&validator, &buffer);
+  CHECK (validator.errors == 1);
+  test_stream_free (&stream);
+}
+
+int main (){
+  test_valid ();
+  test_errors ();
+  return 0;
+}
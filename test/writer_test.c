@@ -0,0 +1,447 @@
+#include "test.h"
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#include "sink.h"
+#include "writer.h"
+
+#define CHUNKS 2000
+#define JOBS 20
+#define CAMERAS 3
+#define FRAMES 96
+#define FRAME_SIZE 20000
+
+typedef struct {
+  int fd;
+  //Size of the file when the job ran
+  off_t size;
+  int* order;
+  int* order_length;
+  int index;
+} job_t;
+
+static void size_job (void* arg){
+  job_t* job = (job_t*)arg;
+  struct stat st;
+  CHECK (!fstat (job->fd, &st));
+  job->size = st.st_size;
+  job->order[(*job->order_length)++] = job->index;
+}
+
+static int file_open (const char* dir, const char* name){
+  char path[128];
+  snprintf (path, sizeof (path), "%s/%s", dir, name);
+  int fd = open (path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+  CHECK (fd != -1);
+  return fd;
+}
+
+static void check_file (const char* dir, const char* name, uint8_t* data,
+    size_t length){
+  char path[128];
+  size_t size;
+  snprintf (path, sizeof (path), "%s/%s", dir, name);
+  uint8_t* content = test_read_file (path, &size);
+  CHECK (size == length && !memcmp (content, data, length));
+  free (content);
+}
+
+//Several threads write a small buffer in quanta: the data reaches the files in
+//order, the rotation applies at its position and the jobs run in order after
+//the data queued before them
+static void test_order (){
+  writer_t writer;
+  job_t jobs[JOBS];
+  int order[JOBS];
+  int order_length = 0;
+  uint8_t chunk[700];
+  char dir[64];
+  int i;
+  int j;
+
+  test_tmpdir (dir, sizeof (dir));
+  uint8_t* data = malloc (CHUNKS*sizeof (chunk));
+  CHECK (data);
+  int first = file_open (dir, "a");
+  int second = file_open (dir, "b");
+  size_t length = 0;
+  size_t rotated = 0;
+  int jobs_length = 0;
+
+  writer_init (&writer, 3, 1000);
+  writer_stream_t* stream = writer_stream_open (&writer, "order", first, 4096);
+  for (i=0; i<CHUNKS; i++){
+    uint32_t n = 1 + i%sizeof (chunk);
+    for (j=0; j<(int)n; j++){
+      chunk[j] = i*7 + j;
+    }
+    //The buffer is smaller than the data, the writes wait for room
+    while (!writer_write (stream, chunk, n)) usleep (100);
+    memcpy (data + length, chunk, n);
+    length += n;
+    if (i == CHUNKS/2){
+      CHECK (writer_rotate (stream, second) == first);
+      rotated = length;
+    }
+    if (!(i%(CHUNKS/JOBS))){
+      job_t* job = &jobs[jobs_length];
+      job->fd = i <= CHUNKS/2 ? first : second;
+      job->size = -1;
+      job->order = order;
+      job->order_length = &order_length;
+      job->index = jobs_length++;
+      writer_job (stream, size_job, job);
+    }
+  }
+  writer_flush (stream);
+  CHECK (stream->refused > 0 && stream->peak <= 4096);
+  CHECK (stream->written == length && stream->jobs == JOBS);
+  CHECK (writer_stream_close (stream) == second);
+  writer_close (&writer);
+
+  CHECK (jobs_length == JOBS && order_length == JOBS);
+  for (i=0; i<JOBS; i++){
+    int chunks = i*(CHUNKS/JOBS);
+    size_t queued = 0;
+    for (j=0; j<=chunks; j++){
+      queued += 1 + j%sizeof (chunk);
+    }
+    CHECK (order[i] == i);
+    CHECK ((size_t)jobs[i].size == (chunks <= CHUNKS/2 ? queued :
+        queued - rotated));
+  }
+  check_file (dir, "a", data, rotated);
+  check_file (dir, "b", data + rotated, length - rotated);
+
+  close (first);
+  close (second);
+  free (data);
+  test_remove (dir);
+}
+
+//A stream that is full refuses the data, all of it or nothing, while the
+//other streams keep the thread busy
+static void test_refused (){
+  writer_t writer;
+  test_blocker_t blocker;
+  uint8_t data[10000];
+  char dir[64];
+  size_t i;
+
+  test_tmpdir (dir, sizeof (dir));
+  for (i=0; i<sizeof (data); i++){
+    data[i] = i*13;
+  }
+  int fd = file_open (dir, "full");
+
+  writer_init (&writer, 1, 0);
+  writer_stream_t* jobs = writer_stream_open (&writer, "jobs", -1, 0);
+  writer_stream_t* stream = writer_stream_open (&writer, "full", fd,
+      sizeof (data));
+  test_block (jobs, &blocker);
+  CHECK (!writer_write (stream, data, sizeof (data) + 1));
+  CHECK (writer_write (stream, data, 6000));
+  CHECK (!writer_write (stream, data + 6000, 5000));
+  CHECK (writer_write (stream, data + 6000, 4000));
+  CHECK (!writer_write (stream, data, 1));
+  CHECK (stream->refused == 3 && stream->peak == sizeof (data));
+  CHECK (!stream->written);
+  usleep (50000);
+  test_unblock (&blocker);
+
+  writer_flush (stream);
+  //The data waited for the thread while it was blocked
+  CHECK (stream->written == sizeof (data) && stream->wait_max >= 50000);
+  CHECK (writer_stream_close (stream) == fd);
+  CHECK (writer_stream_close (jobs) == -1);
+  writer_close (&writer);
+  check_file (dir, "full", data, sizeof (data));
+
+  close (fd);
+  test_remove (dir);
+}
+
+//A stream with a long backlog is served a quantum at a time: the short one
+//behind it doesn't wait for the whole backlog
+static void test_fair (){
+  writer_t writer;
+  test_blocker_t blocker;
+  job_t job;
+  int order[1];
+  int order_length = 0;
+  char report[1024];
+  char dir[64];
+  size_t quantum = 64*1024;
+  size_t size = 2*1024*1024;
+  double fairness;
+  int i;
+
+  test_tmpdir (dir, sizeof (dir));
+  uint8_t* data = calloc (1, size);
+  CHECK (data);
+  int long_fd = file_open (dir, "long");
+  int short_fd = file_open (dir, "short");
+
+  writer_init (&writer, 1, quantum);
+  writer_stream_t* jobs = writer_stream_open (&writer, "jobs", -1, 0);
+  writer_stream_t* backlog = writer_stream_open (&writer, "long", long_fd,
+      size);
+  writer_stream_t* stream = writer_stream_open (&writer, "short", short_fd,
+      quantum);
+  test_block (jobs, &blocker);
+  for (i=0; i<32; i++){
+    CHECK (writer_write (backlog, data + i*size/32, size/32));
+  }
+  CHECK (writer_write (stream, data, quantum));
+  job.fd = long_fd;
+  job.order = order;
+  job.order_length = &order_length;
+  job.index = 0;
+  writer_job (stream, size_job, &job);
+  test_unblock (&blocker);
+
+  writer_flush (stream);
+  writer_flush (backlog);
+  CHECK (order_length == 1);
+  CHECK (job.size > 0 && (size_t)job.size <= 2*quantum);
+  writer_dump (&writer, report, sizeof (report));
+  CHECK (strstr (report, "1 threads, 3 streams, fairness "));
+  CHECK (sscanf (strstr (report, "fairness "), "fairness %lf", &fairness) ==
+      1);
+  CHECK (fairness > 0 && fairness <= 1);
+  CHECK (strstr (report, "; long: 2097152 bytes, "));
+  CHECK (strstr (report, "; short: 65536 bytes, "));
+
+  writer_stream_close (stream);
+  writer_stream_close (backlog);
+  writer_stream_close (jobs);
+  writer_close (&writer);
+  close (long_fd);
+  close (short_fd);
+  free (data);
+  test_remove (dir);
+}
+
+//Counts the samples of the fragments of an MP4 file
+static int mp4_samples (const char* path, uint32_t* samples, int max){
+  size_t length;
+  uint32_t size;
+  uint8_t* moof;
+  int n;
+
+  uint8_t* data = test_read_file (path, &length);
+  for (n=0; (moof = test_box (data, length, "moof", n, &size)); n++){
+    uint8_t* trun = test_box (moof, size, "traf/trun", 0, &size);
+    CHECK (n < max && trun);
+    samples[n] = test_be32 (trun + 4);
+  }
+  free (data);
+  return n;
+}
+
+//A file that is behind drops frames like a slow reader: the MP4 fragment that
+//doesn't fit is lost with its frames, an IDR frame is requested and the file
+//continues there
+static void test_behind (){
+  writer_t writer;
+  test_blocker_t blocker;
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  paramsets_t paramsets;
+  idr_t idr;
+  uint32_t samples[4];
+  char dir[64];
+  char path[128];
+  int i;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (path, sizeof (path), "%s/behind.mp4", dir);
+  test_stream_init (&stream, 100, 1920, 1080, 1000000);
+  paramsets_init (&paramsets);
+  idr_init (&idr);
+
+  writer_init (&writer, 1, 0);
+  sink_set_writer (&writer);
+  writer_stream_t* jobs = writer_stream_open (&writer, "jobs", -1, 0);
+  sink_t* sink = sink_open (path);
+  sink->paramsets = &paramsets;
+  sink->idr = &idr;
+  test_stream_config (&stream, &buffer);
+  CHECK (paramsets_update (&paramsets, &buffer));
+  sink_write (sink, &buffer);
+
+  //The fragments of 8 frames of 1 MB are written at the 9th frame, the third
+  //one doesn't fit in the 16 MB of the stream
+  test_block (jobs, &blocker);
+  for (i=0; i<25; i++){
+    test_stream_frame (&stream, &buffer, !i, 1000000);
+    sink_write (sink, &buffer);
+    CHECK (idr.requests == (i == 24));
+  }
+  CHECK (sink->frames == 16 && sink->dropped_frames == 9);
+  CHECK (sink->stream->refused == 1);
+  test_unblock (&blocker);
+  writer_flush (sink->stream);
+
+  //The P frame waits for the IDR frame
+  test_stream_frame (&stream, &buffer, 0, 1000000);
+  sink_write (sink, &buffer);
+  for (i=0; i<2; i++){
+    test_stream_frame (&stream, &buffer, !i, 1000000);
+    sink_write (sink, &buffer);
+  }
+  CHECK (sink->frames == 18 && sink->dropped_frames == 10);
+  sink_close (sink);
+  sink_set_writer (0);
+  writer_stream_close (jobs);
+  writer_close (&writer);
+
+  CHECK (mp4_samples (path, samples, 4) == 3);
+  CHECK (samples[0] == 8 && samples[1] == 8 && samples[2] == 2);
+
+  test_stream_free (&stream);
+  test_remove (dir);
+}
+
+//Stand-in for a camera: an encoder loop that writes a test stream to its
+//output, with an IDR frame when the output asks for one
+typedef struct {
+  pthread_t thread;
+  char spec[192];
+  sink_t* sink;
+  //Annex-B stream that was written
+  uint8_t* data;
+  size_t length;
+  int64_t time;
+} camera_t;
+
+static void* camera_loop (void* arg){
+  camera_t* camera = (camera_t*)arg;
+  test_stream_t stream;
+  stream_buffer_t buffer;
+  paramsets_t paramsets;
+  idr_t idr;
+  uint32_t requests = 0;
+  int i;
+
+  test_stream_init (&stream, 100, 1920, 1080, FRAME_SIZE);
+  paramsets_init (&paramsets);
+  idr_init (&idr);
+  camera->data = malloc ((FRAMES + 1)*FRAME_SIZE);
+  CHECK (camera->data);
+  camera->length = 0;
+
+  camera->sink->paramsets = &paramsets;
+  camera->sink->idr = &idr;
+  test_stream_config (&stream, &buffer);
+  CHECK (paramsets_update (&paramsets, &buffer));
+  sink_write (camera->sink, &buffer);
+  memcpy (camera->data, buffer.data, buffer.length);
+  camera->length = buffer.length;
+  int64_t start = test_time ();
+  for (i=0; i<FRAMES; i++){
+    int sync = !i || idr.requests != requests;
+    requests = idr.requests;
+    test_stream_frame (&stream, &buffer, sync, FRAME_SIZE - i);
+    sink_write (camera->sink, &buffer);
+    memcpy (camera->data + camera->length, buffer.data, buffer.length);
+    camera->length += buffer.length;
+    usleep (1000);
+  }
+  camera->time = test_time () - start;
+  CHECK (camera->sink->frames == FRAMES && !camera->sink->dropped_frames);
+  sink_close (camera->sink);
+
+  test_stream_free (&stream);
+  return 0;
+}
+
+//Cameras with a file, an MP4 file and MP4 segments share the writer threads.
+//The files have the whole streams and the segments are finished after their
+//last byte has been written
+static void test_cameras (){
+  camera_t cameras[CAMERAS];
+  writer_t writer;
+  char report[2048];
+  char dir[64];
+  char path[128];
+  size_t length;
+  uint32_t size;
+  int i;
+
+  test_tmpdir (dir, sizeof (dir));
+  snprintf (cameras[0].spec, sizeof (cameras[0].spec), "%s/0.h264", dir);
+  snprintf (cameras[1].spec, sizeof (cameras[1].spec), "%s/1.mp4", dir);
+  snprintf (cameras[2].spec, sizeof (cameras[2].spec), "segment:%s/2-%%u.mp4,"
+      "duration=1,playlist=%s/2.m3u8", dir, dir);
+
+  writer_init (&writer, 2, 0);
+  sink_set_writer (&writer);
+  for (i=0; i<CAMERAS; i++){
+    cameras[i].sink = sink_open (cameras[i].spec);
+  }
+  CHECK (cameras[0].sink->stream && cameras[1].sink->stream);
+  for (i=0; i<CAMERAS; i++){
+    CHECK (!pthread_create (&cameras[i].thread, 0, camera_loop, &cameras[i]));
+  }
+  //The statistics can be read while the cameras record
+  usleep (20000);
+  CHECK (writer_dump (&writer, report, sizeof (report)) > 0);
+  CHECK (strstr (report, "2 threads, "));
+  for (i=0; i<CAMERAS; i++){
+    CHECK (!pthread_join (cameras[i].thread, 0));
+    printf ("camera %d: %.2f MB/s\n", i,
+        cameras[i].length/(double)cameras[i].time);
+  }
+  sink_set_writer (0);
+  writer_dump (&writer, report, sizeof (report));
+  CHECK (strstr (report, "2 threads, 0 streams"));
+  writer_close (&writer);
+
+  check_file (dir, "0.h264", cameras[0].data, cameras[0].length);
+
+  //The MP4 file has every frame
+  uint32_t samples[4];
+  CHECK (mp4_samples (cameras[1].spec, samples, 4) == 1);
+  CHECK (samples[0] == FRAMES);
+
+  //Every segment is complete when it's listed: the byte ranges of the
+  //playlist are the sizes of the files
+  snprintf (path, sizeof (path), "%s/2.m3u8", dir);
+  char* playlist = (char*)test_read_file (path, &length);
+  CHECK (strstr (playlist, "#EXT-X-ENDLIST\n"));
+  for (i=0; ; i++){
+    char entry[128];
+    uint32_t header;
+    snprintf (path, sizeof (path), "%s/2-%u.mp4", dir, i);
+    if (access (path, F_OK)) break;
+    uint8_t* data = test_read_file (path, &length);
+    CHECK (test_box (data, length, "ftyp", 0, &size) == data + 8);
+    header = size + 8;
+    CHECK (test_box (data, length, "moov", 0, &size) == data + header + 8);
+    header += size + 8;
+    snprintf (entry, sizeof (entry), "#EXT-X-BYTERANGE:%u@%u\n",
+        (uint32_t)length - header, header);
+    CHECK (strstr (playlist, entry));
+    free (data);
+  }
+  //3.2 s in segments of 1.067 s, the IDR frame comes after the request
+  CHECK (i == 3);
+  free (playlist);
+
+  for (i=0; i<CAMERAS; i++){
+    free (cameras[i].data);
+  }
+  test_remove (dir);
+}
+
+int main (){
+  test_order ();
+  test_refused ();
+  test_fair ();
+  test_behind ();
+  test_cameras ();
+  return 0;
+}
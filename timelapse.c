@@ -0,0 +1,55 @@
+#include <stdio.h>
+
+#include "timelapse.h"
+
+void timelapse_init (timelapse_t* timelapse, uint32_t playback){
+  timelapse->playback = playback;
+  timelapse->source = -1;
+  timelapse->frames = 0;
+  timelapse->capturing = 0;
+}
+
+uint32_t timelapse_framerate (long interval){
+  if (timelapse_toggled (interval)) interval = TIMELAPSE_INTERVAL_MAX;
+  return ((uint64_t)1000 << 16)/interval;
+}
+
+int timelapse_toggled (long interval){
+  return interval > TIMELAPSE_INTERVAL_MAX;
+}
+
+int timelapse_timestamp (timelapse_t* timelapse, stream_buffer_t* buffer){
+  int media = buffer->length && !(buffer->flags & STREAM_FLAG_CODECCONFIG);
+  uint32_t frame = timelapse->frames;
+
+  if (media && buffer->timestamp != timelapse->source){
+    if (timelapse->source != -1) frame = ++timelapse->frames;
+    timelapse->source = buffer->timestamp;
+  }else if (!media && timelapse->source != -1){
+    //The SPS/PPS take the timestamp of the next frame
+    frame++;
+  }
+  buffer->timestamp = (int64_t)frame*1000000/timelapse->playback;
+  return media && (buffer->flags & STREAM_FLAG_ENDOFFRAME);
+}
+
+void timelapse_meter_start (timelapse_meter_t* meter){
+  meter->wakeups = 0;
+  getrusage (RUSAGE_SELF, &meter->start);
+}
+
+int timelapse_meter_dump (timelapse_meter_t* meter, uint32_t frames, char* str,
+    size_t size){
+  struct rusage usage;
+  getrusage (RUSAGE_SELF, &usage);
+  long switches = usage.ru_nvcsw - meter->start.ru_nvcsw;
+  double cpu = (usage.ru_utime.tv_sec - meter->start.ru_utime.tv_sec +
+      usage.ru_stime.tv_sec - meter->start.ru_stime.tv_sec)*1000.0 +
+      (usage.ru_utime.tv_usec - meter->start.ru_utime.tv_usec +
+      usage.ru_stime.tv_usec - meter->start.ru_stime.tv_usec)/1000.0;
+
+  if (!frames) return snprintf (str, size, "no frames");
+  return snprintf (str, size, "frames %u, per frame: encoder loop wakeups "
+      "%.2f, context switches %.2f, CPU time %.2f ms", frames,
+      (double)meter->wakeups/frames, (double)switches/frames, cpu/frames);
+}
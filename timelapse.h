@@ -0,0 +1,62 @@
+#ifndef TIMELAPSE_H
+#define TIMELAPSE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/resource.h>
+
+#include "stream.h"
+
+/*
+Timelapse (-T ms), one frame every interval. Up to TIMELAPSE_INTERVAL_MAX ms
+the camera frame rate is lowered to one frame per interval, so the sensor, the
+encoder and the encoder loop only run once per frame. Longer intervals are
+below the slowest frame rate of the camera: it runs at that frame rate and the
+capture port is enabled at every interval and disabled again once a frame has
+been received. The sensor stays loaded and the preview keeps the exposure and
+the white balance up to date.
+
+The timestamps of the frames are rewritten to the playback frame rate, frame N
+is played at N/playback seconds.
+
+The wakeups of the encoder loop and the voluntary context switches and CPU time
+of the whole process (the VideoCore client threads included) are measured from
+the start of the recording and printed per frame at the end.
+*/
+
+//Longest interval that the camera frame rate can follow (ms), 1 fps
+#define TIMELAPSE_INTERVAL_MAX 1000
+//Longest sleep of the encoder loop between two captures (ms), it bounds the
+//time to notice the end of the recording or SIGINT/SIGTERM
+#define TIMELAPSE_SLEEP_MAX 5000
+
+typedef struct {
+  //Playback frame rate
+  uint32_t playback;
+  //Timestamp of the current frame from the encoder, -1 if none
+  int64_t source;
+  //Frames of the output
+  uint32_t frames;
+  //The capture port is enabled
+  int capturing;
+} timelapse_t;
+
+typedef struct {
+  uint32_t wakeups;
+  struct rusage start;
+} timelapse_meter_t;
+
+void timelapse_init (timelapse_t* timelapse, uint32_t playback);
+//Frame rate of the camera (Q16) for an interval (ms)
+uint32_t timelapse_framerate (long interval);
+//Returns 1 if the capture port is enabled for every frame
+int timelapse_toggled (long interval);
+//Rewrites the timestamp of a buffer, returns 1 at the end of a frame
+int timelapse_timestamp (timelapse_t* timelapse, stream_buffer_t* buffer);
+
+void timelapse_meter_start (timelapse_meter_t* meter);
+//Prints the wakeups, context switches and CPU time per frame in a string
+int timelapse_meter_dump (timelapse_meter_t* meter, uint32_t frames, char* str,
+    size_t size);
+
+#endif
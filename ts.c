@@ -0,0 +1,489 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "ts.h"
+
+#define TS_PACKET_SIZE 188
+#define TS_PAYLOAD_SIZE 184
+//Packets of the pool, a frame that needs more packets is written in several
+//batches
+#define TS_POOL_SIZE 2048
+//Packets per UDP datagram (1316 bytes)
+#define TS_DATAGRAM_PACKETS 7
+//Default interval of the PAT and PMT (ms)
+#define TS_PSI_INTERVAL 100
+//The PCR is this far behind the DTS (90 kHz units, 100 ms), it's the time
+//that the decoder has to receive a frame
+#define TS_PCR_DELAY 9000
+//Socket send buffer, it must hold the burst of an IDR frame
+#define TS_SNDBUF (1024*1024)
+
+#define TS_PID_PAT 0x0000
+#define TS_PID_PMT 0x1000
+#define TS_PID_VIDEO 0x0100
+#define TS_STREAM_TYPE_H264 0x1B
+#define TS_STREAM_ID_VIDEO 0xE0
+
+typedef struct {
+  sink_t sink;
+  int fd;
+  int udp;
+  //Interval of the PAT and PMT (90 kHz units)
+  int64_t psi_interval;
+  int64_t psi_time;
+  int psi_sent;
+  //PAT and PMT packets, only the continuity counter changes
+  uint8_t pat[TS_PACKET_SIZE];
+  uint8_t pmt[TS_PACKET_SIZE];
+  uint8_t pat_counter;
+  uint8_t pmt_counter;
+  uint8_t video_counter;
+  //Packet pool
+  uint8_t* packets;
+  int packets_length;
+  //Free bytes of the last packet, 0 if it's full
+  uint32_t packet_room;
+  struct mmsghdr* messages;
+  struct iovec* iov;
+  //Inside a PES packet
+  int pes;
+  //Waiting for the next IDR frame after a drop
+  int resync;
+  int frame_dropped;
+  //Statistics of the packetization
+  uint64_t packets_total;
+  struct timespec time;
+} ts_sink_t;
+
+static uint32_t crc_table[256];
+
+//CRC-32/MPEG-2 of the PSI sections
+static void crc_init (){
+  uint32_t crc;
+  int i;
+  int j;
+  for (i=0; i<256; i++){
+    crc = (uint32_t)i << 24;
+    for (j=0; j<8; j++){
+      crc = crc & 0x80000000 ? (crc << 1) ^ 0x04C11DB7 : crc << 1;
+    }
+    crc_table[i] = crc;
+  }
+}
+
+static uint32_t crc32_mpeg (uint8_t* data, uint32_t length){
+  uint32_t crc = 0xFFFFFFFF;
+  while (length--){
+    crc = (crc << 8) ^ crc_table[(crc >> 24) ^ *data++];
+  }
+  return crc;
+}
+
+//Builds a packet with a PSI section. The section starts with the table id
+static void ts_psi (uint8_t* packet, uint16_t pid, uint8_t* section,
+    uint32_t length){
+  memset (packet, 0xFF, TS_PACKET_SIZE);
+  packet[0] = 0x47;
+  packet[1] = 0x40 | (pid >> 8);
+  packet[2] = pid;
+  packet[3] = 0x10;
+  //Pointer field
+  packet[4] = 0;
+  memcpy (packet + 5, section, length);
+  uint32_t crc = crc32_mpeg (section, length);
+  uint8_t* p = packet + 5 + length;
+  p[0] = crc >> 24;
+  p[1] = crc >> 16;
+  p[2] = crc >> 8;
+  p[3] = crc;
+}
+
+static void ts_psi_init (ts_sink_t* sink){
+  uint8_t pat[] = {
+    //Table id, section length, transport stream id, version, section number
+    0x00, 0xB0, 13, 0x00, 0x01, 0xC1, 0x00, 0x00,
+    //Program 1
+    0x00, 0x01, 0xE0 | (TS_PID_PMT >> 8), TS_PID_PMT & 0xFF
+  };
+  uint8_t pmt[] = {
+    //Table id, section length, program number, version, section number
+    0x02, 0xB0, 18, 0x00, 0x01, 0xC1, 0x00, 0x00,
+    //PCR PID, program info length
+    0xE0 | (TS_PID_VIDEO >> 8), TS_PID_VIDEO & 0xFF, 0xF0, 0x00,
+    //Video stream
+    TS_STREAM_TYPE_H264, 0xE0 | (TS_PID_VIDEO >> 8), TS_PID_VIDEO & 0xFF,
+    0xF0, 0x00
+  };
+  crc_init ();
+  ts_psi (sink->pat, TS_PID_PAT, pat, sizeof (pat));
+  ts_psi (sink->pmt, TS_PID_PMT, pmt, sizeof (pmt));
+}
+
+//Writes or sends the packets of the pool. The UDP datagrams are always full,
+//unless all is set, so the remaining packets are kept for the next batch.
+//Returns 0 if some packets have been dropped
+static int ts_flush (ts_sink_t* sink, int all){
+  int length = sink->packets_length;
+  int sent = 0;
+  ssize_t n;
+
+  if (!sink->udp){
+    uint8_t* data = sink->packets;
+    size_t left = length*TS_PACKET_SIZE;
+    sink->packets_length = 0;
+    //The writer threads drop the packets when they're behind, like a socket
+    if (sink->sink.stream) return writer_write (sink->sink.stream, data, left);
+    while (left){
+      if ((n = write (sink->fd, data, left)) == -1){
+        if (errno == EINTR) continue;
+        fprintf (stderr, "error: write\n");
+        exit (1);
+      }
+      data += n;
+      left -= n;
+    }
+    return 1;
+  }
+
+  int datagrams = length/TS_DATAGRAM_PACKETS;
+  int rest = length%TS_DATAGRAM_PACKETS;
+  //The last datagram is shortened, it's restored after sending it
+  int partial = all && rest;
+  if (partial){
+    sink->iov[datagrams].iov_len = rest*TS_PACKET_SIZE;
+    datagrams++;
+    rest = 0;
+  }
+  while (sent < datagrams){
+    n = sendmmsg (sink->fd, sink->messages + sent, datagrams - sent,
+        MSG_DONTWAIT);
+    if (n == -1){
+      if (errno == EINTR) continue;
+      //ICMP port unreachable of a previous datagram, just retry
+      if (errno == ECONNREFUSED) continue;
+      break;
+    }
+    sent += n;
+  }
+  if (partial) sink->iov[datagrams - 1].iov_len =
+      TS_DATAGRAM_PACKETS*TS_PACKET_SIZE;
+
+  if (rest){
+    memmove (sink->packets, sink->packets +
+        datagrams*TS_DATAGRAM_PACKETS*TS_PACKET_SIZE, rest*TS_PACKET_SIZE);
+  }
+  sink->packets_length = rest;
+  return sent == datagrams;
+}
+
+//Flushes the pool except the last packet if it still has room for the payload
+//of the current PES packet
+static int ts_flush_complete (ts_sink_t* sink){
+  if (!sink->packet_room) return ts_flush (sink, 0);
+
+  int last = --sink->packets_length;
+  int flushed = ts_flush (sink, 0);
+  if (sink->packets_length != last){
+    memcpy (sink->packets + sink->packets_length*TS_PACKET_SIZE,
+        sink->packets + last*TS_PACKET_SIZE, TS_PACKET_SIZE);
+  }
+  sink->packets_length++;
+  return flushed;
+}
+
+//Takes a packet from the pool, flushing it if it's full
+static uint8_t* ts_packet (ts_sink_t* sink){
+  if (sink->packets_length == TS_POOL_SIZE && !ts_flush (sink, 0)){
+    sink->frame_dropped = 1;
+  }
+  sink->packets_total++;
+  return sink->packets + (sink->packets_length++)*TS_PACKET_SIZE;
+}
+
+static void ts_put_psi (ts_sink_t* sink){
+  uint8_t* packet = ts_packet (sink);
+  memcpy (packet, sink->pat, TS_PACKET_SIZE);
+  packet[3] |= sink->pat_counter++ & 0x0F;
+  packet = ts_packet (sink);
+  memcpy (packet, sink->pmt, TS_PACKET_SIZE);
+  packet[3] |= sink->pmt_counter++ & 0x0F;
+}
+
+static uint8_t* put_timestamp (uint8_t* p, uint8_t prefix, int64_t time){
+  *p++ = (prefix << 4) | ((time >> 29) & 0x0E) | 1;
+  *p++ = time >> 22;
+  *p++ = ((time >> 14) & 0xFE) | 1;
+  *p++ = time >> 7;
+  *p++ = ((time << 1) & 0xFE) | 1;
+  return p;
+}
+
+//Starts a PES packet. The first TS packet has the PCR
+static void ts_pes_begin (ts_sink_t* sink, int64_t time, int sync){
+  uint8_t* packet = ts_packet (sink);
+  int64_t pcr = (time - TS_PCR_DELAY) & 0x1FFFFFFFFLL;
+  uint8_t* p = packet;
+
+  *p++ = 0x47;
+  *p++ = 0x40 | (TS_PID_VIDEO >> 8);
+  *p++ = TS_PID_VIDEO & 0xFF;
+  *p++ = 0x30 | (sink->video_counter++ & 0x0F);
+  //Adaptation field: random access indicator in the IDR frames, PCR flag
+  *p++ = 7;
+  *p++ = (sync ? 0x40 : 0) | 0x10;
+  *p++ = pcr >> 25;
+  *p++ = pcr >> 17;
+  *p++ = pcr >> 9;
+  *p++ = pcr >> 1;
+  *p++ = ((pcr & 1) << 7) | 0x7E;
+  *p++ = 0;
+
+  //PES header, unbounded length, PTS and DTS (there are no B-frames)
+  *p++ = 0;
+  *p++ = 0;
+  *p++ = 1;
+  *p++ = TS_STREAM_ID_VIDEO;
+  *p++ = 0;
+  *p++ = 0;
+  *p++ = 0x80;
+  *p++ = 0xC0;
+  *p++ = 10;
+  p = put_timestamp (p, 3, time);
+  p = put_timestamp (p, 1, time);
+
+  sink->packet_room = TS_PACKET_SIZE - (p - packet);
+  sink->pes = 1;
+}
+
+//Appends data to the current PES packet
+static void ts_pes_write (ts_sink_t* sink, uint8_t* data, uint32_t length){
+  uint8_t* packet;
+  uint32_t n;
+
+  while (length){
+    if (!sink->packet_room){
+      packet = ts_packet (sink);
+      packet[0] = 0x47;
+      packet[1] = TS_PID_VIDEO >> 8;
+      packet[2] = TS_PID_VIDEO & 0xFF;
+      packet[3] = 0x10 | (sink->video_counter++ & 0x0F);
+      sink->packet_room = TS_PAYLOAD_SIZE;
+    }
+    packet = sink->packets + sink->packets_length*TS_PACKET_SIZE;
+    n = length < sink->packet_room ? length : sink->packet_room;
+    memcpy (packet - sink->packet_room, data, n);
+    sink->packet_room -= n;
+    data += n;
+    length -= n;
+  }
+}
+
+//Ends the current PES packet, the payload of the last TS packet is moved to
+//the end and the free bytes are filled with adaptation field stuffing
+static void ts_pes_end (ts_sink_t* sink){
+  uint8_t* packet = sink->packets + (sink->packets_length - 1)*TS_PACKET_SIZE;
+  uint32_t room = sink->packet_room;
+
+  sink->pes = 0;
+  if (!room) return;
+  sink->packet_room = 0;
+
+  if (packet[3] & 0x20){
+    //The adaptation field is already there, it's extended
+    uint32_t start = 5 + packet[4];
+    memmove (packet + start + room, packet + start,
+        TS_PACKET_SIZE - room - start);
+    memset (packet + start, 0xFF, room);
+    packet[4] += room;
+    return;
+  }
+
+  memmove (packet + 4 + room, packet + 4, TS_PAYLOAD_SIZE - room);
+  packet[3] |= 0x20;
+  packet[4] = room - 1;
+  if (room > 1){
+    packet[5] = 0;
+    memset (packet + 6, 0xFF, room - 2);
+  }
+}
+
+static void ts_sink_write (sink_t* base, stream_buffer_t* buffer){
+  ts_sink_t* sink = (ts_sink_t*)base;
+  static uint8_t aud[] = { 0, 0, 0, 1, 9, 0xF0 };
+  struct timespec start;
+  struct timespec end;
+
+  //The SPS/PPS are taken from the cache and sent before every IDR frame
+  if (buffer->flags & STREAM_FLAG_CODECCONFIG) return;
+
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &start);
+
+  if (!sink->pes){
+    int sync = buffer->flags & STREAM_FLAG_SYNCFRAME;
+    if (sink->resync && sync) sink->resync = 0;
+    sink->frame_dropped = sink->resync;
+    if (!sink->resync){
+      int64_t time = (buffer->timestamp*9/100 + TS_PCR_DELAY) & 0x1FFFFFFFFLL;
+      //The PAT and PMT are sent before the first frame, then periodically
+      //and before every IDR frame, so a receiver can start there
+      if (!sink->psi_sent || sync ||
+          ((time - sink->psi_time) & 0x1FFFFFFFFLL) >= sink->psi_interval){
+        ts_put_psi (sink);
+        sink->psi_time = time;
+        sink->psi_sent = 1;
+      }
+      ts_pes_begin (sink, time, sync);
+      ts_pes_write (sink, aud, sizeof (aud));
+      if (sync && base->paramsets && base->paramsets->complete){
+        ts_pes_write (sink, base->paramsets->data, base->paramsets->length);
+      }
+    }
+  }
+
+  if (sink->pes){
+    ts_pes_write (sink, buffer->data, buffer->length);
+    //The full datagrams don't wait for the end of the frame
+    if (base->low_latency && !(buffer->flags & STREAM_FLAG_ENDOFFRAME) &&
+        !ts_flush_complete (sink)){
+      sink->frame_dropped = 1;
+    }
+  }
+
+  if (buffer->flags & STREAM_FLAG_ENDOFFRAME){
+    if (sink->pes){
+      ts_pes_end (sink);
+      if (!ts_flush (sink, 1)) sink->frame_dropped = 1;
+    }
+    if (sink->frame_dropped){
+      if (!sink->resync && base->idr) idr_request (base->idr);
+      sink->resync = 1;
+      base->dropped_frames++;
+    }else{
+      base->frames++;
+    }
+  }
+  if (!sink->frame_dropped) base->bytes += buffer->length;
+
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &end);
+  sink->time.tv_sec += end.tv_sec - start.tv_sec;
+  sink->time.tv_nsec += end.tv_nsec - start.tv_nsec;
+}
+
+static int ts_sink_rotate (sink_t* base, int fd){
+  ts_sink_t* sink = (ts_sink_t*)base;
+  int previous = sink->fd;
+
+  //The new file starts with the PAT and PMT
+  ts_flush (sink, 1);
+  if (base->stream) previous = writer_rotate (base->stream, fd);
+  sink->fd = fd;
+  sink->psi_sent = 0;
+
+  return previous;
+}
+
+static void ts_sink_close (sink_t* base){
+  ts_sink_t* sink = (ts_sink_t*)base;
+
+  if (sink->pes) ts_pes_end (sink);
+  ts_flush (sink, 1);
+
+  double time = sink->time.tv_sec + sink->time.tv_nsec/1.0e9;
+  printf ("sink %s: %llu packets, cpu %.3f s (%.1f MB/s)\n", base->name,
+      (unsigned long long)sink->packets_total, time,
+      time > 0 ? base->bytes/time/1.0e6 : 0);
+
+  if (base->stream) sink->fd = writer_stream_close (base->stream);
+  if (close (sink->fd)){
+    fprintf (stderr, "error: close\n");
+    exit (1);
+  }
+
+  free (sink->packets);
+  free (sink->messages);
+  free (sink->iov);
+  free (sink);
+}
+
+sink_t* ts_sink_open (const char* spec){
+  ts_sink_t* sink = calloc (1, sizeof (ts_sink_t));
+  if (!sink){
+    fprintf (stderr, "error: calloc\n");
+    exit (1);
+  }
+  sink->sink.name = spec;
+  sink->sink.write = ts_sink_write;
+  sink->sink.close = ts_sink_close;
+  sink->resync = 1;
+  sink->udp = !strncmp (spec, "udp:", 4);
+  //Only the files can be rotated
+  if (!sink->udp) sink->sink.rotate = ts_sink_rotate;
+
+  //ts:PATH[,option=value]..., udp:HOST:PORT[,option=value]... or PATH
+  char address[512];
+  const char* options = strchr (spec, ',');
+  size_t length = options ? (size_t)(options - spec) : strlen (spec);
+  size_t prefix = sink->udp ? 4 : !strncmp (spec, "ts:", 3) ? 3 : 0;
+  if (length - prefix >= sizeof (address)){
+    fprintf (stderr, "error: invalid address: %s\n", spec);
+    exit (1);
+  }
+  memcpy (address, spec + prefix, length - prefix);
+  address[length - prefix] = 0;
+
+  unsigned int psi = TS_PSI_INTERVAL;
+  while (options){
+    options++;
+    if (sscanf (options, "psi=%u", &psi) != 1){
+      fprintf (stderr, "error: invalid ts option: %s\n", options);
+      exit (1);
+    }
+    options = strchr (options, ',');
+  }
+  sink->psi_interval = (int64_t)psi*90;
+
+  if (sink->udp){
+    sink->fd = sink_connect (address, SOCK_DGRAM);
+    int size = TS_SNDBUF;
+    setsockopt (sink->fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof (size));
+  }else{
+    sink->fd = open (address, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0666);
+    if (sink->fd == -1){
+      fprintf (stderr, "error: open\n");
+      exit (1);
+    }
+    sink_stream (&sink->sink, sink->fd);
+  }
+
+  ts_psi_init (sink);
+
+  int datagrams = TS_POOL_SIZE/TS_DATAGRAM_PACKETS + 1;
+  sink->packets = malloc (TS_POOL_SIZE*TS_PACKET_SIZE);
+  sink->messages = calloc (datagrams, sizeof (struct mmsghdr));
+  sink->iov = malloc (datagrams*sizeof (struct iovec));
+  if (!sink->packets || !sink->messages || !sink->iov){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+
+  //Every datagram has 7 consecutive packets of the pool
+  int i;
+  for (i=0; i<datagrams; i++){
+    sink->iov[i].iov_base = sink->packets +
+        i*TS_DATAGRAM_PACKETS*TS_PACKET_SIZE;
+    sink->iov[i].iov_len = TS_DATAGRAM_PACKETS*TS_PACKET_SIZE;
+    sink->messages[i].msg_hdr.msg_iov = &sink->iov[i];
+    sink->messages[i].msg_hdr.msg_iovlen = 1;
+  }
+
+  return &sink->sink;
+}
@@ -0,0 +1,27 @@
+#ifndef TS_H
+#define TS_H
+
+#include "sink.h"
+
+/*
+MPEG transport stream writer (ISO/IEC 13818-1). Every frame is a PES packet
+with the PTS and DTS taken from the encoder timestamps, preceded by an access
+unit delimiter and, if it's an IDR frame, by the cached SPS/PPS. The first TS
+packet of every frame carries the PCR, and the PAT and PMT are repeated every
+TS_PSI_INTERVAL ms (psi option).
+
+The 188-byte packets are built in a pool allocated when the sink is opened and
+they're written in batches: a frame is a single write() to a file, and the UDP
+datagrams (7 packets each) are sent with sendmmsg(). The time spent in the
+packetization is printed when the sink is closed.
+
+Output specification:
+
+  ts:PATH[,psi=MS]       file, also any PATH that ends with .ts
+  udp:HOST:PORT[,psi=MS] UDP datagrams, never blocks: the frames are dropped
+                         until the next IDR frame if the socket buffer is full
+*/
+
+sink_t* ts_sink_open (const char* spec);
+
+#endif
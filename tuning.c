@@ -0,0 +1,444 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tuning.h"
+
+//A KEY=VALUE of the commands, it sets count consecutive values
+typedef struct {
+  const char* name;
+  tuning_config_t config;
+  tuning_value_t value;
+  int count;
+  //Range of the numeric values, or the names of the values (the value is the
+  //index of the name)
+  int32_t min;
+  int32_t max;
+  const char* const* names;
+  //"auto" is the value 0
+  int automatic;
+} tuning_key_t;
+
+static const char* const tuning_switch[] = {
+  "off", "on", 0
+};
+
+static const char* const tuning_metering[] = {
+  "average", "spot", "matrix", "backlit", 0
+};
+
+static const char* const tuning_exposure[] = {
+  "off", "auto", "night", "backlight", "spotlight", "sports", "snow", "beach",
+  "largeaperture", "smallaperture", "verylong", "fixedfps", "nightpreview",
+  "antishake", "fireworks", 0
+};
+
+static const char* const tuning_white_balance[] = {
+  "off", "auto", "sunlight", "cloudy", "shade", "tungsten", "fluorescent",
+  "incandescent", "flash", "horizon", 0
+};
+
+static const char* const tuning_mirror[] = {
+  "none", "horizontal", "vertical", "both", 0
+};
+
+static const char* const tuning_drc[] = {
+  "off", "low", "medium", "high", 0
+};
+
+static const tuning_key_t tuning_keys[] = {
+  { "sharpness", TUNING_SHARPNESS, TUNING_VALUE_SHARPNESS, 1, -100, 100, 0,
+      0 },
+  { "contrast", TUNING_CONTRAST, TUNING_VALUE_CONTRAST, 1, -100, 100, 0, 0 },
+  { "brightness", TUNING_BRIGHTNESS, TUNING_VALUE_BRIGHTNESS, 1, 0, 100, 0,
+      0 },
+  { "saturation", TUNING_SATURATION, TUNING_VALUE_SATURATION, 1, -100, 100, 0,
+      0 },
+  { "metering", TUNING_EXPOSURE_VALUE, TUNING_VALUE_METERING, 1, 0, 0,
+      tuning_metering, 0 },
+  { "ev", TUNING_EXPOSURE_VALUE, TUNING_VALUE_EV, 1, -24, 24, 0, 0 },
+  { "shutter", TUNING_EXPOSURE_VALUE, TUNING_VALUE_SHUTTER, 1, 1, 6000000, 0,
+      1 },
+  { "iso", TUNING_EXPOSURE_VALUE, TUNING_VALUE_ISO, 1, 100, 800, 0, 1 },
+  { "exposure", TUNING_EXPOSURE, TUNING_VALUE_EXPOSURE, 1, 0, 0,
+      tuning_exposure, 0 },
+  { "stabilisation", TUNING_STABILISATION, TUNING_VALUE_STABILISATION, 1, 0,
+      0, tuning_switch, 0 },
+  { "awb", TUNING_WHITE_BALANCE, TUNING_VALUE_AWB, 1, 0, 0,
+      tuning_white_balance, 0 },
+  { "awb_gains", TUNING_AWB_GAINS, TUNING_VALUE_AWB_RED, 2, 0, 8000, 0, 0 },
+  { "mirror", TUNING_MIRROR, TUNING_VALUE_MIRROR, 1, 0, 0, tuning_mirror, 0 },
+  { "denoise", TUNING_DENOISE, TUNING_VALUE_DENOISE, 1, 0, 0, tuning_switch,
+      0 },
+  { "roi", TUNING_ROI, TUNING_VALUE_ROI_LEFT, 4, 0, 100, 0, 0 },
+  { "drc", TUNING_DRC, TUNING_VALUE_DRC, 1, 0, 0, tuning_drc, 0 },
+  { "bitrate", TUNING_BITRATE, TUNING_VALUE_BITRATE, 1, 1, 25000000, 0, 0 },
+  { "idr", TUNING_IDR_PERIOD, TUNING_VALUE_IDR_PERIOD, 1, 0, 100000, 0, 0 },
+  { 0, 0, 0, 0, 0, 0, 0, 0 }
+};
+
+//Parameters of the ports, they can't be changed while recording
+static const char* tuning_restart[] = {
+  "size", "framerate", "rotation", "profile", "qp_i", "qp_p", 0
+};
+
+static const char* tuning_configs[] = {
+  "sharpness", "contrast", "brightness", "saturation", "exposure_value",
+  "exposure", "stabilisation", "white_balance", "awb_gains", "mirror",
+  "denoise", "roi", "drc", "bitrate", "idr_period"
+};
+
+int64_t tuning_time (){
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  return (int64_t)spec.tv_sec*1000000 + spec.tv_nsec/1000;
+}
+
+void tuning_init (tuning_t* tuning, const int32_t* values){
+  memset (tuning, 0, sizeof (tuning_t));
+  memcpy (tuning->current, values, sizeof (tuning->current));
+  memcpy (tuning->wanted, values, sizeof (tuning->wanted));
+  if (pthread_mutex_init (&tuning->mutex, 0) ||
+      pthread_cond_init (&tuning->cond, 0)){
+    fprintf (stderr, "error: pthread_mutex_init\n");
+    exit (1);
+  }
+}
+
+static int tuning_number (
+    const tuning_key_t* key,
+    const char* str,
+    int32_t* value){
+  char* end;
+  long n;
+  int i;
+
+  if (key->names){
+    for (i=0; key->names[i]; i++){
+      if (!strcmp (str, key->names[i])){
+        *value = i;
+        return 0;
+      }
+    }
+    return -1;
+  }
+  if (key->automatic && !strcmp (str, "auto")){
+    *value = 0;
+    return 0;
+  }
+  errno = 0;
+  n = strtol (str, &end, 10);
+  if (errno || !*str || *end || n < key->min || n > key->max) return -1;
+  *value = (int32_t)n;
+  return 0;
+}
+
+int tuning_parse (
+    tuning_t* tuning,
+    char* args,
+    int32_t* values,
+    uint32_t* configs,
+    char* error,
+    size_t size){
+  const tuning_key_t* key;
+  const char** restart;
+  char* save;
+  char* token;
+  char* value;
+  char* next;
+  int i;
+
+  pthread_mutex_lock (&tuning->mutex);
+  memcpy (values, tuning->wanted, sizeof (tuning->wanted));
+  pthread_mutex_unlock (&tuning->mutex);
+  *configs = 0;
+
+  for (token = strtok_r (args, " \t", &save); token;
+      token = strtok_r (0, " \t", &save)){
+    if (!(value = strchr (token, '='))){
+      snprintf (error, size, "expected KEY=VALUE: %s", token);
+      return -1;
+    }
+    *value++ = 0;
+
+    for (restart=tuning_restart; *restart; restart++){
+      if (!strcmp (token, *restart)){
+        snprintf (error, size, "%s can't be changed while recording, it "
+            "needs a restart", token);
+        return -1;
+      }
+    }
+    for (key=tuning_keys; key->name; key++){
+      if (!strcmp (token, key->name)) break;
+    }
+    if (!key->name){
+      snprintf (error, size, "unknown setting: %s", token);
+      return -1;
+    }
+
+    //VALUE[,VALUE]...
+    for (i=0; i<key->count; i++){
+      next = strchr (value, ',');
+      if (next) *next++ = 0;
+      if ((!next) != (i == key->count - 1) ||
+          tuning_number (key, value, &values[key->value + i])){
+        snprintf (error, size, "invalid %s", key->name);
+        return -1;
+      }
+      value = next;
+    }
+    *configs |= 1 << key->config;
+  }
+
+  if (!*configs){
+    snprintf (error, size, "usage: set KEY=VALUE...");
+    return -1;
+  }
+  if (!values[TUNING_VALUE_ROI_WIDTH] || !values[TUNING_VALUE_ROI_HEIGHT] ||
+      values[TUNING_VALUE_ROI_LEFT] + values[TUNING_VALUE_ROI_WIDTH] > 100 ||
+      values[TUNING_VALUE_ROI_TOP] + values[TUNING_VALUE_ROI_HEIGHT] > 100){
+    snprintf (error, size, "invalid roi");
+    return -1;
+  }
+  return 0;
+}
+
+//Configs whose values differ
+static uint32_t tuning_diff (const int32_t* a, const int32_t* b){
+  const tuning_key_t* key;
+  uint32_t configs = 0;
+
+  for (key=tuning_keys; key->name; key++){
+    if (memcmp (a + key->value, b + key->value,
+        key->count*sizeof (int32_t))){
+      configs |= 1 << key->config;
+    }
+  }
+  return configs;
+}
+
+//Copies the values of a config
+static void tuning_copy (
+    int32_t* to,
+    const int32_t* from,
+    tuning_config_t config){
+  const tuning_key_t* key;
+
+  for (key=tuning_keys; key->name; key++){
+    if (key->config == config){
+      memcpy (to + key->value, from + key->value,
+          key->count*sizeof (int32_t));
+    }
+  }
+}
+
+uint32_t tuning_request (
+    tuning_t* tuning,
+    const int32_t* values,
+    uint32_t* ticket){
+  int64_t now = tuning_time ();
+  uint32_t configs;
+  int i;
+
+  pthread_mutex_lock (&tuning->mutex);
+  memcpy (tuning->wanted, values, sizeof (tuning->wanted));
+  configs = tuning_diff (tuning->current, tuning->wanted);
+  //The custom gains are sent again when the white balance is turned off
+  if ((configs & (1 << TUNING_WHITE_BALANCE)) &&
+      values[TUNING_VALUE_AWB] == TUNING_AWB_OFF){
+    configs |= 1 << TUNING_AWB_GAINS;
+  }
+  for (i=0; i<TUNING_CONFIGS; i++){
+    if ((configs & (1 << i)) && !(tuning->pending & (1 << i))){
+      tuning->requested[i] = now;
+    }
+  }
+  tuning->pending = configs;
+  if (configs) tuning->requests++;
+  *ticket = tuning->requests;
+  pthread_mutex_unlock (&tuning->mutex);
+
+  return configs;
+}
+
+int tuning_wait (tuning_t* tuning, uint32_t ticket, int timeout){
+  struct timespec deadline;
+  int done;
+
+  clock_gettime (CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout/1000;
+  deadline.tv_nsec += (timeout%1000)*1000000L;
+  if (deadline.tv_nsec >= 1000000000L){
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock (&tuning->mutex);
+  while ((int32_t)(tuning->done - ticket) < 0){
+    if (pthread_cond_timedwait (&tuning->cond, &tuning->mutex, &deadline)){
+      break;
+    }
+  }
+  done = (int32_t)(tuning->done - ticket) >= 0;
+  pthread_mutex_unlock (&tuning->mutex);
+
+  return done;
+}
+
+int tuning_reply (tuning_t* tuning, uint32_t configs, char* str, size_t size){
+  tuning_stats_t* stats;
+  int n = 0;
+  int i;
+
+  if (!configs) return snprintf (str, size, "unchanged");
+
+  pthread_mutex_lock (&tuning->mutex);
+  for (i=0; i<TUNING_CONFIGS && n < (int)size; i++){
+    if (!(configs & (1 << i))) continue;
+    stats = &tuning->stats[i];
+    n += snprintf (str + n, size - n, "%s%s ", n ? ", " : "",
+        tuning_configs[i]);
+    if (n >= (int)size) break;
+    if (tuning->pending & (1 << i)){
+      n += snprintf (str + n, size - n, "pending");
+    }else if (stats->result){
+      n += snprintf (str + n, size - n, "failed (%s)", stats->result);
+    }else{
+      n += snprintf (str + n, size - n, "%.1f ms%s",
+          stats->latency_last/1000.0,
+          i == TUNING_IDR_PERIOD ? " (from the next IDR frame)" : "");
+    }
+  }
+  pthread_mutex_unlock (&tuning->mutex);
+
+  return n;
+}
+
+int tuning_failed (tuning_t* tuning, uint32_t configs){
+  int failed = 0;
+  int i;
+
+  pthread_mutex_lock (&tuning->mutex);
+  for (i=0; i<TUNING_CONFIGS; i++){
+    if ((configs & (1 << i)) && !(tuning->pending & (1 << i)) &&
+        tuning->stats[i].result){
+      failed = 1;
+    }
+  }
+  pthread_mutex_unlock (&tuning->mutex);
+
+  return failed;
+}
+
+int tuning_pending (tuning_t* tuning){
+  return tuning->pending != 0;
+}
+
+uint32_t tuning_begin (tuning_t* tuning, int32_t* values){
+  uint32_t configs;
+
+  pthread_mutex_lock (&tuning->mutex);
+  configs = tuning->pending;
+  tuning->pending = 0;
+  tuning->taken = tuning->requests;
+  memcpy (values, tuning->wanted, sizeof (tuning->wanted));
+  pthread_mutex_unlock (&tuning->mutex);
+
+  return configs;
+}
+
+void tuning_applied (
+    tuning_t* tuning,
+    tuning_config_t config,
+    const int32_t* values,
+    const char* error,
+    int64_t start){
+  int64_t now = tuning_time ();
+  tuning_stats_t* stats = &tuning->stats[config];
+
+  pthread_mutex_lock (&tuning->mutex);
+  stats->result = error;
+  if (error){
+    //The firmware keeps the previous values
+    stats->errors++;
+    if (!(tuning->pending & (1 << config))){
+      tuning_copy (tuning->wanted, tuning->current, config);
+    }
+  }else{
+    tuning_copy (tuning->current, values, config);
+    stats->applied++;
+    stats->latency_last = now - tuning->requested[config];
+    stats->latency_sum += stats->latency_last;
+    if (stats->latency_last > stats->latency_max){
+      stats->latency_max = stats->latency_last;
+    }
+    if (now - start > stats->call_max) stats->call_max = now - start;
+  }
+  pthread_mutex_unlock (&tuning->mutex);
+}
+
+void tuning_end (tuning_t* tuning){
+  pthread_mutex_lock (&tuning->mutex);
+  tuning->done = tuning->taken;
+  pthread_cond_broadcast (&tuning->cond);
+  pthread_mutex_unlock (&tuning->mutex);
+}
+
+int tuning_get (tuning_t* tuning, char* str, size_t size){
+  const tuning_key_t* key;
+  int32_t value;
+  int n = 0;
+  int i;
+  int j;
+
+  pthread_mutex_lock (&tuning->mutex);
+  for (key=tuning_keys; key->name && n < (int)size; key++){
+    n += snprintf (str + n, size - n, "%s%s=", n ? " " : "", key->name);
+    for (i=0; i<key->count && n < (int)size; i++){
+      value = tuning->current[key->value + i];
+      if (i) n += snprintf (str + n, size - n, ",");
+      if (n >= (int)size) break;
+      if (key->names){
+        for (j=0; key->names[j] && j != value; j++);
+        n += snprintf (str + n, size - n, "%s",
+            key->names[j] ? key->names[j] : "?");
+      }else if (key->automatic && !value){
+        n += snprintf (str + n, size - n, "auto");
+      }else{
+        n += snprintf (str + n, size - n, "%d", value);
+      }
+    }
+  }
+  pthread_mutex_unlock (&tuning->mutex);
+
+  return n;
+}
+
+int tuning_dump (tuning_t* tuning, char* str, size_t size){
+  tuning_stats_t* stats;
+  int n = 0;
+  int i;
+
+  pthread_mutex_lock (&tuning->mutex);
+  for (i=0; i<TUNING_CONFIGS && n < (int)size; i++){
+    stats = &tuning->stats[i];
+    if (!stats->applied && !stats->errors) continue;
+    n += snprintf (str + n, size - n, "%s%s applied %u errors %u latency (ms) "
+        "last %.1f avg %.1f max %.1f call max %.1f", n ? ", " : "",
+        tuning_configs[i], stats->applied, stats->errors,
+        stats->latency_last/1000.0,
+        stats->applied ? stats->latency_sum/1000.0/stats->applied : 0.0,
+        stats->latency_max/1000.0, stats->call_max/1000.0);
+  }
+  pthread_mutex_unlock (&tuning->mutex);
+
+  if (!n) n = snprintf (str, size, "no changes");
+  return n;
+}
+
+void tuning_close (tuning_t* tuning){
+  pthread_mutex_destroy (&tuning->mutex);
+  pthread_cond_destroy (&tuning->cond);
+}
@@ -0,0 +1,168 @@
+#ifndef TUNING_H
+#define TUNING_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+Live camera and encoder settings (set and get control commands). The camera
+settings of set_camera_settings() that are configs (OMX_SetConfig) and the
+bitrate and IDR period of the encoder can be changed while recording:
+
+  $ echo set ev=6 awb=off awb_gains=1500,1200 | socat - UNIX-CONNECT:...
+  ok exposure_value 9.1 ms, white_balance 9.4 ms, awb_gains 9.6 ms
+
+The settings that are parameters of the ports (size, frame rate, rotation,
+profile, quantization) are rejected, they need a restart.
+
+The control thread parses a command into the wanted values, and every config
+whose values differ from the ones in the firmware is marked as pending, so a
+setting that doesn't change is never sent again. Like the IDR requests, the
+encoder loop applies the pending configs before giving the next buffer back to
+the encoder, so the components are only driven from one thread. The control
+thread waits until they've been applied (TUNING_WAIT ms at most) and replies
+with the latency of every config, from the command to the return of
+OMX_SetConfig(). The encoder uses a new IDR period after the next IDR frame.
+
+The module doesn't depend on OpenMAX: a setting with names (metering, exposure,
+awb, mirror, drc, on/off) has the index of its name as value, in the order of
+the names in tuning.c, and h264.c maps it to the value of the OMX enum.
+*/
+
+//Time the control thread waits for the encoder loop (ms)
+#define TUNING_WAIT 1000
+//Value of awb=off, the custom gains are only used with it
+#define TUNING_AWB_OFF 0
+
+//Values of the settings, every config sets one or more consecutive values
+typedef enum {
+  TUNING_VALUE_SHARPNESS,
+  TUNING_VALUE_CONTRAST,
+  TUNING_VALUE_BRIGHTNESS,
+  TUNING_VALUE_SATURATION,
+  TUNING_VALUE_METERING,
+  //1/6 EV steps
+  TUNING_VALUE_EV,
+  //us, 0 is automatic
+  TUNING_VALUE_SHUTTER,
+  //0 is automatic
+  TUNING_VALUE_ISO,
+  TUNING_VALUE_EXPOSURE,
+  TUNING_VALUE_STABILISATION,
+  TUNING_VALUE_AWB,
+  //Gains * 1000, used when the white balance is off
+  TUNING_VALUE_AWB_RED,
+  TUNING_VALUE_AWB_BLUE,
+  TUNING_VALUE_MIRROR,
+  TUNING_VALUE_DENOISE,
+  //Percentages
+  TUNING_VALUE_ROI_LEFT,
+  TUNING_VALUE_ROI_TOP,
+  TUNING_VALUE_ROI_WIDTH,
+  TUNING_VALUE_ROI_HEIGHT,
+  TUNING_VALUE_DRC,
+  TUNING_VALUE_BITRATE,
+  TUNING_VALUE_IDR_PERIOD,
+  TUNING_VALUES
+} tuning_value_t;
+
+//Configs, every one is applied with one OMX_SetConfig()
+typedef enum {
+  TUNING_SHARPNESS,
+  TUNING_CONTRAST,
+  TUNING_BRIGHTNESS,
+  TUNING_SATURATION,
+  TUNING_EXPOSURE_VALUE,
+  TUNING_EXPOSURE,
+  TUNING_STABILISATION,
+  TUNING_WHITE_BALANCE,
+  TUNING_AWB_GAINS,
+  TUNING_MIRROR,
+  TUNING_DENOISE,
+  TUNING_ROI,
+  TUNING_DRC,
+  //Configs of the encoder, the others are configs of the camera
+  TUNING_BITRATE,
+  TUNING_IDR_PERIOD,
+  TUNING_CONFIGS
+} tuning_config_t;
+
+typedef struct {
+  uint32_t applied;
+  uint32_t errors;
+  //Error of the last OMX_SetConfig(), 0 if it succeeded
+  const char* result;
+  //From the request to the return of OMX_SetConfig() (us)
+  int64_t latency_last;
+  int64_t latency_max;
+  int64_t latency_sum;
+  //Time spent in OMX_SetConfig() (us)
+  int64_t call_max;
+} tuning_stats_t;
+
+typedef struct {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  //The fields below are protected by the mutex. Values in the firmware and
+  //values requested by the control channel
+  int32_t current[TUNING_VALUES];
+  int32_t wanted[TUNING_VALUES];
+  //Configs to apply, read by the encoder loop without the mutex
+  volatile uint32_t pending;
+  //Time of the oldest request of every pending config (us)
+  int64_t requested[TUNING_CONFIGS];
+  //Requests done and requests taken by the encoder loop
+  uint32_t requests;
+  uint32_t taken;
+  uint32_t done;
+  tuning_stats_t stats[TUNING_CONFIGS];
+} tuning_t;
+
+//values are the settings the firmware is configured with
+void tuning_init (tuning_t* tuning, const int32_t* values);
+//Parses a list of KEY=VALUE, values starts with the wanted settings. The
+//configs that are set are returned in configs (bitwise OR of 1 << config).
+//Returns 0 on success, otherwise the error is printed in error
+int tuning_parse (
+    tuning_t* tuning,
+    char* args,
+    int32_t* values,
+    uint32_t* configs,
+    char* error,
+    size_t size);
+//Requests the values. Returns the configs that differ from the firmware and
+//the ticket to wait for, if any
+uint32_t tuning_request (
+    tuning_t* tuning,
+    const int32_t* values,
+    uint32_t* ticket);
+//Waits until the request of the ticket has been applied, returns 1 if it has
+int tuning_wait (tuning_t* tuning, uint32_t ticket, int timeout);
+//Prints the result of the configs of a request in a string
+int tuning_reply (tuning_t* tuning, uint32_t configs, char* str, size_t size);
+//Returns 1 if any of the configs failed the last time it was applied
+int tuning_failed (tuning_t* tuning, uint32_t configs);
+//Encoder loop: returns 1 if there are configs to apply
+int tuning_pending (tuning_t* tuning);
+//Encoder loop: takes the pending configs and copies the wanted values
+uint32_t tuning_begin (tuning_t* tuning, int32_t* values);
+//Encoder loop: called after every config with the name of the error of
+//OMX_SetConfig(), 0 if there's none. start is the time before the call (us)
+void tuning_applied (
+    tuning_t* tuning,
+    tuning_config_t config,
+    const int32_t* values,
+    const char* error,
+    int64_t start);
+//Encoder loop: wakes up the control thread
+void tuning_end (tuning_t* tuning);
+//Prints the current values in a string, in the format of tuning_parse()
+int tuning_get (tuning_t* tuning, char* str, size_t size);
+//Prints the statistics in a string
+int tuning_dump (tuning_t* tuning, char* str, size_t size);
+//Returns the monotonic time (us) used by the latencies
+int64_t tuning_time ();
+void tuning_close (tuning_t* tuning);
+
+#endif
@@ -0,0 +1,342 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "bits.h"
+#include "validate.h"
+
+typedef struct {
+  uint8_t level_idc;
+  //Maximum macroblocks per second and per frame (H.264, table A-1)
+  uint32_t mbps;
+  uint32_t fs;
+} level_t;
+
+static const level_t levels[] = {
+  { 9, 1485, 99 }, { 10, 1485, 99 }, { 11, 3000, 396 }, { 12, 6000, 396 },
+  { 13, 11880, 396 }, { 20, 11880, 396 }, { 21, 19800, 792 },
+  { 22, 20250, 1620 }, { 30, 40500, 1620 }, { 31, 108000, 3600 },
+  { 32, 216000, 5120 }, { 40, 245760, 8192 }, { 41, 245760, 8192 },
+  { 42, 522240, 8704 }, { 50, 589824, 22080 }, { 51, 983040, 36864 },
+  { 52, 2073600, 36864 }
+};
+
+static void validator_error (
+    validator_t* validator,
+    uint64_t offset,
+    const char* format,
+    ...){
+  va_list args;
+  validator->errors++;
+  fprintf (stderr, "validate: offset %llu, timestamp %lld us: ",
+      (unsigned long long)offset, (long long)validator->timestamp);
+  va_start (args, format);
+  vfprintf (stderr, format, args);
+  va_end (args);
+  fprintf (stderr, "\n");
+}
+
+static void validator_sps (
+    validator_t* validator,
+    nal_entry_t* nal,
+    uint8_t* head,
+    uint32_t length){
+  sps_t sps;
+  uint32_t i;
+
+  if (sps_parse (&sps, head, length) || sps.id >= 32){
+    validator_error (validator, nal->offset, "invalid SPS");
+    return;
+  }
+  if (sps.profile_idc != validator->profile_idc){
+    validator_error (validator, nal->offset, "profile %u, expected %u",
+        sps.profile_idc, validator->profile_idc);
+  }
+
+  for (i=0; i<sizeof (levels)/sizeof (level_t); i++){
+    if (levels[i].level_idc == sps.level_idc) break;
+  }
+  uint32_t mbs = ((sps.width + 15)/16)*((sps.height + 15)/16);
+  if (i == sizeof (levels)/sizeof (level_t)){
+    validator_error (validator, nal->offset, "unknown level %u",
+        sps.level_idc);
+  }else if (mbs > levels[i].fs || mbs*validator->framerate > levels[i].mbps){
+    validator_error (validator, nal->offset, "%ux%u @%u fps exceeds level %u",
+        sps.width, sps.height, validator->framerate, sps.level_idc);
+  }
+
+  validator->sps[sps.id] = sps;
+  validator->sps_valid |= 1 << sps.id;
+}
+
+static void validator_pps (
+    validator_t* validator,
+    nal_entry_t* nal,
+    uint8_t* head,
+    uint32_t length){
+  pps_t pps;
+
+  if (pps_parse (&pps, head, length) || pps.id >= 256){
+    validator_error (validator, nal->offset, "invalid PPS");
+    return;
+  }
+  if (pps.sps_id >= 32 || !(validator->sps_valid & (1 << pps.sps_id))){
+    validator_error (validator, nal->offset, "PPS %u refers to unknown SPS %u",
+        pps.id, pps.sps_id);
+    return;
+  }
+
+  validator->pps[pps.id] = pps;
+  validator->pps_valid[pps.id] = 1;
+}
+
+//Called with the first slice of every picture
+static void validator_picture (
+    validator_t* validator,
+    nal_entry_t* nal,
+    uint32_t frame_num,
+    uint32_t max_frame_num){
+  if (validator->picture){
+    validator->previous = 1;
+    validator->previous_frame_num = validator->frame_num;
+    validator->previous_reference = validator->reference;
+  }
+  validator->picture = 1;
+  validator->picture_offset = nal->offset;
+  validator->frame_num = frame_num;
+
+  if (nal->type == NAL_IDR){
+    if (validator->frame_num){
+      validator_error (validator, nal->offset, "IDR frame with frame_num %u",
+          validator->frame_num);
+    }
+    validator->idr_seen = 1;
+    validator->frames_since_idr = 0;
+    return;
+  }
+
+  if (!validator->idr_seen){
+    validator_error (validator, nal->offset, "no IDR frame before this frame");
+    //Reported once
+    validator->idr_seen = 1;
+  }
+
+  if (validator->previous){
+    uint32_t expected = validator->previous_reference ?
+        (validator->previous_frame_num + 1) % max_frame_num :
+        validator->previous_frame_num;
+    if (validator->frame_num != expected){
+      validator_error (validator, nal->offset,
+          "frame_num gap, expected %u, got %u", expected,
+          validator->frame_num);
+    }
+  }
+
+  if (++validator->frames_since_idr == validator->idr_period + 1 &&
+      validator->idr_period){
+    validator_error (validator, nal->offset,
+        "missing IDR frame, %u frames since the last one",
+        validator->frames_since_idr);
+  }
+}
+
+static void validator_slice (
+    validator_t* validator,
+    nal_entry_t* nal,
+    uint8_t* head,
+    uint32_t length){
+  uint8_t rbsp[VALIDATE_HEADER_SIZE];
+  bits_t bits;
+
+  bits_init (&bits, rbsp, bits_unescape (rbsp, sizeof (rbsp), head + 1,
+      length - 1));
+  uint32_t first_mb = bits_ue (&bits);
+  uint32_t slice_type = bits_ue (&bits);
+  uint32_t pps_id = bits_ue (&bits);
+
+  if (bits_overrun (&bits) || slice_type > 9 || pps_id >= 256){
+    validator_error (validator, nal->offset, "invalid slice header");
+    return;
+  }
+  if (!validator->pps_valid[pps_id]){
+    validator_error (validator, nal->offset, "slice refers to unknown PPS %u",
+        pps_id);
+    return;
+  }
+  sps_t* sps = &validator->sps[validator->pps[pps_id].sps_id];
+
+  uint32_t frame_num = bits_read (&bits, sps->log2_max_frame_num);
+  if (!sps->frame_mbs_only && bits_read (&bits, 1)){
+    //bottom_field_flag
+    bits_skip (&bits, 1);
+  }
+  if (nal->type == NAL_IDR){
+    //idr_pic_id
+    bits_ue (&bits);
+  }
+  if (bits_overrun (&bits)){
+    validator_error (validator, nal->offset, "truncated slice header");
+    return;
+  }
+
+  uint32_t mbs = ((sps->width + 15)/16)*((sps->height + 15)/16);
+  if (first_mb >= mbs){
+    validator_error (validator, nal->offset, "first_mb_in_slice %u of %u",
+        first_mb, mbs);
+    return;
+  }
+
+  if (nal->type == NAL_IDR) validator->idr_slices++;
+  if (!first_mb){
+    validator_picture (validator, nal, frame_num,
+        1 << sps->log2_max_frame_num);
+    validator->reference = (head[0] >> 5) & 3;
+  }
+}
+
+//Checks a complete NAL unit. Only its first bytes are available
+static void validator_nal (
+    validator_t* validator,
+    nal_entry_t* nal,
+    uint8_t* head,
+    uint32_t length,
+    uint8_t last){
+  validator->nals_length++;
+
+  if (head[0] & 0x80){
+    validator_error (validator, nal->offset, "forbidden_zero_bit set");
+  }
+  if (!last){
+    validator_error (validator, nal->offset,
+        "truncated NAL unit (type %u, %llu bytes)", nal->type,
+        (unsigned long long)nal->length);
+  }
+
+  switch (nal->type){
+    case NAL_SPS:
+      validator_sps (validator, nal, head, length);
+      break;
+    case NAL_PPS:
+      validator_pps (validator, nal, head, length);
+      break;
+    case NAL_SLICE:
+    case NAL_IDR:
+      validator_slice (validator, nal, head, length);
+      break;
+  }
+}
+
+//Finds the first bytes of a NAL unit that ends in this buffer, it may have
+//started in a previous one
+static void validator_entry (
+    validator_t* validator,
+    nal_entry_t* nal,
+    uint8_t* data,
+    uint64_t base){
+  uint8_t head[VALIDATE_HEADER_SIZE];
+  uint64_t end = nal->offset + nal->length;
+  //A start code split between buffers may leave the end in the previous one
+  uint8_t last = end > base ? data[end - base - 1] :
+      validator->tail[VALIDATE_TAIL_SIZE - (base - end) - 1];
+  uint32_t length = nal->length < VALIDATE_HEADER_SIZE ?
+      nal->length : VALIDATE_HEADER_SIZE;
+
+  if (nal->offset >= base){
+    validator_nal (validator, nal, data + (nal->offset - base), length, last);
+    return;
+  }
+
+  memcpy (head, validator->head, validator->head_length);
+  if (length > validator->head_length){
+    memcpy (head + validator->head_length, data,
+        length - validator->head_length);
+  }
+  validator_nal (validator, nal, head, length, last);
+}
+
+void validator_init (
+    validator_t* validator,
+    uint8_t profile_idc,
+    uint32_t framerate,
+    uint32_t idr_period){
+  memset (validator, 0, sizeof (validator_t));
+  validator->profile_idc = profile_idc;
+  validator->framerate = framerate;
+  validator->idr_period = idr_period;
+  nal_scanner_init (&validator->scanner);
+}
+
+void validator_write (validator_t* validator, stream_buffer_t* buffer){
+  nal_scanner_t* scanner = &validator->scanner;
+  uint64_t base = scanner->position;
+  struct timespec start;
+  struct timespec end;
+  nal_entry_t nal;
+  int n;
+  int i;
+
+  if (!buffer->length) return;
+
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &start);
+  validator->timestamp = buffer->timestamp;
+
+  n = nal_scan (scanner, buffer->data, buffer->length, validator->nals,
+      VALIDATE_NALS_MAX);
+  for (i=0; i<n; i++){
+    validator_entry (validator, &validator->nals[i], buffer->data, base);
+  }
+
+  if (buffer->flags & (STREAM_FLAG_ENDOFFRAME | STREAM_FLAG_CODECCONFIG)){
+    //The last NAL unit ends with the buffer
+    if (nal_scanner_flush (scanner, &nal)){
+      validator_entry (validator, &nal, buffer->data, base);
+    }
+  }else if (scanner->open){
+    //Keep the first bytes of the NAL unit that continues
+    if (scanner->nal.offset >= base){
+      validator->head_length = scanner->position - scanner->nal.offset;
+      if (validator->head_length > VALIDATE_HEADER_SIZE){
+        validator->head_length = VALIDATE_HEADER_SIZE;
+      }
+      memcpy (validator->head, buffer->data + (scanner->nal.offset - base),
+          validator->head_length);
+    }else if (validator->head_length < VALIDATE_HEADER_SIZE){
+      uint32_t length = VALIDATE_HEADER_SIZE - validator->head_length;
+      if (length > buffer->length) length = buffer->length;
+      memcpy (validator->head + validator->head_length, buffer->data, length);
+      validator->head_length += length;
+    }
+  }
+  if (buffer->length >= VALIDATE_TAIL_SIZE){
+    memcpy (validator->tail, buffer->data + buffer->length - VALIDATE_TAIL_SIZE,
+        VALIDATE_TAIL_SIZE);
+  }else{
+    memmove (validator->tail, validator->tail + buffer->length,
+        VALIDATE_TAIL_SIZE - buffer->length);
+    memcpy (validator->tail + VALIDATE_TAIL_SIZE - buffer->length,
+        buffer->data, buffer->length);
+  }
+
+  if ((buffer->flags & STREAM_FLAG_ENDOFFRAME) &&
+      !(buffer->flags & STREAM_FLAG_CODECCONFIG)){
+    int sync = (buffer->flags & STREAM_FLAG_SYNCFRAME) != 0;
+    if (sync != (validator->idr_slices > 0)){
+      validator_error (validator, validator->picture_offset, sync ?
+          "sync frame without IDR slices" : "IDR slices in a non-sync frame");
+    }
+    validator->idr_slices = 0;
+    validator->frames++;
+  }
+
+  clock_gettime (CLOCK_THREAD_CPUTIME_ID, &end);
+  validator->cpu.tv_sec += end.tv_sec - start.tv_sec;
+  validator->cpu.tv_nsec += end.tv_nsec - start.tv_nsec;
+}
+
+void validator_close (validator_t* validator){
+  double cpu = validator->cpu.tv_sec + validator->cpu.tv_nsec/1.0e9;
+  double frame = validator->frames ? cpu/validator->frames : 0;
+  printf ("validate: %u frames, %u NAL units, %u errors, cpu %.1f us/frame "
+      "(%.2f%% of a core)\n", validator->frames, validator->nals_length,
+      validator->errors, frame*1.0e6, frame*validator->framerate*100);
+}
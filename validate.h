@@ -0,0 +1,84 @@
+#ifndef VALIDATE_H
+#define VALIDATE_H
+
+#include <stdint.h>
+#include <time.h>
+
+#include "nal.h"
+#include "paramsets.h"
+#include "stream.h"
+
+/*
+Online validator of the encoded stream. Every buffer is scanned for NAL units
+(nal_scan()), the SPS/PPS and the slice headers are parsed and the stream is
+checked for:
+
+- a profile different from the configured one, or a resolution and frame rate
+  beyond the limits of the signaled level
+- slices that refer to a PPS or SPS that hasn't been received, or with an
+  invalid header
+- gaps in frame_num, a stream that doesn't start with an IDR frame, or more
+  frames than the IDR period without an IDR frame
+- buffers flagged as sync frames without an IDR slice, and the other way round
+- truncated NAL units: no rbsp_stop_one_bit at the end, or a header shorter than
+  its fields
+
+Every error is printed with the byte offset of the NAL unit in the stream and
+the timestamp of its buffer. Only the first bytes of every NAL unit are read, so
+the cost doesn't depend on the bitrate as much as on the number of NAL units.
+*/
+
+//Bytes of a NAL unit that are parsed, enough for any slice header field used
+#define VALIDATE_HEADER_SIZE 64
+//Maximum NAL units reported by nal_scan() per buffer
+#define VALIDATE_NALS_MAX 64
+//Bytes kept from the end of the previous buffers, a 4-byte start code
+#define VALIDATE_TAIL_SIZE 4
+
+typedef struct {
+  //Configuration
+  uint8_t profile_idc;
+  uint32_t framerate;
+  uint32_t idr_period;
+  nal_scanner_t scanner;
+  nal_entry_t nals[VALIDATE_NALS_MAX];
+  //First bytes of the NAL unit that continues in the next buffer
+  uint8_t head[VALIDATE_HEADER_SIZE];
+  uint32_t head_length;
+  //Last bytes of the previous buffers, to find the end of a NAL unit
+  uint8_t tail[VALIDATE_TAIL_SIZE];
+  //Parameter sets by id
+  sps_t sps[32];
+  uint32_t sps_valid;
+  pps_t pps[256];
+  uint8_t pps_valid[256];
+  //Current picture
+  int picture;
+  uint64_t picture_offset;
+  int idr_slices;
+  uint32_t frame_num;
+  int reference;
+  //Previous picture
+  int previous;
+  uint32_t previous_frame_num;
+  int previous_reference;
+  uint32_t frames_since_idr;
+  int idr_seen;
+  int64_t timestamp;
+  //Statistics
+  uint32_t frames;
+  uint32_t nals_length;
+  uint32_t errors;
+  struct timespec cpu;
+} validator_t;
+
+void validator_init (
+    validator_t* validator,
+    uint8_t profile_idc,
+    uint32_t framerate,
+    uint32_t idr_period);
+void validator_write (validator_t* validator, stream_buffer_t* buffer);
+//Prints the summary
+void validator_close (validator_t* validator);
+
+#endif
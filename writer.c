@@ -0,0 +1,381 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rt.h"
+#include "writer.h"
+
+static int64_t writer_time (){
+  struct timespec spec;
+  clock_gettime (CLOCK_MONOTONIC, &spec);
+  return (int64_t)spec.tv_sec*1000000 + spec.tv_nsec/1000;
+}
+
+static int writer_pending (writer_stream_t* stream){
+  return stream->head > stream->tail || stream->marks_length;
+}
+
+//Next stream of the round-robin that has work and no thread. Called with the
+//mutex locked
+static writer_stream_t* writer_pick (writer_t* writer){
+  int i;
+  for (i=0; i<writer->streams_length; i++){
+    int index = (writer->next + i)%writer->streams_length;
+    writer_stream_t* stream = writer->streams[index];
+    if (!stream->busy && writer_pending (stream)){
+      writer->next = index + 1;
+      return stream;
+    }
+  }
+  return 0;
+}
+
+//Writes everything or exits, the files are regular files
+static void writer_writev_fd (int fd, struct iovec* iov, int iovcnt){
+  ssize_t n;
+
+  while (iovcnt){
+    if ((n = writev (fd, iov, iovcnt)) == -1){
+      if (errno == EINTR) continue;
+      fprintf (stderr, "error: writev\n");
+      exit (1);
+    }
+    while (iovcnt && (size_t)n >= iov->iov_len){
+      n -= iov->iov_len;
+      iov++;
+      iovcnt--;
+    }
+    if (iovcnt){
+      iov->iov_base = (uint8_t*)iov->iov_base + n;
+      iov->iov_len -= n;
+    }
+  }
+}
+
+//Serves a quantum of the data of a stream, or its next rotation or job.
+//Called with the mutex locked, it's unlocked during the I/O
+static void writer_serve (writer_t* writer, writer_stream_t* stream){
+  int64_t now = writer_time ();
+  int64_t wait = now - stream->ready;
+
+  stream->busy = 1;
+  stream->services++;
+  stream->wait_sum += wait;
+  if (wait > stream->wait_max) stream->wait_max = wait;
+
+  writer_mark_t* mark = &stream->marks[stream->marks_head];
+  if (stream->marks_length && mark->position == stream->tail){
+    writer_mark_t current = *mark;
+    stream->marks_head = (stream->marks_head + 1)%WRITER_MARKS;
+    stream->marks_length--;
+    if (current.fd != -1){
+      stream->fd = current.fd;
+    }else{
+      pthread_mutex_unlock (&writer->mutex);
+      current.function (current.arg);
+      pthread_mutex_lock (&writer->mutex);
+      stream->jobs++;
+    }
+  }else{
+    //Up to the next mark, the data after it goes to another file
+    uint64_t end = stream->head;
+    if (stream->marks_length && mark->position < end) end = mark->position;
+    if (end - stream->tail > writer->quantum){
+      end = stream->tail + writer->quantum;
+    }
+    size_t length = end - stream->tail;
+    size_t offset = stream->tail%stream->size;
+    struct iovec iov[2];
+    iov[0].iov_base = stream->data + offset;
+    iov[0].iov_len = length < stream->size - offset ? length :
+        stream->size - offset;
+    iov[1].iov_base = stream->data;
+    iov[1].iov_len = length - iov[0].iov_len;
+    int fd = stream->fd;
+
+    //The producer only writes after the head, the data can be read unlocked
+    pthread_mutex_unlock (&writer->mutex);
+    writer_writev_fd (fd, iov, iov[1].iov_len ? 2 : 1);
+    int64_t time = writer_time () - now;
+    pthread_mutex_lock (&writer->mutex);
+
+    stream->tail = end;
+    stream->written += length;
+    stream->write_time += time;
+  }
+
+  stream->busy = 0;
+  //The stream waits for its next turn
+  stream->ready = writer_pending (stream) ? writer_time () : -1;
+  pthread_cond_broadcast (&writer->served);
+}
+
+static void* writer_loop (void* arg){
+  writer_t* writer = (writer_t*)arg;
+  writer_stream_t* stream;
+
+  rt_thread (RT_WRITER);
+
+  pthread_mutex_lock (&writer->mutex);
+  while (1){
+    if ((stream = writer_pick (writer))){
+      writer_serve (writer, stream);
+      continue;
+    }
+    if (writer->stop) break;
+    pthread_cond_wait (&writer->work, &writer->mutex);
+  }
+  pthread_mutex_unlock (&writer->mutex);
+
+  return 0;
+}
+
+void writer_init (writer_t* writer, int threads, size_t quantum){
+  int i;
+
+  memset (writer, 0, sizeof (writer_t));
+  if (threads < 1) threads = 1;
+  if (threads > WRITER_THREADS_MAX) threads = WRITER_THREADS_MAX;
+  writer->quantum = quantum ? quantum : WRITER_QUANTUM;
+  writer->start = writer_time ();
+
+  if (pthread_mutex_init (&writer->mutex, 0) ||
+      pthread_cond_init (&writer->work, 0) ||
+      pthread_cond_init (&writer->served, 0)){
+    fprintf (stderr, "error: pthread_mutex_init\n");
+    exit (1);
+  }
+  for (i=0; i<threads; i++){
+    if (pthread_create (&writer->threads[i], 0, writer_loop, writer)){
+      fprintf (stderr, "error: pthread_create\n");
+      exit (1);
+    }
+  }
+  writer->threads_length = threads;
+}
+
+void writer_close (writer_t* writer){
+  int i;
+
+  pthread_mutex_lock (&writer->mutex);
+  writer->stop = 1;
+  pthread_cond_broadcast (&writer->work);
+  pthread_mutex_unlock (&writer->mutex);
+  for (i=0; i<writer->threads_length; i++){
+    if (pthread_join (writer->threads[i], 0)){
+      fprintf (stderr, "error: pthread_join\n");
+      exit (1);
+    }
+  }
+
+  pthread_mutex_destroy (&writer->mutex);
+  pthread_cond_destroy (&writer->work);
+  pthread_cond_destroy (&writer->served);
+}
+
+writer_stream_t* writer_stream_open (writer_t* writer, const char* name,
+    int fd, size_t size){
+  writer_stream_t* stream = calloc (1, sizeof (writer_stream_t));
+  if (!stream || (size && !(stream->data = malloc (size)))){
+    fprintf (stderr, "error: malloc\n");
+    exit (1);
+  }
+  stream->writer = writer;
+  stream->name = name;
+  stream->fd = fd;
+  stream->queued_fd = fd;
+  stream->size = size;
+  stream->ready = -1;
+  stream->opened = writer_time ();
+
+  pthread_mutex_lock (&writer->mutex);
+  if (writer->streams_length == WRITER_STREAMS_MAX){
+    fprintf (stderr, "error: writer: too many streams\n");
+    exit (1);
+  }
+  writer->streams[writer->streams_length++] = stream;
+  pthread_mutex_unlock (&writer->mutex);
+
+  return stream;
+}
+
+//Wakes up a thread for new work. Called with the mutex locked
+static void writer_signal (writer_stream_t* stream){
+  if (stream->ready < 0 && !stream->busy) stream->ready = writer_time ();
+  pthread_cond_signal (&stream->writer->work);
+}
+
+int writer_writev (writer_stream_t* stream, const struct iovec* iov,
+    int iovcnt){
+  writer_t* writer = stream->writer;
+  size_t length = 0;
+  int i;
+
+  for (i=0; i<iovcnt; i++){
+    length += iov[i].iov_len;
+  }
+
+  //The threads only move the tail forward, the room can only grow
+  pthread_mutex_lock (&writer->mutex);
+  size_t room = stream->size - (stream->head - stream->tail);
+  if (length > room) stream->refused++;
+  pthread_mutex_unlock (&writer->mutex);
+  if (length > room) return 0;
+
+  size_t offset = stream->head%stream->size;
+  for (i=0; i<iovcnt; i++){
+    const uint8_t* data = (const uint8_t*)iov[i].iov_base;
+    size_t left = iov[i].iov_len;
+    while (left){
+      size_t n = left < stream->size - offset ? left : stream->size - offset;
+      memcpy (stream->data + offset, data, n);
+      data += n;
+      left -= n;
+      offset = (offset + n)%stream->size;
+    }
+  }
+
+  pthread_mutex_lock (&writer->mutex);
+  stream->head += length;
+  if (stream->head - stream->tail > stream->peak){
+    stream->peak = stream->head - stream->tail;
+  }
+  writer_signal (stream);
+  pthread_mutex_unlock (&writer->mutex);
+  return 1;
+}
+
+int writer_write (writer_stream_t* stream, const void* data, size_t length){
+  struct iovec iov;
+  iov.iov_base = (void*)data;
+  iov.iov_len = length;
+  return writer_writev (stream, &iov, 1);
+}
+
+//Queues a rotation or a job at the current position
+static void writer_mark (writer_stream_t* stream, writer_mark_t* mark){
+  writer_t* writer = stream->writer;
+
+  pthread_mutex_lock (&writer->mutex);
+  while (stream->marks_length == WRITER_MARKS){
+    pthread_cond_wait (&writer->served, &writer->mutex);
+  }
+  mark->position = stream->head;
+  stream->marks[(stream->marks_head + stream->marks_length)%WRITER_MARKS] =
+      *mark;
+  stream->marks_length++;
+  writer_signal (stream);
+  pthread_mutex_unlock (&writer->mutex);
+}
+
+int writer_rotate (writer_stream_t* stream, int fd){
+  writer_mark_t mark;
+  int previous = stream->queued_fd;
+
+  mark.fd = fd;
+  mark.function = 0;
+  mark.arg = 0;
+  writer_mark (stream, &mark);
+  stream->queued_fd = fd;
+  return previous;
+}
+
+void writer_job (writer_stream_t* stream, void (*function) (void* arg),
+    void* arg){
+  writer_mark_t mark;
+  mark.fd = -1;
+  mark.function = function;
+  mark.arg = arg;
+  writer_mark (stream, &mark);
+}
+
+void writer_flush (writer_stream_t* stream){
+  writer_t* writer = stream->writer;
+
+  pthread_mutex_lock (&writer->mutex);
+  while (writer_pending (stream) || stream->busy){
+    pthread_cond_wait (&writer->served, &writer->mutex);
+  }
+  pthread_mutex_unlock (&writer->mutex);
+}
+
+int writer_stream_dump (writer_stream_t* stream, char* str, size_t size){
+  writer_t* writer = stream->writer;
+
+  pthread_mutex_lock (&writer->mutex);
+  double seconds = (writer_time () - stream->opened)/1.0e6;
+  int n = snprintf (str, size, "%s: %llu bytes, %.2f MB/s, %u refused, peak "
+      "%llu KiB, %u jobs, wait avg %.2f ms max %.2f ms, write %.2f s",
+      stream->name, (unsigned long long)stream->written,
+      seconds > 0 ? stream->written/seconds/1.0e6 : 0, stream->refused,
+      (unsigned long long)stream->peak/1024, stream->jobs,
+      stream->services ? stream->wait_sum/1000.0/stream->services : 0,
+      stream->wait_max/1000.0, stream->write_time/1.0e6);
+  pthread_mutex_unlock (&writer->mutex);
+  return n;
+}
+
+//Jain's index of the average wait of every stream, from 1/n (one stream does
+//all the waiting) to 1 (even). Called with the mutex locked
+static double writer_fairness (writer_t* writer){
+  double sum = 0;
+  double sum2 = 0;
+  int n = 0;
+  int i;
+
+  for (i=0; i<writer->streams_length; i++){
+    writer_stream_t* stream = writer->streams[i];
+    if (!stream->services) continue;
+    double wait = (double)stream->wait_sum/stream->services;
+    sum += wait;
+    sum2 += wait*wait;
+    n++;
+  }
+  return sum2 > 0 ? sum*sum/(n*sum2) : 1;
+}
+
+int writer_dump (writer_t* writer, char* str, size_t size){
+  writer_stream_t* streams[WRITER_STREAMS_MAX];
+  int n = 0;
+  int i;
+
+  pthread_mutex_lock (&writer->mutex);
+  int length = writer->streams_length;
+  memcpy (streams, writer->streams, length*sizeof (writer_stream_t*));
+  double fairness = writer_fairness (writer);
+  pthread_mutex_unlock (&writer->mutex);
+
+  n += snprintf (str, size, "%d threads, %d streams, fairness %.3f",
+      writer->threads_length, length, fairness);
+  for (i=0; i<length && n < (int)size; i++){
+    n += snprintf (str + n, size - n, "; ");
+    if (n < (int)size) n += writer_stream_dump (streams[i], str + n, size - n);
+  }
+  return n;
+}
+
+int writer_stream_close (writer_stream_t* stream){
+  writer_t* writer = stream->writer;
+  char stats[256];
+  int i;
+
+  writer_flush (stream);
+  writer_stream_dump (stream, stats, sizeof (stats));
+  printf ("writer %s\n", stats);
+
+  pthread_mutex_lock (&writer->mutex);
+  for (i=0; i<writer->streams_length && writer->streams[i] != stream; i++);
+  memmove (writer->streams + i, writer->streams + i + 1,
+      (writer->streams_length - i - 1)*sizeof (writer_stream_t*));
+  writer->streams_length--;
+  if (writer->next > i) writer->next--;
+  pthread_mutex_unlock (&writer->mutex);
+
+  int fd = stream->fd;
+  free (stream->data);
+  free (stream);
+  return fd;
+}
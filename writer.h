@@ -0,0 +1,130 @@
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+/*
+Writer threads shared by all the file outputs of all the cameras, and the
+scheduler of their I/O. Without them the encoder loop writes the regular files
+itself and a slow disk stalls every camera.
+
+Every output has a stream: the encoder loop copies the data into the buffer of
+the stream and returns at once. If the buffer is full the data is refused and
+the output drops the frame, like the network outputs do. The threads take turns
+between the streams that have data: a stream is served at most
+WRITER_QUANTUM bytes at a time (round-robin by bytes), so a camera with a high
+bitrate cannot starve the others, and a stream is served by a single thread at
+a time, so its data reaches the file in order while the other streams are
+written by the other threads.
+
+The jobs of the outputs (fsync, rename and playlist of the segments, the JPEG
+stills) are queued in the streams too. A job runs after the data queued before
+it has been written, and a rotation to a new file descriptor applies at the
+same position, so a segment is finished when its last byte is on its file. A
+stream can also be used for jobs only.
+
+For every stream the time from the moment it has data to the moment a thread
+serves it is measured. The Jain's fairness index of the average waits (1 when
+all the streams wait the same) is printed with the throughput of every stream.
+*/
+
+#define WRITER_THREADS_MAX 8
+#define WRITER_STREAMS_MAX 32
+//Bytes written for a stream before the next one is served
+#define WRITER_QUANTUM (256*1024)
+//Rotations and jobs waiting in a stream
+#define WRITER_MARKS 32
+
+typedef struct writer_s writer_t;
+
+typedef struct {
+  //Position in the data of the stream where it applies
+  uint64_t position;
+  //New file descriptor, or -1 for a job
+  int fd;
+  void (*function) (void* arg);
+  void* arg;
+} writer_mark_t;
+
+typedef struct {
+  writer_t* writer;
+  const char* name;
+  //File descriptor of the data being written, and of the data being queued
+  int fd;
+  int queued_fd;
+  uint8_t* data;
+  size_t size;
+  //Bytes queued and written since the beginning, the data between them is in
+  //the buffer
+  uint64_t head;
+  uint64_t tail;
+  writer_mark_t marks[WRITER_MARKS];
+  int marks_head;
+  int marks_length;
+  //Served by a thread
+  int busy;
+  //Since when it waits for a thread (us), -1 if it has nothing to write
+  int64_t ready;
+  //Statistics, since the stream was opened (us)
+  int64_t opened;
+  uint64_t written;
+  uint32_t refused;
+  uint64_t peak;
+  uint32_t jobs;
+  uint32_t services;
+  int64_t wait_sum;
+  int64_t wait_max;
+  int64_t write_time;
+} writer_stream_t;
+
+struct writer_s {
+  pthread_t threads[WRITER_THREADS_MAX];
+  int threads_length;
+  size_t quantum;
+  //Everything below is protected by the mutex
+  pthread_mutex_t mutex;
+  //Signaled when a stream has work, and when a stream has been served
+  pthread_cond_t work;
+  pthread_cond_t served;
+  writer_stream_t* streams[WRITER_STREAMS_MAX];
+  int streams_length;
+  //Next stream of the round-robin
+  int next;
+  int stop;
+  int64_t start;
+};
+
+//Starts the threads, at least 1. quantum is the number of bytes served at a
+//time, 0 for WRITER_QUANTUM
+void writer_init (writer_t* writer, int threads, size_t quantum);
+//Stops the threads, the streams must be closed
+void writer_close (writer_t* writer);
+//Adds a stream that writes to fd with a buffer of size bytes. size can be 0
+//for the jobs only, fd -1
+writer_stream_t* writer_stream_open (writer_t* writer, const char* name,
+    int fd, size_t size);
+//Queues the data, all of it or nothing. Returns 0 if it doesn't fit
+int writer_write (writer_stream_t* stream, const void* data, size_t length);
+int writer_writev (writer_stream_t* stream, const struct iovec* iov,
+    int iovcnt);
+//The data queued from now on goes to fd. Returns the previous file descriptor,
+//it must not be used before the data queued until now has been written (a job
+//queued now runs after that)
+int writer_rotate (writer_stream_t* stream, int fd);
+//Runs function (arg) in a writer thread after the data queued until now has
+//been written. It waits if there are WRITER_MARKS jobs waiting
+void writer_job (writer_stream_t* stream, void (*function) (void* arg),
+    void* arg);
+//Waits until everything queued until now has been written and run
+void writer_flush (writer_stream_t* stream);
+//Flushes the stream, prints its statistics and releases it. Returns the file
+//descriptor, that is closed by the caller
+int writer_stream_close (writer_stream_t* stream);
+//Prints the statistics of a stream, and of all of them in a string
+int writer_stream_dump (writer_stream_t* stream, char* str, size_t size);
+int writer_dump (writer_t* writer, char* str, size_t size);
+
+#endif